@@ -27,11 +27,143 @@
  * POSSIBILITY OF SUCH DAMAGE.
  **/
 
+#include <string.h>
+
+#include <glib.h>
 #include <psmoveapi/psmove.h>
 
+/* Poll interval (in ms) if a controller has no pollable file descriptor */
+#define PS_MOVE_API_SOURCE_FALLBACK_MS 4
+
 static PSMove *_glib_move;
 static char _glib_move_r, _glib_move_g, _glib_move_b;
 
+/* Input collected since the last dispatch of a PsMoveApiSource */
+typedef struct {
+    int reports;
+    unsigned int buttons;
+    unsigned int pressed;
+    unsigned int released;
+} PsMoveApiBatch;
+
+/* The batch of the dispatch that is currently running (see get_*()) */
+static PsMoveApiBatch _glib_batch;
+
+typedef void (*PsMoveApiImplInputFunc)(gpointer user_data);
+
+/**
+ * A GSource that becomes ready when the controller has new input.
+ *
+ * If the controller is accessed through hidraw, its file descriptor is
+ * added to the main loop's poll set, so the main loop sleeps until a
+ * report arrives. Otherwise (e.g. remote controllers), the source falls
+ * back to checking for input every few milliseconds.
+ **/
+typedef struct {
+    GSource source;
+    PSMove *move;
+    GPollFD pollfd;
+    gboolean pollable;
+    gboolean disconnected;
+    PsMoveApiBatch batch;
+} PsMoveApiSource;
+
+static void
+ps_move_api_source_collect(PsMoveApiSource *source)
+{
+    unsigned int pressed, released;
+
+    /* Read all pending reports, so the batch contains every button
+     * change, and the sensor values are those of the newest report */
+    while (psmove_poll(source->move)) {
+        source->batch.reports++;
+        source->batch.buttons |= psmove_get_buttons(source->move);
+        psmove_get_button_events(source->move, &pressed, &released);
+        source->batch.pressed |= pressed;
+        source->batch.released |= released;
+    }
+}
+
+static gboolean
+ps_move_api_source_prepare(GSource *gsource, gint *timeout)
+{
+    PsMoveApiSource *source = (PsMoveApiSource*)gsource;
+
+    *timeout = source->pollable ? -1 : PS_MOVE_API_SOURCE_FALLBACK_MS;
+    return source->batch.reports > 0;
+}
+
+static gboolean
+ps_move_api_source_check(GSource *gsource)
+{
+    PsMoveApiSource *source = (PsMoveApiSource*)gsource;
+
+    if (source->pollfd.revents & (G_IO_HUP | G_IO_ERR)) {
+        /* The device node is gone, dispatch once more to remove us */
+        source->disconnected = TRUE;
+        return TRUE;
+    }
+
+    if (source->pollable && !(source->pollfd.revents & G_IO_IN)) {
+        return source->batch.reports > 0;
+    }
+
+    ps_move_api_source_collect(source);
+    return source->batch.reports > 0;
+}
+
+static gboolean
+ps_move_api_source_dispatch(GSource *gsource, GSourceFunc callback,
+        gpointer user_data)
+{
+    PsMoveApiSource *source = (PsMoveApiSource*)gsource;
+
+    if (source->disconnected) {
+        return FALSE;
+    }
+
+    _glib_batch = source->batch;
+    memset(&(source->batch), 0, sizeof(source->batch));
+
+    if (callback != NULL) {
+        ((PsMoveApiImplInputFunc)callback)(user_data);
+    }
+
+    return TRUE;
+}
+
+static GSourceFuncs
+ps_move_api_source_funcs = {
+    ps_move_api_source_prepare,
+    ps_move_api_source_check,
+    ps_move_api_source_dispatch,
+    NULL,
+};
+
+static GSource *
+ps_move_api_source_new(PSMove *move)
+{
+    GSource *gsource = g_source_new(&ps_move_api_source_funcs,
+            sizeof(PsMoveApiSource));
+    PsMoveApiSource *source = (PsMoveApiSource*)gsource;
+    int fd = psmove_get_fd(move);
+
+    source->move = move;
+    source->disconnected = FALSE;
+    memset(&(source->batch), 0, sizeof(source->batch));
+
+    if (fd != -1) {
+        source->pollfd.fd = fd;
+        source->pollfd.events = G_IO_IN | G_IO_HUP | G_IO_ERR;
+        source->pollable = TRUE;
+        g_source_add_poll(gsource, &(source->pollfd));
+    } else {
+        source->pollable = FALSE;
+    }
+
+    return gsource;
+}
+
 void ps_move_api_impl_init()
 {
     _glib_move = psmove_connect();
@@ -56,3 +188,51 @@ void ps_move_api_impl_rumble()
     psmove_update_leds(_glib_move);
 }
 
+
+guint ps_move_api_impl_watch(PsMoveApiImplInputFunc func, gpointer user_data,
+        GDestroyNotify notify)
+{
+    GSource *source = ps_move_api_source_new(_glib_move);
+    guint id;
+
+    g_source_set_callback(source, (GSourceFunc)func, user_data, notify);
+    id = g_source_attach(source, NULL);
+    g_source_unref(source);
+
+    return id;
+}
+
+guint ps_move_api_impl_get_buttons()
+{
+    return _glib_batch.buttons;
+}
+
+guint ps_move_api_impl_get_pressed()
+{
+    return _glib_batch.pressed;
+}
+
+guint ps_move_api_impl_get_released()
+{
+    return _glib_batch.released;
+}
+
+int ps_move_api_impl_get_reports()
+{
+    return _glib_batch.reports;
+}
+
+int ps_move_api_impl_get_trigger()
+{
+    return psmove_get_trigger(_glib_move);
+}
+
+void ps_move_api_impl_get_accelerometer(int *x, int *y, int *z)
+{
+    psmove_get_accelerometer(_glib_move, x, y, z);
+}
+
+void ps_move_api_impl_get_gyroscope(int *x, int *y, int *z)
+{
+    psmove_get_gyroscope(_glib_move, x, y, z);
+}
@@ -1,4 +1,5 @@
 
+const Mainloop = imports.mainloop;
 const PsMoveApi = imports.gi.PsMoveApi;
 
 PsMoveApi.init();
@@ -9,3 +10,13 @@ for (var i=0; i<1000; i++) {
     c.r = (c.r + 2) % 255;
 }
 
+/* Input is delivered by the main loop, without polling from a timeout */
+c.connect('input', function (controller, sample) {
+    print('reports: ' + sample.reports + ' buttons: ' + sample.buttons +
+          ' trigger: ' + sample.trigger +
+          ' accel: ' + [sample.ax, sample.ay, sample.az]);
+});
+c.watch();
+
+Mainloop.run();
+
@@ -1,20 +1,81 @@
 
 namespace PsMoveApi {
     namespace Impl {
+        public delegate void InputFunc();
+
         extern void init();
         extern int get_r();
         extern void set_r(int r);
+
+        extern uint watch(owned InputFunc func);
+        extern uint get_buttons();
+        extern uint get_pressed();
+        extern uint get_released();
+        extern int get_reports();
+        extern int get_trigger();
+        extern void get_accelerometer(out int x, out int y, out int z);
+        extern void get_gyroscope(out int x, out int y, out int z);
     }
 
     public void init() {
         Impl.init();
     }
 
+    /* All input received since the last "input" signal */
+    public struct Sample {
+        public int reports;
+        public uint buttons;
+        public uint pressed;
+        public uint released;
+        public int trigger;
+        public int ax;
+        public int ay;
+        public int az;
+        public int gx;
+        public int gy;
+        public int gz;
+    }
+
     public class Controller : Object {
+        private uint watch_id = 0;
+
         public int r {
             get { return Impl.get_r(); }
             set { Impl.set_r(value); }
         }
+
+        /* Emitted from the main loop when new input has arrived */
+        public signal void input(Sample sample);
+
+        /* Start emitting "input" from the default main context
+         * (the main loop keeps the controller alive until unwatch()) */
+        public void watch() {
+            if (watch_id == 0) {
+                watch_id = Impl.watch(dispatch);
+            }
+        }
+
+        /* Stop emitting "input" */
+        public void unwatch() {
+            if (watch_id != 0) {
+                Source.remove(watch_id);
+                watch_id = 0;
+            }
+        }
+
+        private void dispatch() {
+            Sample sample = Sample();
+
+            sample.reports = Impl.get_reports();
+            sample.buttons = Impl.get_buttons();
+            sample.pressed = Impl.get_pressed();
+            sample.released = Impl.get_released();
+            sample.trigger = Impl.get_trigger();
+            Impl.get_accelerometer(out sample.ax, out sample.ay, out sample.az);
+            Impl.get_gyroscope(out sample.gx, out sample.gy, out sample.gz);
+
+            input(sample);
+        }
     }
 }
 
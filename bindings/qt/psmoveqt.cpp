@@ -34,13 +34,93 @@
 #  include <QtDeclarative>
 #endif
 
-/* Update interval for sensor readings and LED setting */
-#define INTERVAL_SENSORS 10
+/* Update interval for the LED setting */
 #define INTERVAL_RGBLEDS 4000
 
+/* How long the reader thread waits for a report before checking for exit */
+#define READER_TIMEOUT_MS 100
+
+int
+PSMoveQtBatch::read(PSMove *move, bool current)
+{
+    int count = 0;
+
+    while (current || psmove_poll(move)) {
+        current = false;
+        count++;
+
+        trigger = psmove_get_trigger(move);
+        psmove_get_accelerometer(move, &ax, &ay, &az);
+        psmove_get_gyroscope(move, &gx, &gy, &gz);
+        psmove_get_magnetometer(move, &mx, &my, &mz);
+        battery = psmove_get_battery(move);
+        buttons = psmove_get_buttons(move);
+
+        /* Keep the events of all reports, the values of the last one */
+        unsigned int p, r;
+        psmove_get_button_events(move, &p, &r);
+        pressed |= p;
+        released |= r;
+    }
+
+    return count;
+}
+
+PSMoveQtReader::PSMoveQtReader(PSMove *move, QObject *parent)
+    : QThread(parent),
+      _move(move),
+      _mutex(),
+      _batch(),
+      _pending(false),
+      _running(true)
+{
+}
+
+PSMoveQtReader::~PSMoveQtReader()
+{
+    _running = false;
+    wait();
+}
+
+bool
+PSMoveQtReader::takeBatch(PSMoveQtBatch &batch)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!_pending) {
+        return false;
+    }
+
+    batch = _batch;
+    _batch.pressed = _batch.released = 0;
+    _pending = false;
+    return true;
+}
+
+void
+PSMoveQtReader::run()
+{
+    while (_running) {
+        if (!psmove_wait_for_input(_move, READER_TIMEOUT_MS)) {
+            continue;
+        }
+
+        QMutexLocker locker(&_mutex);
+        _batch.read(_move, true);
+
+        /* Until the batch is taken, later reports are merged into it */
+        if (!_pending) {
+            _pending = true;
+            emit batchReady();
+        }
+    }
+}
+
 PSMoveQt::PSMoveQt(int index)
     : _move(psmove_connect_by_id(index)),
-      _timer(),
+      _enabled(false),
+      _notifier(NULL),
+      _reader(NULL),
       _colorTimer(),
       _index(index),
       _trigger(0),
@@ -60,8 +140,6 @@ PSMoveQt::PSMoveQt(int index)
       _buttons(0),
       _battery(0)
 {
-    _timer.setInterval(INTERVAL_SENSORS);
-
     /**
      * Re-sending the LED color value every 4 secs should be enough.
      * For this we need a timer, and when color and/or rumble are
@@ -75,14 +153,14 @@ PSMoveQt::PSMoveQt(int index)
     connect(this, SIGNAL(rumbleChanged()),
             this, SLOT(checkColorTimer()));
 
-    connect(&_timer, SIGNAL(timeout()),
-            this, SLOT(onTimeout()));
     connect(&_colorTimer, SIGNAL(timeout()),
             this, SLOT(onColorTimeout()));
 }
 
 PSMoveQt::~PSMoveQt()
 {
+    stopReading();
+
     if (_move != NULL) {
         /* Switch off LEDs + rumble on exit */
         setColor(Qt::black);
@@ -132,23 +210,59 @@ PSMoveQt::registerQML()
 bool
 PSMoveQt::enabled() const
 {
-    return _timer.isActive();
+    return _enabled;
 }
 
 void
 PSMoveQt::setEnabled(bool enabled)
 {
-    if (enabled && !_timer.isActive()) {
+    if (enabled && !_enabled) {
         /* Activate */
-        _timer.start();
+        _enabled = true;
+        startReading();
         emit enabledChanged();
-    } else if (!enabled && _timer.isActive()) {
+    } else if (!enabled && _enabled) {
         /* Deactivate */
-        _timer.stop();
+        _enabled = false;
+        stopReading();
         emit enabledChanged();
     }
 }
 
+void
+PSMoveQt::startReading()
+{
+    if (_move == NULL) {
+        return;
+    }
+
+    /**
+     * Wake up only when reports arrive: on the device node if there is one,
+     * otherwise from a reader thread that hands the reports over in batches
+     **/
+    int fd = psmove_get_fd(_move);
+    if (fd != -1) {
+        _notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+        connect(_notifier, SIGNAL(activated(int)),
+                this, SLOT(onActivated()));
+    } else {
+        _reader = new PSMoveQtReader(_move, this);
+        connect(_reader, SIGNAL(batchReady()),
+                this, SLOT(onBatchReady()), Qt::QueuedConnection);
+        _reader->start();
+    }
+}
+
+void
+PSMoveQt::stopReading()
+{
+    delete _notifier;
+    _notifier = NULL;
+
+    delete _reader;
+    _reader = NULL;
+}
+
 int
 PSMoveQt::trigger() const
 {
@@ -170,8 +284,12 @@ PSMoveQt::setIndex(int index)
     if (_index != index) {
         _index = index;
         PSMove *old = _move;
+        stopReading();
         _move = psmove_connect_by_id(_index);
         psmove_disconnect(old);
+        if (_enabled) {
+            startReading();
+        }
         emit indexChanged();
     }
 }
@@ -213,64 +331,77 @@ PSMoveQt::setRumble(int rumble)
 }
 
 void
-PSMoveQt::onTimeout()
+PSMoveQt::onActivated()
 {
-    int ax, ay, az, gx, gy, gz, mx, my, mz, buttons, battery;
-
-    while (psmove_poll(_move)) {
-        setTrigger(psmove_get_trigger(_move));
-        psmove_get_gyroscope(_move, &gx, &gy, &gz);
-        if (gx != _gx || gy != _gy || gz != _gz) {
-            _gx = gx;
-            _gy = gy;
-            _gz = gz;
-            emit gyroChanged();
-        }
-        psmove_get_accelerometer(_move, &ax, &ay, &az);
-        if (ax != _ax || ay != _ay || az != _az) {
-            _ax = ax;
-            _ay = ay;
-            _az = az;
-            emit accelerometerChanged();
-        }
+    PSMoveQtBatch batch;
 
-        psmove_get_magnetometer(_move, &mx, &my, &mz);
-        if (mx != _mx || my != _my || mz != _mz) {
-            _mx = mx;
-            _my = my;
-            _mz = mz;
-            emit magnetometerChanged();
-        }
+    if (batch.read(_move) > 0) {
+        applyBatch(batch);
+    }
+}
 
-        buttons = psmove_get_buttons(_move);
-        if (buttons != _buttons) {
-            unsigned int pressed, released;
-            psmove_get_button_events(_move, &pressed, &released);
-
-            for (int i=1; i<=PSMoveQt::T; i <<= 1) {
-                if (pressed & i) {
-                    emit buttonPressed(i);
-                } else if (released & i) {
-                    emit buttonReleased(i);
-                }
-            }
+void
+PSMoveQt::onBatchReady()
+{
+    PSMoveQtBatch batch;
 
-            _buttons = buttons;
-        }
+    if (_reader != NULL && _reader->takeBatch(batch)) {
+        applyBatch(batch);
+    }
+}
+
+void
+PSMoveQt::applyBatch(const PSMoveQtBatch &batch)
+{
+    /* Each signal is emitted at most once per batch of reports */
+    setTrigger(batch.trigger);
+
+    if (batch.gx != _gx || batch.gy != _gy || batch.gz != _gz) {
+        _gx = batch.gx;
+        _gy = batch.gy;
+        _gz = batch.gz;
+        emit gyroChanged();
+    }
 
-        battery = psmove_get_battery(_move);
-        if (battery != _battery) {
-            bool charging = (battery == Batt_CHARGING ||
-                    _battery == Batt_CHARGING);
+    if (batch.ax != _ax || batch.ay != _ay || batch.az != _az) {
+        _ax = batch.ax;
+        _ay = batch.ay;
+        _az = batch.az;
+        emit accelerometerChanged();
+    }
 
-            _battery = battery;
+    if (batch.mx != _mx || batch.my != _my || batch.mz != _mz) {
+        _mx = batch.mx;
+        _my = batch.my;
+        _mz = batch.mz;
+        emit magnetometerChanged();
+    }
 
-            if (charging) {
-                emit chargingChanged();
-            } else if (_battery != Batt_CHARGING) {
-                emit batteryChanged(_battery);
+    if (batch.pressed || batch.released) {
+        for (int i=1; i<=PSMoveQt::T; i <<= 1) {
+            if (batch.pressed & i) {
+                emit buttonPressed(i);
             }
         }
+        for (int i=1; i<=PSMoveQt::T; i <<= 1) {
+            if (batch.released & i) {
+                emit buttonReleased(i);
+            }
+        }
+    }
+    _buttons = batch.buttons;
+
+    if (batch.battery != _battery) {
+        bool charging = (batch.battery == Batt_CHARGING ||
+                _battery == Batt_CHARGING);
+
+        _battery = batch.battery;
+
+        if (charging) {
+            emit chargingChanged();
+        } else if (_battery != Batt_CHARGING) {
+            emit batteryChanged(_battery);
+        }
     }
 }
 
@@ -284,7 +415,7 @@ PSMoveQt::onColorTimeout()
 void
 PSMoveQt::checkColorTimer()
 {
-    bool shouldRun = _timer.isActive() &&
+    bool shouldRun = _enabled &&
         ((_color.red() + _color.green() + _color.blue() + _rumble) > 0);
 
     if (shouldRun && !_colorTimer.isActive()) {
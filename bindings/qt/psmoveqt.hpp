@@ -36,13 +36,60 @@
 
 #include "psmove.h"
 
+/* The state after a batch of input reports, with the button events of all */
+struct PSMoveQtBatch {
+    int trigger;
+    int ax, ay, az;
+    int gx, gy, gz;
+    int mx, my, mz;
+    int buttons;
+    unsigned int pressed;
+    unsigned int released;
+    int battery;
+
+    PSMoveQtBatch() : pressed(0), released(0) {}
+
+    /* Read all reports that have arrived; returns the number of reports */
+    int read(PSMove *move, bool current=false);
+};
+
+/**
+ * Reads the reports of controllers without a file descriptor (see
+ * psmove_get_fd()) in the background, and signals batchReady() once for
+ * all reports that arrived until the previous batch was taken.
+ **/
+class PSMoveQtReader : public QThread
+{
+    Q_OBJECT
+
+    PSMove *_move;
+    QMutex _mutex;
+    PSMoveQtBatch _batch;
+    bool _pending;
+    volatile bool _running;
+
+public:
+    PSMoveQtReader(PSMove *move, QObject *parent=NULL);
+    ~PSMoveQtReader();
+
+    bool takeBatch(PSMoveQtBatch &batch);
+
+protected:
+    void run();
+
+signals:
+    void batchReady();
+};
+
 class PSMoveQt : public QObject
 {
     Q_OBJECT
     Q_ENUMS(ButtonType ConnectionType BatteryChargeNames)
 
     PSMove *_move;
-    QTimer _timer;
+    bool _enabled;
+    QSocketNotifier *_notifier;
+    PSMoveQtReader *_reader;
     QTimer _colorTimer;
 
     int _index;
@@ -63,6 +110,10 @@ class PSMoveQt : public QObject
     int _buttons;
     int _battery;
 
+    void startReading();
+    void stopReading();
+    void applyBatch(const PSMoveQtBatch &batch);
+
 public:
     PSMoveQt(int index=0);
     ~PSMoveQt();
@@ -147,7 +198,8 @@ public:
     Q_PROPERTY(int connectionType READ connectionType NOTIFY indexChanged)
 
 private slots:
-    void onTimeout();
+    void onActivated();
+    void onBatchReady();
     void onColorTimeout();
     void checkColorTimer();
 
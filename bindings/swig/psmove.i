@@ -64,9 +64,132 @@
 %}
 
 %include "psmove.h"
+%include "psmove_sample.h"
 
 typedef struct {} PSMove;
 
+#if defined(SWIGPYTHON) || defined(SWIGJAVA)
+
+/**
+ * Bulk access to the sensor values: one row of SAMPLE_COLUMNS float64
+ * values per input report, in the order of the fields of PSMoveSample
+ * (half-frames 0 and 1 of each value next to each other, see
+ * SAMPLE_FIELDS in Python).
+ **/
+%{
+#define PSMOVE_SAMPLE_COLUMNS 34
+%}
+
+%constant int SAMPLE_COLUMNS = PSMOVE_SAMPLE_COLUMNS;
+
+#endif /* defined(SWIGPYTHON) || defined(SWIGJAVA) */
+
+#if defined(SWIGPYTHON)
+
+/**
+ * For NumPy and other users of the buffer protocol, fill_sample() and
+ * fill_samples() write directly into a writable, C-contiguous float64
+ * buffer of SAMPLE_COLUMNS values per row.
+ **/
+%pythoncode %{
+# Columns of the rows written by PSMove.fill_sample() and fill_samples(),
+# in the order of the fields of PSMoveSample (half-frames 0 and 1)
+SAMPLE_FIELDS = (
+    'buttons', 'trigger0', 'trigger1', 'battery', 'temperature',
+    'timestamp0', 'timestamp1',
+    'raw_ax0', 'raw_ax1', 'raw_ay0', 'raw_ay1', 'raw_az0', 'raw_az1',
+    'raw_gx0', 'raw_gx1', 'raw_gy0', 'raw_gy1', 'raw_gz0', 'raw_gz1',
+    'ax0', 'ax1', 'ay0', 'ay1', 'az0', 'az1',
+    'gx0', 'gx1', 'gy0', 'gy1', 'gz0', 'gz1',
+    'mx', 'my', 'mz',
+)
+%}
+
+/* Errors with the buffer are raised as ValueError */
+%exception PSMove::fill_sample {
+    $action
+    if (PyErr_Occurred()) SWIG_fail;
+}
+
+%exception PSMove::fill_samples {
+    $action
+    if (PyErr_Occurred()) SWIG_fail;
+}
+
+#endif /* defined(SWIGPYTHON) */
+
+#if defined(SWIGJAVA)
+
+/**
+ * For Java, sample_buffer() maps a native ring of rows into a direct
+ * ByteBuffer (in native byte order), and fill_sample_buffer() reads all
+ * pending reports into the ring with a single JNI call:
+ *
+ *     ByteBuffer ring = move.sample_buffer(256);
+ *     int count = move.fill_sample_buffer();
+ *     int rows = ring.getInt(4);
+ *     int newest = (ring.getInt(8) + rows - 1) % rows;
+ *     double ax = ring.getDouble(psmoveapi.SAMPLE_HEADER_SIZE +
+ *             8 * (newest * psmoveapi.SAMPLE_COLUMNS + 19));
+ *
+ * The header (SAMPLE_HEADER_SIZE bytes) contains four ints: the number
+ * of rows written since the ring was created (offset 0, wrapping at
+ * 2^31), the number of rows in the ring (offset 4), the row that will
+ * be written next (offset 8) and a sequence number (offset 12) that is
+ * odd while a row is being written.
+ *
+ * Reading the ring in the thread that calls fill_sample_buffer() needs
+ * no synchronization. Other threads read the sequence number (with
+ * acquire semantics, e.g. a VarHandle of byteBufferViewVarHandle), retry
+ * while it is odd, copy the rows, and retry if it has changed since.
+ *
+ * A PSMove object has one ring for its lifetime: later calls return the
+ * same memory, or null if the number of rows differs. It is freed when
+ * the PSMove object is deleted, so the ByteBuffer must not be used after
+ * that.
+ **/
+%{
+#define PSMOVE_SAMPLE_HEADER_SIZE 16
+
+typedef struct {
+    void *data;
+    jlong size;
+} PSMoveSampleBuffer;
+
+typedef struct PSMoveSampleRing {
+    PSMove *move;
+    int rows;
+    int head; /* Row that will be written next */
+    char *data; /* header, followed by rows * PSMOVE_SAMPLE_COLUMNS doubles */
+    struct PSMoveSampleRing *next;
+} PSMoveSampleRing;
+
+/* Guards psmove_sample_rings, held only while the list is changed or searched */
+static PSMoveSampleRing *psmove_sample_rings = NULL;
+static volatile int psmove_sample_rings_lock = 0;
+%}
+
+%constant int SAMPLE_HEADER_SIZE = PSMOVE_SAMPLE_HEADER_SIZE;
+
+%typemap(jni) PSMoveSampleBuffer "jobject"
+%typemap(jtype) PSMoveSampleBuffer "java.nio.ByteBuffer"
+%typemap(jstype) PSMoveSampleBuffer "java.nio.ByteBuffer"
+%typemap(javaout) PSMoveSampleBuffer {
+    java.nio.ByteBuffer buffer = $jnicall;
+    if (buffer != null) {
+        buffer.order(java.nio.ByteOrder.nativeOrder());
+    }
+    return buffer;
+  }
+%typemap(out) PSMoveSampleBuffer {
+    $result = NULL;
+    if ($1.data != NULL) {
+        $result = JCALL2(NewDirectByteBuffer, jenv, $1.data, $1.size);
+    }
+}
+
+#endif /* defined(SWIGJAVA) */
+
 int count_connected();
 
 void reinit();
@@ -161,7 +284,30 @@ void reinit();
         return psmove_get_trigger($self);
     }
 
+#if defined(SWIGPYTHON)
+    /* Write the current report into a buffer of SAMPLE_COLUMNS float64s */
+    int fill_sample(PyObject *buffer);
+
+    /**
+     * Read all buffered reports and write the newest N of them (oldest
+     * first) into a float64 array of N rows, e.g. numpy.empty((N,
+     * psmove.SAMPLE_COLUMNS)); returns the number of rows written
+     **/
+    int fill_samples(PyObject *array);
+#endif
+
+#if defined(SWIGJAVA)
+    /* Map the ring (created on the first call) into a direct ByteBuffer */
+    PSMoveSampleBuffer sample_buffer(int rows);
+
+    /* Read all pending reports into the ring, returns the number read */
+    int fill_sample_buffer();
+#endif
+
     ~PSMove() {
+#if defined(SWIGJAVA)
+        psmove_sample_ring_free($self);
+#endif
         psmove_disconnect($self);
     }
 
@@ -251,6 +397,284 @@ PSMove_mz_get(PSMove *move) {
     return result;
 }
 
+#if defined(SWIGPYTHON) || defined(SWIGJAVA)
+
+static void
+psmove_sample_to_row(const PSMoveSample *sample, double *row)
+{
+    const int *raw[] = {
+        sample->raw_accel_x, sample->raw_accel_y, sample->raw_accel_z,
+        sample->raw_gyro_x, sample->raw_gyro_y, sample->raw_gyro_z,
+    };
+    const float *calibrated[] = {
+        sample->accel_x, sample->accel_y, sample->accel_z,
+        sample->gyro_x, sample->gyro_y, sample->gyro_z,
+    };
+    int i, n = 0;
+
+    row[n++] = sample->buttons;
+    row[n++] = sample->trigger[0];
+    row[n++] = sample->trigger[1];
+    row[n++] = sample->battery;
+    row[n++] = sample->temperature;
+    row[n++] = sample->timestamp[0];
+    row[n++] = sample->timestamp[1];
+    for (i=0; i<6; i++) {
+        row[n++] = raw[i][0];
+        row[n++] = raw[i][1];
+    }
+    for (i=0; i<6; i++) {
+        row[n++] = calibrated[i][0];
+        row[n++] = calibrated[i][1];
+    }
+    row[n++] = sample->mag_x;
+    row[n++] = sample->mag_y;
+    row[n++] = sample->mag_z;
+}
+
+#endif /* defined(SWIGPYTHON) || defined(SWIGJAVA) */
+
+#if defined(SWIGPYTHON)
+
+/* Get the rows of a buffer (see fill_samples); NULL with ValueError if unfit */
+static double *
+psmove_get_rows(PyObject *obj, Py_buffer *view, Py_ssize_t *rows)
+{
+    if (PyObject_GetBuffer(obj, view, PyBUF_WRITABLE | PyBUF_FORMAT |
+                PyBUF_C_CONTIGUOUS) != 0) {
+        return NULL;
+    }
+
+    const char *format = (view->format != NULL) ? view->format : "B";
+    if (format[0] == '@' || format[0] == '=') {
+        format++;
+    }
+
+    Py_ssize_t values = view->len / sizeof(double);
+    if (strcmp(format, "d") != 0 || view->itemsize != sizeof(double) ||
+            values == 0 || values % PSMOVE_SAMPLE_COLUMNS != 0) {
+        PyErr_SetString(PyExc_ValueError, "expected a writable, C-contiguous "
+                "float64 buffer of SAMPLE_COLUMNS values per row");
+        PyBuffer_Release(view);
+        return NULL;
+    }
+
+    *rows = values / PSMOVE_SAMPLE_COLUMNS;
+    return (double *)view->buf;
+}
+
+int
+PSMove_fill_sample(PSMove *move, PyObject *buffer)
+{
+    PSMoveSample sample;
+    Py_buffer view;
+    Py_ssize_t rows;
+
+    double *data = psmove_get_rows(buffer, &view, &rows);
+    if (data == NULL) {
+        return -1;
+    }
+
+    psmove_get_sample(move, &sample);
+    psmove_sample_to_row(&sample, data);
+
+    PyBuffer_Release(&view);
+    return 1;
+}
+
+int
+PSMove_fill_samples(PSMove *move, PyObject *array)
+{
+    PSMoveSample sample;
+    Py_buffer view;
+    Py_ssize_t rows, count = 0;
+
+    double *data = psmove_get_rows(array, &view, &rows);
+    if (data == NULL) {
+        return -1;
+    }
+
+    /* The rows are used as a ring, so only the newest reports are kept */
+    while (psmove_poll(move)) {
+        psmove_get_sample(move, &sample);
+        psmove_sample_to_row(&sample,
+                data + (count % rows) * PSMOVE_SAMPLE_COLUMNS);
+        count++;
+    }
+
+    /* Rotate the ring, so the oldest row comes first */
+    Py_ssize_t oldest = count % rows;
+    if (count > rows && oldest > 0) {
+        size_t head = oldest * PSMOVE_SAMPLE_COLUMNS * sizeof(double);
+        size_t tail = view.len - head;
+        void *tmp = malloc(head);
+        if (tmp != NULL) {
+            memcpy(tmp, data, head);
+            memmove(data, (char *)data + head, tail);
+            memcpy((char *)data + tail, tmp, head);
+            free(tmp);
+        }
+    }
+
+    PyBuffer_Release(&view);
+    return (count > rows) ? rows : count;
+}
+
+#endif /* defined(SWIGPYTHON) */
+
+#if defined(SWIGJAVA)
+
+static void
+psmove_sample_rings_acquire()
+{
+    while (__sync_lock_test_and_set(&psmove_sample_rings_lock, 1)) {
+        while (psmove_sample_rings_lock) {
+            /* Spin, the lock is only held for a walk of the list */
+        }
+    }
+}
+
+static void
+psmove_sample_rings_release()
+{
+    __sync_lock_release(&psmove_sample_rings_lock);
+}
+
+/* Must be called with psmove_sample_rings_lock held */
+static PSMoveSampleRing *
+psmove_sample_ring_find_locked(PSMove *move)
+{
+    PSMoveSampleRing *ring;
+
+    for (ring=psmove_sample_rings; ring != NULL; ring=ring->next) {
+        if (ring->move == move) {
+            return ring;
+        }
+    }
+
+    return NULL;
+}
+
+static PSMoveSampleRing *
+psmove_sample_ring_find(PSMove *move)
+{
+    psmove_sample_rings_acquire();
+    PSMoveSampleRing *ring = psmove_sample_ring_find_locked(move);
+    psmove_sample_rings_release();
+
+    return ring;
+}
+
+static void
+psmove_sample_ring_free(PSMove *move)
+{
+    PSMoveSampleRing **prev;
+    PSMoveSampleRing *ring = NULL;
+
+    psmove_sample_rings_acquire();
+    for (prev=&psmove_sample_rings; *prev != NULL; prev=&((*prev)->next)) {
+        if ((*prev)->move == move) {
+            ring = *prev;
+            *prev = ring->next;
+            break;
+        }
+    }
+    psmove_sample_rings_release();
+
+    if (ring != NULL) {
+        free(ring->data);
+        free(ring);
+    }
+}
+
+PSMoveSampleBuffer
+PSMove_sample_buffer(PSMove *move, int rows)
+{
+    PSMoveSampleBuffer result = { NULL, 0 };
+    size_t size = PSMOVE_SAMPLE_HEADER_SIZE +
+        (size_t)rows * PSMOVE_SAMPLE_COLUMNS * sizeof(double);
+
+    if (rows <= 0) {
+        return result;
+    }
+
+    psmove_sample_rings_acquire();
+
+    /**
+     * Earlier ByteBuffers still point to the ring, so it is never replaced:
+     * the same ring is returned, or none if the number of rows differs
+     **/
+    PSMoveSampleRing *ring = psmove_sample_ring_find_locked(move);
+    if (ring != NULL) {
+        if (ring->rows == rows) {
+            result.data = ring->data;
+            result.size = size;
+        }
+        psmove_sample_rings_release();
+        return result;
+    }
+
+    ring = calloc(1, sizeof(PSMoveSampleRing));
+    if (ring != NULL) {
+        ring->data = calloc(1, size);
+        if (ring->data == NULL) {
+            free(ring);
+            ring = NULL;
+        }
+    }
+
+    if (ring != NULL) {
+        ring->move = move;
+        ring->rows = rows;
+        ((int *)ring->data)[1] = rows;
+        ring->next = psmove_sample_rings;
+        psmove_sample_rings = ring;
+
+        result.data = ring->data;
+        result.size = size;
+    }
+
+    psmove_sample_rings_release();
+    return result;
+}
+
+int
+PSMove_fill_sample_buffer(PSMove *move)
+{
+    PSMoveSampleRing *ring = psmove_sample_ring_find(move);
+    PSMoveSample sample;
+    int count = 0;
+
+    if (ring == NULL) {
+        return -1;
+    }
+
+    volatile int *header = (volatile int *)ring->data;
+    double *rows = (double *)(ring->data + PSMOVE_SAMPLE_HEADER_SIZE);
+
+    while (psmove_poll(move)) {
+        psmove_get_sample(move, &sample);
+
+        /* Readers in other threads retry while the sequence number is odd */
+        header[3]++;
+        __sync_synchronize();
+
+        psmove_sample_to_row(&sample,
+                rows + ring->head * PSMOVE_SAMPLE_COLUMNS);
+        ring->head = (ring->head + 1) % ring->rows;
+        header[0] = (int)(((unsigned int)header[0] + 1) & 0x7fffffff);
+        header[2] = ring->head;
+
+        __sync_synchronize();
+        header[3]++;
+        count++;
+    }
+
+    return count;
+}
+
+#endif /* defined(SWIGJAVA) */
+
 int count_connected()
 {
     return psmove_count_connected();
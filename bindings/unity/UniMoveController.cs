@@ -90,6 +90,39 @@ public enum PSMoveButton
 							 */
 };
 
+/// <summary>
+/// Complete state of a controller, filled in by psmove_update_state() in one native call.
+/// Must match the layout of PSMoveState in psmove.h. All fields are blittable, so the struct
+/// is pinned and passed by reference without any marshalling.
+/// </summary>
+[StructLayout(LayoutKind.Sequential)]
+public struct PSMoveState
+{
+	// Inputs (-1 leaves the value unchanged)
+	public int r, g, b;
+	public int rumble;
+
+	// Outputs
+	public int reports;
+	public int updateResult;
+	public uint buttons;
+	public uint buttonsAny;
+	public uint pressed;
+	public uint released;
+	public int trigger;
+	public int battery;
+	public int temperature;
+
+	public int rawAccelX, rawAccelY, rawAccelZ;
+	public int rawGyroX, rawGyroY, rawGyroZ;
+	public int magX, magY, magZ;
+
+	public float accelX, accelY, accelZ;
+	public float gyroX, gyroY, gyroZ;
+
+	public float q0, q1, q2, q3;
+}
+
 public class UniMoveButtonEventArgs : EventArgs
 {
     public readonly PSMoveButton button;
@@ -117,6 +150,11 @@ public class UniMoveController : MonoBehaviour
 	
 	private static float MIN_UPDATE_RATE = 0.02f; // You probably don't want to update the controller more frequently than every 20 milliseconds
 	
+	/// <summary>
+	/// LED/rumble values to send and sensor values read, exchanged with the library in one call per update.
+	/// </summary>
+	private PSMoveState state;
+	
 	private float trigger = 0f;
 	private uint currentButtons = 0;
 	private uint prevButtons = 0;
@@ -161,6 +199,10 @@ public class UniMoveController : MonoBehaviour
 		// Error check the result!
 		if (handle == IntPtr.Zero) return false;
 		
+		// Leave LEDs and rumble alone until SetLED()/SetRumble() is called
+		state.r = state.g = state.b = -1;
+		state.rumble = -1;
+		
 		// Make sure the connection is actually sending data. If not, this is probably a controller 
 		// you need to remove manually from the OSX Bluetooth Control Panel, then re-connect.
 		return (psmove_update_leds(handle) != 0);
@@ -205,33 +247,67 @@ public class UniMoveController : MonoBehaviour
 		if (timeElapsed < updateRate) return;	
 		else timeElapsed = 0.0f;
 				
-		prevButtons = currentButtons;
-		
-		uint rawButtons = 0;
+		// One native call per update: this sends the LED and rumble values, polls *all* data waiting
+		// in the queue (otherwise data might begin to build up) and fills in the state of the newest report.
+		int result = psmove_update_state(handle, ref state);
 		
-		// NOTE! There is potentially data waiting in queue. 
-		// We need to poll *all* of it by calling psmove_poll() until the queue is empty. Otherwise, data might begin to build up.
-		while (psmove_poll(handle) > 0) 
-		{
-			// We are interested in every button press between the last update and this one:
-			rawButtons = rawButtons | psmove_get_buttons(handle);
-		}
-		currentButtons = rawButtons;
+		// The LED and rumble values have been applied now
+		state.r = state.g = state.b = -1;
+		state.rumble = -1;
 		
-		// For acceleration, gyroscope, and magnetometer values, we look at only the last value in the queue.
-		// We could in theory average all the acceleration (and other) values in the queue for a "smoothing" effect, but we've chosen not to.
-		ProcessData();
+		ProcessState();
 		
-		// Send a report to the controller to update the LEDs and rumble.
-		if (psmove_update_leds(handle) == 0)
+		if (result == 0)
 		{
 			// If it returns zero, the controller must have disconnected (i.e. out of battery or out of range),
 			// so we should fire off any events and disconnect it.
-			OnControllerDisconnected(this, new EventArgs());
+			if (OnControllerDisconnected != null) OnControllerDisconnected(this, new EventArgs());
 			Disconnect();
 		}
     }
 	
+	/// <summary>
+	/// Updates several controllers with a single native call, e.g. from a manager script that
+	/// disables the controllers' own Update(). Controllers that have been disconnected are skipped.
+	/// </summary>
+	public static void UpdateAll(UniMoveController[] controllers)
+	{
+		int count = 0;
+		foreach (UniMoveController c in controllers) if (!c.disconnected) count++;
+		if (count == 0) return;
+		
+		IntPtr[] handles = new IntPtr[count];
+		PSMoveState[] states = new PSMoveState[count];
+		UniMoveController[] active = new UniMoveController[count];
+		
+		int i = 0;
+		foreach (UniMoveController c in controllers)
+		{
+			if (c.disconnected) continue;
+			handles[i] = c.handle;
+			states[i] = c.state;
+			active[i] = c;
+			i++;
+		}
+		
+		psmove_update_states(handles, states, count);
+		
+		for (i = 0; i < count; i++)
+		{
+			UniMoveController c = active[i];
+			c.state = states[i];
+			c.state.r = c.state.g = c.state.b = -1;
+			c.state.rumble = -1;
+			c.ProcessState();
+			
+			if (c.state.updateResult == 0)
+			{
+				if (c.OnControllerDisconnected != null) c.OnControllerDisconnected(c, new EventArgs());
+				c.Disconnect();
+			}
+		}
+	}
+	
     void OnApplicationQuit() 
 	{
         Disconnect();
@@ -253,8 +329,9 @@ public class UniMoveController : MonoBehaviour
     public void Disconnect()
     {
 		disconnected = true;
-        SetLED(0,0,0);
-        SetRumble(0);
+		psmove_set_leds(handle, (char)0, (char)0, (char)0);
+		psmove_set_rumble(handle, (char)0);
+		psmove_update_leds(handle);
 		psmove_disconnect(handle);
     }
 	
@@ -277,7 +354,8 @@ public class UniMoveController : MonoBehaviour
 		// Clamp value between 0 and 1:
         byte rumbleByte = (byte) (Math.Min(Math.Max(rumble, 0f), 1f) * 255);
 		
-		psmove_set_rumble(handle, (char)rumbleByte);
+		// Sent with the next update
+		state.rumble = rumbleByte;
     }
 	
 	/// <summary>
@@ -288,7 +366,7 @@ public class UniMoveController : MonoBehaviour
     {
 		if (disconnected) return;
 		
-		psmove_set_leds(handle, (char)(color.r * 255), (char)(color.g * 255), (char)(color.b * 255));
+		SetLED((byte)(color.r * 255), (byte)(color.g * 255), (byte)(color.b * 255));
     }
 	
 	/// <summary>
@@ -301,7 +379,10 @@ public class UniMoveController : MonoBehaviour
     {
 		if (disconnected) return;
 		
-		psmove_set_leds(handle, (char)r, (char)g, (char)b);
+		// Sent with the next update
+		state.r = r;
+		state.g = g;
+		state.b = b;
     }
 	
 	/// <summary>
@@ -367,41 +448,39 @@ public class UniMoveController : MonoBehaviour
 	#region private methods                              
 	
 	/// <summary>
-    /// Process all the raw data on the Playstation Move controller
+    /// Process the state read by psmove_update_state()
     /// </summary>
-    private void ProcessData()
+    private void ProcessState()
     {	
-		trigger = ((int)psmove_get_trigger(handle)) / 255f;
+		prevButtons = currentButtons;
 		
-		int x = 0;
-		int y = 0; 
-		int z = 0;
+		// We are interested in every button press between the last update and this one.
+		// If no new data has arrived, keep the buttons as they were.
+		if (state.reports > 0) currentButtons = state.buttonsAny;
 		
-		psmove_get_accelerometer(handle, ref x, ref y, ref z);
+		// For acceleration, gyroscope, and magnetometer values, we look at only the last value in the queue.
+		// We could in theory average all the acceleration (and other) values in the queue for a "smoothing" effect, but we've chosen not to.
+		trigger = state.trigger / 255f;
 		
-		rawAccel.x = x;
-		rawAccel.y = y;
-		rawAccel.z = z;
+		rawAccel.x = state.rawAccelX;
+		rawAccel.y = state.rawAccelY;
+		rawAccel.z = state.rawAccelZ;
 		
 		// TODO: Convert these values properly!
 		// Right now the division is a rough approximation to achieve a range between -3g and 3g (where 1g is Earth's gravity)
-		accel.x = x / 4300f;
-		accel.y = y / 4300f;
-		accel.z = z / 4300f;
-		
-		psmove_get_gyroscope(handle, ref x, ref y, ref z );
+		accel.x = state.rawAccelX / 4300f;
+		accel.y = state.rawAccelY / 4300f;
+		accel.z = state.rawAccelZ / 4300f;
 		
 		// TODO: Should these values be converted into a more human-understandable range?
-		gyro.x = x;
-		gyro.y = y;
-		gyro.z = z;
-		
-		psmove_get_magnetometer(handle, ref x, ref y, ref z );
+		gyro.x = state.rawGyroX;
+		gyro.y = state.rawGyroY;
+		gyro.z = state.rawGyroZ;
 		
 		// TODO: Should these values be converted into a more human-understandable range?
-		magnet.x = x;
-		magnet.y = y;
-		magnet.z = z;
+		magnet.x = state.magX;
+		magnet.y = state.magY;
+		magnet.z = state.magZ;
 		
 		// TODO: Add hook to get battery state (when it is implemented in Thomas Perl's C library).		
 		// TODO: Add hook to get temperature state (when it is implemented in Thomas Perl's C library).
@@ -478,22 +557,10 @@ public class UniMoveController : MonoBehaviour
 	private static extern void psmove_set_rumble(IntPtr move, char rumble);
 	
 	[DllImport("PSMove")]
-	private static extern uint psmove_poll(IntPtr move);
-		
-	[DllImport("PSMove")]
-	private static extern uint psmove_get_buttons(IntPtr move);
-		
-	[DllImport("PSMove")]
-	private static extern char psmove_get_trigger(IntPtr move);
-				
-	[DllImport("PSMove")]
-	private static extern void psmove_get_accelerometer(IntPtr move, ref int ax, ref int ay, ref int az);
-	
-	[DllImport("PSMove")]
-	private static extern void psmove_get_gyroscope(IntPtr move, ref int gx, ref int gy, ref int gz);
+	private static extern int psmove_update_state(IntPtr move, ref PSMoveState state);
 	
 	[DllImport("PSMove")]
-	private static extern void psmove_get_magnetometer(IntPtr move, ref int mx, ref int my, ref int mz);
+	private static extern int psmove_update_states(IntPtr[] moves, [In, Out] PSMoveState[] states, int count);
 	
 	[DllImport("PSMove")]
 	private static extern void psmove_disconnect(IntPtr move);
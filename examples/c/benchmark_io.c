@@ -0,0 +1,485 @@
+
+ /**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+/**
+ * Input/output benchmark for all transports
+ *
+ * Reads every input report of all connected controllers concurrently (one
+ * thread per controller where threads are available) for some seconds,
+ * optionally writing LED updates at the same time:
+ *
+ *     benchmark_io [options]
+ *
+ *     --seconds N       Duration of the benchmark (default: 10)
+ *     --controllers N   Only use the first N controllers (default: all)
+ *     --led-rate HZ     LED updates per second and controller (default: 0,
+ *                       no updates; -1 for as fast as possible)
+ *     --local           Only use local controllers (hidapi or hidraw)
+ *     --remote          Only use controllers of moved (UDP or shared memory)
+ *     --csv             Write results as CSV instead of a table
+ *     --json            Write results as one JSON object per line
+ *     --label TEXT      Label written with all results (e.g. the release)
+ *
+ * The transport of each controller is part of the results. A moved on the
+ * same host is read via shared memory; run with PSMOVE_MOVED_SHM=0 to
+ * measure it over UDP instead.
+ *
+ * For each controller, the results contain the report rate, the latency
+ * (from receiving a report - or its capture by moved - until psmove_poll()
+ * returns it) and the interval between reports (p50, p99, p99.9 and max),
+ * the CPU time used, the LED update throughput and the sequence gaps.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "psmove.h"
+#include "../../src/psmove_private.h"
+
+#if defined(PSMOVE_USE_PTHREADS)
+#  include <pthread.h>
+#endif
+
+/* Maximum number of controllers (limit of psmove_poll_all()) */
+#define BENCHMARK_MAX_CONTROLLERS 32
+
+/* Maximum time to wait for input before checking the deadline (in ms) */
+#define BENCHMARK_WAIT_MS 10
+
+enum BenchmarkFormat {
+    Format_Table,
+    Format_CSV,
+    Format_JSON,
+};
+
+/* Measured durations (in microseconds), for computing percentiles */
+typedef struct {
+    int *values;
+    int count;
+    int capacity;
+} BenchmarkSamples;
+
+typedef struct {
+    int id;
+    PSMove *move;
+    char *serial;
+    const char *transport;
+
+    long reports;
+    BenchmarkSamples latency;
+    BenchmarkSamples interval;
+    long long last_input_us;
+
+    long long next_led_us;
+    int led_counter;
+    long led_writes;
+    long led_failed;
+
+    long long cpu_us; /* -1 if not available */
+    PSMoveStats stats;
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_t thread;
+#endif
+} BenchmarkController;
+
+typedef struct {
+    BenchmarkController *controllers;
+    int count;
+    long long deadline_us;
+    int led_rate;
+} BenchmarkWorker;
+
+static void
+samples_add(BenchmarkSamples *samples, long long value)
+{
+    if (samples->count == samples->capacity) {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 1024;
+        samples->values = realloc(samples->values,
+                samples->capacity * sizeof(int));
+    }
+
+    samples->values[samples->count++] = (int)value;
+}
+
+static int
+compare_int(const void *a, const void *b)
+{
+    int ia = *(const int *)a;
+    int ib = *(const int *)b;
+    return (ia > ib) - (ia < ib);
+}
+
+/* Percentile (0..1) of sorted samples, -1 if there are none */
+static int
+samples_percentile(BenchmarkSamples *samples, double p)
+{
+    if (samples->count == 0) {
+        return -1;
+    }
+
+    int index = (int)(p * samples->count + .5) - 1;
+    if (index < 0) {
+        index = 0;
+    } else if (index >= samples->count) {
+        index = samples->count - 1;
+    }
+
+    return samples->values[index];
+}
+
+static long long
+thread_cpu_us()
+{
+#if defined(CLOCK_THREAD_CPUTIME_ID)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+        return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+#endif
+    return -1;
+}
+
+/* Account for the current input report of a controller */
+static void
+handle_report(BenchmarkController *c)
+{
+    long long now = psmove_util_get_ticks_us();
+    long long input = _psmove_get_input_time_us(c->move);
+
+    c->reports++;
+    samples_add(&(c->latency), now - input);
+    if (c->last_input_us != -1) {
+        samples_add(&(c->interval), input - c->last_input_us);
+    }
+    c->last_input_us = input;
+}
+
+static void
+handle_leds(BenchmarkController *c, int led_rate)
+{
+    long long now = psmove_util_get_ticks_us();
+
+    if (led_rate == 0 || (led_rate > 0 && now < c->next_led_us)) {
+        return;
+    }
+
+    /* Always change the color, so that every update has to be written */
+    c->led_counter++;
+    psmove_set_leds(c->move, c->led_counter % 256,
+            255 - c->led_counter % 256, (c->led_counter * 7) % 256);
+
+    if (psmove_update_leds(c->move) == Update_Failed) {
+        c->led_failed++;
+    } else {
+        c->led_writes++;
+    }
+
+    if (led_rate > 0) {
+        c->next_led_us += 1000000 / led_rate;
+        if (c->next_led_us < now) {
+            /* Don't try to catch up after a stall */
+            c->next_led_us = now;
+        }
+    }
+}
+
+static void *
+worker_proc(void *data)
+{
+    BenchmarkWorker *worker = (BenchmarkWorker *)data;
+    PSMove *moves[BENCHMARK_MAX_CONTROLLERS];
+    int i;
+
+    for (i=0; i<worker->count; i++) {
+        moves[i] = worker->controllers[i].move;
+    }
+
+    while (psmove_util_get_ticks_us() < worker->deadline_us) {
+        int timeout_ms = BENCHMARK_WAIT_MS;
+        if (worker->led_rate < 0) {
+            timeout_ms = 0;
+        } else if (worker->led_rate > 0 && 1000 / worker->led_rate < timeout_ms) {
+            timeout_ms = 1000 / worker->led_rate;
+        }
+
+        unsigned int ready = psmove_poll_all(moves, worker->count, timeout_ms);
+
+        for (i=0; i<worker->count; i++) {
+            BenchmarkController *c = &(worker->controllers[i]);
+
+            long long cpu_start = thread_cpu_us();
+
+            if (ready & (1 << i)) {
+                handle_report(c);
+            }
+
+            while (psmove_poll(c->move)) {
+                handle_report(c);
+            }
+
+            handle_leds(c, worker->led_rate);
+
+            long long cpu_end = thread_cpu_us();
+            if (c->cpu_us != -1 && cpu_start != -1 && cpu_end != -1) {
+                c->cpu_us += cpu_end - cpu_start;
+            } else {
+                c->cpu_us = -1;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void
+print_results(BenchmarkController *c, int count, double seconds,
+        enum BenchmarkFormat format, const char *label)
+{
+    static const char *names[] = {
+        "reports", "reports_per_second",
+        "latency_p50_us", "latency_p99_us", "latency_p999_us", "latency_max_us",
+        "interval_p50_us", "interval_p99_us", "interval_p999_us", "interval_max_us",
+        "cpu_percent", "led_writes_per_second", "led_failed",
+        "sequence_gaps", "dropped_reports", "duplicate_reports",
+        "gaps_per_1000_reports",
+    };
+    int n = sizeof(names) / sizeof(names[0]);
+    double values[sizeof(names) / sizeof(names[0])];
+    int i, j;
+
+    if (format == Format_CSV) {
+        printf("label,id,serial,transport,seconds");
+        for (j=0; j<n; j++) {
+            printf(",%s", names[j]);
+        }
+        printf("\n");
+    } else if (format == Format_Table) {
+        printf("%-3s %-18s %-9s %8s %7s  %-23s  %-23s %6s %7s %6s\n",
+                "id", "serial", "transport", "reports", "rate/s",
+                "latency p50/p99/p99.9", "interval p50/p99/p99.9",
+                "cpu%", "leds/s", "gaps");
+        printf("%-3s %-18s %-9s %8s %7s  %-23s  %-23s %6s %7s %6s\n",
+                "", "", "", "", "", "(ms)", "(ms)", "", "", "/1000");
+    }
+
+    for (i=0; i<count; i++) {
+        qsort(c[i].latency.values, c[i].latency.count, sizeof(int), compare_int);
+        qsort(c[i].interval.values, c[i].interval.count, sizeof(int), compare_int);
+
+        double gap_rate = c[i].reports ?
+            1000. * c[i].stats.sequence_gaps / c[i].reports : 0.;
+
+        values[0] = c[i].reports;
+        values[1] = c[i].reports / seconds;
+        values[2] = samples_percentile(&(c[i].latency), .5);
+        values[3] = samples_percentile(&(c[i].latency), .99);
+        values[4] = samples_percentile(&(c[i].latency), .999);
+        values[5] = samples_percentile(&(c[i].latency), 1.);
+        values[6] = samples_percentile(&(c[i].interval), .5);
+        values[7] = samples_percentile(&(c[i].interval), .99);
+        values[8] = samples_percentile(&(c[i].interval), .999);
+        values[9] = samples_percentile(&(c[i].interval), 1.);
+        values[10] = (c[i].cpu_us >= 0) ? 100. * c[i].cpu_us / (seconds * 1e6) : -1.;
+        values[11] = c[i].led_writes / seconds;
+        values[12] = c[i].led_failed;
+        values[13] = c[i].stats.sequence_gaps;
+        values[14] = c[i].stats.dropped_reports;
+        values[15] = c[i].stats.duplicate_reports;
+        values[16] = gap_rate;
+
+        switch (format) {
+            case Format_Table:
+                printf("%-3d %-18s %-9s %8ld %7.1f  %6.2f/%6.2f/%7.2f  "
+                        "%6.2f/%6.2f/%7.2f %6.1f %7.1f %6.2f\n",
+                        c[i].id, c[i].serial, c[i].transport, c[i].reports,
+                        values[1], values[2] / 1000., values[3] / 1000.,
+                        values[4] / 1000., values[6] / 1000., values[7] / 1000.,
+                        values[8] / 1000., values[10], values[11], values[16]);
+                break;
+            case Format_CSV:
+                printf("%s,%d,%s,%s,%.3f", label, c[i].id, c[i].serial,
+                        c[i].transport, seconds);
+                for (j=0; j<n; j++) {
+                    printf(",%.3f", values[j]);
+                }
+                printf("\n");
+                break;
+            case Format_JSON:
+                printf("{\"label\": \"%s\", \"id\": %d, \"serial\": \"%s\", "
+                        "\"transport\": \"%s\", \"seconds\": %.3f", label,
+                        c[i].id, c[i].serial, c[i].transport, seconds);
+                for (j=0; j<n; j++) {
+                    printf(", \"%s\": %.3f", names[j], values[j]);
+                }
+                printf("}\n");
+                break;
+        }
+    }
+}
+
+static void
+usage(const char *program)
+{
+    fprintf(stderr, "Usage: %s [--seconds N] [--controllers N] "
+            "[--led-rate HZ] [--local|--remote] [--csv|--json] "
+            "[--label TEXT]\n", program);
+}
+
+int
+main(int argc, char *argv[])
+{
+    enum BenchmarkFormat format = Format_Table;
+    const char *label = "";
+    int seconds = 10;
+    int max_controllers = BENCHMARK_MAX_CONTROLLERS;
+    int led_rate = 0;
+    int i;
+
+    for (i=1; i<argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i+1 < argc) {
+            seconds = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--controllers") == 0 && i+1 < argc) {
+            max_controllers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--led-rate") == 0 && i+1 < argc) {
+            led_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--local") == 0) {
+            _psmove_disable_remote();
+        } else if (strcmp(argv[i], "--remote") == 0) {
+            _psmove_disable_local();
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            format = Format_CSV;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            format = Format_JSON;
+        } else if (strcmp(argv[i], "--label") == 0 && i+1 < argc) {
+            label = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (seconds <= 0 || max_controllers <= 0 ||
+            max_controllers > BENCHMARK_MAX_CONTROLLERS) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int count = psmove_count_connected();
+    if (count > max_controllers) {
+        count = max_controllers;
+    }
+
+    if (count == 0) {
+        fprintf(stderr, "No controllers connected.\n");
+        return 1;
+    }
+
+    BenchmarkController *controllers = calloc(count, sizeof(BenchmarkController));
+
+    for (i=0; i<count; i++) {
+        BenchmarkController *c = &(controllers[i]);
+
+        c->id = i;
+        c->move = psmove_connect_by_id(i);
+        if (c->move == NULL) {
+            fprintf(stderr, "Could not connect to controller #%d.\n", i);
+            return 1;
+        }
+
+        c->serial = psmove_get_serial(c->move);
+        c->transport = _psmove_get_transport(c->move);
+        c->last_input_us = -1;
+
+        /* Every LED update should be written, see handle_leds() */
+        psmove_set_rate_limiting(c->move, PSMove_False);
+
+#if defined(PSMOVE_USE_PTHREADS)
+        /* Lets psmove_poll_all() sleep instead of polling in a loop */
+        psmove_enable_input_thread(c->move, PSMove_True);
+#endif
+    }
+
+    fprintf(stderr, "Benchmarking %d controller(s) for %d seconds...\n",
+            count, seconds);
+
+    long long started = psmove_util_get_ticks_us();
+    long long deadline = started + (long long)seconds * 1000000;
+
+    for (i=0; i<count; i++) {
+        controllers[i].next_led_us = started;
+        psmove_get_stats(controllers[i].move, &(controllers[i].stats));
+    }
+
+#if defined(PSMOVE_USE_PTHREADS)
+    /* One worker thread per controller */
+    BenchmarkWorker *workers = calloc(count, sizeof(BenchmarkWorker));
+    for (i=0; i<count; i++) {
+        workers[i].controllers = &(controllers[i]);
+        workers[i].count = 1;
+        workers[i].deadline_us = deadline;
+        workers[i].led_rate = led_rate;
+        pthread_create(&(controllers[i].thread), NULL, worker_proc, &(workers[i]));
+    }
+
+    for (i=0; i<count; i++) {
+        pthread_join(controllers[i].thread, NULL);
+    }
+    free(workers);
+#else
+    /* No threads - one worker reads all controllers */
+    BenchmarkWorker worker = { controllers, count, deadline, led_rate };
+    worker_proc(&worker);
+#endif
+
+    double elapsed = (psmove_util_get_ticks_us() - started) / 1e6;
+
+    for (i=0; i<count; i++) {
+        /* The statistics since the start of the benchmark */
+        PSMoveStats before = controllers[i].stats;
+        psmove_get_stats(controllers[i].move, &(controllers[i].stats));
+        controllers[i].stats.sequence_gaps -= before.sequence_gaps;
+        controllers[i].stats.dropped_reports -= before.dropped_reports;
+        controllers[i].stats.duplicate_reports -= before.duplicate_reports;
+    }
+
+    print_results(controllers, count, elapsed, format, label);
+
+    for (i=0; i<count; i++) {
+        psmove_disconnect(controllers[i].move);
+        free(controllers[i].serial);
+        free(controllers[i].latency.values);
+        free(controllers[i].interval.values);
+    }
+    free(controllers);
+
+    return 0;
+}
@@ -0,0 +1,775 @@
+
+ /**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+/**
+ * Microbenchmarks of the tracker kernels with synthetic frames
+ *
+ * Renders a frame with lit spheres of known color, position and radius
+ * (plus noise), then times every kernel of the tracking loop on its own,
+ * for each of its implementations, and checks that the outputs agree:
+ *
+ *     benchmark_kernels [options]
+ *
+ *     --size WxH        Frame size (default: 640x480)
+ *     --radius R        Radius of the spheres in pixels (default: 30)
+ *     --noise N         Amplitude of the pixel noise (default: 12)
+ *     --spheres N       Number of spheres, the first is tracked (default: 3)
+ *     --iterations N    Timed runs of each kernel (default: 200)
+ *     --json            Write results as one JSON object per line
+ *
+ * The kernels and their implementations:
+ *
+ *     color filter   BGR to HSV conversion and thresholding: OpenCV
+ *                    (cvCvtColor + cvInRangeS, the reference), per-pixel
+ *                    scalar code, the fused single pass (with SIMD if
+ *                    compiled in), the color lookup table, the YUYV lookup
+ *                    table and OpenCL (if a GPU is available)
+ *     lut build      Building the BGR and YUV lookup tables
+ *     blob           Biggest contour (psmove_tracker_biggest_contour) and
+ *                    the connected components labeler (th_biggest_blob)
+ *     moments        Moments of the biggest contour and of the whole mask
+ *                    (the labeler computes them in the same pass)
+ *     circle         Circle from the most distant contour points and from
+ *                    the blob moments, compared to the rendered sphere
+ *     undistort      Remapping the whole frame and undistorting one point
+ *
+ * The check column compares each output to the reference of its kernel:
+ * the fraction of different mask pixels, the difference of the bounding
+ * box or center, or the error of the circle in pixels.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "opencv2/core/core_c.h"
+#include "opencv2/imgproc/imgproc_c.h"
+
+#include "psmove.h"
+#include "../../src/tracker/tracker_helpers.h"
+#include "../../src/tracker/tracker_opencl.h"
+
+/* Internal functions of psmove_tracker.c */
+void psmove_tracker_biggest_contour(IplImage* img, CvMemStorage* stor,
+        CvSeq** resContour, float* resSize);
+void psmove_tracker_estimate_circle_from_blob(const th_blob* blob,
+        float *x, float *y, float* radius);
+
+/* Same as the defaults of the tracker (see COLOR_FILTER_RANGE_H etc.) */
+#define BENCHMARK_RANGE_H 12
+#define BENCHMARK_RANGE_S 85
+#define BENCHMARK_RANGE_V 85
+
+/* Untimed runs of each kernel before measuring */
+#define BENCHMARK_WARMUP 3
+
+/* Colors of the spheres (BGR), the first one is tracked */
+static const int
+sphere_colors[][3] = {
+    { 255, 0, 255 },
+    { 255, 255, 0 },
+    { 0, 255, 0 },
+    { 0, 0, 255 },
+    { 255, 0, 0 },
+};
+
+#define SPHERE_COLORS (sizeof(sphere_colors) / sizeof(sphere_colors[0]))
+
+typedef struct {
+    /* Options */
+    CvSize size;
+    int radius;
+    int noise;
+    int spheres;
+    int iterations;
+    int json;
+
+    /* Inputs: the rendered frame (BGR and YUYV) and the tracked sphere */
+    IplImage *frame;
+    IplImage *yuyv;
+    float x, y;
+    CvScalar min, max;
+
+    /* Scratch buffers and outputs of the kernels */
+    IplImage *hsv;
+    IplImage *reference;
+    IplImage *mask;
+    IplImage *contour_mask;
+    CvMemStorage *storage;
+    th_blob_labeler *labeler;
+    unsigned char *lut;
+    unsigned char *yuv_lut;
+    th_opencl *opencl;
+    th_opencl_filter *opencl_filter;
+
+    CvSeq *contour;
+    th_blob blob;
+    CvMoments moments;
+    float cx, cy, radius_found;
+
+    CvMat *intrinsic;
+    CvMat *distortion;
+    IplImage *mapx;
+    IplImage *mapy;
+    IplImage *undistorted;
+    float ux, uy;
+
+    /* Timings of the current kernel */
+    int *samples;
+    int reference_us;
+} KernelBenchmark;
+
+typedef void (*KernelFunc)(KernelBenchmark *bench);
+
+/* A simple generator, so that the frames are the same on all platforms */
+static unsigned int
+noise_state = 1;
+
+static int
+noise_next(int amplitude)
+{
+    noise_state = noise_state * 1103515245 + 12345;
+    if (amplitude == 0) {
+        return 0;
+    }
+    return (int)((noise_state >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+static unsigned char
+clamp_byte(int value)
+{
+    return value < 0 ? 0 : (value > 0xFF ? 0xFF : value);
+}
+
+static void
+render_frame(KernelBenchmark *bench)
+{
+    IplImage *frame = bench->frame;
+    int x, y, i;
+
+    /* A dark background (as with the low exposure of the tracker) */
+    for (y = 0; y < frame->height; y++) {
+        unsigned char *p = (unsigned char *)frame->imageData +
+            y * frame->widthStep;
+        for (x = 0; x < frame->width * 3; x++) {
+            p[x] = clamp_byte(20 + noise_next(bench->noise));
+        }
+    }
+
+    /* Shaded spheres next to each other along the diagonal */
+    for (i = 0; i < bench->spheres; i++) {
+        const int *color = sphere_colors[i % SPHERE_COLORS];
+        float cx = frame->width * (i + 1) / (float)(bench->spheres + 1);
+        float cy = frame->height * (i + 1) / (float)(bench->spheres + 1);
+        int r = bench->radius;
+
+        if (i == 0) {
+            bench->x = cx;
+            bench->y = cy;
+        }
+
+        for (y = (int)cy - r; y <= (int)cy + r; y++) {
+            if (y < 0 || y >= frame->height) {
+                continue;
+            }
+
+            unsigned char *p = (unsigned char *)frame->imageData +
+                y * frame->widthStep;
+            for (x = (int)cx - r; x <= (int)cx + r; x++) {
+                float d2 = ((x - cx) * (x - cx) + (y - cy) * (y - cy)) /
+                    (float)(r * r);
+                if (x < 0 || x >= frame->width || d2 > 1.f) {
+                    continue;
+                }
+
+                float shade = .9f - .3f * d2;
+                int c;
+                for (c = 0; c < 3; c++) {
+                    p[x * 3 + c] = clamp_byte((int)(color[c] * shade) +
+                            noise_next(bench->noise));
+                }
+            }
+        }
+    }
+
+    /* The same frame as the camera would deliver it in YUYV (BT.601) */
+    for (y = 0; y < frame->height; y++) {
+        unsigned char *p = (unsigned char *)frame->imageData +
+            y * frame->widthStep;
+        unsigned char *q = (unsigned char *)bench->yuyv->imageData +
+            y * bench->yuyv->widthStep;
+
+        for (x = 0; x + 1 < frame->width; x += 2) {
+            int b = (p[x * 3] + p[x * 3 + 3]) / 2;
+            int g = (p[x * 3 + 1] + p[x * 3 + 4]) / 2;
+            int r = (p[x * 3 + 2] + p[x * 3 + 5]) / 2;
+            int j;
+
+            for (j = 0; j < 2; j++) {
+                unsigned char *px = p + (x + j) * 3;
+                q[x * 2 + j * 2] = clamp_byte(16 + ((66 * px[2] +
+                                129 * px[1] + 25 * px[0] + 128) >> 8));
+            }
+            q[x * 2 + 1] = clamp_byte(128 + ((-38 * r - 74 * g + 112 * b +
+                            128) >> 8));
+            q[x * 2 + 3] = clamp_byte(128 + ((112 * r - 94 * g - 18 * b +
+                            128) >> 8));
+        }
+    }
+
+    /* The filter range of the tracker around the color of the first sphere */
+    const int *color = sphere_colors[0];
+    CvScalar hsv = th_brg2hsv(cvScalar(color[0] * .9, color[1] * .9,
+                color[2] * .9, 0));
+    CvScalar range = cvScalar(BENCHMARK_RANGE_H, BENCHMARK_RANGE_S,
+            BENCHMARK_RANGE_V, 0);
+    th_minus(hsv.val, range.val, bench->min.val, 3);
+    th_plus(hsv.val, range.val, bench->max.val, 3);
+}
+
+static int
+compare_int(const void *a, const void *b)
+{
+    int ia = *(const int *)a;
+    int ib = *(const int *)b;
+    return (ia > ib) - (ia < ib);
+}
+
+/* Runs a kernel (after the warmup), returns the median time in microseconds */
+static int
+measure(KernelBenchmark *bench, KernelFunc func, int *p99)
+{
+    int i;
+
+    for (i = 0; i < BENCHMARK_WARMUP; i++) {
+        func(bench);
+    }
+
+    for (i = 0; i < bench->iterations; i++) {
+        long long started = psmove_util_get_ticks_us();
+        func(bench);
+        bench->samples[i] = (int)(psmove_util_get_ticks_us() - started);
+    }
+
+    qsort(bench->samples, bench->iterations, sizeof(int), compare_int);
+    *p99 = bench->samples[(int)(.99 * (bench->iterations - 1))];
+    return bench->samples[bench->iterations / 2];
+}
+
+static void
+report(KernelBenchmark *bench, const char *kernel, const char *variant,
+        int reference, KernelFunc func, const char *check)
+{
+    int p99;
+    int median = measure(bench, func, &p99);
+
+    if (reference) {
+        bench->reference_us = median;
+    }
+
+    /* The check is only known after running the kernel */
+    char result[64];
+    snprintf(result, sizeof(result), "%s", check ? check : "");
+
+    float speedup = (median > 0 && bench->reference_us > 0) ?
+        (float)bench->reference_us / median : 0.f;
+
+    if (bench->json) {
+        printf("{\"kernel\": \"%s\", \"variant\": \"%s\", \"median_us\": %d, "
+                "\"p99_us\": %d, \"speedup\": %.2f, \"check\": \"%s\"}\n",
+                kernel, variant, median, p99, speedup, result);
+    } else {
+        printf("%-13s %-22s %9d %9d %7.2fx  %s\n", kernel, variant,
+                median, p99, speedup, result);
+    }
+}
+
+/* Fraction of pixels that differ from the reference mask, as a check */
+static const char *
+check_mask(KernelBenchmark *bench, const IplImage *reference)
+{
+    static char result[64];
+    long differences = 0;
+    int x, y;
+
+    for (y = 0; y < bench->mask->height; y++) {
+        const unsigned char *m = (const unsigned char *)
+            bench->mask->imageData + y * bench->mask->widthStep;
+        const unsigned char *r = (const unsigned char *)
+            reference->imageData + y * reference->widthStep;
+        for (x = 0; x < bench->mask->width; x++) {
+            differences += ((m[x] != 0) != (r[x] != 0));
+        }
+    }
+
+    if (differences == 0) {
+        return "match";
+    }
+
+    snprintf(result, sizeof(result), "%ld pixels differ (%.3g%%)",
+            differences, 100. * differences /
+            (bench->mask->width * bench->mask->height));
+    return result;
+}
+
+static void
+filter_opencv(KernelBenchmark *bench)
+{
+    cvCvtColor(bench->frame, bench->hsv, CV_BGR2HSV);
+    cvInRangeS(bench->hsv, bench->min, bench->max, bench->reference);
+}
+
+static void
+filter_scalar(KernelBenchmark *bench)
+{
+    int lo[3], hi[3];
+    int x, y, c;
+
+    for (c = 0; c < 3; c++) {
+        lo[c] = cvRound(bench->min.val[c]);
+        hi[c] = cvRound(bench->max.val[c]);
+    }
+
+    for (y = 0; y < bench->frame->height; y++) {
+        const unsigned char *p = (const unsigned char *)
+            bench->frame->imageData + y * bench->frame->widthStep;
+        unsigned char *m = (unsigned char *)bench->mask->imageData +
+            y * bench->mask->widthStep;
+
+        for (x = 0; x < bench->frame->width; x++, p += 3) {
+            int h, s, v;
+            th_bgr2hsv_pixel(p[0], p[1], p[2], &h, &s, &v);
+            m[x] = (h >= lo[0] && h <= hi[0] && s >= lo[1] && s <= hi[1] &&
+                    v >= lo[2] && v <= hi[2]) ? 0xFF : 0;
+        }
+    }
+}
+
+static void
+filter_fused(KernelBenchmark *bench)
+{
+    th_bgr_hsv_in_range(bench->frame, bench->min, bench->max, bench->mask);
+}
+
+static void
+filter_lut(KernelBenchmark *bench)
+{
+    th_color_lut_mask(bench->frame, bench->lut, bench->mask);
+}
+
+static void
+filter_yuyv_lut(KernelBenchmark *bench)
+{
+    th_yuyv_lut_mask(bench->yuyv, cvRect(0, 0, bench->yuyv->width,
+                bench->yuyv->height), bench->yuv_lut, bench->mask);
+}
+
+static void
+filter_opencl(KernelBenchmark *bench)
+{
+    /* The upload is done once per frame, for all controllers */
+    th_opencl_upload(bench->opencl, bench->frame);
+    th_opencl_filter_mask(bench->opencl_filter, cvRect(0, 0,
+                bench->frame->width, bench->frame->height), bench->lut,
+            bench->mask);
+}
+
+static void
+build_lut(KernelBenchmark *bench)
+{
+    th_build_color_lut(bench->min, bench->max, bench->lut);
+}
+
+static void
+build_yuv_lut(KernelBenchmark *bench)
+{
+    th_build_yuv_lut(bench->min, bench->max, bench->yuv_lut);
+}
+
+static void
+blob_contour(KernelBenchmark *bench)
+{
+    float size;
+
+    /* cvFindContours() modifies its input */
+    cvCopy(bench->reference, bench->contour_mask, NULL);
+    cvClearMemStorage(bench->storage);
+    psmove_tracker_biggest_contour(bench->contour_mask, bench->storage,
+            &(bench->contour), &size);
+}
+
+static void
+blob_labeler(KernelBenchmark *bench)
+{
+    th_biggest_blob(bench->labeler, bench->reference, NULL, &(bench->blob));
+}
+
+static void
+blob_labeler_color(KernelBenchmark *bench)
+{
+    th_biggest_blob(bench->labeler, bench->reference, bench->frame,
+            &(bench->blob));
+}
+
+static void
+moments_contour(KernelBenchmark *bench)
+{
+    cvMoments(bench->contour, &(bench->moments), 0);
+}
+
+static void
+moments_mask(KernelBenchmark *bench)
+{
+    cvMoments(bench->reference, &(bench->moments), 1);
+}
+
+/* The estimation of the tracker before the connected components labeler */
+static void
+circle_contour(KernelBenchmark *bench)
+{
+    CvSeq *contour = bench->contour;
+    int step = MAX(1, contour->total / 20);
+    float d = 0.f;
+    CvPoint m1 = cvPoint(0, 0), m2 = cvPoint(0, 0);
+    int i, j;
+
+    /* Compare every two points of the contour (but not more than 20) */
+    for (i = 0; i < contour->total; i += step) {
+        CvPoint *p1 = (CvPoint *)cvGetSeqElem(contour, i);
+        for (j = i + 1; j < contour->total; j += step) {
+            CvPoint *p2 = (CvPoint *)cvGetSeqElem(contour, j);
+            float cd = (p1->x - p2->x) * (p1->x - p2->x) +
+                (p1->y - p2->y) * (p1->y - p2->y);
+            if (cd > d) {
+                d = cd;
+                m1 = *p1;
+                m2 = *p2;
+            }
+        }
+    }
+
+    bench->cx = .5f * (m1.x + m2.x);
+    bench->cy = .5f * (m1.y + m2.y);
+    bench->radius_found = sqrtf(d) / 2.f;
+}
+
+static void
+circle_blob(KernelBenchmark *bench)
+{
+    psmove_tracker_estimate_circle_from_blob(&(bench->blob),
+            &(bench->cx), &(bench->cy), &(bench->radius_found));
+}
+
+static void
+undistort_remap(KernelBenchmark *bench)
+{
+    cvRemap(bench->frame, bench->undistorted, bench->mapx, bench->mapy,
+            CV_INTER_LINEAR | CV_WARP_FILL_OUTLIERS, cvScalarAll(0));
+}
+
+static void
+undistort_point(KernelBenchmark *bench)
+{
+    float src[2] = { bench->x, bench->y };
+    float dst[2];
+    CvMat src_m = cvMat(1, 1, CV_32FC2, src);
+    CvMat dst_m = cvMat(1, 1, CV_32FC2, dst);
+
+    cvUndistortPoints(&src_m, &dst_m, bench->intrinsic, bench->distortion,
+            NULL, bench->intrinsic);
+    bench->ux = dst[0];
+    bench->uy = dst[1];
+}
+
+static const char *
+check_circle(KernelBenchmark *bench)
+{
+    static char result[64];
+    float dx = bench->cx - bench->x;
+    float dy = bench->cy - bench->y;
+
+    snprintf(result, sizeof(result), "center %.2f px, radius %+.2f px",
+            sqrtf(dx * dx + dy * dy), bench->radius_found - bench->radius);
+    return result;
+}
+
+static const char *
+check_centroid(KernelBenchmark *bench)
+{
+    static char result[64];
+
+    if (bench->moments.m00 == 0) {
+        return "no moments";
+    }
+
+    float dx = bench->moments.m10 / bench->moments.m00 - bench->blob.cx;
+    float dy = bench->moments.m01 / bench->moments.m00 - bench->blob.cy;
+    snprintf(result, sizeof(result), "center %.2f px from labeler",
+            sqrtf(dx * dx + dy * dy));
+    return result;
+}
+
+static const char *
+check_bbox(KernelBenchmark *bench)
+{
+    static char result[64];
+
+    if (!bench->contour) {
+        return "no contour";
+    }
+
+    CvRect a = cvBoundingRect(bench->contour, 0);
+    CvRect b = bench->blob.bbox;
+    if (a.x == b.x && a.y == b.y && a.width == b.width &&
+            a.height == b.height) {
+        return "same bounding box";
+    }
+
+    snprintf(result, sizeof(result), "bounding box differs (%d,%d %dx%d)",
+            b.x - a.x, b.y - a.y, b.width - a.width, b.height - a.height);
+    return result;
+}
+
+static const char *
+check_undistort(KernelBenchmark *bench)
+{
+    static char result[64];
+    int x = cvRound(bench->ux);
+    int y = cvRound(bench->uy);
+
+    if (x < 0 || y < 0 || x >= bench->mapx->width ||
+            y >= bench->mapx->height) {
+        return "point outside of the frame";
+    }
+
+    /* The remap takes the pixel of the undistorted point from here */
+    float dx = CV_IMAGE_ELEM(bench->mapx, float, y, x) - bench->x;
+    float dy = CV_IMAGE_ELEM(bench->mapy, float, y, x) - bench->y;
+    snprintf(result, sizeof(result), "map and point %.2f px apart",
+            sqrtf(dx * dx + dy * dy));
+    return result;
+}
+
+static int
+parse_args(KernelBenchmark *bench, int argc, char *argv[])
+{
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(argv[i], "--json") == 0) {
+            bench->json = 1;
+        } else if (value && strcmp(argv[i], "--size") == 0) {
+            if (sscanf(value, "%dx%d", &(bench->size.width),
+                        &(bench->size.height)) != 2) {
+                return 0;
+            }
+            i++;
+        } else if (value && strcmp(argv[i], "--radius") == 0) {
+            bench->radius = atoi(value);
+            i++;
+        } else if (value && strcmp(argv[i], "--noise") == 0) {
+            bench->noise = atoi(value);
+            i++;
+        } else if (value && strcmp(argv[i], "--spheres") == 0) {
+            bench->spheres = atoi(value);
+            i++;
+        } else if (value && strcmp(argv[i], "--iterations") == 0) {
+            bench->iterations = atoi(value);
+            i++;
+        } else {
+            return 0;
+        }
+    }
+
+    return bench->size.width >= 2 && bench->size.height >= 2 &&
+        bench->radius > 0 && bench->noise >= 0 && bench->spheres > 0 &&
+        bench->iterations > 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    KernelBenchmark bench;
+    const char *simd = "none";
+
+    memset(&bench, 0, sizeof(bench));
+    bench.size = cvSize(640, 480);
+    bench.radius = 30;
+    bench.noise = 12;
+    bench.spheres = 3;
+    bench.iterations = 200;
+
+    if (!parse_args(&bench, argc, argv)) {
+        fprintf(stderr, "Usage: %s [--size WxH] [--radius R] [--noise N] "
+                "[--spheres N] [--iterations N] [--json]\n", argv[0]);
+        return 1;
+    }
+
+#if defined(__SSE2__)
+    simd = "SSE2";
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    simd = "NEON";
+#endif
+
+    bench.frame = cvCreateImage(bench.size, IPL_DEPTH_8U, 3);
+    bench.yuyv = cvCreateImage(bench.size, IPL_DEPTH_8U, 2);
+    bench.hsv = cvCreateImage(bench.size, IPL_DEPTH_8U, 3);
+    bench.reference = cvCreateImage(bench.size, IPL_DEPTH_8U, 1);
+    bench.mask = cvCreateImage(bench.size, IPL_DEPTH_8U, 1);
+    bench.contour_mask = cvCreateImage(bench.size, IPL_DEPTH_8U, 1);
+    bench.storage = cvCreateMemStorage(0);
+    bench.labeler = th_blob_labeler_new(bench.size);
+    bench.lut = malloc(TH_COLOR_LUT_SIZE);
+    bench.yuv_lut = malloc(TH_COLOR_LUT_SIZE);
+    bench.samples = malloc(bench.iterations * sizeof(int));
+
+    render_frame(&bench);
+    build_lut(&bench);
+    build_yuv_lut(&bench);
+
+    /* A typical lens of a webcam (as if calibrated for this frame size) */
+    double f = bench.size.width * .85;
+    double intrinsic[9] = {
+        f, 0., bench.size.width / 2.,
+        0., f, bench.size.height / 2.,
+        0., 0., 1.,
+    };
+    double distortion[5] = { -.12, .05, 0., 0., 0. };
+    bench.intrinsic = cvCreateMat(3, 3, CV_64FC1);
+    bench.distortion = cvCreateMat(1, 5, CV_64FC1);
+    memcpy(bench.intrinsic->data.db, intrinsic, sizeof(intrinsic));
+    memcpy(bench.distortion->data.db, distortion, sizeof(distortion));
+    bench.mapx = cvCreateImage(bench.size, IPL_DEPTH_32F, 1);
+    bench.mapy = cvCreateImage(bench.size, IPL_DEPTH_32F, 1);
+    bench.undistorted = cvCreateImage(bench.size, IPL_DEPTH_8U, 3);
+    cvInitUndistortMap(bench.intrinsic, bench.distortion,
+            bench.mapx, bench.mapy);
+
+    bench.opencl = th_opencl_new();
+    if (bench.opencl) {
+        bench.opencl_filter = th_opencl_filter_new(bench.opencl, bench.size);
+    }
+
+    if (!bench.json) {
+        printf("Frame %dx%d, %d spheres (radius %d), noise %d, SIMD: %s, "
+                "OpenCL: %s\n\n", bench.size.width, bench.size.height,
+                bench.spheres, bench.radius, bench.noise, simd,
+                bench.opencl_filter ? "yes" : "no");
+        printf("%-13s %-22s %9s %9s %8s  %s\n", "kernel", "variant",
+                "median us", "p99 us", "speedup", "check");
+    }
+
+    char fused[32];
+    snprintf(fused, sizeof(fused), "fused (SIMD: %s)", simd);
+
+    /* The reference mask is also the input of the blob kernels */
+    report(&bench, "color filter", "opencv", 1, filter_opencv, "reference");
+    filter_scalar(&bench);
+    report(&bench, "color filter", "scalar", 0, filter_scalar,
+            check_mask(&bench, bench.reference));
+    filter_fused(&bench);
+    report(&bench, "color filter", fused, 0, filter_fused,
+            check_mask(&bench, bench.reference));
+    filter_lut(&bench);
+    report(&bench, "color filter", "lut", 0, filter_lut,
+            check_mask(&bench, bench.reference));
+    filter_yuyv_lut(&bench);
+    report(&bench, "color filter", "yuyv lut", 0, filter_yuyv_lut,
+            check_mask(&bench, bench.reference));
+    if (bench.opencl_filter) {
+        /* Same table as the CPU lookup, so it has to match that exactly */
+        IplImage *lut_mask = cvCloneImage(bench.mask);
+        filter_lut(&bench);
+        cvCopy(bench.mask, lut_mask, NULL);
+        filter_opencl(&bench);
+        report(&bench, "color filter", "opencl (lut)", 0, filter_opencl,
+                check_mask(&bench, lut_mask));
+        cvReleaseImage(&lut_mask);
+    }
+
+    report(&bench, "lut build", "bgr", 1, build_lut, NULL);
+    report(&bench, "lut build", "yuv", 0, build_yuv_lut, NULL);
+
+    report(&bench, "blob", "contours (opencv)", 1, blob_contour, "reference");
+    blob_labeler(&bench);
+    report(&bench, "blob", "labeler", 0, blob_labeler, check_bbox(&bench));
+    report(&bench, "blob", "labeler with color", 0, blob_labeler_color,
+            check_bbox(&bench));
+
+    if (bench.contour) {
+        moments_contour(&bench);
+        report(&bench, "moments", "contour", 1, moments_contour,
+                check_centroid(&bench));
+        moments_mask(&bench);
+        report(&bench, "moments", "mask", 0, moments_mask,
+                check_centroid(&bench));
+
+        circle_contour(&bench);
+        report(&bench, "circle", "contour", 1, circle_contour,
+                check_circle(&bench));
+        circle_blob(&bench);
+        report(&bench, "circle", "blob moments", 0, circle_blob,
+                check_circle(&bench));
+    } else {
+        fprintf(stderr, "The tracked sphere was not found in the mask.\n");
+    }
+
+    undistort_point(&bench);
+    report(&bench, "undistort", "remap (frame)", 1, undistort_remap, NULL);
+    report(&bench, "undistort", "point", 0, undistort_point,
+            check_undistort(&bench));
+
+    if (bench.opencl_filter) {
+        th_opencl_filter_free(bench.opencl_filter);
+    }
+    if (bench.opencl) {
+        th_opencl_free(bench.opencl);
+    }
+    th_blob_labeler_free(bench.labeler);
+    cvReleaseMemStorage(&bench.storage);
+    cvReleaseMat(&bench.intrinsic);
+    cvReleaseMat(&bench.distortion);
+    cvReleaseImage(&bench.mapx);
+    cvReleaseImage(&bench.mapy);
+    cvReleaseImage(&bench.undistorted);
+    cvReleaseImage(&bench.frame);
+    cvReleaseImage(&bench.yuyv);
+    cvReleaseImage(&bench.hsv);
+    cvReleaseImage(&bench.reference);
+    cvReleaseImage(&bench.mask);
+    cvReleaseImage(&bench.contour_mask);
+    free(bench.lut);
+    free(bench.yuv_lut);
+    free(bench.samples);
+
+    return 0;
+}
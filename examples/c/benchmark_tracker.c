@@ -0,0 +1,261 @@
+
+ /**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+/**
+ * Tracker benchmark with recorded sessions
+ *
+ * A session consists of the camera video (<session>.avi, with the
+ * calibration records in <session>.avi.ini) and the input reports of the
+ * controllers (<session>.psmove). Record one with live controllers:
+ *
+ *     benchmark_tracker --record <session> [seconds]
+ *
+ * and replay any number of sessions through the tracker:
+ *
+ *     benchmark_tracker <session> [<session> ...]
+ *
+ * For each session, one line with a JSON object is written to stdout
+ * (per-stage timings, frames per second, reacquisition latency and
+ * tracking loss rate), so that results can be compared automatically.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "psmove.h"
+#include "psmove_tracker.h"
+
+/* The controllers send about twice as many input reports as there are frames */
+#define REPORTS_PER_FRAME 2
+
+/* Default duration of a recording (in seconds) */
+#define RECORD_SECONDS 30
+
+static char *
+session_file(const char *session, const char *extension)
+{
+    char *filename = malloc(strlen(session) + strlen(extension) + 1);
+    strcpy(filename, session);
+    strcat(filename, extension);
+    return filename;
+}
+
+static int
+record_session(const char *session, int seconds)
+{
+    int i;
+    int count = psmove_count_connected();
+    PSMove **moves = calloc(count, sizeof(PSMove *));
+
+    PSMoveTracker *tracker = psmove_tracker_new();
+    if (!tracker) {
+        fprintf(stderr, "Could not init PSMoveTracker.\n");
+        return 1;
+    }
+
+    for (i=0; i<count; i++) {
+        moves[i] = psmove_connect_by_id(i);
+        while (psmove_tracker_enable(tracker, moves[i]) != Tracker_CALIBRATED) {
+            fprintf(stderr, "Calibrating controller %d failed - retrying\n", i);
+        }
+    }
+
+    char *video = session_file(session, ".avi");
+    char *input = session_file(session, ".psmove");
+    psmove_start_recording(input);
+    psmove_tracker_start_recording(tracker, video);
+
+    fprintf(stderr, "Recording %d controllers for %d seconds...\n",
+            count, seconds);
+    long long until = psmove_util_get_ticks_us() + seconds * 1000000LL;
+    while (psmove_util_get_ticks_us() < until) {
+        psmove_tracker_update_image(tracker);
+        psmove_tracker_update(tracker, NULL);
+
+        for (i=0; i<count; i++) {
+            unsigned char r, g, b;
+            while (psmove_poll(moves[i]));
+            psmove_tracker_get_color(tracker, moves[i], &r, &g, &b);
+            psmove_set_leds(moves[i], r, g, b);
+            psmove_update_leds(moves[i]);
+        }
+    }
+
+    psmove_tracker_stop_recording(tracker);
+    psmove_stop_recording();
+    free(video);
+    free(input);
+
+    for (i=0; i<count; i++) {
+        psmove_disconnect(moves[i]);
+    }
+    free(moves);
+    psmove_tracker_free(tracker);
+    return 0;
+}
+
+static int
+replay_session(const char *session)
+{
+    int i, k;
+    int count = 0;
+    PSMove **moves = NULL;
+
+    char *video = session_file(session, ".avi");
+    char *input = session_file(session, ".psmove");
+    PSMoveTracker *tracker = psmove_tracker_new_from_file(video);
+    if (!tracker) {
+        fprintf(stderr, "Could not open %s.\n", video);
+        free(video);
+        free(input);
+        return 1;
+    }
+
+    /* Controllers are enabled in the order in which they were recorded */
+    while (1) {
+        PSMove *move = psmove_connect_replay(input, count,
+                Replay_AsFastAsPossible);
+        if (!move) {
+            break;
+        }
+        moves = realloc(moves, (count + 1) * sizeof(PSMove *));
+        moves[count++] = move;
+        if (psmove_tracker_enable(tracker, move) != Tracker_CALIBRATED) {
+            fprintf(stderr, "Could not enable controller %d of %s.\n",
+                    count - 1, session);
+        }
+    }
+
+    /* Totals over all frames */
+    long frames = 0;
+    double capture_wait_us = 0, undistort_us = 0, color_filter_us = 0;
+    double blob_us = 0, color_adaption_us = 0, total_us = 0;
+    long tracked = 0, lost = 0;
+    long reacquisitions = 0, reacquisition_frames = 0;
+    long *lost_since = calloc(count ? count : 1, sizeof(long));
+
+    long long started = psmove_util_get_ticks_us();
+    while (1) {
+        psmove_tracker_update_image(tracker);
+        if (!psmove_tracker_get_image(tracker)) {
+            break;
+        }
+
+        for (i=0; i<count; i++) {
+            for (k=0; k<REPORTS_PER_FRAME; k++) {
+                psmove_poll(moves[i]);
+            }
+        }
+
+        psmove_tracker_update(tracker, NULL);
+        frames++;
+
+        PSMoveTrackerMetrics metrics;
+        psmove_tracker_get_metrics(tracker, &metrics);
+        capture_wait_us += metrics.capture_wait_us;
+        undistort_us += metrics.undistort_us;
+        color_filter_us += metrics.color_filter_us;
+        blob_us += metrics.blob_us;
+        color_adaption_us += metrics.color_adaption_us;
+        total_us += metrics.total_us;
+
+        for (i=0; i<count; i++) {
+            if (psmove_tracker_get_status(tracker, moves[i]) ==
+                    Tracker_TRACKING) {
+                tracked++;
+                if (lost_since[i]) {
+                    /* Frames from losing the sphere until finding it again */
+                    reacquisitions++;
+                    reacquisition_frames += frames - lost_since[i];
+                    lost_since[i] = 0;
+                }
+            } else {
+                lost++;
+                if (!lost_since[i]) {
+                    lost_since[i] = frames;
+                }
+            }
+        }
+    }
+    double elapsed_s = (psmove_util_get_ticks_us() - started) / 1000000.;
+
+    double n = frames ? frames : 1;
+    printf("{\"session\": \"%s\", \"controllers\": %d, \"frames\": %ld, "
+            "\"fps\": %.1f, \"capture_wait_us\": %.1f, \"undistort_us\": %.1f, "
+            "\"color_filter_us\": %.1f, \"blob_us\": %.1f, "
+            "\"color_adaption_us\": %.1f, \"update_us\": %.1f, "
+            "\"tracking_loss_rate\": %.4f, \"reacquisitions\": %ld, "
+            "\"reacquisition_frames\": %.1f}\n",
+            session, count, frames,
+            elapsed_s > 0 ? frames / elapsed_s : 0.,
+            capture_wait_us / n, undistort_us / n,
+            color_filter_us / n, blob_us / n,
+            color_adaption_us / n, total_us / n,
+            (tracked + lost) ? (double)lost / (tracked + lost) : 0.,
+            reacquisitions,
+            reacquisitions ? (double)reacquisition_frames / reacquisitions : 0.);
+    fflush(stdout);
+
+    for (i=0; i<count; i++) {
+        psmove_disconnect(moves[i]);
+    }
+    free(moves);
+    free(lost_since);
+    psmove_tracker_free(tracker);
+    free(video);
+    free(input);
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    int i;
+    int result = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s --record <session> [seconds]\n"
+                "       %s <session> [<session> ...]\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "--record") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Missing session name.\n");
+            return 1;
+        }
+        return record_session(argv[2],
+                (argc > 3) ? atoi(argv[3]) : RECORD_SECONDS);
+    }
+
+    for (i=1; i<argc; i++) {
+        result |= replay_session(argv[i]);
+    }
+
+    return result;
+}
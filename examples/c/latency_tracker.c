@@ -0,0 +1,534 @@
+
+ /**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+/**
+ * End-to-end latency of the tracker (LED change to tracked position)
+ *
+ * Hold the controller still in front of the camera and run:
+ *
+ *     latency_tracker [--buttons] [trials]
+ *
+ * After the color calibration, the sphere LED is switched off and on again
+ * (trials times, default: 50). For each change, the time of the LED write
+ * is taken on the host and the frames are examined until the brightness of
+ * the sphere has changed. After the sphere is lit again, the frames are
+ * processed until psmove_tracker_update() has found it. With --buttons,
+ * every press of the Move button toggles the LED instead, so the path from
+ * the button press to the tracked position is measured.
+ *
+ * The breakdown of the latency (p50, p99 and max in microseconds):
+ *
+ *     input       Button report received until psmove_poll() returned it
+ *                 (only with --buttons)
+ *     write       Duration of the psmove_update_leds() call
+ *     exposure    End of the LED write until the camera captured the
+ *                 first frame showing the change (Bluetooth delivery to
+ *                 the controller, exposure and readout of the frame)
+ *     processing  Capture of that frame until the position was found
+ *     total       Start of the LED write (or receiving the button report)
+ *                 until the position was found
+ *
+ * The exposure stage includes waiting for the next frame, so its spread is
+ * about one frame interval. The average duration of the Bluetooth writes
+ * (as measured by the LED writer) is printed along with the results.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "opencv2/core/core_c.h"
+
+#include "psmove.h"
+#include "psmove_tracker.h"
+#include "../../src/psmove_private.h"
+
+/* Default number of LED changes to measure */
+#define LATENCY_TRIALS 50
+
+/* Frames a change may take to show up before the trial is given up */
+#define LATENCY_MAX_FRAMES 30
+
+/* Frames to average for the brightness of the lit and the dark sphere */
+#define LATENCY_LEVEL_FRAMES 10
+
+/* Minimum brightness difference between the lit and the dark sphere */
+#define LATENCY_MIN_CONTRAST 20.
+
+enum LatencyStage {
+    Stage_Input,
+    Stage_Write,
+    Stage_Exposure,
+    Stage_Processing,
+    Stage_Total,
+    Stage_Count,
+};
+
+static const char *
+stage_names[Stage_Count] = {
+    "input",
+    "write",
+    "exposure",
+    "processing",
+    "total",
+};
+
+/* Measured durations (in microseconds), for computing percentiles */
+typedef struct {
+    int *values;
+    int count;
+    int capacity;
+} LatencySamples;
+
+typedef struct {
+    PSMoveTracker *tracker;
+    PSMove *move;
+    unsigned char r, g, b;
+    int lit;
+
+    /* Area of the sphere in the camera image (the controller is not moved) */
+    float x, y, radius;
+
+    /* Brightness halfway between the dark and the lit sphere */
+    float threshold;
+
+    LatencySamples stages[Stage_Count];
+    int timeouts;
+} LatencyTest;
+
+/* A processed frame */
+typedef struct {
+    float level; /* Mean brightness of the sphere area */
+    long long captured_us;
+    int tracked; /* Whether the position was found in this frame */
+    long long tracked_us;
+} LatencyFrame;
+
+static void
+samples_add(LatencySamples *samples, long long value)
+{
+    if (samples->count == samples->capacity) {
+        samples->capacity = samples->capacity ? samples->capacity * 2 : 64;
+        samples->values = realloc(samples->values,
+                samples->capacity * sizeof(int));
+    }
+
+    samples->values[samples->count++] = (int)value;
+}
+
+static int
+compare_int(const void *a, const void *b)
+{
+    int ia = *(const int *)a;
+    int ib = *(const int *)b;
+    return (ia > ib) - (ia < ib);
+}
+
+/* Percentile (0..1) of sorted samples, -1 if there are none */
+static int
+samples_percentile(LatencySamples *samples, double p)
+{
+    if (samples->count == 0) {
+        return -1;
+    }
+
+    int index = (int)(p * samples->count + .5) - 1;
+    if (index < 0) {
+        index = 0;
+    } else if (index >= samples->count) {
+        index = samples->count - 1;
+    }
+
+    return samples->values[index];
+}
+
+/* Mean brightness (of all channels) in the square inside the sphere */
+static float
+sphere_level(LatencyTest *test, IplImage *image)
+{
+    int half = (int)(test->radius * .7f);
+    if (half < 1) {
+        half = 1;
+    }
+
+    int x0 = (int)test->x - half;
+    int y0 = (int)test->y - half;
+    int x1 = (int)test->x + half;
+    int y1 = (int)test->y + half;
+
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    if (x1 > image->width) x1 = image->width;
+    if (y1 > image->height) y1 = image->height;
+
+    long sum = 0;
+    long count = 0;
+    int x, y, c;
+
+    for (y = y0; y < y1; y++) {
+        unsigned char *row = (unsigned char *)image->imageData +
+            y * image->widthStep;
+        for (x = x0; x < x1; x++) {
+            for (c = 0; c < image->nChannels; c++) {
+                sum += row[x * image->nChannels + c];
+            }
+            count += image->nChannels;
+        }
+    }
+
+    return count ? (float)sum / count : 0.f;
+}
+
+static void
+process_frame(LatencyTest *test, LatencyFrame *result)
+{
+    psmove_tracker_update_image(test->tracker);
+    psmove_tracker_update(test->tracker, NULL);
+
+    /* Keep the input queue short, the tool only looks at the newest report */
+    while (psmove_poll(test->move));
+
+    PSMoveTrackerFrame *frame = psmove_tracker_acquire_frame(test->tracker);
+    if (frame) {
+        result->level = sphere_level(test,
+                psmove_tracker_frame_get_image(frame));
+        result->captured_us = psmove_tracker_frame_get_timestamp(frame);
+        result->tracked = psmove_tracker_frame_get_position(frame,
+                test->move, NULL, NULL, NULL);
+        psmove_tracker_release_frame(test->tracker, frame);
+    } else {
+        result->level = 0.f;
+        result->captured_us = psmove_util_get_ticks_us();
+        result->tracked = 0;
+    }
+
+    result->tracked_us = 0;
+    if (result->tracked) {
+        long long captured_us;
+        psmove_tracker_get_position_timestamp(test->tracker, test->move,
+                &captured_us, &(result->tracked_us));
+    }
+}
+
+static void
+set_lit(LatencyTest *test, int lit)
+{
+    test->lit = lit;
+    if (lit) {
+        psmove_set_leds(test->move, test->r, test->g, test->b);
+    } else {
+        psmove_set_leds(test->move, 0, 0, 0);
+    }
+}
+
+/* Average brightness of the sphere area with the LED on or off */
+static float
+measure_level(LatencyTest *test, int lit)
+{
+    LatencyFrame frame;
+    float sum = 0.f;
+    int i;
+
+    set_lit(test, lit);
+    psmove_update_leds(test->move);
+
+    /* Let the change settle before averaging */
+    for (i = 0; i < LATENCY_LEVEL_FRAMES; i++) {
+        process_frame(test, &frame);
+    }
+
+    for (i = 0; i < LATENCY_LEVEL_FRAMES; i++) {
+        process_frame(test, &frame);
+        sum += frame.level;
+    }
+
+    return sum / LATENCY_LEVEL_FRAMES;
+}
+
+static int
+setup(LatencyTest *test)
+{
+    LatencyFrame frame;
+    int i;
+
+    while (psmove_tracker_enable(test->tracker, test->move) !=
+            Tracker_CALIBRATED) {
+        fprintf(stderr, "Calibration failed - retrying\n");
+    }
+
+    psmove_tracker_get_color(test->tracker, test->move,
+            &(test->r), &(test->g), &(test->b));
+    set_lit(test, 1);
+    psmove_update_leds(test->move);
+
+    /* Wait until the sphere is tracked, then remember where it is */
+    for (i = 0; i < LATENCY_MAX_FRAMES * 10; i++) {
+        process_frame(test, &frame);
+        if (psmove_tracker_get_status(test->tracker, test->move) ==
+                Tracker_TRACKING) {
+            break;
+        }
+    }
+
+    if (psmove_tracker_get_status(test->tracker, test->move) !=
+            Tracker_TRACKING) {
+        fprintf(stderr, "The controller is not tracked.\n");
+        return 0;
+    }
+
+    psmove_tracker_get_position(test->tracker, test->move,
+            &(test->x), &(test->y), &(test->radius));
+
+    float dark = measure_level(test, 0);
+    float bright = measure_level(test, 1);
+
+    printf("Sphere at (%.0f, %.0f), radius %.1f, brightness %.1f (off) "
+            "to %.1f (on)\n", test->x, test->y, test->radius, dark, bright);
+
+    if (bright - dark < LATENCY_MIN_CONTRAST) {
+        fprintf(stderr, "Not enough contrast between the lit and the dark "
+                "sphere (keep the controller still, darken the room).\n");
+        return 0;
+    }
+
+    test->threshold = (dark + bright) / 2.f;
+    return 1;
+}
+
+/**
+ * Change the LED and measure until the change is seen (and, if the sphere
+ * is lit, until its position has been found again). started_us is when the
+ * measured path started (the LED write, or receiving the button report).
+ **/
+static void
+measure_change(LatencyTest *test, long long started_us, long long input_us)
+{
+    LatencyFrame frame;
+    int lit = !test->lit;
+
+    long long write_us = psmove_util_get_ticks_us();
+    if (started_us == 0) {
+        started_us = write_us;
+    }
+
+    set_lit(test, lit);
+    if (psmove_update_leds(test->move) == Update_Failed) {
+        fprintf(stderr, "LED update failed\n");
+    }
+    long long written_us = psmove_util_get_ticks_us();
+
+    long long captured_us = 0;
+    int i;
+
+    for (i = 0; i < LATENCY_MAX_FRAMES; i++) {
+        process_frame(test, &frame);
+        if ((frame.level > test->threshold) == lit) {
+            captured_us = frame.captured_us;
+            break;
+        }
+    }
+
+    if (captured_us == 0) {
+        test->timeouts++;
+        return;
+    }
+
+    if (lit) {
+        /* The sphere may be found in the first lit frame or later ones */
+        for (; i < LATENCY_MAX_FRAMES && !frame.tracked; i++) {
+            process_frame(test, &frame);
+        }
+
+        if (!frame.tracked) {
+            test->timeouts++;
+            return;
+        }
+
+        samples_add(&(test->stages[Stage_Processing]),
+                frame.tracked_us - captured_us);
+        samples_add(&(test->stages[Stage_Total]),
+                frame.tracked_us - started_us);
+    }
+
+    if (input_us) {
+        samples_add(&(test->stages[Stage_Input]), input_us);
+    }
+    samples_add(&(test->stages[Stage_Write]), written_us - write_us);
+    samples_add(&(test->stages[Stage_Exposure]), captured_us - written_us);
+}
+
+static void
+run_trials(LatencyTest *test, int trials)
+{
+    int i;
+
+    for (i = 0; i < trials; i++) {
+        /* Don't start the write at the same point of the frame interval */
+        LatencyFrame frame;
+        process_frame(test, &frame);
+        usleep(1000 * (rand() % 40));
+
+        measure_change(test, 0, 0);
+        printf("\rTrial %d/%d", i + 1, trials);
+        fflush(stdout);
+    }
+    printf("\n");
+}
+
+static void
+run_buttons(LatencyTest *test, int presses)
+{
+    int i = 0;
+
+    printf("Press the Move button %d times (PS button to stop)\n", presses);
+
+    while (i < presses) {
+        psmove_tracker_update_image(test->tracker);
+        psmove_tracker_update(test->tracker, NULL);
+
+        while (psmove_poll(test->move)) {
+            long long returned_us = psmove_util_get_ticks_us();
+            long long received_us = _psmove_get_input_time_us(test->move);
+            unsigned int pressed;
+
+            psmove_get_button_events(test->move, &pressed, NULL);
+
+            if (pressed & Btn_PS) {
+                return;
+            }
+
+            if (pressed & Btn_MOVE) {
+                measure_change(test, received_us, returned_us - received_us);
+                printf("\rPress %d/%d", ++i, presses);
+                fflush(stdout);
+                break;
+            }
+        }
+
+        /* Keep the LED of a lit sphere refreshed */
+        psmove_update_leds(test->move);
+    }
+    printf("\n");
+
+    /* Leave the tracker with a lit sphere */
+    if (!test->lit) {
+        measure_change(test, 0, 0);
+    }
+}
+
+static void
+print_results(LatencyTest *test)
+{
+    PSMoveTrackerMetrics metrics;
+    PSMoveLEDPolicy policy;
+    int i;
+
+    psmove_tracker_get_metrics(test->tracker, &metrics);
+    psmove_get_led_policy(test->move, &policy);
+
+    printf("%-12s %8s %8s %8s %8s\n", "stage", "samples", "p50", "p99", "max");
+    for (i = 0; i < Stage_Count; i++) {
+        LatencySamples *samples = &(test->stages[i]);
+        if (samples->count == 0) {
+            continue;
+        }
+
+        qsort(samples->values, samples->count, sizeof(int), compare_int);
+        printf("%-12s %8d %8d %8d %8d\n", stage_names[i], samples->count,
+                samples_percentile(samples, .5),
+                samples_percentile(samples, .99),
+                samples_percentile(samples, 1.));
+    }
+
+    printf("Bluetooth write: %d us average (%s)\n", policy.write_latency_us,
+            _psmove_get_transport(test->move));
+    printf("Camera: %.1f fps, exposure %d, frame interval %.0f us\n",
+            metrics.fps, metrics.exposure,
+            (metrics.fps > 0.f) ? 1000000.f / metrics.fps : 0.f);
+    printf("Timeouts: %d\n", test->timeouts);
+}
+
+int
+main(int argc, char *argv[])
+{
+    LatencyTest test;
+    int buttons = 0;
+    int trials = LATENCY_TRIALS;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--buttons") == 0) {
+            buttons = 1;
+        } else if (atoi(argv[i]) > 0) {
+            trials = atoi(argv[i]);
+        } else {
+            fprintf(stderr, "Usage: %s [--buttons] [trials]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    memset(&test, 0, sizeof(test));
+
+    test.move = psmove_connect();
+    if (!test.move) {
+        fprintf(stderr, "Could not connect to the controller.\n");
+        return 1;
+    }
+
+    test.tracker = psmove_tracker_new();
+    if (!test.tracker) {
+        fprintf(stderr, "Could not init PSMoveTracker.\n");
+        psmove_disconnect(test.move);
+        return 1;
+    }
+
+    /* Every change of the LEDs has to be written immediately */
+    psmove_set_rate_limiting(test.move, PSMove_False);
+
+    int result = 1;
+    if (setup(&test)) {
+        if (buttons) {
+            run_buttons(&test, trials);
+        } else {
+            run_trials(&test, trials);
+        }
+        print_results(&test);
+        result = 0;
+    }
+
+    for (i = 0; i < Stage_Count; i++) {
+        free(test.stages[i].values);
+    }
+
+    psmove_tracker_free(test.tracker);
+    psmove_disconnect(test.move);
+
+    return result;
+}
@@ -41,7 +41,8 @@ int main(int argc, char *argv[])
 
     for (i=0; i<connected; i++) {
         printf("Writing to dev %d...\n", i);
-        moved_client_send(client, MOVED_REQ_WRITE, i, output);
+        moved_client_send(client, MOVED_REQ_WRITE,
+                moved_client_device_id(client, i), output);
     }
 
     if (moved_client_send(client, MOVED_REQ_READ, 0, NULL)) {
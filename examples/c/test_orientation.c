@@ -0,0 +1,136 @@
+
+ /**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+
+/**
+ * Checks that the vectorized orientation update (used for controllers that
+ * are updated together) gives the same results as the scalar filter (used
+ * in lazy mode), including inputs where the corrective step is zero.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "psmove.h"
+#include "../../src/psmove_orientation.h"
+
+#define BEGIN_TEST(x) fprintf(stderr, "Testing: %s", x)
+#define END_TEST()    fprintf(stderr, " ... OK\n")
+
+/**
+ * The filters differ in their reciprocal square root (see psmove.h): the
+ * scalar invSqrt() is off by up to 0.18%, the vectorized one by 1e-5
+ **/
+#define TOLERANCE 5e-3f
+
+static void
+compare(PSMoveOrientation *batched, PSMoveOrientation *scalar)
+{
+    float a[4], b[4];
+    int k;
+
+    psmove_orientation_get_quaternion(batched, a, a+1, a+2, a+3);
+    psmove_orientation_get_quaternion(scalar, b, b+1, b+2, b+3);
+
+    for (k=0; k<4; k++) {
+        assert(isfinite(a[k]));
+        assert(fabsf(a[k] - b[k]) < TOLERANCE);
+    }
+}
+
+/* Run the same reports through both orientations, comparing each result */
+static void
+run(PSMove *move, const float *accel, const float *gyro)
+{
+    PSMoveOrientation *orientations[2];
+    PSMoveOrientationSample samples[2];
+    int i, frame, k;
+
+    orientations[0] = psmove_orientation_new(move);
+    orientations[1] = psmove_orientation_new(move);
+    assert(orientations[0] != NULL && orientations[1] != NULL);
+    psmove_orientation_set_lazy(orientations[1], PSMove_True);
+
+    memset(samples, 0, sizeof(samples));
+    for (frame=0; frame<2; frame++) {
+        for (k=0; k<3; k++) {
+            samples[0].sensors[frame*3 + k] = accel[k];
+            samples[0].sensors[6 + frame*3 + k] = gyro[k];
+        }
+    }
+
+    for (i=0; i<100; i++) {
+        /* Nominal spacing of 120 Hz, as the hardware clock runs */
+        samples[0].timestamp = (i * 2) & 0xFFFF;
+        samples[0].time_us = 1000000LL + i * 8333LL;
+        samples[1] = samples[0];
+
+        psmove_orientation_update_batch(orientations, samples, 2);
+        compare(orientations[0], orientations[1]);
+    }
+
+    psmove_orientation_free(orientations[0]);
+    psmove_orientation_free(orientations[1]);
+}
+
+int
+main(int argc, char* argv[])
+{
+    /* At rest, upright: the corrective step of the initial orientation is 0 */
+    const float upright[3] = { 0.f, 0.f, 1.f };
+    const float tilted[3] = { 0.3f, -0.2f, 0.93f };
+    const float still[3] = { 0.f, 0.f, 0.f };
+    const float turning[3] = { 0.5f, -0.25f, 1.f };
+
+    PSMove *move = psmove_connect();
+
+    if (move == NULL) {
+        printf("Could not connect to default Move controller.\n"
+               "Please connect one via USB or Bluetooth.\n");
+        exit(1);
+    }
+
+    /* The orientation needs the calibration data of a controller */
+    assert(psmove_has_calibration(move));
+
+    BEGIN_TEST("batched update stays finite with a zero corrective step");
+    run(move, upright, still);
+    END_TEST();
+
+    BEGIN_TEST("batched update matches the scalar filter (tilted, turning)");
+    run(move, tilted, turning);
+    END_TEST();
+
+    psmove_disconnect(move);
+
+    return 0;
+}
@@ -43,9 +43,13 @@ enum TestMode {
     STATIC_UPDATES,
 };
 
+/* Recording to read from instead of a controller (optional argument) */
+const char *replay_filename = NULL;
+
 void test_read_performance(PSMove *move, enum TestMode mode) {
     int round, max_rounds = 3;
     float sum = 0.;
+    int finished = 0;
 
     /* Only enable rate limiting if we test for smart updates */
     psmove_set_rate_limiting(move, mode == SMART_UPDATES);
@@ -54,7 +58,7 @@ void test_read_performance(PSMove *move, enum TestMode mode) {
         psmove_set_leds(move, 0, 255, 0);
     }
 
-    for (round=0; round<max_rounds; round++) {
+    for (round=0; round<max_rounds && !finished; round++) {
         long packet_loss = 0;
         long started = psmove_util_get_ticks();
         long reads = 0;
@@ -73,7 +77,16 @@ void test_read_performance(PSMove *move, enum TestMode mode) {
                 fprintf(stderr, "\r%c", "-\\|/"[(reads/20)%4]);
             }
 
-            while (!(sequence = psmove_poll(move))) {}
+            while (!(sequence = psmove_poll(move))) {
+                if (replay_filename != NULL && psmove_is_replay_finished(move)) {
+                    finished = 1;
+                    break;
+                }
+            }
+
+            if (finished) {
+                break;
+            }
 
             if (old_sequence != -1) {
                 if (sequence != ((old_sequence % 16) + 1)) {
@@ -88,6 +101,10 @@ void test_read_performance(PSMove *move, enum TestMode mode) {
         }
         fputc('\r', stderr);
         long diff = psmove_util_get_ticks() - started;
+        if (diff == 0) {
+            /* Replaying can be faster than the clock resolution */
+            diff = 1;
+        }
 
         double reads_per_second = 1000. * (double)reads / (double)diff;
         printf("%ld reads in %ld ms = %f reads/sec "
@@ -98,36 +115,72 @@ void test_read_performance(PSMove *move, enum TestMode mode) {
     }
 
     printf("=====\n");
-    printf("Mean over %d rounds: %f reads/sec\n", max_rounds,
-            sum/(double)max_rounds);
+    printf("Mean over %d rounds: %f reads/sec\n", round,
+            sum/(double)round);
+}
+
+PSMove *connect_move()
+{
+    if (replay_filename != NULL) {
+        /* Start from the beginning of the recording for each test */
+        return psmove_connect_replay(replay_filename, 0,
+                Replay_AsFastAsPossible);
+    }
+
+    return psmove_connect();
+}
+
+void run_test(PSMove *move, enum TestMode mode)
+{
+    if (replay_filename != NULL) {
+        move = connect_move();
+        assert(move != NULL);
+    }
+
+    test_read_performance(move, mode);
+
+    if (replay_filename != NULL) {
+        psmove_disconnect(move);
+    }
 }
 
 int main(int argc, char* argv[])
 {
-    PSMove *move = psmove_connect();
+    if (argc > 1) {
+        /* Benchmark without hardware using psmove_start_recording() data */
+        replay_filename = argv[1];
+    }
+
+    PSMove *move = connect_move();
 
     if (move == NULL) {
-        printf("Could not connect to default Move controller.\n"
-               "Please connect one via USB or Bluetooth.\n");
+        if (replay_filename != NULL) {
+            printf("Could not open recording: %s\n", replay_filename);
+        } else {
+            printf("Could not connect to default Move controller.\n"
+                   "Please connect one via USB or Bluetooth.\n");
+        }
         exit(1);
     }
 
     printf("\n -- PS Move API Sensor Reading Performance Test -- \n");
 
     printf("\nTesting STATIC READ performance (non-changing LED setting)\n");
-    test_read_performance(move, STATIC_UPDATES);
+    run_test(move, STATIC_UPDATES);
 
     printf("\nTesting SMART READ performance (rate-limited LED setting)\n");
-    test_read_performance(move, SMART_UPDATES);
+    run_test(move, SMART_UPDATES);
 
     printf("\nTesting BAD READ performance (continous LED setting)\n");
-    test_read_performance(move, ALL_UPDATES);
+    run_test(move, ALL_UPDATES);
 
     printf("\nTesting RAW READ performance (no LED setting)\n");
-    test_read_performance(move, NO_UPDATES);
+    run_test(move, NO_UPDATES);
 
     printf("\n");
 
+    psmove_disconnect(move);
+
     return 0;
 }
 
@@ -78,7 +78,7 @@ int main(int arg, char** args) {
         psmove_tracker_update_image(tracker);
         psmove_tracker_update(tracker, NULL);
 
-        frame = psmove_tracker_get_image(tracker);
+        frame = psmove_tracker_get_annotated_image(tracker);
         if (frame) {
             cvShowImage("live camera feed", frame);
         }
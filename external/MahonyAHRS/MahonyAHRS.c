@@ -8,6 +8,7 @@
 // Date			Author			Notes
 // 29/09/2011	SOH Madgwick    Initial release
 // 02/10/2011	SOH Madgwick	Optimised for reduced CPU load
+// 14/10/2026   PS Move API     Per-instance state and sample frequency
 //
 //=====================================================================================================
 
@@ -20,7 +21,6 @@
 //---------------------------------------------------------------------------------------------------
 // Definitions
 
-#define sampleFreq	512.0f			// sample frequency in Hz
 #define twoKpDef	(2.0f * 0.5f)	// 2 * proportional gain
 #define twoKiDef	(2.0f * 0.0f)	// 2 * integral gain
 
@@ -29,13 +29,11 @@
 
 volatile float twoKp = twoKpDef;											// 2 * proportional gain (Kp)
 volatile float twoKi = twoKiDef;											// 2 * integral gain (Ki)
-volatile float q0 = 1.0f, q1 = 0.0f, q2 = 0.0f, q3 = 0.0f;					// quaternion of sensor frame relative to auxiliary frame
-volatile float integralFBx = 0.0f,  integralFBy = 0.0f, integralFBz = 0.0f;	// integral error terms scaled by Ki
 
 //---------------------------------------------------------------------------------------------------
 // Function declarations
 
-float invSqrt(float x);
+static float invSqrt(float x);
 
 //====================================================================================================
 // Functions
@@ -43,7 +41,19 @@ float invSqrt(float x);
 //---------------------------------------------------------------------------------------------------
 // AHRS algorithm update
 
-void MahonyAHRSupdate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz) {
+void MahonyAHRSupdate(float *quaternion, float *integralFB, float sampleFreq,
+		float ax, float ay, float az,
+		float gx, float gy, float gz,
+		float mx, float my, float mz)
+{
+	float q0 = quaternion[0],
+	      q1 = quaternion[1],
+	      q2 = quaternion[2],
+	      q3 = quaternion[3];
+	float integralFBx = integralFB[0],
+	      integralFBy = integralFB[1],
+	      integralFBz = integralFB[2];
+
 	float recipNorm;
     float q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;  
 	float hx, hy, bx, bz;
@@ -53,7 +63,7 @@ void MahonyAHRSupdate(float gx, float gy, float gz, float ax, float ay, float az
 
 	// Use IMU algorithm if magnetometer measurement invalid (avoids NaN in magnetometer normalisation)
 	if((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)) {
-		MahonyAHRSupdateIMU(gx, gy, gz, ax, ay, az);
+		MahonyAHRSupdateIMU(quaternion, integralFB, sampleFreq, ax, ay, az, gx, gy, gz);
 		return;
 	}
 
@@ -142,12 +152,31 @@ void MahonyAHRSupdate(float gx, float gy, float gz, float ax, float ay, float az
 	q1 *= recipNorm;
 	q2 *= recipNorm;
 	q3 *= recipNorm;
+
+	quaternion[0] = q0;
+	quaternion[1] = q1;
+	quaternion[2] = q2;
+	quaternion[3] = q3;
+	integralFB[0] = integralFBx;
+	integralFB[1] = integralFBy;
+	integralFB[2] = integralFBz;
 }
 
 //---------------------------------------------------------------------------------------------------
 // IMU algorithm update
 
-void MahonyAHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, float az) {
+void MahonyAHRSupdateIMU(float *quaternion, float *integralFB, float sampleFreq,
+		float ax, float ay, float az,
+		float gx, float gy, float gz)
+{
+	float q0 = quaternion[0],
+	      q1 = quaternion[1],
+	      q2 = quaternion[2],
+	      q3 = quaternion[3];
+	float integralFBx = integralFB[0],
+	      integralFBy = integralFB[1],
+	      integralFBz = integralFB[2];
+
 	float recipNorm;
 	float halfvx, halfvy, halfvz;
 	float halfex, halfey, halfez;
@@ -211,13 +240,21 @@ void MahonyAHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, float
 	q1 *= recipNorm;
 	q2 *= recipNorm;
 	q3 *= recipNorm;
+
+	quaternion[0] = q0;
+	quaternion[1] = q1;
+	quaternion[2] = q2;
+	quaternion[3] = q3;
+	integralFB[0] = integralFBx;
+	integralFB[1] = integralFBy;
+	integralFB[2] = integralFBz;
 }
 
 //---------------------------------------------------------------------------------------------------
 // Fast inverse square-root
 // See: http://en.wikipedia.org/wiki/Fast_inverse_square_root
 
-float invSqrt(float x) {
+static float invSqrt(float x) {
 	float halfx = 0.5f * x;
 	float y = x;
 	long i = *(long*)&y;
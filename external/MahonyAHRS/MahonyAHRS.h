@@ -8,23 +8,41 @@
 // Date			Author			Notes
 // 29/09/2011	SOH Madgwick    Initial release
 // 02/10/2011	SOH Madgwick	Optimised for reduced CPU load
+// 14/10/2026   PS Move API     Per-instance state and sample frequency
 //
 //=====================================================================================================
 #ifndef MahonyAHRS_h
 #define MahonyAHRS_h
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 //----------------------------------------------------------------------------------------------------
 // Variable declaration
 
 extern volatile float twoKp;			// 2 * proportional gain (Kp)
 extern volatile float twoKi;			// 2 * integral gain (Ki)
-extern volatile float q0, q1, q2, q3;	// quaternion of sensor frame relative to auxiliary frame
 
 //---------------------------------------------------------------------------------------------------
 // Function declarations
 
-void MahonyAHRSupdate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz);
-void MahonyAHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, float az);
+// quaternion -> pointer to a float[4]
+// integralFB -> pointer to a float[3] (integral error terms, initially 0)
+// sampleFreq -> sample frequency in Hz
+
+void MahonyAHRSupdate(float *quaternion, float *integralFB, float sampleFreq,
+		float ax, float ay, float az,
+		float gx, float gy, float gz,
+		float mx, float my, float mz);
+
+void MahonyAHRSupdateIMU(float *quaternion, float *integralFB, float sampleFreq,
+		float ax, float ay, float az,
+		float gx, float gy, float gz);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
 //=====================================================================================================
@@ -30,6 +30,8 @@
 #ifndef __PSMOVE_H
 #define __PSMOVE_H
 
+#include <stddef.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -146,13 +148,280 @@ enum PSMove_Bool {
     PSMove_True = 1, /*!< True, Success, Enabled (depending on context) */
 };
 
+/*! Hotplug event type, see psmove_set_hotplug_callback() */
+enum PSMove_Hotplug_Event {
+    Hotplug_Added = 0, /*!< A controller has been connected */
+    Hotplug_Removed, /*!< A controller has been disconnected */
+};
+
+/*! Orientation filter algorithms, see psmove_set_orientation_filter() */
+enum PSMove_Orientation_Filter {
+    OrientationFilter_Madgwick = 0, /*!< Madgwick's gradient descent filter (default) */
+    OrientationFilter_Mahony, /*!< Mahony's complementary filter */
+    OrientationFilter_GyroIntegrator, /*!< Gyroscope only (cheapest, drifts) */
+};
+
+/*! Playback speed of recordings, see psmove_connect_replay() */
+enum PSMove_Replay_Mode {
+    Replay_RealTime = 0, /*!< Deliver reports with the recorded timing */
+    Replay_AsFastAsPossible, /*!< Deliver reports as fast as they are polled */
+};
+
+/*! Background threads of the library, see psmove_set_thread_policy() */
+enum PSMove_Thread_Type {
+    Thread_InputReader = 0, /*!< The input threads (see psmove_enable_input_thread()) */
+    Thread_LEDWriter, /*!< The thread writing LED and rumble updates */
+};
+
 struct _PSMove;
 typedef struct _PSMove PSMove; /*!< Handle to a PS Move Controller.
                                     Obtained via psmove_connect_by_id() */
 
+/*! Input report statistics.
+ * Counters about the input reports received from a controller since
+ * connecting (or since the last psmove_reset_stats() call). Missing and
+ * duplicate reports are detected using the report sequence number (see
+ * psmove_poll()), intervals are measured on the host when a report is
+ * received.
+ *
+ * Used by psmove_get_stats().
+ **/
+typedef struct {
+    unsigned long reports; /*!< Number of input reports received */
+    unsigned long sequence_gaps; /*!< Number of times reports were missing */
+    unsigned long dropped_reports; /*!< Estimated number of missing reports */
+    unsigned long duplicate_reports; /*!< Reports with a repeated sequence number */
+    unsigned long empty_polls; /*!< psmove_poll() calls without new data */
+    float min_interval_ms; /*!< Minimum time between two reports (in ms) */
+    float mean_interval_ms; /*!< Average time between two reports (in ms) */
+    float max_interval_ms; /*!< Maximum time between two reports (in ms) */
+} PSMoveStats;
+
+/*! Quality of the connection to a controller, see psmove_get_link_quality(). */
+typedef struct {
+    float quality; /*!< Fraction of input reports that recently arrived
+                        (1.0 if none were lost) */
+    float report_rate; /*!< Input reports received per second */
+    long last_report_ms; /*!< Time since the previous report (in ms), -1 if
+                              no report has been received yet */
+} PSMoveLinkQuality;
+
+/*! Summary of the input reports of a time window.
+ * Mean, minimum, maximum and RMS of each sensor axis over all half-frames
+ * of the window, and the buttons and trigger seen in it. The sensor values
+ * are calibrated (accelerometer in g, gyroscope in rad/s) when calibration
+ * data is available, otherwise raw readings.
+ *
+ * Used by psmove_get_aggregate().
+ **/
+typedef struct {
+    int reports; /*!< Number of input reports in the window */
+    long long start_us; /*!< Time the first report was received, see psmove_util_get_ticks_us() */
+    long long end_us; /*!< Time the last report was received */
+    int calibrated; /*!< Nonzero if the sensor values are calibrated */
+
+    float accel_mean[3]; /*!< Accelerometer X/Y/Z mean */
+    float accel_min[3]; /*!< Accelerometer X/Y/Z minimum */
+    float accel_max[3]; /*!< Accelerometer X/Y/Z maximum */
+    float accel_rms[3]; /*!< Accelerometer X/Y/Z root mean square */
+
+    float gyro_mean[3]; /*!< Gyroscope X/Y/Z mean */
+    float gyro_min[3]; /*!< Gyroscope X/Y/Z minimum */
+    float gyro_max[3]; /*!< Gyroscope X/Y/Z maximum */
+    float gyro_rms[3]; /*!< Gyroscope X/Y/Z root mean square */
+
+    int trigger_peak; /*!< Highest trigger value (0..255) */
+    unsigned int buttons; /*!< Buttons held in any report (see \ref PSMove_Button) */
+    unsigned int pressed; /*!< Buttons pressed during the window */
+} PSMoveAggregate;
+
+/*! Version of the layout of \ref PSMoveSample.
+ * Incremented whenever fields are added, removed or reordered. Code that
+ * uses the inline accessors (see psmove_sample.h) or reads the fields
+ * directly depends on the layout it has been compiled with, see
+ * psmove_get_sample_version().
+ **/
+#define PSMOVE_SAMPLE_VERSION 1
+
+/*! Decoded contents of one input report.
+ * All sensor readings of an input report, decoded in one go by
+ * psmove_get_sample(). Values that come in two half-frames (see
+ * \ref PSMove_Frame) are stored as arrays indexed by \ref Frame_FirstHalf
+ * and \ref Frame_SecondHalf, with one array per axis.
+ *
+ * The layout is part of the API (see \ref PSMOVE_SAMPLE_VERSION): the
+ * fields can be read directly, or with the psmove_sample_get_*()
+ * accessors, which are inline functions unless \c PSMOVE_NO_INLINE is
+ * defined.
+ **/
+typedef struct {
+    unsigned int buttons; /*!< Button bitmask, see psmove_get_buttons() */
+    unsigned char trigger[2]; /*!< Trigger value (0..255) per half-frame */
+    unsigned char battery; /*!< Battery level, see \ref PSMove_Battery_Level */
+    int temperature; /*!< Raw temperature, see psmove_get_temperature() */
+    int timestamp[2]; /*!< Hardware timestamp, see psmove_get_frame_timestamp() */
+
+    int raw_accel_x[2]; /*!< Raw accelerometer X reading per half-frame */
+    int raw_accel_y[2]; /*!< Raw accelerometer Y reading per half-frame */
+    int raw_accel_z[2]; /*!< Raw accelerometer Z reading per half-frame */
+    int raw_gyro_x[2]; /*!< Raw gyroscope X reading per half-frame */
+    int raw_gyro_y[2]; /*!< Raw gyroscope Y reading per half-frame */
+    int raw_gyro_z[2]; /*!< Raw gyroscope Z reading per half-frame */
+
+    float accel_x[2]; /*!< Calibrated accelerometer X value (in g) */
+    float accel_y[2]; /*!< Calibrated accelerometer Y value (in g) */
+    float accel_z[2]; /*!< Calibrated accelerometer Z value (in g) */
+    float gyro_x[2]; /*!< Calibrated gyroscope X value (in rad/s) */
+    float gyro_y[2]; /*!< Calibrated gyroscope Y value (in rad/s) */
+    float gyro_z[2]; /*!< Calibrated gyroscope Z value (in rad/s) */
+
+    int mag_x; /*!< Raw magnetometer X reading */
+    int mag_y; /*!< Raw magnetometer Y reading */
+    int mag_z; /*!< Raw magnetometer Z reading */
+} PSMoveSample;
+
+#include "psmove_sample.h"
+
+/*! Complete state of a controller for one frame of a binding.
+ * Filled in by psmove_update_state(). The struct only consists of 32-bit
+ * scalar fields (no arrays or pointers), so it is blittable and can be
+ * passed by reference from managed code (e.g. C# P/Invoke) without any
+ * marshalling. The first four fields are inputs, all others are outputs.
+ **/
+typedef struct {
+    int r; /*!< Input: red LED value (0..255), or -1 to leave it unchanged */
+    int g; /*!< Input: green LED value (0..255), or -1 to leave it unchanged */
+    int b; /*!< Input: blue LED value (0..255), or -1 to leave it unchanged */
+    int rumble; /*!< Input: rumble value (0..255), or -1 to leave it unchanged */
+
+    int reports; /*!< Number of input reports read during this update */
+    int update_result; /*!< Result of the LED update, see \ref PSMove_Update_Result */
+    unsigned int buttons; /*!< Buttons of the newest report, see psmove_get_buttons() */
+    unsigned int buttons_any; /*!< Buttons held in any report read during this update */
+    unsigned int pressed; /*!< Buttons pressed during this update */
+    unsigned int released; /*!< Buttons released during this update */
+    int trigger; /*!< Trigger value (0..255) of the newest report */
+    int battery; /*!< Battery level, see \ref PSMove_Battery_Level */
+    int temperature; /*!< Raw temperature, see psmove_get_temperature() */
+
+    int raw_accel_x; /*!< Raw accelerometer X, see psmove_get_accelerometer() */
+    int raw_accel_y; /*!< Raw accelerometer Y, see psmove_get_accelerometer() */
+    int raw_accel_z; /*!< Raw accelerometer Z, see psmove_get_accelerometer() */
+    int raw_gyro_x; /*!< Raw gyroscope X, see psmove_get_gyroscope() */
+    int raw_gyro_y; /*!< Raw gyroscope Y, see psmove_get_gyroscope() */
+    int raw_gyro_z; /*!< Raw gyroscope Z, see psmove_get_gyroscope() */
+    int mag_x; /*!< Raw magnetometer X reading */
+    int mag_y; /*!< Raw magnetometer Y reading */
+    int mag_z; /*!< Raw magnetometer Z reading */
+
+    float accel_x; /*!< Calibrated accelerometer X value (in g), or 0 */
+    float accel_y; /*!< Calibrated accelerometer Y value (in g), or 0 */
+    float accel_z; /*!< Calibrated accelerometer Z value (in g), or 0 */
+    float gyro_x; /*!< Calibrated gyroscope X value (in rad/s), or 0 */
+    float gyro_y; /*!< Calibrated gyroscope Y value (in rad/s), or 0 */
+    float gyro_z; /*!< Calibrated gyroscope Z value (in rad/s), or 0 */
+
+    float q0; /*!< Orientation quaternion, see psmove_get_orientation() */
+    float q1; /*!< Orientation quaternion, see psmove_get_orientation() */
+    float q2; /*!< Orientation quaternion, see psmove_get_orientation() */
+    float q3; /*!< Orientation quaternion, see psmove_get_orientation() */
+} PSMoveState;
+
+/*! A change of the button state, see psmove_get_button_event(). */
+typedef struct {
+    unsigned int buttons; /*!< All buttons pressed after the change */
+    unsigned int pressed; /*!< Buttons that have been pressed */
+    unsigned int released; /*!< Buttons that have been released */
+    long long time_us; /*!< Host time of the input report (see
+                            psmove_util_get_ticks_us()) */
+    int timestamp; /*!< Hardware timestamp of the input report (see
+                        psmove_get_timestamp()) */
+} PSMoveButtonEvent;
+
+/*! One step of an LED/rumble animation, see psmove_play_animation().
+ * The LEDs fade linearly from the color of the previous keyframe to the
+ * color of this keyframe over \a duration_ms milliseconds, and the rumble
+ * motor is set to \a rumble for the same time.
+ **/
+typedef struct {
+    unsigned char r; /*!< Red LED value at the end of this step */
+    unsigned char g; /*!< Green LED value at the end of this step */
+    unsigned char b; /*!< Blue LED value at the end of this step */
+    unsigned char rumble; /*!< Rumble intensity during this step */
+    int duration_ms; /*!< Duration of this step (0 = jump immediately) */
+} PSMoveKeyframe;
+
+/*! LED update policy of a controller, see psmove_set_led_policy(). */
+typedef struct {
+    int min_interval_ms; /*!< Minimum time between two LED updates if rate
+                              limiting is enabled (default: 120 ms) */
+    int keepalive_ms; /*!< Time after which unchanged LED values are sent
+                           again to keep them lit (default: 4000 ms) */
+    enum PSMove_Bool adaptive; /*!< Increase the minimum interval when LED
+                                    writes get slow (default: disabled) */
+    enum PSMove_Bool link_adaptive; /*!< Hold back LED updates while input
+                                         reports get lost, see
+                                         psmove_get_link_quality()
+                                         (default: enabled) */
+
+    int current_interval_ms; /*!< The minimum interval currently in effect
+                                  (output only, see psmove_get_led_policy) */
+    int write_latency_us; /*!< Average duration of an LED write in
+                               microseconds (output only) */
+} PSMoveLEDPolicy;
+
+/*! Scheduling of a background thread, see psmove_set_thread_policy(). */
+typedef struct {
+    unsigned long long cpu_mask; /*!< CPUs the thread may run on (bit n is
+                                      CPU n), 0 to keep the affinity the
+                                      thread inherited (default) */
+    int priority; /*!< 0 for normal scheduling (default), 1 to 99 for
+                       realtime (\c SCHED_FIFO) scheduling at that priority */
+} PSMoveThreadPolicy;
+
+/**
+ * \brief Hotplug callback function type.
+ *
+ * \param event \ref Hotplug_Added or \ref Hotplug_Removed
+ * \param serial The serial number (Bluetooth address) of the controller,
+ *               or an empty string for USB-connected controllers. Only
+ *               valid during the callback.
+ * \param type \ref Conn_USB or \ref Conn_Bluetooth
+ * \param user_data The pointer passed to psmove_set_hotplug_callback()
+ **/
+typedef void (*psmove_hotplug_callback)(enum PSMove_Hotplug_Event event,
+        const char *serial, enum PSMove_Connection_Type type, void *user_data);
+
+/**
+ * \brief Get notified when controllers are connected or disconnected.
+ *
+ * The callback is called for every locally-connected (USB or Bluetooth)
+ * controller that appears or disappears. When setting a callback, it is
+ * first called with \ref Hotplug_Added for all controllers that are
+ * already connected, so no controller is missed.
+ *
+ * On Linux, the callback is called from a background thread as soon as
+ * the system reports the change. On other systems, changes are detected
+ * when the device list is refreshed, so you have to call
+ * psmove_count_connected() regularly (which is cheap, see psmove_reinit())
+ * and the callback will be called from within that call.
+ *
+ * The callback can use all other API functions (e.g. to connect to a new
+ * controller using psmove_connect_by_id()).
+ *
+ * \param callback The function to call, or \c NULL to remove the callback
+ * \param user_data A pointer that will be passed to \a callback
+ **/
+ADDAPI void
+ADDCALL psmove_set_hotplug_callback(psmove_hotplug_callback callback,
+        void *user_data);
+
 /**
  * \brief Get the number of available controllers
  *
+ * Locally-connected controllers are counted using a cached device list
+ * (see psmove_reinit()), so this function is cheap to call repeatedly.
+ *
  * \return Number of controllers available (USB + Bluetooth + Remote)
  **/
 ADDAPI int
@@ -193,6 +462,64 @@ ADDCALL psmove_connect();
 ADDAPI PSMove *
 ADDCALL psmove_connect_by_id(int id);
 
+/**
+ * \brief Connect to all available controllers at once.
+ *
+ * This is equivalent to calling psmove_connect_by_id() for every controller
+ * counted by psmove_count_connected(), but locally-connected controllers
+ * are opened concurrently by a pool of worker threads (where supported),
+ * which is a lot faster when many controllers are connected.
+ *
+ * Controllers that can't be connected are left out of the result, so the
+ * position of a controller in the result is not necessarily its ID.
+ *
+ * \param count Pointer to store the number of connected controllers
+ *
+ * \return A newly-allocated array of \c *count valid \ref PSMove handles.
+ *         Disconnect each controller using psmove_disconnect() and then
+ *         free() the array when you are done with it.
+ * \return On error, \c NULL is returned.
+ **/
+ADDAPI PSMove **
+ADDCALL psmove_connect_all(int *count);
+
+/**
+ * \brief Play back a controller from a recording.
+ *
+ * Opens a virtual controller that delivers the input reports of one
+ * controller in a recording made with psmove_start_recording(). This makes
+ * it possible to test and benchmark input processing (calibration,
+ * orientation tracking, applications) deterministically without hardware.
+ *
+ * The recording is memory-mapped. LED and rumble updates are accepted but
+ * discarded. Calibration data is loaded from the PS Move API data directory
+ * using the recorded serial number, as for Bluetooth controllers.
+ *
+ * \param filename Path of the recording file
+ * \param device Zero-based index of the recorded controller (in the order
+ *               in which controllers first appeared during recording)
+ * \param mode \ref Replay_RealTime to deliver reports with their recorded
+ *             timing, \ref Replay_AsFastAsPossible to return the next
+ *             report on every psmove_poll()
+ *
+ * \return A new \ref PSMove handle, or \c NULL if the file is not a valid
+ *         recording or does not contain the requested controller
+ **/
+ADDAPI PSMove *
+ADDCALL psmove_connect_replay(const char *filename, int device,
+        enum PSMove_Replay_Mode mode);
+
+/**
+ * \brief Check if a replayed controller has reached the end of its recording.
+ *
+ * \param move A valid \ref PSMove handle obtained via psmove_connect_replay()
+ *
+ * \return \ref PSMove_True if all recorded input reports have been read
+ * \return \ref PSMove_False if more input reports are available
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_is_replay_finished(PSMove *move);
+
 /**
  * \brief Get the connection type of a PS Move controller
  *
@@ -225,6 +552,60 @@ ADDCALL psmove_connection_type(PSMove *move);
 ADDAPI enum PSMove_Bool
 ADDCALL psmove_is_remote(PSMove *move);
 
+/**
+ * \brief Get the clock offset and round-trip time of a remote controller's host.
+ *
+ * While a remote controller is polled, the clock of its \c moved host is
+ * sampled regularly (NTP-style). The reports then carry the time at which
+ * \c moved received them from the controller, converted to the local
+ * clock (see \ref PSMoveButtonEvent), so the orientation and its prediction
+ * (see psmove_get_orientation_predicted()) account for the network delay,
+ * and reports of several hosts can be put in order.
+ *
+ * \param move A valid \ref PSMove handle
+ * \param offset_us A pointer to store the offset of the host's clock to the
+ *                  local clock (in microseconds), or \c NULL
+ * \param rtt_us A pointer to store the round-trip time to the host (in
+ *               microseconds), or \c NULL
+ *
+ * \return \ref PSMove_True if the clock of the host has been sampled
+ * \return \ref PSMove_False if the controller is local, or not sampled yet
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_get_remote_clock(PSMove *move, long long *offset_us,
+        long long *rtt_us);
+
+/**
+ * \brief Set how long to wait for responses of remote (\c moved) hosts.
+ *
+ * Requests to \c moved are sent via UDP, so a request or its response can
+ * get lost. Instead of waiting forever, the request is given up after this
+ * timeout: psmove_poll() then reports no new data, and
+ * psmove_count_connected() does not count the controllers of that host.
+ *
+ * \param timeout_ms The time to wait for a response (in milliseconds), or
+ *                   a value <= 0 to use the default (100 ms)
+ **/
+ADDAPI void
+ADDCALL psmove_set_remote_timeout(int timeout_ms);
+
+/**
+ * \brief Get the file descriptor of a controller's device node.
+ *
+ * When the library is built with PSMOVE_USE_HIDRAW on Linux, locally
+ * connected controllers are accessed through their /dev/hidraw* device
+ * node directly. The returned file descriptor can be added to a poll(),
+ * select() or epoll set to wait for new input reports; call psmove_poll()
+ * once the descriptor becomes readable.
+ *
+ * \param move A valid \ref PSMove handle
+ *
+ * \return The file descriptor of the device, or -1 if the controller is
+ *         not accessed through the hidraw backend
+ **/
+ADDAPI int
+ADDCALL psmove_get_fd(PSMove *move);
+
 /**
  * \brief Get the serial number (Bluetooth MAC address) of a controller.
  *
@@ -270,7 +651,8 @@ ADDCALL psmove_get_serial(PSMove *move);
  * is a mobile device), you can use psmove_pair_custom() on a
  * different computer and specify the Bluetooth address of the
  * mobile device instead. For most use cases, you can use the
- * \c psmovepair command-line utility.
+ * \c psmovepair command-line utility (<tt>psmovepair --all</tt> pairs
+ * all USB-connected controllers at once, spread over all adapters).
  *
  * \param move A valid \ref PSMove handle
  *
@@ -315,6 +697,48 @@ ADDCALL psmove_pair_custom(PSMove *move, const char *btaddr_string);
 ADDAPI void
 ADDCALL psmove_set_rate_limiting(PSMove *move, enum PSMove_Bool enabled);
 
+/**
+ * \brief Configure LED update rate limiting and keepalive for a controller.
+ *
+ * Each LED update is an output report that competes with the input
+ * reports for Bluetooth bandwidth. With many controllers on one Bluetooth
+ * adapter, it can be useful to trade LED responsiveness for input
+ * bandwidth on some controllers.
+ *
+ * The minimum interval is used when rate limiting is enabled (see
+ * psmove_set_rate_limiting()) and for animations (see
+ * psmove_play_animation()). The keepalive interval determines when
+ * psmove_update_leds() resends unchanged LED values (the controller
+ * turns off the LEDs if it doesn't receive updates for a while).
+ *
+ * In adaptive mode, the minimum interval is increased to a multiple of
+ * the average LED write duration (up to the keepalive interval), so that
+ * LED updates back off automatically when the radio is congested.
+ *
+ * In link-adaptive mode (the default), LED updates are also rate limited
+ * while the controller loses input reports, with a minimum interval that
+ * grows with the fraction of lost reports (see psmove_get_link_quality()),
+ * so the input reports get the bandwidth.
+ *
+ * \param move A valid \ref PSMove handle
+ * \param policy The new policy (the output-only fields are ignored),
+ *               or \c NULL to restore the default policy
+ **/
+ADDAPI void
+ADDCALL psmove_set_led_policy(PSMove *move, const PSMoveLEDPolicy *policy);
+
+/**
+ * \brief Get the LED update policy of a controller.
+ *
+ * In addition to the configured values, this fills in the minimum
+ * interval currently in effect and the measured LED write latency.
+ *
+ * \param move A valid \ref PSMove handle
+ * \param policy Pointer to a \ref PSMoveLEDPolicy to be filled in
+ **/
+ADDAPI void
+ADDCALL psmove_get_led_policy(PSMove *move, PSMoveLEDPolicy *policy);
+
 /**
  * \brief Set the RGB LEDs on the PS Move controller.
  *
@@ -386,6 +810,70 @@ ADDCALL psmove_set_rumble(PSMove *move, unsigned char rumble);
 ADDAPI enum PSMove_Update_Result
 ADDCALL psmove_update_leds(PSMove *move);
 
+/**
+ * \brief Play an LED and rumble animation in the background.
+ *
+ * Instead of calling psmove_set_leds(), psmove_set_rumble() and
+ * psmove_update_leds() every frame to implement fades and pulses, an
+ * animation can be described as a sequence of keyframes and handed to the
+ * LED writer thread with one call. The writer thread computes the frames,
+ * writes them at most every 120 ms (the rate limiting interval, see
+ * psmove_set_rate_limiting()) and skips writes that would not change the
+ * LED or rumble state, saving Bluetooth bandwidth.
+ *
+ * The first keyframe fades from the current LED color. Starting a new
+ * animation replaces the current one. While an animation is playing,
+ * psmove_update_leds() ignores the values set by psmove_set_leds() and
+ * psmove_set_rumble(); they are sent again after the animation finished.
+ *
+ * Example (rumble pulse while flashing red, then fading to black):
+ *
+ * \code
+ * PSMoveKeyframe flash[] = {
+ *     { 255, 0, 0, 200, 0 },
+ *     { 255, 0, 0, 200, 300 },
+ *     { 0, 0, 0, 0, 1000 },
+ * };
+ * psmove_play_animation(move, flash, 3, 1);
+ * \endcode
+ *
+ * \param move A valid \ref PSMove handle
+ * \param keyframes Array of \a count keyframes (copied by this function)
+ * \param count Number of keyframes (at least 1)
+ * \param loops Number of times to play the animation, or 0 to loop until
+ *              psmove_stop_animation() is called
+ *
+ * \return \ref PSMove_True if the animation was started
+ * \return \ref PSMove_False if animations are not supported for this
+ *         controller (only locally-connected controllers on systems with
+ *         a background LED writer thread support animations)
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_play_animation(PSMove *move, const PSMoveKeyframe *keyframes,
+        int count, int loops);
+
+/**
+ * \brief Stop the animation started with psmove_play_animation().
+ *
+ * The LEDs keep the color of the last animation frame until the next
+ * call to psmove_update_leds(), which restores the LED state set by
+ * psmove_set_leds() and psmove_set_rumble().
+ *
+ * \param move A valid \ref PSMove handle
+ **/
+ADDAPI void
+ADDCALL psmove_stop_animation(PSMove *move);
+
+/**
+ * \brief Check if an animation is currently playing.
+ *
+ * \param move A valid \ref PSMove handle
+ *
+ * \return \ref PSMove_True if an animation is playing, \ref PSMove_False otherwise
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_is_animation_playing(PSMove *move);
+
 /**
  * \brief Read new sensor/button data from the controller.
  *
@@ -430,6 +918,276 @@ ADDCALL psmove_update_leds(PSMove *move);
 ADDAPI int
 ADDCALL psmove_poll(PSMove *move);
 
+/**
+ * \brief Wait for new sensor/button data from the controller.
+ *
+ * This works like psmove_poll(), but instead of returning \c 0
+ * immediately when no new data is available, it waits until a new input
+ * report arrives or the timeout expires, without spinning on the CPU:
+ *
+ * \code
+ *     while (1) {
+ *         if (psmove_wait_for_input(move, 100)) {
+ *             // process new data
+ *         }
+ *     }
+ * \endcode
+ *
+ * \param move A valid \ref PSMove handle
+ * \param timeout_ms Maximum time to wait (in ms), \c 0 to not wait at all
+ *                   (same as psmove_poll()) or a negative value to wait
+ *                   without a timeout
+ *
+ * \return a positive sequence number (1..16) if new data is
+ *         available
+ * \return \c 0 if the timeout expired or an error occurred
+ **/
+ADDAPI int
+ADDCALL psmove_wait_for_input(PSMove *move, int timeout_ms);
+
+/**
+ * \brief Enable or disable reading input reports in a background thread.
+ *
+ * By default, psmove_poll() reads input reports from the controller
+ * synchronously. With the input thread enabled, a per-controller thread
+ * receives all input reports as they arrive and queues them in a
+ * lock-free ring buffer, and psmove_poll() only takes the oldest queued
+ * report (or returns \c 0 immediately if none is queued). This keeps the
+ * HID read latency out of the main loop and avoids losing reports when
+ * a single iteration of the main loop takes longer than usual.
+ *
+ * psmove_poll() must only be called from one thread at a time while the
+ * input thread is enabled. If psmove_poll() is not called often enough,
+ * the ring buffer fills up and new reports are dropped.
+ *
+ * If orientation tracking is enabled (see psmove_enable_orientation()),
+ * the input thread also integrates the orientation of every report as it
+ * arrives (including reports dropped from a full ring buffer), so that
+ * psmove_poll() does not pay for the filter. psmove_get_orientation()
+ * always returns the latest result without blocking.
+ *
+ * \note This is currently only supported for locally-connected
+ *       controllers on Linux.
+ *
+ * \param move A valid \ref PSMove handle
+ * \param enabled \ref PSMove_True to start the input thread,
+ *                \ref PSMove_False to stop it
+ *
+ * \return \ref PSMove_True on success
+ * \return \ref PSMove_False if background reading is not supported
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_enable_input_thread(PSMove *move, enum PSMove_Bool enabled);
+
+/**
+ * \brief Pin a type of background thread to CPUs and set its priority.
+ *
+ * The policy applies to all threads of that type, including the ones that
+ * are already running (they pick it up before handling their next report
+ * or LED update). By default, the threads keep the CPU affinity of the
+ * process (e.g. as set by \c taskset) and normal scheduling, which is
+ * usually fine on a dedicated machine. A zero \c cpu_mask does not change
+ * the affinity, so threads that were pinned stay pinned. When other
+ * busy threads (e.g. a render thread) share the CPUs, pinning the input
+ * threads to a CPU of their own and/or giving them a realtime priority
+ * keeps the scheduler from delaying them.
+ *
+ * Realtime priorities need the appropriate rights (\c CAP_SYS_NICE or a
+ * suitable \c RLIMIT_RTPRIO); without them, the threads keep normal
+ * scheduling and a warning is printed.
+ *
+ * \note This is currently only supported on Linux.
+ *
+ * \param type The type of thread to configure
+ * \param policy The new policy, or \c NULL to restore the default policy
+ *
+ * \return \ref PSMove_True on success
+ * \return \ref PSMove_False if the policy is invalid or not supported
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_set_thread_policy(enum PSMove_Thread_Type type,
+        const PSMoveThreadPolicy *policy);
+
+/**
+ * \brief Get the policy of a type of background thread.
+ *
+ * \param type The type of thread
+ * \param policy A pointer to a \ref PSMoveThreadPolicy structure to fill
+ **/
+ADDAPI void
+ADDCALL psmove_get_thread_policy(enum PSMove_Thread_Type type,
+        PSMoveThreadPolicy *policy);
+
+/**
+ * \brief Record the input reports of all controllers to a file.
+ *
+ * Starts recording every input report received by psmove_poll() (for all
+ * connected controllers) together with its host timestamp into a compact
+ * binary file. Records are buffered in memory and written to disk by a
+ * background thread, so recording adds very little overhead to polling.
+ *
+ * If a recording is already in progress, it is stopped first. Recordings
+ * must not be started or stopped while another thread calls psmove_poll().
+ *
+ * \param filename Path of the recording file (will be overwritten)
+ *
+ * \return \ref PSMove_True if the recording was started
+ * \return \ref PSMove_False if the file could not be created
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_start_recording(const char *filename);
+
+/**
+ * \brief Stop recording input reports.
+ *
+ * Writes all pending records to disk and closes the recording file.
+ * Does nothing if no recording is in progress.
+ **/
+ADDAPI void
+ADDCALL psmove_stop_recording();
+
+/**
+ * \brief Get input report statistics of the controller.
+ *
+ * The statistics are always collected (at negligible cost) when calling
+ * psmove_poll() and can be used to detect Bluetooth congestion or a main
+ * loop that doesn't read reports often enough. See \ref PSMoveStats for
+ * a description of the fields.
+ *
+ * Because there are only 16 sequence numbers, \c dropped_reports is a
+ * lower bound if more than 15 reports are missing in a row.
+ *
+ * \param move A valid \ref PSMove handle
+ * \param stats Pointer to a \ref PSMoveStats that will be filled in
+ **/
+ADDAPI void
+ADDCALL psmove_get_stats(PSMove *move, PSMoveStats *stats);
+
+/**
+ * \brief Get the current quality of the connection to the controller.
+ *
+ * Unlike the cumulative \ref PSMoveStats, this describes the last second
+ * or so: Lost reports (detected using the sequence numbers) and the report
+ * rate are measured over short windows as the reports arrive (in the input
+ * thread if enabled, see psmove_enable_input_thread(), otherwise in
+ * psmove_poll(), which then has to be called often enough).
+ *
+ * With many controllers on one Bluetooth adapter, the input reports
+ * compete with the LED and rumble updates. By default, LED updates to a
+ * controller that loses more than 5% of its reports are therefore rate
+ * limited (even if psmove_set_rate_limiting() is disabled), all the more
+ * the more reports are lost, see \ref PSMoveLEDPolicy.
+ *
+ * \param move A valid \ref PSMove handle
+ * \param quality Pointer to a \ref PSMoveLinkQuality that will be filled in
+ *
+ * \return \ref PSMove_True if reports have been received recently
+ * \return \ref PSMove_False if the link is down (or nothing was received yet)
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_get_link_quality(PSMove *move, PSMoveLinkQuality *quality);
+
+/**
+ * \brief Get the memory used by a controller handle.
+ *
+ * This is the heap memory allocated by the library for this controller:
+ * the handle itself, the input ring of the read thread (only allocated
+ * while psmove_enable_input_thread() is enabled), the calibration data
+ * and orientation state. Memory of the HID library and of replays is not
+ * included.
+ *
+ * \param move A valid \ref PSMove handle
+ *
+ * \return The memory usage in bytes
+ **/
+ADDAPI size_t
+ADDCALL psmove_get_memory_usage(PSMove *move);
+
+/**
+ * \brief Summarize the input reports over time windows.
+ *
+ * For consumers that only need a few updates per second (e.g. telemetry
+ * or logging), the reports can be summarized where they are received, so
+ * the consumer doesn't have to process each of them. Every report is
+ * included, even the ones that the application doesn't psmove_poll() in
+ * time when the input thread is enabled (see psmove_enable_input_thread()).
+ * Without the input thread, the reports are summarized in psmove_poll().
+ *
+ * With a positive \a window_ms, the windows have a fixed length (a window
+ * is complete with the first report after its end), and
+ * psmove_get_aggregate() returns the last complete one. With \c 0, a
+ * window lasts until the next psmove_get_aggregate() call.
+ *
+ * \param move A valid \ref PSMove handle
+ * \param window_ms The length of the windows (in ms), \c 0 to end the
+ *                  windows on each psmove_get_aggregate() call, or a
+ *                  negative value to disable the aggregation
+ *
+ * \return \ref PSMove_True on success
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_set_aggregation(PSMove *move, int window_ms);
+
+/**
+ * \brief Get the summary of the input reports of a time window.
+ *
+ * This can be called from any thread. See psmove_set_aggregation().
+ *
+ * \param move A valid \ref PSMove handle
+ * \param aggregate Pointer to a \ref PSMoveAggregate that will be filled in
+ *
+ * \return \ref PSMove_True if the window has not been returned before
+ *         and contains at least one report
+ * \return \ref PSMove_False otherwise (\a aggregate is filled in anyway)
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_get_aggregate(PSMove *move, PSMoveAggregate *aggregate);
+
+/**
+ * \brief Reset the input report statistics of the controller.
+ *
+ * \param move A valid \ref PSMove handle
+ **/
+ADDAPI void
+ADDCALL psmove_reset_stats(PSMove *move);
+
+/**
+ * \brief Read new sensor/button data from multiple controllers at once.
+ *
+ * This calls psmove_poll() on each controller in \a moves and, if none
+ * of them has new data, waits until at least one of them receives a new
+ * input report or the timeout expires. It replaces having one busy loop
+ * per controller with a single wakeup:
+ *
+ * \code
+ *     while (1) {
+ *         unsigned int ready = psmove_poll_all(moves, count, 100);
+ *         for (i=0; i<count; i++) {
+ *             if (ready & (1u << i)) {
+ *                 // process new data of moves[i]
+ *             }
+ *         }
+ *     }
+ * \endcode
+ *
+ * To wait, the input thread (see psmove_enable_input_thread()) is started
+ * for every local controller that does not have it yet (unless \a timeout_ms
+ * is \c 0); it keeps running after the call. If a controller can't have
+ * one (remote and replayed controllers, or platforms without thread
+ * support), the controllers are polled in a loop every millisecond until
+ * data arrives or the timeout expires.
+ *
+ * \param moves An array of valid \ref PSMove handles
+ * \param count The number of handles in \a moves (at most 32)
+ * \param timeout_ms Maximum time to wait (in ms), \c 0 to not wait at all
+ *                   or a negative value to wait without a timeout
+ *
+ * \return A bitmask with bit \c i set if \c moves[i] has new data
+ * \return \c 0 if the timeout expired or an error occurred
+ **/
+ADDAPI unsigned int
+ADDCALL psmove_poll_all(PSMove **moves, int count, int timeout_ms);
+
 /**
  * \brief Get the current button states from the controller.
  *
@@ -496,6 +1254,39 @@ ADDAPI void
 ADDCALL psmove_get_button_events(PSMove *move, unsigned int *pressed,
         unsigned int *released);
 
+/**
+ * \brief Get the next queued button event.
+ *
+ * psmove_get_button_events() only compares the current report with the
+ * state at its last call, so presses that start and end between two calls
+ * are lost (e.g. if the application polls several reports before checking
+ * the buttons). In addition, every button change seen while decoding input
+ * reports in psmove_poll() is queued with its timestamps (up to 64 events
+ * per controller; if the application doesn't drain the queue, the oldest
+ * events are dropped).
+ *
+ * Example usage:
+ *
+ * \code
+ *     PSMoveButtonEvent event;
+ *
+ *     while (psmove_poll(move)) {}
+ *
+ *     while (psmove_get_button_event(move, &event)) {
+ *         if (event.pressed & Btn_MOVE) {
+ *             printf("Move button pressed at %lld us\n", event.time_us);
+ *         }
+ *     }
+ * \endcode
+ *
+ * \param move A valid \ref PSMove handle
+ * \param event Pointer to a \ref PSMoveButtonEvent to be filled in
+ *
+ * \return 1 if an event was stored in \a event, 0 if the queue is empty
+ **/
+ADDAPI int
+ADDCALL psmove_get_button_event(PSMove *move, PSMoveButtonEvent *event);
+
 /**
  * \brief Get the battery charge level of the controller.
  *
@@ -693,6 +1484,128 @@ ADDAPI void
 ADDCALL psmove_get_gyroscope_frame(PSMove *move, enum PSMove_Frame frame,
         float *gx, float *gy, float *gz);
 
+/**
+ * \brief Get the hardware timestamp of the current input report.
+ *
+ * Each input report carries a 16-bit timestamp generated by the
+ * controller itself when the sensors were sampled. Unlike the host-side
+ * psmove_util_get_ticks(), it is not affected by Bluetooth or scheduling
+ * jitter, so it can be used to compute the exact time between reports.
+ *
+ * The timestamp is a free-running counter that wraps around at 0xFFFF,
+ * so differences should be computed as <tt>(b - a) \& 0xFFFF</tt>.
+ *
+ * You need to call psmove_poll() first to read new data from the
+ * controller.
+ *
+ * \param move A valid \ref PSMove handle
+ *
+ * \return The raw hardware timestamp (0..0xFFFF) of the current report
+ **/
+ADDAPI int
+ADDCALL psmove_get_timestamp(PSMove *move);
+
+/**
+ * \brief Get the hardware timestamp of a single half-frame.
+ *
+ * The report timestamp (see psmove_get_timestamp()) belongs to the
+ * most recent half-frame (\ref Frame_SecondHalf). The sample time of
+ * \ref Frame_FirstHalf is derived from the spacing between the current
+ * and the previous report, as both half-frames are sampled at equal
+ * intervals. For the very first report, both half-frames get the same
+ * timestamp.
+ *
+ * You need to call psmove_poll() first to read new data from the
+ * controller.
+ *
+ * \param move A valid \ref PSMove handle
+ * \param frame \ref Frame_FirstHalf or \ref Frame_SecondHalf (see \ref PSMove_Frame)
+ *
+ * \return The raw hardware timestamp (0..0xFFFF) of the half-frame
+ **/
+ADDAPI int
+ADDCALL psmove_get_frame_timestamp(PSMove *move, enum PSMove_Frame frame);
+
+/**
+ * \brief Get all sensor and button values of the current report at once.
+ *
+ * This decodes the whole input report into a \ref PSMoveSample, which is
+ * much cheaper than calling the individual getter functions for each
+ * value (and for each half-frame), especially from language bindings.
+ *
+ * The calibrated values are only filled in if calibration data is
+ * available (see psmove_has_calibration()), otherwise they are set to
+ * \c 0. The raw values are always filled in.
+ *
+ * You need to call psmove_poll() first to read new data from the
+ * controller.
+ *
+ * \param move A valid \ref PSMove handle
+ * \param sample Pointer to a \ref PSMoveSample that will be filled in
+ *
+ * \return \ref PSMove_True on success, \ref PSMove_False on error
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_get_sample(PSMove *move, PSMoveSample *sample);
+
+/**
+ * \brief Get the version of the \ref PSMoveSample layout of the library.
+ *
+ * Applications (and bindings) compiled against a different version of
+ * psmove.h can compare this to \ref PSMOVE_SAMPLE_VERSION before using
+ * the fields of \ref PSMoveSample.
+ *
+ * \return The \ref PSMOVE_SAMPLE_VERSION the library has been built with
+ **/
+ADDAPI int
+ADDCALL psmove_get_sample_version();
+
+/**
+ * \brief Do a complete per-frame update of a controller in one call.
+ *
+ * This is meant for language bindings where every call into the native
+ * library is expensive (e.g. C# P/Invoke in Unity). One call does the
+ * work of a whole frame of individual calls:
+ *
+ *  - Applies the LED and rumble values from the input fields of
+ *    \a state (fields set to \c -1 are left unchanged)
+ *  - Reads all pending reports with psmove_poll(), collecting the
+ *    button changes of every report
+ *  - Fills in the output fields from the newest report
+ *  - Sends the LED and rumble values with psmove_update_leds()
+ *
+ * The calibrated values are only filled in if calibration data is
+ * available (see psmove_has_calibration()), the orientation only if
+ * orientation tracking is enabled (see psmove_has_orientation()).
+ * Otherwise they are set to \c 0 (and the identity quaternion).
+ *
+ * If no report was pending, the sensor and button fields keep the values
+ * of the last report that has been read.
+ *
+ * \param move A valid \ref PSMove handle
+ * \param state Pointer to a \ref PSMoveState with the input fields set
+ *
+ * \return The result of the LED update (see \ref PSMove_Update_Result),
+ *         \ref Update_Failed means that the controller is disconnected
+ **/
+ADDAPI enum PSMove_Update_Result
+ADDCALL psmove_update_state(PSMove *move, PSMoveState *state);
+
+/**
+ * \brief Do a complete per-frame update of several controllers.
+ *
+ * Calls psmove_update_state() for each controller, so a binding can
+ * update all of its controllers with a single native call.
+ *
+ * \param moves Array of \a count valid \ref PSMove handles
+ * \param states Array of \a count \ref PSMoveState structs
+ * \param count Number of controllers in \a moves and \a states
+ *
+ * \return The number of controllers whose LED update did not fail
+ **/
+ADDAPI int
+ADDCALL psmove_update_states(PSMove **moves, PSMoveState *states, int count);
+
 /**
  * \brief Check if calibration is available on this controller.
  *
@@ -708,6 +1621,11 @@ ADDCALL psmove_get_gyroscope_frame(PSMove *move, enum PSMove_Frame frame,
  * values will return uncalibrated values. Also, the orientation features
  * will not work without calibration.
  *
+ * The calibration data is not loaded when connecting, but on first use
+ * (this function, the calibrated getters and the orientation features),
+ * which can take a moment on USB. Use psmove_load_calibration_async()
+ * to load it in the background instead.
+ *
  * \param move A valid \ref PSMove handle
  *
  * \return \ref PSMove_True if calibration is supported, \ref PSMove_False otherwise
@@ -715,6 +1633,36 @@ ADDCALL psmove_get_gyroscope_frame(PSMove *move, enum PSMove_Frame frame,
 ADDAPI enum PSMove_Bool
 ADDCALL psmove_has_calibration(PSMove *move);
 
+/**
+ * \brief Start loading the calibration data in the background.
+ *
+ * Connecting to a controller does not load its calibration data, so
+ * applications that only use buttons and LEDs connect faster. This starts
+ * loading the data in a background thread, so that it is (usually)
+ * ready when needed; use psmove_is_calibration_loaded() to check.
+ * Functions that need the data before the thread is done wait for it.
+ *
+ * Without thread support, the data is loaded before this function returns.
+ *
+ * \param move A valid \ref PSMove handle
+ **/
+ADDAPI void
+ADDCALL psmove_load_calibration_async(PSMove *move);
+
+/**
+ * \brief Check if the calibration data has been loaded.
+ *
+ * Unlike psmove_has_calibration(), this never loads the data (and thus
+ * never blocks).
+ *
+ * \param move A valid \ref PSMove handle
+ *
+ * \return \ref PSMove_True if the data has been loaded (whether or not
+ *         calibration is available), \ref PSMove_False otherwise
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_is_calibration_loaded(PSMove *move);
+
 /**
  * \brief Dump the calibration information to stdout.
  *
@@ -735,7 +1683,8 @@ ADDCALL psmove_dump_calibration(PSMove *move);
  *
  * This will enable orientation tracking and update the internal orientation
  * quaternion (which can be retrieved using psmove_get_orientation()) when
- * psmove_poll() is called.
+ * psmove_poll() is called (or as reports arrive, if the input thread is
+ * enabled, see psmove_enable_input_thread()).
  *
  * In addition to enabling the orientation tracking features, calibration data
  * and an orientation algorithm (usually built-in) has to be used, too. You can
@@ -792,6 +1741,31 @@ ADDAPI void
 ADDCALL psmove_get_orientation(PSMove *move,
         float *q0, float *q1, float *q2, float *q3);
 
+/**
+ * \brief Get the predicted orientation as quaternion.
+ *
+ * This extrapolates the current orientation (see psmove_get_orientation())
+ * to dt_us microseconds from now, assuming the controller keeps rotating
+ * at the rate of the latest gyroscope reading. The time since the latest
+ * input report is included, so the result is valid for "now + dt_us" no
+ * matter when psmove_poll() was last called. The extrapolation is limited
+ * to 100 ms beyond the latest report.
+ *
+ * This does not read from the controller and only costs a few floating
+ * point operations, so it can be called right before rendering a frame,
+ * with dt_us set to the expected latency until the frame is displayed.
+ *
+ * \param move A valid \ref PSMove handle
+ * \param dt_us Time from now (in microseconds) to predict the orientation for
+ * \param q0 A pointer to store the first part of the orientation quaternion
+ * \param q1 A pointer to store the second part of the orientation quaternion
+ * \param q2 A pointer to store the third part of the orientation quaternion
+ * \param q3 A pointer to store the fourth part of the orientation quaternion
+ **/
+ADDAPI void
+ADDCALL psmove_get_orientation_predicted(PSMove *move, int dt_us,
+        float *q0, float *q1, float *q2, float *q3);
+
 /**
  * \brief (Re-)Set the current orientation quaternion.
  *
@@ -816,6 +1790,93 @@ ADDAPI void
 ADDCALL psmove_set_orientation(PSMove *move,
         float q0, float q1, float q2, float q3);
 
+/**
+ * \brief Enable or disable lazy orientation updates.
+ *
+ * By default, every input report is integrated into the orientation as soon
+ * as it is received. In lazy mode, psmove_poll() only stores calibrated
+ * sensor samples, and they are integrated in one go the next time the
+ * orientation is read (psmove_get_orientation() or
+ * psmove_get_orientation_predicted()). This is cheaper for applications
+ * that read the orientation much less often than reports arrive (e.g. once
+ * per frame at 30 Hz). The results are equivalent up to rounding: lazy
+ * mode integrates with the scalar filter, while psmove_poll_all() updates
+ * several controllers at once with a vectorized reciprocal square root.
+ *
+ * At most 64 samples are stored; if the orientation is not read for longer
+ * than that, the stored samples are integrated when the next one arrives.
+ *
+ * \param move A valid \ref PSMove handle
+ * \param enabled \ref PSMove_True to integrate lazily, \ref PSMove_False
+ *                to integrate every report immediately (the default)
+ *
+ * \return \ref PSMove_True on success
+ * \return \ref PSMove_False if orientation tracking is not available
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_enable_lazy_orientation(PSMove *move, enum PSMove_Bool enabled);
+
+/**
+ * \brief Select the algorithm used for orientation tracking.
+ *
+ * The filters differ in accuracy and CPU cost:
+ *
+ *  - \ref OrientationFilter_Madgwick corrects gyroscope drift using the
+ *    accelerometer (gradient descent); this is the default
+ *  - \ref OrientationFilter_Mahony corrects drift using a proportional
+ *    (and optionally integral) feedback, which is slightly cheaper
+ *  - \ref OrientationFilter_GyroIntegrator only integrates the gyroscope;
+ *    it is the cheapest option, but the orientation drifts over time and
+ *    has to be corrected using psmove_set_orientation()
+ *
+ * The current orientation is kept when switching filters. Use
+ * psmove_get_orientation_filter_cost() to compare the filters on the
+ * target machine.
+ *
+ * \param move A valid \ref PSMove handle
+ * \param filter The filter to use (see \ref PSMove_Orientation_Filter)
+ *
+ * \return \ref PSMove_True on success
+ * \return \ref PSMove_False if orientation tracking is not available
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_set_orientation_filter(PSMove *move,
+        enum PSMove_Orientation_Filter filter);
+
+/**
+ * \brief Get the measured CPU cost of the orientation filter.
+ *
+ * The time spent in the orientation filter is measured continuously;
+ * the average is reset when a different filter is selected.
+ *
+ * \param move A valid \ref PSMove handle
+ *
+ * \return The average time per filter update (one half-frame) in
+ *         nanoseconds, or 0 if no updates have been measured yet
+ **/
+ADDAPI float
+ADDCALL psmove_get_orientation_filter_cost(PSMove *move);
+
+/**
+ * \brief Check if the controller is lying still.
+ *
+ * The orientation tracking detects when a controller doesn't move (e.g.
+ * while it is lying on a table or sitting in its charger). After half a
+ * second without motion, the orientation filter is paused and the
+ * orientation is held, which saves its cost for idle controllers. In the
+ * meantime, the gyroscope readings are used to estimate the remaining bias
+ * of the gyroscope, which is then subtracted from all readings, reducing
+ * the drift once the controller moves again. The filter resumes with the
+ * first report that shows any motion.
+ *
+ * \param move A valid \ref PSMove handle
+ *
+ * \return \ref PSMove_True if the controller is still and the filter paused
+ * \return \ref PSMove_False if it moves or orientation tracking is disabled
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_is_still(PSMove *move);
+
 
 /**
  * \brief Disconnect from the PS Move and release resources.
@@ -844,8 +1905,13 @@ ADDCALL psmove_disconnect(PSMove *move);
  *
  * You do not need to call this function at application startup.
  *
+ * The list of locally-connected controllers is cached. On Linux, it is
+ * refreshed automatically when controllers are added or removed, on other
+ * systems, it is refreshed when it is older than a second. This function
+ * drops the cached list immediately.
+ *
  * \bug It should be possible to auto-detect newly-connected controllers
- *      without having to rely on this function.
+ *      without having to rely on this function on Mac OS X.
  **/
 ADDAPI void
 ADDCALL psmove_reinit();
@@ -857,11 +1923,28 @@ ADDCALL psmove_reinit();
  * measurement. It implements a cross-platform way of getting the current
  * time, relative to library use.
  *
+ * This is psmove_util_get_ticks_us() divided by 1000, so both functions
+ * share the same (monotonic) time base.
+ *
  * \return Time (in ms) since first library use.
  **/
 ADDAPI long
 ADDCALL psmove_util_get_ticks();
 
+/**
+ * \brief Get microseconds since first library use.
+ *
+ * A monotonic, high-resolution clock for measuring short intervals (for
+ * example the time between input reports at 120+ Hz, where millisecond
+ * resolution is too coarse). It is not affected by changes of the system
+ * time. The timestamps of input reports (see psmove_get_stats()) and of
+ * psmove_util_get_ticks() use the same time base.
+ *
+ * \return Time (in microseconds) since first library use.
+ **/
+ADDAPI long long
+ADDCALL psmove_util_get_ticks_us();
+
 /**
  * \brief Get local save directory for settings.
  *
@@ -892,6 +1975,29 @@ ADDCALL psmove_util_get_data_dir();
 ADDAPI char *
 ADDCALL psmove_util_get_file_path(const char *filename);
 
+/**
+ * \brief Write the recorded trace events to a file.
+ *
+ * If the library has been built with \c PSMOVE_USE_TRACE, the library
+ * and the tracker record timing events (polling, HID reads, LED writes,
+ * camera capture and the stages of the tracker) into a ring buffer per
+ * thread, which holds the most recent events. This writes them as JSON
+ * in the Chrome trace event format, which can be opened in
+ * \c chrome://tracing or in Perfetto. Times (\c ts) are in microseconds,
+ * see psmove_util_get_ticks_us().
+ *
+ * Recording continues while the trace is written. If the environment
+ * variable \c PSMOVE_TRACE_FILE is set, the trace is also written to
+ * that file when the process exits.
+ *
+ * \param filename The file to write the trace to (will be overwritten)
+ *
+ * \return \ref PSMove_True on success
+ * \return \ref PSMove_False on error, or if tracing is not compiled in
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_trace_dump(const char *filename);
+
 
 #ifdef __cplusplus
 }
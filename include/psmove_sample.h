@@ -0,0 +1,228 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+
+
+/**
+ * Accessors for the fields of a PSMoveSample (see psmove_get_sample()).
+ *
+ * This file is included by psmove.h, don't include it directly. The
+ * accessors are "static inline" functions, so they cost nothing when
+ * compiled with optimization. Define PSMOVE_NO_INLINE before including
+ * psmove.h to call the exported versions instead (these also exist for
+ * language bindings and other FFI users, which can't use the inline
+ * versions).
+ *
+ * The inline versions depend on the layout of PSMoveSample at compile
+ * time; compare PSMOVE_SAMPLE_VERSION with psmove_get_sample_version()
+ * to check if the library uses the same layout.
+ *
+ * The sample must be valid, there are no checks for NULL pointers
+ * (except for the output pointers, which can be NULL to skip a value).
+ **/
+
+#ifndef PSMOVE_SAMPLE_H
+#define PSMOVE_SAMPLE_H
+
+#if defined(SWIG) || defined(PSMOVE_NO_INLINE)
+#  define PSMOVE_SAMPLE_API ADDAPI
+#  define PSMOVE_SAMPLE_CALL ADDCALL
+#else
+#  if defined(_MSC_VER) && !defined(__cplusplus)
+#    define PSMOVE_SAMPLE_API static __inline
+#  else
+#    define PSMOVE_SAMPLE_API static inline
+#  endif
+#  define PSMOVE_SAMPLE_CALL
+#  define PSMOVE_SAMPLE_DEFINITIONS
+#endif
+
+/**
+ * \brief Button bitmask of a sample (see psmove_get_buttons())
+ **/
+PSMOVE_SAMPLE_API unsigned int
+PSMOVE_SAMPLE_CALL psmove_sample_get_buttons(const PSMoveSample *sample);
+
+/**
+ * \brief Trigger value of a sample (0..255, average of both half-frames,
+ * see psmove_get_trigger())
+ **/
+PSMOVE_SAMPLE_API unsigned char
+PSMOVE_SAMPLE_CALL psmove_sample_get_trigger(const PSMoveSample *sample);
+
+/**
+ * \brief Battery level of a sample (see psmove_get_battery())
+ **/
+PSMOVE_SAMPLE_API enum PSMove_Battery_Level
+PSMOVE_SAMPLE_CALL psmove_sample_get_battery(const PSMoveSample *sample);
+
+/**
+ * \brief Raw temperature of a sample (see psmove_get_temperature())
+ **/
+PSMOVE_SAMPLE_API int
+PSMOVE_SAMPLE_CALL psmove_sample_get_temperature(const PSMoveSample *sample);
+
+/**
+ * \brief Hardware timestamp of a half-frame (see psmove_get_frame_timestamp())
+ **/
+PSMOVE_SAMPLE_API int
+PSMOVE_SAMPLE_CALL psmove_sample_get_frame_timestamp(const PSMoveSample *sample,
+        enum PSMove_Frame frame);
+
+/**
+ * \brief Raw accelerometer reading, averaged over both half-frames
+ * (same as psmove_get_accelerometer())
+ **/
+PSMOVE_SAMPLE_API void
+PSMOVE_SAMPLE_CALL psmove_sample_get_accelerometer(const PSMoveSample *sample,
+        int *ax, int *ay, int *az);
+
+/**
+ * \brief Raw gyroscope reading, averaged over both half-frames
+ * (same as psmove_get_gyroscope())
+ **/
+PSMOVE_SAMPLE_API void
+PSMOVE_SAMPLE_CALL psmove_sample_get_gyroscope(const PSMoveSample *sample,
+        int *gx, int *gy, int *gz);
+
+/**
+ * \brief Raw magnetometer reading (see psmove_get_magnetometer())
+ **/
+PSMOVE_SAMPLE_API void
+PSMOVE_SAMPLE_CALL psmove_sample_get_magnetometer(const PSMoveSample *sample,
+        int *mx, int *my, int *mz);
+
+/**
+ * \brief Calibrated accelerometer values (in g) of a half-frame
+ * (see psmove_get_accelerometer_frame())
+ **/
+PSMOVE_SAMPLE_API void
+PSMOVE_SAMPLE_CALL psmove_sample_get_accelerometer_frame(const PSMoveSample *sample,
+        enum PSMove_Frame frame, float *ax, float *ay, float *az);
+
+/**
+ * \brief Calibrated gyroscope values (in rad/s) of a half-frame
+ * (see psmove_get_gyroscope_frame())
+ **/
+PSMOVE_SAMPLE_API void
+PSMOVE_SAMPLE_CALL psmove_sample_get_gyroscope_frame(const PSMoveSample *sample,
+        enum PSMove_Frame frame, float *gx, float *gy, float *gz);
+
+#endif /* PSMOVE_SAMPLE_H */
+
+
+/**
+ * The definitions: inline (see above), or the exported versions if the
+ * library defines PSMOVE_SAMPLE_DEFINITIONS itself.
+ **/
+#if defined(PSMOVE_SAMPLE_DEFINITIONS) && !defined(PSMOVE_SAMPLE_DEFINED)
+#define PSMOVE_SAMPLE_DEFINED
+
+/* The raw values are biased by 0x8000 before averaging, like in the report */
+#define PSMOVE_SAMPLE_AVERAGE(v) (((v)[0] + (v)[1] + 0x10000) / 2 - 0x8000)
+
+PSMOVE_SAMPLE_API unsigned int
+PSMOVE_SAMPLE_CALL psmove_sample_get_buttons(const PSMoveSample *sample)
+{
+    return sample->buttons;
+}
+
+PSMOVE_SAMPLE_API unsigned char
+PSMOVE_SAMPLE_CALL psmove_sample_get_trigger(const PSMoveSample *sample)
+{
+    return (sample->trigger[Frame_FirstHalf] +
+            sample->trigger[Frame_SecondHalf]) / 2;
+}
+
+PSMOVE_SAMPLE_API enum PSMove_Battery_Level
+PSMOVE_SAMPLE_CALL psmove_sample_get_battery(const PSMoveSample *sample)
+{
+    return (enum PSMove_Battery_Level)sample->battery;
+}
+
+PSMOVE_SAMPLE_API int
+PSMOVE_SAMPLE_CALL psmove_sample_get_temperature(const PSMoveSample *sample)
+{
+    return sample->temperature;
+}
+
+PSMOVE_SAMPLE_API int
+PSMOVE_SAMPLE_CALL psmove_sample_get_frame_timestamp(const PSMoveSample *sample,
+        enum PSMove_Frame frame)
+{
+    return sample->timestamp[frame];
+}
+
+PSMOVE_SAMPLE_API void
+PSMOVE_SAMPLE_CALL psmove_sample_get_accelerometer(const PSMoveSample *sample,
+        int *ax, int *ay, int *az)
+{
+    if (ax) *ax = PSMOVE_SAMPLE_AVERAGE(sample->raw_accel_x);
+    if (ay) *ay = PSMOVE_SAMPLE_AVERAGE(sample->raw_accel_y);
+    if (az) *az = PSMOVE_SAMPLE_AVERAGE(sample->raw_accel_z);
+}
+
+PSMOVE_SAMPLE_API void
+PSMOVE_SAMPLE_CALL psmove_sample_get_gyroscope(const PSMoveSample *sample,
+        int *gx, int *gy, int *gz)
+{
+    if (gx) *gx = PSMOVE_SAMPLE_AVERAGE(sample->raw_gyro_x);
+    if (gy) *gy = PSMOVE_SAMPLE_AVERAGE(sample->raw_gyro_y);
+    if (gz) *gz = PSMOVE_SAMPLE_AVERAGE(sample->raw_gyro_z);
+}
+
+PSMOVE_SAMPLE_API void
+PSMOVE_SAMPLE_CALL psmove_sample_get_magnetometer(const PSMoveSample *sample,
+        int *mx, int *my, int *mz)
+{
+    if (mx) *mx = sample->mag_x;
+    if (my) *my = sample->mag_y;
+    if (mz) *mz = sample->mag_z;
+}
+
+PSMOVE_SAMPLE_API void
+PSMOVE_SAMPLE_CALL psmove_sample_get_accelerometer_frame(const PSMoveSample *sample,
+        enum PSMove_Frame frame, float *ax, float *ay, float *az)
+{
+    if (ax) *ax = sample->accel_x[frame];
+    if (ay) *ay = sample->accel_y[frame];
+    if (az) *az = sample->accel_z[frame];
+}
+
+PSMOVE_SAMPLE_API void
+PSMOVE_SAMPLE_CALL psmove_sample_get_gyroscope_frame(const PSMoveSample *sample,
+        enum PSMove_Frame frame, float *gx, float *gy, float *gz)
+{
+    if (gx) *gx = sample->gyro_x[frame];
+    if (gy) *gy = sample->gyro_y[frame];
+    if (gz) *gz = sample->gyro_z[frame];
+}
+
+#undef PSMOVE_SAMPLE_AVERAGE
+
+#endif /* defined(PSMOVE_SAMPLE_DEFINITIONS) && !defined(PSMOVE_SAMPLE_DEFINED) */
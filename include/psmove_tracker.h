@@ -47,11 +47,57 @@ extern "C" {
 /* Name of the environment variable used to pick a camera */
 #define PSMOVE_TRACKER_CAMERA_ENV "PSMOVE_TRACKER_CAMERA"
 
+/**
+ * Name of the environment variable used to pick a capture mode of the
+ * V4L2 capture backend (PSMOVE_USE_V4L2_CAPTURE), in the form
+ * "<width>x<height>@<fps>", e.g. "320x240@187" or "640x480@75"
+ **/
+#define PSMOVE_TRACKER_CAMERA_MODE_ENV "PSMOVE_TRACKER_CAMERA_MODE"
+
+/**
+ * Name of the environment variable used to pick the format of the tracker
+ * trace: "js" (default, debug.js and JPEG images) or "binary" (a single
+ * debug.trace file, see tracker_trace.h)
+ **/
+#define PSMOVE_TRACKER_TRACE_FORMAT_ENV "PSMOVE_TRACKER_TRACE_FORMAT"
+
+/**
+ * Name of the environment variable used to sample the images of the
+ * tracker trace: only every n-th image is written, 0 disables images
+ **/
+#define PSMOVE_TRACKER_TRACE_IMAGES_ENV "PSMOVE_TRACKER_TRACE_IMAGES"
+
+/**
+ * Name of the environment variable used to enable the automatic exposure
+ * and gain control ("1" enables it, see psmove_tracker_set_auto_exposure)
+ **/
+#define PSMOVE_TRACKER_AUTO_EXPOSURE_ENV "PSMOVE_TRACKER_AUTO_EXPOSURE"
+
 
 /* Opaque data structure, defined only in psmove_tracker.c */
 struct _PSMoveTracker;
 typedef struct _PSMoveTracker PSMoveTracker;
 
+/* Opaque data structure, defined only in psmove_tracker_group.c */
+typedef struct _PSMoveTrackerGroup PSMoveTrackerGroup;
+
+/* Opaque data structure, defined only in psmove_tracker.c */
+typedef struct _PSMoveTrackerFrame PSMoveTrackerFrame;
+
+/* Opaque data structure, defined only in psmove_tracker_fusion.c */
+typedef struct _PSMoveTrackerFusion PSMoveTrackerFusion;
+
+/* Opaque data structure, defined only in psmove_tracker_snapshot.c */
+typedef struct _PSMoveTrackerSnapshot PSMoveTrackerSnapshot;
+
+/**
+ * Called by psmove_tracker_update() with the processed frame (see
+ * psmove_tracker_set_frame_callback). The frame is only valid during the
+ * call, unless it is acquired again with psmove_tracker_acquire_frame().
+ **/
+typedef void (*PSMoveTrackerFrameCallback)(PSMoveTracker *tracker,
+        PSMoveTrackerFrame *frame, void *user_data);
+
 /*! Status of the tracker */
 enum PSMoveTracker_Status {
     Tracker_NOT_CALIBRATED, /*!< Controller not registered with tracker */
@@ -60,6 +106,70 @@ enum PSMoveTracker_Status {
     Tracker_TRACKING, /*!< Calibrated and successfully tracked in the camera */
 };
 
+/*! Background threads of the tracker, see psmove_tracker_set_thread_policy() */
+enum PSMoveTracker_Thread_Type {
+    Tracker_THREAD_CAPTURE, /*!< The thread capturing frames from the camera */
+    Tracker_THREAD_WORKERS, /*!< The threads tracking controllers in parallel */
+};
+
+/*! Timing of the most recent frame, broken down by processing stage.
+ * All durations are in microseconds. The per-controller stages are summed
+ * over all controllers updated by the last psmove_tracker_update() call
+ * (when controllers are tracked in parallel, the sum can exceed total_us).
+ *
+ * Used by psmove_tracker_get_metrics().
+ **/
+typedef struct {
+    int capture_wait_us; /*!< Waiting for the frame in psmove_tracker_update_image() */
+    int undistort_us; /*!< Remapping the frame (only if whole frames are undistorted) */
+    int color_filter_us; /*!< Color conversion and segmentation (done in one pass) */
+    int blob_us; /*!< Finding the sphere blob (connected components and moments) */
+    int color_adaption_us; /*!< Adapting the estimated sphere color */
+    int total_us; /*!< Duration of the last psmove_tracker_update() call */
+    int latency_us; /*!< From the capture of the frame to the end of psmove_tracker_update() */
+    float fps; /*!< Smoothed rate of psmove_tracker_update() calls */
+    int allocations; /*!< Heap allocations by the tracker during the last psmove_tracker_update() (0 once warm) */
+    int budget_skips; /*!< Optional steps skipped to stay within the time budget (see psmove_tracker_set_time_budget()) */
+    int exposure; /*!< Current camera exposure (0-0xFFFF, see psmove_tracker_set_auto_exposure()) */
+    int gain; /*!< Current camera gain (0-0xFFFF) */
+} PSMoveTrackerMetrics;
+
+/*! Tracking quality and search state of a single controller.
+ *
+ * Used by psmove_tracker_get_controller_metrics().
+ **/
+typedef struct {
+    float q1; /*!< Ratio of blob pixels vs. pixels of the estimated circle */
+    float q2; /*!< Relative change of the radius since the last frame */
+    float q3; /*!< Estimated radius (in pixels) */
+    int roi_width; /*!< Current ROI width (in pixels) */
+    int roi_height; /*!< Current ROI height (in pixels) */
+    int search_quadrant; /*!< Next quadrant to search when the sphere is lost */
+    int color_filter_us; /*!< Time spent on color filtering in the last update */
+    int blob_us; /*!< Time spent finding the blob in the last update */
+    int color_adaption_us; /*!< Time spent on color adaption in the last update */
+    unsigned long frames_tracked; /*!< Number of updates that found the sphere */
+    unsigned long frames_lost; /*!< Number of updates that did not find the sphere */
+    unsigned long roi_enlargements; /*!< Number of times the ROI was enlarged to search again */
+    unsigned long quadrant_searches; /*!< Number of times a whole quadrant had to be searched */
+    unsigned long reacquisitions; /*!< Number of times the whole (downsampled) frame had to be searched */
+} PSMoveTrackerControllerMetrics;
+
+/*! Tracking result of a single controller after psmove_tracker_update().
+ *
+ * Used by psmove_tracker_get_results().
+ **/
+typedef struct {
+    PSMove *move; /*!< The controller this result belongs to */
+    enum PSMoveTracker_Status status; /*!< Same as psmove_tracker_get_status() */
+    float x; /*!< X coordinate of the sphere (see psmove_tracker_get_position()) */
+    float y; /*!< Y coordinate of the sphere */
+    float radius; /*!< Radius of the sphere (in pixels) */
+    float quality; /*!< Ratio of blob pixels vs. pixels of the estimated circle (see PSMoveTrackerControllerMetrics.q1) */
+    long long captured_us; /*!< When the camera captured the frame the position was found in (see psmove_tracker_get_position_timestamp()) */
+    long long tracked_us; /*!< When the position was found in that frame, 0 if the controller has not been found yet */
+} PSMoveTrackerResult;
+
 /**
  * Create a new PS Move tracker and set up tracking
  *
@@ -90,6 +200,56 @@ ADDAPI PSMoveTracker *
 ADDCALL psmove_tracker_new_with_camera(int camera);
 
 
+/**
+ * Create a new PS Move tracker that plays back a recorded video
+ *
+ * The video can be a recording made with psmove_tracker_start_recording()
+ * (or any video or image sequence, e.g. "frame%04d.png", that OpenCV can
+ * read). Every frame is processed in order and as fast as possible, so
+ * psmove_tracker_update_image() and psmove_tracker_update() can be used to
+ * benchmark the tracker deterministically. After the last frame,
+ * psmove_tracker_update_image() leaves the tracker without a frame.
+ *
+ * Controllers can be enabled if the calibration records saved with the
+ * recording exist. Use controllers played back with psmove_connect_replay()
+ * from an input recording made at the same time (see psmove_start_recording()).
+ *
+ * filename - the video file to play back
+ *
+ * Returns a new PSMoveTracker * instance or NULL (indicates error)
+ **/
+ADDAPI PSMoveTracker *
+ADDCALL psmove_tracker_new_from_file(const char *filename);
+
+
+/**
+ * Record the video of the camera for playback with psmove_tracker_new_from_file()
+ *
+ * All captured frames are written (losslessly compressed) to the given
+ * video file, and the calibration records of the currently enabled
+ * controllers to a file next to it (the file name with ".ini" appended).
+ * Enable all controllers before starting the recording, and record their
+ * input reports at the same time using psmove_start_recording().
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * filename - the video file to create (e.g. "session.avi")
+ *
+ * Returns: nonzero if the recording has been started
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_start_recording(PSMoveTracker *tracker,
+        const char *filename);
+
+
+/**
+ * Stop recording the video of the camera
+ *
+ * tracker - A valid PSMoveTracker * instance
+ **/
+ADDAPI void
+ADDCALL psmove_tracker_stop_recording(PSMoveTracker *tracker);
+
+
 /**
  * Enable tracking for a given PSMove * instance
  *
@@ -127,6 +287,27 @@ ADDCALL psmove_tracker_enable_with_color(PSMoveTracker *tracker, PSMove *move,
         unsigned char r, unsigned char g, unsigned char b);
 
 
+/**
+ * Enable tracking for several PSMove * instances at once
+ *
+ * This does the same as calling psmove_tracker_enable() for each
+ * controller, but the spheres of all controllers that need to be
+ * calibrated are blinked at the same time, each in its own color.
+ * The spheres are told apart by their hue, so that calibrating
+ * several controllers takes about as long as calibrating one.
+ *
+ * moves   - Array of count valid PSMove * instances
+ * count   - Number of controllers in moves
+ * results - Array of count status values to store the calibration
+ *           result of each controller (see psmove_tracker_enable())
+ *
+ * Returns: the number of controllers that are calibrated
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_enable_multiple(PSMoveTracker *tracker, PSMove **moves,
+        int count, enum PSMoveTracker_Status *results);
+
+
 /**
  * Get the current sphere color of a given controller
  *
@@ -190,6 +371,110 @@ ADDCALL psmove_tracker_update(PSMoveTracker *tracker, PSMove *move);
 ADDAPI void*
 ADDCALL psmove_tracker_get_image(PSMoveTracker *tracker);
 
+/**
+ * Retrieves a copy of the most recently processed image with the
+ * tracking statistics (FPS, ROIs, sphere colors, radius and distance)
+ * drawn into it.
+ *
+ * The overlay is only rendered when this function is called, so the
+ * image returned by psmove_tracker_get_image() stays untouched and
+ * psmove_tracker_update() never draws anything.
+ *
+ * tracker - A valid PSMoveTracker * instance
+ *
+ * Returns: the annotated image (owned by the tracker and valid until the
+ *          next call), zero if no image has been processed yet
+ *          XXX: Define the return value type (IplImage* internally)
+ **/
+ADDAPI void*
+ADDCALL psmove_tracker_get_annotated_image(PSMoveTracker *tracker);
+
+/**
+ * Get a reference to the most recently processed frame, without a copy
+ *
+ * The frame (its image, timestamp and the positions found in it) stays
+ * valid and unchanged until it is released with psmove_tracker_release_frame(),
+ * even if the tracker moves on to the next frames in the meantime. As long
+ * as it is released before the next psmove_tracker_update_image(), the image
+ * is never copied; frames that are held longer are copied once, when the
+ * tracker needs the camera buffer back.
+ *
+ * All acquired frames must be released before psmove_tracker_free().
+ *
+ * tracker - A valid PSMoveTracker * instance
+ *
+ * Returns: a frame handle, NULL if no image has been processed yet
+ **/
+ADDAPI PSMoveTrackerFrame *
+ADDCALL psmove_tracker_acquire_frame(PSMoveTracker *tracker);
+
+/**
+ * Release a frame acquired with psmove_tracker_acquire_frame()
+ *
+ * Every acquired frame must be released once (can be called from any thread).
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * frame - The frame to release
+ **/
+ADDAPI void
+ADDCALL psmove_tracker_release_frame(PSMoveTracker *tracker,
+        PSMoveTrackerFrame *frame);
+
+/**
+ * Get the image of an acquired frame
+ *
+ * frame - A valid (acquired) PSMoveTrackerFrame * instance
+ *
+ * Returns: the image (valid until the frame is released)
+ *          XXX: Define the return value type (IplImage* internally)
+ **/
+ADDAPI void*
+ADDCALL psmove_tracker_frame_get_image(PSMoveTrackerFrame *frame);
+
+/**
+ * Get the capture time of an acquired frame
+ *
+ * frame - A valid (acquired) PSMoveTrackerFrame * instance
+ *
+ * Returns: when the camera captured the frame, in microseconds (see
+ *          psmove_util_get_ticks_us)
+ **/
+ADDAPI long long
+ADDCALL psmove_tracker_frame_get_timestamp(PSMoveTrackerFrame *frame);
+
+/**
+ * Get the position of a controller in an acquired frame
+ *
+ * The positions are the ones of the enabled controllers at the time the
+ * frame was handed out (after psmove_tracker_update() for the frame
+ * callback), in the same units as psmove_tracker_get_position().
+ *
+ * frame - A valid (acquired) PSMoveTrackerFrame * instance
+ * move - A valid PSMove * instance
+ * x - A pointer to store the X part of the location, or NULL
+ * y - A pointer to store the Y part of the location, or NULL
+ * radius - A pointer to store the controller radius, or NULL
+ *
+ * Returns: nonzero if the controller was tracked in this frame
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_frame_get_position(PSMoveTrackerFrame *frame,
+        PSMove *move, float *x, float *y, float *radius);
+
+/**
+ * Set a function to be called with every processed frame
+ *
+ * The callback is invoked at the end of each psmove_tracker_update() call
+ * (on the calling thread), with the frame and the positions found in it.
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * callback - The function to call, or NULL to remove the callback
+ * user_data - Passed to the callback
+ **/
+ADDAPI void
+ADDCALL psmove_tracker_set_frame_callback(PSMoveTracker *tracker,
+        PSMoveTrackerFrameCallback callback, void *user_data);
+
 /**
  * Grabs internally a new image from the camera.
  * Should always be called before "psmove_tracker_update".
@@ -200,6 +485,50 @@ ADDCALL psmove_tracker_get_image(PSMoveTracker *tracker);
 ADDAPI void
 ADDCALL psmove_tracker_update_image(PSMoveTracker *tracker);
 
+/**
+ * Enable or disable the automatic exposure and gain control
+ *
+ * With automatic exposure, the tracker measures the contrast between the
+ * spheres and their surroundings while tracking, and adjusts exposure and
+ * gain of the camera in small, rate-limited steps (so that the color
+ * adaption can follow): down if the spheres are washed out, up if they
+ * are too dark. The camera is reconfigured in a background thread, so
+ * capturing and tracking are never stalled by it.
+ *
+ * It is disabled by default (the exposure is fixed), unless the environment
+ * variable PSMOVE_TRACKER_AUTO_EXPOSURE_ENV is set to "1".
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * enabled - PSMove_True to follow the lighting, PSMove_False to keep the
+ *           current exposure and gain
+ **/
+ADDAPI void
+ADDCALL psmove_tracker_set_auto_exposure(PSMoveTracker *tracker,
+        enum PSMove_Bool enabled);
+
+/**
+ * Limit the time psmove_tracker_update() spends on optional work
+ *
+ * By default, psmove_tracker_update() does all of its work on every frame,
+ * however long it takes. With a time budget, it skips optional work when
+ * it falls behind: when the smoothed duration of recent updates exceeds
+ * the budget, or when half of the budget is used up in the current one.
+ * Skipped are the color adaption, re-centering the ROI on the sphere and
+ * the search for controllers that have been lost (lost controllers are
+ * tracked after the locked ones, and searched for again in the next
+ * frame). Controllers that are locked are always tracked, so the budget
+ * can be exceeded if tracking them alone takes longer than that.
+ *
+ * The number of skipped steps is reported in the budget_skips field of
+ * the metrics (see psmove_tracker_get_metrics()).
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * budget_us - The budget of a psmove_tracker_update() call (in
+ *             microseconds), or 0 to never skip work (default)
+ **/
+ADDAPI void
+ADDCALL psmove_tracker_set_time_budget(PSMoveTracker *tracker, int budget_us);
+
 /**
  * Get the currently-tracked low-level position of the controllers
  *
@@ -216,6 +545,138 @@ ADDCALL psmove_tracker_get_position(PSMoveTracker *tracker,
         PSMove *move, float *x, float *y, float *radius);
 
 
+/**
+ * Get the location of a controller relative to the camera in millimeters
+ *
+ * The location is calculated once per psmove_tracker_update() from the
+ * position and radius of the sphere, using the camera matrix of the lens
+ * calibration (or the nominal focal length of the PS Eye if none is loaded).
+ * The X axis points to the right, Y down and Z away from the camera.
+ * If the controller is currently not tracked, the last location is returned.
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * move - A valid (and enabled) controller
+ * x - A pointer to a float for storing the X coordinate (in mm), or NULL
+ * y - A pointer to a float for storing the Y coordinate (in mm), or NULL
+ * z - A pointer to a float for storing the Z coordinate (in mm), or NULL
+ *
+ * Returns: nonzero on success, zero if the controller is not enabled
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_get_location(PSMoveTracker *tracker,
+        PSMove *move, float *x, float *y, float *z);
+
+
+/**
+ * Get the timestamps of the currently-tracked position of a controller
+ *
+ * Both timestamps use the time base of psmove_util_get_ticks_us(), so they
+ * can be compared to the timestamps of the controller's sensor readings.
+ * They are updated whenever psmove_tracker_update() finds the controller.
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * move - A valid (and enabled) controller
+ * captured_us - A pointer for storing when the camera captured the frame
+ *               the position was found in (in microseconds), or NULL
+ * tracked_us - A pointer for storing when the position was found in that
+ *              frame (in microseconds), or NULL
+ *
+ * Returns: nonzero on success, zero if the controller has not been found yet
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_get_position_timestamp(PSMoveTracker *tracker,
+        PSMove *move, long long *captured_us, long long *tracked_us);
+
+
+/**
+ * Get timing metrics of the most recently processed frame
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * metrics - A pointer to a PSMoveTrackerMetrics structure to fill
+ **/
+ADDAPI void
+ADDCALL psmove_tracker_get_metrics(PSMoveTracker *tracker,
+        PSMoveTrackerMetrics *metrics);
+
+
+/**
+ * Get tracking quality and search metrics of a controller
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * move - A valid (and enabled) controller
+ * metrics - A pointer to a PSMoveTrackerControllerMetrics structure to fill
+ *
+ * Returns: nonzero on success, zero if the controller is not enabled
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_get_controller_metrics(PSMoveTracker *tracker,
+        PSMove *move, PSMoveTrackerControllerMetrics *metrics);
+
+
+/**
+ * Get the tracking results of all enabled controllers at once
+ *
+ * This is equivalent to calling psmove_tracker_get_status(),
+ * psmove_tracker_get_position() and psmove_tracker_get_position_timestamp()
+ * for every enabled controller, but without looking up each controller.
+ * The results are in the order in which the controllers were enabled.
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * results - An array of PSMoveTrackerResult structures to fill
+ * count - The number of entries in results
+ *
+ * Returns: the number of entries filled (at most count)
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_get_results(PSMoveTracker *tracker,
+        PSMoveTrackerResult *results, int count);
+
+/**
+ * Get the memory used by the tracker (in bytes)
+ *
+ * This includes the tracker itself, the per-controller scratch buffers
+ * and lookup tables, the frame handles and the frame buffers of the
+ * camera. Scratch buffers are only allocated for the features that are
+ * in use (e.g. the background tables only with the color adaption
+ * thread). Memory of OpenCV, the camera driver and the GPU is not
+ * included, nor are frames that the application still holds after the
+ * tracker has moved on.
+ *
+ * tracker - A valid PSMoveTracker * instance
+ *
+ * Returns: the memory usage in bytes
+ **/
+ADDAPI size_t
+ADDCALL psmove_tracker_get_memory_usage(PSMoveTracker *tracker);
+
+/**
+ * Pin background threads of the tracker to CPUs and set their priority
+ *
+ * By default, the capture thread and the tracking workers (one per
+ * additional core) run on any CPU with normal scheduling. If another busy
+ * thread of the application (e.g. the render thread) competes with them,
+ * psmove_tracker_update() has to wait for the slowest worker; pinning the
+ * workers to CPUs that thread doesn't use, or giving them a realtime
+ * priority, avoids these delays. The worker pool is pinned as a whole, as
+ * the workers take the next free controller of every frame.
+ *
+ * The policy is applied immediately. Realtime priorities need the
+ * appropriate rights, see psmove_set_thread_policy() (which configures
+ * the input and LED threads of the controllers).
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * type - The threads to configure
+ * policy - The new policy, or NULL to restore the default policy
+ *
+ * Returns: PSMove_True on success, PSMove_False if the policy could not
+ *          be applied (or there are no such threads on this platform or
+ *          with this capture backend)
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_tracker_set_thread_policy(PSMoveTracker *tracker,
+        enum PSMoveTracker_Thread_Type type, const PSMoveThreadPolicy *policy);
+
+
 /**
  * Destroy an existing tracker instance and free allocated resources
  *
@@ -224,6 +685,285 @@ ADDCALL psmove_tracker_get_position(PSMoveTracker *tracker,
 ADDAPI void
 ADDCALL psmove_tracker_free(PSMoveTracker *tracker);
 
+/**
+ * Create a tracker group that tracks controllers with several cameras
+ *
+ * Every camera gets its own PSMoveTracker instance and its own thread, so
+ * that capturing and processing of all cameras happens in parallel.
+ *
+ * cameras - An array of camera indices (as for psmove_tracker_new_with_camera)
+ * count - The number of entries in cameras
+ *
+ * Returns: A new PSMoveTrackerGroup instance or NULL on error
+ **/
+ADDAPI PSMoveTrackerGroup *
+ADDCALL psmove_tracker_group_new(const int *cameras, int count);
+
+
+/**
+ * Get the number of cameras in a tracker group
+ *
+ * group - A valid PSMoveTrackerGroup * instance
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_group_count(PSMoveTrackerGroup *group);
+
+
+/**
+ * Get the tracker of a single camera in a tracker group
+ *
+ * The returned tracker is owned by the group; use it for per-camera
+ * settings and images, but not for updating it.
+ *
+ * group - A valid PSMoveTrackerGroup * instance
+ * index - The index of the camera (0 .. psmove_tracker_group_count()-1)
+ *
+ * Returns: The tracker of the camera, or NULL on error
+ **/
+ADDAPI PSMoveTracker *
+ADDCALL psmove_tracker_group_get_tracker(PSMoveTrackerGroup *group, int index);
+
+
+/**
+ * Enable tracking of a motion controller on all cameras of the group
+ *
+ * The controller is calibrated with the first camera; all other cameras
+ * track it with the same color. Cameras that cannot see the controller
+ * during calibration do not make this function fail.
+ *
+ * group - A valid PSMoveTrackerGroup * instance
+ * move - A valid PSMove * instance
+ *
+ * Returns: Tracker_CALIBRATED on success, Tracker_CALIBRATION_ERROR on error
+ **/
+ADDAPI enum PSMoveTracker_Status
+ADDCALL psmove_tracker_group_enable(PSMoveTrackerGroup *group, PSMove *move);
+
+
+/**
+ * Disable tracking of a motion controller on all cameras of the group
+ *
+ * group - A valid PSMoveTrackerGroup * instance
+ * move - A valid PSMove * instance
+ **/
+ADDAPI void
+ADDCALL psmove_tracker_group_disable(PSMoveTrackerGroup *group, PSMove *move);
+
+
+/**
+ * Capture and process a new frame on all cameras of the group
+ *
+ * The cameras are updated in parallel; this function returns when all of
+ * them have finished processing their frame.
+ *
+ * group - A valid PSMoveTrackerGroup * instance
+ *
+ * Returns: the number of controllers tracked by at least one camera
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_group_update(PSMoveTrackerGroup *group);
+
+
+/**
+ * Get the position of a controller from the camera that tracks it best
+ *
+ * Of all cameras tracking the controller, the one with the best blob
+ * quality (see PSMoveTrackerControllerMetrics.q1) is used.
+ *
+ * group - A valid PSMoveTrackerGroup * instance
+ * move - A valid (and enabled) controller
+ * x - A pointer to a float for storing the X coordinate, or NULL
+ * y - A pointer to a float for storing the Y coordinate, or NULL
+ * radius - A pointer to a float for storing the radius, or NULL
+ *
+ * Returns: the index of the camera used, or -1 if no camera tracks it
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_group_get_position(PSMoveTrackerGroup *group,
+        PSMove *move, float *x, float *y, float *radius);
+
+
+/**
+ * Destroy a tracker group, its threads and all of its trackers
+ *
+ * group - A valid PSMoveTrackerGroup * instance
+ **/
+ADDAPI void
+ADDCALL psmove_tracker_group_free(PSMoveTrackerGroup *group);
+
+
+/**
+ * Create a sensor fusion stage for the controllers tracked by a tracker
+ *
+ * The fusion combines the (60-75 Hz) camera location of a controller (see
+ * psmove_tracker_get_location) with its calibrated accelerometer and its
+ * orientation, and gives a location at the rate of the input reports.
+ * A complementary filter integrates the acceleration between two camera
+ * frames, and pulls the result towards the camera, which removes the drift.
+ *
+ * The orientation of the controllers has to be enabled (see
+ * psmove_enable_orientation) and aligned to the camera: the identity
+ * orientation is the controller pointing at the camera, buttons up.
+ *
+ * tracker - A valid PSMoveTracker * instance (must outlive the fusion)
+ *
+ * Returns: a new PSMoveTrackerFusion * instance
+ **/
+ADDAPI PSMoveTrackerFusion *
+ADDCALL psmove_tracker_fusion_new(PSMoveTracker *tracker);
+
+
+/**
+ * Feed the current input report of a controller into the fusion
+ *
+ * Call this after each psmove_poll() that returned a new report; the
+ * camera frames processed by psmove_tracker_update() in the meantime are
+ * picked up automatically.
+ *
+ * fusion - A valid PSMoveTrackerFusion * instance
+ * move - A valid (and enabled) controller
+ *
+ * Returns: nonzero if a location is available (the camera has seen the
+ *          controller at least once), zero otherwise
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_fusion_update(PSMoveTrackerFusion *fusion, PSMove *move);
+
+
+/**
+ * Get the fused location of a controller relative to the camera
+ *
+ * Same units and axes as psmove_tracker_get_location(), updated with every
+ * psmove_tracker_fusion_update() call.
+ *
+ * fusion - A valid PSMoveTrackerFusion * instance
+ * move - A valid (and enabled) controller
+ * x - A pointer to a float for storing the X coordinate (in mm), or NULL
+ * y - A pointer to a float for storing the Y coordinate (in mm), or NULL
+ * z - A pointer to a float for storing the Z coordinate (in mm), or NULL
+ *
+ * Returns: nonzero on success, zero if no location is available yet
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_fusion_get_location(PSMoveTrackerFusion *fusion,
+        PSMove *move, float *x, float *y, float *z);
+
+
+/**
+ * Destroy a sensor fusion stage (the tracker is not freed)
+ *
+ * fusion - A valid PSMoveTrackerFusion * instance
+ **/
+ADDAPI void
+ADDCALL psmove_tracker_fusion_free(PSMoveTrackerFusion *fusion);
+
+
+/*! State of a single controller at the time requested from
+ *  psmove_tracker_snapshot_get().
+ **/
+typedef struct {
+    PSMove *move; /*!< The controller this entry belongs to */
+    int valid; /*!< Nonzero if input has been recorded for the controller */
+    unsigned int buttons; /*!< Buttons of the newest report at or before the time (see psmove_get_buttons()) */
+    int trigger; /*!< Trigger value of the same report */
+    float orientation[4]; /*!< Orientation quaternion (w, x, y, z), interpolated at the time */
+    long long input_us; /*!< When the report used for buttons and trigger was received */
+    int tracked; /*!< Nonzero if the sphere was tracked in the camera at the time */
+    float x; /*!< X coordinate of the sphere, interpolated at the time */
+    float y; /*!< Y coordinate of the sphere, interpolated at the time */
+    float radius; /*!< Radius of the sphere (in pixels), interpolated at the time */
+    long long captured_us; /*!< Capture time of the newest frame at or before the time */
+} PSMoveTrackerSnapshotEntry;
+
+/**
+ * Create a snapshot of the state of several controllers at one instant
+ *
+ * A snapshot keeps a short history of input reports (recorded with
+ * psmove_tracker_snapshot_update_input()) and of camera positions
+ * (recorded with psmove_tracker_snapshot_update_tracker()) for every
+ * controller. psmove_tracker_snapshot_get() then returns the state of all
+ * controllers at the same point in time, interpolated from that history.
+ *
+ * The input of every controller and the tracker can be updated from
+ * separate threads, and reading a snapshot never waits for any of them.
+ * All times use the time base of psmove_util_get_ticks_us().
+ *
+ * tracker - A valid PSMoveTracker * instance, or NULL for input only
+ *
+ * Returns: A new PSMoveTrackerSnapshot * instance
+ **/
+ADDAPI PSMoveTrackerSnapshot *
+ADDCALL psmove_tracker_snapshot_new(PSMoveTracker *tracker);
+
+/**
+ * Add a controller to a snapshot
+ *
+ * This must be done before any of the update functions are called.
+ *
+ * snapshot - A valid PSMoveTrackerSnapshot * instance
+ * move - A valid PSMove * instance
+ *
+ * Returns: nonzero on success, zero on error
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_snapshot_add(PSMoveTrackerSnapshot *snapshot,
+        PSMove *move);
+
+/**
+ * Record the current input of a controller
+ *
+ * Call this after every successful psmove_poll() of the controller, from
+ * the thread that polls it.
+ *
+ * snapshot - A valid PSMoveTrackerSnapshot * instance
+ * move - A controller added with psmove_tracker_snapshot_add()
+ *
+ * Returns: nonzero on success, zero on error
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_snapshot_update_input(PSMoveTrackerSnapshot *snapshot,
+        PSMove *move);
+
+/**
+ * Record the current camera positions of all controllers
+ *
+ * Call this after every psmove_tracker_update(), from the same thread.
+ *
+ * snapshot - A valid PSMoveTrackerSnapshot * instance
+ *
+ * Returns: nonzero on success, zero if the snapshot has no tracker
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_snapshot_update_tracker(PSMoveTrackerSnapshot *snapshot);
+
+/**
+ * Get the state of all controllers at one point in time
+ *
+ * Buttons and trigger come from the newest report at or before the time,
+ * orientations are interpolated between reports, and camera positions are
+ * interpolated between frames (or extrapolated up to 50 ms past the
+ * newest frame). The history covers roughly the last 130 ms.
+ *
+ * snapshot - A valid PSMoveTrackerSnapshot * instance
+ * time_us - The point in time (see psmove_util_get_ticks_us())
+ * entries - An array of PSMoveTrackerSnapshotEntry structures to fill
+ * count - The number of entries in entries
+ *
+ * Returns: the number of entries filled, in the order of
+ *          psmove_tracker_snapshot_add() (at most count)
+ **/
+ADDAPI int
+ADDCALL psmove_tracker_snapshot_get(PSMoveTrackerSnapshot *snapshot,
+        long long time_us, PSMoveTrackerSnapshotEntry *entries, int count);
+
+/**
+ * Destroy a snapshot (the tracker and controllers are not freed)
+ *
+ * snapshot - A valid PSMoveTrackerSnapshot * instance
+ **/
+ADDAPI void
+ADDCALL psmove_tracker_snapshot_free(PSMoveTrackerSnapshot *snapshot);
+
 #ifdef __cplusplus
 }
 #endif
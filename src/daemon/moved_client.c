@@ -31,6 +31,74 @@
 #include "psmove.h"
 #include "moved_client.h"
 
+#ifndef _WIN32
+#  include <fcntl.h>
+#endif
+
+/* How long to wait for a response (see moved_client_set_timeout) */
+static int moved_client_timeout_ms = MOVED_CLIENT_TIMEOUT_MS;
+
+static void
+moved_client_set_nonblocking(int socket)
+{
+#ifdef _WIN32
+    u_long nonblocking = 1;
+    ioctlsocket(socket, FIONBIO, &nonblocking);
+#else
+    fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+}
+
+/* Join the group moved publishes its reports to; returns the socket or -1 */
+static int
+moved_client_join_multicast(const char *group)
+{
+    struct sockaddr_in addr;
+    struct ip_mreq mreq;
+    int reuse = 1;
+
+    memset(&mreq, 0, sizeof(mreq));
+#ifdef _WIN32
+    mreq.imr_multiaddr.s_addr = inet_addr(group);
+    if (mreq.imr_multiaddr.s_addr == INADDR_NONE) {
+#else
+    if (inet_pton(AF_INET, group, &(mreq.imr_multiaddr)) != 1) {
+#endif
+        printf("Warn: invalid multicast group: '%s'\n", group);
+        return -1;
+    }
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock == -1) {
+        return -1;
+    }
+
+    /* Several clients on this host can join the same group */
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse,
+            sizeof(reuse));
+#ifdef SO_REUSEPORT
+    setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, (const char *)&reuse,
+            sizeof(reuse));
+#endif
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(MOVED_MULTICAST_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+            setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+                (const char *)&mreq, sizeof(mreq)) == -1) {
+        printf("Warn: cannot join multicast group '%s'\n", group);
+        close(sock);
+        return -1;
+    }
+
+    moved_client_set_nonblocking(sock);
+    return sock;
+}
+
 moved_client_list *
 moved_client_list_insert(moved_client_list *list, moved_client *client)
 {
@@ -56,12 +124,17 @@ moved_client_list_open()
     if (fp != NULL) {
         while (fgets(hostname, sizeof(hostname), fp) != NULL) {
             char *end = hostname + strlen(hostname) - 1;
-            if (*end == '\n' || *end == '\r') {
-                *end = '\0';
+            while (end >= hostname && (*end == '\n' || *end == '\r')) {
+                *end-- = '\0';
+            }
+            if (hostname[0] == '\0') {
+                continue;
             }
             printf("using remote host (from remotes.txt): '%s'\n", hostname);
-            result = moved_client_list_insert(result,
-                    moved_client_create(hostname));
+            moved_client *client = moved_client_create(hostname);
+            if (client != NULL) {
+                result = moved_client_list_insert(result, client);
+            }
         }
         fclose(fp);
     }
@@ -102,26 +175,364 @@ moved_client_create(const char *hostname)
 #endif
 
     moved_client *client = (moved_client*)calloc(1, sizeof(moved_client));
-
-    client->hostname = strdup(hostname);
-
-    client->socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    assert(client->socket != -1);
+    client->clock_rtt_us = -1;
+    client->ping_seq = -1;
 
     client->moved_addr.sin_family = AF_INET;
     client->moved_addr.sin_port = htons(MOVED_UDP_PORT);
 #ifdef _WIN32
     client->moved_addr.sin_addr.s_addr = inet_addr(hostname);
-    assert(client->moved_addr.sin_addr.s_addr != INADDR_NONE);
+    if (client->moved_addr.sin_addr.s_addr == INADDR_NONE) {
 #else
-    assert(inet_pton(AF_INET, hostname, &(client->moved_addr.sin_addr)) != 0);
+    if (inet_pton(AF_INET, hostname, &(client->moved_addr.sin_addr)) != 1) {
 #endif
+        /* Not an address literal - resolve the host name */
+        struct addrinfo hints;
+        struct addrinfo *info = NULL;
+
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_DGRAM;
+
+        if (getaddrinfo(hostname, NULL, &hints, &info) != 0 || info == NULL) {
+            printf("Warn: invalid remote host address: '%s'\n", hostname);
+            free(client);
+            return NULL;
+        }
+
+        client->moved_addr.sin_addr =
+            ((struct sockaddr_in *)(info->ai_addr))->sin_addr;
+        freeaddrinfo(info);
+    }
+
+    client->socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (client->socket == -1) {
+        printf("Warn: cannot create socket for remote host '%s'\n", hostname);
+        free(client);
+        return NULL;
+    }
+
+    /* Responses are waited for with a timeout (see moved_client_wait) */
+    moved_client_set_nonblocking(client->socket);
+
+    client->multicast_socket = -1;
+    char *multicast_env = getenv(MOVED_MULTICAST_ENV);
+    if (multicast_env != NULL) {
+        const char *group = MOVED_MULTICAST_GROUP;
+        if (strcmp(multicast_env, "1") != 0 && strcmp(multicast_env, "") != 0) {
+            group = multicast_env;
+        }
+        client->multicast_socket = moved_client_join_multicast(group);
+    }
+
+    /* Reports of a local moved are read from shared memory instead */
+    char *shm_env = getenv(MOVED_SHM_ENV);
+    if ((ntohl(client->moved_addr.sin_addr.s_addr) >> 24) == 127 &&
+            (shm_env == NULL || strcmp(shm_env, "0") != 0)) {
+        client->shm = moved_shm_open();
+    }
+
+    if (client->shm != NULL) {
+        int id;
+        for (id=0; id<MOVED_CLIENT_MAX_SUBSCRIPTIONS; id++) {
+            client->subscriptions[id].shm_next = moved_shm_tail(client->shm, id);
+        }
+        printf("using shared memory for remote host '%s'\n", hostname);
+    }
+
+    client->hostname = strdup(hostname);
 
     return client;
 }
 
-int
-moved_client_send(moved_client *client, char req, char id, const unsigned char *data)
+/* Read a 64-bit big endian value (see MOVED_SIZE_TIMESTAMP) */
+static long long
+moved_client_unpack_time(const unsigned char *buf)
+{
+    unsigned long long value = 0;
+    int i;
+
+    for (i=0; i<8; i++) {
+        value = (value << 8) | buf[i];
+    }
+
+    return (long long)value;
+}
+
+/* Convert a capture time of moved to our clock (receive time if unknown) */
+static long long
+moved_client_capture_time(moved_client *client, long long time_us)
+{
+    if (time_us < 0 || client->clock_rtt_us < 0) {
+        return psmove_util_get_ticks_us();
+    }
+
+    return time_us - client->clock_offset_us;
+}
+
+/**
+ * Queue a report entry (device id, sequence number, input report), captured
+ * at time_us (our clock)
+ **/
+static void
+moved_client_queue_report(moved_client *client, const unsigned char *entry,
+        long long time_us)
+{
+    int id = entry[0];
+    if (id >= MOVED_CLIENT_MAX_SUBSCRIPTIONS) {
+        return;
+    }
+
+    moved_client_subscription *sub = &(client->subscriptions[id]);
+    unsigned int seq = ((unsigned int)entry[1] << 24) | (entry[2] << 16) |
+        (entry[3] << 8) | entry[4];
+
+    /* Drop reports that arrive late (UDP does not keep the order) */
+    if (sub->received_ms != 0) {
+        int delta = (int)(seq - sub->last_seq);
+        if (delta <= 0) {
+            return;
+        }
+        sub->lost += delta - 1;
+    }
+    sub->last_seq = seq;
+    sub->received_ms = psmove_util_get_ticks();
+
+    /* If the consumer is too slow, the oldest report is dropped */
+    if (sub->queue_count == MOVED_CLIENT_QUEUE) {
+        sub->queue_head = (sub->queue_head + 1) % MOVED_CLIENT_QUEUE;
+        sub->queue_count--;
+        sub->lost++;
+    }
+
+    int tail = (sub->queue_head + sub->queue_count) % MOVED_CLIENT_QUEUE;
+    memcpy(sub->queue[tail], entry + MOVED_SIZE_PUSH_HEADER - 1,
+            MOVED_SIZE_INPUT);
+    sub->queue_time_us[tail] = time_us;
+    sub->queue_count++;
+}
+
+/* Queue a MOVED_PUSH_COMPACT report; returns 0 if it can't be decoded */
+static int
+moved_client_queue_compact(moved_client *client, const unsigned char *buf,
+        int len)
+{
+    long long time_us = -1;
+    if ((buf[4] & MOVED_COMPACT_TIMESTAMP) && len >= 5 + MOVED_SIZE_TIMESTAMP) {
+        len -= MOVED_SIZE_TIMESTAMP;
+        time_us = moved_client_unpack_time(buf + len);
+    }
+
+    unsigned char entry[MOVED_SIZE_REPORT_ENTRY];
+    unsigned int seq;
+
+    int id = buf[1];
+    if (id >= MOVED_CLIENT_MAX_SUBSCRIPTIONS) {
+        return 0;
+    }
+
+    moved_client_subscription *sub = &(client->subscriptions[id]);
+    if (!moved_compact_decode(&(sub->compact), buf, len,
+                entry + MOVED_SIZE_PUSH_HEADER - 1, &seq)) {
+        return 0;
+    }
+
+    /* Only the 16 low bits are sent, pick the closest sequence number */
+    seq = sub->last_seq + (short)(seq - (sub->last_seq & 0xFFFF));
+
+    entry[0] = id;
+    entry[1] = (seq >> 24) & 0xFF;
+    entry[2] = (seq >> 16) & 0xFF;
+    entry[3] = (seq >> 8) & 0xFF;
+    entry[4] = seq & 0xFF;
+    moved_client_queue_report(client, entry,
+            moved_client_capture_time(client, time_us));
+    return 1;
+}
+
+/**
+ * Queue the reports of a pushed report or a MOVED_REQ_READ_ALL response;
+ * returns the number of reports if it was one of them, -1 otherwise
+ **/
+static int
+moved_client_queue_reports(moved_client *client, const unsigned char *buf,
+        int len)
+{
+    if (len == MOVED_SIZE_PUSH && buf[0] == MOVED_PUSH_INPUT) {
+        moved_client_queue_report(client, buf + 1,
+                psmove_util_get_ticks_us());
+        return 1;
+    }
+
+    if (len == MOVED_SIZE_PUSH + MOVED_SIZE_TIMESTAMP &&
+            buf[0] == MOVED_PUSH_INPUT) {
+        moved_client_queue_report(client, buf + 1, moved_client_capture_time(
+                    client, moved_client_unpack_time(buf + MOVED_SIZE_PUSH)));
+        return 1;
+    }
+
+    if (len >= 5 && buf[0] == MOVED_PUSH_COMPACT) {
+        return moved_client_queue_compact(client, buf, len);
+    }
+
+    if (len >= MOVED_SIZE_READ_ALL_HEADER && buf[0] == MOVED_READ_ALL_RESPONSE &&
+            len == MOVED_SIZE_READ_ALL_HEADER + buf[1] * MOVED_SIZE_REPORT_ENTRY) {
+        long long now_us = psmove_util_get_ticks_us();
+        int i;
+        for (i=0; i<buf[1]; i++) {
+            moved_client_queue_report(client, buf + MOVED_SIZE_READ_ALL_HEADER +
+                    i * MOVED_SIZE_REPORT_ENTRY, now_us);
+        }
+        return buf[1];
+    }
+
+    return -1;
+}
+
+/* Wait until the socket is readable or the deadline has passed */
+static int
+moved_client_wait(moved_client *client, long deadline_ms)
+{
+    long remaining = deadline_ms - psmove_util_get_ticks();
+    if (remaining < 0) {
+        remaining = 0;
+    }
+
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(client->socket, &fds);
+    struct timeval timeout = { remaining / 1000, (remaining % 1000) * 1000 };
+    return select(client->socket + 1, &fds, NULL, NULL, &timeout) > 0;
+}
+
+/**
+ * Handle a datagram received while waiting for the response to the request
+ * "req" with sequence number "seq", queueing pushed reports and skipping
+ * late responses to earlier requests. Returns nonzero if it is the response.
+ **/
+/* Take a sample of moved's clock from a MOVED_TIME_RESPONSE */
+static void
+moved_client_handle_time(moved_client *client, const unsigned char *buf)
+{
+    long long received_us = psmove_util_get_ticks_us();
+
+    if (client->ping_seq == -1 || ((buf[2] << 8) | buf[3]) != client->ping_seq) {
+        return;
+    }
+    client->ping_seq = -1;
+
+    long long moved_received_us = moved_client_unpack_time(buf + 4);
+    long long moved_sent_us = moved_client_unpack_time(buf + 12);
+
+    moved_client_clock_sample *sample = &(client->clock_samples[
+            client->clock_samples_taken % MOVED_CLIENT_CLOCK_SAMPLES]);
+    sample->rtt_us = (received_us - client->ping_sent_us) -
+        (moved_sent_us - moved_received_us);
+    sample->offset_us = ((moved_received_us - client->ping_sent_us) +
+            (moved_sent_us - received_us)) / 2;
+    client->clock_samples_taken++;
+
+    /* Queueing delays make the offset wrong, the fastest exchange is best */
+    int i, count = client->clock_samples_taken;
+    if (count > MOVED_CLIENT_CLOCK_SAMPLES) {
+        count = MOVED_CLIENT_CLOCK_SAMPLES;
+    }
+
+    moved_client_clock_sample *best = &(client->clock_samples[0]);
+    for (i=1; i<count; i++) {
+        if (client->clock_samples[i].rtt_us < best->rtt_us) {
+            best = &(client->clock_samples[i]);
+        }
+    }
+
+    client->clock_offset_us = best->offset_us;
+    client->clock_rtt_us = (best->rtt_us > 0) ? best->rtt_us : 0;
+}
+
+static int
+moved_client_handle_datagram(moved_client *client, const unsigned char *buf,
+        int len, int req, int seq)
+{
+    if (len == MOVED_SIZE_TIME_RESPONSE && buf[0] == MOVED_TIME_RESPONSE) {
+        moved_client_handle_time(client, buf);
+        return 0;
+    }
+
+    if (len == MOVED_SIZE_WRITE_ACK && buf[0] == MOVED_WRITE_ACK) {
+        moved_client_write_state *write =
+            &(client->writes[MOVED_DEVICE_SLOT(buf[1])]);
+        if (write->unacked && write->device_id == buf[1] &&
+                write->seq == ((buf[2] << 8) | buf[3])) {
+            write->unacked = 0;
+        }
+        client->write_ack_answered = 1;
+        return 0;
+    }
+
+    if (moved_client_queue_reports(client, buf, len) != -1) {
+        return (req == MOVED_REQ_READ_ALL && buf[0] == MOVED_READ_ALL_RESPONSE &&
+                ((buf[2] << 8) | buf[3]) == seq);
+    }
+
+    if (req == MOVED_REQ_READ_ALL) {
+        return 0;
+    }
+
+    if (len == MOVED_SIZE_STATS_RESPONSE && buf[0] == MOVED_STATS_RESPONSE) {
+        if (req != MOVED_REQ_STATS || ((buf[2] << 8) | buf[3]) != seq) {
+            return 0;
+        }
+
+        memcpy(client->stats_response_buf, buf,
+                sizeof(client->stats_response_buf));
+        return 1;
+    }
+
+    /* Older versions of moved don't send the sequence number */
+    if (len == MOVED_SIZE_READ_RESPONSE + MOVED_SIZE_RESPONSE_SEQ) {
+        if (((buf[MOVED_SIZE_READ_RESPONSE] << 8) |
+                    buf[MOVED_SIZE_READ_RESPONSE + 1]) != seq) {
+            return 0;
+        }
+    } else if (len != MOVED_SIZE_READ_RESPONSE) {
+        return 0;
+    }
+
+    memcpy(client->read_response_buf, buf, sizeof(client->read_response_buf));
+    return 1;
+}
+
+/**
+ * Receive the response to the request "req" with sequence number "seq"
+ * (see moved_client_handle_datagram). Returns the length of the response,
+ * or -1 if it has not arrived within the timeout (e.g. one of the
+ * datagrams got lost).
+ **/
+static int
+moved_client_recv_response(moved_client *client, int req, int seq)
+{
+    unsigned char buf[MOVED_SIZE_READ_ALL_RESPONSE];
+    long deadline = psmove_util_get_ticks() + moved_client_timeout_ms;
+
+    while (moved_client_wait(client, deadline)) {
+        int len = recv(client->socket, (char *)buf, sizeof(buf), 0);
+        if (len == -1) {
+            /* Non-blocking socket - e.g. a datagram with a bad checksum */
+            continue;
+        }
+
+        if (moved_client_handle_datagram(client, buf, len, req, seq)) {
+            return len;
+        }
+    }
+
+    return -1;
+}
+
+/* Send a request; returns the sequence number of requests with a response */
+static int
+moved_client_send_request(moved_client *client, char req, char id,
+        const unsigned char *data)
 {
     client->request_buf[0] = req;
     client->request_buf[1] = id;
@@ -130,39 +541,588 @@ moved_client_send(moved_client *client, char req, char id, const unsigned char *
         memcpy(client->request_buf+2, data, sizeof(client->request_buf)-2);
     }
 
-    if (sendto(client->socket, client->request_buf,
+    /* Requests with a response carry a sequence number in their last bytes */
+    int seq = 0;
+    if (req == MOVED_REQ_COUNT_CONNECTED || req == MOVED_REQ_READ ||
+            req == MOVED_REQ_READ_ALL || req == MOVED_REQ_TIME ||
+            req == MOVED_REQ_STATS) {
+        seq = ++client->request_seq & 0xFFFF;
+        client->request_buf[MOVED_SIZE_REQUEST-2] = (seq >> 8) & 0xFF;
+        client->request_buf[MOVED_SIZE_REQUEST-1] = seq & 0xFF;
+    }
+
+    if (sendto(client->socket, (char *)client->request_buf,
                 sizeof(client->request_buf), 0,
                 (struct sockaddr *)&(client->moved_addr),
-                sizeof(client->moved_addr)) >= 0)
-    {
-        switch (req) {
-            case MOVED_REQ_COUNT_CONNECTED:
-                assert(recv(client->socket, client->read_response_buf,
-                            sizeof(client->read_response_buf), 0) != -1);
-                return client->read_response_buf[0];
-                break;
-            case MOVED_REQ_READ:
-                if (recv(client->socket, client->read_response_buf,
-                            sizeof(client->read_response_buf), 0) == -1) {
-                    printf("Warn: recv cancelled\n");
+                sizeof(client->moved_addr)) < 0) {
+        return -1;
+    }
+
+    return seq;
+}
+
+/**
+ * Take the device ids of a MOVED_REQ_COUNT_CONNECTED response, skipping
+ * free slots. Older versions of moved only send the number of devices,
+ * those are addressed by their index (generation 0 matches any device).
+ **/
+static void
+moved_client_take_count(moved_client *client)
+{
+    const unsigned char *response = client->read_response_buf;
+    int slots = response[0];
+    int slot;
+
+    if (slots > MOVED_MAX_DEVICES) {
+        slots = MOVED_MAX_DEVICES;
+    }
+
+    client->count = 0;
+    for (slot=0; slot<slots; slot++) {
+        if (response[1+slot] != 0) {
+            client->ids[client->count++] = response[1+slot];
+        }
+    }
+
+    if (client->count == 0) {
+        for (slot=0; slot<slots; slot++) {
+            client->ids[client->count++] = MOVED_DEVICE_ID(slot, 0);
+        }
+    }
+
+    client->counted_ms = psmove_util_get_ticks();
+}
+
+int
+moved_client_send(moved_client *client, char req, char id, const unsigned char *data)
+{
+    int seq = moved_client_send_request(client, req, id, data);
+    if (seq == -1) {
+        return 0;
+    }
+
+    switch (req) {
+        case MOVED_REQ_COUNT_CONNECTED:
+            if (moved_client_recv_response(client, req, seq) == -1) {
+                printf("Warn: %s did not answer in time\n", client->hostname);
+                return 0;
+            }
+            moved_client_take_count(client);
+            return client->count;
+            break;
+        case MOVED_REQ_READ:
+            /* A lost request or response just means "no new data" */
+            return moved_client_recv_response(client, req, seq) != -1;
+            break;
+        case MOVED_REQ_WRITE:
+        case MOVED_REQ_SUBSCRIBE:
+            return 1;
+            break;
+        default:
+            break;
+    }
+
+    return 0;
+}
+
+int
+moved_client_count(moved_client *client)
+{
+    if (client->counted_ms == 0 ||
+            psmove_util_get_ticks() - client->counted_ms > MOVED_CLIENT_COUNT_CACHE_MS) {
+        moved_client_send(client, MOVED_REQ_COUNT_CONNECTED, 0, NULL);
+    }
+
+    return client->count;
+}
+
+int
+moved_client_list_count(moved_client_list *client_list)
+{
+    unsigned char buf[MOVED_SIZE_READ_ALL_RESPONSE];
+    moved_client_list *cur;
+    long now = psmove_util_get_ticks();
+    long deadline = now + moved_client_timeout_ms;
+    int pending = 0;
+    int total = 0;
+
+    /* Ask all hosts whose count is not cached at once... */
+    for (cur=client_list; cur != NULL; cur=cur->next) {
+        moved_client *client = cur->client;
+        client->count_seq = -1;
+        if (client->counted_ms == 0 ||
+                now - client->counted_ms > MOVED_CLIENT_COUNT_CACHE_MS) {
+            client->count_seq = moved_client_send_request(client,
+                    MOVED_REQ_COUNT_CONNECTED, 0, NULL);
+            if (client->count_seq != -1) {
+                pending++;
+            } else {
+                client->count = 0;
+            }
+        }
+    }
+
+    /* ...and wait for their responses until all have answered or the deadline */
+    while (pending > 0) {
+        long remaining = deadline - psmove_util_get_ticks();
+        if (remaining < 0) {
+            break;
+        }
+
+        fd_set fds;
+        int max_fd = -1;
+        FD_ZERO(&fds);
+        for (cur=client_list; cur != NULL; cur=cur->next) {
+            if (cur->client->count_seq != -1) {
+                FD_SET(cur->client->socket, &fds);
+                if (cur->client->socket > max_fd) {
+                    max_fd = cur->client->socket;
                 }
-                return 1;
-                break;
-            case MOVED_REQ_WRITE:
-                return 1;
-                break;
-            default:
-                break;
+            }
+        }
+
+        struct timeval timeout = { remaining / 1000, (remaining % 1000) * 1000 };
+        if (select(max_fd + 1, &fds, NULL, NULL, &timeout) <= 0) {
+            break;
         }
+
+        for (cur=client_list; cur != NULL; cur=cur->next) {
+            moved_client *client = cur->client;
+            if (client->count_seq == -1 || !FD_ISSET(client->socket, &fds)) {
+                continue;
+            }
+
+            int len = recv(client->socket, (char *)buf, sizeof(buf), 0);
+            if (len != -1 && moved_client_handle_datagram(client, buf, len,
+                        MOVED_REQ_COUNT_CONNECTED, client->count_seq)) {
+                moved_client_take_count(client);
+                client->count_seq = -1;
+                pending--;
+            }
+        }
+    }
+
+    for (cur=client_list; cur != NULL; cur=cur->next) {
+        moved_client *client = cur->client;
+        if (client->count_seq != -1) {
+            /* Unreachable hosts are asked again on the next call */
+            printf("Warn: %s did not answer in time\n", client->hostname);
+            client->count = 0;
+            client->count_seq = -1;
+        }
+        total += client->count;
+    }
+
+    return total;
+}
+
+int
+moved_client_device_id(moved_client *client, int index)
+{
+    if (index < 0 || index >= client->count) {
+        return -1;
+    }
+
+    return client->ids[index];
+}
+
+int
+moved_client_subscribe(moved_client *client, int id)
+{
+    /**
+     * Subscribe, in the compact encoding (see MOVED_PUSH_COMPACT) and with
+     * capture times (see MOVED_SIZE_TIMESTAMP)
+     **/
+    unsigned char data[MOVED_SIZE_REQUEST-2] = { 1, 1, 0, 1 };
+
+    if (id < 0) {
+        return 0;
+    }
+
+    moved_client_subscription *sub =
+        &(client->subscriptions[MOVED_DEVICE_SLOT(id)]);
+    if (client->shm == NULL && client->multicast_socket == -1 &&
+            !moved_client_send(client, MOVED_REQ_SUBSCRIBE, id, data)) {
+        return 0;
+    }
+
+    sub->subscribed = 1;
+    sub->renewed_ms = psmove_util_get_ticks();
+    return 1;
+}
+
+int
+moved_client_read_all(moved_client *client)
+{
+    if (client->read_all_unsupported) {
+        return -1;
+    }
+
+    int seq = moved_client_send_request(client, MOVED_REQ_READ_ALL, 0, NULL);
+    int len = (seq == -1) ? -1 :
+        moved_client_recv_response(client, MOVED_REQ_READ_ALL, seq);
+    if (len == -1) {
+        /* Older versions of moved ignore the request (it never answers) */
+        if (!client->read_all_answered) {
+            printf("Warn: %s does not answer read-all requests\n",
+                    client->hostname);
+            client->read_all_unsupported = 1;
+            return -1;
+        }
+
+        /* Otherwise, a datagram got lost - no new data this time */
+        return 0;
+    }
+
+    client->read_all_answered = 1;
+    return (len - MOVED_SIZE_READ_ALL_HEADER) / MOVED_SIZE_REPORT_ENTRY;
+}
+
+int
+moved_client_get_stats(moved_client *client, int id, unsigned int *stats)
+{
+    int seq = moved_client_send_request(client, MOVED_REQ_STATS, id, NULL);
+    if (seq == -1 ||
+            moved_client_recv_response(client, MOVED_REQ_STATS, seq) == -1) {
+        return -1;
+    }
+
+    int i;
+    for (i=0; i<MOVED_STATS_COUNT; i++) {
+        const unsigned char *value = client->stats_response_buf +
+            MOVED_SIZE_STATS_HEADER + 4 * i;
+        stats[i] = ((unsigned int)value[0] << 24) | (value[1] << 16) |
+            (value[2] << 8) | value[3];
+    }
+
+    return client->stats_response_buf[4];
+}
+
+void
+moved_client_set_timeout(int timeout_ms)
+{
+    moved_client_timeout_ms = (timeout_ms > 0) ? timeout_ms : MOVED_CLIENT_TIMEOUT_MS;
+}
+
+/**
+ * Receive one datagram from the multicast group; returns the number of
+ * reports queued, or -1 if there was nothing to receive
+ **/
+static int
+moved_client_receive_multicast(moved_client *client)
+{
+    unsigned char buf[MOVED_SIZE_PUSH + MOVED_SIZE_TIMESTAMP];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+
+    int len = recvfrom(client->multicast_socket, (char *)buf, sizeof(buf), 0,
+            (struct sockaddr *)&from, &from_len);
+    if (len == -1) {
+        return -1;
+    }
+
+    /**
+     * Other hosts can publish to the same group. Reports of a moved on this
+     * host come from one of its addresses, so they are taken for loopback.
+     **/
+    if (from.sin_addr.s_addr != client->moved_addr.sin_addr.s_addr &&
+            (ntohl(client->moved_addr.sin_addr.s_addr) >> 24) != 127) {
+        return 0;
+    }
+
+    if (len > 0 && (buf[0] == MOVED_PUSH_INPUT ||
+                buf[0] == MOVED_PUSH_COMPACT)) {
+        int reports = moved_client_queue_reports(client, buf, len);
+        return (reports > 0) ? reports : 0;
     }
 
     return 0;
 }
 
+/* Queue the reports written to shared memory since the last call */
+static int
+moved_client_receive_shm(moved_client *client)
+{
+    unsigned char entry[MOVED_SIZE_REPORT_ENTRY];
+    long long time_us;
+    int received = 0;
+    int id;
+
+    for (id=0; id<MOVED_CLIENT_MAX_SUBSCRIPTIONS; id++) {
+        /* Written by moved on this host, so the time is in our clock */
+        while (moved_shm_read(client->shm, id,
+                    &(client->subscriptions[id].shm_next), entry, &time_us)) {
+            moved_client_queue_report(client, entry, time_us);
+            received++;
+        }
+    }
+
+    return received;
+}
+
+int
+moved_client_receive(moved_client *client, int timeout_ms)
+{
+    unsigned char buf[MOVED_SIZE_READ_ALL_RESPONSE];
+    int received = 0;
+    int max_fd = client->socket;
+
+    if (client->shm != NULL) {
+        long deadline = psmove_util_get_ticks() + timeout_ms;
+
+        while (1) {
+            unsigned int updates = moved_shm_updates(client->shm);
+            received += moved_client_receive_shm(client);
+
+            long remaining = deadline - psmove_util_get_ticks();
+            if (received > 0 || timeout_ms <= 0 || remaining <= 0) {
+                break;
+            }
+
+            /* Sleeps until moved writes the next report */
+            moved_shm_wait(client->shm, updates, remaining);
+        }
+
+        return received;
+    }
+
+    if (client->multicast_socket > max_fd) {
+        max_fd = client->multicast_socket;
+    }
+
+    while (1) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(client->socket, &fds);
+        if (client->multicast_socket != -1) {
+            FD_SET(client->multicast_socket, &fds);
+        }
+
+        /* Only wait for the first report, then take what is there */
+        struct timeval timeout = { 0, 0 };
+        if (received == 0 && timeout_ms > 0) {
+            timeout.tv_sec = timeout_ms / 1000;
+            timeout.tv_usec = (timeout_ms % 1000) * 1000;
+        }
+
+        if (select(max_fd + 1, &fds, NULL, NULL, &timeout) <= 0) {
+            break;
+        }
+
+        int got_datagram = 0;
+
+        if (client->multicast_socket != -1 &&
+                FD_ISSET(client->multicast_socket, &fds)) {
+            int reports = moved_client_receive_multicast(client);
+            if (reports != -1) {
+                received += reports;
+                got_datagram = 1;
+            }
+        }
+
+        if (FD_ISSET(client->socket, &fds)) {
+            int len = recv(client->socket, (char *)buf, sizeof(buf), 0);
+            if (len != -1) {
+                /* Responses are only expected by moved_client_send() */
+                int reports = moved_client_queue_reports(client, buf, len);
+                if (reports > 0) {
+                    received += reports;
+                } else if (reports == -1) {
+                    moved_client_handle_datagram(client, buf, len, -1, -1);
+                }
+                got_datagram = 1;
+            }
+        }
+
+        if (!got_datagram) {
+            break;
+        }
+    }
+
+    return received;
+}
+
+int
+moved_client_pop_report(moved_client *client, int id, unsigned char *input,
+        long long *time_us)
+{
+    if (id < 0) {
+        return 0;
+    }
+
+    /* Reports are queued by slot (moved sends the slot, not the device id) */
+    moved_client_subscription *sub =
+        &(client->subscriptions[MOVED_DEVICE_SLOT(id)]);
+    if (sub->queue_count == 0) {
+        return 0;
+    }
+
+    memcpy(input, sub->queue[sub->queue_head], MOVED_SIZE_INPUT);
+    if (time_us != NULL) {
+        *time_us = sub->queue_time_us[sub->queue_head];
+    }
+    sub->queue_head = (sub->queue_head + 1) % MOVED_CLIENT_QUEUE;
+    sub->queue_count--;
+    return 1;
+}
+
+/* Send the output of a device (again) */
+static void
+moved_client_send_write(moved_client *client, int slot)
+{
+    moved_client_write_state *write = &(client->writes[slot]);
+    int id = write->device_id;
+    unsigned char request[MOVED_SIZE_WRITE_ACKED];
+
+    write->sent_ms = psmove_util_get_ticks();
+
+    if (client->write_ack_unsupported) {
+        moved_client_send(client, MOVED_REQ_WRITE, id, write->output);
+        write->unacked = 0;
+        return;
+    }
+
+    if (!write->unacked) {
+        write->seq = ++client->request_seq & 0xFFFF;
+        write->unacked = 1;
+        write->attempts = 0;
+    }
+    write->attempts++;
+
+    request[0] = MOVED_REQ_WRITE_ACKED;
+    request[1] = id;
+    memcpy(request + 2, write->output, sizeof(write->output));
+    request[MOVED_SIZE_WRITE_ACKED-2] = (write->seq >> 8) & 0xFF;
+    request[MOVED_SIZE_WRITE_ACKED-1] = write->seq & 0xFF;
+
+    sendto(client->socket, (char *)request, sizeof(request), 0,
+            (struct sockaddr *)&(client->moved_addr),
+            sizeof(client->moved_addr));
+}
+
+void
+moved_client_write(moved_client *client, int id, const unsigned char *output)
+{
+    if (id < 0) {
+        moved_client_send(client, MOVED_REQ_WRITE, id, output);
+        return;
+    }
+
+    moved_client_write_state *write = &(client->writes[MOVED_DEVICE_SLOT(id)]);
+    write->device_id = id;
+    memcpy(write->output, output, sizeof(write->output));
+    write->dirty = 1;
+
+    /* A new output supersedes an unacknowledged one */
+    write->unacked = 0;
+
+    moved_client_flush_writes(client);
+}
+
+void
+moved_client_flush_writes(moved_client *client)
+{
+    unsigned char buf[MOVED_SIZE_READ_ALL_RESPONSE];
+    long now = psmove_util_get_ticks();
+    int slot;
+
+    /* Take the acknowledgements that have arrived (without waiting) */
+    int len;
+    while ((len = recv(client->socket, (char *)buf, sizeof(buf), 0)) > 0) {
+        moved_client_handle_datagram(client, buf, len, -1, -1);
+    }
+
+    for (slot=0; slot<MOVED_CLIENT_MAX_SUBSCRIPTIONS; slot++) {
+        moved_client_write_state *write = &(client->writes[slot]);
+
+        if (write->dirty) {
+            /* Coalesce: only the newest output of an interval is sent */
+            if (now - write->sent_ms >= MOVED_CLIENT_WRITE_INTERVAL_MS) {
+                write->dirty = 0;
+                moved_client_send_write(client, slot);
+            }
+        } else if (write->unacked && now - write->sent_ms >= MOVED_WRITE_RESEND_MS) {
+            if (write->attempts < MOVED_WRITE_ATTEMPTS) {
+                moved_client_send_write(client, slot);
+            } else if (!client->write_ack_answered) {
+                /* Older versions of moved ignore the request */
+                printf("Warn: %s does not acknowledge writes\n",
+                        client->hostname);
+                client->write_ack_unsupported = 1;
+                moved_client_send_write(client, slot);
+            } else {
+                /* The host does not answer anymore - give up */
+                write->unacked = 0;
+            }
+        }
+    }
+}
+
+void
+moved_client_update_clock(moved_client *client)
+{
+    long now = psmove_util_get_ticks();
+    if (now < client->next_ping_ms) {
+        return;
+    }
+
+    /* Older versions of moved ignore the request (it never answers) */
+    if (client->clock_samples_taken == 0 &&
+            client->pings == 2 * MOVED_CLIENT_CLOCK_SAMPLES) {
+        printf("Warn: %s does not answer time requests\n", client->hostname);
+    }
+    if (client->clock_samples_taken == 0 &&
+            client->pings >= 2 * MOVED_CLIENT_CLOCK_SAMPLES) {
+        client->next_ping_ms = now + MOVED_CLIENT_CLOCK_INTERVAL_MS * 60;
+    } else if (client->clock_samples_taken < MOVED_CLIENT_CLOCK_SAMPLES) {
+        client->next_ping_ms = now + MOVED_CLIENT_CLOCK_STARTUP_MS;
+    } else {
+        client->next_ping_ms = now + MOVED_CLIENT_CLOCK_INTERVAL_MS;
+    }
+
+    client->ping_sent_us = psmove_util_get_ticks_us();
+    client->ping_seq = moved_client_send_request(client, MOVED_REQ_TIME, 0,
+            NULL);
+    client->pings++;
+}
+
+int
+moved_client_get_clock(moved_client *client, long long *offset_us,
+        long long *rtt_us)
+{
+    if (client->clock_rtt_us < 0) {
+        return 0;
+    }
+
+    if (offset_us != NULL) {
+        *offset_us = client->clock_offset_us;
+    }
+    if (rtt_us != NULL) {
+        *rtt_us = client->clock_rtt_us;
+    }
+    return 1;
+}
+
 void
 moved_client_destroy(moved_client *client)
 {
+    unsigned char data[MOVED_SIZE_REQUEST-2] = { 0 };
+    int id;
+
+    /* Stop the pushed reports (they would expire anyway) */
+    for (id=0; id<MOVED_CLIENT_MAX_SUBSCRIPTIONS; id++) {
+        if (client->subscriptions[id].subscribed && client->shm == NULL &&
+                client->multicast_socket == -1) {
+            moved_client_send(client, MOVED_REQ_SUBSCRIBE, id, data);
+        }
+    }
+
+    if (client->multicast_socket != -1) {
+        close(client->multicast_socket);
+    }
+    moved_shm_close(client->shm);
     close(client->socket);
+    free(client->hostname);
     free(client);
 }
 
@@ -41,6 +41,7 @@
 #  include <netdb.h>
 #  include <unistd.h>
 #  include <sys/socket.h>
+#  include <sys/select.h>
 #endif
 
 #include <stdio.h>
@@ -50,6 +51,70 @@
 #include <string.h>
 
 #include "psmove_moved_protocol.h"
+#include "moved_compact.h"
+#include "moved_shm.h"
+
+/* Default time to wait for a response (see moved_client_set_timeout) */
+#define MOVED_CLIENT_TIMEOUT_MS 100
+
+/* Number of remote devices per host that can be subscribed to (one per slot) */
+#define MOVED_CLIENT_MAX_SUBSCRIPTIONS MOVED_MAX_DEVICES
+
+/* How long the number of devices of a host is cached */
+#define MOVED_CLIENT_COUNT_CACHE_MS 1000
+
+/* Outputs of a device are sent at most this often (newer ones replace older) */
+#define MOVED_CLIENT_WRITE_INTERVAL_MS 10
+
+/* Clock samples kept per host; the one with the lowest round-trip wins */
+#define MOVED_CLIENT_CLOCK_SAMPLES 8
+
+/* moved's clock is sampled this often... */
+#define MOVED_CLIENT_CLOCK_INTERVAL_MS 1000
+
+/* ...and this often until MOVED_CLIENT_CLOCK_SAMPLES samples were taken */
+#define MOVED_CLIENT_CLOCK_STARTUP_MS 50
+
+/* Number of pushed reports queued per device */
+#define MOVED_CLIENT_QUEUE 16
+
+/**
+ * Reports received for one device, pushed by moved (see MOVED_REQ_SUBSCRIBE)
+ * or as part of a MOVED_REQ_READ_ALL response
+ **/
+typedef struct {
+    int subscribed; /* Nonzero once a subscription has been sent */
+    long renewed_ms; /* When the subscription was last sent */
+    long received_ms; /* When the last report was pushed, 0 if never */
+
+    unsigned int last_seq; /* Sequence number of the newest queued report */
+    unsigned long lost; /* Reports missing from the sequence */
+
+    unsigned char queue[MOVED_CLIENT_QUEUE][MOVED_SIZE_INPUT];
+    long long queue_time_us[MOVED_CLIENT_QUEUE]; /* Capture times, our clock */
+    int queue_head; /* Index of the oldest queued report */
+    int queue_count; /* Number of queued reports */
+
+    moved_compact_state compact; /* Decoder of MOVED_PUSH_COMPACT reports */
+    unsigned int shm_next; /* Next report to read from shared memory */
+} moved_client_subscription;
+
+/* One exchange of MOVED_REQ_TIME (see moved_client_update_clock) */
+typedef struct {
+    long long offset_us; /* moved's clock minus ours */
+    long long rtt_us; /* Round-trip time, without moved's processing time */
+} moved_client_clock_sample;
+
+/* The output of one device (see moved_client_write) */
+typedef struct {
+    int device_id; /* Device id the output is sent to (see MOVED_DEVICE_ID) */
+    unsigned char output[MOVED_SIZE_REQUEST-2];
+    int dirty; /* The output has not been sent yet */
+    int unacked; /* The output has been sent, but not acknowledged */
+    int seq; /* Sequence number of the unacknowledged output */
+    int attempts; /* How often the unacknowledged output has been sent */
+    long sent_ms; /* When the output was last sent */
+} moved_client_write_state;
 
 typedef struct {
     char *hostname;
@@ -59,6 +124,37 @@ typedef struct {
 
     unsigned char request_buf[MOVED_SIZE_REQUEST];
     unsigned char read_response_buf[MOVED_SIZE_READ_RESPONSE];
+    unsigned char stats_response_buf[MOVED_SIZE_STATS_RESPONSE];
+
+    moved_client_subscription subscriptions[MOVED_CLIENT_MAX_SUBSCRIPTIONS];
+    moved_client_write_state writes[MOVED_CLIENT_MAX_SUBSCRIPTIONS];
+    int write_ack_unsupported; /* Nonzero if MOVED_REQ_WRITE_ACKED is not answered */
+    int write_ack_answered; /* Nonzero once a MOVED_REQ_WRITE_ACKED has been answered */
+    int request_seq; /* Sequence number of the last request with a response */
+    int read_all_unsupported; /* Nonzero if MOVED_REQ_READ_ALL is not answered */
+    int read_all_answered; /* Nonzero once a MOVED_REQ_READ_ALL has been answered */
+
+    /* Joined to the multicast group (see MOVED_MULTICAST_ENV), or -1 */
+    int multicast_socket;
+
+    /* Reports of a moved on this host (see moved_shm.h), or NULL */
+    moved_shm_segment *shm;
+
+    /* moved's clock (see moved_client_update_clock) */
+    moved_client_clock_sample clock_samples[MOVED_CLIENT_CLOCK_SAMPLES];
+    int clock_samples_taken;
+    long long clock_offset_us; /* moved's clock minus ours */
+    long long clock_rtt_us; /* -1 until the first sample was taken */
+    int ping_seq; /* Sequence number of the pending MOVED_REQ_TIME, or -1 */
+    int pings; /* Number of MOVED_REQ_TIME sent */
+    long long ping_sent_us;
+    long next_ping_ms;
+
+    /* Cached number of devices (see moved_client_count) */
+    int count;
+    int ids[MOVED_MAX_DEVICES]; /* Device ids of the connected devices */
+    long counted_ms; /* When the count was received, 0 if never */
+    int count_seq; /* Sequence number of a pending count request, or -1 */
 } moved_client;
 
 typedef struct _moved_client_list {
@@ -75,9 +171,114 @@ moved_client_list_destroy(moved_client_list *client_list);
 moved_client *
 moved_client_create(const char *hostname);
 
+/**
+ * Send a request; for requests with a response, waits for it at most for
+ * the timeout (see moved_client_set_timeout). Returns 0 on errors and
+ * timeouts, the number of devices for MOVED_REQ_COUNT_CONNECTED, 1 otherwise.
+ **/
 int
 moved_client_send(moved_client *client, char req, char id, const unsigned char *data);
 
+/**
+ * The number of devices of the host, asking it only if the cached number
+ * is older than MOVED_CLIENT_COUNT_CACHE_MS (0 if it does not answer)
+ **/
+int
+moved_client_count(moved_client *client);
+
+/**
+ * Refresh the cached number of devices of all hosts concurrently, waiting
+ * at most for the timeout (see moved_client_set_timeout) for all of them
+ * to answer; returns the total number of devices
+ **/
+int
+moved_client_list_count(moved_client_list *client_list);
+
+/**
+ * The device id (see MOVED_DEVICE_ID) of the index-th connected device of
+ * the last count, or -1 if there is no such device. The other functions
+ * take this id; a device that was replaced in its slot is not addressed.
+ **/
+int
+moved_client_device_id(moved_client *client, int index);
+
+/**
+ * Get the statistics of moved and of one of its devices (see
+ * MOVED_REQ_STATS); fills stats (MOVED_STATS_COUNT values) and returns 1
+ * if the device exists, 0 if only the server-wide values are valid, or -1
+ * if moved did not answer (older versions ignore the request).
+ **/
+int
+moved_client_get_stats(moved_client *client, int id, unsigned int *stats);
+
+/* Set the time to wait for responses of all clients (<= 0: default) */
+void
+moved_client_set_timeout(int timeout_ms);
+
+/**
+ * Subscribe to (or renew the subscription of) the pushed reports of a
+ * remote device; returns 0 if the device can't be subscribed to. Clients
+ * that joined the multicast group or read the reports from shared memory
+ * receive all reports without subscribing.
+ **/
+int
+moved_client_subscribe(moved_client *client, int id);
+
+/**
+ * Request the new reports of all devices in one round trip and queue them
+ * (see moved_client_pop_report); returns the number of reports (0 if the
+ * response got lost), or -1 if moved does not support MOVED_REQ_READ_ALL
+ **/
+int
+moved_client_read_all(moved_client *client);
+
+/**
+ * Receive the reports pushed by moved (waits up to timeout_ms for the first
+ * one, 0 does not wait); returns the number of reports received
+ **/
+int
+moved_client_receive(moved_client *client, int timeout_ms);
+
+/**
+ * Take the oldest queued report of a subscribed device; returns 1 and fills
+ * input (MOVED_SIZE_INPUT bytes) if there was one, 0 otherwise. If time_us
+ * is not NULL, it is set to the capture time of the report converted to
+ * our clock (see MOVED_SIZE_TIMESTAMP), or the time it was received if
+ * moved did not send it.
+ **/
+int
+moved_client_pop_report(moved_client *client, int id, unsigned char *input,
+        long long *time_us);
+
+/**
+ * Sample moved's clock when due (see MOVED_CLIENT_CLOCK_INTERVAL_MS); the
+ * answers are taken by the other functions receiving from moved, so call
+ * this regularly, e.g. together with moved_client_flush_writes()
+ **/
+void
+moved_client_update_clock(moved_client *client);
+
+/**
+ * Get the offset of moved's clock to ours and the round-trip time (both in
+ * microseconds); returns 0 if the clock has not been sampled yet
+ **/
+int
+moved_client_get_clock(moved_client *client, long long *offset_us,
+        long long *rtt_us);
+
+/**
+ * Set the output (LEDs and rumble, MOVED_SIZE_REQUEST-2 bytes) of a remote
+ * device. Outputs are sent at most every MOVED_CLIENT_WRITE_INTERVAL_MS
+ * (only the newest one) and resent until moved acknowledges them, so call
+ * moved_client_flush_writes() regularly.
+ **/
+void
+moved_client_write(moved_client *client, int id, const unsigned char *output);
+
+/* Send pending outputs and resend unacknowledged ones when they are due */
+void
+moved_client_flush_writes(moved_client *client);
+
 void
 moved_client_destroy(moved_client *client);
 
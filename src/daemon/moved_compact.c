@@ -0,0 +1,228 @@
+
+ /**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2011, 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#include <string.h>
+
+#include "moved_compact.h"
+
+/* Offsets of the bytes that rarely change (see moved_compact_state) */
+static const unsigned char moved_compact_static[] = {
+    0, /* type */
+    1, 2, 3, 4, /* buttons */
+    5, 6, /* trigger, 2nd frame */
+    7, 8, 9, 10, /* unknown */
+    12, /* battery */
+    44, 45, 46, 47, 48, /* padding / unknown */
+};
+#define MOVED_COMPACT_STATIC_COUNT \
+    (int)(sizeof(moved_compact_static) / sizeof(moved_compact_static[0]))
+#define MOVED_COMPACT_MASK_SIZE ((MOVED_COMPACT_STATIC_COUNT + 7) / 8)
+
+/* Offsets of the bytes that are always sent as they are */
+static const unsigned char moved_compact_sensors[] = {
+    11, 43, /* timestamp */
+    13, 14, 15, 16, 17, 18, /* accelerometer */
+    25, 26, 27, 28, 29, 30, /* gyro */
+    37, 38, 39, 40, 41, 42, /* temperature, magnetometer */
+};
+#define MOVED_COMPACT_SENSORS_COUNT \
+    (int)(sizeof(moved_compact_sensors) / sizeof(moved_compact_sensors[0]))
+
+/* Offsets of the 16-bit values of the 2nd frame and of their 1st frame */
+static const unsigned char moved_compact_frame2[][2] = {
+    { 19, 13 }, { 21, 15 }, { 23, 17 }, /* accelerometer */
+    { 31, 25 }, { 33, 27 }, { 35, 29 }, /* gyro */
+};
+#define MOVED_COMPACT_FRAME2_COUNT \
+    (int)(sizeof(moved_compact_frame2) / sizeof(moved_compact_frame2[0]))
+
+/* [0] tag, [1] device id, [2..3] sequence number, [4] flags */
+#define MOVED_COMPACT_HEADER 5
+
+#define MOVED_COMPACT_KEY 0x01 /* The full report follows */
+#define MOVED_COMPACT_FRAME2_DELTA 0x02 /* 2nd frame as 8-bit differences */
+
+static int
+moved_compact_value(const unsigned char *input, int offset)
+{
+    return (short)(input[offset] | (input[offset+1] << 8));
+}
+
+int
+moved_compact_encode(moved_compact_state *state, int device_id,
+        unsigned int seq, const unsigned char *input, unsigned char *out)
+{
+    int i, len;
+
+    out[0] = MOVED_PUSH_COMPACT;
+    out[1] = device_id;
+    out[2] = (seq >> 8) & 0xFF;
+    out[3] = seq & 0xFF;
+    out[4] = 0;
+
+    if (state->has_key && state->since_key < MOVED_COMPACT_KEY_INTERVAL) {
+        unsigned char *mask = out + MOVED_COMPACT_HEADER + 2;
+
+        out[MOVED_COMPACT_HEADER] = (state->key_seq >> 8) & 0xFF;
+        out[MOVED_COMPACT_HEADER+1] = state->key_seq & 0xFF;
+        memset(mask, 0, MOVED_COMPACT_MASK_SIZE);
+        len = MOVED_COMPACT_HEADER + 2 + MOVED_COMPACT_MASK_SIZE;
+
+        for (i=0; i<MOVED_COMPACT_STATIC_COUNT; i++) {
+            int offset = moved_compact_static[i];
+            if (input[offset] != state->key[offset]) {
+                mask[i / 8] |= 1 << (i % 8);
+                out[len++] = input[offset];
+            }
+        }
+
+        for (i=0; i<MOVED_COMPACT_SENSORS_COUNT; i++) {
+            out[len++] = input[moved_compact_sensors[i]];
+        }
+
+        /* Both frames of a report are only a few milliseconds apart */
+        out[4] |= MOVED_COMPACT_FRAME2_DELTA;
+        for (i=0; i<MOVED_COMPACT_FRAME2_COUNT; i++) {
+            int delta = moved_compact_value(input, moved_compact_frame2[i][0]) -
+                moved_compact_value(input, moved_compact_frame2[i][1]);
+            if (delta < -128 || delta > 127) {
+                out[4] &= ~MOVED_COMPACT_FRAME2_DELTA;
+                break;
+            }
+        }
+
+        for (i=0; i<MOVED_COMPACT_FRAME2_COUNT; i++) {
+            int offset = moved_compact_frame2[i][0];
+            if (out[4] & MOVED_COMPACT_FRAME2_DELTA) {
+                out[len++] = (moved_compact_value(input, offset) -
+                        moved_compact_value(input,
+                            moved_compact_frame2[i][1])) & 0xFF;
+            } else {
+                out[len++] = input[offset];
+                out[len++] = input[offset+1];
+            }
+        }
+
+        /* Many changes at once - a key frame is not larger */
+        if (len < MOVED_SIZE_COMPACT_MAX) {
+            state->since_key++;
+            return len;
+        }
+    }
+
+    out[4] = MOVED_COMPACT_KEY;
+    memcpy(out + MOVED_COMPACT_HEADER, input, MOVED_SIZE_INPUT);
+
+    state->has_key = 1;
+    memcpy(state->key, input, MOVED_SIZE_INPUT);
+    state->key_seq = seq & 0xFFFF;
+    state->since_key = 0;
+
+    return MOVED_SIZE_COMPACT_MAX;
+}
+
+int
+moved_compact_decode(moved_compact_state *state,
+        const unsigned char *buf, int len, unsigned char *input,
+        unsigned int *seq)
+{
+    int i, pos;
+
+    if (len < MOVED_COMPACT_HEADER || buf[0] != MOVED_PUSH_COMPACT) {
+        return 0;
+    }
+
+    *seq = (buf[2] << 8) | buf[3];
+
+    if (buf[4] & MOVED_COMPACT_KEY) {
+        if (len != MOVED_SIZE_COMPACT_MAX) {
+            return 0;
+        }
+
+        memcpy(input, buf + MOVED_COMPACT_HEADER, MOVED_SIZE_INPUT);
+
+        state->has_key = 1;
+        memcpy(state->key, input, MOVED_SIZE_INPUT);
+        state->key_seq = *seq;
+        return 1;
+    }
+
+    pos = MOVED_COMPACT_HEADER + 2 + MOVED_COMPACT_MASK_SIZE;
+    if (len < pos) {
+        return 0;
+    }
+
+    /* The key frame this report refers to got lost */
+    if (!state->has_key || ((buf[MOVED_COMPACT_HEADER] << 8) |
+                buf[MOVED_COMPACT_HEADER+1]) != state->key_seq) {
+        return 0;
+    }
+
+    const unsigned char *mask = buf + MOVED_COMPACT_HEADER + 2;
+    int frame2_size = (buf[4] & MOVED_COMPACT_FRAME2_DELTA) ?
+        MOVED_COMPACT_FRAME2_COUNT : 2 * MOVED_COMPACT_FRAME2_COUNT;
+    int changed = 0;
+
+    for (i=0; i<MOVED_COMPACT_STATIC_COUNT; i++) {
+        if (mask[i / 8] & (1 << (i % 8))) {
+            changed++;
+        }
+    }
+
+    if (len != pos + changed + MOVED_COMPACT_SENSORS_COUNT + frame2_size) {
+        return 0;
+    }
+
+    memcpy(input, state->key, MOVED_SIZE_INPUT);
+
+    for (i=0; i<MOVED_COMPACT_STATIC_COUNT; i++) {
+        if (mask[i / 8] & (1 << (i % 8))) {
+            input[moved_compact_static[i]] = buf[pos++];
+        }
+    }
+
+    for (i=0; i<MOVED_COMPACT_SENSORS_COUNT; i++) {
+        input[moved_compact_sensors[i]] = buf[pos++];
+    }
+
+    for (i=0; i<MOVED_COMPACT_FRAME2_COUNT; i++) {
+        int offset = moved_compact_frame2[i][0];
+        if (buf[4] & MOVED_COMPACT_FRAME2_DELTA) {
+            int value = moved_compact_value(input, moved_compact_frame2[i][1]) +
+                (signed char)buf[pos++];
+            input[offset] = value & 0xFF;
+            input[offset+1] = (value >> 8) & 0xFF;
+        } else {
+            input[offset] = buf[pos++];
+            input[offset+1] = buf[pos++];
+        }
+    }
+
+    return 1;
+}
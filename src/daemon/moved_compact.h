@@ -0,0 +1,77 @@
+
+ /**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2011, 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#ifndef MOVED_COMPACT_H
+#define MOVED_COMPACT_H
+
+#include "psmove.h"
+#include "psmove_moved_protocol.h"
+
+/**
+ * Delta encoding of pushed input reports (see MOVED_PUSH_COMPACT)
+ *
+ * A key frame carries the full input report. The reports in between only
+ * carry a bitmask of the bytes that changed since the key frame (buttons,
+ * trigger, battery, ...), the sensor values of the first frame and the
+ * second frame's accelerometer and gyro values as 8-bit differences to the
+ * first frame, if they fit. Reports always refer to the last key frame (not
+ * to the previous report), so a lost datagram only loses that report.
+ **/
+
+/* A key frame is sent at least every this many reports */
+#define MOVED_COMPACT_KEY_INTERVAL 16
+
+/* Encoder or decoder state of one report stream */
+typedef struct {
+    int has_key; /* Nonzero once a key frame has been sent/received */
+    unsigned char key[MOVED_SIZE_INPUT]; /* The last key frame */
+    unsigned int key_seq; /* Sequence number of the key frame (16 bits) */
+    int since_key; /* Reports encoded since the key frame */
+} moved_compact_state;
+
+/**
+ * Encode the input report (MOVED_SIZE_INPUT bytes) of a device as a
+ * MOVED_PUSH_COMPACT datagram into "out" (at least MOVED_SIZE_COMPACT_MAX
+ * bytes); returns the size of the datagram
+ **/
+ADDAPI int
+ADDCALL moved_compact_encode(moved_compact_state *state, int device_id,
+        unsigned int seq, const unsigned char *input, unsigned char *out);
+
+/**
+ * Decode a MOVED_PUSH_COMPACT datagram into an input report (MOVED_SIZE_INPUT
+ * bytes) and the 16 low bits of its sequence number; returns 0 if it can't
+ * be decoded (malformed, or its key frame got lost)
+ **/
+ADDAPI int
+ADDCALL moved_compact_decode(moved_compact_state *state,
+        const unsigned char *buf, int len, unsigned char *input,
+        unsigned int *seq);
+
+#endif
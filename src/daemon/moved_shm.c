@@ -0,0 +1,282 @@
+
+ /**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2011, 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "moved_shm.h"
+
+#if defined(__linux)
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <limits.h>
+#  include <signal.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <sys/syscall.h>
+#  include <linux/futex.h>
+#endif
+
+#if defined(__linux)
+
+moved_shm_segment *
+moved_shm_create()
+{
+    moved_shm_segment *shm;
+
+    /* A segment left behind by a moved that crashed is replaced */
+    shm_unlink(MOVED_SHM_NAME);
+
+    int fd = shm_open(MOVED_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(moved_shm_segment)) == -1) {
+        close(fd);
+        shm_unlink(MOVED_SHM_NAME);
+        return NULL;
+    }
+
+    shm = mmap(NULL, sizeof(moved_shm_segment), PROT_READ | PROT_WRITE,
+            MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (shm == MAP_FAILED) {
+        shm_unlink(MOVED_SHM_NAME);
+        return NULL;
+    }
+
+    /* The segment is zeroed by ftruncate(); publish it last */
+    shm->version = MOVED_SHM_VERSION;
+    shm->pid = getpid();
+    __atomic_store_n(&(shm->magic), MOVED_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return shm;
+}
+
+void
+moved_shm_write(moved_shm_segment *shm, int slot, unsigned int seq,
+        long long time_us, const unsigned char *input)
+{
+    moved_shm_device *device = &(shm->devices[slot]);
+    unsigned int written = device->written;
+    moved_shm_entry *entry = &(device->ring[written % MOVED_SHM_RING]);
+    unsigned int lock = entry->lock;
+
+    __atomic_store_n(&(entry->lock), lock + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    entry->seq = seq;
+    entry->time_us = time_us;
+    memcpy(entry->input, input, MOVED_SIZE_INPUT);
+
+    __atomic_store_n(&(entry->lock), lock + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&(device->written), written + 1, __ATOMIC_RELEASE);
+
+    /* No-op in the kernel if no client is waiting */
+    __atomic_add_fetch(&(shm->updates), 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &(shm->updates), FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+void
+moved_shm_destroy(moved_shm_segment *shm)
+{
+    if (shm != NULL) {
+        munmap(shm, sizeof(moved_shm_segment));
+        shm_unlink(MOVED_SHM_NAME);
+    }
+}
+
+moved_shm_segment *
+moved_shm_open()
+{
+    moved_shm_segment *shm;
+    struct stat st;
+
+    int fd = shm_open(MOVED_SHM_NAME, O_RDONLY, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) == -1 || st.st_size < sizeof(moved_shm_segment)) {
+        close(fd);
+        return NULL;
+    }
+
+    shm = mmap(NULL, sizeof(moved_shm_segment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (shm == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* Don't use a segment left behind by a moved that is not running */
+    if (__atomic_load_n(&(shm->magic), __ATOMIC_ACQUIRE) != MOVED_SHM_MAGIC ||
+            shm->version != MOVED_SHM_VERSION ||
+            (kill(shm->pid, 0) == -1 && errno != EPERM)) {
+        munmap(shm, sizeof(moved_shm_segment));
+        return NULL;
+    }
+
+    return shm;
+}
+
+unsigned int
+moved_shm_tail(moved_shm_segment *shm, int slot)
+{
+    return __atomic_load_n(&(shm->devices[slot].written), __ATOMIC_ACQUIRE);
+}
+
+int
+moved_shm_read(moved_shm_segment *shm, int slot, unsigned int *next,
+        unsigned char *entry, long long *time_us)
+{
+    moved_shm_device *device = &(shm->devices[slot]);
+
+    while (1) {
+        unsigned int written = __atomic_load_n(&(device->written),
+                __ATOMIC_ACQUIRE);
+
+        if (*next == written) {
+            return 0;
+        }
+
+        /* The oldest reports have been overwritten already */
+        if (written - *next > MOVED_SHM_RING) {
+            *next = written - MOVED_SHM_RING;
+        }
+
+        moved_shm_entry *ring = &(device->ring[*next % MOVED_SHM_RING]);
+        unsigned int lock = __atomic_load_n(&(ring->lock), __ATOMIC_ACQUIRE);
+        unsigned int seq = ring->seq;
+        long long captured_us = ring->time_us;
+        memcpy(entry + 5, ring->input, MOVED_SIZE_INPUT);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        (*next)++;
+
+        /* Being written or overwritten while copying - try the next one */
+        if ((lock & 1) || __atomic_load_n(&(ring->lock),
+                    __ATOMIC_RELAXED) != lock) {
+            continue;
+        }
+
+        entry[0] = slot;
+        entry[1] = (seq >> 24) & 0xFF;
+        entry[2] = (seq >> 16) & 0xFF;
+        entry[3] = (seq >> 8) & 0xFF;
+        entry[4] = seq & 0xFF;
+        *time_us = captured_us;
+        return 1;
+    }
+}
+
+unsigned int
+moved_shm_updates(moved_shm_segment *shm)
+{
+    return __atomic_load_n(&(shm->updates), __ATOMIC_ACQUIRE);
+}
+
+void
+moved_shm_wait(moved_shm_segment *shm, unsigned int updates, int timeout_ms)
+{
+    struct timespec timeout = {
+        timeout_ms / 1000, (timeout_ms % 1000) * 1000000
+    };
+
+    /* Returns right away if "updates" has changed in the meantime */
+    syscall(SYS_futex, &(shm->updates), FUTEX_WAIT, updates, &timeout,
+            NULL, 0);
+}
+
+void
+moved_shm_close(moved_shm_segment *shm)
+{
+    if (shm != NULL) {
+        munmap(shm, sizeof(moved_shm_segment));
+    }
+}
+
+#else
+
+moved_shm_segment *
+moved_shm_create()
+{
+    return NULL;
+}
+
+void
+moved_shm_write(moved_shm_segment *shm, int slot, unsigned int seq,
+        long long time_us, const unsigned char *input)
+{
+}
+
+void
+moved_shm_destroy(moved_shm_segment *shm)
+{
+}
+
+moved_shm_segment *
+moved_shm_open()
+{
+    return NULL;
+}
+
+unsigned int
+moved_shm_tail(moved_shm_segment *shm, int slot)
+{
+    return 0;
+}
+
+int
+moved_shm_read(moved_shm_segment *shm, int slot, unsigned int *next,
+        unsigned char *entry, long long *time_us)
+{
+    return 0;
+}
+
+unsigned int
+moved_shm_updates(moved_shm_segment *shm)
+{
+    return 0;
+}
+
+void
+moved_shm_wait(moved_shm_segment *shm, unsigned int updates, int timeout_ms)
+{
+}
+
+void
+moved_shm_close(moved_shm_segment *shm)
+{
+}
+
+#endif
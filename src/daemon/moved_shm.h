@@ -0,0 +1,128 @@
+
+ /**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2011, 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#ifndef MOVED_SHM_H
+#define MOVED_SHM_H
+
+#include "psmove.h"
+#include "psmove_moved_protocol.h"
+
+/**
+ * Shared-memory transport for clients on the same host as moved
+ *
+ * moved writes every input report into a ring per device in a named
+ * shared memory segment. Each ring entry is protected by a sequence lock,
+ * so clients (which only map the segment read-only) can copy the reports
+ * without any system call; if the writer was faster, the entry is skipped.
+ * Each report also increments a futex, so that clients can wait for new
+ * reports without polling.
+ *
+ * This is only available on Linux; elsewhere, moved_shm_create() and
+ * moved_shm_open() return NULL.
+ **/
+
+#define MOVED_SHM_NAME "/psmove-moved"
+#define MOVED_SHM_MAGIC 0x4d4f5645
+#define MOVED_SHM_VERSION 2
+
+/* Number of reports kept per device */
+#define MOVED_SHM_RING 32
+
+typedef struct {
+    unsigned int lock; /* Odd while the entry is being written */
+    unsigned int seq; /* Sequence number of the report */
+    long long time_us; /* Capture time (see MOVED_SIZE_TIMESTAMP) */
+    unsigned char input[MOVED_SIZE_INPUT];
+} moved_shm_entry;
+
+typedef struct {
+    unsigned int written; /* Number of reports written so far */
+    moved_shm_entry ring[MOVED_SHM_RING];
+} moved_shm_device;
+
+typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    int pid; /* Process ID of moved */
+    unsigned int updates; /* Futex, incremented after each report */
+    moved_shm_device devices[MOVED_MAX_DEVICES];
+} moved_shm_segment;
+
+/* Create (replace) the segment; for moved */
+ADDAPI moved_shm_segment *
+ADDCALL moved_shm_create();
+
+/**
+ * Write the input report (MOVED_SIZE_INPUT bytes) of the device in a slot,
+ * captured at time_us (see psmove_util_get_ticks_us())
+ **/
+ADDAPI void
+ADDCALL moved_shm_write(moved_shm_segment *shm, int slot, unsigned int seq,
+        long long time_us, const unsigned char *input);
+
+/* Remove the segment; for moved */
+ADDAPI void
+ADDCALL moved_shm_destroy(moved_shm_segment *shm);
+
+/* Map the segment of a running moved read-only; NULL if there is none */
+ADDAPI moved_shm_segment *
+ADDCALL moved_shm_open();
+
+/* Position after the newest report of a slot, for moved_shm_read() */
+ADDAPI unsigned int
+ADDCALL moved_shm_tail(moved_shm_segment *shm, int slot);
+
+/**
+ * Copy the report at position *next of a slot into entry (device id,
+ * sequence number and input report, see MOVED_SIZE_REPORT_ENTRY) and its
+ * capture time into *time_us, and advance *next; returns 0 if there is no
+ * new report. Reports that have been overwritten in the meantime are
+ * skipped. moved runs on the same host, so the time needs no conversion.
+ **/
+ADDAPI int
+ADDCALL moved_shm_read(moved_shm_segment *shm, int slot, unsigned int *next,
+        unsigned char *entry, long long *time_us);
+
+/* The number of reports written to all devices, for moved_shm_wait() */
+ADDAPI unsigned int
+ADDCALL moved_shm_updates(moved_shm_segment *shm);
+
+/**
+ * Wait up to timeout_ms for a report to be written after "updates" was
+ * returned by moved_shm_updates(); returns immediately if one already was
+ **/
+ADDAPI void
+ADDCALL moved_shm_wait(moved_shm_segment *shm, unsigned int updates,
+        int timeout_ms);
+
+/* Unmap a segment opened with moved_shm_open() */
+ADDAPI void
+ADDCALL moved_shm_close(moved_shm_segment *shm);
+
+#endif
@@ -32,14 +32,235 @@
 
 #define MOVED_UDP_PORT 17777
 
+/**
+ * Device ids: the lower 4 bits are the slot of the device, which does not
+ * change while the device stays connected; the upper 4 bits are the
+ * generation of the slot (1..15), which changes whenever a new device gets
+ * the slot. Requests with a generation of 0 address whatever device is in
+ * the slot (as used by older clients); requests with another generation
+ * are ignored once the device has been replaced.
+ **/
+#define MOVED_MAX_DEVICES 16
+#define MOVED_DEVICE_SLOT(id) ((id) & 0x0F)
+#define MOVED_DEVICE_GENERATION(id) (((id) >> 4) & 0x0F)
+#define MOVED_DEVICE_ID(slot, generation) (((generation) << 4) | (slot))
+
+/**
+ * Count the devices: the response is [0] = number of slots up to the last
+ * one in use, [1..] = device id of each slot, 0 for free slots
+ **/
 #define MOVED_REQ_COUNT_CONNECTED 0x01
 /* Request ID 0x02 is reserved / obsolete */
 #define MOVED_REQ_WRITE 0x03
 #define MOVED_REQ_READ 0x04
 
+/**
+ * Subscribe to the input reports of a device: request[2] is 1 to subscribe
+ * (or renew the subscription), 0 to unsubscribe. There is no response;
+ * instead, moved pushes every new input report of the device to the
+ * sender as a MOVED_PUSH_INPUT datagram, until the subscription is
+ * cancelled or has not been renewed for MOVED_SUBSCRIPTION_TIMEOUT_MS.
+ * If request[3] is 1, the reports are pushed as MOVED_PUSH_COMPACT
+ * datagrams instead; if request[4] is 1, as MOVED_PUSH_STATE datagrams
+ * (older versions of moved ignore both). If request[5] is 1, the pushed
+ * datagrams carry the capture time of their report (see
+ * MOVED_SIZE_TIMESTAMP).
+ **/
+#define MOVED_REQ_SUBSCRIBE 0x05
+
+/**
+ * A pushed input report: [0] = MOVED_PUSH_INPUT, [1] = device id,
+ * [2..5] = sequence number (big endian, incremented per pushed report of
+ * the device), [6..] = the input report (same as MOVED_REQ_READ, without
+ * the leading return value of psmove_poll())
+ **/
+#define MOVED_PUSH_INPUT 0x84
+
+/**
+ * A pushed input report in the delta encoding of moved_compact.h: [0] =
+ * MOVED_PUSH_COMPACT, [1] = device id, [2..3] = 16 low bits of the sequence
+ * number, [4] = flags, followed by the encoded report (at most
+ * MOVED_SIZE_COMPACT_MAX bytes in total). Reports published to the
+ * multicast group (see MOVED_MULTICAST_ENV) use this encoding.
+ **/
+#define MOVED_PUSH_COMPACT 0x85
+
+/**
+ * Capture time of a pushed report: the time at which moved received it
+ * from the device, in microseconds of moved's clock (see MOVED_REQ_TIME),
+ * as a 64-bit big endian value appended to the datagram. MOVED_PUSH_INPUT
+ * and MOVED_PUSH_STATE datagrams are MOVED_SIZE_TIMESTAMP bytes longer
+ * with it, MOVED_PUSH_COMPACT datagrams have MOVED_COMPACT_TIMESTAMP set
+ * in their flags. Datagrams published to the multicast group always carry
+ * it, as do the reports in shared memory (see moved_shm.h).
+ **/
+#define MOVED_SIZE_TIMESTAMP 8
+#define MOVED_COMPACT_TIMESTAMP 0x80
+
+/**
+ * The state of a device computed by moved (see MOVED_ORIENTATION_ENV), for
+ * clients that don't want to do calibration and sensor fusion themselves:
+ * [0] = MOVED_PUSH_STATE, [1] = device id, [2..5] = sequence number (same
+ * as for the input report), [6..9] = buttons (see psmove_get_buttons()),
+ * [10] = trigger, [11] = battery, [12] = flags (MOVED_STATE_*), followed
+ * by 10 IEEE 754 single precision floats: accelerometer X, Y, Z (in g),
+ * gyroscope X, Y, Z (in rad/s) and the orientation quaternion q0..q3 (see
+ * psmove_get_orientation()). All values are big endian.
+ **/
+#define MOVED_PUSH_STATE 0x87
+#define MOVED_STATE_CALIBRATED 0x01 /* Sensor values are calibrated */
+#define MOVED_STATE_ORIENTATION 0x02 /* The quaternion is valid */
+
+/**
+ * Read the new input reports of all devices in one round trip. The
+ * response is [0] = MOVED_READ_ALL_RESPONSE, [1] = number of entries,
+ * [2..3] = sequence number of the request (see MOVED_SIZE_RESPONSE_SEQ),
+ * followed by one entry of MOVED_SIZE_REPORT_ENTRY bytes for each device
+ * that has a new report (same layout as MOVED_PUSH_INPUT without its
+ * first byte: device id, sequence number, input report). At most
+ * MOVED_READ_ALL_MAX devices are included.
+ **/
+#define MOVED_REQ_READ_ALL 0x06
+#define MOVED_READ_ALL_RESPONSE 0x86
+#define MOVED_READ_ALL_MAX 16
+
+/**
+ * Like MOVED_REQ_WRITE, but acknowledged: the request is [0] =
+ * MOVED_REQ_WRITE_ACKED, [1] = device id, [2..8] = output (as for
+ * MOVED_REQ_WRITE), [9..10] = sequence number (MOVED_SIZE_WRITE_ACKED
+ * bytes). moved answers with [0] = MOVED_WRITE_ACK, [1] = device id,
+ * [2..3] = sequence number, [4] = 1 if the device exists, 0 otherwise
+ * (MOVED_SIZE_WRITE_ACK bytes). Clients resend the output until it has
+ * been acknowledged; older versions of moved never answer.
+ **/
+#define MOVED_REQ_WRITE_ACKED 0x08
+#define MOVED_WRITE_ACK 0x88
+
+/* Clients resend unacknowledged outputs after this time... */
+#define MOVED_WRITE_RESEND_MS 50
+
+/* ...at most this many times */
+#define MOVED_WRITE_ATTEMPTS 10
+
+/**
+ * Read moved's clock, NTP-style: the response is [0] = MOVED_TIME_RESPONSE,
+ * [1] = 0, [2..3] = sequence number of the request (see
+ * MOVED_SIZE_RESPONSE_SEQ), [4..11] = time at which moved received the
+ * request, [12..19] = time at which it sent the response (microseconds of
+ * psmove_util_get_ticks_us() on moved's host, 64-bit big endian). From
+ * these and its own send and receive times, the client computes the clock
+ * offset and the round-trip time.
+ **/
+#define MOVED_REQ_TIME 0x0A
+#define MOVED_TIME_RESPONSE 0x8A
+
+/**
+ * Get the health of moved and of one of its devices, for monitoring. The
+ * response is [0] = MOVED_STATS_RESPONSE, [1] = device id, [2..3] =
+ * sequence number of the request (see MOVED_SIZE_RESPONSE_SEQ), [4] = 1 if
+ * the device exists, 0 otherwise (then only the server-wide values are
+ * set), followed by MOVED_STATS_COUNT unsigned 32-bit values (big endian)
+ * indexed by MOVED_STATS_*. Rates are in 1/100 per second, latencies in
+ * microseconds.
+ **/
+#define MOVED_REQ_STATS 0x09
+#define MOVED_STATS_RESPONSE 0x89
+
+/* Server-wide values */
+#define MOVED_STATS_UPTIME_S 0 /* Seconds since moved was started */
+#define MOVED_STATS_REQUESTS 1 /* Requests received */
+#define MOVED_STATS_REQUEST_RATE 2 /* Requests per second (x100) */
+#define MOVED_STATS_CLIENTS 3 /* Clients that sent a request recently */
+#define MOVED_STATS_PENDING_OUTPUTS 4 /* Outputs not written to a device yet */
+#define MOVED_STATS_DEVICES 5 /* Connected devices */
+
+/* Values of the device */
+#define MOVED_STATS_REPORTS 6 /* Input reports read */
+#define MOVED_STATS_REPORT_RATE 7 /* Input reports per second (x100) */
+#define MOVED_STATS_LATENCY_P50 8 /* Read latency percentiles (see below) */
+#define MOVED_STATS_LATENCY_P95 9
+#define MOVED_STATS_LATENCY_P99 10
+#define MOVED_STATS_WRITES 11 /* Outputs written to the device */
+#define MOVED_STATS_COALESCED_WRITES 12 /* Outputs replaced before written */
+#define MOVED_STATS_DROPPED_REPORTS 13 /* Gaps in the report sequence numbers */
+#define MOVED_STATS_QUEUED_REPORTS 14 /* Reports read but not handled yet */
+#define MOVED_STATS_DEVICE_CLIENTS 15 /* Clients that used the device recently */
+#define MOVED_STATS_SUBSCRIBED 16 /* 1 if reports are pushed to a subscriber */
+
+#define MOVED_STATS_COUNT 17
+
+/**
+ * The read latency is the time from receiving an input report from the
+ * device to moved handing it out, over the last MOVED_STATS_LATENCY_SAMPLES
+ * reports. Clients count as connected for MOVED_SUBSCRIPTION_TIMEOUT_MS
+ * after their last request (clients of the multicast group and of the
+ * shared memory are not counted).
+ **/
+#define MOVED_STATS_LATENCY_SAMPLES 256
+
 #define MOVED_SIZE_REQUEST 9
+#define MOVED_SIZE_WRITE_ACKED 11
+#define MOVED_SIZE_WRITE_ACK 5
+#define MOVED_SIZE_TIME_RESPONSE 20
+#define MOVED_SIZE_STATS_HEADER 5
+#define MOVED_SIZE_STATS_RESPONSE (MOVED_SIZE_STATS_HEADER + \
+        MOVED_STATS_COUNT * 4)
 #define MOVED_SIZE_READ_RESPONSE 50
+#define MOVED_SIZE_INPUT (MOVED_SIZE_READ_RESPONSE - 1)
+#define MOVED_SIZE_PUSH_HEADER 6
+#define MOVED_SIZE_PUSH (MOVED_SIZE_PUSH_HEADER + MOVED_SIZE_INPUT)
+#define MOVED_SIZE_REPORT_ENTRY (MOVED_SIZE_PUSH - 1)
+#define MOVED_SIZE_READ_ALL_HEADER 4
+#define MOVED_SIZE_COMPACT_MAX (5 + MOVED_SIZE_INPUT)
+#define MOVED_SIZE_PUSH_STATE (13 + 10 * 4)
+
+/**
+ * Requests with a response (MOVED_REQ_COUNT_CONNECTED, MOVED_REQ_READ,
+ * MOVED_REQ_READ_ALL, MOVED_REQ_TIME and MOVED_REQ_STATS) carry a 16-bit sequence number (big endian) in their
+ * last two bytes. moved appends it to the response of MOVED_REQ_COUNT_CONNECTED
+ * and MOVED_REQ_READ (after MOVED_SIZE_READ_RESPONSE bytes), so clients can
+ * tell the response to their current request from late ones.
+ **/
+#define MOVED_SIZE_RESPONSE_SEQ 2
+#define MOVED_SIZE_READ_ALL_RESPONSE (MOVED_SIZE_READ_ALL_HEADER + \
+        MOVED_READ_ALL_MAX * MOVED_SIZE_REPORT_ENTRY)
+
+/* Clients wait this long for a MOVED_REQ_READ_ALL response */
+#define MOVED_READ_ALL_TIMEOUT_MS 500
+
+/* Subscriptions expire if not renewed within this time */
+#define MOVED_SUBSCRIPTION_TIMEOUT_MS 5000
+
+/* Clients renew their subscriptions this often */
+#define MOVED_SUBSCRIPTION_RENEW_MS 1000
 
 #define MOVED_HOSTS_LIST_FILE "moved_hosts.txt"
 
+/**
+ * Opt-in multicast fan-out: if this environment variable is set for moved,
+ * it publishes every input report of every device once as a
+ * MOVED_PUSH_COMPACT datagram to the multicast group; if it is set for a
+ * client, the client joins the group instead of subscribing. The value is
+ * the group address, or "1" for MOVED_MULTICAST_GROUP.
+ **/
+#define MOVED_MULTICAST_ENV "PSMOVE_MOVED_MULTICAST"
+
+/**
+ * If this environment variable is set to "1" for moved, it computes the
+ * orientation of all devices (see psmove_enable_orientation()), so that
+ * MOVED_PUSH_STATE datagrams carry it. Those are then also published to
+ * the multicast group, next to the input reports.
+ **/
+#define MOVED_ORIENTATION_ENV "PSMOVE_MOVED_ORIENTATION"
+
+/**
+ * If this environment variable is set to "0" for a client, it does not use
+ * the shared memory segment of a moved on the same host (see moved_shm.h),
+ * but receives the input reports over UDP like remote clients do (e.g. to
+ * compare both transports with the benchmark_io test program).
+ **/
+#define MOVED_SHM_ENV "PSMOVE_MOVED_SHM"
+#define MOVED_MULTICAST_GROUP "239.255.77.77"
+#define MOVED_MULTICAST_PORT 17778
+
 #endif
@@ -27,10 +27,16 @@
  * POSSIBILITY OF SUCH DAMAGE.
  **/
 
+/* This file has the exported versions of the PSMoveSample accessors */
+#define PSMOVE_NO_INLINE
+
 #include "psmove.h"
 #include "psmove_private.h"
 #include "psmove_calibration.h"
 #include "psmove_orientation.h"
+#include "psmove_aggregate.h"
+#include "psmove_recorder.h"
+#include "psmove_replay.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,11 +46,13 @@
 #include <wchar.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <time.h>
 #include <sys/stat.h>
 
 /* OS-specific includes, for getting the Bluetooth address */
 #ifdef __APPLE__
 #  include "platform/psmove_osxsupport.h"
+#  include <mach/mach_time.h>
 #  include <sys/syslimits.h>
 #  include <sys/stat.h>
 #endif
@@ -55,8 +63,18 @@
 #  include <sys/ioctl.h>
 #  include <linux/limits.h>
 #  include <pthread.h>
+#  include <semaphore.h>
 #  include <unistd.h>
-#  define PSMOVE_USE_PTHREADS
+#  include <poll.h>
+#  include <fcntl.h>
+#  include <errno.h>
+#  include <libudev.h>
+#  include <linux/hidraw.h>
+#endif
+
+/* The native hidraw backend is only available on Linux */
+#if defined(PSMOVE_USE_HIDRAW) && !defined(__linux)
+#  undef PSMOVE_USE_HIDRAW
 #endif
 
 #ifdef _WIN32
@@ -88,15 +106,42 @@
 /* Buffer size for the Bluetooth address set request */
 #define PSMOVE_BTADDR_SET_SIZE 23
 
-/* Maximum length of the serial string */
-#define PSMOVE_MAX_SERIAL_LENGTH 255
-
 /* Maximum milliseconds to inhibit further updates to LEDs if not changed */
 #define PSMOVE_MAX_LED_INHIBIT_MS 4000
 
 /* Minimum time (in milliseconds) between two LED updates (rate limiting) */
 #define PSMOVE_MIN_LED_UPDATE_WAIT_MS 120
 
+/* Adaptive LED policy: Minimum interval as a multiple of the write latency */
+#define PSMOVE_LED_ADAPTIVE_LATENCY_FACTOR 8
+
+/* Link quality: Time over which lost reports and the report rate are measured */
+#define PSMOVE_LINK_WINDOW_US 250000
+
+/* Link quality: Without reports for this long, the link is considered down */
+#define PSMOVE_LINK_TIMEOUT_US 1000000
+
+/* Link-adaptive LED policy: Fraction of lost reports that is tolerated */
+#define PSMOVE_LINK_LOSS_THRESHOLD 0.05f
+
+/* Link-adaptive LED policy: Interval increase per fraction of lost reports */
+#define PSMOVE_LINK_THROTTLE_FACTOR 40
+
+/* Maximum number of threads used by psmove_connect_all() */
+#define PSMOVE_CONNECT_WORKERS 8
+
+/* Maximum age (in milliseconds) of the device list without hotplug events */
+#define PSMOVE_DEVICE_LIST_MAX_AGE_MS 1000
+
+/* Number of button transitions queued per device (must be power of 2) */
+#define PSMOVE_BUTTON_EVENT_QUEUE_SIZE 64
+
+/* Number of input reports buffered by the input reader (must be power of 2) */
+#define PSMOVE_INPUT_RING_SIZE 64
+
+/* Timeout (in milliseconds) for a single read in the input reader thread */
+#define PSMOVE_INPUT_READ_TIMEOUT_MS 100
+
 enum PSMove_Request_Type {
     PSMove_Req_GetInput = 0x01,
     PSMove_Req_SetLEDs = 0x02,
@@ -108,6 +153,8 @@ enum PSMove_Request_Type {
 enum PSMove_Device_Type {
     PSMove_HIDAPI = 0x01,
     PSMove_MOVED = 0x02,
+    PSMove_HIDRAW = 0x03,
+    PSMove_REPLAY = 0x04,
 };
 
 enum PSMove_Sensor {
@@ -126,6 +173,33 @@ typedef struct {
     unsigned char _padding[PSMOVE_BUFFER_SIZE-7]; /* must be zero */
 } PSMove_Data_LEDs;
 
+/* An LED/rumble animation played by the LED writer thread */
+typedef struct {
+    PSMoveKeyframe *keyframes;
+    int count;
+    int loops;
+
+    /* Sum of the keyframe durations */
+    long duration_ms;
+
+    /* Time at which the animation was started */
+    long started_ms;
+
+    /* LED state at the start (faded from in the first keyframe) */
+    unsigned char r, g, b;
+
+    /* The next frame to be written, valid if pending is set */
+    PSMove_Data_LEDs leds;
+    int pending;
+
+    /* Earliest time for the next frame and time of the last write */
+    long next_frame_ms;
+    long last_write_ms;
+
+    /* Set once the final frame has been computed */
+    int done;
+} PSMove_Animation;
+
 /* Decode 12-bit signed value (assuming two's complement) */
 #define TWELVE_BIT_SIGNED(x) (((x) & 0x800)?(-(((~(x)) & 0xFFF) + 1)):(x))
 
@@ -188,6 +262,12 @@ typedef struct {
     unsigned char _padding[PSMOVE_BUFFER_SIZE-44]; /* unknown */
 } PSMove_Data_Input;
 
+/* One report in the input ring, with its host receive time */
+typedef struct {
+    PSMove_Data_Input input;
+    long long time_us;
+} PSMove_Input_Ring_Entry;
+
 struct _PSMove {
     /* Device type (hidapi-based or moved-based */
     enum PSMove_Device_Type type;
@@ -195,10 +275,20 @@ struct _PSMove {
     /* The handle to the HIDAPI device */
     hid_device *handle;
 
+    /* The file descriptor of the hidraw device (PSMove_HIDRAW) */
+    int fd;
+
     /* The handle to the moved client */
     moved_client *client;
     int remote_id;
 
+    /* Reports pushed by moved (see MOVED_REQ_SUBSCRIBE) */
+    long moved_subscribed_ms; /* When the first subscription was sent */
+    int moved_polling; /* Nonzero if moved does not push reports */
+
+    /* The recording played back by a PSMove_REPLAY device */
+    PSMoveReplay *replay;
+
     /* Index (at connection time) - not exposed yet */
     int id;
 
@@ -218,21 +308,121 @@ struct _PSMove {
     /* Milliseconds timestamp of last LEDs update (psmove_util_get_ticks) */
     long last_leds_update;
 
+    /* LED update policy (see psmove_set_led_policy) */
+    int led_min_interval_ms;
+    int led_keepalive_ms;
+    enum PSMove_Bool led_adaptive;
+    enum PSMove_Bool led_link_adaptive;
+
+    /* Moving average of the LED write latency (microseconds) */
+    int led_write_latency_us;
+
     /* Previous values of buttons (psmove_get_button_events) */
     int last_buttons;
 
+    /**
+     * Button transitions found while decoding input reports, drained by
+     * psmove_get_button_event(). When the queue is full, the oldest event
+     * is dropped. event_buttons holds the buttons of the previous report.
+     **/
+    PSMoveButtonEvent button_events[PSMOVE_BUTTON_EVENT_QUEUE_SIZE];
+    unsigned int button_events_head;
+    unsigned int button_events_tail;
+    unsigned int event_buttons;
+
+    /* Hardware timestamp of the previous report, and ticks between reports */
+    int last_timestamp;
+    int timestamp_delta;
+
+    /* Host time (in microseconds) at which the current report was received */
+    long long input_time_us;
+
+    /* Report statistics (psmove_get_stats) */
+    int last_seq;
+    long long last_input_time_us;
+    unsigned long stats_reports;
+    unsigned long stats_sequence_gaps;
+    unsigned long stats_dropped_reports;
+    unsigned long stats_duplicate_reports;
+    unsigned long stats_empty_polls;
+    long long stats_interval_sum_us;
+    long long stats_interval_min_us;
+    long long stats_interval_max_us;
+
+    /**
+     * Link quality (psmove_get_link_quality), measured where the reports
+     * arrive (in the input thread if enabled, in psmove_poll() otherwise):
+     * Lost reports and the report rate are counted over windows of
+     * PSMOVE_LINK_WINDOW_US. link_loss (moving average of the fraction of
+     * lost reports) and link_rate are read from other threads.
+     **/
+    int link_seq;
+    long long link_last_us;
+    long long link_window_start_us;
+    int link_window_reports;
+    int link_window_lost;
+    float link_loss;
+    float link_rate;
+
     PSMoveCalibration *calibration;
     PSMoveOrientation *orientation;
 
+    /**
+     * Summaries of the reports (see psmove_set_aggregation), created on
+     * first use and kept until the handle is closed, so the input thread
+     * can use it without a lock on the handle.
+     **/
+    PSMoveAggregator *aggregator;
+
     /* Is orientation tracking currently enabled? */
     enum PSMove_Bool orientation_enabled;
 
+    /**
+     * Device number in the current recording (see psmove_start_recording),
+     * only valid if record_epoch matches psmove_recorder_epoch
+     **/
+    int record_device;
+    int record_epoch;
+
 #ifdef PSMOVE_USE_PTHREADS
-    /* Write thread for updating LEDs in the background */
-    pthread_t led_write_thread;
-    pthread_mutex_t led_write_mutex;
-    pthread_cond_t led_write_new_data;
-    unsigned char led_write_thread_write_queued;
+    /**
+     * LED/rumble state handed over to the shared LED writer thread,
+     * protected by a sequence lock (led_write_seq is odd while
+     * psmove_update_leds() is copying into led_write_leds), so that
+     * neither side has to take a lock. led_write_queued is set by
+     * psmove_update_leds() and cleared by the writer thread (atomically).
+     **/
+    PSMove_Data_LEDs led_write_leds;
+    unsigned int led_write_seq;
+    unsigned char led_write_queued;
+
+    /* Round of the LED writer in which this device was last written */
+    unsigned long led_write_round;
+
+    /* Next device served by the LED writer thread */
+    PSMove *led_write_next;
+
+    /**
+     * Animation played by the LED writer thread (NULL if none), protected
+     * by psmove_led_writer_mutex. led_animation_ended is set by the writer
+     * thread when an animation has finished, so that psmove_update_leds()
+     * can restore the LED state set by the application.
+     **/
+    PSMove_Animation *led_animation;
+    unsigned char led_animation_ended;
+
+    /**
+     * Read thread for receiving input reports in the background. Reports
+     * are passed to psmove_poll() via a single-producer, single-consumer
+     * ring buffer: The read thread only ever writes input_ring_head, and
+     * psmove_poll() only ever writes input_ring_tail. The ring is only
+     * allocated while the read thread is enabled.
+     **/
+    pthread_t input_read_thread;
+    enum PSMove_Bool input_read_thread_running;
+    PSMove_Input_Ring_Entry *input_ring;
+    unsigned int input_ring_head;
+    unsigned int input_ring_tail;
 #endif
 
 #ifdef _WIN32
@@ -241,6 +431,12 @@ struct _PSMove {
 #endif
 };
 
+/* A locally-connected controller, as found by hid_enumerate() */
+typedef struct {
+    char *path;
+    wchar_t *serial_number;
+} PSMove_Device_Info;
+
 /* End private definitions */
 
 static moved_client_list *clients;
@@ -250,833 +446,3011 @@ static int psmove_remote_disabled = 0;
 /* Number of valid, open PSMove* handles "in the wild" */
 static int psmove_num_open_handles = 0;
 
-/* Private functionality needed by the Linux version */
+/**
+ * Recorder for input reports of all controllers (NULL if not recording).
+ * The epoch is incremented for every new recording, so that each
+ * controller announces itself again in the new file.
+ **/
+static PSMoveRecorder *psmove_recorder = NULL;
+static int psmove_recorder_epoch = 0;
+static int psmove_recorder_devices = 0;
+
+/**
+ * Cached result of hid_enumerate(), so that counting and connecting N
+ * controllers doesn't walk the HID device tree N times. On Linux, the list
+ * is refreshed when udev reports that a hidraw device was added or removed.
+ * On other systems, the list is refreshed when it gets too old.
+ **/
+static PSMove_Device_Info *psmove_devices = NULL;
+static int psmove_devices_count = 0;
+static int psmove_devices_valid = 0;
+static long psmove_devices_updated = 0;
+
 #if defined(__linux)
+static struct udev *psmove_udev = NULL;
+static struct udev_monitor *psmove_udev_monitor = NULL;
+#endif
 
-int _psmove_linux_bt_dev_info(int s, int dev_id, long arg)
-{
-    struct hci_dev_info di = { dev_id: dev_id };
-    unsigned char *btaddr = (void*)arg;
-    int i;
+/* A hotplug event, queued until the devices lock has been released */
+typedef struct {
+    enum PSMove_Hotplug_Event event;
+    char *serial;
+    enum PSMove_Connection_Type type;
+} PSMove_Hotplug_Pending;
 
-    if (ioctl(s, HCIGETDEVINFO, (void *) &di) == 0) {
-        for (i=0; i<6; i++) {
-            btaddr[i] = di.bdaddr.b[5-i];
-        }
-    }
+/* Hotplug callback and events not yet delivered to it */
+static psmove_hotplug_callback psmove_hotplug_func = NULL;
+static void *psmove_hotplug_user_data = NULL;
+static PSMove_Hotplug_Pending *psmove_hotplug_pending = NULL;
+static int psmove_hotplug_pending_count = 0;
 
-    return 0;
-}
+#if defined(PSMOVE_USE_PTHREADS)
+/* Protects the cached device list and the hotplug state */
+static pthread_mutex_t psmove_devices_mutex = PTHREAD_MUTEX_INITIALIZER;
 
-#endif /* defined(__linux) */
+/* Background thread delivering hotplug events as soon as udev reports them */
+static pthread_t psmove_hotplug_thread;
+static int psmove_hotplug_thread_running = 0;
+
+/**
+ * Shared wakeup for all input read threads: Each thread increments
+ * psmove_input_generation and broadcasts psmove_input_cond whenever it
+ * has queued a new report, so psmove_poll_all() can sleep on a single
+ * condition variable for any number of controllers.
+ **/
+static pthread_mutex_t psmove_input_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t psmove_input_cond = PTHREAD_COND_INITIALIZER;
+static unsigned long psmove_input_generation = 0;
 
+/**
+ * One LED writer thread is shared by all locally-connected controllers.
+ * psmove_update_leds() queues the latest LED/rumble state of a device and
+ * wakes up the writer via psmove_led_writer_sem, which writes out queued
+ * devices round-robin (every queued device is written once per round, so
+ * one busy controller can't starve the others). Newer updates replace
+ * not-yet-written ones.
+ *
+ * The mutex protects the device list and psmove_led_writer_current only,
+ * it is never taken by psmove_update_leds().
+ **/
+static pthread_mutex_t psmove_led_writer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t psmove_led_writer_cond = PTHREAD_COND_INITIALIZER;
+static sem_t psmove_led_writer_sem;
+static pthread_t psmove_led_writer_thread;
+static PSMove *psmove_led_writer_devices = NULL;
+static PSMove *psmove_led_writer_current = NULL;
+static unsigned long psmove_led_writer_round = 0;
+static int psmove_led_writer_running = 0;
 
-#if defined(PSMOVE_USE_PTHREADS)
+/**
+ * Set while the last device is removed and the writer thread is joined
+ * (outside of the mutex), so that a new device waits for the old thread
+ * to finish before the semaphore and thread handle are reused
+ **/
+static int psmove_led_writer_stopping = 0;
+#endif
 
-void *
-_psmove_led_write_thread_proc(void *data)
+/* Set the default LED update policy for a new device */
+static void
+_psmove_led_policy_init(PSMove *move)
 {
-    PSMove *move = (PSMove*)data;
-    PSMove_Data_LEDs leds;
+    move->led_min_interval_ms = PSMOVE_MIN_LED_UPDATE_WAIT_MS;
+    move->led_keepalive_ms = PSMOVE_MAX_LED_INHIBIT_MS;
+    move->led_adaptive = PSMove_False;
+    move->led_link_adaptive = PSMove_True;
+    move->led_write_latency_us = 0;
+}
 
-    while (1) {
-        pthread_mutex_lock(&(move->led_write_mutex));
-        pthread_cond_wait(&(move->led_write_new_data),
-                &(move->led_write_mutex));
-        pthread_mutex_unlock(&(move->led_write_mutex));
+/* Fraction of input reports recently lost (0 if the link is down or unknown) */
+static float
+_psmove_link_loss(PSMove *move)
+{
+    long long last_us = __atomic_load_n(&(move->link_last_us), __ATOMIC_RELAXED);
+    float loss;
 
-        if (!move->led_write_thread_write_queued) {
-            break;
-        }
+    if (last_us == 0 || psmove_util_get_ticks_us() - last_us >
+            PSMOVE_LINK_TIMEOUT_US) {
+        return 0.f;
+    }
 
-        do {
-            /* Create a local copy of the LED state */
-            memcpy(&leds, &(move->leds), sizeof(leds));
-            move->led_write_thread_write_queued = 0;
+    __atomic_load(&(move->link_loss), &loss, __ATOMIC_RELAXED);
+    return loss;
+}
 
-            long started = psmove_util_get_ticks();
+/* Should LED updates be held back in favor of the input reports? */
+static int
+_psmove_link_congested(PSMove *move)
+{
+    return move->led_link_adaptive &&
+        _psmove_link_loss(move) > PSMOVE_LINK_LOSS_THRESHOLD;
+}
 
-#if defined(__linux)
-            /* Don't write padding bytes on Linux (makes it faster) */
-            hid_write(move->handle, (unsigned char*)(&leds),
-                    sizeof(leds) - sizeof(leds._padding));
-#else
-            hid_write(move->handle, (unsigned char*)(&leds),
-                    sizeof(leds));
-#endif
+/* Effective minimum interval between LED updates (policy + adaptation) */
+static long
+_psmove_led_min_interval(PSMove *move)
+{
+    long interval = move->led_min_interval_ms;
+    int adapted = 0;
 
-#ifdef PSMOVE_DEBUG
-            fprintf(stderr, "hid_write(%d) = %ld ms\n",
-                    move->id,
-                    psmove_util_get_ticks() - started);
-#endif
+    if (move->led_adaptive) {
+        long latency = __atomic_load_n(&(move->led_write_latency_us),
+                __ATOMIC_RELAXED);
+        long adaptive = PSMOVE_LED_ADAPTIVE_LATENCY_FACTOR * latency / 1000;
 
-            pthread_yield();
-        } while (memcmp(&leds, &(move->leds), sizeof(leds)) != 0);
+        if (adaptive > interval) {
+            interval = adaptive;
+        }
+        adapted = 1;
     }
-}
 
-#endif /* defined(PSMOVE_USE_PTHREADS) */
+    if (_psmove_link_congested(move)) {
+        long base = move->led_min_interval_ms;
+        if (base < PSMOVE_MIN_LED_UPDATE_WAIT_MS) {
+            base = PSMOVE_MIN_LED_UPDATE_WAIT_MS;
+        }
 
+        long throttled = base * (1.f + PSMOVE_LINK_THROTTLE_FACTOR *
+                (_psmove_link_loss(move) - PSMOVE_LINK_LOSS_THRESHOLD));
+        if (throttled > interval) {
+            interval = throttled;
+        }
+        adapted = 1;
+    }
 
+    if (adapted && interval > move->led_keepalive_ms) {
+        interval = move->led_keepalive_ms;
+    }
 
-/* Previously public functions, now private: */
+    return interval;
+}
 
 /**
- * Get a half-frame from the accelerometer or gyroscope from the
- * PS Move after using psmove_poll() previously.
- *
- * sensor must be Sensor_Accelerometer or Sensor_Accelerometer.
- *
- * frame must be Frame_FirstHalf or Frame_SecondHalf.
- *
- * x, y and z can point to integer locations that will be filled
- * with the readings. If any are NULL, the fields will be ignored.
+ * Account for a report with sequence number seq that arrived at time_us
+ * (see psmove_get_link_quality). Only called by the thread reading the
+ * reports from the device.
  **/
-void
-psmove_get_half_frame(PSMove *move, enum PSMove_Sensor sensor,
-        enum PSMove_Frame frame, int *x, int *y, int *z);
+static void
+_psmove_link_update(PSMove *move, int seq, long long time_us)
+{
+    if (move->link_last_us == 0 ||
+            time_us - move->link_last_us > PSMOVE_LINK_TIMEOUT_US) {
+        /* First report (or the link was down) - start measuring from here */
+        move->link_window_start_us = time_us;
+        move->link_window_reports = 0;
+        move->link_window_lost = 0;
+    } else if (seq == move->link_seq) {
+        /* Duplicate report */
+        return;
+    } else {
+        move->link_window_lost += (seq - move->link_seq - 1) & 0x0F;
+        move->link_window_reports++;
+    }
 
-/**
- * Set the Host Bluetooth address that is used to connect via
- * Bluetooth. You should set this to the local computer's
- * Bluetooth address when connected via USB, then disconnect
- * and press the PS button to connect the controller via BT.
- **/
-int
-psmove_set_btaddr(PSMove *move, PSMove_Data_BTAddr *addr);
+    move->link_seq = seq;
+    __atomic_store_n(&(move->link_last_us), time_us, __ATOMIC_RELAXED);
 
+    long long elapsed_us = time_us - move->link_window_start_us;
+    if (elapsed_us >= PSMOVE_LINK_WINDOW_US && move->link_window_reports > 0) {
+        float loss = (float)move->link_window_lost /
+            (float)(move->link_window_reports + move->link_window_lost);
+        float rate = 1000000.f * move->link_window_reports / (float)elapsed_us;
 
-/* Start implementation of the API */
+        /* Moving average over windows, so a single burst doesn't count much */
+        loss = 0.5f * (move->link_loss + loss);
 
+        __atomic_store(&(move->link_loss), &loss, __ATOMIC_RELAXED);
+        __atomic_store(&(move->link_rate), &rate, __ATOMIC_RELAXED);
 
-void
-_psmove_disable_remote()
-{
-    psmove_remote_disabled = 1;
+        move->link_window_start_us = time_us;
+        move->link_window_reports = 0;
+        move->link_window_lost = 0;
+    }
 }
 
-void
-_psmove_disable_local()
+/* Update the moving average of the LED write latency */
+static void
+_psmove_led_record_latency(PSMove *move, long long latency_us)
 {
-    psmove_local_disabled = 1;
+    int average = __atomic_load_n(&(move->led_write_latency_us),
+            __ATOMIC_RELAXED);
+
+    /* Exponential moving average with alpha = 1/8 */
+    average += (int)((latency_us - average) / 8);
+    __atomic_store_n(&(move->led_write_latency_us), average, __ATOMIC_RELAXED);
 }
 
-void
-_psmove_write_data(PSMove *move, unsigned char *data, int length)
+/* Is this a locally-connected device (hidapi or hidraw)? */
+#define PSMOVE_IS_LOCAL(move) \
+    ((move)->type == PSMove_HIDAPI || (move)->type == PSMove_HIDRAW)
+
+/**
+ * Low-level I/O for locally-connected devices: These dispatch to hidapi
+ * or to the hidraw device node, depending on the device type. The return
+ * values are the same as for the corresponding hidapi functions.
+ **/
+
+static int
+_psmove_device_read(PSMove *move, unsigned char *data, size_t length,
+        int timeout_ms)
 {
-    if (memcmp(&(move->leds), data, length) != 0) {
-        memcpy(&(move->leds), data, length);
-        move->leds_dirty = 1;
+#if defined(PSMOVE_USE_HIDRAW)
+    if (move->type == PSMove_HIDRAW) {
+        int res;
+
+        if (timeout_ms != 0) {
+            struct pollfd pfd;
+            pfd.fd = move->fd;
+            pfd.events = POLLIN;
+            if (poll(&pfd, 1, timeout_ms) <= 0) {
+                return 0;
+            }
+        }
+
+        res = read(move->fd, data, length);
+        if (res < 0 && (errno == EAGAIN || errno == EINPROGRESS)) {
+            return 0;
+        }
+        return res;
     }
-    psmove_update_leds(move);
-}
+#endif
 
-void
-_psmove_read_data(PSMove *move, unsigned char *data, int length)
-{
-    assert(data != NULL);
-    assert(length >= (sizeof(move->input) + 1));
+    if (timeout_ms == 0) {
+        return hid_read(move->handle, data, length);
+    }
 
-    data[0] = psmove_poll(move);
-    memcpy(data+1, &(move->input), sizeof(move->input));
+    return hid_read_timeout(move->handle, data, length, timeout_ms);
 }
 
-enum PSMove_Bool
-psmove_is_remote(PSMove *move)
+static int
+_psmove_device_write(PSMove *move, const unsigned char *data, size_t length)
 {
-    return move->type == PSMove_MOVED;
+    if (move->type == PSMove_REPLAY) {
+        /* Output reports of replayed devices are discarded */
+        return length;
+    }
+
+#if defined(PSMOVE_USE_HIDRAW)
+    if (move->type == PSMove_HIDRAW) {
+        return write(move->fd, data, length);
+    }
+#endif
+
+    return hid_write(move->handle, data, length);
 }
 
-void
-psmove_reinit()
+static int
+_psmove_device_get_feature_report(PSMove *move, unsigned char *data,
+        size_t length)
 {
-    if (psmove_num_open_handles != 0) {
-        psmove_CRITICAL("reinit called with open handles "
-                "(forgot psmove_disconnect?)");
-        exit(0);
+    if (move->type == PSMove_REPLAY) {
+        return -1;
     }
 
-    if (clients != NULL) {
-        moved_client_list_destroy(clients);
-        clients = NULL;
+#if defined(PSMOVE_USE_HIDRAW)
+    if (move->type == PSMove_HIDRAW) {
+        return ioctl(move->fd, HIDIOCGFEATURE(length), data);
     }
+#endif
 
-    hid_exit();
+    return hid_get_feature_report(move->handle, data, length);
 }
 
-int
-psmove_count_connected_hidapi()
+static int
+_psmove_device_send_feature_report(PSMove *move, const unsigned char *data,
+        size_t length)
 {
-    struct hid_device_info *devs, *cur_dev;
-    int count = 0;
-
-    if (psmove_local_disabled) {
-        return 0;
+    if (move->type == PSMove_REPLAY) {
+        return -1;
     }
 
-    devs = hid_enumerate(PSMOVE_VID, PSMOVE_PID);
-    cur_dev = devs;
-    while (cur_dev) {
-#ifdef _WIN32
-        /**
-         * Windows Quirk: Ignore extraneous devices (each dev is enumerated
-         * 3 times, count only the one with "&col02#" in the path)
-         *
-         * We use col02 for enumeration, and col01 for connecting. We want to
-         * have col02 here, because after connecting to col01, it disappears.
-         **/
-        if (strstr(cur_dev->path, "&col02#") == NULL) {
-            count--;
-        }
-#endif
-        count++;
-        cur_dev = cur_dev->next;
+#if defined(PSMOVE_USE_HIDRAW)
+    if (move->type == PSMove_HIDRAW) {
+        return ioctl(move->fd, HIDIOCSFEATURE(length), data);
     }
-    hid_free_enumeration(devs);
+#endif
 
-    return count;
+    return hid_send_feature_report(move->handle, data, length);
 }
 
-int
-psmove_count_connected_moved(moved_client *client)
-{
-    psmove_return_val_if_fail(client != NULL, 0);
-    return moved_client_send(client, MOVED_REQ_COUNT_CONNECTED, 0, NULL);
-}
+/* Private functionality needed by the Linux version */
+#if defined(__linux)
 
-int
-psmove_count_connected()
+int _psmove_linux_bt_dev_info(int s, int dev_id, long arg)
 {
-    int count = psmove_count_connected_hidapi();
+    struct hci_dev_info di = { dev_id: dev_id };
+    unsigned char *btaddr = (void*)arg;
+    int i;
 
-    if (clients == NULL && !psmove_remote_disabled) {
-        clients = moved_client_list_open();
+    if (ioctl(s, HCIGETDEVINFO, (void *) &di) == 0) {
+        for (i=0; i<6; i++) {
+            btaddr[i] = di.bdaddr.b[5-i];
+        }
     }
 
-    moved_client_list *cur;
-    for (cur=clients; cur != NULL; cur=cur->next) {
-        count += psmove_count_connected_moved(cur->client);
+    return 0;
+}
+
+/* Collects the addresses of all adapters, see _psmove_get_host_btaddrs() */
+typedef struct {
+    PSMove_Data_BTAddr *addrs;
+    int count;
+    int max;
+} PSMove_Linux_BT_Dev_List;
+
+int _psmove_linux_bt_dev_list(int s, int dev_id, long arg)
+{
+    PSMove_Linux_BT_Dev_List *list = (void*)arg;
+
+    if (list->count < list->max) {
+        _psmove_linux_bt_dev_info(s, dev_id, (long)(list->addrs[list->count]));
+        list->count++;
     }
 
-    return count;
+    return 0;
 }
 
-PSMove *
-psmove_connect_internal(wchar_t *serial, char *path, int id)
-{
-    char *tmp;
+#endif /* defined(__linux) */
 
-    PSMove *move = (PSMove*)calloc(1, sizeof(PSMove));
-    move->type = PSMove_HIDAPI;
 
-    /* Make sure the first LEDs update will go through (+ init get_ticks) */
-    move->last_leds_update = psmove_util_get_ticks() - PSMOVE_MAX_LED_INHIBIT_MS;
+/* Get the values of an input report used by the orientation filters */
+static void
+_psmove_get_orientation_sample(PSMove *move, PSMove_Data_Input *input,
+        long long time_us, PSMoveOrientationSample *sample)
+{
+    sample->timestamp = ((input->timehigh << 8) | input->timelow);
+    sample->time_us = time_us;
+    psmove_calibration_map_sensors(move->calibration,
+            (unsigned char*)&(input->aXlow), sample->sensors);
+}
 
-#ifdef _WIN32
-    /* Windows Quirk: USB devices have "0" as serial, BT devices their addr */
-    if (wcslen(serial) > 1) {
-        move->is_bluetooth = 1;
-    }
-    /* Windows Quirk: Use path instead of serial number by ignoring serial */
-    serial = NULL;
+/* The button bitmask of an input report (see psmove_get_buttons) */
+static unsigned int
+_psmove_input_buttons(const PSMove_Data_Input *input)
+{
+    return ((input->buttons2) |
+            (input->buttons1 << 8) |
+            ((input->buttons3 & 0x01) << 16) |
+            ((input->buttons4 & 0xF0) << 13));
+}
 
-    /* XXX Ugly: Convert "col02" path to "col01" path (tested w/ BT and USB) */
-    char *p;
-    psmove_return_val_if_fail((p = strstr(path, "&col02#")) != NULL, NULL);
-    p[5] = '1';
-    psmove_return_val_if_fail((p = strstr(path, "&0001#")) != NULL, NULL);
-    p[4] = '0';
-#endif
+/**
+ * Add an input report to the aggregation windows. sensors are the
+ * calibrated values if they have been computed already (or NULL).
+ **/
+static void
+_psmove_aggregate_input(PSMove *move, PSMove_Data_Input *input,
+        long long time_us, const float *sensors)
+{
+    PSMoveAggregator *aggregator = __atomic_load_n(&(move->aggregator),
+            __ATOMIC_ACQUIRE);
+    float values[PSMOVE_SENSOR_VALUES];
+    unsigned char *raw = (unsigned char*)&(input->aXlow);
+    int i;
 
-    if (serial == NULL && path != NULL) {
-        move->handle = hid_open_path(path);
-    } else {
-        move->handle = hid_open(PSMOVE_VID, PSMOVE_PID, serial);
+    if (aggregator == NULL || !psmove_aggregator_enabled(aggregator)) {
+        return;
     }
 
-    if (!move->handle) {
-        free(move);
-        return NULL;
+    if (sensors == NULL) {
+        if (psmove_aggregator_calibrated(aggregator)) {
+            psmove_calibration_map_sensors(move->calibration, raw, values);
+        } else {
+            /* Raw readings: little-endian 16-bit values, biased by 0x8000 */
+            for (i=0; i<PSMOVE_SENSOR_VALUES; i++) {
+                values[i] = (float)((raw[2*i] | (raw[2*i+1] << 8)) - 0x8000);
+            }
+        }
+        sensors = values;
     }
 
-    /* Use Non-Blocking I/O */
-    hid_set_nonblocking(move->handle, 1);
-
-    /* Message type for LED set requests */
-    move->leds.type = PSMove_Req_SetLEDs;
+    psmove_aggregator_add(aggregator, sensors,
+            (input->trigger + input->trigger2) / 2,
+            _psmove_input_buttons(input), time_us);
+}
 
-    /* Remember the ID/index */
-    move->id = id;
+#if defined(PSMOVE_USE_PTHREADS)
 
-    /* Remember the serial number */
-    move->serial_number = (char*)calloc(PSMOVE_MAX_SERIAL_LENGTH, sizeof(char));
-    if (serial != NULL) {
-        wcstombs(move->serial_number, serial, PSMOVE_MAX_SERIAL_LENGTH);
+static void
+_psmove_animation_free(PSMove_Animation *animation)
+{
+    if (animation != NULL) {
+        free(animation->keyframes);
+        free(animation);
     }
+}
 
-    /**
-     * Normalize "aa-bb-cc-dd-ee-ff" (OS X format) into "aa:bb:cc:dd:ee:ff"
-     * Also normalize "AA:BB:CC:DD:EE:FF" into "aa:bb:cc:dd:ee:ff" (lowercase)
-     **/
-    tmp = move->serial_number;
-    while (*tmp != '\0') {
-        if (*tmp == '-') {
-            *tmp = ':';
-        }
-
-        *tmp = tolower(*tmp);
-        tmp++;
+/* Linear interpolation between two color components */
+static unsigned char
+_psmove_animation_mix(unsigned char from, unsigned char to,
+        long elapsed_ms, long duration_ms)
+{
+    if (elapsed_ms >= duration_ms) {
+        return to;
     }
 
-#if defined(PSMOVE_USE_PTHREADS)
-    psmove_return_val_if_fail(pthread_mutex_init(&move->led_write_mutex,
-                NULL) == 0, NULL);
-    psmove_return_val_if_fail(pthread_cond_init(&move->led_write_new_data,
-                NULL) == 0, NULL);
-    psmove_return_val_if_fail(pthread_create(&move->led_write_thread,
-            NULL,
-            _psmove_led_write_thread_proc,
-            (void*)move) == 0, NULL);
-#endif
-
-    /* Bookkeeping of open handles (for psmove_reinit) */
-    psmove_num_open_handles++;
-
-    return move;
+    return (unsigned char)(from + ((int)to - (int)from) *
+            elapsed_ms / duration_ms);
 }
 
-PSMove *
-psmove_connect_remote_by_id(int id, moved_client *client, int remote_id)
+/* Compute the frame of animation at time now_ms into animation->leds */
+static void
+_psmove_animation_frame(PSMove_Animation *animation, long now_ms)
 {
-    PSMove *move = (PSMove*)calloc(1, sizeof(PSMove));
-    move->type = PSMove_MOVED;
-
-    move->client = client;
-    move->remote_id = remote_id;
-
-    /* Message type for LED set requests */
-    move->leds.type = PSMove_Req_SetLEDs;
+    long elapsed_ms = now_ms - animation->started_ms;
+    unsigned char r = animation->r;
+    unsigned char g = animation->g;
+    unsigned char b = animation->b;
+    int i;
 
-    /* Remember the ID/index */
-    move->id = id;
+    if (animation->duration_ms == 0 || (animation->loops > 0 &&
+                elapsed_ms >= animation->duration_ms * animation->loops)) {
+        /* Finished - hold the last keyframe */
+        PSMoveKeyframe *last = &(animation->keyframes[animation->count-1]);
+        animation->leds.r = last->r;
+        animation->leds.g = last->g;
+        animation->leds.b = last->b;
+        animation->leds.rumble = last->rumble;
+        animation->done = 1;
+        return;
+    }
 
-    /* Remember the serial number */
-    move->serial_number = (char*)calloc(PSMOVE_MAX_SERIAL_LENGTH, sizeof(char));
-    snprintf(move->serial_number, PSMOVE_MAX_SERIAL_LENGTH, "%s:%d",
-            client->hostname, remote_id);
+    if (elapsed_ms >= animation->duration_ms) {
+        /* From the second loop on, fade from the last keyframe */
+        PSMoveKeyframe *last = &(animation->keyframes[animation->count-1]);
+        r = last->r;
+        g = last->g;
+        b = last->b;
+        elapsed_ms %= animation->duration_ms;
+    }
 
-    /* Bookkeeping of open handles (for psmove_reinit) */
-    psmove_num_open_handles++;
+    for (i=0; i<animation->count; i++) {
+        PSMoveKeyframe *keyframe = &(animation->keyframes[i]);
+
+        if (elapsed_ms < keyframe->duration_ms) {
+            animation->leds.r = _psmove_animation_mix(r, keyframe->r,
+                    elapsed_ms, keyframe->duration_ms);
+            animation->leds.g = _psmove_animation_mix(g, keyframe->g,
+                    elapsed_ms, keyframe->duration_ms);
+            animation->leds.b = _psmove_animation_mix(b, keyframe->b,
+                    elapsed_ms, keyframe->duration_ms);
+            animation->leds.rumble = keyframe->rumble;
+            return;
+        }
 
-    return move;
+        elapsed_ms -= keyframe->duration_ms;
+        r = keyframe->r;
+        g = keyframe->g;
+        b = keyframe->b;
+    }
 }
 
-PSMove *
-psmove_connect_by_id(int id)
+/**
+ * Advance all animations, queueing frames that are due (only frames that
+ * differ from the last written one, or keepalive frames). Returns the
+ * number of milliseconds until the next frame is due, or -1 if no
+ * animations are playing. psmove_led_writer_mutex must be held.
+ **/
+static long
+_psmove_led_writer_animate()
 {
-    int hidapi_count = psmove_count_connected_hidapi();
+    PSMove *cur;
+    PSMove_Animation *animation;
+    long now = psmove_util_get_ticks();
+    long timeout = -1;
+    PSMove_Data_LEDs previous;
+
+    for (cur=psmove_led_writer_devices; cur != NULL; cur=cur->led_write_next) {
+        animation = cur->led_animation;
+        if (animation == NULL) {
+            continue;
+        }
 
-    if (id >= hidapi_count) {
-        /* XXX: check remote controllers */
-        if (clients == NULL && !psmove_remote_disabled) {
-            clients = moved_client_list_open();
+        if (animation->done && !animation->pending) {
+            /* Final frame has been written */
+            _psmove_animation_free(animation);
+            cur->led_animation = NULL;
+            __atomic_store_n(&(cur->led_animation_ended), 1, __ATOMIC_RELEASE);
+            continue;
         }
 
-        int offset = hidapi_count;
+        if (!animation->done && now >= animation->next_frame_ms) {
+            memcpy(&previous, &(animation->leds), sizeof(previous));
+            _psmove_animation_frame(animation, now);
 
-        moved_client_list *cur;
-        for (cur=clients; cur != NULL; cur=cur->next) {
-            int count = psmove_count_connected_moved(cur->client);
-            if ((id - offset) < count) {
-                int remote_id = id - offset;
-                return psmove_connect_remote_by_id(id, cur->client, remote_id);
+            /* Spend Bluetooth writes only on visible changes */
+            if (memcmp(&previous, &(animation->leds), sizeof(previous)) != 0 ||
+                    now - animation->last_write_ms >= cur->led_keepalive_ms) {
+                animation->pending = 1;
             }
-            offset += count;
+
+            animation->next_frame_ms = now + _psmove_led_min_interval(cur);
         }
 
-        return NULL;
+        if (!animation->done) {
+            long remaining = animation->next_frame_ms - now;
+            if (remaining < 0) {
+                remaining = 0;
+            }
+            if (timeout < 0 || remaining < timeout) {
+                timeout = remaining;
+            }
+        } else if (!animation->pending) {
+            /* Clean up in the next pass */
+            timeout = 0;
+        }
     }
 
-    struct hid_device_info *devs, *cur_dev;
-    int count = 0;
-    PSMove *move = NULL;
+    return timeout;
+}
 
-    devs = hid_enumerate(PSMOVE_VID, PSMOVE_PID);
-    cur_dev = devs;
-    while (cur_dev) {
-#ifdef _WIN32
-        if (strstr(cur_dev->path, "&col02#") != NULL) {
-#endif
-            if (count == id) {
-                move = psmove_connect_internal(cur_dev->serial_number,
-                        cur_dev->path, id);
-                break;
+/* Find the next device to write to, psmove_led_writer_mutex must be held */
+static PSMove *
+_psmove_led_writer_next()
+{
+    PSMove *cur;
+    int queued = 0;
+
+    for (cur=psmove_led_writer_devices; cur != NULL; cur=cur->led_write_next) {
+        if (__atomic_load_n(&(cur->led_write_queued), __ATOMIC_ACQUIRE) ||
+                (cur->led_animation != NULL && cur->led_animation->pending)) {
+            if (cur->led_write_round != psmove_led_writer_round) {
+                return cur;
             }
-#ifdef _WIN32
-        } else {
-            count--;
+            queued = 1;
         }
-#endif
-
-        count++;
-        cur_dev = cur_dev->next;
     }
-    hid_free_enumeration(devs);
 
-    move->calibration = psmove_calibration_new(move);
-    move->orientation = psmove_orientation_new(move);
+    if (queued) {
+        /* All queued devices have been served in this round - next round */
+        psmove_led_writer_round++;
+        return _psmove_led_writer_next();
+    }
 
-    return move;
+    return NULL;
 }
 
-
-PSMove *
-psmove_connect()
+/* Copy the LED state queued by psmove_update_leds() without tearing */
+static void
+_psmove_led_writer_read(PSMove *move, PSMove_Data_LEDs *leds)
 {
-    return psmove_connect_by_id(0);
+    unsigned int seq;
+
+    while (1) {
+        seq = __atomic_load_n(&(move->led_write_seq), __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            /* psmove_update_leds() is in the middle of an update */
+            sched_yield();
+            continue;
+        }
+
+        memcpy(leds, &(move->led_write_leds), sizeof(*leds));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        if (__atomic_load_n(&(move->led_write_seq), __ATOMIC_RELAXED) == seq) {
+            break;
+        }
+    }
 }
 
-int
-_psmove_read_btaddrs(PSMove *move, PSMove_Data_BTAddr *host, PSMove_Data_BTAddr *controller)
+/* Publish the current LED state for the writer thread (lock-free) */
+static void
+_psmove_led_writer_queue(PSMove *move)
 {
-    unsigned char btg[PSMOVE_BTADDR_GET_SIZE];
-    int res;
+    unsigned int seq = move->led_write_seq;
 
-    psmove_return_val_if_fail(move != NULL, 0);
+    __atomic_store_n(&(move->led_write_seq), seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&(move->led_write_leds), &(move->leds), sizeof(move->leds));
+    __atomic_store_n(&(move->led_write_seq), seq + 2, __ATOMIC_RELEASE);
 
-    if (move->type == PSMove_MOVED) {
-        psmove_CRITICAL("Not implemented in MOVED mode");
-        return 0;
+    /* Only wake up the writer if this device wasn't queued already */
+    if (!__atomic_exchange_n(&(move->led_write_queued), 1, __ATOMIC_ACQ_REL)) {
+        sem_post(&psmove_led_writer_sem);
     }
+}
 
-    /* Get Bluetooth address */
-    memset(btg, 0, sizeof(btg));
-    btg[0] = PSMove_Req_GetBTAddr;
-    res = hid_get_feature_report(move->handle, btg, sizeof(btg));
+void *
+_psmove_led_write_thread_proc(void *data)
+{
+    PSMove *move;
+    PSMove_Data_LEDs leds;
+    struct timespec deadline;
+    struct timeval now;
+    long timeout = -1;
+    int animated;
+    int policy_generation = -1;
 
-    if (res == sizeof(btg)) {
-#ifdef PSMOVE_DEBUG
-        int i;
-        fprintf(stderr, "[PSMOVE] controller bt mac addr: ");
-        for (i=6; i>=1; i--) {
-            if (i != 6) putc(':', stderr);
-            fprintf(stderr, "%02x", btg[i]);
+    PSMOVE_TRACE_THREAD_NAME("psmove LED writer");
+
+    while (1) {
+        if (timeout < 0) {
+            sem_wait(&psmove_led_writer_sem);
+        } else if (timeout > 0) {
+            /* Wake up for the next animation frame (or a queued update) */
+            gettimeofday(&now, NULL);
+            deadline.tv_sec = now.tv_sec + timeout / 1000;
+            deadline.tv_nsec = (now.tv_usec + (timeout % 1000) * 1000) * 1000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            sem_timedwait(&psmove_led_writer_sem, &deadline);
         }
-        fprintf(stderr, "\n");
-#endif
-        if (controller != NULL) {
-            memcpy(*controller, btg+1, 6);
+
+        _psmove_thread_update_policy(Thread_LEDWriter, &policy_generation);
+
+        pthread_mutex_lock(&psmove_led_writer_mutex);
+        if (!psmove_led_writer_running) {
+            pthread_mutex_unlock(&psmove_led_writer_mutex);
+            break;
         }
 
+        _psmove_led_writer_animate();
+
+        while ((move = _psmove_led_writer_next()) != NULL) {
+            /**
+             * Frames of a playing animation take precedence over the
+             * state queued by psmove_update_leds() (which is ignored
+             * while the animation is playing, see below).
+             **/
+            animated = (move->led_animation != NULL &&
+                    move->led_animation->pending);
+            if (animated) {
+                memcpy(&leds, &(move->led_animation->leds), sizeof(leds));
+                move->led_animation->pending = 0;
+                move->led_animation->last_write_ms = psmove_util_get_ticks();
+            }
+
+            /**
+             * Clear the flag before taking the copy, so that an update
+             * that comes in while we write will queue the device again
+             **/
+            __atomic_store_n(&(move->led_write_queued), 0, __ATOMIC_RELEASE);
+            move->led_write_round = psmove_led_writer_round;
+
+            /* While set, psmove_disconnect() will wait before closing move */
+            psmove_led_writer_current = move;
+            pthread_mutex_unlock(&psmove_led_writer_mutex);
+
+            if (!animated) {
+                _psmove_led_writer_read(move, &leds);
+            }
+
+            long long started = psmove_util_get_ticks_us();
+            PSMOVE_TRACE_BEGIN("led_write");
+
+#if defined(__linux)
+            /* Don't write padding bytes on Linux (makes it faster) */
+            _psmove_device_write(move, (unsigned char*)(&leds),
+                    sizeof(leds) - sizeof(leds._padding));
+#else
+            _psmove_device_write(move, (unsigned char*)(&leds),
+                    sizeof(leds));
+#endif
+
+            PSMOVE_TRACE_END("led_write");
+            long long latency = psmove_util_get_ticks_us() - started;
+            _psmove_led_record_latency(move, latency);
+
 #ifdef PSMOVE_DEBUG
-        fprintf(stderr, "[PSMOVE] current host bt mac addr: ");
-        for (i=15; i>=10; i--) {
-            if (i != 15) putc(':', stderr);
-            fprintf(stderr, "%02x", btg[i]);
-        }
-        fprintf(stderr, "\n");
+            fprintf(stderr, "hid_write(%d) = %lld us\n", move->id, latency);
 #endif
-        if (host != NULL) {
-            memcpy(*host, btg+10, 6);
+
+            pthread_mutex_lock(&psmove_led_writer_mutex);
+            psmove_led_writer_current = NULL;
+            pthread_cond_broadcast(&psmove_led_writer_cond);
         }
 
-        /* Success! */
-        return 1;
+        timeout = _psmove_led_writer_animate();
+        pthread_mutex_unlock(&psmove_led_writer_mutex);
     }
 
-    return 0;
+    return NULL;
 }
 
-int
-_psmove_get_calibration_blob(PSMove *move, char **dest, size_t *size)
+/* Register a device with the LED writer (starting the thread if needed) */
+static int
+_psmove_led_writer_add(PSMove *move)
 {
-    psmove_return_val_if_fail(move != NULL, 0);
-    psmove_return_val_if_fail(dest != NULL, 0);
-    psmove_return_val_if_fail(size != NULL, 0);
+    int result = 1;
 
-    unsigned char calibration[PSMOVE_CALIBRATION_BLOB_SIZE];
+    pthread_mutex_lock(&psmove_led_writer_mutex);
+    while (psmove_led_writer_stopping) {
+        pthread_cond_wait(&psmove_led_writer_cond, &psmove_led_writer_mutex);
+    }
 
-    unsigned char cal[PSMOVE_CALIBRATION_SIZE];
-    int res;
-    int x;
+    if (psmove_led_writer_devices == NULL) {
+        psmove_led_writer_running = 1;
+        sem_init(&psmove_led_writer_sem, 0, 0);
+        if (pthread_create(&psmove_led_writer_thread, NULL,
+                    _psmove_led_write_thread_proc, NULL) != 0) {
+            psmove_led_writer_running = 0;
+            sem_destroy(&psmove_led_writer_sem);
+            result = 0;
+        }
+    }
 
-    int dest_offset;
-    int src_offset;
+    if (result) {
+        /* Not yet served in the current round */
+        move->led_write_round = psmove_led_writer_round - 1;
+        move->led_write_next = psmove_led_writer_devices;
+        psmove_led_writer_devices = move;
+    }
+    pthread_mutex_unlock(&psmove_led_writer_mutex);
 
-    for (x=0; x<3; x++) {
-        memset(cal, 0, sizeof(cal));
-        cal[0] = PSMove_Req_GetCalibration;
-        res = hid_get_feature_report(move->handle, cal, sizeof(cal));
-        assert(res == PSMOVE_CALIBRATION_SIZE);
+    return result;
+}
 
-        if (cal[1] == 0x00) {
-            /* First block */
-            dest_offset = 0;
-            src_offset = 0;
-        } else if (cal[1] == 0x01) {
-            /* Second block */
-            dest_offset = PSMOVE_CALIBRATION_SIZE;
-            src_offset = 2;
-        } else if (cal[1] == 0x82) {
-            /* Third block */
-            dest_offset = 2*PSMOVE_CALIBRATION_SIZE - 2;
-            src_offset = 2;
-        } else {
-            return 0;
+/* Unregister a device (stopping the thread when it was the last one) */
+static void
+_psmove_led_writer_remove(PSMove *move)
+{
+    PSMove **cur;
+    int stop = 0;
+
+    pthread_mutex_lock(&psmove_led_writer_mutex);
+    for (cur=&psmove_led_writer_devices; *cur != NULL;
+            cur=&((*cur)->led_write_next)) {
+        if (*cur == move) {
+            *cur = move->led_write_next;
+            break;
         }
+    }
 
-        memcpy(calibration+dest_offset, cal+src_offset,
-                sizeof(cal)-src_offset);
+    /* Don't return while the writer thread is still writing to move */
+    while (psmove_led_writer_current == move) {
+        pthread_cond_wait(&psmove_led_writer_cond, &psmove_led_writer_mutex);
     }
 
-    *dest = (char*)malloc(sizeof(calibration));
-    memcpy(*dest, calibration, sizeof(calibration));
-    *size = sizeof(calibration);
+    _psmove_animation_free(move->led_animation);
+    move->led_animation = NULL;
 
-    return 1;
+    if (psmove_led_writer_devices == NULL && psmove_led_writer_running) {
+        psmove_led_writer_running = 0;
+        psmove_led_writer_stopping = 1;
+        sem_post(&psmove_led_writer_sem);
+        stop = 1;
+    }
+    pthread_mutex_unlock(&psmove_led_writer_mutex);
+
+    if (stop) {
+        pthread_join(psmove_led_writer_thread, NULL);
+        sem_destroy(&psmove_led_writer_sem);
+
+        /* Let _psmove_led_writer_add() start a new thread */
+        pthread_mutex_lock(&psmove_led_writer_mutex);
+        psmove_led_writer_stopping = 0;
+        pthread_cond_broadcast(&psmove_led_writer_cond);
+        pthread_mutex_unlock(&psmove_led_writer_mutex);
+    }
 }
 
-char *
-psmove_get_serial(PSMove *move)
+void *
+_psmove_input_read_thread_proc(void *data)
 {
-    psmove_return_val_if_fail(move != NULL, NULL);
-    psmove_return_val_if_fail(move->serial_number != NULL, NULL);
-    return strdup(move->serial_number);
-}
+    PSMove *move = (PSMove*)data;
+    PSMove_Data_Input input;
+    PSMoveOrientationSample sample;
+    unsigned int head, tail;
+    long long time_us;
+    int res;
+    int policy_generation = -1;
+
+    PSMOVE_TRACE_THREAD_NAME("psmove input");
+
+    while (__atomic_load_n(&(move->input_read_thread_running),
+                __ATOMIC_ACQUIRE)) {
+        _psmove_thread_update_policy(Thread_InputReader, &policy_generation);
+
+        PSMOVE_TRACE_BEGIN("hid_read");
+        res = _psmove_device_read(move, (unsigned char*)(&input),
+                sizeof(input), PSMOVE_INPUT_READ_TIMEOUT_MS);
+        PSMOVE_TRACE_END("hid_read");
+
+        if (res != sizeof(input) || input.type != PSMove_Req_GetInput) {
+            continue;
+        }
+
+        time_us = psmove_util_get_ticks_us();
+        _psmove_link_update(move, input.buttons4 & 0x0F, time_us);
+
+        /**
+         * Integrate the orientation right here, so psmove_poll() doesn't
+         * have to (and so no report is missed if the ring buffer is full)
+         **/
+        if (__atomic_load_n(&(move->orientation_enabled), __ATOMIC_RELAXED) &&
+                move->orientation != NULL) {
+            _psmove_get_orientation_sample(move, &input, time_us, &sample);
+            psmove_orientation_update_batch(&(move->orientation), &sample, 1);
+            _psmove_aggregate_input(move, &input, time_us, sample.sensors);
+        } else {
+            _psmove_aggregate_input(move, &input, time_us, NULL);
+        }
+
+        head = move->input_ring_head;
+        tail = __atomic_load_n(&(move->input_ring_tail), __ATOMIC_ACQUIRE);
+
+        if (head - tail == PSMOVE_INPUT_RING_SIZE) {
+            /* Consumer is too slow - drop this report, keep the older ones */
+#ifdef PSMOVE_DEBUG
+            fprintf(stderr, "[PSMOVE] Input ring full, dropping report\n");
+#endif
+            continue;
+        }
+
+        memcpy(&(move->input_ring[head % PSMOVE_INPUT_RING_SIZE].input),
+                &input, sizeof(input));
+        move->input_ring[head % PSMOVE_INPUT_RING_SIZE].time_us = time_us;
+        __atomic_store_n(&(move->input_ring_head), head + 1,
+                __ATOMIC_RELEASE);
+
+        pthread_mutex_lock(&psmove_input_mutex);
+        psmove_input_generation++;
+        pthread_cond_broadcast(&psmove_input_cond);
+        pthread_mutex_unlock(&psmove_input_mutex);
+    }
+
+    return NULL;
+}
+
+unsigned long
+_psmove_input_generation()
+{
+    unsigned long generation;
+
+    pthread_mutex_lock(&psmove_input_mutex);
+    generation = psmove_input_generation;
+    pthread_mutex_unlock(&psmove_input_mutex);
+
+    return generation;
+}
+
+/**
+ * Wait until any input read thread has queued a new report since
+ * _psmove_input_generation() returned generation, or until timeout_ms
+ * milliseconds have passed (a negative timeout_ms waits forever).
+ **/
+void
+_psmove_input_wait(unsigned long generation, long timeout_ms)
+{
+    struct timeval now;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&psmove_input_mutex);
+    if (timeout_ms < 0) {
+        while (generation == psmove_input_generation) {
+            pthread_cond_wait(&psmove_input_cond, &psmove_input_mutex);
+        }
+    } else {
+        gettimeofday(&now, NULL);
+        deadline.tv_sec = now.tv_sec + timeout_ms / 1000;
+        deadline.tv_nsec = now.tv_usec * 1000 + (timeout_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+
+        while (generation == psmove_input_generation) {
+            if (pthread_cond_timedwait(&psmove_input_cond,
+                        &psmove_input_mutex, &deadline) != 0) {
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&psmove_input_mutex);
+}
+
+/**
+ * Pop the oldest report from the input ring into move->input.
+ * Returns nonzero if a report was available, zero otherwise.
+ **/
+int
+_psmove_input_ring_pop(PSMove *move)
+{
+    unsigned int tail = move->input_ring_tail;
+    unsigned int head = __atomic_load_n(&(move->input_ring_head),
+            __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+        return 0;
+    }
+
+    memcpy(&(move->input), &(move->input_ring[tail % PSMOVE_INPUT_RING_SIZE].input),
+            sizeof(move->input));
+    move->input_time_us = move->input_ring[tail % PSMOVE_INPUT_RING_SIZE].time_us;
+    __atomic_store_n(&(move->input_ring_tail), tail + 1, __ATOMIC_RELEASE);
+
+    return 1;
+}
+
+#endif /* defined(PSMOVE_USE_PTHREADS) */
+
+
+
+/* Previously public functions, now private: */
+
+/**
+ * Get a half-frame from the accelerometer or gyroscope from the
+ * PS Move after using psmove_poll() previously.
+ *
+ * sensor must be Sensor_Accelerometer or Sensor_Accelerometer.
+ *
+ * frame must be Frame_FirstHalf or Frame_SecondHalf.
+ *
+ * x, y and z can point to integer locations that will be filled
+ * with the readings. If any are NULL, the fields will be ignored.
+ **/
+void
+psmove_get_half_frame(PSMove *move, enum PSMove_Sensor sensor,
+        enum PSMove_Frame frame, int *x, int *y, int *z);
+
+
+/* Start implementation of the API */
+
+
+void
+_psmove_disable_remote()
+{
+    psmove_remote_disabled = 1;
+}
+
+void
+_psmove_disable_local()
+{
+    psmove_local_disabled = 1;
+}
+
+void
+_psmove_write_data(PSMove *move, unsigned char *data, int length)
+{
+    if (memcmp(&(move->leds), data, length) != 0) {
+        memcpy(&(move->leds), data, length);
+        move->leds_dirty = 1;
+    }
+    psmove_update_leds(move);
+}
+
+void
+_psmove_read_data(PSMove *move, unsigned char *data, int length)
+{
+    assert(data != NULL);
+    assert(length >= (sizeof(move->input) + 1));
+
+    data[0] = psmove_poll(move);
+    memcpy(data+1, &(move->input), sizeof(move->input));
+}
+
+void
+_psmove_read_data_timeout(PSMove *move, unsigned char *data, int length,
+        int timeout_ms)
+{
+    assert(data != NULL);
+    assert(length >= (sizeof(move->input) + 1));
+
+    data[0] = psmove_wait_for_input(move, timeout_ms);
+    memcpy(data+1, &(move->input), sizeof(move->input));
+}
+
+enum PSMove_Bool
+psmove_is_remote(PSMove *move)
+{
+    return move->type == PSMove_MOVED;
+}
+
+enum PSMove_Bool
+psmove_get_remote_clock(PSMove *move, long long *offset_us, long long *rtt_us)
+{
+    psmove_return_val_if_fail(move != NULL, PSMove_False);
+
+    if (move->type != PSMove_MOVED) {
+        return PSMove_False;
+    }
+
+    return moved_client_get_clock(move->client, offset_us, rtt_us) ?
+        PSMove_True : PSMove_False;
+}
+
+void
+psmove_set_remote_timeout(int timeout_ms)
+{
+    moved_client_set_timeout(timeout_ms);
+}
+
+int
+psmove_get_fd(PSMove *move)
+{
+    psmove_return_val_if_fail(move != NULL, -1);
+
+    if (move->type == PSMove_HIDRAW) {
+        return move->fd;
+    }
+
+    return -1;
+}
+
+static void
+_psmove_devices_lock()
+{
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_lock(&psmove_devices_mutex);
+#endif
+}
+
+static void
+_psmove_devices_unlock()
+{
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_unlock(&psmove_devices_mutex);
+#endif
+}
+
+static wchar_t *
+_psmove_wcsdup(const wchar_t *string)
+{
+    wchar_t *result;
+
+    if (string == NULL) {
+        return NULL;
+    }
+
+    result = malloc((wcslen(string) + 1) * sizeof(wchar_t));
+    wcscpy(result, string);
+    return result;
+}
+
+static void
+_psmove_devices_free()
+{
+    int i;
+
+    for (i=0; i<psmove_devices_count; i++) {
+        free(psmove_devices[i].path);
+        free(psmove_devices[i].serial_number);
+    }
+    free(psmove_devices);
+
+    psmove_devices = NULL;
+    psmove_devices_count = 0;
+    psmove_devices_valid = 0;
+}
+
+/* Queue a hotplug event for a device (devices lock held) */
+static void
+_psmove_hotplug_queue(enum PSMove_Hotplug_Event event,
+        PSMove_Device_Info *info)
+{
+    PSMove_Hotplug_Pending *pending;
+    char *tmp;
+
+    psmove_hotplug_pending = realloc(psmove_hotplug_pending,
+            (psmove_hotplug_pending_count + 1) *
+            sizeof(PSMove_Hotplug_Pending));
+    pending = &(psmove_hotplug_pending[psmove_hotplug_pending_count++]);
+
+    pending->event = event;
+    pending->serial = calloc(PSMOVE_MAX_SERIAL_LENGTH, sizeof(char));
+    pending->type = Conn_USB;
+
+    if (info->serial_number != NULL) {
+        wcstombs(pending->serial, info->serial_number, PSMOVE_MAX_SERIAL_LENGTH);
+
+        /* Same logic as psmove_connection_type() and the Windows quirk */
+        if (strlen(pending->serial) > 1) {
+            pending->type = Conn_Bluetooth;
+        }
+    }
+
+    /* Normalize the serial number like psmove_connect_internal() does */
+    for (tmp=pending->serial; *tmp != '\0'; tmp++) {
+        if (*tmp == '-') {
+            *tmp = ':';
+        }
+        *tmp = tolower(*tmp);
+    }
+}
+
+/* Find a device by path in a device list */
+static int
+_psmove_devices_contains(PSMove_Device_Info *devices, int count,
+        const char *path)
+{
+    int i;
+
+    for (i=0; i<count; i++) {
+        if (strcmp(devices[i].path, path) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Deliver queued hotplug events. Must be called without holding the
+ * devices lock, so that the callback can use the rest of the API.
+ **/
+static void
+_psmove_hotplug_dispatch()
+{
+    PSMove_Hotplug_Pending *pending;
+    psmove_hotplug_callback func;
+    void *user_data;
+    int count;
+    int i;
+
+    _psmove_devices_lock();
+    pending = psmove_hotplug_pending;
+    count = psmove_hotplug_pending_count;
+    func = psmove_hotplug_func;
+    user_data = psmove_hotplug_user_data;
+    psmove_hotplug_pending = NULL;
+    psmove_hotplug_pending_count = 0;
+    _psmove_devices_unlock();
+
+    for (i=0; i<count; i++) {
+        if (func != NULL) {
+            func(pending[i].event, pending[i].serial, pending[i].type,
+                    user_data);
+        }
+        free(pending[i].serial);
+    }
+    free(pending);
+}
+
+/**
+ * Check if hotplug events invalidated the device list (devices lock held).
+ * Returns nonzero if it is still valid, zero if it needs to be refreshed.
+ **/
+static int
+_psmove_devices_check()
+{
+    if (!psmove_devices_valid) {
+        return 0;
+    }
+
+#if defined(__linux)
+    if (psmove_udev_monitor != NULL) {
+        struct pollfd pfd;
+        struct udev_device *dev;
+        int changed = 0;
+
+        pfd.fd = udev_monitor_get_fd(psmove_udev_monitor);
+        pfd.events = POLLIN;
+
+        /* Drain all pending events without blocking */
+        while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+            dev = udev_monitor_receive_device(psmove_udev_monitor);
+            if (dev == NULL) {
+                break;
+            }
+            udev_device_unref(dev);
+            changed = 1;
+        }
+
+        return !changed;
+    }
+#endif
+
+    return (psmove_util_get_ticks() - psmove_devices_updated) <
+        PSMOVE_DEVICE_LIST_MAX_AGE_MS;
+}
+
+/* Make sure the cached device list is up to date (devices lock held) */
+static void
+_psmove_devices_update()
+{
+    struct hid_device_info *devs, *cur_dev;
+    int count = 0;
+
+#if defined(__linux)
+    if (psmove_udev == NULL) {
+        /* Subscribe to hotplug events before the first enumeration */
+        psmove_udev = udev_new();
+        if (psmove_udev != NULL) {
+            psmove_udev_monitor = udev_monitor_new_from_netlink(psmove_udev,
+                    "udev");
+        }
+
+        if (psmove_udev_monitor != NULL) {
+            udev_monitor_filter_add_match_subsystem_devtype(psmove_udev_monitor,
+                    "hidraw", NULL);
+            if (udev_monitor_enable_receiving(psmove_udev_monitor) != 0) {
+                udev_monitor_unref(psmove_udev_monitor);
+                psmove_udev_monitor = NULL;
+            }
+        }
+    }
+#endif
+
+    if (_psmove_devices_check()) {
+        return;
+    }
+
+    /* Keep the old list around for finding added/removed devices */
+    PSMove_Device_Info *old_devices = psmove_devices;
+    int old_count = psmove_devices_count;
+    int i;
+
+    psmove_devices = NULL;
+    psmove_devices_count = 0;
+
+    devs = hid_enumerate(PSMOVE_VID, PSMOVE_PID);
+
+    for (cur_dev = devs; cur_dev != NULL; cur_dev = cur_dev->next) {
+        count++;
+    }
+
+    psmove_devices = calloc(count ? count : 1, sizeof(PSMove_Device_Info));
+
+    for (cur_dev = devs; cur_dev != NULL; cur_dev = cur_dev->next) {
+#ifdef _WIN32
+        /**
+         * Windows Quirk: Ignore extraneous devices (each dev is enumerated
+         * 3 times, count only the one with "&col02#" in the path)
+         *
+         * We use col02 for enumeration, and col01 for connecting. We want to
+         * have col02 here, because after connecting to col01, it disappears.
+         **/
+        if (strstr(cur_dev->path, "&col02#") == NULL) {
+            continue;
+        }
+#endif
+        psmove_devices[psmove_devices_count].path = strdup(cur_dev->path);
+        psmove_devices[psmove_devices_count].serial_number =
+            _psmove_wcsdup(cur_dev->serial_number);
+        psmove_devices_count++;
+    }
+    hid_free_enumeration(devs);
+
+    psmove_devices_valid = 1;
+    psmove_devices_updated = psmove_util_get_ticks();
+
+    if (psmove_hotplug_func != NULL) {
+        for (i=0; i<old_count; i++) {
+            if (!_psmove_devices_contains(psmove_devices,
+                        psmove_devices_count, old_devices[i].path)) {
+                _psmove_hotplug_queue(Hotplug_Removed, &(old_devices[i]));
+            }
+        }
+
+        for (i=0; i<psmove_devices_count; i++) {
+            if (!_psmove_devices_contains(old_devices,
+                        old_count, psmove_devices[i].path)) {
+                _psmove_hotplug_queue(Hotplug_Added, &(psmove_devices[i]));
+            }
+        }
+    }
+
+    for (i=0; i<old_count; i++) {
+        free(old_devices[i].path);
+        free(old_devices[i].serial_number);
+    }
+    free(old_devices);
+}
+
+#if defined(PSMOVE_USE_PTHREADS)
+void *
+_psmove_hotplug_thread_proc(void *data)
+{
+    struct pollfd pfd;
+
+    pfd.fd = udev_monitor_get_fd(psmove_udev_monitor);
+    pfd.events = POLLIN;
+
+    while (__atomic_load_n(&psmove_hotplug_thread_running, __ATOMIC_ACQUIRE)) {
+        /* Wake up regularly to check if we should stop */
+        if (poll(&pfd, 1, 100) > 0) {
+            _psmove_devices_lock();
+            _psmove_devices_update();
+            _psmove_devices_unlock();
+
+            _psmove_hotplug_dispatch();
+        }
+    }
+
+    return NULL;
+}
+
+static void
+_psmove_hotplug_thread_stop()
+{
+    if (psmove_hotplug_thread_running) {
+        __atomic_store_n(&psmove_hotplug_thread_running, 0, __ATOMIC_RELEASE);
+        pthread_join(psmove_hotplug_thread, NULL);
+    }
+}
+#endif
+
+void
+psmove_set_hotplug_callback(psmove_hotplug_callback callback, void *user_data)
+{
+    int i;
+
+#if defined(PSMOVE_USE_PTHREADS)
+    _psmove_hotplug_thread_stop();
+#endif
+
+    _psmove_devices_lock();
+
+    /* Bring the list up to date before reporting the current devices */
+    psmove_hotplug_func = NULL;
+    if (!psmove_local_disabled) {
+        _psmove_devices_update();
+    }
+
+    psmove_hotplug_func = callback;
+    psmove_hotplug_user_data = user_data;
+
+    if (callback != NULL) {
+        for (i=0; i<psmove_devices_count; i++) {
+            _psmove_hotplug_queue(Hotplug_Added, &(psmove_devices[i]));
+        }
+
+#if defined(PSMOVE_USE_PTHREADS)
+        if (psmove_udev_monitor != NULL) {
+            psmove_hotplug_thread_running = 1;
+            if (pthread_create(&psmove_hotplug_thread, NULL,
+                        _psmove_hotplug_thread_proc, NULL) != 0) {
+                psmove_CRITICAL("Could not start hotplug thread");
+                psmove_hotplug_thread_running = 0;
+            }
+        }
+#endif
+    }
+    _psmove_devices_unlock();
+
+    _psmove_hotplug_dispatch();
+}
+
+void
+psmove_reinit()
+{
+    if (psmove_num_open_handles != 0) {
+        psmove_CRITICAL("reinit called with open handles "
+                "(forgot psmove_disconnect?)");
+        exit(0);
+    }
+
+    if (clients != NULL) {
+        moved_client_list_destroy(clients);
+        clients = NULL;
+    }
+
+#if defined(PSMOVE_USE_PTHREADS)
+    _psmove_hotplug_thread_stop();
+#endif
+
+    _psmove_devices_lock();
+    _psmove_devices_free();
+#if defined(__linux)
+    if (psmove_udev_monitor != NULL) {
+        udev_monitor_unref(psmove_udev_monitor);
+        psmove_udev_monitor = NULL;
+    }
+    if (psmove_udev != NULL) {
+        udev_unref(psmove_udev);
+        psmove_udev = NULL;
+    }
+#endif
+    _psmove_devices_unlock();
+
+    hid_exit();
+}
+
+int
+psmove_count_connected_hidapi()
+{
+    int count;
+
+    if (psmove_local_disabled) {
+        return 0;
+    }
+
+    _psmove_devices_lock();
+    _psmove_devices_update();
+    count = psmove_devices_count;
+    _psmove_devices_unlock();
+
+    _psmove_hotplug_dispatch();
+
+    return count;
+}
+
+int
+psmove_count_connected_moved(moved_client *client)
+{
+    psmove_return_val_if_fail(client != NULL, 0);
+    return moved_client_count(client);
+}
+
+int
+psmove_count_connected()
+{
+    int count = psmove_count_connected_hidapi();
+
+    if (clients == NULL && !psmove_remote_disabled) {
+        clients = moved_client_list_open();
+    }
+
+    /* All hosts are asked at once, so one unreachable host can't stall */
+    count += moved_client_list_count(clients);
+
+    return count;
+}
+
+PSMove *
+psmove_connect_internal(wchar_t *serial, char *path, int id)
+{
+    char *tmp;
+
+    PSMove *move = (PSMove*)calloc(1, sizeof(PSMove));
+    move->type = PSMove_HIDAPI;
+    move->last_timestamp = -1;
+
+    /* Make sure the first LEDs update will go through (+ init get_ticks) */
+    _psmove_led_policy_init(move);
+    move->last_leds_update = psmove_util_get_ticks() - move->led_keepalive_ms;
+
+#ifdef _WIN32
+    /* Windows Quirk: USB devices have "0" as serial, BT devices their addr */
+    if (wcslen(serial) > 1) {
+        move->is_bluetooth = 1;
+    }
+    /* Windows Quirk: Use path instead of serial number by ignoring serial */
+    serial = NULL;
+
+    /* XXX Ugly: Convert "col02" path to "col01" path (tested w/ BT and USB) */
+    char *p;
+    psmove_return_val_if_fail((p = strstr(path, "&col02#")) != NULL, NULL);
+    p[5] = '1';
+    psmove_return_val_if_fail((p = strstr(path, "&0001#")) != NULL, NULL);
+    p[4] = '0';
+#endif
+
+#if defined(PSMOVE_USE_HIDRAW)
+    /* hidapi's Linux backend enumerates hidraw device nodes as paths */
+    if (path != NULL && strncmp(path, "/dev/hidraw", 11) == 0) {
+        move->fd = open(path, O_RDWR | O_NONBLOCK);
+        if (move->fd == -1) {
+            free(move);
+            return NULL;
+        }
+        move->type = PSMove_HIDRAW;
+    }
+#endif
+
+    if (move->type == PSMove_HIDAPI) {
+        if (serial == NULL && path != NULL) {
+            move->handle = hid_open_path(path);
+        } else {
+            move->handle = hid_open(PSMOVE_VID, PSMOVE_PID, serial);
+        }
+
+        if (!move->handle) {
+            free(move);
+            return NULL;
+        }
+
+        /* Use Non-Blocking I/O */
+        hid_set_nonblocking(move->handle, 1);
+        move->fd = -1;
+    }
+
+    /* Message type for LED set requests */
+    move->leds.type = PSMove_Req_SetLEDs;
+
+    /* Remember the ID/index */
+    move->id = id;
+
+    /* Remember the serial number */
+    move->serial_number = (char*)calloc(PSMOVE_MAX_SERIAL_LENGTH, sizeof(char));
+    if (serial != NULL) {
+        wcstombs(move->serial_number, serial, PSMOVE_MAX_SERIAL_LENGTH);
+    }
+
+    /**
+     * Normalize "aa-bb-cc-dd-ee-ff" (OS X format) into "aa:bb:cc:dd:ee:ff"
+     * Also normalize "AA:BB:CC:DD:EE:FF" into "aa:bb:cc:dd:ee:ff" (lowercase)
+     **/
+    tmp = move->serial_number;
+    while (*tmp != '\0') {
+        if (*tmp == '-') {
+            *tmp = ':';
+        }
+
+        *tmp = tolower(*tmp);
+        tmp++;
+    }
+
+#if defined(PSMOVE_USE_PTHREADS)
+    psmove_return_val_if_fail(_psmove_led_writer_add(move), NULL);
+#endif
+
+    /* Bookkeeping of open handles (for psmove_reinit) */
+    __sync_add_and_fetch(&psmove_num_open_handles, 1);
+
+    return move;
+}
+
+PSMove *
+psmove_connect_remote_by_id(int id, moved_client *client, int remote_id)
+{
+    PSMove *move = (PSMove*)calloc(1, sizeof(PSMove));
+    move->type = PSMove_MOVED;
+    move->last_timestamp = -1;
+
+    move->client = client;
+    move->remote_id = remote_id;
+
+    /* Message type for LED set requests */
+    move->leds.type = PSMove_Req_SetLEDs;
+    _psmove_led_policy_init(move);
+
+    /* Remember the ID/index */
+    move->id = id;
+
+    /* Remember the serial number */
+    move->serial_number = (char*)calloc(PSMOVE_MAX_SERIAL_LENGTH, sizeof(char));
+    snprintf(move->serial_number, PSMOVE_MAX_SERIAL_LENGTH, "%s:%d",
+            client->hostname, MOVED_DEVICE_SLOT(remote_id));
+
+    /* Bookkeeping of open handles (for psmove_reinit) */
+    __sync_add_and_fetch(&psmove_num_open_handles, 1);
+
+    return move;
+}
+
+PSMove *
+psmove_connect_replay(const char *filename, int device,
+        enum PSMove_Replay_Mode mode)
+{
+    PSMoveReplay *replay = psmove_replay_new(filename, device, mode);
+
+    if (replay == NULL) {
+        return NULL;
+    }
+
+    PSMove *move = (PSMove*)calloc(1, sizeof(PSMove));
+    move->type = PSMove_REPLAY;
+    move->last_timestamp = -1;
+    move->replay = replay;
+
+    /* Message type for LED set requests */
+    move->leds.type = PSMove_Req_SetLEDs;
+    _psmove_led_policy_init(move);
+
+    move->id = device;
+
+    /* Use the recorded serial number (for loading calibration data) */
+    move->serial_number = strdup(psmove_replay_get_serial(replay));
+
+    /* Bookkeeping of open handles (for psmove_reinit) */
+    __sync_add_and_fetch(&psmove_num_open_handles, 1);
+
+    /* Calibration and orientation are set up on first use */
+    move->calibration = psmove_calibration_new(move);
+
+    return move;
+}
+
+enum PSMove_Bool
+psmove_is_replay_finished(PSMove *move)
+{
+    psmove_return_val_if_fail(move != NULL, PSMove_True);
+    psmove_return_val_if_fail(move->type == PSMove_REPLAY, PSMove_True);
+
+    return psmove_replay_finished(move->replay);
+}
+
+PSMove *
+psmove_connect_by_id(int id)
+{
+    int hidapi_count = psmove_count_connected_hidapi();
+
+    if (id >= hidapi_count) {
+        /* XXX: check remote controllers */
+        if (clients == NULL && !psmove_remote_disabled) {
+            clients = moved_client_list_open();
+        }
+
+        int offset = hidapi_count;
+
+        /* Refresh all counts at once, then use the cached counts */
+        moved_client_list_count(clients);
+
+        moved_client_list *cur;
+        for (cur=clients; cur != NULL; cur=cur->next) {
+            int count = psmove_count_connected_moved(cur->client);
+            if ((id - offset) < count) {
+                /* Requests carry the generation, so stale handles fail */
+                int remote_id = moved_client_device_id(cur->client, id - offset);
+                if (remote_id == -1) {
+                    return NULL;
+                }
+                return psmove_connect_remote_by_id(id, cur->client, remote_id);
+            }
+            offset += count;
+        }
+
+        return NULL;
+    }
+
+    PSMove *move = NULL;
+    char *path = NULL;
+    wchar_t *serial_number = NULL;
+
+    /* Copy the entry, the list might be refreshed while we connect */
+    _psmove_devices_lock();
+    _psmove_devices_update();
+    if (id < psmove_devices_count) {
+        path = strdup(psmove_devices[id].path);
+        serial_number = _psmove_wcsdup(psmove_devices[id].serial_number);
+    }
+    _psmove_devices_unlock();
+
+    _psmove_hotplug_dispatch();
+
+    if (path != NULL) {
+        move = psmove_connect_internal(serial_number, path, id);
+    }
+
+    free(path);
+    free(serial_number);
+
+    if (move != NULL) {
+        /* Calibration and orientation are set up on first use */
+        move->calibration = psmove_calibration_new(move);
+    }
+
+    return move;
+}
+
+
+PSMove *
+psmove_connect()
+{
+    return psmove_connect_by_id(0);
+}
+
+#if defined(PSMOVE_USE_PTHREADS)
+/* Shared state of the psmove_connect_all() worker threads */
+typedef struct {
+    PSMove **moves;
+    int count;
+    int next_id;
+} PSMove_Connect_Job;
+
+void *
+_psmove_connect_worker_proc(void *data)
+{
+    PSMove_Connect_Job *job = (PSMove_Connect_Job*)data;
+    int id;
+
+    while ((id = __sync_fetch_and_add(&(job->next_id), 1)) < job->count) {
+        job->moves[id] = psmove_connect_by_id(id);
+    }
+
+    return NULL;
+}
+#endif
+
+PSMove **
+psmove_connect_all(int *count)
+{
+    PSMove **moves;
+    int total;
+    int local;
+    int id;
+    int i, j;
+
+    psmove_return_val_if_fail(count != NULL, NULL);
+
+    /**
+     * Do all lazy initialization of shared state up-front, so that the
+     * workers only do per-device work (see psmove_connect_internal())
+     **/
+    psmove_util_get_ticks();
+    psmove_util_get_data_dir();
+    total = psmove_count_connected();
+    local = psmove_count_connected_hidapi();
+
+    moves = (PSMove**)calloc(total ? total : 1, sizeof(PSMove*));
+
+#if defined(PSMOVE_USE_PTHREADS)
+    PSMove_Connect_Job job;
+    pthread_t workers[PSMOVE_CONNECT_WORKERS];
+    int workers_count = 0;
+
+    job.moves = moves;
+    job.count = local;
+    job.next_id = 0;
+
+    for (i=0; i<PSMOVE_CONNECT_WORKERS && i<local; i++) {
+        if (pthread_create(&workers[workers_count], NULL,
+                    _psmove_connect_worker_proc, &job) == 0) {
+            workers_count++;
+        }
+    }
+
+    if (workers_count == 0) {
+        /* Could not start any worker - connect from this thread */
+        _psmove_connect_worker_proc(&job);
+    }
+
+    for (i=0; i<workers_count; i++) {
+        pthread_join(workers[i], NULL);
+    }
+#else
+    for (id=0; id<local; id++) {
+        moves[id] = psmove_connect_by_id(id);
+    }
+#endif
+
+    /**
+     * Remote controllers share one socket per moved host, and requests
+     * can't be interleaved on it, so connect to them one by one
+     **/
+    for (id=local; id<total; id++) {
+        moves[id] = psmove_connect_by_id(id);
+    }
+
+    /* Remove controllers that failed to connect */
+    for (i=0, j=0; i<total; i++) {
+        if (moves[i] != NULL) {
+            moves[j++] = moves[i];
+        }
+    }
+
+    *count = j;
+    return moves;
+}
+
+int
+_psmove_read_btaddrs(PSMove *move, PSMove_Data_BTAddr *host, PSMove_Data_BTAddr *controller)
+{
+    unsigned char btg[PSMOVE_BTADDR_GET_SIZE];
+    int res;
+
+    psmove_return_val_if_fail(move != NULL, 0);
+
+    if (move->type == PSMove_MOVED) {
+        psmove_CRITICAL("Not implemented in MOVED mode");
+        return 0;
+    }
+
+    /* Get Bluetooth address */
+    memset(btg, 0, sizeof(btg));
+    btg[0] = PSMove_Req_GetBTAddr;
+    res = _psmove_device_get_feature_report(move, btg, sizeof(btg));
+
+    if (res == sizeof(btg)) {
+#ifdef PSMOVE_DEBUG
+        int i;
+        fprintf(stderr, "[PSMOVE] controller bt mac addr: ");
+        for (i=6; i>=1; i--) {
+            if (i != 6) putc(':', stderr);
+            fprintf(stderr, "%02x", btg[i]);
+        }
+        fprintf(stderr, "\n");
+#endif
+        if (controller != NULL) {
+            memcpy(*controller, btg+1, 6);
+        }
+
+#ifdef PSMOVE_DEBUG
+        fprintf(stderr, "[PSMOVE] current host bt mac addr: ");
+        for (i=15; i>=10; i--) {
+            if (i != 15) putc(':', stderr);
+            fprintf(stderr, "%02x", btg[i]);
+        }
+        fprintf(stderr, "\n");
+#endif
+        if (host != NULL) {
+            memcpy(*host, btg+10, 6);
+        }
+
+        /* Success! */
+        return 1;
+    }
+
+    return 0;
+}
+
+int
+_psmove_get_calibration_blob(PSMove *move, char **dest, size_t *size)
+{
+    psmove_return_val_if_fail(move != NULL, 0);
+    psmove_return_val_if_fail(dest != NULL, 0);
+    psmove_return_val_if_fail(size != NULL, 0);
+
+    unsigned char calibration[PSMOVE_CALIBRATION_BLOB_SIZE];
+
+    unsigned char cal[PSMOVE_CALIBRATION_SIZE];
+    int res;
+    int x;
+
+    int dest_offset;
+    int src_offset;
+
+    for (x=0; x<3; x++) {
+        memset(cal, 0, sizeof(cal));
+        cal[0] = PSMove_Req_GetCalibration;
+        res = _psmove_device_get_feature_report(move, cal, sizeof(cal));
+        assert(res == PSMOVE_CALIBRATION_SIZE);
+
+        if (cal[1] == 0x00) {
+            /* First block */
+            dest_offset = 0;
+            src_offset = 0;
+        } else if (cal[1] == 0x01) {
+            /* Second block */
+            dest_offset = PSMOVE_CALIBRATION_SIZE;
+            src_offset = 2;
+        } else if (cal[1] == 0x82) {
+            /* Third block */
+            dest_offset = 2*PSMOVE_CALIBRATION_SIZE - 2;
+            src_offset = 2;
+        } else {
+            return 0;
+        }
+
+        memcpy(calibration+dest_offset, cal+src_offset,
+                sizeof(cal)-src_offset);
+    }
+
+    *dest = (char*)malloc(sizeof(calibration));
+    memcpy(*dest, calibration, sizeof(calibration));
+    *size = sizeof(calibration);
+
+    return 1;
+}
+
+char *
+psmove_get_serial(PSMove *move)
+{
+    psmove_return_val_if_fail(move != NULL, NULL);
+    psmove_return_val_if_fail(move->serial_number != NULL, NULL);
+    return strdup(move->serial_number);
+}
+
+int
+psmove_set_btaddr(PSMove *move, PSMove_Data_BTAddr *addr)
+{
+    unsigned char bts[PSMOVE_BTADDR_SET_SIZE];
+    int res;
+    int i;
+
+    psmove_return_val_if_fail(move != NULL, 0);
+    psmove_return_val_if_fail(addr != NULL, 0);
+
+    /* Get calibration data */
+    memset(bts, 0, sizeof(bts));
+    bts[0] = PSMove_Req_SetBTAddr;
+
+    /* Copy 6 bytes from addr into bts[1]..bts[6], reversed */
+    for (i=0; i<6; i++) {
+        bts[1+5-i] = (*addr)[i];
+    }
+
+    res = _psmove_device_send_feature_report(move, bts, sizeof(bts));
+
+    return (res == sizeof(bts));
+}
+
+enum PSMove_Bool
+psmove_pair(PSMove *move)
+{
+    psmove_return_val_if_fail(move != NULL, 0);
+
+    PSMove_Data_BTAddr btaddr;
+
+    if (!_psmove_read_btaddrs(move, &btaddr, NULL)) {
+        return PSMove_False;
+    }
+
+
+#if defined(__APPLE__)
+    char *btaddr_string = macosx_get_btaddr();
+    if (!_psmove_btaddr_from_string(btaddr_string, &btaddr)) {
+        free(btaddr_string);
+        return PSMove_False;
+    }
+    free(btaddr_string);
+#elif defined(__linux)
+    hci_for_each_dev(HCI_UP, _psmove_linux_bt_dev_info, (long)btaddr);
+#elif defined(_WIN32)
+    HBLUETOOTH_RADIO_FIND hFind;
+    HANDLE hRadio;
+    BLUETOOTH_RADIO_INFO radioInfo;
+
+    BLUETOOTH_FIND_RADIO_PARAMS btfrp;
+    btfrp.dwSize = sizeof(BLUETOOTH_FIND_RADIO_PARAMS);
+    hFind = BluetoothFindFirstRadio(&btfrp, &hRadio);
+
+    psmove_return_val_if_fail(hFind != NULL, 0);
+    radioInfo.dwSize = sizeof(BLUETOOTH_RADIO_INFO);
+
+    if (BluetoothGetRadioInfo(hRadio, &radioInfo) != ERROR_SUCCESS) {
+        psmove_CRITICAL("BluetoothGetRadioInfo");
+        CloseHandle(hRadio);
+        BluetoothFindRadioClose(hFind);
+        return PSMove_False;
+    }
+
+    int i;
+    for (i=0; i<6; i++) {
+        btaddr[i] = radioInfo.address.rgBytes[5-i];
+    }
+
+    CloseHandle(hRadio);
+    BluetoothFindRadioClose(hFind);
+
+#else
+    /* TODO: Implement for other OSes (if any?) */
+    return PSMove_False;
+#endif
+
+    if (!psmove_set_btaddr(move, &btaddr)) {
+        return PSMove_False;
+    }
+
+    return PSMove_True;
+}
+
+int
+_psmove_get_host_btaddrs(PSMove_Data_BTAddr *addrs, int max)
+{
+    psmove_return_val_if_fail(addrs != NULL || max == 0, 0);
+
+    if (max == 0) {
+        return 0;
+    }
+
+#if defined(__APPLE__)
+    char *btaddr_string = macosx_get_btaddr();
+    int count = _psmove_btaddr_from_string(btaddr_string, &addrs[0]);
+    free(btaddr_string);
+    return count;
+#elif defined(__linux)
+    PSMove_Linux_BT_Dev_List list = { addrs, 0, max };
+    hci_for_each_dev(HCI_UP, _psmove_linux_bt_dev_list, (long)&list);
+    return list.count;
+#elif defined(_WIN32)
+    HBLUETOOTH_RADIO_FIND hFind;
+    HANDLE hRadio;
+    BLUETOOTH_RADIO_INFO radioInfo;
+    int count = 0;
+    int i;
+
+    BLUETOOTH_FIND_RADIO_PARAMS btfrp;
+    btfrp.dwSize = sizeof(BLUETOOTH_FIND_RADIO_PARAMS);
+    hFind = BluetoothFindFirstRadio(&btfrp, &hRadio);
+
+    if (hFind == NULL) {
+        return 0;
+    }
+
+    do {
+        radioInfo.dwSize = sizeof(BLUETOOTH_RADIO_INFO);
+        if (BluetoothGetRadioInfo(hRadio, &radioInfo) == ERROR_SUCCESS) {
+            for (i=0; i<6; i++) {
+                addrs[count][i] = radioInfo.address.rgBytes[5-i];
+            }
+            count++;
+        }
+        CloseHandle(hRadio);
+    } while (count < max && BluetoothFindNextRadio(hFind, &hRadio));
+
+    BluetoothFindRadioClose(hFind);
+    return count;
+#else
+    return 0;
+#endif
+}
+
+enum PSMove_Bool
+psmove_pair_custom(PSMove *move, const char *btaddr_string)
+{
+    psmove_return_val_if_fail(move != NULL, 0);
+
+    PSMove_Data_BTAddr btaddr;
+
+    if (!_psmove_read_btaddrs(move, &btaddr, NULL)) {
+        return PSMove_False;
+    }
+
+    if (!_psmove_btaddr_from_string(btaddr_string, &btaddr)) {
+        return PSMove_False;
+    }
+
+    if (!psmove_set_btaddr(move, &btaddr)) {
+        return PSMove_False;
+    }
+
+    return PSMove_True;
+}
+
+enum PSMove_Connection_Type
+psmove_connection_type(PSMove *move)
+{
+    psmove_return_val_if_fail(move != NULL, Conn_Unknown);
+
+    if (move->type == PSMove_MOVED || move->type == PSMove_REPLAY) {
+        return Conn_Bluetooth;
+    }
+
+#if defined(_WIN32)
+    if (move->is_bluetooth) {
+        return Conn_Bluetooth;
+    } else {
+        return Conn_USB;
+    }
+#endif
+
+    if (move->serial_number == NULL) {
+        return Conn_Unknown;
+    }
+
+    if (strlen(move->serial_number) == 0) {
+        return Conn_USB;
+    }
+
+    return Conn_Bluetooth;
+}
+
+int
+_psmove_btaddr_from_string(const char *string, PSMove_Data_BTAddr *dest)
+{
+    int i, value;
+    PSMove_Data_BTAddr tmp = {0};
+
+    /* strlen("00:11:22:33:44:55") == 17 */
+    psmove_return_val_if_fail(strlen(string) == 17, 0);
+
+    for (i=0; i<6; i++) {
+        value = strtol(string + i*3, NULL, 16);
+        psmove_return_val_if_fail(value >= 0x00 && value <= 0xFF, 0);
+        tmp[i] = value;
+    }
+
+    if (dest != NULL) {
+        memcpy(*dest, tmp, sizeof(PSMove_Data_BTAddr));
+    }
+
+    return 1;
+}
+
+char *
+_psmove_btaddr_to_string(const PSMove_Data_BTAddr addr)
+{
+    int size = 18; /* strlen("aa:bb:cc:dd:ee:ff") + 1 */
+    char *result = (char*)malloc(size);
+
+    snprintf(result, size, "%02hhx:%02hhx:%02hhx:%02hhx:%02hhx:%02hhx",
+            addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
+
+    return result;
+}
+
+void
+psmove_set_leds(PSMove *move, unsigned char r, unsigned char g,
+        unsigned char b)
+{
+    psmove_return_if_fail(move != NULL);
+
+    if (move->leds.r == r && move->leds.g == g && move->leds.b == b) {
+        /**
+         * Avoid extraneous LED updates - this does not set the "leds_dirty"
+         * flag below, so we don't have to send an update the next time.
+         **/
+        return;
+    }
+
+    move->leds.r = r;
+    move->leds.g = g;
+    move->leds.b = b;
+    move->leds_dirty = 1;
+}
+
+void
+psmove_set_rumble(PSMove *move, unsigned char rumble)
+{
+    psmove_return_if_fail(move != NULL);
+
+    if (move->leds.rumble == rumble) {
+        /* Avoid extraneous updates (see psmove_set_leds above) */
+        return;
+    }
+
+    move->leds.rumble2 = 0x00;
+    move->leds.rumble = rumble;
+    move->leds_dirty = 1;
+}
+
+enum PSMove_Update_Result
+psmove_update_leds(PSMove *move)
+{
+    int res;
+    long timediff_ms;
+
+    psmove_return_val_if_fail(move != NULL, 0);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    if (PSMOVE_IS_LOCAL(move)) {
+        if (__atomic_exchange_n(&(move->led_animation_ended), 0,
+                    __ATOMIC_ACQ_REL)) {
+            /* Restore the application's LED state after an animation */
+            move->leds_dirty = 1;
+            move->last_leds_update -= _psmove_led_min_interval(move);
+        }
+
+        if (__atomic_load_n(&(move->led_animation), __ATOMIC_ACQUIRE) != NULL) {
+            /* The LED writer thread is playing an animation */
+            return Update_Ignored;
+        }
+    }
+#endif
+
+    timediff_ms = (psmove_util_get_ticks() - move->last_leds_update);
+
+    if ((move->leds_rate_limiting || _psmove_link_congested(move)) &&
+            move->leds_dirty && timediff_ms < _psmove_led_min_interval(move)) {
+        /* Rate limiting (too many updates, or a congested link) */
+        return Update_Ignored;
+    } else if (!move->leds_dirty && timediff_ms < move->led_keepalive_ms) {
+        /* Unchanged LEDs value (no need to update yet) */
+        return Update_Ignored;
+    }
+
+    move->leds_dirty = 0;
+    move->last_leds_update = psmove_util_get_ticks();
+
+    switch (move->type) {
+        case PSMove_HIDAPI:
+        case PSMove_HIDRAW:
+#if defined(PSMOVE_USE_PTHREADS)
+            _psmove_led_writer_queue(move);
+            return Update_Success;
+#else
+            {
+                long long started = psmove_util_get_ticks_us();
+                PSMOVE_TRACE_BEGIN("led_write");
+                res = _psmove_device_write(move,
+                        (unsigned char*)(&(move->leds)), sizeof(move->leds));
+                PSMOVE_TRACE_END("led_write");
+                _psmove_led_record_latency(move,
+                        psmove_util_get_ticks_us() - started);
+            }
+            if (res == sizeof(move->leds)) {
+                return Update_Success;
+            } else {
+                return Update_Failed;
+            }
+#endif
+            break;
+        case PSMove_MOVED:
+            /* Coalesced and resent until acknowledged (see moved_client.h) */
+            moved_client_write(move->client, move->remote_id,
+                    (unsigned char*)(&move->leds));
+            return Update_Success;
+            break;
+        case PSMove_REPLAY:
+            /* LED updates of replayed devices are discarded */
+            return Update_Success;
+            break;
+        default:
+            psmove_CRITICAL("Unknown device type");
+            return 0;
+            break;
+    }
+}
+
+enum PSMove_Bool
+psmove_play_animation(PSMove *move, const PSMoveKeyframe *keyframes,
+        int count, int loops)
+{
+    psmove_return_val_if_fail(move != NULL, PSMove_False);
+    psmove_return_val_if_fail(keyframes != NULL, PSMove_False);
+    psmove_return_val_if_fail(count > 0, PSMove_False);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    PSMove_Animation *animation;
+    PSMove_Animation *old;
+    int i;
+
+    if (!PSMOVE_IS_LOCAL(move)) {
+        return PSMove_False;
+    }
+
+    animation = (PSMove_Animation*)calloc(1, sizeof(PSMove_Animation));
+    animation->keyframes = (PSMoveKeyframe*)malloc(count *
+            sizeof(PSMoveKeyframe));
+    memcpy(animation->keyframes, keyframes, count * sizeof(PSMoveKeyframe));
+    animation->count = count;
+    animation->loops = loops;
+
+    for (i=0; i<count; i++) {
+        if (animation->keyframes[i].duration_ms < 0) {
+            animation->keyframes[i].duration_ms = 0;
+        }
+        animation->duration_ms += animation->keyframes[i].duration_ms;
+    }
+
+    /* Fade from the current LED state */
+    memcpy(&(animation->leds), &(move->leds), sizeof(animation->leds));
+    animation->r = move->leds.r;
+    animation->g = move->leds.g;
+    animation->b = move->leds.b;
+    animation->started_ms = psmove_util_get_ticks();
+    animation->next_frame_ms = animation->started_ms;
+    animation->last_write_ms = animation->started_ms;
+
+    pthread_mutex_lock(&psmove_led_writer_mutex);
+    old = move->led_animation;
+    __atomic_store_n(&(move->led_animation), animation, __ATOMIC_RELEASE);
+    __atomic_store_n(&(move->led_animation_ended), 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&psmove_led_writer_mutex);
+
+    _psmove_animation_free(old);
+
+    /* Wake up the writer thread to start the animation */
+    sem_post(&psmove_led_writer_sem);
+
+    return PSMove_True;
+#else
+    return PSMove_False;
+#endif
+}
+
+void
+psmove_stop_animation(PSMove *move)
+{
+    psmove_return_if_fail(move != NULL);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    PSMove_Animation *old;
+
+    if (!PSMOVE_IS_LOCAL(move)) {
+        return;
+    }
+
+    pthread_mutex_lock(&psmove_led_writer_mutex);
+    old = move->led_animation;
+    __atomic_store_n(&(move->led_animation), NULL, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&psmove_led_writer_mutex);
+
+    if (old != NULL) {
+        _psmove_animation_free(old);
+        __atomic_store_n(&(move->led_animation_ended), 1, __ATOMIC_RELEASE);
+    }
+#endif
+}
+
+enum PSMove_Bool
+psmove_is_animation_playing(PSMove *move)
+{
+    psmove_return_val_if_fail(move != NULL, PSMove_False);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    if (__atomic_load_n(&(move->led_animation), __ATOMIC_ACQUIRE) != NULL) {
+        return PSMove_True;
+    }
+#endif
+
+    return PSMove_False;
+}
+
+void
+psmove_set_rate_limiting(PSMove *move, enum PSMove_Bool enabled)
+{
+    psmove_return_if_fail(move != NULL);
+    move->leds_rate_limiting = enabled;
+}
+
+void
+psmove_set_led_policy(PSMove *move, const PSMoveLEDPolicy *policy)
+{
+    psmove_return_if_fail(move != NULL);
+
+    if (policy == NULL) {
+        _psmove_led_policy_init(move);
+        return;
+    }
+
+    psmove_return_if_fail(policy->min_interval_ms >= 0);
+    psmove_return_if_fail(policy->keepalive_ms > 0);
+
+    move->led_min_interval_ms = policy->min_interval_ms;
+    move->led_keepalive_ms = policy->keepalive_ms;
+    move->led_adaptive = policy->adaptive;
+    move->led_link_adaptive = policy->link_adaptive;
+}
+
+void
+psmove_get_led_policy(PSMove *move, PSMoveLEDPolicy *policy)
+{
+    psmove_return_if_fail(move != NULL);
+    psmove_return_if_fail(policy != NULL);
+
+    policy->min_interval_ms = move->led_min_interval_ms;
+    policy->keepalive_ms = move->led_keepalive_ms;
+    policy->adaptive = move->led_adaptive;
+    policy->link_adaptive = move->led_link_adaptive;
+    policy->current_interval_ms = _psmove_led_min_interval(move);
+    policy->write_latency_us = __atomic_load_n(&(move->led_write_latency_us),
+            __ATOMIC_RELAXED);
+}
+
+enum PSMove_Bool
+psmove_enable_input_thread(PSMove *move, enum PSMove_Bool enabled)
+{
+    psmove_return_val_if_fail(move != NULL, PSMove_False);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    if (!PSMOVE_IS_LOCAL(move)) {
+        return PSMove_False;
+    }
+
+    if (enabled == move->input_read_thread_running) {
+        return PSMove_True;
+    }
+
+    if (enabled) {
+        move->input_ring = calloc(PSMOVE_INPUT_RING_SIZE,
+                sizeof(PSMove_Input_Ring_Entry));
+        if (move->input_ring == NULL) {
+            return PSMove_False;
+        }
+
+        move->input_ring_head = move->input_ring_tail = 0;
+        move->input_read_thread_running = PSMove_True;
+        if (pthread_create(&move->input_read_thread, NULL,
+                    _psmove_input_read_thread_proc, (void*)move) != 0) {
+            psmove_CRITICAL("Could not start input read thread");
+            move->input_read_thread_running = PSMove_False;
+            free(move->input_ring);
+            move->input_ring = NULL;
+            return PSMove_False;
+        }
+    } else {
+        __atomic_store_n(&(move->input_read_thread_running), PSMove_False,
+                __ATOMIC_RELEASE);
+        pthread_join(move->input_read_thread, NULL);
+
+        /* Reports still queued are dropped, psmove_poll() reads directly */
+        free(move->input_ring);
+        move->input_ring = NULL;
+        move->input_ring_head = move->input_ring_tail = 0;
+    }
+
+    return PSMove_True;
+#else
+    return PSMove_False;
+#endif
+}
+
+/* Account for a newly-received report with sequence number seq */
+static void
+_psmove_update_stats(PSMove *move, int seq)
+{
+    if (move->stats_reports > 0) {
+        if (seq == move->last_seq) {
+            move->stats_duplicate_reports++;
+        } else if (seq != ((move->last_seq + 1) % 16)) {
+            move->stats_sequence_gaps++;
+            move->stats_dropped_reports += (seq - move->last_seq - 1) & 0x0F;
+#ifdef PSMOVE_DEBUG
+            fprintf(stderr, "[PSMOVE] Warning: Dropped frames (seq %d -> %d)\n",
+                    move->last_seq, seq);
+#endif
+        }
+
+        long long interval = move->input_time_us - move->last_input_time_us;
+        move->stats_interval_sum_us += interval;
+        if (move->stats_reports == 1 || interval < move->stats_interval_min_us) {
+            move->stats_interval_min_us = interval;
+        }
+        if (interval > move->stats_interval_max_us) {
+            move->stats_interval_max_us = interval;
+        }
+    }
+
+    move->stats_reports++;
+    move->last_seq = seq;
+    move->last_input_time_us = move->input_time_us;
+
+#if defined(PSMOVE_USE_PTHREADS)
+    /* Otherwise already measured by the input thread */
+    if (!move->input_read_thread_running)
+#endif
+    {
+        _psmove_link_update(move, seq, move->input_time_us);
+    }
+}
+
+/**
+ * Queue an event if the buttons in the current report differ from the
+ * previous report (see psmove_get_button_event)
+ **/
+static void
+_psmove_queue_button_event(PSMove *move)
+{
+    unsigned int buttons = psmove_get_buttons(move);
+    PSMoveButtonEvent *event;
+
+    if (buttons == move->event_buttons) {
+        return;
+    }
+
+    if (move->button_events_head - move->button_events_tail ==
+            PSMOVE_BUTTON_EVENT_QUEUE_SIZE) {
+        /* Queue full - drop the oldest event */
+        move->button_events_tail++;
+    }
+
+    event = &(move->button_events[move->button_events_head %
+            PSMOVE_BUTTON_EVENT_QUEUE_SIZE]);
+    event->buttons = buttons;
+    event->pressed = buttons & ~(move->event_buttons);
+    event->released = move->event_buttons & ~buttons;
+    event->time_us = move->input_time_us;
+    event->timestamp = psmove_get_timestamp(move);
+    move->button_events_head++;
+
+    move->event_buttons = buttons;
+}
+
+/**
+ * Append the current input report of move to the active recording
+ **/
+static void
+_psmove_record_input(PSMove *move)
+{
+    if (move->record_epoch != psmove_recorder_epoch) {
+        /* Controllers may be polled from different threads */
+        move->record_device = __sync_fetch_and_add(&psmove_recorder_devices, 1);
+        move->record_epoch = psmove_recorder_epoch;
+
+        psmove_recorder_write(psmove_recorder, Record_Device,
+                move->record_device, move->input_time_us,
+                move->serial_number, strlen(move->serial_number));
+    }
+
+    psmove_recorder_write(psmove_recorder, Record_Input, move->record_device,
+            move->input_time_us, &(move->input), sizeof(move->input));
+}
+
+/**
+ * Take the next input report pushed by moved for a remote controller,
+ * waiting at most timeout_ms milliseconds for it (see MOVED_REQ_SUBSCRIBE).
+ * Unlike MOVED_REQ_READ, this does not cost a round trip per report. If
+ * moved does not push any reports (older versions), move->moved_polling is
+ * set and the caller falls back to requesting the reports.
+ **/
+static int
+_psmove_moved_pop_report(PSMove *move, int timeout_ms, long started)
+{
+    moved_client *client = move->client;
+    unsigned char input[MOVED_SIZE_INPUT];
+    long now = psmove_util_get_ticks();
+
+    moved_client_subscription *sub =
+        &(client->subscriptions[MOVED_DEVICE_SLOT(move->remote_id)]);
+
+    /* The subscription expires on the remote end if it is not renewed */
+    if (!sub->subscribed || now - sub->renewed_ms > MOVED_SUBSCRIPTION_RENEW_MS) {
+        if (!moved_client_subscribe(client, move->remote_id)) {
+            move->moved_polling = 1;
+            return 0;
+        }
+        if (move->moved_subscribed_ms == 0) {
+            move->moved_subscribed_ms = now;
+        }
+    }
+
+    while (1) {
+        /* The capture time at moved, so latencies include the network */
+        if (moved_client_pop_report(client, move->remote_id, input,
+                    &(move->input_time_us))) {
+            memcpy((unsigned char*)(&(move->input)), input,
+                    sizeof(move->input));
+            return sizeof(move->input);
+        }
+
+        long remaining = timeout_ms - (psmove_util_get_ticks() - started);
+        if (timeout_ms == 0 || (timeout_ms > 0 && remaining <= 0)) {
+            moved_client_receive(client, 0);
+            if (moved_client_pop_report(client, move->remote_id, input,
+                        &(move->input_time_us))) {
+                memcpy((unsigned char*)(&(move->input)), input,
+                        sizeof(move->input));
+                return sizeof(move->input);
+            }
+            break;
+        }
+
+        moved_client_receive(client, (timeout_ms < 0) ? 100 : remaining);
+    }
+
+    /* A controller sends reports all the time, so no report means no push */
+    if (sub->received_ms == 0 &&
+            now - move->moved_subscribed_ms > MOVED_SUBSCRIPTION_RENEW_MS) {
+#ifdef PSMOVE_DEBUG
+        fprintf(stderr, "[PSMOVE] moved on %s does not push reports, "
+                "polling instead\n", client->hostname);
+#endif
+        move->moved_polling = 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Read the next input report, waiting at most timeout_ms milliseconds for
+ * it to arrive (0 = don't wait, negative = wait forever). This implements
+ * both psmove_poll() and psmove_wait_for_input(). If orientation_pending
+ * is not NULL, the orientation is not updated here: Instead, it is set to
+ * nonzero if the new report still has to be integrated by the caller
+ * (psmove_poll_all() batches the updates of all controllers).
+ **/
+static int
+_psmove_poll_timeout(PSMove *move, int timeout_ms, int *orientation_pending)
+{
+    /* Reports from the input thread are integrated by that thread */
+    int integrated = 0;
+    int res = 0;
+    long started = psmove_util_get_ticks();
+    long remaining;
+
+    psmove_return_val_if_fail(move != NULL, 0);
+
+    switch (move->type) {
+        case PSMove_HIDAPI:
+        case PSMove_HIDRAW:
+#if defined(PSMOVE_USE_PTHREADS)
+            if (move->input_read_thread_running) {
+                while (1) {
+                    unsigned long generation = _psmove_input_generation();
+
+                    if (_psmove_input_ring_pop(move)) {
+                        res = sizeof(move->input);
+                        integrated = 1;
+                        break;
+                    }
+
+                    remaining = timeout_ms - (psmove_util_get_ticks() - started);
+                    if (timeout_ms == 0 || (timeout_ms > 0 && remaining <= 0)) {
+                        break;
+                    }
+
+                    _psmove_input_wait(generation,
+                            (timeout_ms < 0) ? -1 : remaining);
+                }
+                break;
+            }
+#endif
+            PSMOVE_TRACE_BEGIN("hid_read");
+            res = _psmove_device_read(move, (unsigned char*)(&(move->input)),
+                    sizeof(move->input), timeout_ms);
+            PSMOVE_TRACE_END("hid_read");
+            move->input_time_us = psmove_util_get_ticks_us();
+            break;
+        case PSMove_MOVED:
+            moved_client_flush_writes(move->client);
+            moved_client_update_clock(move->client);
+
+            if (!move->moved_polling) {
+                res = _psmove_moved_pop_report(move, timeout_ms, started);
+                if (!move->moved_polling) {
+                    break;
+                }
+            }
+
+            /**
+             * Without pushed reports, one request reads the reports of all
+             * controllers of the remote host; the other controllers then
+             * find theirs in the queue (so one round trip per frame)
+             **/
+            if (!move->client->read_all_unsupported) {
+                unsigned char input[MOVED_SIZE_INPUT];
+                while (1) {
+                    if (moved_client_pop_report(move->client, move->remote_id,
+                                input, &(move->input_time_us)) ||
+                            (moved_client_read_all(move->client) > 0 &&
+                             moved_client_pop_report(move->client,
+                                 move->remote_id, input,
+                                 &(move->input_time_us)))) {
+                        memcpy((unsigned char*)(&(move->input)), input,
+                                sizeof(move->input));
+                        res = sizeof(move->input);
+                        break;
+                    }
+
+                    remaining = timeout_ms - (psmove_util_get_ticks() - started);
+                    if (move->client->read_all_unsupported || timeout_ms == 0 ||
+                            (timeout_ms > 0 && remaining <= 0)) {
+                        break;
+                    }
+
+                    usleep(1000);
+                }
+
+                if (!move->client->read_all_unsupported) {
+                    break;
+                }
+            }
+
+            /**
+             * The remote end answers immediately with the result of its
+             * own psmove_poll(), so waiting means repeating the request
+             * (with a short pause) until data arrives or time runs out.
+             **/
+            while (moved_client_send(move->client, MOVED_REQ_READ,
+                        move->remote_id, NULL)) {
+                /**
+                 * The input buffer is stored at offset 1 (the first byte
+                 * contains the return value of the remote psmove_poll())
+                 **/
+                memcpy((unsigned char*)(&(move->input)),
+                        move->client->read_response_buf+1,
+                        sizeof(move->input));
+
+                /**
+                 * The first byte of the response contains the return value
+                 * of the remote psmove_poll() call - if it is nonzero, we
+                 * want to calculate a non-zero value locally (see below).
+                 *
+                 * See also _psmove_read_data() for how the buffer is filled
+                 * on the remote end of the moved protocol connection.
+                 **/
+                if (move->client->read_response_buf[0] != 0) {
+                    res = sizeof(move->input);
+                    move->input_time_us = psmove_util_get_ticks_us();
+                    break;
+                }
 
-int
-psmove_set_btaddr(PSMove *move, PSMove_Data_BTAddr *addr)
-{
-    unsigned char bts[PSMOVE_BTADDR_SET_SIZE];
-    int res;
-    int i;
+                remaining = timeout_ms - (psmove_util_get_ticks() - started);
+                if (timeout_ms == 0 || (timeout_ms > 0 && remaining <= 0)) {
+                    break;
+                }
 
-    psmove_return_val_if_fail(move != NULL, 0);
-    psmove_return_val_if_fail(addr != NULL, 0);
+                usleep(1000);
+            }
+            break;
+        case PSMove_REPLAY:
+            /* Use the recorded timestamp, so throughput tests are stable */
+            res = psmove_replay_read(move->replay,
+                    (unsigned char*)(&(move->input)), sizeof(move->input),
+                    timeout_ms, &(move->input_time_us));
+            break;
+        default:
+            psmove_CRITICAL("Unknown device type");
+    }
 
-    /* Get calibration data */
-    memset(bts, 0, sizeof(bts));
-    bts[0] = PSMove_Req_SetBTAddr;
+    if (res == sizeof(move->input)) {
+        /* Sanity check: The first byte should be PSMove_Req_GetInput */
+        psmove_return_val_if_fail(move->input.type == PSMove_Req_GetInput, 0);
 
-    /* Copy 6 bytes from addr into bts[1]..bts[6], reversed */
-    for (i=0; i<6; i++) {
-        bts[1+5-i] = (*addr)[i];
-    }
+        /**
+         * buttons4's 4 least significant bits contain the sequence number,
+         * so we add 1 to signal "success" and add the sequence number for
+         * consumers to utilize the data
+         **/
+        int seq = (move->input.buttons4 & 0x0F);
 
-    res = hid_send_feature_report(move->handle, bts, sizeof(bts));
+        /* Remember report spacing for the half-frame timestamps */
+        int timestamp = psmove_get_timestamp(move);
+        if (move->last_timestamp >= 0) {
+            move->timestamp_delta = (timestamp - move->last_timestamp) & 0xFFFF;
+        }
+        move->last_timestamp = timestamp;
 
-    return (res == sizeof(bts));
-}
+        _psmove_update_stats(move, seq);
 
-enum PSMove_Bool
-psmove_pair(PSMove *move)
-{
-    psmove_return_val_if_fail(move != NULL, 0);
+        _psmove_queue_button_event(move);
 
-    PSMove_Data_BTAddr btaddr;
+        if (!integrated) {
+            _psmove_aggregate_input(move, &(move->input), move->input_time_us,
+                    NULL);
+        }
 
-    if (!_psmove_read_btaddrs(move, &btaddr, NULL)) {
-        return PSMove_False;
-    }
+        if (psmove_recorder != NULL) {
+            _psmove_record_input(move);
+        }
 
+        if (move->orientation_enabled && move->orientation != NULL &&
+                !integrated) {
+            if (orientation_pending != NULL) {
+                *orientation_pending = 1;
+            } else {
+                psmove_orientation_update(move->orientation);
+            }
+        }
 
-#if defined(__APPLE__)
-    char *btaddr_string = macosx_get_btaddr();
-    if (!_psmove_btaddr_from_string(btaddr_string, &btaddr)) {
-        free(btaddr_string);
-        return PSMove_False;
+        return 1 + seq;
     }
-    free(btaddr_string);
-#elif defined(__linux)
-    hci_for_each_dev(HCI_UP, _psmove_linux_bt_dev_info, (long)btaddr);
-#elif defined(_WIN32)
-    HBLUETOOTH_RADIO_FIND hFind;
-    HANDLE hRadio;
-    BLUETOOTH_RADIO_INFO radioInfo;
-
-    BLUETOOTH_FIND_RADIO_PARAMS btfrp;
-    btfrp.dwSize = sizeof(BLUETOOTH_FIND_RADIO_PARAMS);
-    hFind = BluetoothFindFirstRadio(&btfrp, &hRadio);
 
-    psmove_return_val_if_fail(hFind != NULL, 0);
-    radioInfo.dwSize = sizeof(BLUETOOTH_RADIO_INFO);
+    move->stats_empty_polls++;
+    return 0;
+}
 
-    if (BluetoothGetRadioInfo(hRadio, &radioInfo) != ERROR_SUCCESS) {
-        psmove_CRITICAL("BluetoothGetRadioInfo");
-        CloseHandle(hRadio);
-        BluetoothFindRadioClose(hFind);
-        return PSMove_False;
-    }
+int
+psmove_poll(PSMove *move)
+{
+    int result;
 
-    int i;
-    for (i=0; i<6; i++) {
-        btaddr[i] = radioInfo.address.rgBytes[5-i];
-    }
+    PSMOVE_TRACE_BEGIN("psmove_poll");
+    result = _psmove_poll_timeout(move, 0, NULL);
+    PSMOVE_TRACE_END("psmove_poll");
 
-    CloseHandle(hRadio);
-    BluetoothFindRadioClose(hFind);
+    return result;
+}
 
-#else
-    /* TODO: Implement for other OSes (if any?) */
-    return PSMove_False;
-#endif
+int
+psmove_wait_for_input(PSMove *move, int timeout_ms)
+{
+    int result;
 
-    if (!psmove_set_btaddr(move, &btaddr)) {
-        return PSMove_False;
-    }
+    PSMOVE_TRACE_BEGIN("psmove_wait_for_input");
+    result = _psmove_poll_timeout(move, timeout_ms, NULL);
+    PSMOVE_TRACE_END("psmove_wait_for_input");
 
-    return PSMove_True;
+    return result;
 }
 
 enum PSMove_Bool
-psmove_pair_custom(PSMove *move, const char *btaddr_string)
+psmove_start_recording(const char *filename)
 {
-    psmove_return_val_if_fail(move != NULL, 0);
-
-    PSMove_Data_BTAddr btaddr;
+    psmove_return_val_if_fail(filename != NULL, PSMove_False);
 
-    if (!_psmove_read_btaddrs(move, &btaddr, NULL)) {
-        return PSMove_False;
-    }
+    psmove_stop_recording();
 
-    if (!_psmove_btaddr_from_string(btaddr_string, &btaddr)) {
+    psmove_recorder = psmove_recorder_new(filename);
+    if (psmove_recorder == NULL) {
         return PSMove_False;
     }
 
-    if (!psmove_set_btaddr(move, &btaddr)) {
-        return PSMove_False;
-    }
+    /* Reset before the new epoch becomes visible to the polling threads */
+    psmove_recorder_devices = 0;
+    __sync_add_and_fetch(&psmove_recorder_epoch, 1);
 
     return PSMove_True;
 }
 
-enum PSMove_Connection_Type
-psmove_connection_type(PSMove *move)
+void
+psmove_stop_recording()
 {
-    psmove_return_val_if_fail(move != NULL, Conn_Unknown);
-
-    if (move->type == PSMove_MOVED) {
-        return Conn_Bluetooth;
-    }
-
-#if defined(_WIN32)
-    if (move->is_bluetooth) {
-        return Conn_Bluetooth;
-    } else {
-        return Conn_USB;
-    }
-#endif
-
-    if (move->serial_number == NULL) {
-        return Conn_Unknown;
-    }
-
-    if (strlen(move->serial_number) == 0) {
-        return Conn_USB;
+    if (psmove_recorder != NULL) {
+        psmove_recorder_free(psmove_recorder);
+        psmove_recorder = NULL;
     }
-
-    return Conn_Bluetooth;
 }
 
-int
-_psmove_btaddr_from_string(const char *string, PSMove_Data_BTAddr *dest)
+enum PSMove_Bool
+psmove_get_link_quality(PSMove *move, PSMoveLinkQuality *quality)
 {
-    int i, value;
-    PSMove_Data_BTAddr tmp = {0};
+    psmove_return_val_if_fail(move != NULL, PSMove_False);
+    psmove_return_val_if_fail(quality != NULL, PSMove_False);
 
-    /* strlen("00:11:22:33:44:55") == 17 */
-    psmove_return_val_if_fail(strlen(string) == 17, 0);
+    long long last_us = __atomic_load_n(&(move->link_last_us), __ATOMIC_RELAXED);
+    long long now_us = psmove_util_get_ticks_us();
 
-    for (i=0; i<6; i++) {
-        value = strtol(string + i*3, NULL, 16);
-        psmove_return_val_if_fail(value >= 0x00 && value <= 0xFF, 0);
-        tmp[i] = value;
-    }
+    quality->quality = 0.f;
+    quality->report_rate = 0.f;
+    quality->last_report_ms = (last_us != 0) ? (now_us - last_us) / 1000 : -1;
 
-    if (dest != NULL) {
-        memcpy(*dest, tmp, sizeof(PSMove_Data_BTAddr));
+    if (last_us == 0 || now_us - last_us > PSMOVE_LINK_TIMEOUT_US) {
+        return PSMove_False;
     }
 
-    return 1;
+    quality->quality = 1.f - _psmove_link_loss(move);
+    __atomic_load(&(move->link_rate), &(quality->report_rate), __ATOMIC_RELAXED);
+    return PSMove_True;
 }
 
-char *
-_psmove_btaddr_to_string(const PSMove_Data_BTAddr addr)
+void
+psmove_get_stats(PSMove *move, PSMoveStats *stats)
 {
-    int size = 18; /* strlen("aa:bb:cc:dd:ee:ff") + 1 */
-    char *result = (char*)malloc(size);
-
-    snprintf(result, size, "%02hhx:%02hhx:%02hhx:%02hhx:%02hhx:%02hhx",
-            addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
-
-    return result;
+    psmove_return_if_fail(move != NULL);
+    psmove_return_if_fail(stats != NULL);
+
+    stats->reports = move->stats_reports;
+    stats->sequence_gaps = move->stats_sequence_gaps;
+    stats->dropped_reports = move->stats_dropped_reports;
+    stats->duplicate_reports = move->stats_duplicate_reports;
+    stats->empty_polls = move->stats_empty_polls;
+
+    if (move->stats_reports > 1) {
+        stats->min_interval_ms = move->stats_interval_min_us / 1000.f;
+        stats->mean_interval_ms = (move->stats_interval_sum_us /
+                (double)(move->stats_reports - 1)) / 1000.f;
+        stats->max_interval_ms = move->stats_interval_max_us / 1000.f;
+    } else {
+        stats->min_interval_ms = 0.f;
+        stats->mean_interval_ms = 0.f;
+        stats->max_interval_ms = 0.f;
+    }
 }
 
-void
-psmove_set_leds(PSMove *move, unsigned char r, unsigned char g,
-        unsigned char b)
+enum PSMove_Bool
+psmove_set_aggregation(PSMove *move, int window_ms)
 {
-    psmove_return_if_fail(move != NULL);
+    psmove_return_val_if_fail(move != NULL, PSMove_False);
 
-    if (move->leds.r == r && move->leds.g == g && move->leds.b == b) {
-        /**
-         * Avoid extraneous LED updates - this does not set the "leds_dirty"
-         * flag below, so we don't have to send an update the next time.
-         **/
-        return;
+    if (move->aggregator == NULL) {
+        if (window_ms < 0) {
+            return PSMove_True;
+        }
+
+        /* Remote controllers have no calibration, their values stay raw */
+        int calibrated = (move->calibration != NULL &&
+                psmove_has_calibration(move));
+        __atomic_store_n(&(move->aggregator),
+                psmove_aggregator_new(window_ms, calibrated), __ATOMIC_RELEASE);
+    } else {
+        psmove_aggregator_set_window(move->aggregator, window_ms);
     }
 
-    move->leds.r = r;
-    move->leds.g = g;
-    move->leds.b = b;
-    move->leds_dirty = 1;
+    return PSMove_True;
 }
 
-void
-psmove_set_rumble(PSMove *move, unsigned char rumble)
+enum PSMove_Bool
+psmove_get_aggregate(PSMove *move, PSMoveAggregate *aggregate)
 {
-    psmove_return_if_fail(move != NULL);
+    psmove_return_val_if_fail(move != NULL, PSMove_False);
+    psmove_return_val_if_fail(aggregate != NULL, PSMove_False);
 
-    if (move->leds.rumble == rumble) {
-        /* Avoid extraneous updates (see psmove_set_leds above) */
-        return;
+    if (move->aggregator == NULL) {
+        memset(aggregate, 0, sizeof(*aggregate));
+        return PSMove_False;
     }
 
-    move->leds.rumble2 = 0x00;
-    move->leds.rumble = rumble;
-    move->leds_dirty = 1;
+    return psmove_aggregator_get(move->aggregator, aggregate);
 }
 
-enum PSMove_Update_Result
-psmove_update_leds(PSMove *move)
+size_t
+psmove_get_memory_usage(PSMove *move)
 {
-    int res;
-    long timediff_ms;
+    size_t usage;
 
     psmove_return_val_if_fail(move != NULL, 0);
 
-    timediff_ms = (psmove_util_get_ticks() - move->last_leds_update);
+    usage = sizeof(PSMove);
 
-    if (move->leds_rate_limiting &&
-            move->leds_dirty && timediff_ms < PSMOVE_MIN_LED_UPDATE_WAIT_MS) {
-        /* Rate limiting (too many updates) */
-        return Update_Ignored;
-    } else if (!move->leds_dirty && timediff_ms < PSMOVE_MAX_LED_INHIBIT_MS) {
-        /* Unchanged LEDs value (no need to update yet) */
-        return Update_Ignored;
+    if (move->serial_number != NULL) {
+        usage += strlen(move->serial_number) + 1;
     }
 
-    move->leds_dirty = 0;
-    move->last_leds_update = psmove_util_get_ticks();
-
-    switch (move->type) {
-        case PSMove_HIDAPI:
 #if defined(PSMOVE_USE_PTHREADS)
-            pthread_mutex_lock(&(move->led_write_mutex));
-            move->led_write_thread_write_queued = 1;
-            pthread_cond_signal(&(move->led_write_new_data));
-            pthread_mutex_unlock(&(move->led_write_mutex));
-            return Update_Success;
-#else
-            res = hid_write(move->handle, (unsigned char*)(&(move->leds)),
-                    sizeof(move->leds));
-            if (res == sizeof(move->leds)) {
-                return Update_Success;
-            } else {
-                return Update_Failed;
-            }
+    if (move->input_ring != NULL) {
+        usage += PSMOVE_INPUT_RING_SIZE * sizeof(PSMove_Input_Ring_Entry);
+    }
 #endif
-            break;
-        case PSMove_MOVED:
-            moved_client_send(move->client, MOVED_REQ_WRITE,
-                    move->remote_id, (unsigned char*)(&move->leds));
-            return Update_Success; // XXX: Error handling
-            break;
-        default:
-            psmove_CRITICAL("Unknown device type");
-            return 0;
-            break;
+
+    if (move->calibration != NULL) {
+        usage += psmove_calibration_get_memory_usage(move->calibration);
     }
+
+    if (move->orientation != NULL) {
+        usage += psmove_orientation_get_memory_usage(move->orientation);
+    }
+
+    if (move->aggregator != NULL) {
+        usage += psmove_aggregator_get_memory_usage(move->aggregator);
+    }
+
+    return usage;
 }
 
 void
-psmove_set_rate_limiting(PSMove *move, enum PSMove_Bool enabled)
+psmove_reset_stats(PSMove *move)
 {
     psmove_return_if_fail(move != NULL);
-    move->leds_rate_limiting = enabled;
+
+    move->stats_reports = 0;
+    move->stats_sequence_gaps = 0;
+    move->stats_dropped_reports = 0;
+    move->stats_duplicate_reports = 0;
+    move->stats_empty_polls = 0;
+    move->stats_interval_sum_us = 0;
+    move->stats_interval_min_us = 0;
+    move->stats_interval_max_us = 0;
 }
 
-int
-psmove_poll(PSMove *move)
+unsigned int
+psmove_poll_all(PSMove **moves, int count, int timeout_ms)
 {
-    int res = 0;
+    PSMoveOrientation *orientations[32];
+    PSMoveOrientationSample samples[32];
+    int orientation_count;
+    unsigned int result;
+    long started = psmove_util_get_ticks();
+    long remaining;
+    int waitable;
+    int i;
 
-    psmove_return_val_if_fail(move != NULL, 0);
+    psmove_return_val_if_fail(moves != NULL, 0);
+    psmove_return_val_if_fail(count >= 0 && count <= 32, 0);
 
-#ifdef PSMOVE_DEBUG
-    /* store old sequence number before reading */
-    int oldseq = (move->input.buttons4 & 0x0F);
-#endif
+    /* Check all handles first, so no reports are consumed and then lost */
+    for (i=0; i<count; i++) {
+        psmove_return_val_if_fail(moves[i] != NULL, 0);
+    }
 
-    switch (move->type) {
-        case PSMove_HIDAPI:
-            res = hid_read(move->handle, (unsigned char*)(&(move->input)),
-                sizeof(move->input));
-            break;
-        case PSMove_MOVED:
-            if (moved_client_send(move->client, MOVED_REQ_READ,
-                        move->remote_id, NULL)) {
-                /**
-                 * The input buffer is stored at offset 1 (the first byte
-                 * contains the return value of the remote psmove_poll())
-                 **/
-                memcpy((unsigned char*)(&(move->input)),
-                        move->client->read_response_buf+1,
-                        sizeof(move->input));
+#if defined(PSMOVE_USE_PTHREADS)
+    /**
+     * Waiting for all controllers at once needs their input threads (only
+     * local controllers have one); they keep running after we return
+     **/
+    if (timeout_ms != 0) {
+        for (i=0; i<count; i++) {
+            if (PSMOVE_IS_LOCAL(moves[i]) &&
+                    !moves[i]->input_read_thread_running) {
+                psmove_enable_input_thread(moves[i], PSMove_True);
+            }
+        }
+    }
+#endif
 
-                /**
-                 * The first byte of the response contains the return value
-                 * of the remote psmove_poll() call - if it is nonzero, we
-                 * want to calculate a non-zero value locally (see below).
-                 *
-                 * See also _psmove_read_data() for how the buffer is filled
-                 * on the remote end of the moved protocol connection.
-                 **/
-                if (move->client->read_response_buf[0] != 0) {
-                    res = sizeof(move->input);
+    while (1) {
+#if defined(PSMOVE_USE_PTHREADS)
+        unsigned long generation = _psmove_input_generation();
+#endif
+
+        result = 0;
+        waitable = 1;
+        orientation_count = 0;
+        for (i=0; i<count; i++) {
+            int orientation_pending = 0;
+            PSMOVE_TRACE_BEGIN("psmove_poll");
+            int polled = _psmove_poll_timeout(moves[i], 0,
+                    &orientation_pending);
+            PSMOVE_TRACE_END("psmove_poll");
+            if (polled) {
+                result |= (1u << i);
+
+                if (orientation_pending) {
+                    _psmove_get_orientation_sample(moves[i], &(moves[i]->input),
+                            moves[i]->input_time_us, &samples[orientation_count]);
+                    orientations[orientation_count++] = moves[i]->orientation;
                 }
             }
-            break;
-        default:
-            psmove_CRITICAL("Unknown device type");
-    }
 
-    if (res == sizeof(move->input)) {
-        /* Sanity check: The first byte should be PSMove_Req_GetInput */
-        psmove_return_val_if_fail(move->input.type == PSMove_Req_GetInput, 0);
+#if defined(PSMOVE_USE_PTHREADS)
+            if (!moves[i]->input_read_thread_running) {
+                waitable = 0;
+            }
+#else
+            waitable = 0;
+#endif
+        }
 
-        /**
-         * buttons4's 4 least significant bits contain the sequence number,
-         * so we add 1 to signal "success" and add the sequence number for
-         * consumers to utilize the data
-         **/
-        int seq = (move->input.buttons4 & 0x0F);
-#ifdef PSMOVE_DEBUG
-        if (seq != ((oldseq + 1) % 16)) {
-            fprintf(stderr, "[PSMOVE] Warning: Dropped frames (seq %d -> %d)\n",
-                    oldseq, seq);
+        if (orientation_count > 0) {
+            psmove_orientation_update_batch(orientations, samples,
+                    orientation_count);
         }
-#endif
 
-        if (move->orientation_enabled) {
-            psmove_orientation_update(move->orientation);
+        if (result != 0 || timeout_ms == 0) {
+            return result;
         }
 
-        return 1 + seq;
-    }
+        remaining = timeout_ms - (psmove_util_get_ticks() - started);
+        if (timeout_ms > 0 && remaining <= 0) {
+            return 0;
+        }
 
-    return 0;
+        if (!waitable) {
+            /**
+             * At least one controller has no input thread (a remote or
+             * replayed one, or there is no thread support), so there's
+             * nothing to wait on - poll again.
+             **/
+            usleep(1000);
+            continue;
+        }
+
+#if defined(PSMOVE_USE_PTHREADS)
+        _psmove_input_wait(generation, (timeout_ms < 0) ? -1 : remaining);
+#endif
+    }
 }
 
 unsigned int
@@ -1084,10 +3458,7 @@ psmove_get_buttons(PSMove *move)
 {
     psmove_return_val_if_fail(move != NULL, 0);
 
-    return ((move->input.buttons2) |
-            (move->input.buttons1 << 8) |
-            ((move->input.buttons3 & 0x01) << 16) |
-            ((move->input.buttons4 & 0xF0) << 13));
+    return _psmove_input_buttons(&(move->input));
 }
 
 void
@@ -1109,6 +3480,23 @@ psmove_get_button_events(PSMove *move, unsigned int *pressed,
     move->last_buttons = buttons;
 }
 
+int
+psmove_get_button_event(PSMove *move, PSMoveButtonEvent *event)
+{
+    psmove_return_val_if_fail(move != NULL, 0);
+    psmove_return_val_if_fail(event != NULL, 0);
+
+    if (move->button_events_tail == move->button_events_head) {
+        return 0;
+    }
+
+    memcpy(event, &(move->button_events[move->button_events_tail %
+                PSMOVE_BUTTON_EVENT_QUEUE_SIZE]), sizeof(*event));
+    move->button_events_tail++;
+
+    return 1;
+}
+
 enum PSMove_Battery_Level
 psmove_get_battery(PSMove *move)
 {
@@ -1134,6 +3522,34 @@ psmove_get_trigger(PSMove *move)
     return (move->input.trigger + move->input.trigger2) / 2;
 }
 
+int
+psmove_get_timestamp(PSMove *move)
+{
+    psmove_return_val_if_fail(move != NULL, 0);
+
+    return ((move->input.timehigh << 8) | move->input.timelow);
+}
+
+int
+psmove_get_frame_timestamp(PSMove *move, enum PSMove_Frame frame)
+{
+    psmove_return_val_if_fail(move != NULL, 0);
+    psmove_return_val_if_fail(frame == Frame_FirstHalf ||
+            frame == Frame_SecondHalf, 0);
+
+    int timestamp = psmove_get_timestamp(move);
+
+    if (frame == Frame_FirstHalf) {
+        /**
+         * The first half-frame was sampled half-way between the previous
+         * report and this one (the report timestamp is the second half)
+         **/
+        timestamp = (timestamp - move->timestamp_delta / 2) & 0xFFFF;
+    }
+
+    return timestamp;
+}
+
 void
 psmove_get_half_frame(PSMove *move, enum PSMove_Sensor sensor,
         enum PSMove_Frame frame, int *x, int *y, int *z)
@@ -1172,6 +3588,204 @@ psmove_get_half_frame(PSMove *move, enum PSMove_Sensor sensor,
     }
 }
 
+long long
+_psmove_get_input_time_us(PSMove *move)
+{
+    psmove_return_val_if_fail(move != NULL, 0);
+
+    return move->input_time_us;
+}
+
+const char *
+_psmove_get_transport(PSMove *move)
+{
+    psmove_return_val_if_fail(move != NULL, NULL);
+
+    switch (move->type) {
+        case PSMove_HIDAPI:
+            return "hidapi";
+        case PSMove_HIDRAW:
+            return "hidraw";
+        case PSMove_MOVED:
+            return (move->client->shm != NULL) ? "moved-shm" : "moved";
+        case PSMove_REPLAY:
+            return "replay";
+    }
+
+    return "unknown";
+}
+
+int
+_psmove_get_queued_reports(PSMove *move)
+{
+    psmove_return_val_if_fail(move != NULL, 0);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    return __atomic_load_n(&(move->input_ring_head), __ATOMIC_ACQUIRE) -
+        move->input_ring_tail;
+#else
+    return 0;
+#endif
+}
+
+void
+_psmove_get_calibrated_sensors(PSMove *move, float *output)
+{
+    psmove_return_if_fail(move != NULL);
+
+    psmove_calibration_map_sensors(move->calibration,
+            (unsigned char*)&(move->input.aXlow), output);
+}
+
+enum PSMove_Bool
+psmove_get_sample(PSMove *move, PSMoveSample *sample)
+{
+    psmove_return_val_if_fail(move != NULL, PSMove_False);
+    psmove_return_val_if_fail(sample != NULL, PSMove_False);
+
+    char *data = (char*)&(move->input);
+    int calibrated = (move->calibration != NULL &&
+            psmove_calibration_supported(move->calibration));
+    float values[PSMOVE_SENSOR_VALUES];
+    int frame;
+
+    sample->buttons = psmove_get_buttons(move);
+    sample->trigger[Frame_FirstHalf] = move->input.trigger;
+    sample->trigger[Frame_SecondHalf] = move->input.trigger2;
+    sample->battery = move->input.battery;
+    sample->temperature = psmove_get_temperature(move);
+
+    if (calibrated) {
+        psmove_calibration_map_sensors(move->calibration,
+                (unsigned char*)&(move->input.aXlow), values);
+    } else {
+        memset(values, 0, sizeof(values));
+    }
+
+    for (frame=Frame_FirstHalf; frame<=Frame_SecondHalf; frame++) {
+        int accel = offsetof(PSMove_Data_Input, aXlow) + 6 * frame;
+        int gyro = offsetof(PSMove_Data_Input, gXlow) + 6 * frame;
+
+        sample->timestamp[frame] = psmove_get_frame_timestamp(move, frame);
+
+        sample->raw_accel_x[frame] = psmove_decode_16bit(data, accel + 0);
+        sample->raw_accel_y[frame] = psmove_decode_16bit(data, accel + 2);
+        sample->raw_accel_z[frame] = psmove_decode_16bit(data, accel + 4);
+        sample->raw_gyro_x[frame] = psmove_decode_16bit(data, gyro + 0);
+        sample->raw_gyro_y[frame] = psmove_decode_16bit(data, gyro + 2);
+        sample->raw_gyro_z[frame] = psmove_decode_16bit(data, gyro + 4);
+
+        sample->accel_x[frame] = values[frame*3 + 0];
+        sample->accel_y[frame] = values[frame*3 + 1];
+        sample->accel_z[frame] = values[frame*3 + 2];
+        sample->gyro_x[frame] = values[6 + frame*3 + 0];
+        sample->gyro_y[frame] = values[6 + frame*3 + 1];
+        sample->gyro_z[frame] = values[6 + frame*3 + 2];
+    }
+
+    psmove_get_magnetometer(move, &(sample->mag_x), &(sample->mag_y),
+            &(sample->mag_z));
+
+    return PSMove_True;
+}
+
+int
+psmove_get_sample_version()
+{
+    return PSMOVE_SAMPLE_VERSION;
+}
+
+/* The exported versions of the accessors (see psmove_sample.h) */
+#define PSMOVE_SAMPLE_DEFINITIONS
+#include "psmove_sample.h"
+
+enum PSMove_Update_Result
+psmove_update_state(PSMove *move, PSMoveState *state)
+{
+    psmove_return_val_if_fail(move != NULL, Update_Failed);
+    psmove_return_val_if_fail(state != NULL, Update_Failed);
+
+    unsigned int previous, buttons;
+
+    if (state->r >= 0 && state->g >= 0 && state->b >= 0) {
+        psmove_set_leds(move, state->r, state->g, state->b);
+    }
+
+    if (state->rumble >= 0) {
+        psmove_set_rumble(move, state->rumble);
+    }
+
+    state->reports = 0;
+    state->buttons_any = 0;
+    state->pressed = 0;
+    state->released = 0;
+
+    /* Button changes are collected per report, as they would be lost
+     * if we only looked at the newest report of the queue. The edges are
+     * taken against our own snapshot, so psmove_get_button_events() still
+     * sees all of them. */
+    previous = psmove_get_buttons(move);
+    while (psmove_poll(move)) {
+        buttons = psmove_get_buttons(move);
+        state->reports++;
+        state->buttons_any |= buttons;
+        state->pressed |= buttons & ~previous;
+        state->released |= previous & ~buttons;
+        previous = buttons;
+    }
+
+    state->buttons = psmove_get_buttons(move);
+    state->trigger = psmove_get_trigger(move);
+    state->battery = move->input.battery;
+    state->temperature = psmove_get_temperature(move);
+
+    psmove_get_accelerometer(move, &(state->raw_accel_x),
+            &(state->raw_accel_y), &(state->raw_accel_z));
+    psmove_get_gyroscope(move, &(state->raw_gyro_x),
+            &(state->raw_gyro_y), &(state->raw_gyro_z));
+    psmove_get_magnetometer(move, &(state->mag_x), &(state->mag_y),
+            &(state->mag_z));
+
+    if (psmove_has_calibration(move)) {
+        psmove_get_accelerometer_frame(move, Frame_SecondHalf,
+                &(state->accel_x), &(state->accel_y), &(state->accel_z));
+        psmove_get_gyroscope_frame(move, Frame_SecondHalf,
+                &(state->gyro_x), &(state->gyro_y), &(state->gyro_z));
+    } else {
+        state->accel_x = state->accel_y = state->accel_z = 0.f;
+        state->gyro_x = state->gyro_y = state->gyro_z = 0.f;
+    }
+
+    if (move->orientation != NULL && move->orientation_enabled) {
+        psmove_get_orientation(move, &(state->q0), &(state->q1),
+                &(state->q2), &(state->q3));
+    } else {
+        state->q0 = 1.f;
+        state->q1 = state->q2 = state->q3 = 0.f;
+    }
+
+    state->update_result = psmove_update_leds(move);
+    return state->update_result;
+}
+
+int
+psmove_update_states(PSMove **moves, PSMoveState *states, int count)
+{
+    psmove_return_val_if_fail(moves != NULL, 0);
+    psmove_return_val_if_fail(states != NULL, 0);
+
+    int connected = 0;
+    int i;
+
+    for (i=0; i<count; i++) {
+        if (psmove_update_state(moves[i], &(states[i])) != Update_Failed) {
+            connected++;
+        }
+    }
+
+    return connected;
+}
+
 void
 psmove_get_accelerometer(PSMove *move, int *ax, int *ay, int *az)
 {
@@ -1255,6 +3869,29 @@ psmove_has_calibration(PSMove *move)
     return psmove_calibration_supported(move->calibration);
 }
 
+void
+psmove_load_calibration_async(PSMove *move)
+{
+    psmove_return_if_fail(move != NULL);
+
+    /* Remote controllers have no calibration (nothing to load) */
+    if (move->calibration != NULL) {
+        psmove_calibration_load_async(move->calibration);
+    }
+}
+
+enum PSMove_Bool
+psmove_is_calibration_loaded(PSMove *move)
+{
+    psmove_return_val_if_fail(move != NULL, PSMove_False);
+
+    if (move->calibration == NULL) {
+        return PSMove_True;
+    }
+
+    return psmove_calibration_is_loaded(move->calibration);
+}
+
 void
 psmove_dump_calibration(PSMove *move)
 {
@@ -1285,11 +3922,34 @@ psmove_get_magnetometer(PSMove *move, int *mx, int *my, int *mz)
 }
 
 
+/**
+ * Get the orientation of a controller, creating it on first use (this
+ * loads the calibration data, which isn't done when connecting).
+ * Returns NULL if the controller has no calibration.
+ **/
+static PSMoveOrientation *
+_psmove_get_orientation(PSMove *move)
+{
+    if (move->orientation == NULL && psmove_has_calibration(move)) {
+        PSMoveOrientation *orientation = psmove_orientation_new(move);
+
+        /* The input thread uses it as soon as it is set and enabled */
+        __sync_synchronize();
+        move->orientation = orientation;
+    }
+
+    return move->orientation;
+}
+
 void
 psmove_enable_orientation(PSMove *move, enum PSMove_Bool enabled)
 {
     psmove_return_if_fail(move != NULL);
 
+    if (enabled) {
+        _psmove_get_orientation(move);
+    }
+
     move->orientation_enabled = enabled;
 }
 
@@ -1297,7 +3957,7 @@ enum PSMove_Bool
 psmove_has_orientation(PSMove *move)
 {
     psmove_return_val_if_fail(move != NULL, 0);
-    psmove_return_val_if_fail(move->orientation != NULL, 0);
+    psmove_return_val_if_fail(_psmove_get_orientation(move) != NULL, 0);
 
     return move->orientation_enabled;
 }
@@ -1307,21 +3967,79 @@ psmove_get_orientation(PSMove *move,
         float *q0, float *q1, float *q2, float *q3)
 {
     psmove_return_if_fail(move != NULL);
-    psmove_return_if_fail(move->orientation != NULL);
+    psmove_return_if_fail(_psmove_get_orientation(move) != NULL);
 
     psmove_orientation_get_quaternion(move->orientation, q0, q1, q2, q3);
 }
 
+void
+psmove_get_orientation_predicted(PSMove *move, int dt_us,
+        float *q0, float *q1, float *q2, float *q3)
+{
+    psmove_return_if_fail(move != NULL);
+    psmove_return_if_fail(_psmove_get_orientation(move) != NULL);
+
+    psmove_orientation_get_quaternion_predicted(move->orientation, dt_us,
+            q0, q1, q2, q3);
+}
+
 void
 psmove_set_orientation(PSMove *move,
         float q0, float q1, float q2, float q3)
 {
     psmove_return_if_fail(move != NULL);
-    psmove_return_if_fail(move->orientation != NULL);
+    psmove_return_if_fail(_psmove_get_orientation(move) != NULL);
 
     psmove_orientation_set_quaternion(move->orientation, q0, q1, q2, q3);
 }
 
+enum PSMove_Bool
+psmove_enable_lazy_orientation(PSMove *move, enum PSMove_Bool enabled)
+{
+    psmove_return_val_if_fail(move != NULL, PSMove_False);
+
+    if (_psmove_get_orientation(move) == NULL) {
+        return PSMove_False;
+    }
+
+    psmove_orientation_set_lazy(move->orientation, enabled);
+    return PSMove_True;
+}
+
+enum PSMove_Bool
+psmove_set_orientation_filter(PSMove *move,
+        enum PSMove_Orientation_Filter filter)
+{
+    psmove_return_val_if_fail(move != NULL, PSMove_False);
+
+    if (_psmove_get_orientation(move) == NULL) {
+        return PSMove_False;
+    }
+
+    return psmove_orientation_set_filter(move->orientation, filter);
+}
+
+float
+psmove_get_orientation_filter_cost(PSMove *move)
+{
+    psmove_return_val_if_fail(move != NULL, 0.);
+    psmove_return_val_if_fail(_psmove_get_orientation(move) != NULL, 0.);
+
+    return psmove_orientation_get_filter_cost(move->orientation);
+}
+
+enum PSMove_Bool
+psmove_is_still(PSMove *move)
+{
+    psmove_return_val_if_fail(move != NULL, PSMove_False);
+
+    if (_psmove_get_orientation(move) == NULL || !move->orientation_enabled) {
+        return PSMove_False;
+    }
+
+    return psmove_orientation_is_still(move->orientation);
+}
+
 
 void
 psmove_disconnect(PSMove *move)
@@ -1329,31 +4047,39 @@ psmove_disconnect(PSMove *move)
     psmove_return_if_fail(move != NULL);
 
 #if defined(PSMOVE_USE_PTHREADS)
-    while (pthread_tryjoin_np(move->led_write_thread, NULL) != 0) {
-        pthread_mutex_lock(&(move->led_write_mutex));
-        pthread_cond_signal(&(move->led_write_new_data));
-        pthread_mutex_unlock(&(move->led_write_mutex));
-    }
+    psmove_enable_input_thread(move, PSMove_False);
 
-    pthread_mutex_destroy(&(move->led_write_mutex));
-    pthread_cond_destroy(&(move->led_write_new_data));
+    if (PSMOVE_IS_LOCAL(move)) {
+        _psmove_led_writer_remove(move);
+    }
 #endif
 
+    if (move->orientation) {
+        psmove_orientation_free(move->orientation);
+    }
+
+    if (move->aggregator) {
+        psmove_aggregator_free(move->aggregator);
+    }
+
+    /* Before closing the device, a background load might still use it */
+    if (move->calibration) {
+        psmove_calibration_free(move->calibration);
+    }
+
     switch (move->type) {
         case PSMove_HIDAPI:
             hid_close(move->handle);
             break;
+        case PSMove_HIDRAW:
+            close(move->fd);
+            break;
         case PSMove_MOVED:
             // XXX: Close connection?
             break;
-    }
-
-    if (move->orientation) {
-        psmove_orientation_free(move->orientation);
-    }
-
-    if (move->calibration) {
-        psmove_calibration_free(move->calibration);
+        case PSMove_REPLAY:
+            psmove_replay_free(move->replay);
+            break;
     }
 
     free(move->serial_number);
@@ -1361,14 +4087,34 @@ psmove_disconnect(PSMove *move)
 
     /* Bookkeeping of open handles (for psmove_reinit) */
     psmove_return_if_fail(psmove_num_open_handles > 0);
-    psmove_num_open_handles--;
+    __sync_sub_and_fetch(&psmove_num_open_handles, 1);
 }
 
-long
-psmove_util_get_ticks()
+/**
+ * The clock value of the first call, which is the zero of the ticks. The
+ * reader, writer and tracker threads may all make the first call at once,
+ * so the first value stored wins (and is returned to all of them).
+ **/
+static long long
+_psmove_util_ticks_base(long long now)
+{
+    static long long startup_time = 0;
+    long long base = __atomic_load_n(&startup_time, __ATOMIC_ACQUIRE);
+
+    if (base == 0) {
+        base = __sync_val_compare_and_swap(&startup_time, 0, now);
+        if (base == 0) {
+            base = now;
+        }
+    }
+
+    return base;
+}
+
+long long
+psmove_util_get_ticks_us()
 {
-#ifdef WIN32
-    static LARGE_INTEGER startup_time = { .QuadPart = 0 };
+#if defined(_WIN32)
     static LARGE_INTEGER frequency = { .QuadPart = 0 };
     LARGE_INTEGER now;
 
@@ -1378,30 +4124,37 @@ psmove_util_get_ticks()
 
     psmove_return_val_if_fail(QueryPerformanceCounter(&now), 0);
 
-    /* The first time this function gets called, we init startup_time */
-    if (startup_time.QuadPart == 0) {
-        startup_time.QuadPart = now.QuadPart;
-    }
+    /* Split into seconds and remainder to avoid overflowing the product */
+    long long ticks = now.QuadPart - _psmove_util_ticks_base(now.QuadPart);
+    return (ticks / frequency.QuadPart) * 1000000 +
+        (ticks % frequency.QuadPart) * 1000000 / frequency.QuadPart;
+#elif defined(__APPLE__)
+    mach_timebase_info_data_t timebase;
+    uint64_t now = mach_absolute_time();
+    uint64_t base = (uint64_t)_psmove_util_ticks_base((long long)now);
 
-    return (long)((now.QuadPart - startup_time.QuadPart) * 1000 /
-            frequency.QuadPart);
-#else
-    static long startup_time = 0;
-    long now;
-    struct timeval tv;
+    /* Cached by the system, and a local copy can't be seen half-written */
+    mach_timebase_info(&timebase);
 
-    psmove_return_val_if_fail(gettimeofday(&tv, NULL) == 0, 0);
-    now = (tv.tv_sec * 1000 + tv.tv_usec / 1000);
+    return (long long)((now - base) * timebase.numer /
+            timebase.denom / 1000);
+#else
+    long long now;
+    struct timespec ts;
 
-    /* The first time this function gets called, we init startup_time */
-    if (startup_time == 0) {
-        startup_time = now;
-    }
+    psmove_return_val_if_fail(clock_gettime(CLOCK_MONOTONIC, &ts) == 0, 0);
+    now = ((long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
 
-    return (now - startup_time);
+    return (now - _psmove_util_ticks_base(now));
 #endif
 }
 
+long
+psmove_util_get_ticks()
+{
+    return (long)(psmove_util_get_ticks_us() / 1000);
+}
+
 const char *
 psmove_util_get_data_dir()
 {
@@ -0,0 +1,268 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "psmove_private.h"
+#include "psmove_aggregate.h"
+
+#if defined(PSMOVE_USE_PTHREADS)
+#  include <pthread.h>
+#  define aggregator_lock(a) pthread_mutex_lock(&((a)->lock))
+#  define aggregator_unlock(a) pthread_mutex_unlock(&((a)->lock))
+#else
+#  define aggregator_lock(a)
+#  define aggregator_unlock(a)
+#endif
+
+/* The running sums of a window (index 0: accelerometer, 1: gyroscope) */
+typedef struct {
+    int reports;
+    long long start_us;
+    long long end_us;
+    double sum[2][3];
+    double sum_squares[2][3];
+    float min[2][3];
+    float max[2][3];
+    int trigger_peak;
+    unsigned int buttons;
+    unsigned int pressed;
+} PSMoveAggregatorWindow;
+
+struct _PSMoveAggregator {
+    int window_ms;
+    int calibrated;
+
+    /* The window reports are added to */
+    PSMoveAggregatorWindow current;
+
+    /* The last complete window, and if it has been read already */
+    PSMoveAggregatorWindow complete;
+    int complete_fresh;
+
+    /* Buttons of the previous report (for "pressed") */
+    unsigned int last_buttons;
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_t lock;
+#endif
+};
+
+
+static void
+psmove_aggregator_reset(PSMoveAggregatorWindow *window)
+{
+    memset(window, 0, sizeof(*window));
+}
+
+PSMoveAggregator *
+psmove_aggregator_new(int window_ms, int calibrated)
+{
+    PSMoveAggregator *aggregator = calloc(1, sizeof(PSMoveAggregator));
+
+    aggregator->window_ms = window_ms;
+    aggregator->calibrated = calibrated;
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_init(&(aggregator->lock), NULL);
+#endif
+
+    return aggregator;
+}
+
+void
+psmove_aggregator_set_window(PSMoveAggregator *aggregator, int window_ms)
+{
+    psmove_return_if_fail(aggregator != NULL);
+
+    aggregator_lock(aggregator);
+    __atomic_store_n(&(aggregator->window_ms), window_ms, __ATOMIC_RELAXED);
+    psmove_aggregator_reset(&(aggregator->current));
+    aggregator->complete_fresh = 0;
+    aggregator_unlock(aggregator);
+}
+
+int
+psmove_aggregator_enabled(PSMoveAggregator *aggregator)
+{
+    psmove_return_val_if_fail(aggregator != NULL, 0);
+
+    return __atomic_load_n(&(aggregator->window_ms), __ATOMIC_RELAXED) >= 0;
+}
+
+int
+psmove_aggregator_calibrated(PSMoveAggregator *aggregator)
+{
+    psmove_return_val_if_fail(aggregator != NULL, 0);
+
+    return aggregator->calibrated;
+}
+
+void
+psmove_aggregator_add(PSMoveAggregator *aggregator, const float *sensors,
+        int trigger, unsigned int buttons, long long time_us)
+{
+    PSMoveAggregatorWindow *window;
+    int frame, sensor, axis;
+
+    psmove_return_if_fail(aggregator != NULL);
+    psmove_return_if_fail(sensors != NULL);
+
+    aggregator_lock(aggregator);
+
+    if (aggregator->window_ms < 0) {
+        aggregator_unlock(aggregator);
+        return;
+    }
+
+    window = &(aggregator->current);
+
+    /* Close a fixed-length window with the first report after its end */
+    if (aggregator->window_ms > 0 && window->reports > 0 &&
+            time_us - window->start_us >= aggregator->window_ms * 1000LL) {
+        aggregator->complete = *window;
+        aggregator->complete_fresh = 1;
+        psmove_aggregator_reset(window);
+    }
+
+    if (window->reports == 0) {
+        window->start_us = time_us;
+        for (sensor=0; sensor<2; sensor++) {
+            for (axis=0; axis<3; axis++) {
+                window->min[sensor][axis] = sensors[sensor*6 + axis];
+                window->max[sensor][axis] = sensors[sensor*6 + axis];
+            }
+        }
+    }
+
+    /* Both half-frames of the report are samples of the window */
+    for (sensor=0; sensor<2; sensor++) {
+        for (frame=0; frame<2; frame++) {
+            for (axis=0; axis<3; axis++) {
+                float value = sensors[sensor*6 + frame*3 + axis];
+                window->sum[sensor][axis] += value;
+                window->sum_squares[sensor][axis] += value * value;
+                if (value < window->min[sensor][axis]) {
+                    window->min[sensor][axis] = value;
+                }
+                if (value > window->max[sensor][axis]) {
+                    window->max[sensor][axis] = value;
+                }
+            }
+        }
+    }
+
+    if (trigger > window->trigger_peak) {
+        window->trigger_peak = trigger;
+    }
+    window->buttons |= buttons;
+    window->pressed |= buttons & ~(aggregator->last_buttons);
+    aggregator->last_buttons = buttons;
+
+    window->end_us = time_us;
+    window->reports++;
+
+    aggregator_unlock(aggregator);
+}
+
+enum PSMove_Bool
+psmove_aggregator_get(PSMoveAggregator *aggregator, PSMoveAggregate *aggregate)
+{
+    PSMoveAggregatorWindow window;
+    int fresh;
+    int sensor, axis;
+
+    psmove_return_val_if_fail(aggregator != NULL, PSMove_False);
+    psmove_return_val_if_fail(aggregate != NULL, PSMove_False);
+
+    aggregator_lock(aggregator);
+    if (aggregator->window_ms == 0) {
+        /* The window ends with this call */
+        window = aggregator->current;
+        fresh = (window.reports > 0);
+        psmove_aggregator_reset(&(aggregator->current));
+    } else {
+        window = aggregator->complete;
+        fresh = aggregator->complete_fresh;
+        aggregator->complete_fresh = 0;
+    }
+    aggregator_unlock(aggregator);
+
+    /* The expensive part happens outside of the lock */
+    memset(aggregate, 0, sizeof(*aggregate));
+    aggregate->reports = window.reports;
+    aggregate->start_us = window.start_us;
+    aggregate->end_us = window.end_us;
+    aggregate->calibrated = aggregator->calibrated;
+    aggregate->trigger_peak = window.trigger_peak;
+    aggregate->buttons = window.buttons;
+    aggregate->pressed = window.pressed;
+
+    if (window.reports > 0) {
+        double samples = 2. * window.reports;
+        float *mean[2] = { aggregate->accel_mean, aggregate->gyro_mean };
+        float *min[2] = { aggregate->accel_min, aggregate->gyro_min };
+        float *max[2] = { aggregate->accel_max, aggregate->gyro_max };
+        float *rms[2] = { aggregate->accel_rms, aggregate->gyro_rms };
+
+        for (sensor=0; sensor<2; sensor++) {
+            for (axis=0; axis<3; axis++) {
+                mean[sensor][axis] = window.sum[sensor][axis] / samples;
+                min[sensor][axis] = window.min[sensor][axis];
+                max[sensor][axis] = window.max[sensor][axis];
+                rms[sensor][axis] = sqrt(window.sum_squares[sensor][axis] / samples);
+            }
+        }
+    }
+
+    return fresh ? PSMove_True : PSMove_False;
+}
+
+size_t
+psmove_aggregator_get_memory_usage(PSMoveAggregator *aggregator)
+{
+    psmove_return_val_if_fail(aggregator != NULL, 0);
+
+    return sizeof(PSMoveAggregator);
+}
+
+void
+psmove_aggregator_free(PSMoveAggregator *aggregator)
+{
+    psmove_return_if_fail(aggregator != NULL);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_destroy(&(aggregator->lock));
+#endif
+
+    free(aggregator);
+}
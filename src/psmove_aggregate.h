@@ -0,0 +1,103 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+
+
+#ifndef PSMOVE_AGGREGATE_H
+#define PSMOVE_AGGREGATE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "psmove.h"
+#include "psmove_calibration.h"
+
+
+/**
+ * Summaries of the input reports over time windows (see
+ * psmove_set_aggregation()). Reports are added by the thread that reads
+ * them, the windows can be read from any other thread.
+ **/
+struct _PSMoveAggregator;
+typedef struct _PSMoveAggregator PSMoveAggregator;
+
+ADDAPI PSMoveAggregator *
+ADDCALL psmove_aggregator_new(int window_ms, int calibrated);
+
+/**
+ * Set the length of the windows (0: until the next psmove_aggregator_get())
+ * and start a new window. Reports are ignored if window_ms is negative.
+ **/
+ADDAPI void
+ADDCALL psmove_aggregator_set_window(PSMoveAggregator *aggregator, int window_ms);
+
+/**
+ * Nonzero if reports are added (the window length is not negative)
+ **/
+ADDAPI int
+ADDCALL psmove_aggregator_enabled(PSMoveAggregator *aggregator);
+
+/**
+ * Nonzero if the sensor values are calibrated (fixed at creation)
+ **/
+ADDAPI int
+ADDCALL psmove_aggregator_calibrated(PSMoveAggregator *aggregator);
+
+/**
+ * Add the values of one report: sensors are the PSMOVE_SENSOR_VALUES
+ * values (see psmove_calibration_map_sensors()), time_us is the host
+ * time of the report.
+ **/
+ADDAPI void
+ADDCALL psmove_aggregator_add(PSMoveAggregator *aggregator,
+        const float *sensors, int trigger, unsigned int buttons,
+        long long time_us);
+
+/**
+ * Get the most recent complete window, see psmove_get_aggregate()
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_aggregator_get(PSMoveAggregator *aggregator,
+        PSMoveAggregate *aggregate);
+
+/**
+ * Memory used by the aggregator (in bytes), see psmove_get_memory_usage()
+ **/
+ADDAPI size_t
+ADDCALL psmove_aggregator_get_memory_usage(PSMoveAggregator *aggregator);
+
+ADDAPI void
+ADDCALL psmove_aggregator_free(PSMoveAggregator *aggregator);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
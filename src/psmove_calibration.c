@@ -38,31 +38,118 @@
 #include <assert.h>
 #include <libgen.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#  include <sys/mman.h>
+#endif
+
+#if defined(PSMOVE_USE_PTHREADS)
+#  include <pthread.h>
+#endif
+
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#  include <arm_neon.h>
+#endif
 
 #define PSMOVE_CALIBRATION_EXTENSION ".calibration"
 
+/* Binary cache of parsed calibration data of all known controllers */
+#define PSMOVE_CALIBRATION_CACHE_FILENAME "calibration.cache"
+#define PSMOVE_CALIBRATION_CACHE_MAGIC "PSMC"
+#define PSMOVE_CALIBRATION_CACHE_VERSION 2
+
+/* Size of the serial number field ("aa_bb_cc_dd_ee_ff" + padding) */
+#define PSMOVE_CALIBRATION_CACHE_SERIAL_SIZE 32
+
 enum _PSMoveCalibrationFlag {
     CalibrationFlag_None = 0,
     CalibrationFlag_HaveUSB,
 };
 
+/* Sensors with an affine mapping (index into PSMoveCalibration.matrix) */
+enum _PSMoveCalibrationSensor {
+    CalibrationSensor_Accelerometer = 0,
+    CalibrationSensor_Gyroscope,
+    CalibrationSensor_Count,
+};
+
+/* One column of a mapping matrix, padded to 4 floats */
+#define PSMOVE_CALIBRATION_COLUMN 4
+
 struct _PSMoveCalibration {
     PSMove *move;
 
+    /**
+     * Nonzero once the calibration data has been loaded. The data is only
+     * loaded on first use (see psmove_calibration_ensure_loaded()), as
+     * reading it from the controller is the slowest part of connecting.
+     **/
+    int loaded;
+
+#if defined(PSMOVE_USE_PTHREADS)
+    /* Serializes loading (on first use, or in the background thread) */
+    pthread_mutex_t load_lock;
+
+    /* Background thread started by psmove_calibration_load_async() */
+    pthread_t load_thread;
+    int load_thread_started;
+#endif
+
     char usb_calibration[PSMOVE_CALIBRATION_BLOB_SIZE];
     int flags;
 
     char *filename;
 
-    /* Pre-calculated factors for accelerometer mapping */
-    float ax, ay, az;
+    /**
+     * Pre-calculated affine mapping [M | o] of each sensor, including
+     * cross-axis terms: calibrated = M * raw + o. The 3x4 matrix is stored
+     * column by column (M's three columns, then o), each column padded to
+     * 4 floats and aligned to 16 bytes for loading into vector registers
+     * (see psmove_calibration_map_sensors()).
+     **/
+    float matrix[CalibrationSensor_Count][4][PSMOVE_CALIBRATION_COLUMN]
+        __attribute__((aligned(16)));
+};
+
 
-    /* Pre-calculated summands for accelerometer mapping */
-    float bx, by, bz;
+/* Header of the calibration cache file, followed by "count" entries */
+typedef struct {
+    char magic[4];
+    int version;
+    int entry_size;
+    int count;
+} PSMoveCalibrationCacheHeader;
 
-    /* Pre-calculated factors for gyroscope mapping */
-    float gx, gy, gz;
-};
+/* One controller in the calibration cache file */
+typedef struct {
+    char serial[PSMOVE_CALIBRATION_CACHE_SERIAL_SIZE];
+    char usb_calibration[PSMOVE_CALIBRATION_BLOB_SIZE];
+    int flags;
+
+    /* Pre-calculated mapping matrices (see PSMoveCalibration.matrix) */
+    float matrix[CalibrationSensor_Count][4][PSMOVE_CALIBRATION_COLUMN];
+} PSMoveCalibrationCacheEntry;
+
+/* The calibration cache file, mapped into memory on first use */
+static const char *psmove_calibration_cache = NULL;
+static size_t psmove_calibration_cache_size = 0;
+
+#if defined(PSMOVE_USE_PTHREADS)
+/* Protects the calibration cache (controllers can be connected in parallel) */
+static pthread_mutex_t psmove_calibration_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+#  define psmove_calibration_cache_lock() \
+        pthread_mutex_lock(&psmove_calibration_cache_mutex)
+#  define psmove_calibration_cache_unlock() \
+        pthread_mutex_unlock(&psmove_calibration_cache_mutex)
+#else
+#  define psmove_calibration_cache_lock()
+#  define psmove_calibration_cache_unlock()
+#endif
 
 
 /* PRIVATE FUNCTION DEFINITIONS - ONLY USED IN THIS MODULE DIRECTLY */
@@ -80,6 +167,44 @@ struct _PSMoveCalibration {
 int
 psmove_calibration_read_from_usb(PSMoveCalibration *calibration);
 
+/**
+ * Pre-calculate the matrices used for mapping input from the calibration
+ * blob (or pass-through matrices if no calibration data is available).
+ **/
+void
+psmove_calibration_compute_matrices(PSMoveCalibration *calibration);
+
+/**
+ * Map the calibration cache file into memory (if it exists and is valid)
+ **/
+void
+psmove_calibration_cache_open();
+
+/**
+ * Unmap the calibration cache file
+ **/
+void
+psmove_calibration_cache_close();
+
+/**
+ * Find the cache entry for a serial number (as used in the filename).
+ *
+ * Returns a pointer into the mapped cache, or NULL if not found.
+ **/
+const PSMoveCalibrationCacheEntry *
+psmove_calibration_cache_lookup(const char *serial);
+
+/**
+ * Add or replace the cache entry for a serial number.
+ *
+ * The cache functions must be called with the cache lock held.
+ *
+ * Returns nonzero on success, zero on error.
+ **/
+int
+psmove_calibration_cache_store(PSMoveCalibration *calibration,
+        const char *serial);
+
 /**
  * Load the calibration from persistent storage.
  *
@@ -88,6 +213,22 @@ psmove_calibration_read_from_usb(PSMoveCalibration *calibration);
 int
 psmove_calibration_load(PSMoveCalibration *calibration);
 
+/**
+ * Load the calibration data (from the cache, from disk or from USB) and
+ * pre-calculate the mapping matrices, if this hasn't been done yet.
+ **/
+void
+psmove_calibration_ensure_loaded(PSMoveCalibration *calibration);
+
+/**
+ * Check the calibration flags without loading the calibration data
+ **/
+static int
+psmove_calibration_have_usb(PSMoveCalibration *calibration)
+{
+    return (calibration->flags & CalibrationFlag_HaveUSB) != 0;
+}
+
 /**
  * Save the calibration to persistent storage.
  *
@@ -160,91 +301,437 @@ psmove_calibration_parse_usb(PSMoveCalibration *calibration)
 }
 
 void
-psmove_calibration_get_usb_accel_values(PSMoveCalibration *calibration,
-        int *x1, int *x2, int *y1, int *y2, int *z1, int *z2)
+psmove_calibration_dump_usb(PSMoveCalibration *calibration)
 {
+    int j;
+
     assert(calibration != NULL);
-    assert(psmove_calibration_supported(calibration));
-    char *data = calibration->usb_calibration;
 
-    int orientation;
+    for (j=0; j<sizeof(calibration->usb_calibration); j++) {
+        printf("%02hhx", calibration->usb_calibration[j]);
+        if (j % 16 == 15) {
+            printf("\n");
+        } else if (j < sizeof(calibration->usb_calibration)-1) {
+            printf(" ");
+        }
+    }
+    printf("\n");
 
-    /* Minimum (negative) value of each axis */
-    orientation = 1;
-    *x1 = psmove_calibration_decode(data, 0x04 + 6*orientation);
-    orientation = 5;
-    *y1 = psmove_calibration_decode(data, 0x04 + 6*orientation + 2);
-    orientation = 2;
-    *z1 = psmove_calibration_decode(data, 0x04 + 6*orientation + 4);
-
-    /* Maximum (positive) values of each axis */
-    orientation = 3;
-    *x2 = psmove_calibration_decode(data, 0x04 + 6*orientation);
-    orientation = 4;
-    *y2 = psmove_calibration_decode(data, 0x04 + 6*orientation + 2);
-    orientation = 0;
-    *z2 = psmove_calibration_decode(data, 0x04 + 6*orientation + 4);
+    psmove_calibration_parse_usb(calibration);
+    printf("\n");
 }
 
 
-void
-psmove_calibration_get_usb_gyro_values(PSMoveCalibration *calibration,
-        int *x, int *y, int *z)
+/* Gravity direction of the 6 accelerometer readings in the USB blob */
+static const int
+psmove_calibration_accel_orientations[6][3] = {
+    { 0,  0, +1},
+    {-1,  0,  0},
+    { 0,  0, -1},
+    {+1,  0,  0},
+    { 0, +1,  0},
+    { 0, -1,  0},
+};
+
+/**
+ * Invert a 3x3 matrix (stored as in PSMoveCalibration.matrix, columns first)
+ *
+ * Returns nonzero on success, zero if the matrix is (nearly) singular.
+ **/
+static int
+psmove_calibration_invert(const float in[3][3], float out[3][3])
 {
-    assert(calibration != NULL);
-    assert(psmove_calibration_supported(calibration));
-    char *data = calibration->usb_calibration;
+    /* Cofactors of the first row of the (transposed) matrix */
+    float c00 = in[1][1] * in[2][2] - in[2][1] * in[1][2];
+    float c01 = in[2][1] * in[0][2] - in[0][1] * in[2][2];
+    float c02 = in[0][1] * in[1][2] - in[1][1] * in[0][2];
+    float det = in[0][0] * c00 + in[1][0] * c01 + in[2][0] * c02;
+    float scale = fabsf(in[0][0]) + fabsf(in[1][1]) + fabsf(in[2][2]);
+
+    if (fabsf(det) <= 1e-6f * scale * scale * scale) {
+        return 0;
+    }
 
-    int bx, by, bz; /* Bias(?) values, need to sustract those */
-    bx = psmove_calibration_decode(data, 0x2a);
-    by = psmove_calibration_decode(data, 0x2a + 2);
-    bz = psmove_calibration_decode(data, 0x2a + 4);
+    out[0][0] = c00 / det;
+    out[0][1] = c01 / det;
+    out[0][2] = c02 / det;
+    out[1][0] = (in[2][0] * in[1][2] - in[1][0] * in[2][2]) / det;
+    out[1][1] = (in[0][0] * in[2][2] - in[2][0] * in[0][2]) / det;
+    out[1][2] = (in[1][0] * in[0][2] - in[0][0] * in[1][2]) / det;
+    out[2][0] = (in[1][0] * in[2][1] - in[2][0] * in[1][1]) / det;
+    out[2][1] = (in[2][0] * in[0][1] - in[0][0] * in[2][1]) / det;
+    out[2][2] = (in[0][0] * in[1][1] - in[1][0] * in[0][1]) / det;
 
-    int orientation;
+    return 1;
+}
 
-    orientation = 0;
-    *x = psmove_calibration_decode(data, 0x46 + 8*orientation) - bx;
-    orientation = 1;
-    *y = psmove_calibration_decode(data, 0x46 + 8*orientation + 2) - by;
-    orientation = 2;
-    *z = psmove_calibration_decode(data, 0x46 + 8*orientation + 4) - bz;
+/**
+ * Set a mapping matrix to a diagonal (per-axis) mapping
+ **/
+static void
+psmove_calibration_set_diagonal(float m[4][PSMOVE_CALIBRATION_COLUMN],
+        float fx, float fy, float fz, float cx, float cy, float cz)
+{
+    memset(m, 0, sizeof(float) * 4 * PSMOVE_CALIBRATION_COLUMN);
+    m[0][0] = fx;
+    m[1][1] = fy;
+    m[2][2] = fz;
+    m[3][0] = cx;
+    m[3][1] = cy;
+    m[3][2] = cz;
 }
 
+/**
+ * Pre-calculate the values used for mapping input from the USB blob
+ **/
 void
-psmove_calibration_dump_usb(PSMoveCalibration *calibration)
+psmove_calibration_compute_matrices(PSMoveCalibration *calibration)
 {
-    int j;
+    float (*accel)[PSMOVE_CALIBRATION_COLUMN] =
+        calibration->matrix[CalibrationSensor_Accelerometer];
+    float (*gyro)[PSMOVE_CALIBRATION_COLUMN] =
+        calibration->matrix[CalibrationSensor_Gyroscope];
+
+    if (psmove_calibration_have_usb(calibration)) {
+        char *data = calibration->usb_calibration;
+        float sensitivity[3][3];
+        float inverse[3][3];
+        float bias[3];
+        int orientation, axis, row;
 
-    assert(calibration != NULL);
+        /**
+         *
+         * Calculation of accelerometer mapping (as factor of gravity, 1g):
+         *
+         * The blob contains the full raw X/Y/Z reading for each of the six
+         * orientations where one axis points up or down (g = +/- 1g along
+         * that axis). We model the sensor as:
+         *
+         *  raw = S * g + b
+         *
+         * with:
+         *
+         *  S ... 3x3 sensitivity matrix (off-diagonal: cross-axis terms)
+         *  b ... Raw reading at 0g
+         *
+         * The least-squares fit to the six readings is:
+         *
+         *  b = mean of all six readings
+         *  S column j = (reading at +1g along j - reading at -1g along j) / 2
+         *
+         * Then we get:
+         *
+         *  calibrated = S^-1 * raw - S^-1 * b
+         *
+         * Without cross-axis terms, this is the same as the per-axis
+         * mapping f * raw + c with f = 2 / (high - low) and
+         * c = - (f * low) - 1 (low/high: raw reading at -1g/+1g).
+         *
+         **/
 
-    for (j=0; j<sizeof(calibration->usb_calibration); j++) {
-        printf("%02hhx", calibration->usb_calibration[j]);
-        if (j % 16 == 15) {
-            printf("\n");
-        } else if (j < sizeof(calibration->usb_calibration)-1) {
-            printf(" ");
+        memset(sensitivity, 0, sizeof(sensitivity));
+        memset(bias, 0, sizeof(bias));
+
+        for (orientation=0; orientation<6; orientation++) {
+            const int *up = psmove_calibration_accel_orientations[orientation];
+            for (row=0; row<3; row++) {
+                float value = (float)psmove_calibration_decode(data,
+                        0x04 + 6*orientation + 2*row);
+                bias[row] += value / 6.f;
+                for (axis=0; axis<3; axis++) {
+                    sensitivity[axis][row] += value * (float)up[axis] / 2.f;
+                }
+            }
         }
+
+        if (psmove_calibration_invert((const float (*)[3])sensitivity, inverse)) {
+            for (axis=0; axis<3; axis++) {
+                for (row=0; row<3; row++) {
+                    accel[axis][row] = inverse[axis][row];
+                }
+                accel[axis][3] = 0.f;
+            }
+            for (row=0; row<3; row++) {
+                accel[3][row] = - (inverse[0][row] * bias[0] +
+                        inverse[1][row] * bias[1] + inverse[2][row] * bias[2]);
+            }
+            accel[3][3] = 0.f;
+        } else {
+            /* Fall back to the per-axis mapping */
+            float f[3];
+            for (axis=0; axis<3; axis++) {
+                f[axis] = 1.f / sensitivity[axis][axis];
+            }
+            psmove_calibration_set_diagonal(accel, f[0], f[1], f[2],
+                    - f[0] * bias[0], - f[1] * bias[1], - f[2] * bias[2]);
+        }
+
+        /**
+         * Calculation of gyroscope mapping (in radiant per second):
+         *
+         * The blob contains the full raw X/Y/Z reading while rotating
+         * around each axis at 80 RPM, and a bias(?) vector that needs to
+         * be subtracted from those readings. With:
+         *
+         *  R ... 3x3 matrix, column j = reading at 80 RPM around j - bias
+         *
+         *         2 * PI * 80
+         *  f = ----------------  (80 RPM in rad/s)
+         *            60
+         *
+         * we get (raw readings are not biased):
+         *
+         *  calibrated = f * R^-1 * raw
+         *
+         * Without cross-axis terms, this is the same as the per-axis
+         * mapping f * raw / rpm80 (rpm80: reading at 80 RPM).
+         *
+         **/
+
+        float factor = (2.f * M_PI * 80.f) / 60.f;
+
+        for (row=0; row<3; row++) {
+            bias[row] = (float)psmove_calibration_decode(data, 0x2a + 2*row);
+        }
+
+        for (axis=0; axis<3; axis++) {
+            for (row=0; row<3; row++) {
+                sensitivity[axis][row] = (float)psmove_calibration_decode(data,
+                        0x46 + 8*axis + 2*row) - bias[row];
+            }
+        }
+
+        if (psmove_calibration_invert((const float (*)[3])sensitivity, inverse)) {
+            memset(gyro, 0, sizeof(float) * 4 * PSMOVE_CALIBRATION_COLUMN);
+            for (axis=0; axis<3; axis++) {
+                for (row=0; row<3; row++) {
+                    gyro[axis][row] = factor * inverse[axis][row];
+                }
+            }
+        } else {
+            /* Fall back to the per-axis mapping */
+            psmove_calibration_set_diagonal(gyro,
+                    factor / sensitivity[0][0], factor / sensitivity[1][1],
+                    factor / sensitivity[2][2], 0.f, 0.f, 0.f);
+        }
+    } else {
+        /* No calibration data - pass-through input data */
+        psmove_calibration_set_diagonal(accel, 1.f, 1.f, 1.f, 0.f, 0.f, 0.f);
+        psmove_calibration_set_diagonal(gyro, 1.f, 1.f, 1.f, 0.f, 0.f, 0.f);
     }
-    printf("\n");
+}
 
-    psmove_calibration_parse_usb(calibration);
-    printf("\n");
+const PSMoveCalibrationCacheEntry *
+psmove_calibration_cache_lookup(const char *serial)
+{
+    const PSMoveCalibrationCacheHeader *header;
+    const PSMoveCalibrationCacheEntry *entries;
+    int i;
+
+    if (psmove_calibration_cache == NULL) {
+        psmove_calibration_cache_open();
+    }
+
+    if (psmove_calibration_cache == NULL) {
+        return NULL;
+    }
+
+    header = (const PSMoveCalibrationCacheHeader*)psmove_calibration_cache;
+    entries = (const PSMoveCalibrationCacheEntry*)(header + 1);
+
+    for (i=0; i<header->count; i++) {
+        if (strncmp(entries[i].serial, serial,
+                    PSMOVE_CALIBRATION_CACHE_SERIAL_SIZE) == 0) {
+            return &(entries[i]);
+        }
+    }
+
+    return NULL;
 }
 
+void
+psmove_calibration_cache_open()
+{
+    char *filename = psmove_util_get_file_path(PSMOVE_CALIBRATION_CACHE_FILENAME);
+    const PSMoveCalibrationCacheHeader *header;
+    struct stat st;
+    char *data = NULL;
+    int fd;
+
+    psmove_return_if_fail(filename != NULL);
 
+    fd = open(filename, O_RDONLY);
+    free(filename);
 
-PSMoveCalibration *
-psmove_calibration_new(PSMove *move)
+    if (fd == -1) {
+        return;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(PSMoveCalibrationCacheHeader)) {
+        close(fd);
+        return;
+    }
+
+#ifdef _WIN32
+    /* No mmap() on Windows - read the (small) file into memory instead */
+    data = malloc(st.st_size);
+    if (read(fd, data, st.st_size) != st.st_size) {
+        free(data);
+        data = NULL;
+    }
+#else
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        data = NULL;
+    }
+#endif
+    close(fd);
+
+    if (data == NULL) {
+        return;
+    }
+
+    psmove_calibration_cache = data;
+    psmove_calibration_cache_size = st.st_size;
+
+    header = (const PSMoveCalibrationCacheHeader*)data;
+    if (memcmp(header->magic, PSMOVE_CALIBRATION_CACHE_MAGIC, 4) != 0 ||
+            header->version != PSMOVE_CALIBRATION_CACHE_VERSION ||
+            header->entry_size != sizeof(PSMoveCalibrationCacheEntry) ||
+            st.st_size < sizeof(PSMoveCalibrationCacheHeader) +
+            header->count * sizeof(PSMoveCalibrationCacheEntry)) {
+#ifdef PSMOVE_DEBUG
+        fprintf(stderr, "[PSMOVE] Ignoring invalid calibration cache\n");
+#endif
+        psmove_calibration_cache_close();
+    }
+}
+
+void
+psmove_calibration_cache_close()
 {
-    PSMove_Data_BTAddr addr;
-    char *serial;
+    if (psmove_calibration_cache != NULL) {
+#ifdef _WIN32
+        free((void*)psmove_calibration_cache);
+#else
+        munmap((void*)psmove_calibration_cache, psmove_calibration_cache_size);
+#endif
+    }
+
+    psmove_calibration_cache = NULL;
+    psmove_calibration_cache_size = 0;
+}
+
+int
+psmove_calibration_cache_store(PSMoveCalibration *calibration,
+        const char *serial)
+{
+    PSMoveCalibrationCacheHeader header;
+    PSMoveCalibrationCacheEntry entry;
+    const PSMoveCalibrationCacheHeader *old_header = NULL;
+    const PSMoveCalibrationCacheEntry *old_entries = NULL;
+    char *filename;
+    char *tmp_filename;
+    FILE *fp;
     int i;
 
+    if (psmove_calibration_cache == NULL) {
+        psmove_calibration_cache_open();
+    }
+
+    memset(&entry, 0, sizeof(entry));
+    strncpy(entry.serial, serial, sizeof(entry.serial) - 1);
+    memcpy(entry.usb_calibration, calibration->usb_calibration,
+            sizeof(entry.usb_calibration));
+    entry.flags = calibration->flags;
+    memcpy(entry.matrix, calibration->matrix, sizeof(entry.matrix));
+
+    memcpy(header.magic, PSMOVE_CALIBRATION_CACHE_MAGIC, 4);
+    header.version = PSMOVE_CALIBRATION_CACHE_VERSION;
+    header.entry_size = sizeof(PSMoveCalibrationCacheEntry);
+    header.count = 1;
+
+    if (psmove_calibration_cache != NULL) {
+        old_header = (const PSMoveCalibrationCacheHeader*)psmove_calibration_cache;
+        old_entries = (const PSMoveCalibrationCacheEntry*)(old_header + 1);
+        for (i=0; i<old_header->count; i++) {
+            if (strncmp(old_entries[i].serial, entry.serial,
+                        sizeof(entry.serial)) != 0) {
+                header.count++;
+            }
+        }
+    }
+
+    filename = psmove_util_get_file_path(PSMOVE_CALIBRATION_CACHE_FILENAME);
+    psmove_return_val_if_fail(filename != NULL, 0);
+
+    /* Write to a temporary file first, then replace the old cache */
+    tmp_filename = malloc(strlen(filename) + strlen(".tmp") + 1);
+    strcpy(tmp_filename, filename);
+    strcat(tmp_filename, ".tmp");
+
+    fp = fopen(tmp_filename, "wb");
+    if (fp == NULL) {
+        free(tmp_filename);
+        free(filename);
+        return 0;
+    }
+
+    fwrite(&header, sizeof(header), 1, fp);
+    if (old_header != NULL) {
+        for (i=0; i<old_header->count; i++) {
+            if (strncmp(old_entries[i].serial, entry.serial,
+                        sizeof(entry.serial)) != 0) {
+                fwrite(&(old_entries[i]), sizeof(entry), 1, fp);
+            }
+        }
+    }
+    fwrite(&entry, sizeof(entry), 1, fp);
+    fclose(fp);
+
+    psmove_calibration_cache_close();
+
+#ifdef _WIN32
+    /* rename() doesn't replace existing files on Windows */
+    remove(filename);
+#endif
+    rename(tmp_filename, filename);
+
+    free(tmp_filename);
+    free(filename);
+
+    return 1;
+}
+
+PSMoveCalibration *
+psmove_calibration_new(PSMove *move)
+{
     PSMoveCalibration *calibration =
         (PSMoveCalibration*)calloc(1, sizeof(PSMoveCalibration));
 
     calibration->move = move;
 
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_init(&(calibration->load_lock), NULL);
+#endif
+
+    /* Pass-through mapping until the calibration data has been loaded */
+    psmove_calibration_compute_matrices(calibration);
+
+    return calibration;
+}
+
+/**
+ * Load the calibration data of the controller (called once, on first use)
+ **/
+static void
+psmove_calibration_load_all(PSMoveCalibration *calibration)
+{
+    PSMove *move = calibration->move;
+    PSMove_Data_BTAddr addr;
+    char *serial;
+    int i;
+
     if (psmove_connection_type(move) == Conn_USB) {
         _psmove_read_btaddrs(move, NULL, &addr);
         serial = _psmove_btaddr_to_string(addr);
@@ -266,11 +753,26 @@ psmove_calibration_new(PSMove *move)
     calibration->filename = psmove_util_get_file_path(template);
 
     free(template);
-    free(serial);
+
+    /* Fast path: Everything is already in the calibration cache */
+    psmove_calibration_cache_lock();
+    const PSMoveCalibrationCacheEntry *entry =
+        psmove_calibration_cache_lookup(serial);
+    if (entry != NULL) {
+        memcpy(calibration->usb_calibration, entry->usb_calibration,
+                sizeof(calibration->usb_calibration));
+        calibration->flags = entry->flags;
+        memcpy(calibration->matrix, entry->matrix, sizeof(calibration->matrix));
+        psmove_calibration_cache_unlock();
+
+        free(serial);
+        return;
+    }
+    psmove_calibration_cache_unlock();
 
     /* Try to load the calibration data from disk, or from USB */
     psmove_calibration_load(calibration);
-    if (!psmove_calibration_supported(calibration)) {
+    if (!psmove_calibration_have_usb(calibration)) {
         if (psmove_connection_type(move) == Conn_USB) {
 #ifdef PSMOVE_DEBUG
             fprintf(stderr, "[PSMOVE] Storing calibration from USB\n");
@@ -280,112 +782,82 @@ psmove_calibration_new(PSMove *move)
         }
     }
 
-    /* Pre-calculate values used for mapping input */
-    if (psmove_calibration_supported(calibration)) {
-        /* Accelerometer reading (high/low) for each axis */
-        int axlow, axhigh, aylow, ayhigh, azlow, azhigh;
-        psmove_calibration_get_usb_accel_values(calibration,
-                &axlow, &axhigh, &aylow, &ayhigh, &azlow, &azhigh);
+    psmove_calibration_compute_matrices(calibration);
 
-        /**
-         *
-         * Calculation of accelermeter mapping (as factor of gravity, 1g):
-         *
-         *                2 * (raw - low)
-         *  calibrated = ----------------  - 1
-         *                 (high - low)
-         *
-         * with:
-         *
-         *  raw .... Raw sensor reading
-         *  low .... Raw reading at -1g
-         *  high ... Raw reading at +1g
-         *
-         * Now define:
-         *
-         *            2
-         *  f = --------------
-         *       (high - low)
-         *
-         * And combine constants:
-         *
-         *  c = - (f * low) - 1
-         *
-         * Then we get:
-         *
-         *  calibrated = f * raw + c
-         *
-         **/
+    if (psmove_calibration_have_usb(calibration)) {
+        psmove_calibration_cache_lock();
+        psmove_calibration_cache_store(calibration, serial);
+        psmove_calibration_cache_unlock();
+    }
 
-        /* Accelerometer factors "f" */
-        calibration->ax = 2.f / (float)(axhigh - axlow);
-        calibration->ay = 2.f / (float)(ayhigh - aylow);
-        calibration->az = 2.f / (float)(azhigh - azlow);
+    free(serial);
+}
 
-        /* Accelerometer constants "c" */
-        calibration->bx = - (calibration->ax * (float)axlow) - 1.f;
-        calibration->by = - (calibration->ay * (float)aylow) - 1.f;
-        calibration->bz = - (calibration->az * (float)azlow) - 1.f;
+void
+psmove_calibration_ensure_loaded(PSMoveCalibration *calibration)
+{
+#if defined(PSMOVE_USE_PTHREADS)
+    if (__atomic_load_n(&(calibration->loaded), __ATOMIC_ACQUIRE)) {
+        return;
+    }
 
-        /**
-         * Calculation of gyroscope mapping (in radiant per second):
-         *
-         *                 raw
-         *  calibrated = -------- * 2 PI
-         *                rpm60
-         *
-         *           60 * rpm80
-         *  rpm60 = ------------
-         *               80
-         *
-         * with:
-         *
-         *  raw ..... Raw sensor reading
-         *  rpm80 ... Sensor reading at 80 RPM (from calibration blob)
-         *  rpm60 ... Sensor reading at 60 RPM (1 rotation per second)
-         *
-         * Or combined:
-         *
-         *                80 * raw * 2 PI
-         *  calibrated = -----------------
-         *                  60 * rpm80
-         *
-         * Now define:
-         *
-         *       2 * PI * 80
-         *  f = -------------
-         *        60 * rpm80
-         *
-         * Then we get:
-         *
-         *  calibrated = f * raw
-         *
-         **/
+    pthread_mutex_lock(&(calibration->load_lock));
+    if (!calibration->loaded) {
+        psmove_calibration_load_all(calibration);
+        __atomic_store_n(&(calibration->loaded), 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&(calibration->load_lock));
+#else
+    if (!calibration->loaded) {
+        psmove_calibration_load_all(calibration);
+        calibration->loaded = 1;
+    }
+#endif
+}
 
-        int gx80, gy80, gz80;
-        psmove_calibration_get_usb_gyro_values(calibration,
-                &gx80, &gy80, &gz80);
+#if defined(PSMOVE_USE_PTHREADS)
+static void *
+psmove_calibration_load_thread(void *data)
+{
+    psmove_calibration_ensure_loaded((PSMoveCalibration*)data);
+    return NULL;
+}
+#endif
 
-        float factor = (2.f * M_PI * 80.f) / 60.f;
-        calibration->gx = factor / (float)gx80;
-        calibration->gy = factor / (float)gy80;
-        calibration->gz = factor / (float)gz80;
-    } else {
-        /* No calibration data - pass-through input data */
-        calibration->ax = 1.f;
-        calibration->ay = 1.f;
-        calibration->az = 1.f;
+void
+psmove_calibration_load_async(PSMoveCalibration *calibration)
+{
+    psmove_return_if_fail(calibration != NULL);
 
-        calibration->bx = 0.f;
-        calibration->by = 0.f;
-        calibration->bz = 0.f;
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_lock(&(calibration->load_lock));
+    if (!calibration->loaded && !calibration->load_thread_started) {
+        if (pthread_create(&(calibration->load_thread), NULL,
+                    psmove_calibration_load_thread, calibration) == 0) {
+            calibration->load_thread_started = 1;
+        }
+    }
+    pthread_mutex_unlock(&(calibration->load_lock));
 
-        calibration->gx = 1.f;
-        calibration->gy = 1.f;
-        calibration->gz = 1.f;
+    if (calibration->load_thread_started) {
+        return;
     }
+#endif
 
-    return calibration;
+    /* No threads available - load synchronously */
+    psmove_calibration_ensure_loaded(calibration);
+}
+
+int
+psmove_calibration_is_loaded(PSMoveCalibration *calibration)
+{
+    psmove_return_val_if_fail(calibration != NULL, 0);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    return __atomic_load_n(&(calibration->loaded), __ATOMIC_ACQUIRE);
+#else
+    return calibration->loaded;
+#endif
 }
 
 int
@@ -412,6 +884,8 @@ psmove_calibration_dump(PSMoveCalibration *calibration)
 {
     psmove_return_if_fail(calibration != NULL);
 
+    psmove_calibration_ensure_loaded(calibration);
+
     printf("File: %s\n", calibration->filename);
     printf("Flags: %x\n", calibration->flags);
 
@@ -421,6 +895,28 @@ psmove_calibration_dump(PSMoveCalibration *calibration)
     }
 }
 
+/* Apply the mapping of one sensor to a raw X/Y/Z triple */
+static void
+psmove_calibration_map_vector(const float m[4][PSMOVE_CALIBRATION_COLUMN],
+        const int *raw_input, float *x, float *y, float *z)
+{
+    float rx = (float)raw_input[0];
+    float ry = (float)raw_input[1];
+    float rz = (float)raw_input[2];
+
+    if (x) {
+        *x = m[0][0] * rx + m[1][0] * ry + m[2][0] * rz + m[3][0];
+    }
+
+    if (y) {
+        *y = m[0][1] * rx + m[1][1] * ry + m[2][1] * rz + m[3][1];
+    }
+
+    if (z) {
+        *z = m[0][2] * rx + m[1][2] * ry + m[2][2] * rz + m[3][2];
+    }
+}
+
 void
 psmove_calibration_map_accelerometer(PSMoveCalibration *calibration,
         int *raw_input, float *ax, float *ay, float *az)
@@ -428,15 +924,10 @@ psmove_calibration_map_accelerometer(PSMoveCalibration *calibration,
     psmove_return_if_fail(calibration != NULL);
     psmove_return_if_fail(raw_input != NULL);
 
-    if (ax) {
-        *ax = (float)raw_input[0] * calibration->ax + calibration->bx;
-    }
-    if (ay) {
-        *ay = (float)raw_input[1] * calibration->ay + calibration->by;
-    }
-    if (az) {
-        *az = (float)raw_input[2] * calibration->az + calibration->bz;
-    }
+    psmove_calibration_ensure_loaded(calibration);
+    psmove_calibration_map_vector(
+            calibration->matrix[CalibrationSensor_Accelerometer],
+            raw_input, ax, ay, az);
 }
 
 void
@@ -446,17 +937,98 @@ psmove_calibration_map_gyroscope(PSMoveCalibration *calibration,
     psmove_return_if_fail(calibration != NULL);
     psmove_return_if_fail(raw_input != NULL);
 
-    if (gx) {
-        *gx = (float)raw_input[0] * calibration->gx;
-    }
+    psmove_calibration_ensure_loaded(calibration);
+    psmove_calibration_map_vector(
+            calibration->matrix[CalibrationSensor_Gyroscope],
+            raw_input, gx, gy, gz);
+}
+
+void
+psmove_calibration_map_sensors(PSMoveCalibration *calibration,
+        const unsigned char *raw, float *output)
+{
+    psmove_return_if_fail(calibration != NULL);
+    psmove_return_if_fail(raw != NULL);
+    psmove_return_if_fail(output != NULL);
+
+    psmove_calibration_ensure_loaded(calibration);
+
+    /**
+     * The report contains 4 X/Y/Z triples: accelerometer (both half-frames),
+     * then gyroscope (both half-frames). Each result is computed as a full
+     * column vector; the stores overlap, so the padding lane of one triple
+     * is overwritten by the next one and only the last one needs the
+     * extra float at the end of "result".
+     **/
+    float values[PSMOVE_SENSOR_VALUES] __attribute__((aligned(16)));
+    float result[PSMOVE_SENSOR_VALUES + 1] __attribute__((aligned(16)));
+    int i;
 
-    if (gy) {
-        *gy = (float)raw_input[1] * calibration->gy;
+#if defined(__SSE2__)
+    /* 8 + 4 little-endian unsigned 16-bit values, biased by 0x8000 */
+    __m128i lo = _mm_loadu_si128((const __m128i*)raw);
+    __m128i hi = _mm_loadl_epi64((const __m128i*)(raw + 16));
+    __m128i zero = _mm_setzero_si128();
+    __m128i bias = _mm_set1_epi32(0x8000);
+
+    _mm_store_ps(values + 0, _mm_cvtepi32_ps(
+                _mm_sub_epi32(_mm_unpacklo_epi16(lo, zero), bias)));
+    _mm_store_ps(values + 4, _mm_cvtepi32_ps(
+                _mm_sub_epi32(_mm_unpackhi_epi16(lo, zero), bias)));
+    _mm_store_ps(values + 8, _mm_cvtepi32_ps(
+                _mm_sub_epi32(_mm_unpacklo_epi16(hi, zero), bias)));
+
+    for (i=0; i<4; i++) {
+        const float (*m)[PSMOVE_CALIBRATION_COLUMN] = calibration->matrix[i / 2];
+        const float *v = values + i*3;
+
+        __m128 r = _mm_load_ps(m[3]);
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(m[0]), _mm_set1_ps(v[0])));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(m[1]), _mm_set1_ps(v[1])));
+        r = _mm_add_ps(r, _mm_mul_ps(_mm_load_ps(m[2]), _mm_set1_ps(v[2])));
+        _mm_storeu_ps(result + i*3, r);
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    /* Byte loads, as the sensor values are not 16-bit aligned in the report */
+    uint16x8_t lo = vreinterpretq_u16_u8(vld1q_u8(raw));
+    uint16x4_t hi = vreinterpret_u16_u8(vld1_u8(raw + 16));
+    int32x4_t bias = vdupq_n_s32(0x8000);
+
+    vst1q_f32(values + 0, vcvtq_f32_s32(vsubq_s32(
+                    vreinterpretq_s32_u32(vmovl_u16(vget_low_u16(lo))), bias)));
+    vst1q_f32(values + 4, vcvtq_f32_s32(vsubq_s32(
+                    vreinterpretq_s32_u32(vmovl_u16(vget_high_u16(lo))), bias)));
+    vst1q_f32(values + 8, vcvtq_f32_s32(vsubq_s32(
+                    vreinterpretq_s32_u32(vmovl_u16(hi)), bias)));
+
+    for (i=0; i<4; i++) {
+        const float (*m)[PSMOVE_CALIBRATION_COLUMN] = calibration->matrix[i / 2];
+        const float *v = values + i*3;
+
+        float32x4_t r = vld1q_f32(m[3]);
+        r = vmlaq_n_f32(r, vld1q_f32(m[0]), v[0]);
+        r = vmlaq_n_f32(r, vld1q_f32(m[1]), v[1]);
+        r = vmlaq_n_f32(r, vld1q_f32(m[2]), v[2]);
+        vst1q_f32(result + i*3, r);
     }
+#else
+    for (i=0; i<PSMOVE_SENSOR_VALUES; i++) {
+        values[i] = (float)((raw[i*2] | (raw[i*2+1] << 8)) - 0x8000);
+    }
+
+    for (i=0; i<4; i++) {
+        const float (*m)[PSMOVE_CALIBRATION_COLUMN] = calibration->matrix[i / 2];
+        const float *v = values + i*3;
+        int row;
 
-    if (gz) {
-        *gz = (float)raw_input[2] * calibration->gz;
+        for (row=0; row<3; row++) {
+            result[i*3 + row] = m[0][row] * v[0] + m[1][row] * v[1] +
+                m[2][row] * v[2] + m[3][row];
+        }
     }
+#endif
+
+    memcpy(output, result, PSMOVE_SENSOR_VALUES * sizeof(float));
 }
 
 int
@@ -464,7 +1036,8 @@ psmove_calibration_supported(PSMoveCalibration *calibration)
 {
     psmove_return_val_if_fail(calibration != NULL, 0);
 
-    return (calibration->flags & CalibrationFlag_HaveUSB) != 0;
+    psmove_calibration_ensure_loaded(calibration);
+    return psmove_calibration_have_usb(calibration);
 }
 
 int
@@ -509,11 +1082,33 @@ psmove_calibration_save(PSMoveCalibration *calibration)
     return 1;
 }
 
+size_t
+psmove_calibration_get_memory_usage(PSMoveCalibration *calibration)
+{
+    size_t usage;
+
+    psmove_return_val_if_fail(calibration != NULL, 0);
+
+    usage = sizeof(PSMoveCalibration);
+    if (calibration->filename != NULL) {
+        usage += strlen(calibration->filename) + 1;
+    }
+
+    return usage;
+}
+
 void
 psmove_calibration_free(PSMoveCalibration *calibration)
 {
     psmove_return_if_fail(calibration != NULL);
 
+#if defined(PSMOVE_USE_PTHREADS)
+    if (calibration->load_thread_started) {
+        pthread_join(calibration->load_thread, NULL);
+    }
+    pthread_mutex_destroy(&(calibration->load_lock));
+#endif
+
     free(calibration->filename);
     free(calibration);
 }
@@ -41,19 +41,45 @@ extern "C" {
 struct _PSMoveCalibration;
 typedef struct _PSMoveCalibration PSMoveCalibration;
 
+/* Number of accelerometer + gyroscope values in an input report (2 frames) */
+#define PSMOVE_SENSOR_VALUES 12
+
 
 /**
  * Create a new calibration object for a given controller
  *
  * move ... a valid PSMove * instance.
  *
- * The calibration will be read from disk if possible. If not (and if the
- * controller is connected via USB), the calibration will be fetched from
- * the controller and saved on-disk for future loading).
+ * The calibration data is loaded on first use (or in the background, see
+ * psmove_calibration_load_async()), so this returns immediately. It will
+ * be read from disk if possible. If not (and if the controller is
+ * connected via USB), the calibration will be fetched from the controller
+ * and saved on-disk for future loading).
  **/
 ADDAPI PSMoveCalibration *
 ADDCALL psmove_calibration_new(PSMove *move);
 
+/**
+ * Start loading the calibration data in a background thread
+ *
+ * calibration ... a valid PSMoveCalibration * instance.
+ *
+ * If the calibration data is used before the thread is done, the caller
+ * waits for it. Without thread support, the data is loaded immediately.
+ **/
+ADDAPI void
+ADDCALL psmove_calibration_load_async(PSMoveCalibration *calibration);
+
+/**
+ * Check if the calibration data has been loaded, without loading it
+ *
+ * calibration ... a valid PSMoveCalibration * instance.
+ *
+ * Returns nonzero if the data has been loaded, zero otherwise.
+ **/
+ADDAPI int
+ADDCALL psmove_calibration_is_loaded(PSMoveCalibration *calibration);
+
 /**
  * Check if a calibration object has the necessary calibration data.
  *
@@ -90,6 +116,25 @@ ADDAPI void
 ADDCALL psmove_calibration_map_gyroscope(PSMoveCalibration *calibration,
         int *raw_input, float *gx, float *gy, float *gz);
 
+/**
+ * Decode and map all accelerometer and gyroscope values of a report at once
+ *
+ * calibration ... a valid PSMoveCalibration * instance.
+ * raw ... pointer to the PSMOVE_SENSOR_VALUES little-endian 16-bit values
+ *         as they appear in the input report (accelerometer X/Y/Z for the
+ *         first and second half-frame, then the same for the gyroscope)
+ * output ... pointer to a float[PSMOVE_SENSOR_VALUES] for the results
+ *            (same order: accelerometer in g, gyroscope in rad/s)
+ *
+ * This is equivalent to decoding each value and calling
+ * psmove_calibration_map_accelerometer() and
+ * psmove_calibration_map_gyroscope() for both half-frames, but uses
+ * SSE2 or NEON where available.
+ **/
+ADDAPI void
+ADDCALL psmove_calibration_map_sensors(PSMoveCalibration *calibration,
+        const unsigned char *raw, float *output);
+
 /**
  * Dump calibration information to stdout.
  *
@@ -99,6 +144,13 @@ ADDCALL psmove_calibration_map_gyroscope(PSMoveCalibration *calibration,
 ADDAPI void
 ADDCALL psmove_calibration_dump(PSMoveCalibration *calibration);
 
+/**
+ * Memory used by the calibration instance (in bytes), see
+ * psmove_get_memory_usage().
+ **/
+ADDAPI size_t
+ADDCALL psmove_calibration_get_memory_usage(PSMoveCalibration *calibration);
+
 /**
  * Destroy a PSMoveCalibration * instance and free() associated memory.
  **/
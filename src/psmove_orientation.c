@@ -31,32 +31,361 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "psmove.h"
 #include "psmove_private.h"
 #include "psmove_orientation.h"
+#include "psmove_calibration.h"
 
 #include "../external/MadgwickAHRS/MadgwickAHRS.h"
+#include "../external/MahonyAHRS/MahonyAHRS.h"
 
+#include <math.h>
 
-struct _PSMoveOrientation {
-    PSMove *move;
+#if defined(PSMOVE_USE_PTHREADS)
+#  include <pthread.h>
+#endif
+
+#if defined(__SSE__)
+#  include <xmmintrin.h>
+#endif
+
+/* Number of controllers processed together by the batched Madgwick filter */
+#define PSMOVE_ORIENTATION_BATCH_WIDTH 4
+
+/**
+ * A vector of PSMOVE_ORIENTATION_BATCH_WIDTH floats (GCC vector extension),
+ * mapped to SSE or NEON registers where available (and to plain loops
+ * otherwise). The corresponding integer vector holds comparison masks.
+ **/
+typedef float psmove_vec __attribute__((vector_size(4 * PSMOVE_ORIENTATION_BATCH_WIDTH)));
+typedef int psmove_vec_mask __attribute__((vector_size(4 * PSMOVE_ORIENTATION_BATCH_WIDTH)));
+
+/* Integration step used before the hardware time base is known */
+#define PSMOVE_ORIENTATION_DEFAULT_STEP_US (1000000 / 120)
 
-    /* 9 values = 3x accelerometer + 3x gyroscope + 3x magnetometer */
-    int input[9];
-    float output[9];
+/* Time (host) over which the hardware timestamp rate is measured */
+#define PSMOVE_ORIENTATION_CLOCK_WINDOW_US 1000000
 
-    /* Current sampling frequency */
-    float sample_freq;
+/* Longer half-frame intervals are integrated in steps of at most this size */
+#define PSMOVE_ORIENTATION_MAX_STEP_US 10000
+
+/* After longer gaps, the time of the gap is not integrated */
+#define PSMOVE_ORIENTATION_MAX_GAP_US 500000
+
+/* Limit for extrapolating the orientation ahead of the latest report */
+#define PSMOVE_ORIENTATION_MAX_PREDICTION_US 100000
+
+/* Samples buffered in lazy mode before they are integrated anyway */
+#define PSMOVE_ORIENTATION_MAX_PENDING 64
+
+/* Thresholds below which a half-frame counts as still (rad/s, g) */
+#define PSMOVE_ORIENTATION_STILL_GYRO 0.05f
+#define PSMOVE_ORIENTATION_STILL_ACCEL 0.02f
+#define PSMOVE_ORIENTATION_STILL_GRAVITY 0.1f
+
+/* Time the controller has to be still before the filter is paused */
+#define PSMOVE_ORIENTATION_STILL_TIME_US 500000
+
+/* Weight of each held report in the gyroscope bias estimate */
+#define PSMOVE_ORIENTATION_BIAS_RATE 0.01f
+
+/**
+ * An orientation filter backend: Update the orientation quaternion with
+ * one accelerometer (in g) and gyroscope (in rad/s) sample, taken
+ * 1/sample_freq seconds after the previous one. The axes are already
+ * mapped to the coordinate system of the filter.
+ **/
+typedef void (*psmove_orientation_filter_func)(PSMoveOrientation *orientation,
+        float sample_freq, const float *accel, const float *gyro);
 
-    /* Sample frequency measurements */
-    long sample_freq_measure_start;
-    long sample_freq_measure_count;
+
+struct _PSMoveOrientation {
+    PSMove *move;
+
+    /**
+     * Hardware time base: The controller timestamps have an unknown, but
+     * fixed rate. It is measured against the host time of the reports over
+     * PSMOVE_ORIENTATION_CLOCK_WINDOW_US (us_per_tick is zero until then).
+     **/
+    int last_timestamp;
+    long long last_time_us;
+    float us_per_tick;
+    long clock_ticks;
+    long long clock_start_us;
 
     /* Output value as quaternion */
     float quaternion[4];
+
+    /* Latest gyroscope rate (filter axes, rad/s) for the prediction */
+    float rate[3];
+
+    /**
+     * Stillness detection: Once the controller has been still for
+     * PSMOVE_ORIENTATION_STILL_TIME_US, reports are not run through the
+     * filter (the quaternion is held), but averaged into the gyroscope
+     * bias (filter axes), which is subtracted from all gyroscope readings.
+     **/
+    float gyro_bias[3];
+    float still_accel[3]; /* Running mean of the accelerometer (in g) */
+    long long still_since_us; /* Host time of the first still report, or -1 */
+    int still; /* Nonzero while the filter is paused */
+
+    /**
+     * Snapshot of the output, published after each update for lock-free
+     * readers (seqlock: the sequence number is odd while it is written).
+     * The updating thread is the only writer; psmove_orientation_set_*()
+     * from other threads is serialized with the updates by lock.
+     **/
+    unsigned int snapshot_seq;
+    float snapshot_quaternion[4];
+    float snapshot_rate[3];
+    long long snapshot_time_us;
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_t lock;
+#endif
+
+    /* The active filter backend and its state */
+    enum PSMove_Orientation_Filter filter;
+    psmove_orientation_filter_func filter_func;
+    float mahony_integral[3];
+
+    /* Time spent in the filter (for psmove_orientation_get_filter_cost) */
+    double filter_time_us;
+    long filter_updates;
+
+    /**
+     * Lazy mode: Samples are only buffered by the updates, and integrated
+     * by the getters (protected by lock)
+     **/
+    enum PSMove_Bool lazy;
+    PSMoveOrientationSample pending[PSMOVE_ORIENTATION_MAX_PENDING];
+    int pending_count;
 };
 
+/**
+ * Sensor values of one report, prepared for the filter (struct-of-arrays
+ * layout for the batched filter: one lane per controller)
+ **/
+typedef struct {
+    psmove_vec q[4];
+    psmove_vec accel[2][3];
+    psmove_vec gyro[2][3];
+    psmove_vec dt;
+} PSMoveOrientationBatch;
+
+
+/* Serialize modifications of the filter state (readers use the snapshot) */
+static inline void
+psmove_orientation_lock(PSMoveOrientation *orientation)
+{
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_lock(&(orientation->lock));
+#endif
+}
+
+static inline void
+psmove_orientation_unlock(PSMoveOrientation *orientation)
+{
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_unlock(&(orientation->lock));
+#endif
+}
+
+/* Publish the current output for the getters (called with the lock held) */
+static void
+psmove_orientation_publish(PSMoveOrientation *orientation)
+{
+    unsigned int seq = orientation->snapshot_seq;
+
+    __atomic_store_n(&(orientation->snapshot_seq), seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    memcpy(orientation->snapshot_quaternion, orientation->quaternion,
+            sizeof(orientation->snapshot_quaternion));
+    memcpy(orientation->snapshot_rate, orientation->rate,
+            sizeof(orientation->snapshot_rate));
+    orientation->snapshot_time_us = (orientation->last_timestamp >= 0) ?
+        orientation->last_time_us : -1;
+
+    __atomic_store_n(&(orientation->snapshot_seq), seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Read a consistent copy of the latest snapshot (from any thread) */
+static void
+psmove_orientation_read_snapshot(PSMoveOrientation *orientation,
+        float *quaternion, float *rate, long long *time_us)
+{
+    unsigned int seq;
+
+    do {
+        seq = __atomic_load_n(&(orientation->snapshot_seq), __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            /* Being updated right now - try again */
+            continue;
+        }
+
+        memcpy(quaternion, orientation->snapshot_quaternion,
+                sizeof(orientation->snapshot_quaternion));
+        memcpy(rate, orientation->snapshot_rate,
+                sizeof(orientation->snapshot_rate));
+        *time_us = orientation->snapshot_time_us;
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&(orientation->snapshot_seq),
+                __ATOMIC_RELAXED));
+}
+
+
+/* FILTER BACKENDS */
+
+/* Approximate 1/sqrt(x) for all lanes (relative error below 1e-5) */
+static inline psmove_vec
+psmove_vec_rsqrt(psmove_vec x)
+{
+    psmove_vec half = x * 0.5f;
+    psmove_vec y;
+
+#if defined(__SSE__) && PSMOVE_ORIENTATION_BATCH_WIDTH == 4
+    y = (psmove_vec)_mm_rsqrt_ps((__m128)x);
+#else
+    int i;
+    for (i=0; i<PSMOVE_ORIENTATION_BATCH_WIDTH; i++) {
+        y[i] = 1.f / sqrtf(x[i]);
+    }
+#endif
+
+    /* One Newton-Raphson step, as used by invSqrt() in the filters */
+    return y * (1.5f - half * y * y);
+}
+
+/**
+ * Madgwick's IMU update (see MadgwickAHRSupdateIMU()) for one half-frame
+ * of PSMOVE_ORIENTATION_BATCH_WIDTH controllers at once
+ **/
+static void
+psmove_orientation_madgwick_batch(PSMoveOrientationBatch *batch, int frame)
+{
+    psmove_vec q0 = batch->q[0], q1 = batch->q[1];
+    psmove_vec q2 = batch->q[2], q3 = batch->q[3];
+    psmove_vec ax = batch->accel[frame][0];
+    psmove_vec ay = batch->accel[frame][1];
+    psmove_vec az = batch->accel[frame][2];
+    psmove_vec gx = batch->gyro[frame][0];
+    psmove_vec gy = batch->gyro[frame][1];
+    psmove_vec gz = batch->gyro[frame][2];
+    psmove_vec recipNorm, s0, s1, s2, s3;
+    psmove_vec_mask valid;
+
+    /* Rate of change of quaternion from gyroscope */
+    psmove_vec qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+    psmove_vec qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+    psmove_vec qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+    psmove_vec qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+
+    /* Feedback only for lanes with a valid accelerometer measurement */
+    valid = (ax != 0.f) | (ay != 0.f) | (az != 0.f);
+
+    /* Normalise accelerometer measurement */
+    recipNorm = psmove_vec_rsqrt(ax * ax + ay * ay + az * az);
+    ax *= recipNorm;
+    ay *= recipNorm;
+    az *= recipNorm;
+
+    /* Auxiliary variables to avoid repeated arithmetic */
+    psmove_vec _2q0 = 2.f * q0, _2q1 = 2.f * q1;
+    psmove_vec _2q2 = 2.f * q2, _2q3 = 2.f * q3;
+    psmove_vec _4q0 = 4.f * q0, _4q1 = 4.f * q1, _4q2 = 4.f * q2;
+    psmove_vec _8q1 = 8.f * q1, _8q2 = 8.f * q2;
+    psmove_vec q0q0 = q0 * q0, q1q1 = q1 * q1;
+    psmove_vec q2q2 = q2 * q2, q3q3 = q3 * q3;
+
+    /* Gradient descent algorithm corrective step */
+    s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+    s1 = _4q1 * q3q3 - _2q3 * ax + 4.f * q0q0 * q1 - _2q0 * ay - _4q1 +
+        _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+    s2 = 4.f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 +
+        _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+    s3 = 4.f * q1q1 * q3 - _2q1 * ax + 4.f * q2q2 * q3 - _2q2 * ay;
+    psmove_vec norm = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+    recipNorm = psmove_vec_rsqrt(norm);
+
+    /**
+     * A zero step (e.g. at rest in the initial orientation) has an infinite
+     * reciprocal, which the Newton step turns into NaN; the scalar filter
+     * ends up with a zero step there, so these lanes get no feedback either
+     **/
+    valid &= (norm != 0.f);
+
+    /* Apply feedback step (masking out NaNs of invalid lanes) */
+    recipNorm *= beta;
+    qDot1 -= (psmove_vec)((psmove_vec_mask)(s0 * recipNorm) & valid);
+    qDot2 -= (psmove_vec)((psmove_vec_mask)(s1 * recipNorm) & valid);
+    qDot3 -= (psmove_vec)((psmove_vec_mask)(s2 * recipNorm) & valid);
+    qDot4 -= (psmove_vec)((psmove_vec_mask)(s3 * recipNorm) & valid);
+
+    /* Integrate rate of change of quaternion to yield quaternion */
+    q0 += qDot1 * batch->dt;
+    q1 += qDot2 * batch->dt;
+    q2 += qDot3 * batch->dt;
+    q3 += qDot4 * batch->dt;
+
+    /* Normalise quaternion */
+    recipNorm = psmove_vec_rsqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    batch->q[0] = q0 * recipNorm;
+    batch->q[1] = q1 * recipNorm;
+    batch->q[2] = q2 * recipNorm;
+    batch->q[3] = q3 * recipNorm;
+}
+
+static void
+psmove_orientation_filter_madgwick(PSMoveOrientation *orientation,
+        float sample_freq, const float *accel, const float *gyro)
+{
+    MadgwickAHRSupdate(orientation->quaternion, sample_freq,
+            accel[0], accel[1], accel[2],
+            gyro[0], gyro[1], gyro[2],
+
+            /* Magnetometer orientation disabled for now */
+            0, 0, 0);
+}
+
+static void
+psmove_orientation_filter_mahony(PSMoveOrientation *orientation,
+        float sample_freq, const float *accel, const float *gyro)
+{
+    MahonyAHRSupdateIMU(orientation->quaternion,
+            orientation->mahony_integral, sample_freq,
+            accel[0], accel[1], accel[2],
+            gyro[0], gyro[1], gyro[2]);
+}
+
+static void
+psmove_orientation_filter_gyro(PSMoveOrientation *orientation,
+        float sample_freq, const float *accel, const float *gyro)
+{
+    float *q = orientation->quaternion;
+    float dt = 1.f / sample_freq;
+    float q0, q1, q2, q3;
+    float norm;
+
+    /* Rate of change of quaternion from gyroscope (q' = 0.5 q x omega) */
+    q0 = q[0] + 0.5f * (-q[1] * gyro[0] - q[2] * gyro[1] - q[3] * gyro[2]) * dt;
+    q1 = q[1] + 0.5f * (q[0] * gyro[0] + q[2] * gyro[2] - q[3] * gyro[1]) * dt;
+    q2 = q[2] + 0.5f * (q[0] * gyro[1] - q[1] * gyro[2] + q[3] * gyro[0]) * dt;
+    q3 = q[3] + 0.5f * (q[0] * gyro[2] + q[1] * gyro[1] - q[2] * gyro[0]) * dt;
+
+    norm = sqrtf(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    if (norm > 0.f) {
+        q[0] = q0 / norm;
+        q[1] = q1 / norm;
+        q[2] = q2 / norm;
+        q[3] = q3 / norm;
+    }
+}
+
 
 PSMoveOrientation *
 psmove_orientation_new(PSMove *move)
@@ -74,105 +403,529 @@ psmove_orientation_new(PSMove *move)
 
     orientation->move = move;
 
-    /* Initial sampling frequency */
-    orientation->sample_freq = 120.0f;
+    /* No previous report yet */
+    orientation->last_timestamp = -1;
+    orientation->clock_start_us = -1;
+    orientation->still_since_us = -1;
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_init(&(orientation->lock), NULL);
+#endif
 
-    /* Measurement */
-    orientation->sample_freq_measure_start = psmove_util_get_ticks();
-    orientation->sample_freq_measure_count = 0;
+    psmove_orientation_set_filter(orientation, OrientationFilter_Madgwick);
 
     /* Initial quaternion */
-    orientation->quaternion[0] = 1;
-    orientation->quaternion[1] = 0;
-    orientation->quaternion[2] = 0;
-    orientation->quaternion[3] = 0;
+    psmove_orientation_set_quaternion(orientation, 1, 0, 0, 0);
 
     return orientation;
 }
 
 
-void
-psmove_orientation_update(PSMoveOrientation *orientation)
+/**
+ * Determine the time between the previous and the current input report
+ * from the hardware timestamps (in microseconds). Returns 0 if the report
+ * should not be integrated (duplicate report).
+ **/
+static long long
+psmove_orientation_report_interval(PSMoveOrientation *orientation,
+        const PSMoveOrientationSample *sample)
 {
-    psmove_return_if_fail(orientation != NULL);
+    int timestamp = sample->timestamp;
+    long long time_us = sample->time_us;
+    long long host_us = time_us - orientation->last_time_us;
+    long long interval_us;
+    int ticks;
+
+    if (orientation->last_timestamp < 0) {
+        /* First report - assume the nominal spacing */
+        orientation->last_timestamp = timestamp;
+        orientation->last_time_us = time_us;
+        return 2 * PSMOVE_ORIENTATION_DEFAULT_STEP_US;
+    }
+
+    ticks = (timestamp - orientation->last_timestamp) & 0xFFFF;
+    if (ticks == 0) {
+        return 0;
+    }
+
+    orientation->last_timestamp = timestamp;
+    orientation->last_time_us = time_us;
 
-    int frame;
+    /**
+     * Measure the rate of the hardware clock over reports with regular
+     * spacing (the 16-bit counter is ambiguous after long gaps)
+     **/
+    if (host_us < PSMOVE_ORIENTATION_MAX_GAP_US) {
+        if (orientation->clock_start_us < 0) {
+            orientation->clock_start_us = time_us;
+            orientation->clock_ticks = 0;
+        } else {
+            orientation->clock_ticks += ticks;
 
-    long now = psmove_util_get_ticks();
-    if (now - orientation->sample_freq_measure_start >= 1000) {
-        float measured = ((float)orientation->sample_freq_measure_count) /
-            ((float)(now-orientation->sample_freq_measure_start))*1000.;
+            long long elapsed_us = time_us - orientation->clock_start_us;
+            if (elapsed_us >= PSMOVE_ORIENTATION_CLOCK_WINDOW_US) {
+                float measured = (float)elapsed_us /
+                    (float)orientation->clock_ticks;
+
+                if (orientation->us_per_tick == 0.) {
+                    orientation->us_per_tick = measured;
+                } else {
+                    /* Smooth out host-side jitter over multiple windows */
+                    orientation->us_per_tick = 0.75 * orientation->us_per_tick +
+                        0.25 * measured;
+                }
 
 #ifdef PSMOVE_DEBUG
-        printf("[PSMOVE] Measured sample_freq: %f\n", measured);
+                printf("[PSMOVE] Hardware clock: %f us/tick\n",
+                        orientation->us_per_tick);
 #endif
 
-        orientation->sample_freq = measured;
-        orientation->sample_freq_measure_start = now;
-        orientation->sample_freq_measure_count = 0;
+                orientation->clock_start_us = time_us;
+                orientation->clock_ticks = 0;
+            }
+        }
+    } else {
+        /* Restart the measurement after a gap */
+        orientation->clock_start_us = -1;
+    }
+
+    if (orientation->us_per_tick > 0.) {
+        interval_us = (long long)(ticks * orientation->us_per_tick);
+    } else if (host_us > 0) {
+        interval_us = host_us;
+    } else {
+        interval_us = 2 * PSMOVE_ORIENTATION_DEFAULT_STEP_US;
+    }
+
+    if (interval_us > PSMOVE_ORIENTATION_MAX_GAP_US ||
+            host_us > PSMOVE_ORIENTATION_MAX_GAP_US) {
+        /* Lost track of time - don't integrate the gap */
+        interval_us = 2 * PSMOVE_ORIENTATION_DEFAULT_STEP_US;
     }
 
-    /* We get 2 measurements per call to psmove_poll() */
-    orientation->sample_freq_measure_count += 2;
+    return interval_us;
+}
 
-    psmove_get_magnetometer(orientation->move,
-            &orientation->input[6],
-            &orientation->input[7],
-            &orientation->input[8]);
+/**
+ * Load the sensor values of a sample into lane i of the batch (in the axes
+ * of the filters)
+ **/
+static void
+psmove_orientation_load(PSMoveOrientation *orientation,
+        const PSMoveOrientationSample *sample,
+        PSMoveOrientationBatch *batch, int i)
+{
+    const float *sensors = sample->sensors;
+    int frame, k;
 
     for (frame=0; frame<2; frame++) {
-        psmove_get_accelerometer_frame(orientation->move, frame,
-                &orientation->output[0],
-                &orientation->output[1],
-                &orientation->output[2]);
-
-        psmove_get_gyroscope_frame(orientation->move, frame,
-                &orientation->output[3],
-                &orientation->output[4],
-                &orientation->output[5]);
-
-        MadgwickAHRSupdate(orientation->quaternion,
-                orientation->sample_freq,
-
-                -orientation->output[0],
-                orientation->output[1],
-                orientation->output[2],
-
-                orientation->output[3],
-                orientation->output[5],
-                -orientation->output[4],
-
-                /* Magnetometer orientation disabled for now */
-                0, 0, 0
-#if 0
-                orientation->output[6],
-                orientation->output[8],
-                orientation->output[7]
-#endif
-        );
+        /* Accelerometer of this half-frame */
+        batch->accel[frame][0][i] = -sensors[frame*3 + 0];
+        batch->accel[frame][1][i] = sensors[frame*3 + 1];
+        batch->accel[frame][2][i] = sensors[frame*3 + 2];
+
+        /* Gyroscope of this half-frame */
+        batch->gyro[frame][0][i] = sensors[6 + frame*3 + 0];
+        batch->gyro[frame][1][i] = sensors[6 + frame*3 + 2];
+        batch->gyro[frame][2][i] = -sensors[6 + frame*3 + 1];
+    }
+
+    for (k=0; k<3; k++) {
+        batch->gyro[0][k][i] -= orientation->gyro_bias[k];
+        batch->gyro[1][k][i] -= orientation->gyro_bias[k];
+    }
+
+    for (k=0; k<4; k++) {
+        batch->q[k][i] = orientation->quaternion[k];
+    }
+
+    for (k=0; k<3; k++) {
+        orientation->rate[k] = batch->gyro[1][k][i];
+    }
+}
+
+/**
+ * Detect whether the controller is lying still. Returns nonzero if the
+ * sample should not be integrated, but held (it then updates the gyroscope
+ * bias instead). Called with the lock held.
+ **/
+static int
+psmove_orientation_hold_if_still(PSMoveOrientation *orientation,
+        const PSMoveOrientationSample *sample)
+{
+    const float *sensors = sample->sensors;
+    float gyro[3] = { 0.f, 0.f, 0.f };
+    int moving = 0;
+    int frame, k;
+
+    for (frame=0; frame<2; frame++) {
+        const float *accel = sensors + frame*3;
+        float raw[3] = {
+            sensors[6 + frame*3 + 0],
+            sensors[6 + frame*3 + 2],
+            -sensors[6 + frame*3 + 1],
+        };
+        float rate2 = 0.f, deviation2 = 0.f, gravity2 = 0.f;
+
+        for (k=0; k<3; k++) {
+            float rate = raw[k] - orientation->gyro_bias[k];
+            float deviation = accel[k] - orientation->still_accel[k];
+
+            rate2 += rate * rate;
+            deviation2 += deviation * deviation;
+            gravity2 += accel[k] * accel[k];
+            gyro[k] += 0.5f * raw[k];
+        }
+
+        if (rate2 > PSMOVE_ORIENTATION_STILL_GYRO * PSMOVE_ORIENTATION_STILL_GYRO ||
+                deviation2 > PSMOVE_ORIENTATION_STILL_ACCEL * PSMOVE_ORIENTATION_STILL_ACCEL ||
+                fabsf(sqrtf(gravity2) - 1.f) > PSMOVE_ORIENTATION_STILL_GRAVITY) {
+            moving = 1;
+        }
+    }
+
+    if (moving) {
+        /* Start over from the current acceleration */
+        memcpy(orientation->still_accel, sensors + 3,
+                sizeof(orientation->still_accel));
+        orientation->still_since_us = -1;
+        __atomic_store_n(&(orientation->still), 0, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    for (k=0; k<3; k++) {
+        orientation->still_accel[k] += 0.1f * (0.5f * (sensors[k] +
+                    sensors[3 + k]) - orientation->still_accel[k]);
+    }
+
+    if (orientation->still_since_us < 0) {
+        orientation->still_since_us = sample->time_us;
+    }
+
+    if (sample->time_us - orientation->still_since_us <
+            PSMOVE_ORIENTATION_STILL_TIME_US) {
+        /* Might just be a slow movement, keep filtering for now */
+        return 0;
+    }
+
+    for (k=0; k<3; k++) {
+        orientation->gyro_bias[k] += PSMOVE_ORIENTATION_BIAS_RATE *
+            (gyro[k] - orientation->gyro_bias[k]);
+        orientation->rate[k] = 0.f;
+    }
+
+    __atomic_store_n(&(orientation->still), 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+/**
+ * Integrate lane i of the batch through the orientation's filter backend
+ * (used for other filters and for long intervals that need several steps)
+ **/
+static void
+psmove_orientation_integrate(PSMoveOrientation *orientation,
+        PSMoveOrientationBatch *batch, int i, long long interval_us)
+{
+    float accel[3], gyro[3];
+    int frame, k;
+
+    for (frame=0; frame<2; frame++) {
+        for (k=0; k<3; k++) {
+            accel[k] = batch->accel[frame][k][i];
+            gyro[k] = batch->gyro[frame][k][i];
+        }
+
+        /**
+         * Both half-frames are sampled at equal intervals. Long intervals
+         * (after dropped reports) are integrated in several steps, holding
+         * the current sample, so the filter catches up with the real time.
+         **/
+        long long remaining_us = interval_us / 2;
+        while (remaining_us > 0) {
+            long long step_us = remaining_us;
+            if (step_us > PSMOVE_ORIENTATION_MAX_STEP_US) {
+                step_us = PSMOVE_ORIENTATION_MAX_STEP_US;
+            }
+            remaining_us -= step_us;
+
+            orientation->filter_func(orientation, 1000000.f / (float)step_us,
+                    accel, gyro);
+            orientation->filter_updates++;
+        }
+    }
+}
+
+/* Integrate a single sample through the filter backend (lock held) */
+static void
+psmove_orientation_integrate_sample(PSMoveOrientation *orientation,
+        const PSMoveOrientationSample *sample, long long interval_us)
+{
+    PSMoveOrientationBatch single;
+
+    psmove_orientation_load(orientation, sample, &single, 0);
+
+    long long started = psmove_util_get_ticks_us();
+    psmove_orientation_integrate(orientation, &single, 0, interval_us);
+    orientation->filter_time_us += psmove_util_get_ticks_us() - started;
+}
+
+/* Integrate all samples buffered in lazy mode (lock held) */
+static void
+psmove_orientation_flush_pending(PSMoveOrientation *orientation)
+{
+    int i;
+
+    if (orientation->pending_count == 0) {
+        return;
+    }
+
+    for (i=0; i<orientation->pending_count; i++) {
+        const PSMoveOrientationSample *sample = &(orientation->pending[i]);
+        long long interval_us = psmove_orientation_report_interval(orientation,
+                sample);
+
+        if (interval_us != 0 &&
+                !psmove_orientation_hold_if_still(orientation, sample)) {
+            psmove_orientation_integrate_sample(orientation, sample,
+                    interval_us);
+        }
+    }
+
+    orientation->pending_count = 0;
+    psmove_orientation_publish(orientation);
+}
+
+/* In lazy mode, bring the snapshot up to date before reading it */
+static void
+psmove_orientation_catch_up(PSMoveOrientation *orientation)
+{
+    if (__atomic_load_n(&(orientation->lazy), __ATOMIC_RELAXED)) {
+        psmove_orientation_lock(orientation);
+        psmove_orientation_flush_pending(orientation);
+        psmove_orientation_unlock(orientation);
+    }
+}
+
+/* Integrate the Madgwick lanes of a batch with the vectorized filter */
+static void
+psmove_orientation_flush_batch(PSMoveOrientation **lanes, int count,
+        PSMoveOrientationBatch *batch)
+{
+    long long started = psmove_util_get_ticks_us();
+    int i, k;
+
+    /* Unused lanes: A valid quaternion and zero inputs */
+    for (i=count; i<PSMOVE_ORIENTATION_BATCH_WIDTH; i++) {
+        for (k=0; k<3; k++) {
+            batch->accel[0][k][i] = batch->accel[1][k][i] = 0.f;
+            batch->gyro[0][k][i] = batch->gyro[1][k][i] = 0.f;
+        }
+        batch->q[0][i] = 1.f;
+        batch->q[1][i] = batch->q[2][i] = batch->q[3][i] = 0.f;
+        batch->dt[i] = 0.f;
+    }
+
+    psmove_orientation_madgwick_batch(batch, 0);
+    psmove_orientation_madgwick_batch(batch, 1);
+
+    /* Attribute the time spent in equal parts to the controllers */
+    double elapsed_us = (double)(psmove_util_get_ticks_us() - started) /
+        (double)count;
+
+    for (i=0; i<count; i++) {
+        for (k=0; k<4; k++) {
+            lanes[i]->quaternion[k] = batch->q[k][i];
+        }
+        lanes[i]->filter_updates += 2;
+        lanes[i]->filter_time_us += elapsed_us;
+
+        psmove_orientation_publish(lanes[i]);
+        psmove_orientation_unlock(lanes[i]);
+    }
+}
+
+void
+psmove_orientation_update_batch(PSMoveOrientation **orientations,
+        const PSMoveOrientationSample *samples, int count)
+{
+    PSMoveOrientation *lanes[PSMOVE_ORIENTATION_BATCH_WIDTH];
+    PSMoveOrientationBatch batch;
+    int used = 0;
+    int i, j;
+
+    psmove_return_if_fail(orientations != NULL);
+    psmove_return_if_fail(samples != NULL);
+
+    /* Check everything first, so no lane is left locked on error */
+    for (i=0; i<count; i++) {
+        psmove_return_if_fail(orientations[i] != NULL);
+    }
+
+    for (i=0; i<count; i++) {
+        PSMoveOrientation *orientation = orientations[i];
+
+        /**
+         * A second sample of an orientation that is already in the batch
+         * (locked, and not integrated yet): integrate the batch first
+         **/
+        for (j=0; j<used; j++) {
+            if (lanes[j] == orientation) {
+                psmove_orientation_flush_batch(lanes, used, &batch);
+                used = 0;
+                break;
+            }
+        }
+
+        /* Held until the result is published (in the batch: by the flush) */
+        psmove_orientation_lock(orientation);
+
+        if (orientation->lazy) {
+            /* Make room by integrating what has piled up so far */
+            if (orientation->pending_count == PSMOVE_ORIENTATION_MAX_PENDING) {
+                psmove_orientation_flush_pending(orientation);
+            }
+
+            orientation->pending[orientation->pending_count++] = samples[i];
+            psmove_orientation_unlock(orientation);
+            continue;
+        }
+
+        long long interval_us = psmove_orientation_report_interval(orientation,
+                &samples[i]);
+        if (interval_us == 0) {
+            psmove_orientation_unlock(orientation);
+            continue;
+        }
+
+        if (psmove_orientation_hold_if_still(orientation, &samples[i])) {
+            /* Nothing to integrate, but the time of the snapshot moves on */
+            psmove_orientation_publish(orientation);
+            psmove_orientation_unlock(orientation);
+            continue;
+        }
+
+        if (orientation->filter != OrientationFilter_Madgwick ||
+                interval_us / 2 > PSMOVE_ORIENTATION_MAX_STEP_US) {
+            /* Not suitable for the batched filter */
+            psmove_orientation_integrate_sample(orientation, &samples[i],
+                    interval_us);
+            psmove_orientation_publish(orientation);
+            psmove_orientation_unlock(orientation);
+            continue;
+        }
+
+        psmove_orientation_load(orientation, &samples[i], &batch, used);
+        batch.dt[used] = (float)(interval_us / 2) / 1000000.f;
+        lanes[used++] = orientation;
+
+        if (used == PSMOVE_ORIENTATION_BATCH_WIDTH) {
+            psmove_orientation_flush_batch(lanes, used, &batch);
+            used = 0;
+        }
+    }
+
+    if (used > 0) {
+        psmove_orientation_flush_batch(lanes, used, &batch);
     }
 }
 
+void
+psmove_orientation_update(PSMoveOrientation *orientation)
+{
+    PSMoveOrientationSample sample;
+
+    psmove_return_if_fail(orientation != NULL);
+
+    sample.timestamp = psmove_get_timestamp(orientation->move);
+    sample.time_us = _psmove_get_input_time_us(orientation->move);
+    _psmove_get_calibrated_sensors(orientation->move, sample.sensors);
+
+    psmove_orientation_update_batch(&orientation, &sample, 1);
+}
+
 void
 psmove_orientation_get_quaternion(PSMoveOrientation *orientation,
         float *q0, float *q1, float *q2, float *q3)
 {
     psmove_return_if_fail(orientation != NULL);
 
+    float q[4], rate[3];
+    long long time_us;
+
+    psmove_orientation_catch_up(orientation);
+    psmove_orientation_read_snapshot(orientation, q, rate, &time_us);
+
+    if (q0) {
+        *q0 = q[0];
+    }
+
+    if (q1) {
+        *q1 = q[1];
+    }
+
+    if (q2) {
+        *q2 = q[2];
+    }
+
+    if (q3) {
+        *q3 = q[3];
+    }
+}
+
+void
+psmove_orientation_get_quaternion_predicted(PSMoveOrientation *orientation,
+        int dt_us, float *q0, float *q1, float *q2, float *q3)
+{
+    psmove_return_if_fail(orientation != NULL);
+
+    float q[4], w[3];
+    float d[4] = {1.f, 0.f, 0.f, 0.f};
+    long long time_us;
+    long long ahead_us = dt_us;
+
+    psmove_orientation_catch_up(orientation);
+    psmove_orientation_read_snapshot(orientation, q, w, &time_us);
+
+    /* The prediction starts at the time of the latest report */
+    if (time_us >= 0) {
+        long long since_us = psmove_util_get_ticks_us() - time_us;
+        if (since_us > 0) {
+            ahead_us += since_us;
+        }
+    }
+
+    if (ahead_us > PSMOVE_ORIENTATION_MAX_PREDICTION_US) {
+        ahead_us = PSMOVE_ORIENTATION_MAX_PREDICTION_US;
+    } else if (ahead_us < -PSMOVE_ORIENTATION_MAX_PREDICTION_US) {
+        ahead_us = -PSMOVE_ORIENTATION_MAX_PREDICTION_US;
+    }
+
+    /* Rotation by the constant rate over ahead_us (d = exp(0.5 w t)) */
+    float rate = sqrtf(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+    float angle = rate * (float)ahead_us / 1000000.f;
+    if (rate > 1e-6f) {
+        float s = sinf(.5f * angle) / rate;
+        d[0] = cosf(.5f * angle);
+        d[1] = w[0] * s;
+        d[2] = w[1] * s;
+        d[3] = w[2] * s;
+    }
+
+    /* Same convention as the filters: q' = 0.5 q x omega */
     if (q0) {
-        *q0 = orientation->quaternion[0];
+        *q0 = q[0] * d[0] - q[1] * d[1] - q[2] * d[2] - q[3] * d[3];
     }
 
     if (q1) {
-        *q1 = orientation->quaternion[1];
+        *q1 = q[0] * d[1] + q[1] * d[0] + q[2] * d[3] - q[3] * d[2];
     }
 
     if (q2) {
-        *q2 = orientation->quaternion[2];
+        *q2 = q[0] * d[2] - q[1] * d[3] + q[2] * d[0] + q[3] * d[1];
     }
 
     if (q3) {
-        *q3 = orientation->quaternion[3];
+        *q3 = q[0] * d[3] + q[1] * d[2] - q[2] * d[1] + q[3] * d[0];
     }
 }
 
@@ -182,10 +935,94 @@ psmove_orientation_set_quaternion(PSMoveOrientation *orientation,
 {
     psmove_return_if_fail(orientation != NULL);
 
+    psmove_orientation_lock(orientation);
+    /* Samples taken before the new orientation was set are applied first */
+    psmove_orientation_flush_pending(orientation);
     orientation->quaternion[0] = q0;
     orientation->quaternion[1] = q1;
     orientation->quaternion[2] = q2;
     orientation->quaternion[3] = q3;
+    psmove_orientation_publish(orientation);
+    psmove_orientation_unlock(orientation);
+}
+
+enum PSMove_Bool
+psmove_orientation_set_filter(PSMoveOrientation *orientation,
+        enum PSMove_Orientation_Filter filter)
+{
+    psmove_return_val_if_fail(orientation != NULL, PSMove_False);
+
+    psmove_orientation_filter_func filter_func;
+
+    switch (filter) {
+        case OrientationFilter_Madgwick:
+            filter_func = psmove_orientation_filter_madgwick;
+            break;
+        case OrientationFilter_Mahony:
+            filter_func = psmove_orientation_filter_mahony;
+            break;
+        case OrientationFilter_GyroIntegrator:
+            filter_func = psmove_orientation_filter_gyro;
+            break;
+        default:
+            psmove_CRITICAL("Unknown orientation filter");
+            return PSMove_False;
+    }
+
+    psmove_orientation_lock(orientation);
+    orientation->filter = filter;
+    orientation->filter_func = filter_func;
+    memset(orientation->mahony_integral, 0,
+            sizeof(orientation->mahony_integral));
+    orientation->filter_time_us = 0;
+    orientation->filter_updates = 0;
+    psmove_orientation_unlock(orientation);
+
+    return PSMove_True;
+}
+
+void
+psmove_orientation_set_lazy(PSMoveOrientation *orientation,
+        enum PSMove_Bool lazy)
+{
+    psmove_return_if_fail(orientation != NULL);
+
+    psmove_orientation_lock(orientation);
+    if (!lazy) {
+        psmove_orientation_flush_pending(orientation);
+    }
+    __atomic_store_n(&(orientation->lazy), lazy, __ATOMIC_RELAXED);
+    psmove_orientation_unlock(orientation);
+}
+
+float
+psmove_orientation_get_filter_cost(PSMoveOrientation *orientation)
+{
+    psmove_return_val_if_fail(orientation != NULL, 0.);
+
+    if (orientation->filter_updates == 0) {
+        return 0.;
+    }
+
+    return 1000. * (float)orientation->filter_time_us /
+        (float)orientation->filter_updates;
+}
+
+enum PSMove_Bool
+psmove_orientation_is_still(PSMoveOrientation *orientation)
+{
+    psmove_return_val_if_fail(orientation != NULL, PSMove_False);
+
+    return __atomic_load_n(&(orientation->still), __ATOMIC_RELAXED) ?
+        PSMove_True : PSMove_False;
+}
+
+size_t
+psmove_orientation_get_memory_usage(PSMoveOrientation *orientation)
+{
+    psmove_return_val_if_fail(orientation != NULL, 0);
+
+    return sizeof(PSMoveOrientation);
 }
 
 void
@@ -193,6 +1030,10 @@ psmove_orientation_free(PSMoveOrientation *orientation)
 {
     psmove_return_if_fail(orientation != NULL);
 
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_destroy(&(orientation->lock));
+#endif
+
     free(orientation);
 }
 
@@ -36,26 +36,94 @@ extern "C" {
 #endif
 
 #include "psmove.h"
+#include "psmove_calibration.h"
 
 
 struct _PSMoveOrientation;
 typedef struct _PSMoveOrientation PSMoveOrientation;
 
+/* The values of one input report that are used by the orientation filters */
+typedef struct {
+    int timestamp; /* Hardware timestamp (see psmove_get_timestamp()) */
+    long long time_us; /* Host time of the report (see psmove_util_get_ticks_us()) */
+    float sensors[PSMOVE_SENSOR_VALUES]; /* see psmove_calibration_map_sensors() */
+} PSMoveOrientationSample;
+
 
 ADDAPI PSMoveOrientation *
 ADDCALL psmove_orientation_new(PSMove *move);
 
+/**
+ * Process the current input report of the controller
+ **/
 ADDAPI void
 ADDCALL psmove_orientation_update(PSMoveOrientation *orientation);
 
+/**
+ * Process one sample each for count controllers at once. Controllers using
+ * the Madgwick filter are integrated together in vector registers;
+ * psmove_orientation_update() is the same as a batch of one.
+ *
+ * Updates may be done on any thread (e.g. the input read thread), but not
+ * on two threads at the same time for the same orientation. The getters
+ * read a snapshot of the latest result without locking and can be called
+ * from any thread while an update is running.
+ **/
+ADDAPI void
+ADDCALL psmove_orientation_update_batch(PSMoveOrientation **orientations,
+        const PSMoveOrientationSample *samples, int count);
+
 ADDAPI void
 ADDCALL psmove_orientation_get_quaternion(PSMoveOrientation *orientation,
         float *q0, float *q1, float *q2, float *q3);
 
+/**
+ * Extrapolate the quaternion dt_us microseconds from now, assuming the
+ * latest gyroscope rate stays constant (see psmove_get_orientation_predicted)
+ **/
+ADDAPI void
+ADDCALL psmove_orientation_get_quaternion_predicted(PSMoveOrientation *orientation,
+        int dt_us, float *q0, float *q1, float *q2, float *q3);
+
 ADDAPI void
 ADDCALL psmove_orientation_set_quaternion(PSMoveOrientation *orientation,
         float q0, float q1, float q2, float q3);
 
+/**
+ * Select the filter algorithm (resets the cost measurement)
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_orientation_set_filter(PSMoveOrientation *orientation,
+        enum PSMove_Orientation_Filter filter);
+
+/**
+ * Lazy mode: Updates only buffer the samples, which are integrated when
+ * the orientation is read (the getters then take the lock)
+ **/
+ADDAPI void
+ADDCALL psmove_orientation_set_lazy(PSMoveOrientation *orientation,
+        enum PSMove_Bool lazy);
+
+/**
+ * Average time per filter update (one half-frame), in nanoseconds
+ **/
+ADDAPI float
+ADDCALL psmove_orientation_get_filter_cost(PSMoveOrientation *orientation);
+
+/**
+ * Nonzero while the controller lies still and the filter is paused
+ * (see psmove_is_still)
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_orientation_is_still(PSMoveOrientation *orientation);
+
+/**
+ * Memory used by the orientation instance (in bytes), see
+ * psmove_get_memory_usage().
+ **/
+ADDAPI size_t
+ADDCALL psmove_orientation_get_memory_usage(PSMoveOrientation *orientation);
+
 ADDAPI void
 ADDCALL psmove_orientation_free(PSMoveOrientation *orientation);
 
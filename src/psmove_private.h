@@ -48,6 +48,15 @@ extern "C" {
      * implementation modules (psmove_*.c) should go here.
      **/
 
+/* Use pthreads for background threads and locking (Linux only for now) */
+#if defined(__linux)
+#  define PSMOVE_USE_PTHREADS
+#endif
+
+#if defined(PSMOVE_USE_PTHREADS)
+#  include <pthread.h>
+#endif
+
 /* Macro: Print a critical message if an assertion fails */
 #define psmove_CRITICAL(x) \
         {fprintf(stderr, "[PSMOVE] Assertion fail in %s: %s\n", __func__, x);}
@@ -63,6 +72,9 @@ extern "C" {
         {if(!(expr)){psmove_CRITICAL(#expr);return(val);}}
 
 
+/* Maximum length of the serial string */
+#define PSMOVE_MAX_SERIAL_LENGTH 255
+
 /* Buffer size for calibration data */
 #define PSMOVE_CALIBRATION_SIZE 49
 
@@ -83,6 +95,14 @@ ADDCALL _psmove_write_data(PSMove *move, unsigned char *data, int length);
 ADDAPI void
 ADDCALL _psmove_read_data(PSMove *move, unsigned char *data, int length);
 
+/**
+ * [PRIVATE API] Read raw data blob from device, waiting up to timeout_ms
+ * for a new report (see psmove_wait_for_input())
+ **/
+ADDAPI void
+ADDCALL _psmove_read_data_timeout(PSMove *move, unsigned char *data,
+        int length, int timeout_ms);
+
 /**
  * [PRIVATE API] Disable the connection to remote servers
  *
@@ -111,6 +131,71 @@ ADDCALL _psmove_disable_local();
 ADDAPI int
 ADDCALL _psmove_get_calibration_blob(PSMove *move, char **dest, size_t *size);
 
+/**
+ * [PRIVATE API] Get calibrated accelerometer and gyroscope values
+ *
+ * Decodes and maps all sensor values of the current input report in one go
+ * (see psmove_calibration_map_sensors() for the layout of output, which
+ * must have room for PSMOVE_SENSOR_VALUES floats).
+ **/
+ADDAPI void
+ADDCALL _psmove_get_calibrated_sensors(PSMove *move, float *output);
+
+/**
+ * [PRIVATE API] Get the host time at which the current input report was
+ * received (see psmove_util_get_ticks_us(); for replayed devices, this is
+ * the recorded time)
+ **/
+ADDAPI long long
+ADDCALL _psmove_get_input_time_us(PSMove *move);
+
+/**
+ * [PRIVATE API] Get the number of input reports that have been received
+ * from the device, but not returned by psmove_poll() yet
+ **/
+ADDAPI int
+ADDCALL _psmove_get_queued_reports(PSMove *move);
+
+/**
+ * [PRIVATE API] Get the name of the transport used to talk to the device
+ * ("hidapi", "hidraw", "moved" for UDP, "moved-shm" for shared memory
+ * of a moved on the same host, or "replay")
+ **/
+ADDAPI const char *
+ADDCALL _psmove_get_transport(PSMove *move);
+
+/**
+ * Trace points for timing analysis (see psmove_trace_dump())
+ *
+ * Only compiled in with PSMOVE_USE_TRACE. The names must be string
+ * literals (they are recorded as pointers and only read when dumping).
+ * Every PSMOVE_TRACE_BEGIN needs a PSMOVE_TRACE_END on the same thread.
+ **/
+#if defined(PSMOVE_USE_TRACE)
+#  define PSMOVE_TRACE_BEGIN(name) _psmove_trace_event(name, 'B')
+#  define PSMOVE_TRACE_END(name) _psmove_trace_event(name, 'E')
+#  define PSMOVE_TRACE_INSTANT(name) _psmove_trace_event(name, 'i')
+#  define PSMOVE_TRACE_THREAD_NAME(name) _psmove_trace_thread_name(name)
+
+/**
+ * [PRIVATE API] Record a trace event ('B'egin, 'E'nd or 'i'nstant) in the
+ * event ring of the calling thread
+ **/
+ADDAPI void
+ADDCALL _psmove_trace_event(const char *name, char phase);
+
+/**
+ * [PRIVATE API] Name the calling thread in the trace
+ **/
+ADDAPI void
+ADDCALL _psmove_trace_thread_name(const char *name);
+#else
+#  define PSMOVE_TRACE_BEGIN(name) do {} while (0)
+#  define PSMOVE_TRACE_END(name) do {} while (0)
+#  define PSMOVE_TRACE_INSTANT(name) do {} while (0)
+#  define PSMOVE_TRACE_THREAD_NAME(name) do {} while (0)
+#endif
+
 /* A Bluetooth address. */
 typedef unsigned char PSMove_Data_BTAddr[6];
 
@@ -144,6 +229,51 @@ ADDCALL _psmove_btaddr_to_string(const PSMove_Data_BTAddr addr);
 ADDAPI int
 ADDCALL _psmove_read_btaddrs(PSMove *move, PSMove_Data_BTAddr *host, PSMove_Data_BTAddr *controller);
 
+/**
+ * Get the addresses of the available Bluetooth adapters of this machine
+ *
+ * Stores up to max addresses in addrs, in the byte order expected by
+ * psmove_set_btaddr() (the same as returned by _psmove_btaddr_from_string()).
+ * On Mac OS X, only the default adapter is returned.
+ *
+ * Returns the number of addresses stored.
+ **/
+ADDAPI int
+ADDCALL _psmove_get_host_btaddrs(PSMove_Data_BTAddr *addrs, int max);
+
+/**
+ * Set the Host Bluetooth address that is used to connect via
+ * Bluetooth. You should set this to the local computer's
+ * Bluetooth address when connected via USB, then disconnect
+ * and press the PS button to connect the controller via BT.
+ *
+ * The address is in the byte order of _psmove_btaddr_from_string().
+ **/
+ADDAPI int
+ADDCALL psmove_set_btaddr(PSMove *move, PSMove_Data_BTAddr *addr);
+
+#if defined(PSMOVE_USE_PTHREADS)
+/**
+ * Apply a scheduling policy (see psmove_set_thread_policy()) to a thread
+ *
+ * Used for the library's own threads and for the threads of the tracker.
+ * On failure, a warning is printed and the thread keeps its scheduling.
+ *
+ * Returns nonzero on success, zero on error.
+ **/
+int
+_psmove_thread_apply_policy(pthread_t thread, const PSMoveThreadPolicy *policy);
+
+/**
+ * Apply the current policy of a type of thread to the calling thread, if
+ * it has been changed since *generation (start with *generation = -1)
+ *
+ * This is cheap enough to be called for every report or LED update.
+ **/
+void
+_psmove_thread_update_policy(enum PSMove_Thread_Type type, int *generation);
+#endif
+
 
 
 
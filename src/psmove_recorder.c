@@ -0,0 +1,229 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+
+
+#include "psmove_private.h"
+#include "psmove_recorder.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(PSMOVE_USE_PTHREADS)
+#  include <pthread.h>
+#  include <sys/time.h>
+#endif
+
+/* Size of each of the two in-memory record buffers */
+#define PSMOVE_RECORDER_BUFFER_SIZE (64 * 1024)
+
+/* Maximum time between two flushes by the writer thread */
+#define PSMOVE_RECORDER_FLUSH_INTERVAL_MS 100
+
+struct _PSMoveRecorder {
+    FILE *fp;
+
+#if defined(PSMOVE_USE_PTHREADS)
+    /**
+     * Double buffering: Records are appended to "buffer", while the
+     * writer thread writes out "spare" without holding the lock.
+     **/
+    char *buffer;
+    size_t buffer_used;
+    char *spare;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t thread;
+    int running;
+#endif
+};
+
+
+#if defined(PSMOVE_USE_PTHREADS)
+static void *
+_psmove_recorder_thread_proc(void *data)
+{
+    PSMoveRecorder *recorder = (PSMoveRecorder*)data;
+    struct timespec deadline;
+    struct timeval now;
+    size_t used;
+    char *tmp;
+    int running = 1;
+
+    pthread_mutex_lock(&(recorder->mutex));
+    while (running) {
+        running = recorder->running;
+
+        if (running && recorder->buffer_used < PSMOVE_RECORDER_BUFFER_SIZE / 2) {
+            gettimeofday(&now, NULL);
+            deadline.tv_sec = now.tv_sec;
+            deadline.tv_nsec = (now.tv_usec +
+                    PSMOVE_RECORDER_FLUSH_INTERVAL_MS * 1000) * 1000;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000;
+            deadline.tv_nsec %= 1000000000;
+            pthread_cond_timedwait(&(recorder->cond), &(recorder->mutex),
+                    &deadline);
+            running = recorder->running;
+        }
+
+        /* Swap buffers, then write out the filled one without the lock */
+        tmp = recorder->spare;
+        recorder->spare = recorder->buffer;
+        recorder->buffer = tmp;
+        used = recorder->buffer_used;
+        recorder->buffer_used = 0;
+
+        if (used > 0) {
+            pthread_mutex_unlock(&(recorder->mutex));
+            fwrite(recorder->spare, 1, used, recorder->fp);
+            fflush(recorder->fp);
+            pthread_mutex_lock(&(recorder->mutex));
+        }
+    }
+    pthread_mutex_unlock(&(recorder->mutex));
+
+    return NULL;
+}
+#endif
+
+PSMoveRecorder *
+psmove_recorder_new(const char *filename)
+{
+    PSMoveRecorder *recorder;
+    PSMoveRecordingHeader header;
+
+    psmove_return_val_if_fail(filename != NULL, NULL);
+
+    recorder = (PSMoveRecorder*)calloc(1, sizeof(PSMoveRecorder));
+    recorder->fp = fopen(filename, "wb");
+
+    if (recorder->fp == NULL) {
+#ifdef PSMOVE_DEBUG
+        fprintf(stderr, "[PSMOVE] Cannot create recording: %s\n", filename);
+#endif
+        free(recorder);
+        return NULL;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PSMOVE_RECORDING_MAGIC, sizeof(header.magic));
+    header.version = PSMOVE_RECORDING_VERSION;
+    fwrite(&header, sizeof(header), 1, recorder->fp);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    recorder->buffer = (char*)malloc(PSMOVE_RECORDER_BUFFER_SIZE);
+    recorder->spare = (char*)malloc(PSMOVE_RECORDER_BUFFER_SIZE);
+    pthread_mutex_init(&(recorder->mutex), NULL);
+    pthread_cond_init(&(recorder->cond), NULL);
+    recorder->running = 1;
+
+    if (pthread_create(&(recorder->thread), NULL,
+                _psmove_recorder_thread_proc, recorder) != 0) {
+        psmove_CRITICAL("Cannot create recorder thread");
+        pthread_mutex_destroy(&(recorder->mutex));
+        pthread_cond_destroy(&(recorder->cond));
+        free(recorder->buffer);
+        free(recorder->spare);
+        fclose(recorder->fp);
+        free(recorder);
+        return NULL;
+    }
+#endif
+
+    return recorder;
+}
+
+void
+psmove_recorder_write(PSMoveRecorder *recorder,
+        enum PSMove_Record_Type type, int device, long long time_us,
+        const void *data, int length)
+{
+    PSMoveRecord record;
+
+    psmove_return_if_fail(recorder != NULL);
+    psmove_return_if_fail(length >= 0 && length <= 0xFFFF);
+
+    memset(&record, 0, sizeof(record));
+    record.time_us = time_us;
+    record.type = (unsigned char)type;
+    record.device = (unsigned char)device;
+    record.length = (unsigned short)length;
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_lock(&(recorder->mutex));
+
+    if (recorder->buffer_used + sizeof(record) + length >
+            PSMOVE_RECORDER_BUFFER_SIZE) {
+        /* Writer thread can't keep up - drop the record */
+        pthread_mutex_unlock(&(recorder->mutex));
+#ifdef PSMOVE_DEBUG
+        fprintf(stderr, "[PSMOVE] Recording buffer full, record dropped\n");
+#endif
+        return;
+    }
+
+    memcpy(recorder->buffer + recorder->buffer_used, &record, sizeof(record));
+    recorder->buffer_used += sizeof(record);
+    memcpy(recorder->buffer + recorder->buffer_used, data, length);
+    recorder->buffer_used += length;
+
+    if (recorder->buffer_used >= PSMOVE_RECORDER_BUFFER_SIZE / 2) {
+        pthread_cond_signal(&(recorder->cond));
+    }
+
+    pthread_mutex_unlock(&(recorder->mutex));
+#else
+    fwrite(&record, sizeof(record), 1, recorder->fp);
+    fwrite(data, 1, length, recorder->fp);
+#endif
+}
+
+void
+psmove_recorder_free(PSMoveRecorder *recorder)
+{
+    psmove_return_if_fail(recorder != NULL);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    /* The writer thread flushes the remaining records before exiting */
+    pthread_mutex_lock(&(recorder->mutex));
+    recorder->running = 0;
+    pthread_cond_signal(&(recorder->cond));
+    pthread_mutex_unlock(&(recorder->mutex));
+    pthread_join(recorder->thread, NULL);
+
+    pthread_mutex_destroy(&(recorder->mutex));
+    pthread_cond_destroy(&(recorder->cond));
+    free(recorder->buffer);
+    free(recorder->spare);
+#endif
+
+    fclose(recorder->fp);
+    free(recorder);
+}
@@ -0,0 +1,111 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+
+#ifndef PSMOVE_RECORDER_H
+#define PSMOVE_RECORDER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "psmove.h"
+
+/**
+ * Recording file format (all values in host byte order):
+ *
+ *  - One PSMoveRecordingHeader at the start of the file
+ *  - A sequence of records, each consisting of a PSMoveRecord header
+ *    followed by "length" bytes of payload
+ *
+ * Each controller gets a small per-recording device number, which is
+ * introduced by a Record_Device record (payload: serial number, not
+ * NUL-terminated) before its first Record_Input record (payload: the
+ * raw input report as read from the controller).
+ **/
+
+#define PSMOVE_RECORDING_MAGIC "PSMR"
+#define PSMOVE_RECORDING_VERSION 1
+
+enum PSMove_Record_Type {
+    Record_Device = 0x01,
+    Record_Input = 0x02,
+};
+
+typedef struct {
+    char magic[4];
+    int version;
+} PSMoveRecordingHeader;
+
+typedef struct {
+    /* Host time at which the record was captured (microseconds) */
+    long long time_us;
+
+    unsigned char type; /* enum PSMove_Record_Type */
+    unsigned char device;
+    unsigned short length;
+    int _reserved;
+} PSMoveRecord;
+
+
+struct _PSMoveRecorder;
+typedef struct _PSMoveRecorder PSMoveRecorder;
+
+
+/**
+ * Create a new recorder writing to filename (the file is truncated).
+ *
+ * Returns NULL if the file cannot be created.
+ **/
+ADDAPI PSMoveRecorder *
+ADDCALL psmove_recorder_new(const char *filename);
+
+/**
+ * Append a record to the recording.
+ *
+ * This only copies the record into an in-memory buffer; the buffer is
+ * written to disk asynchronously by a background thread (where pthreads
+ * are available) or by stdio buffering (elsewhere).
+ **/
+ADDAPI void
+ADDCALL psmove_recorder_write(PSMoveRecorder *recorder,
+        enum PSMove_Record_Type type, int device, long long time_us,
+        const void *data, int length);
+
+/**
+ * Flush all pending records to disk, close the file and free the recorder.
+ **/
+ADDAPI void
+ADDCALL psmove_recorder_free(PSMoveRecorder *recorder);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,293 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+
+
+#include "psmove_private.h"
+#include "psmove_recorder.h"
+#include "psmove_replay.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#  include <sys/mman.h>
+#endif
+
+struct _PSMoveReplay {
+    /* The recording, mapped into memory */
+    const char *data;
+    size_t size;
+
+    /* Offset of the next record to be examined */
+    size_t offset;
+
+    int device;
+    enum PSMove_Replay_Mode mode;
+    char serial[PSMOVE_MAX_SERIAL_LENGTH];
+
+    /**
+     * For Replay_RealTime: Host time of the first read and recorded time
+     * of the first report, to determine when the next report is due
+     **/
+    long long start_time_us;
+    long long start_record_us;
+};
+
+
+/* PRIVATE FUNCTION DEFINITIONS - ONLY USED IN THIS MODULE DIRECTLY */
+
+/**
+ * Copy the header of the record at offset into *record (records are not
+ * aligned in the file). Returns zero if there is no complete record.
+ **/
+static int
+_psmove_replay_record_at(PSMoveReplay *replay, size_t offset,
+        PSMoveRecord *record)
+{
+    if (offset + sizeof(PSMoveRecord) > replay->size) {
+        return 0;
+    }
+
+    memcpy(record, replay->data + offset, sizeof(PSMoveRecord));
+    if (offset + sizeof(PSMoveRecord) + record->length > replay->size) {
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Advance replay->offset to the next input report of the replayed device
+ **/
+static int
+_psmove_replay_next_input(PSMoveReplay *replay, PSMoveRecord *record)
+{
+    while (_psmove_replay_record_at(replay, replay->offset, record)) {
+        if (record->type == Record_Input && record->device == replay->device) {
+            return 1;
+        }
+        replay->offset += sizeof(PSMoveRecord) + record->length;
+    }
+
+    return 0;
+}
+
+static void
+_psmove_replay_unmap(PSMoveReplay *replay)
+{
+#ifdef _WIN32
+    free((void*)replay->data);
+#else
+    munmap((void*)replay->data, replay->size);
+#endif
+}
+
+
+/* PUBLIC FUNCTION DEFINITIONS */
+
+PSMoveReplay *
+psmove_replay_new(const char *filename, int device,
+        enum PSMove_Replay_Mode mode)
+{
+    PSMoveReplay *replay;
+    PSMoveRecordingHeader header;
+    PSMoveRecord record;
+    struct stat st;
+    char *data = NULL;
+    size_t offset;
+    int found = 0;
+    int fd;
+
+    psmove_return_val_if_fail(filename != NULL, NULL);
+    psmove_return_val_if_fail(device >= 0, NULL);
+
+    fd = open(filename, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(PSMoveRecordingHeader)) {
+        close(fd);
+        return NULL;
+    }
+
+#ifdef _WIN32
+    /* No mmap() on Windows - read the file into memory instead */
+    data = malloc(st.st_size);
+    if (read(fd, data, st.st_size) != st.st_size) {
+        free(data);
+        data = NULL;
+    }
+#else
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        data = NULL;
+    }
+#endif
+    close(fd);
+
+    if (data == NULL) {
+        return NULL;
+    }
+
+    replay = (PSMoveReplay*)calloc(1, sizeof(PSMoveReplay));
+    replay->data = data;
+    replay->size = st.st_size;
+    replay->offset = sizeof(PSMoveRecordingHeader);
+    replay->device = device;
+    replay->mode = mode;
+    replay->start_time_us = -1;
+
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, PSMOVE_RECORDING_MAGIC, 4) != 0 ||
+            header.version != PSMOVE_RECORDING_VERSION) {
+#ifdef PSMOVE_DEBUG
+        fprintf(stderr, "[PSMOVE] Not a valid recording: %s\n", filename);
+#endif
+        psmove_replay_free(replay);
+        return NULL;
+    }
+
+    /* Find the serial number of the device (announced before its input) */
+    offset = replay->offset;
+    while (_psmove_replay_record_at(replay, offset, &record)) {
+        if (record.type == Record_Device && record.device == device) {
+            int length = record.length;
+            if (length >= PSMOVE_MAX_SERIAL_LENGTH) {
+                length = PSMOVE_MAX_SERIAL_LENGTH - 1;
+            }
+            memcpy(replay->serial, data + offset + sizeof(PSMoveRecord), length);
+            found = 1;
+            break;
+        }
+        offset += sizeof(PSMoveRecord) + record.length;
+    }
+
+    if (!found) {
+#ifdef PSMOVE_DEBUG
+        fprintf(stderr, "[PSMOVE] No device %d in recording: %s\n",
+                device, filename);
+#endif
+        psmove_replay_free(replay);
+        return NULL;
+    }
+
+    return replay;
+}
+
+const char *
+psmove_replay_get_serial(PSMoveReplay *replay)
+{
+    psmove_return_val_if_fail(replay != NULL, NULL);
+
+    return replay->serial;
+}
+
+int
+psmove_replay_read(PSMoveReplay *replay, void *data, int length,
+        int timeout_ms, long long *time_us)
+{
+    PSMoveRecord record;
+    long long started, now, due;
+
+    psmove_return_val_if_fail(replay != NULL, 0);
+    psmove_return_val_if_fail(data != NULL, 0);
+
+    if (!_psmove_replay_next_input(replay, &record)) {
+        return 0;
+    }
+
+    if (replay->mode == Replay_RealTime) {
+        started = now = psmove_util_get_ticks_us();
+
+        if (replay->start_time_us < 0) {
+            replay->start_time_us = now;
+            replay->start_record_us = record.time_us;
+        }
+
+        due = replay->start_time_us + (record.time_us - replay->start_record_us);
+        while (now < due) {
+            long long wait_us = due - now;
+
+            if (timeout_ms == 0) {
+                return 0;
+            }
+
+            if (timeout_ms > 0) {
+                long long remaining_us = (long long)timeout_ms * 1000 -
+                    (now - started);
+                if (remaining_us <= 0) {
+                    return 0;
+                }
+                if (remaining_us < wait_us) {
+                    wait_us = remaining_us;
+                }
+            }
+
+            usleep(wait_us);
+            now = psmove_util_get_ticks_us();
+        }
+    }
+
+    if (length > record.length) {
+        length = record.length;
+    }
+    memcpy(data, replay->data + replay->offset + sizeof(PSMoveRecord), length);
+
+    if (time_us != NULL) {
+        *time_us = record.time_us;
+    }
+
+    replay->offset += sizeof(PSMoveRecord) + record.length;
+
+    return length;
+}
+
+enum PSMove_Bool
+psmove_replay_finished(PSMoveReplay *replay)
+{
+    PSMoveRecord record;
+
+    psmove_return_val_if_fail(replay != NULL, PSMove_True);
+
+    return !_psmove_replay_next_input(replay, &record);
+}
+
+void
+psmove_replay_free(PSMoveReplay *replay)
+{
+    psmove_return_if_fail(replay != NULL);
+
+    _psmove_replay_unmap(replay);
+    free(replay);
+}
@@ -0,0 +1,91 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+
+#ifndef PSMOVE_REPLAY_H
+#define PSMOVE_REPLAY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "psmove.h"
+
+
+struct _PSMoveReplay;
+typedef struct _PSMoveReplay PSMoveReplay;
+
+
+/**
+ * Open the input reports of one controller in a recording made with
+ * psmove_start_recording() (see psmove_recorder.h for the file format).
+ *
+ * device is the per-recording device number (0 for the first controller
+ * that was recorded, 1 for the second one, ...).
+ *
+ * Returns NULL if the file is not a valid recording or does not contain
+ * the requested device.
+ **/
+ADDAPI PSMoveReplay *
+ADDCALL psmove_replay_new(const char *filename, int device,
+        enum PSMove_Replay_Mode mode);
+
+/**
+ * Get the serial number of the recorded controller
+ **/
+ADDAPI const char *
+ADDCALL psmove_replay_get_serial(PSMoveReplay *replay);
+
+/**
+ * Copy the next input report into data, waiting at most timeout_ms
+ * milliseconds for it to become due (only in Replay_RealTime mode;
+ * 0 = don't wait, negative = wait forever).
+ *
+ * The recorded host timestamp of the report is stored in *time_us.
+ *
+ * Returns the number of bytes copied, or 0 if no report is available.
+ **/
+ADDAPI int
+ADDCALL psmove_replay_read(PSMoveReplay *replay, void *data, int length,
+        int timeout_ms, long long *time_us);
+
+/**
+ * Returns PSMove_True if all input reports have been read
+ **/
+ADDAPI enum PSMove_Bool
+ADDCALL psmove_replay_finished(PSMoveReplay *replay);
+
+ADDAPI void
+ADDCALL psmove_replay_free(PSMoveReplay *replay);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
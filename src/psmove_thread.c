@@ -0,0 +1,155 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+
+/* For the CPU affinity functions of pthreads */
+#ifndef _GNU_SOURCE
+#  define _GNU_SOURCE
+#endif
+
+#include "psmove.h"
+#include "psmove_private.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(PSMOVE_USE_PTHREADS)
+#  include <pthread.h>
+#  include <sched.h>
+#endif
+
+/* Number of values of enum PSMove_Thread_Type */
+#define PSMOVE_THREAD_TYPES (Thread_LEDWriter + 1)
+
+#if defined(PSMOVE_USE_PTHREADS)
+/* Protects psmove_thread_policies, the generation of a type is bumped on change */
+static pthread_mutex_t psmove_thread_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PSMoveThreadPolicy psmove_thread_policies[PSMOVE_THREAD_TYPES];
+static int psmove_thread_generations[PSMOVE_THREAD_TYPES];
+
+int
+_psmove_thread_apply_policy(pthread_t thread, const PSMoveThreadPolicy *policy)
+{
+    struct sched_param param;
+    cpu_set_t cpus;
+    int result = 1;
+    int i;
+
+    CPU_ZERO(&cpus);
+    for (i = 0; i < 64 && i < CPU_SETSIZE; i++) {
+        if (policy->cpu_mask & (1ULL << i)) {
+            CPU_SET(i, &cpus);
+        }
+    }
+
+    /* No mask keeps the inherited affinity (e.g. when started by taskset) */
+    if (policy->cpu_mask != 0 &&
+            pthread_setaffinity_np(thread, sizeof(cpus), &cpus) != 0) {
+        fprintf(stderr, "[PSMOVE] Warning: Cannot set CPU affinity "
+                "(mask 0x%llx)\n", policy->cpu_mask);
+        result = 0;
+    }
+
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = policy->priority;
+    if (pthread_setschedparam(thread, (policy->priority > 0) ?
+                SCHED_FIFO : SCHED_OTHER, &param) != 0) {
+        fprintf(stderr, "[PSMOVE] Warning: Cannot set realtime priority %d "
+                "(missing rights?)\n", policy->priority);
+        result = 0;
+    }
+
+    return result;
+}
+
+void
+_psmove_thread_update_policy(enum PSMove_Thread_Type type, int *generation)
+{
+    PSMoveThreadPolicy policy;
+    int current = __atomic_load_n(psmove_thread_generations + type,
+            __ATOMIC_ACQUIRE);
+
+    if (current == *generation) {
+        return;
+    }
+
+    pthread_mutex_lock(&psmove_thread_mutex);
+    policy = psmove_thread_policies[type];
+    *generation = psmove_thread_generations[type];
+    pthread_mutex_unlock(&psmove_thread_mutex);
+
+    /* A new thread with the default policy has nothing to change */
+    if (current != 0 || policy.cpu_mask != 0 || policy.priority != 0) {
+        _psmove_thread_apply_policy(pthread_self(), &policy);
+    }
+}
+#endif
+
+enum PSMove_Bool
+psmove_set_thread_policy(enum PSMove_Thread_Type type,
+        const PSMoveThreadPolicy *policy)
+{
+    psmove_return_val_if_fail(type >= 0 && type < PSMOVE_THREAD_TYPES,
+            PSMove_False);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    int max_priority = sched_get_priority_max(SCHED_FIFO);
+
+    psmove_return_val_if_fail(policy == NULL || (policy->priority >= 0 &&
+                policy->priority <= max_priority), PSMove_False);
+
+    pthread_mutex_lock(&psmove_thread_mutex);
+    if (policy != NULL) {
+        psmove_thread_policies[type] = *policy;
+    } else {
+        memset(psmove_thread_policies + type, 0, sizeof(PSMoveThreadPolicy));
+    }
+    __atomic_add_fetch(psmove_thread_generations + type, 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&psmove_thread_mutex);
+
+    return PSMove_True;
+#else
+    return PSMove_False;
+#endif
+}
+
+void
+psmove_get_thread_policy(enum PSMove_Thread_Type type,
+        PSMoveThreadPolicy *policy)
+{
+    psmove_return_if_fail(type >= 0 && type < PSMOVE_THREAD_TYPES);
+    psmove_return_if_fail(policy != NULL);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_lock(&psmove_thread_mutex);
+    *policy = psmove_thread_policies[type];
+    pthread_mutex_unlock(&psmove_thread_mutex);
+#else
+    memset(policy, 0, sizeof(PSMoveThreadPolicy));
+#endif
+}
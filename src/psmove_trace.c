@@ -0,0 +1,253 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+
+#include "psmove_private.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(PSMOVE_USE_TRACE)
+
+#if defined(_WIN32)
+#  include <windows.h>
+#  define psmove_trace_pid() ((int)GetCurrentProcessId())
+#else
+#  include <unistd.h>
+#  define psmove_trace_pid() ((int)getpid())
+#endif
+
+/* Number of events kept per thread (older events are overwritten) */
+#define PSMOVE_TRACE_EVENTS (32 * 1024)
+
+/* If set, the trace is written to this file when the process exits */
+#define PSMOVE_TRACE_FILE_ENV "PSMOVE_TRACE_FILE"
+
+typedef struct {
+    long long time_us;
+    const char *name;
+    char phase;
+} PSMoveTraceEvent;
+
+/**
+ * Each thread writes into its own ring, so recording an event needs no
+ * locking and no atomic read-modify-write. The rings are never freed (so
+ * the events of threads that have exited are still dumped); they are kept
+ * in a list that is only ever prepended to.
+ **/
+typedef struct _PSMoveTraceBuffer {
+    struct _PSMoveTraceBuffer *next;
+    int tid;
+    const char *thread_name;
+
+    /* Number of events ever written (only changed by the owning thread) */
+    unsigned long written;
+    PSMoveTraceEvent events[PSMOVE_TRACE_EVENTS];
+} PSMoveTraceBuffer;
+
+static PSMoveTraceBuffer *psmove_trace_buffers = NULL;
+static int psmove_trace_threads = 0;
+static __thread PSMoveTraceBuffer *psmove_trace_buffer = NULL;
+
+static void
+_psmove_trace_dump_at_exit()
+{
+    const char *filename = getenv(PSMOVE_TRACE_FILE_ENV);
+
+    if (filename != NULL && !psmove_trace_dump(filename)) {
+        fprintf(stderr, "[PSMOVE] Cannot write trace to %s\n", filename);
+    }
+}
+
+static PSMoveTraceBuffer *
+_psmove_trace_get_buffer()
+{
+    PSMoveTraceBuffer *buffer = psmove_trace_buffer;
+
+    if (buffer != NULL) {
+        return buffer;
+    }
+
+    buffer = calloc(1, sizeof(PSMoveTraceBuffer));
+    if (buffer == NULL) {
+        return NULL;
+    }
+
+    buffer->tid = __atomic_add_fetch(&psmove_trace_threads, 1,
+            __ATOMIC_RELAXED);
+    if (buffer->tid == 1 && getenv(PSMOVE_TRACE_FILE_ENV) != NULL) {
+        atexit(_psmove_trace_dump_at_exit);
+    }
+
+    buffer->next = __atomic_load_n(&psmove_trace_buffers, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&psmove_trace_buffers,
+                &(buffer->next), buffer, 1,
+                __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+
+    psmove_trace_buffer = buffer;
+    return buffer;
+}
+
+void
+_psmove_trace_event(const char *name, char phase)
+{
+    PSMoveTraceBuffer *buffer = _psmove_trace_get_buffer();
+
+    if (buffer == NULL) {
+        return;
+    }
+
+    unsigned long index = buffer->written;
+    PSMoveTraceEvent *event = &(buffer->events[index % PSMOVE_TRACE_EVENTS]);
+    event->time_us = psmove_util_get_ticks_us();
+    event->name = name;
+    event->phase = phase;
+
+    /* Publish the event to psmove_trace_dump() */
+    __atomic_store_n(&(buffer->written), index + 1, __ATOMIC_RELEASE);
+}
+
+void
+_psmove_trace_thread_name(const char *name)
+{
+    PSMoveTraceBuffer *buffer = _psmove_trace_get_buffer();
+
+    if (buffer != NULL) {
+        __atomic_store_n(&(buffer->thread_name), name, __ATOMIC_RELEASE);
+    }
+}
+
+/* Write the events of one thread, returns the new value of first */
+static int
+_psmove_trace_dump_buffer(FILE *fp, PSMoveTraceBuffer *buffer,
+        PSMoveTraceEvent *copy, int pid, int first)
+{
+    const char *thread_name = __atomic_load_n(&(buffer->thread_name),
+            __ATOMIC_ACQUIRE);
+    unsigned long end = __atomic_load_n(&(buffer->written), __ATOMIC_ACQUIRE);
+    unsigned long start = (end > PSMOVE_TRACE_EVENTS) ?
+        (end - PSMOVE_TRACE_EVENTS) : 0;
+    unsigned long base = start;
+    unsigned long i;
+    int depth = 0;
+
+    if (thread_name != NULL) {
+        fprintf(fp, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+                "\"tid\":%d,\"args\":{\"name\":\"%s\"}}", first ? "" : ",",
+                pid, buffer->tid, thread_name);
+        first = 0;
+    }
+
+    for (i=start; i<end; i++) {
+        copy[i - base] = buffer->events[i % PSMOVE_TRACE_EVENTS];
+    }
+
+    /**
+     * The owning thread keeps recording while we copy: Skip the events
+     * that might have been overwritten in the meantime.
+     **/
+    unsigned long written = __atomic_load_n(&(buffer->written),
+            __ATOMIC_ACQUIRE);
+    if (written > PSMOVE_TRACE_EVENTS &&
+            written - PSMOVE_TRACE_EVENTS > start) {
+        start = written - PSMOVE_TRACE_EVENTS;
+    }
+
+    for (i=start; i<end; i++) {
+        PSMoveTraceEvent *event = &(copy[i - base]);
+
+        /* The beginning of the oldest events might have been overwritten */
+        if (event->phase == 'B') {
+            depth++;
+        } else if (event->phase == 'E') {
+            if (depth == 0) {
+                continue;
+            }
+            depth--;
+        }
+
+        fprintf(fp, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%lld,"
+                "\"pid\":%d,\"tid\":%d%s}", first ? "" : ",",
+                event->name, event->phase, event->time_us, pid, buffer->tid,
+                (event->phase == 'i') ? ",\"s\":\"t\"" : "");
+        first = 0;
+    }
+
+    return first;
+}
+
+enum PSMove_Bool
+psmove_trace_dump(const char *filename)
+{
+    psmove_return_val_if_fail(filename != NULL, PSMove_False);
+
+    PSMoveTraceEvent *copy = malloc(PSMOVE_TRACE_EVENTS *
+            sizeof(PSMoveTraceEvent));
+    if (copy == NULL) {
+        return PSMove_False;
+    }
+
+    FILE *fp = fopen(filename, "w");
+    if (fp == NULL) {
+        free(copy);
+        return PSMove_False;
+    }
+
+    int pid = psmove_trace_pid();
+    int first = 1;
+    PSMoveTraceBuffer *buffer = __atomic_load_n(&psmove_trace_buffers,
+            __ATOMIC_ACQUIRE);
+
+    fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (; buffer != NULL; buffer = buffer->next) {
+        first = _psmove_trace_dump_buffer(fp, buffer, copy, pid, first);
+    }
+    fprintf(fp, "\n]}\n");
+
+    int result = (ferror(fp) == 0);
+    if (fclose(fp) != 0) {
+        result = 0;
+    }
+    free(copy);
+
+    return result ? PSMove_True : PSMove_False;
+}
+
+#else
+
+enum PSMove_Bool
+psmove_trace_dump(const char *filename)
+{
+    psmove_return_val_if_fail(filename != NULL, PSMove_False);
+
+    /* Built without PSMOVE_USE_TRACE, there are no trace points */
+    return PSMove_False;
+}
+
+#endif
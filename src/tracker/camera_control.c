@@ -34,9 +34,70 @@
 #include "../external/iniparser/iniparser.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "camera_control_private.h"
 
+/* Grab a frame from the camera and undistort it (blocks until available) */
+static IplImage *
+camera_control_capture_frame(CameraControl* cc);
+
+#if defined(PSMOVE_USE_PTHREADS)
+static void *
+camera_control_capture_proc(void *data)
+{
+    CameraControl *cc = (CameraControl *)data;
+
+    PSMOVE_TRACE_THREAD_NAME("camera capture");
+
+    while (1) {
+        pthread_mutex_lock(&cc->capture_mutex);
+        PSMOVE_TRACE_BEGIN("camera_capture");
+        IplImage *frame = camera_control_capture_frame(cc);
+        PSMOVE_TRACE_END("camera_capture");
+        pthread_mutex_lock(&cc->buffer_mutex);
+        if (cc->capture_quit || !frame) {
+            pthread_mutex_unlock(&cc->buffer_mutex);
+            pthread_mutex_unlock(&cc->capture_mutex);
+            break;
+        }
+        pthread_mutex_unlock(&cc->buffer_mutex);
+
+        if (!cc->back) {
+            /* Allocate the buffers once the frame format is known */
+            CvSize size = cvGetSize(frame);
+            cc->back = cvCreateImage(size, frame->depth, frame->nChannels);
+            pthread_mutex_lock(&cc->buffer_mutex);
+            cc->ready = cvCreateImage(size, frame->depth, frame->nChannels);
+            cc->front = cvCreateImage(size, frame->depth, frame->nChannels);
+            pthread_mutex_unlock(&cc->buffer_mutex);
+        }
+        cvCopy(frame, cc->back, NULL);
+        pthread_mutex_unlock(&cc->capture_mutex);
+
+        /* Publish the complete frame, dropping a stale one if not consumed */
+        pthread_mutex_lock(&cc->buffer_mutex);
+        IplImage *tmp = cc->ready;
+        cc->ready = cc->back;
+        cc->back = tmp;
+        cc->ready_fresh = 1;
+        cc->ready_undistort_us = cc->capture_undistort_us;
+        cc->ready_timestamp_us = cc->capture_timestamp_us;
+        pthread_cond_signal(&cc->buffer_cond);
+        pthread_mutex_unlock(&cc->buffer_mutex);
+    }
+
+    /* Wake up a waiting consumer, so that it does not wait forever */
+    pthread_mutex_lock(&cc->buffer_mutex);
+    cc->capture_running = 0;
+    pthread_cond_broadcast(&cc->buffer_cond);
+    pthread_mutex_unlock(&cc->buffer_mutex);
+
+    return NULL;
+}
+#endif
+
 CameraControl *
 camera_control_new(int cameraID)
 {
@@ -63,55 +124,384 @@ camera_control_new(int cameraID)
 	cc->frame3ch = cvCreateImage(cvSize(w, h), IPL_DEPTH_8U, 3);
 
 	CLEyeCameraStart(cc->camera);
+	cc->width = w;
+	cc->height = h;
 #else
-	cc->capture = cvCaptureFromCAM(cc->cameraID);
-	cvSetCaptureProperty(cc->capture,
-                CV_CAP_PROP_FRAME_WIDTH, PSMOVE_TRACKER_POSITION_X_MAX);
-	cvSetCaptureProperty(cc->capture,
-                CV_CAP_PROP_FRAME_HEIGHT, PSMOVE_TRACKER_POSITION_Y_MAX);
+#if defined(CAMERA_CONTROL_USE_V4L2)
+	int width = CAMERA_CONTROL_V4L2_WIDTH;
+	int height = CAMERA_CONTROL_V4L2_HEIGHT;
+	int fps = CAMERA_CONTROL_V4L2_FPS;
+
+	char *mode_env = getenv(PSMOVE_TRACKER_CAMERA_MODE_ENV);
+	if (mode_env && sscanf(mode_env, "%dx%d@%d", &width, &height, &fps) != 3) {
+            fprintf(stderr, "Warning: Invalid %s, use e.g. \"320x240@187\".\n",
+                    PSMOVE_TRACKER_CAMERA_MODE_ENV);
+            width = CAMERA_CONTROL_V4L2_WIDTH;
+            height = CAMERA_CONTROL_V4L2_HEIGHT;
+            fps = CAMERA_CONTROL_V4L2_FPS;
+	}
+
+	if (camera_control_v4l2_open(cc, width, height, fps)) {
+            cc->width = width;
+            cc->height = height;
+	} else {
+            fprintf(stderr, "Warning: V4L2 capture failed, using OpenCV.\n");
+	}
+
+	if (!cc->v4l2_streaming)
+#endif
+	{
+            cc->capture = cvCaptureFromCAM(cc->cameraID);
+            cvSetCaptureProperty(cc->capture,
+                    CV_CAP_PROP_FRAME_WIDTH, PSMOVE_TRACKER_POSITION_X_MAX);
+            cvSetCaptureProperty(cc->capture,
+                    CV_CAP_PROP_FRAME_HEIGHT, PSMOVE_TRACKER_POSITION_Y_MAX);
+            cc->width = PSMOVE_TRACKER_POSITION_X_MAX;
+            cc->height = PSMOVE_TRACKER_POSITION_Y_MAX;
+	}
+#endif
+
+#if defined(PSMOVE_USE_PTHREADS)
+	pthread_mutex_init(&cc->capture_mutex, NULL);
+	pthread_mutex_init(&cc->buffer_mutex, NULL);
+	pthread_cond_init(&cc->buffer_cond, NULL);
+
+#if defined(CAMERA_CONTROL_USE_V4L2)
+	/* The driver's buffer queue already decouples capture from processing */
+	if (!cc->v4l2_streaming)
+#endif
+	{
+            cc->capture_running = 1;
+            if (pthread_create(&cc->capture_thread, NULL,
+                        camera_control_capture_proc, cc) != 0) {
+                fprintf(stderr, "Warning: Cannot start capture thread.\n");
+                cc->capture_running = 0;
+            }
+	}
 #endif
 
 	return cc;
 }
 
+CameraControl *
+camera_control_new_from_file(const char *filename)
+{
+    CvCapture *capture = cvCaptureFromFile(filename);
+    if (!capture) {
+        return NULL;
+    }
+
+    CameraControl* cc = (CameraControl*) calloc(1, sizeof(CameraControl));
+    cc->cameraID = -1;
+    cc->from_file = 1;
+    cc->capture = capture;
+    cc->width = (int)cvGetCaptureProperty(capture, CV_CAP_PROP_FRAME_WIDTH);
+    cc->height = (int)cvGetCaptureProperty(capture, CV_CAP_PROP_FRAME_HEIGHT);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    /* No capture thread: every frame is read on request, none are dropped */
+    pthread_mutex_init(&cc->capture_mutex, NULL);
+    pthread_mutex_init(&cc->buffer_mutex, NULL);
+    pthread_cond_init(&cc->buffer_cond, NULL);
+#endif
+
+    return cc;
+}
+
+int
+camera_control_is_file(CameraControl* cc)
+{
+    return cc->from_file;
+}
+
+int
+camera_control_start_recording(CameraControl* cc, const char *filename)
+{
+    camera_control_stop_recording(cc);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_lock(&cc->capture_mutex);
+#endif
+
+    /* The writer is created with the first frame, when its size is known */
+    cc->recording = strdup(filename);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_unlock(&cc->capture_mutex);
+#endif
+
+    return 1;
+}
+
+void
+camera_control_stop_recording(CameraControl* cc)
+{
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_lock(&cc->capture_mutex);
+#endif
+
+    if (cc->writer) {
+        cvReleaseVideoWriter(&cc->writer);
+    }
+    free(cc->recording);
+    cc->recording = NULL;
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_unlock(&cc->capture_mutex);
+#endif
+}
+
+/* Append a frame to the recording (see camera_control_start_recording) */
+static void
+camera_control_record_frame(CameraControl* cc, IplImage *frame)
+{
+    if (!cc->writer) {
+        /* FFV1 is lossless, so replays see exactly the captured pixels */
+        cc->writer = cvCreateVideoWriter(cc->recording,
+                CV_FOURCC('F', 'F', 'V', '1'), CAMERA_CONTROL_RECORDING_FPS,
+                cvGetSize(frame), 1);
+        if (!cc->writer) {
+            fprintf(stderr, "Warning: Cannot record to %s.\n", cc->recording);
+            free(cc->recording);
+            cc->recording = NULL;
+            return;
+        }
+    }
+
+    cvWriteFrame(cc->writer, frame);
+}
+
 void
 camera_control_read_calibration(CameraControl* cc,
-        char* intrinsicsFile, char* distortionFile)
+        char* intrinsicsFile, char* distortionFile, int undistortFrames)
 {
     CvMat *intrinsic = (CvMat*) cvLoad(intrinsicsFile, 0, 0, 0);
     CvMat *distortion = (CvMat*) cvLoad(distortionFile, 0, 0, 0);
 
+#if defined(PSMOVE_USE_PTHREADS)
+    /* Wait for the capture thread to finish the frame it's working on */
+    pthread_mutex_lock(&cc->capture_mutex);
+#endif
+
     if (cc->mapx) {
         cvReleaseImage(&cc->mapx);
     }
     if (cc->mapy) {
         cvReleaseImage(&cc->mapy);
     }
+    if (cc->intrinsic) {
+        cvReleaseMat(&cc->intrinsic);
+    }
+    if (cc->distortion) {
+        cvReleaseMat(&cc->distortion);
+    }
 
-    if (intrinsic && distortion) {
-        if (!cc->frame3chUndistort) {
-            cc->frame3chUndistort = cvCloneImage(
-                    camera_control_query_frame(cc));
-        }
-
-        cc->mapx = cvCreateImage(cvSize(PSMOVE_TRACKER_POSITION_X_MAX,
-                    PSMOVE_TRACKER_POSITION_Y_MAX), IPL_DEPTH_32F, 1);
-        cc->mapy = cvCreateImage(cvSize(PSMOVE_TRACKER_POSITION_X_MAX,
-                    PSMOVE_TRACKER_POSITION_Y_MAX), IPL_DEPTH_32F, 1);
+    if (intrinsic && distortion && !undistortFrames) {
+        /* Keep the raw frames, points are undistorted on request */
+        cc->intrinsic = intrinsic;
+        cc->distortion = distortion;
+    } else if (intrinsic && distortion) {
+        cc->mapx = cvCreateImage(cvSize(cc->width, cc->height),
+                IPL_DEPTH_32F, 1);
+        cc->mapy = cvCreateImage(cvSize(cc->width, cc->height),
+                IPL_DEPTH_32F, 1);
 
         cvInitUndistortMap(intrinsic, distortion, cc->mapx, cc->mapy);
 
-        // TODO: Shouldn't we free intrinsic and distortion here?
+        /* The camera matrix is still used for camera_control_get_intrinsics() */
+        cc->intrinsic = intrinsic;
+        cvReleaseMat(&distortion);
     } else {
         fprintf(stderr, "Warning: No lens calibration files found.\n");
+
+        if (intrinsic) {
+            cvReleaseMat(&intrinsic);
+        }
+        if (distortion) {
+            cvReleaseMat(&distortion);
+        }
     }
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_unlock(&cc->capture_mutex);
+#endif
+}
+
+int
+camera_control_undistort_point(CameraControl* cc, float *x, float *y)
+{
+    if (!cc->intrinsic || !cc->distortion) {
+        return 0;
+    }
+
+    /**
+     * The iteration of cvUndistortPoints (with the camera matrix as P, so
+     * the result is in pixels again), but without the temporary matrices
+     * that function allocates for every call on the tracking path.
+     **/
+    double k[8] = { 0, 0, 0, 0, 0, 0, 0, 0 };
+    int count = cc->distortion->rows * cc->distortion->cols;
+    int i;
+    for (i = 0; i < count && i < 8; i++) {
+        k[i] = cvGetReal1D(cc->distortion, i);
+    }
+
+    double fx = cvmGet(cc->intrinsic, 0, 0);
+    double fy = cvmGet(cc->intrinsic, 1, 1);
+    double cx = cvmGet(cc->intrinsic, 0, 2);
+    double cy = cvmGet(cc->intrinsic, 1, 2);
+
+    double x0 = (*x - cx) / fx;
+    double y0 = (*y - cy) / fy;
+    double ux = x0, uy = y0;
+    for (i = 0; i < 5; i++) {
+        double r2 = ux * ux + uy * uy;
+        double icdist = (1 + ((k[7] * r2 + k[6]) * r2 + k[5]) * r2) /
+            (1 + ((k[4] * r2 + k[1]) * r2 + k[0]) * r2);
+        double dx = 2 * k[2] * ux * uy + k[3] * (r2 + 2 * ux * ux);
+        double dy = k[2] * (r2 + 2 * uy * uy) + 2 * k[3] * ux * uy;
+        ux = (x0 - dx) * icdist;
+        uy = (y0 - dy) * icdist;
+    }
+
+    *x = ux * fx + cx;
+    *y = uy * fy + cy;
+    return 1;
+}
+
+int
+camera_control_get_intrinsics(CameraControl* cc,
+        float *fx, float *fy, float *cx, float *cy)
+{
+    if (!cc->intrinsic) {
+        return 0;
+    }
+
+    *fx = cvmGet(cc->intrinsic, 0, 0);
+    *fy = cvmGet(cc->intrinsic, 1, 1);
+    *cx = cvmGet(cc->intrinsic, 0, 2);
+    *cy = cvmGet(cc->intrinsic, 1, 2);
+
+    return 1;
 }
 
 IplImage *
 camera_control_query_frame(CameraControl* cc)
+{
+#if defined(PSMOVE_USE_PTHREADS)
+    if (cc->capture_running) {
+        IplImage *result = NULL;
+
+        /**
+         * Take the newest complete frame. Only if it has already been
+         * handed out, wait for the capture thread to deliver the next one.
+         **/
+        PSMOVE_TRACE_BEGIN("camera_wait");
+        pthread_mutex_lock(&cc->buffer_mutex);
+        while (!cc->ready_fresh && cc->capture_running) {
+            pthread_cond_wait(&cc->buffer_cond, &cc->buffer_mutex);
+        }
+        PSMOVE_TRACE_END("camera_wait");
+        if (cc->ready_fresh) {
+            IplImage *tmp = cc->front;
+            cc->front = cc->ready;
+            cc->ready = tmp;
+            cc->ready_fresh = 0;
+            cc->undistort_us = cc->ready_undistort_us;
+            cc->timestamp_us = cc->ready_timestamp_us;
+            result = cc->front;
+        }
+        pthread_mutex_unlock(&cc->buffer_mutex);
+
+        return result;
+    }
+#endif
+
+    PSMOVE_TRACE_BEGIN("camera_capture");
+    IplImage *result = camera_control_capture_frame(cc);
+    PSMOVE_TRACE_END("camera_capture");
+    cc->undistort_us = cc->capture_undistort_us;
+    cc->timestamp_us = cc->capture_timestamp_us;
+    return result;
+}
+
+int
+camera_control_get_undistort_us(CameraControl* cc)
+{
+    return cc->undistort_us;
+}
+
+long long
+camera_control_get_frame_timestamp(CameraControl* cc)
+{
+    return cc->timestamp_us;
+}
+
+IplImage *
+camera_control_get_yuyv_frame(CameraControl* cc)
+{
+#if defined(CAMERA_CONTROL_USE_V4L2)
+    /* Remapped frames don't match the raw data anymore */
+    if (cc->v4l2_streaming && cc->v4l2_held != -1 && !cc->mapx) {
+        return cc->v4l2_yuyv;
+    }
+#endif
+
+    return NULL;
+}
+
+static size_t
+camera_control_image_size(const IplImage *image)
+{
+    return image ? sizeof(IplImage) + image->imageSize : 0;
+}
+
+size_t
+camera_control_get_memory_usage(CameraControl* cc)
+{
+    size_t usage = sizeof(CameraControl);
+
+    usage += camera_control_image_size(cc->frame3chUndistort);
+    usage += camera_control_image_size(cc->mapx);
+    usage += camera_control_image_size(cc->mapy);
+#if defined(CAMERA_CONTROL_USE_CL_DRIVER)
+    usage += camera_control_image_size(cc->frame3ch);
+    usage += camera_control_image_size(cc->frame4ch);
+#endif
+#if defined(CAMERA_CONTROL_USE_V4L2)
+    usage += camera_control_image_size(cc->v4l2_frame3ch);
+#endif
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_lock(&cc->buffer_mutex);
+    usage += camera_control_image_size(cc->front);
+    usage += camera_control_image_size(cc->ready);
+    usage += camera_control_image_size(cc->back);
+    pthread_mutex_unlock(&cc->buffer_mutex);
+#endif
+
+    return usage;
+}
+
+int
+camera_control_set_thread_policy(CameraControl* cc, const PSMoveThreadPolicy *policy)
+{
+#if defined(PSMOVE_USE_PTHREADS)
+    if (cc->capture_running) {
+        return _psmove_thread_apply_policy(cc->capture_thread, policy);
+    }
+#endif
+
+    return 0;
+}
+
+static IplImage *
+camera_control_capture_frame(CameraControl* cc)
 {
     IplImage* result;
 
+    if (cc->from_file) {
+        result = cvQueryFrame(cc->capture);
+    } else {
 #if defined(CAMERA_CONTROL_USE_CL_DRIVER)
     // assign buffer-pointer to address of buffer
     cvGetRawData(cc->frame4ch, &cc->pCapBuffer, 0, 0);
@@ -126,54 +516,119 @@ camera_control_query_frame(CameraControl* cc)
 
     result = cc->frame3ch;
 #else
+#if defined(CAMERA_CONTROL_USE_V4L2)
+    if (cc->v4l2_streaming) {
+        result = camera_control_v4l2_grab(cc);
+    } else
+#endif
     result = cvQueryFrame(cc->capture);
 #endif
+    }
 
-#if defined(PSMOVE_USE_DEINTERLACE)
-    /**
-     * Dirty hack follows:
-     *  - Clone image
-     *  - Hack internal variables to make an image of all odd lines
-     **/
-    IplImage *tmp = cvCloneImage(result);
-    tmp->imageData += tmp->widthStep; // odd lines
-    tmp->widthStep *= 2;
-    tmp->height /= 2;
-
-    /**
-     * Use nearest-neighbor to be faster. In my tests, this does not
-     * cause a speed disadvantage, and tracking quality is still good.
-     *
-     * This will scale the half-height image "tmp" to the original frame
-     * size by doubling lines (so we can still do normal circle tracking).
-     **/
-    cvResize(tmp, result, CV_INTER_NN);
+    if (!result) {
+        return NULL;
+    }
 
     /**
-     * Need to revert changes in tmp from above, otherwise the call
-     * to cvReleaseImage would cause a crash.
+     * The drivers used via CLEye and OpenCV don't report when a frame was
+     * captured, so the time it arrived here is the best estimate.
      **/
-    tmp->height = result->height;
-    tmp->widthStep = result->widthStep;
-    tmp->imageData -= tmp->widthStep; // odd lines
-    cvReleaseImage(&tmp);
+    cc->capture_timestamp_us = psmove_util_get_ticks_us();
+#if defined(CAMERA_CONTROL_USE_V4L2)
+    if (cc->v4l2_streaming) {
+        cc->capture_timestamp_us = cc->v4l2_timestamp_us;
+    }
 #endif
 
+    if (cc->recording) {
+        camera_control_record_frame(cc, result);
+    }
+
     // undistort image
+    cc->capture_undistort_us = 0;
     if (cc->mapx && cc->mapy) {
+        long long started = psmove_util_get_ticks_us();
+
+        if (!cc->frame3chUndistort) {
+            cc->frame3chUndistort = cvCreateImage(cvGetSize(result),
+                    result->depth, result->nChannels);
+        }
         cvRemap(result, cc->frame3chUndistort,
                 cc->mapx, cc->mapy,
                 CV_INTER_LINEAR | CV_WARP_FILL_OUTLIERS,
                 cvScalarAll(0));
         result = cc->frame3chUndistort;
+        cc->capture_undistort_us = (int)(psmove_util_get_ticks_us() - started);
     }
 
+#if defined(PSMOVE_USE_DEINTERLACE)
+    /**
+     * Return a view of the odd lines (one field) of the frame: The header
+     * shares the frame's data with a doubled line stride and half height,
+     * so there is no copy and no upscaling. Y coordinates in this view are
+     * scaled by CAMERA_CONTROL_FIELD_SCALE compared to the full frame.
+     **/
+    if (!cc->field) {
+        cc->field = cvCreateImageHeader(cvSize(result->width,
+                    result->height / 2), result->depth, result->nChannels);
+    }
+    cvSetData(cc->field, result->imageData + result->widthStep,
+            result->widthStep * 2);
+    result = cc->field;
+
+#if defined(CAMERA_CONTROL_USE_V4L2)
+    /* The same view of the raw frame (see camera_control_get_yuyv_frame) */
+    if (cc->v4l2_streaming) {
+        if (!cc->v4l2_field) {
+            cc->v4l2_field = cvCreateImageHeader(cvSize(cc->v4l2_frame->width,
+                        cc->v4l2_frame->height / 2), IPL_DEPTH_8U, 2);
+        }
+        cvSetData(cc->v4l2_field, cc->v4l2_frame->imageData +
+                cc->v4l2_frame->widthStep, cc->v4l2_frame->widthStep * 2);
+        cc->v4l2_yuyv = cc->v4l2_field;
+    }
+#endif
+#endif
+
     return result;
 }
 
 void
 camera_control_delete(CameraControl* cc)
 {
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_lock(&cc->buffer_mutex);
+    int running = cc->capture_running;
+    cc->capture_quit = 1;
+    pthread_mutex_unlock(&cc->buffer_mutex);
+
+    if (running) {
+        /* The thread leaves after the frame it's currently grabbing */
+        pthread_join(cc->capture_thread, NULL);
+    }
+
+    camera_control_stop_recording(cc);
+
+    if (cc->front) {
+        cvReleaseImage(&cc->front);
+    }
+    if (cc->ready) {
+        cvReleaseImage(&cc->ready);
+    }
+    if (cc->back) {
+        cvReleaseImage(&cc->back);
+    }
+
+    pthread_cond_destroy(&cc->buffer_cond);
+    pthread_mutex_destroy(&cc->buffer_mutex);
+    pthread_mutex_destroy(&cc->capture_mutex);
+#else
+    camera_control_stop_recording(cc);
+#endif
+
+    if (cc->from_file) {
+        cvReleaseCapture(&cc->capture);
+    } else {
 #if defined(CAMERA_CONTROL_USE_CL_DRIVER)
     if (cc->frame3ch != 0x0)
         cvReleaseImage(&cc->frame3ch);
@@ -183,14 +638,27 @@ camera_control_delete(CameraControl* cc)
 
     CLEyeDestroyCamera(cc->camera);
 #else
+#if defined(CAMERA_CONTROL_USE_V4L2)
+    if (cc->v4l2_streaming) {
+        camera_control_v4l2_close(cc);
+    }
+#endif
+
     // linux, others and windows opencv only
-    cvReleaseCapture(&cc->capture);
+    if (cc->capture) {
+        cvReleaseCapture(&cc->capture);
+    }
 #endif
+    }
 
     if (cc->frame3chUndistort) {
         cvReleaseImage(&cc->frame3chUndistort);
     }
 
+    if (cc->field) {
+        cvReleaseImageHeader(&cc->field);
+    }
+
     if (cc->mapx) {
         cvReleaseImage(&cc->mapx);
     }
@@ -199,6 +667,14 @@ camera_control_delete(CameraControl* cc)
         cvReleaseImage(&cc->mapy);
     }
 
+    if (cc->intrinsic) {
+        cvReleaseMat(&cc->intrinsic);
+    }
+
+    if (cc->distortion) {
+        cvReleaseMat(&cc->distortion);
+    }
+
     free(cc);
 }
 
@@ -35,19 +35,154 @@ extern "C" {
 
 #include "opencv2/core/core_c.h"
 
+#include "psmove.h"
+#include "psmove_config.h"
+
+/**
+ * With PSMOVE_USE_DEINTERLACE, camera_control_query_frame() returns only
+ * one field (every other line) of each frame. Multiply Y coordinates (and
+ * areas) in the returned image by this to get full frame coordinates.
+ **/
+#if defined(PSMOVE_USE_DEINTERLACE)
+#    define CAMERA_CONTROL_FIELD_SCALE 2
+#else
+#    define CAMERA_CONTROL_FIELD_SCALE 1
+#endif
+
 struct _CameraControl;
 typedef struct _CameraControl CameraControl;
 
 CameraControl *
 camera_control_new(int cameraID);
 
+/**
+ * Open a recorded video (see camera_control_start_recording) or an image
+ * sequence (e.g. "frame%04d.png") instead of a live camera
+ *
+ * Every frame of the file is returned by camera_control_query_frame() in
+ * order (none are dropped, and there is no waiting), so the tracker runs
+ * deterministically and as fast as it can. After the last frame,
+ * camera_control_query_frame() returns NULL. Camera settings are ignored.
+ *
+ * filename - the file to open (anything cvCaptureFromFile() supports)
+ *
+ * Returns: the new camera control, or NULL if the file could not be opened
+ **/
+CameraControl *
+camera_control_new_from_file(const char *filename);
+
+/**
+ * Record all captured frames (before undistortion and deinterlacing) into
+ * a losslessly compressed video file, which can be played back using
+ * camera_control_new_from_file(). A running recording is stopped first.
+ *
+ * cc       - the camera control to record
+ * filename - the video file to create
+ *
+ * Returns: nonzero if the recording has been started
+ **/
+int
+camera_control_start_recording(CameraControl* cc, const char *filename);
+
+/**
+ * Stop recording frames (see camera_control_start_recording)
+ **/
+void
+camera_control_stop_recording(CameraControl* cc);
+
+/**
+ * Returns nonzero if the frames are read from a file
+ * (see camera_control_new_from_file)
+ **/
+int
+camera_control_is_file(CameraControl* cc);
+
+/**
+ * Load the lens calibration of the camera
+ *
+ * cc              - the camera control to modify
+ * intrinsicsFile  - camera matrix written by the calibration tool
+ * distortionFile  - distortion coefficients written by the calibration tool
+ * undistortFrames - nonzero to remap every captured frame, zero to keep the
+ *                   raw frames and only use camera_control_undistort_point()
+ **/
 void
 camera_control_read_calibration(CameraControl* cc,
-        char* intrinsicsFile, char* distortionFile);
+        char* intrinsicsFile, char* distortionFile, int undistortFrames);
+
+/**
+ * Apply the lens model to a point in a raw (distorted) frame
+ *
+ * cc - the camera control with a lens calibration
+ * x  - (in/out) the X coordinate in pixels
+ * y  - (in/out) the Y coordinate in pixels
+ *
+ * Returns: nonzero if a calibration is loaded and the point was changed
+ **/
+int
+camera_control_undistort_point(CameraControl* cc, float *x, float *y);
+
+/**
+ * Get the camera matrix of the lens calibration
+ *
+ * cc - the camera control with a lens calibration
+ * fx - (out) the focal length in X direction (in pixels)
+ * fy - (out) the focal length in Y direction (in pixels)
+ * cx - (out) the X coordinate of the principal point (in pixels)
+ * cy - (out) the Y coordinate of the principal point (in pixels)
+ *
+ * Returns: nonzero if a calibration is loaded, zero otherwise
+ **/
+int
+camera_control_get_intrinsics(CameraControl* cc,
+        float *fx, float *fy, float *cx, float *cy);
 
 IplImage *
 camera_control_query_frame(CameraControl* cc);
 
+/**
+ * Get the time (in microseconds) spent on remapping the frame last returned
+ * by camera_control_query_frame(), zero if whole frames are not undistorted
+ **/
+int
+camera_control_get_undistort_us(CameraControl* cc);
+
+/**
+ * Get the raw YUYV data of the frame last returned by
+ * camera_control_query_frame() (8-bit, 2 channels: Y and alternating U/V),
+ * with the same size and view (PSMOVE_USE_DEINTERLACE) as the BGR frame.
+ *
+ * Returns: the YUYV frame, or NULL if the capture backend does not provide
+ *          one (only the V4L2 backend does) or every frame is remapped
+ **/
+IplImage *
+camera_control_get_yuyv_frame(CameraControl* cc);
+
+/**
+ * Get the capture time of the frame last returned by
+ * camera_control_query_frame(), in the time base of psmove_util_get_ticks_us().
+ * With the V4L2 backend, this is the driver's timestamp of the frame,
+ * otherwise the time the frame has been received from the driver.
+ **/
+long long
+camera_control_get_frame_timestamp(CameraControl* cc);
+
+/**
+ * Memory of the frame buffers and undistortion maps (in bytes), see
+ * psmove_tracker_get_memory_usage(). The mmap'd V4L2 buffers belong to
+ * the driver and are not included.
+ **/
+size_t
+camera_control_get_memory_usage(CameraControl* cc);
+
+/**
+ * Apply a scheduling policy to the capture thread, see
+ * psmove_tracker_set_thread_policy(). Returns zero if there is no capture
+ * thread (the V4L2 backend captures without one) or on error.
+ **/
+int
+camera_control_set_thread_policy(CameraControl* cc, const PSMoveThreadPolicy *policy);
+
 void
 camera_control_delete(CameraControl* cc);
 
@@ -34,6 +34,17 @@
 #include "opencv2/highgui/highgui_c.h"
 #include "opencv2/imgproc/imgproc_c.h"
 
+#include "../psmove_private.h"
+#include "psmove_config.h"
+
+#if defined(PSMOVE_USE_V4L2_CAPTURE) && defined(__linux)
+#    define CAMERA_CONTROL_USE_V4L2
+#endif
+
+#if defined(PSMOVE_USE_PTHREADS)
+#    include <pthread.h>
+#endif
+
 #if defined(WIN32)
 #    include <windows.h>
 #endif
@@ -44,10 +55,20 @@
 #    define CL_DRIVER_REG_PATH "Software\\PS3EyeCamera\\Settings"
 #endif
 
+#define CAMERA_CONTROL_RECORDING_FPS 60 // nominal frame rate written to recordings (replays ignore it)
+
+#if defined(CAMERA_CONTROL_USE_V4L2)
+#    define CAMERA_CONTROL_V4L2_BUFFERS 4 // number of mmap'd streaming buffers
+#    define CAMERA_CONTROL_V4L2_WIDTH 640 // default capture mode (see PSMOVE_TRACKER_CAMERA_MODE_ENV)
+#    define CAMERA_CONTROL_V4L2_HEIGHT 480
+#    define CAMERA_CONTROL_V4L2_FPS 75
+#endif
+
 
 struct _CameraControl {
 	int cameraID;
 	IplImage* frame3chUndistort;
+	IplImage* field; // header for the field view of a frame (PSMOVE_USE_DEINTERLACE)
 
 #if defined(CAMERA_CONTROL_USE_CL_DRIVER)
 	CLEyeCameraInstance camera;
@@ -56,10 +77,78 @@ struct _CameraControl {
 	PBYTE pCapBuffer;
 #endif
 
+#if defined(CAMERA_CONTROL_USE_V4L2)
+	int v4l2_streaming; // nonzero if frames are captured via V4L2 (instead of OpenCV)
+	int v4l2_fd;
+	void* v4l2_start[CAMERA_CONTROL_V4L2_BUFFERS]; // mmap'd streaming buffers
+	size_t v4l2_length[CAMERA_CONTROL_V4L2_BUFFERS];
+	int v4l2_buffers; // number of buffers granted by the driver
+	int v4l2_held; // index of the buffer of the current frame, -1 if none
+	IplImage* v4l2_frame; // header pointing into the held buffer (YUYV)
+	IplImage* v4l2_frame3ch; // the current frame converted to BGR
+	IplImage* v4l2_field; // header for the field view of v4l2_frame (PSMOVE_USE_DEINTERLACE)
+	IplImage* v4l2_yuyv; // the current frame as returned by camera_control_get_yuyv_frame()
+	long long v4l2_timestamp_us; // the driver's capture time of the current frame (see psmove_util_get_ticks_us)
+#endif
+
 	CvCapture* capture;
+	int width, height; // size of the captured frames
+	int from_file; // nonzero if frames are read from a recording (see camera_control_new_from_file)
+
+	CvVideoWriter* writer; // records the captured frames (see camera_control_start_recording)
+	char* recording; // the file name of the recording, NULL if not recording
 
 	IplImage* mapx;
 	IplImage* mapy;
+
+	CvMat* intrinsic; // lens calibration, for undistorting points
+	CvMat* distortion;
+
+	int capture_undistort_us; // remap time of the most recently captured frame
+	int undistort_us; // remap time of the frame returned by camera_control_query_frame()
+	long long capture_timestamp_us; // capture time of the most recently captured frame
+	long long timestamp_us; // capture time of the frame returned by camera_control_query_frame()
+
+#if defined(PSMOVE_USE_PTHREADS)
+	/**
+	 * Triple buffer filled by the capture thread: The thread writes into
+	 * "back", then swaps it with "ready". camera_control_query_frame()
+	 * swaps "ready" with "front" and hands out "front", which stays
+	 * untouched until the next query.
+	 **/
+	pthread_t capture_thread;
+	int capture_running;
+	int capture_quit;
+	pthread_mutex_t capture_mutex; // held while grabbing (protects capture, mapx, mapy and frame3chUndistort)
+	pthread_mutex_t buffer_mutex; // protects the buffers and the fields below
+	pthread_cond_t buffer_cond; // signalled when a new frame is ready (or the thread quits)
+	IplImage* front;
+	IplImage* ready;
+	IplImage* back;
+	int ready_fresh; // "ready" holds a frame that has not been handed out yet
+	int ready_undistort_us; // remap time of the frame in "ready"
+	long long ready_timestamp_us; // capture time of the frame in "ready"
+#endif
 };
 
+#if defined(CAMERA_CONTROL_USE_V4L2)
+/**
+ * Start V4L2 mmap streaming of YUYV frames in the given mode
+ *
+ * Returns: nonzero on success, zero if the mode is not supported
+ **/
+int
+camera_control_v4l2_open(CameraControl* cc, int width, int height, int fps);
+
+/**
+ * Get the newest frame, dropping older ones waiting in the queue. The
+ * returned image stays valid until the next call.
+ **/
+IplImage*
+camera_control_v4l2_grab(CameraControl* cc);
+
+void
+camera_control_v4l2_close(CameraControl* cc);
+#endif
+
 #endif
@@ -36,6 +36,14 @@
 #include <libv4l2.h>
 #include <fcntl.h>
 
+#if defined(CAMERA_CONTROL_USE_V4L2)
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/select.h>
+#include <time.h>
+#endif
+
 
 int open_v4l2_device(int id)
 {
@@ -134,3 +142,202 @@ void camera_control_set_parameters(CameraControl* cc, int autoE, int autoG, int
 	}
 }
 
+#if defined(CAMERA_CONTROL_USE_V4L2)
+
+static int v4l2_xioctl(int fd, unsigned long request, void *arg) {
+	int result;
+	do {
+		result = v4l2_ioctl(fd, request, arg);
+	} while (result == -1 && errno == EINTR);
+	return result;
+}
+
+static int v4l2_queue_buffer(CameraControl* cc, int index) {
+	struct v4l2_buffer buf;
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = index;
+	return v4l2_xioctl(cc->v4l2_fd, VIDIOC_QBUF, &buf) != -1;
+}
+
+int camera_control_v4l2_open(CameraControl* cc, int width, int height, int fps) {
+	struct v4l2_format fmt;
+	struct v4l2_streamparm parm;
+	struct v4l2_requestbuffers req;
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	int i;
+
+	cc->v4l2_held = -1;
+	cc->v4l2_fd = open_v4l2_device(cc->cameraID);
+	if (cc->v4l2_fd == -1) {
+		return 0;
+	}
+
+	// YUYV is the native format of the PS Eye, so the driver does not convert
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt.fmt.pix.width = width;
+	fmt.fmt.pix.height = height;
+	fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+	fmt.fmt.pix.field = V4L2_FIELD_NONE;
+	if (v4l2_xioctl(cc->v4l2_fd, VIDIOC_S_FMT, &fmt) == -1 ||
+			fmt.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV ||
+			fmt.fmt.pix.width != width || fmt.fmt.pix.height != height ||
+			fmt.fmt.pix.bytesperline != width * 2) {
+		fprintf(stderr, "Warning: Camera does not support YUYV %dx%d.\n", width, height);
+		camera_control_v4l2_close(cc);
+		return 0;
+	}
+
+	memset(&parm, 0, sizeof(parm));
+	parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	parm.parm.capture.timeperframe.numerator = 1;
+	parm.parm.capture.timeperframe.denominator = fps;
+	if (v4l2_xioctl(cc->v4l2_fd, VIDIOC_S_PARM, &parm) == -1 ||
+			parm.parm.capture.timeperframe.denominator != fps) {
+		fprintf(stderr, "Warning: Camera does not support %d fps at %dx%d.\n", fps, width, height);
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.count = CAMERA_CONTROL_V4L2_BUFFERS;
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = V4L2_MEMORY_MMAP;
+	if (v4l2_xioctl(cc->v4l2_fd, VIDIOC_REQBUFS, &req) == -1 || req.count < 2) {
+		camera_control_v4l2_close(cc);
+		return 0;
+	}
+
+	for (i = 0; i < req.count && i < CAMERA_CONTROL_V4L2_BUFFERS; i++) {
+		struct v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		if (v4l2_xioctl(cc->v4l2_fd, VIDIOC_QUERYBUF, &buf) == -1) {
+			break;
+		}
+
+		cc->v4l2_start[i] = v4l2_mmap(NULL, buf.length, PROT_READ | PROT_WRITE,
+				MAP_SHARED, cc->v4l2_fd, buf.m.offset);
+		if (cc->v4l2_start[i] == MAP_FAILED) {
+			break;
+		}
+		cc->v4l2_length[i] = buf.length;
+		cc->v4l2_buffers++;
+
+		if (!v4l2_queue_buffer(cc, i)) {
+			break;
+		}
+	}
+
+	if (cc->v4l2_buffers < req.count ||
+			v4l2_xioctl(cc->v4l2_fd, VIDIOC_STREAMON, &type) == -1) {
+		camera_control_v4l2_close(cc);
+		return 0;
+	}
+
+	cc->v4l2_frame = cvCreateImageHeader(cvSize(width, height), IPL_DEPTH_8U, 2);
+	cc->v4l2_frame3ch = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 3);
+	cc->v4l2_streaming = 1;
+
+	return 1;
+}
+
+IplImage* camera_control_v4l2_grab(CameraControl* cc) {
+	struct v4l2_buffer buf;
+	struct timeval timeout;
+	struct timeval stamp;
+	fd_set fds;
+	int found = 0;
+	int monotonic = 0;
+
+	// the buffer of the previous frame is no longer in use
+	if (cc->v4l2_held != -1) {
+		v4l2_queue_buffer(cc, cc->v4l2_held);
+		cc->v4l2_held = -1;
+	}
+
+	// wait for a frame, then take all frames that are ready and keep the newest
+	timeout.tv_sec = 2;
+	timeout.tv_usec = 0;
+	while (1) {
+		FD_ZERO(&fds);
+		FD_SET(cc->v4l2_fd, &fds);
+		if (select(cc->v4l2_fd + 1, &fds, NULL, NULL, &timeout) <= 0) {
+			break;
+		}
+
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		if (v4l2_xioctl(cc->v4l2_fd, VIDIOC_DQBUF, &buf) == -1) {
+			break;
+		}
+
+		if (cc->v4l2_held != -1) {
+			v4l2_queue_buffer(cc, cc->v4l2_held);
+		}
+		cc->v4l2_held = buf.index;
+		stamp = buf.timestamp;
+		monotonic = (buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC;
+		found = 1;
+
+		// don't wait for further frames
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 0;
+	}
+
+	if (!found) {
+		return NULL;
+	}
+
+	// the driver's timestamp is taken from CLOCK_MONOTONIC, translate its age to our time base
+	cc->v4l2_timestamp_us = psmove_util_get_ticks_us();
+	if (monotonic) {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long long age = (now.tv_sec - stamp.tv_sec) * 1000000LL + now.tv_nsec / 1000 - stamp.tv_usec;
+		if (age > 0) {
+			cc->v4l2_timestamp_us -= age;
+		}
+	}
+
+	// the header points straight into the mmap'd buffer, nothing is copied
+	cvSetData(cc->v4l2_frame, cc->v4l2_start[cc->v4l2_held], cc->v4l2_frame->width * 2);
+	cvCvtColor(cc->v4l2_frame, cc->v4l2_frame3ch, CV_YUV2BGR_YUYV);
+	cc->v4l2_yuyv = cc->v4l2_frame;
+	return cc->v4l2_frame3ch;
+}
+
+void camera_control_v4l2_close(CameraControl* cc) {
+	enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	int i;
+
+	if (cc->v4l2_streaming) {
+		v4l2_xioctl(cc->v4l2_fd, VIDIOC_STREAMOFF, &type);
+	}
+
+	for (i = 0; i < cc->v4l2_buffers; i++) {
+		v4l2_munmap(cc->v4l2_start[i], cc->v4l2_length[i]);
+	}
+	cc->v4l2_buffers = 0;
+
+	if (cc->v4l2_frame) {
+		cvReleaseImageHeader(&cc->v4l2_frame);
+	}
+	if (cc->v4l2_frame3ch) {
+		cvReleaseImage(&cc->v4l2_frame3ch);
+	}
+	if (cc->v4l2_field) {
+		cvReleaseImageHeader(&cc->v4l2_field);
+	}
+	cc->v4l2_yuyv = NULL;
+
+	v4l2_close(cc->v4l2_fd);
+	cc->v4l2_fd = -1;
+	cc->v4l2_held = -1;
+	cc->v4l2_streaming = 0;
+}
+
+#endif
@@ -29,6 +29,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <time.h>
 
@@ -43,18 +44,27 @@
 #include "tracked_controller.h"
 #include "tracked_color.h"
 #include "tracker_trace.h"
+#include "tracker_opencl.h"
 
 #ifdef __linux
 #  include "platform/psmove_linuxsupport.h"
 #endif
 
+#if defined(PSMOVE_USE_PTHREADS)
+#  include <pthread.h>
+#endif
+
 #define DIMMING_FACTOR 1  			// LED color dimming for use in high exposure settings
-#define PRINT_DEBUG_STATS			// shall graphical statistics be printed to the image
 //#define DEBUG_WINDOWS 			// shall additional windows be shown
 #define GOOD_EXPOSURE 2051			// a very low exposure that was found to be good for tracking
-#define ROIS 4                   	// the number of levels of regions of interest (roi)
+#define ROI_MIN_SIZE 32				// the smallest width/height of a region of interest (roi), in pixels
+#define ROI_BLOB_FACTOR 3			// the roi is this many times as big as the blob found in the last frame
+#define ROI_GROWTH 1.5				// the factor the roi grows by when the sphere was not found in it
 #define BLINKS 4                 	// number of diff images to create during calibration
 #define BLINK_DELAY 50             	// number of milliseconds to wait between a blink
+#define CALIB_MAX_CANDIDATES 16		// maximum number of blobs considered when calibrating multiple controllers at once
+#define CALIB_CACHE_QUALITY 0.83	// minimum ratio of blob pixels vs. circle pixels to accept a cached calibration
+#define CALIB_CACHE_RADIUS_RANGE 2	// maximum factor between the found radius and the cached typical radius
 #define CALIB_MIN_SIZE 50		 	// minimum size of the estimated glowing sphere during calibration process (in pixel)
 #define CALIB_SIZE_STD 10	     	// maximum standard deviation (in %) of the glowing spheres found during calibration process
 #define CALIB_MAX_DIST 30		 	// maximum displacement of the separate found blobs
@@ -62,9 +72,10 @@
 #define COLOR_FILTER_RANGE_S 85		// +- s-Range of the hsv-colorfilter
 #define COLOR_FILTER_RANGE_V 85		// +- v-Range of the hsv-colorfilter
 #define CAMERA_FOCAL_LENGTH 28.3	// focal lenght constant of the ps-eye camera in (degrees)
-#define CAMERA_PIXEL_HEIGHT 5		// pixel height constant of the ps-eye camera in (m)
+#define CAMERA_PIXEL_HEIGHT 5		// pixel height constant of the ps-eye camera in (ÃÂµm)
 #define PS_MOVE_DIAMETER 47			// orb diameter constant of the ps-move controller in (mm)
 /* Thresholds */
+#define TRACKER_BUDGET_OPTIONAL 50	// optional work is only started in this part of the time budget (in percent, see "psmove_tracker_set_time_budget")
 #define ROI_ADJUST_FPS_T 160		// the minimum fps to be reached, if a better roi-center adjusment is to be perfomred
 #define CALIBRATION_DIFF_T 20		// during calibration, all grey values in the diff image below this value are set to black
 // if tracker thresholds not met, sphere is deemed not to be found
@@ -73,12 +84,30 @@
 #define TRACKER_QUALITY_T3 4		// minimum radius
 #define TRACKER_ADAPTIVE_XY 1		// specifies to use a adaptive x/y smoothing
 #define TRACKER_ADAPTIVE_Z 1		// specifies to use a adaptive z smoothing
+#define TRACKER_COLOR_LUT 0			// specifies to segment using a quantized color lookup table (32x32x32) instead of the exact HSV color filter
+#define TRACKER_YUYV_FILTER 1		// specifies to segment on the raw YUYV data (with a YUV lookup table) if the capture backend provides it
+#define TRACKER_OPENCL 1			// specifies to segment on the GPU (with the color lookup table) if built with OpenCL and a GPU is available
+#define TRACKER_UNDISTORT_POINTS 1	// specifies to track on the raw frame and only undistort the resulting positions (instead of remapping every frame)
+#define TRACKER_PREDICT_ROI 1		// specifies to place and size the next ROI using the image velocity and the controller's IMU
+#define TRACKER_PREDICT_LEVER 150	// assumed distance between the center of rotation (wrist) and the sphere (in mm)
+#define TRACKER_VARIANTS 1			// specifies to use a precompiled copy of the tracking loop for common configurations (see "psmove_tracker_select_variant")
+#define TRACKER_PYRAMID_REACQUIRE 1	// specifies to search a lost sphere in the whole (4x downsampled) frame instead of cycling through the quadrants
+#define REACQUIRE_SCALE 4			// downsampling factor of the frame used for reacquisition
 #define COLOR_ADAPTION_QUALITY 35 	// maximal distance (calculated by 'psmove_tracker_hsvcolor_diff') between the first estimated color and the newly estimated
 #define COLOR_UPDATE_RATE 1	 	 	// every x seconds adapt to the color, 0 means no adaption
+#define COLOR_BACKGROUND_ADAPTION 1	// specifies to rebuild the lookup tables for an adapted color in a low-priority thread (the old ones are used until then)
+#define COLOR_ADAPTION_QUEUE 8		// maximum number of controllers waiting for new lookup tables (others rebuild them inline)
 // if color thresholds not met, color is not adapted
 #define COLOR_UPDATE_QUALITY_T1 0.8	// minimum ratio of number of pixels in blob vs pixel of estimated circle.
 #define COLOR_UPDATE_QUALITY_T2 0.2	// maximum allowed change of the radius in percent, compared to the last estimated radius
 #define COLOR_UPDATE_QUALITY_T3 6	// minimum radius
+#define AUTO_EXPOSURE_MIN 1024		// shortest exposure the automatic exposure control uses
+#define AUTO_EXPOSURE_MAX 8192		// longest exposure the automatic exposure control uses (longer ones blur a moving sphere)
+#define AUTO_EXPOSURE_GAIN_MAX 0x4000	// highest gain the automatic exposure control uses (only once the exposure is at its maximum)
+#define AUTO_EXPOSURE_STEP 1.15		// factor by which exposure or gain are changed per adjustment
+#define AUTO_EXPOSURE_INTERVAL 1000000	// minimum time between two adjustments (in us), so the color adaption can follow
+#define AUTO_EXPOSURE_CONTRAST_T 60	// minimum difference between the luminance of the sphere and its surroundings (0-255)
+#define AUTO_EXPOSURE_CLIP_T 245	// a sphere color channel above this is regarded as saturated (its hue gets lost)
 #ifdef WIN32
 #define PSEYE_BACKUP_FILE "PSEye_backup_win.ini"
 #else
@@ -88,27 +117,78 @@
 #define INTRINSICS_XML "intrinsics.xml"
 #define DISTORTION_XML "distortion.xml"
 
+#define TRACKER_MAX_WORKERS 3		// maximum number of worker threads (in addition to the caller) for tracking controllers in parallel
+
+#define RECORDING_CAMERA -1			// the camera index of calibration records stored with a recording (see "psmove_tracker_start_recording")
+#define RECORDING_CALIBRATION ".ini"	// appended to the file name of a recording to get the file name of its calibration records
+
+// the position of a controller in a frame handed out to the application
+typedef struct {
+	PSMove* move;
+	float x, y, radius;
+	int tracked;
+} TrackerFramePosition;
+
+struct _PSMoveTrackerFrame {
+	IplImage header; // the image handed out (refers to the camera buffer, or to "copy" once detached)
+	IplImage* copy; // copy of the image, only made if it is still acquired when the next frame arrives
+	long long timestamp_us; // the capture time of the frame
+	int refs; // number of acquisitions that have not been released yet
+	TrackerFramePosition* positions; // the positions of the controllers in this frame
+	int position_count; // number of entries in "positions"
+	int position_capacity; // allocated entries of "positions"
+	struct _PSMoveTrackerFrame* next; // next unused frame (see "free_frames")
+};
+
+// tracking loop for a single controller, selected by "psmove_tracker_select_variant"
+typedef int (*PSMoveTrackerUpdateFunc)(PSMoveTracker* tracker, TrackedController* tc);
+
 struct _PSMoveTracker {
 	CameraControl* cc;
+	int camera; // the index of the camera (identifies cached calibrations)
+	char* replay_calibration; // the calibration records of the recording played back, NULL for a live camera
 	IplImage* frame; // the current frame of the camera
+	IplImage* frame_yuyv; // the raw YUYV data of the current frame, NULL if not available
+	th_opencl* opencl; // the GPU used for segmentation, NULL if not available (see "tracker_opencl")
+	int frame_uploaded; // 1 if the current frame has been uploaded to the GPU
+	long long frame_timestamp_us; // the capture time of the current frame (see psmove_util_get_ticks_us)
+	IplImage* annotated; // copy of the current frame with the tracking statistics (see "psmove_tracker_get_annotated_image")
+	PSMoveTrackerFrame* current_frame; // the handle of the current frame, if it has been handed out (see "psmove_tracker_acquire_frame")
+	PSMoveTrackerFrame* free_frames; // released handles, for reuse
+	PSMoveTrackerFrameCallback frame_callback; // called at the end of "psmove_tracker_update", or NULL
+	void* frame_callback_data; // passed to frame_callback
 	int exposure; // the exposure to use
-	IplImage* roiI[ROIS]; // array of images for each level of roi (colored)
-	IplImage* roiM[ROIS]; // array of images for each level of roi (greyscale)
+	int gain; // the gain currently used
+	int auto_exposure; // should exposure and gain follow the lighting (see "psmove_tracker_auto_exposure")
+	int auto_exposure_value; // the exposure currently set by the automatic exposure control
+	long long auto_exposure_us; // the time of the last automatic adjustment
+	CvSize roi_max; // the size of the biggest roi (a quarter of the frame)
+#ifdef DEBUG_WINDOWS
+	IplImage* roiI; // scratch image of the biggest roi size (colored, only used as HSV image)
+#endif
 	IplConvKernel* kCalib; // kernel used for morphological operations during calibration
 	CvScalar rHSV; // the range of the color filter
 	TrackedController* controllers; // a pointer to a linked list of connected controllers
 	PSMoveTrackingColor* available_colors; // a pointer to a linked list of available tracking colors
 	CvMemStorage* storage; // use to store the result of cvFindContour and cvHughCircles
-        long duration; // duration of tracking operation, in ms
+        long long duration; // duration of tracking operation, in us
+	PSMoveTrackerMetrics metrics; // timing of the most recent frame (see "psmove_tracker_get_metrics")
 
 	// internal variables
 	float cam_focal_length; // in (mm)
-	float cam_pixel_height; // in (m)
+	float cam_pixel_height; // in (ÃÂµm)
 	float ps_move_diameter; // in (mm)
 	float user_factor_dist; // user defined factor used in distance calulation
 
 	int tracker_adaptive_xy; // should adaptive x/y-smoothing be used
 	int tracker_adaptive_z; // should adaptive z-smoothing be used
+	int tracker_color_lut; // should the color lookup table be used for segmentation
+	int tracker_yuyv_filter; // should the raw YUYV data be used for segmentation (if available)
+	int tracker_opencl; // should the segmentation run on the GPU (if available)
+	int tracker_undistort_points; // should only the positions be undistorted (instead of the whole frame)
+	int tracker_predict_roi; // should the next ROI be predicted from image velocity and IMU
+	int tracker_pyramid_reacquire; // should a lost sphere be searched in the downsampled frame (instead of the quadrants)
+	PSMoveTrackerUpdateFunc update_controller; // the tracking loop specialized for the options above
 
 	int calibration_t; // the threshold used during calibration to create the diff image
 
@@ -124,16 +204,57 @@ struct _PSMoveTracker {
 	float color_t2; // quality threshold3 for the color adaption
 	float color_t3; // quality threshold3 for the color adaption
 	float color_update_rate; // how often shall the color be adapted (in seconds), 0 means never
+	int color_background_adaption; // should the lookup tables for an adapted color be built in the background
 
 	// internal variables (debug)
 	float debug_fps; // the current FPS achieved by "psmove_tracker_update"
 
+	// time budget (see "psmove_tracker_set_time_budget")
+	int time_budget_us; // the budget of a "psmove_tracker_update" call, 0 if there is none
+	long long update_started_us; // when the current "psmove_tracker_update" call started
+	float budget_load; // smoothed duration of "psmove_tracker_update" relative to the budget
+
+#if defined(PSMOVE_USE_PTHREADS)
+	// worker pool for tracking multiple controllers in parallel (see "psmove_tracker_update")
+	pthread_t workers[TRACKER_MAX_WORKERS];
+	int worker_count; // number of running worker threads
+	int workers_quit; // set to make the worker threads exit
+	pthread_mutex_t work_mutex; // protects all work_* fields
+	pthread_cond_t work_cond; // signalled when new work is available (or workers_quit is set)
+	pthread_cond_t done_cond; // signalled when the last controller of this frame is done
+	TrackedController* work_next; // next controller of this frame that has not been claimed yet
+	int work_pending; // number of controllers of this frame that are not done yet
+	int work_found; // number of spheres found in this frame so far
+
+	pthread_mutex_t frame_mutex; // protects current_frame, free_frames and the handles (see "psmove_tracker_acquire_frame")
+
+	// low-priority thread building the lookup tables after a color adaption (see "psmove_tracker_adopt_luts")
+	pthread_t adaption_thread;
+	int adaption_running; // 1 if adaption_thread has been started
+	int adaption_quit; // set to make the adaption thread exit
+	pthread_mutex_t adaption_mutex; // protects all adaption_* fields and the lut_next_* fields of the controllers
+	pthread_cond_t adaption_cond; // signalled when a controller is queued (or adaption_quit is set)
+	pthread_cond_t adaption_done; // signalled when the tables of a controller have been built
+	TrackedController* adaption_queue[COLOR_ADAPTION_QUEUE]; // controllers waiting for their tables
+	int adaption_queued; // number of controllers in adaption_queue
+	TrackedController* adaption_current; // the controller whose tables are being built, or NULL
+
+	// thread applying new camera parameters of the automatic exposure control (see "psmove_tracker_apply_exposure")
+	pthread_t exposure_thread;
+	int exposure_running; // 1 if exposure_thread has been started
+	int exposure_quit; // set to make the exposure thread exit
+	pthread_mutex_t exposure_mutex; // protects all exposure_* fields
+	pthread_cond_t exposure_cond; // signalled when new parameters are pending (or exposure_quit is set)
+	int exposure_pending; // 1 if exposure_next and gain_next have not been applied yet
+	int exposure_next; // exposure to apply
+	int gain_next; // gain to apply
+#endif
 };
 
 // -------- START: internal functions only
 
 /**
- * XXX - this function is currently not used
+ * Used for the start exposure of the automatic exposure control (see "psmove_tracker_auto_exposure")
  * 
  * Adapts the cameras exposure to the current lighting conditions
  * This function will adapt to the most suitable exposure, it will start
@@ -148,6 +269,34 @@ struct _PSMoveTracker {
  **/
 int psmove_tracker_adapt_to_light(PSMoveTracker *tracker, int lumMin, int expMin, int expMax);
 
+/**
+ * Adjusts exposure and gain for the segmentation statistics of the last update:
+ * down if a sphere is saturated, up if the contrast between a sphere and its
+ * surroundings is too low. Changes are rate-limited and applied in the background.
+ *
+ * tracker - A valid PSMoveTracker * instance
+ **/
+void psmove_tracker_auto_exposure(PSMoveTracker* tracker);
+
+/**
+ * Reconfigures the camera with new exposure and gain, without blocking the caller
+ * if the exposure thread is running (the latest pending values win).
+ *
+ * tracker  - A valid PSMoveTracker * instance
+ * exposure - the new exposure (0-0xFFFF)
+ * gain     - the new gain (0-0xFFFF)
+ **/
+void psmove_tracker_apply_exposure(PSMoveTracker* tracker, int exposure, int gain);
+
+#if defined(PSMOVE_USE_PTHREADS)
+/**
+ * The exposure thread: applies the pending camera parameters (see "psmove_tracker_apply_exposure").
+ *
+ * data - the PSMoveTracker * instance
+ **/
+void *psmove_tracker_exposure_proc(void *data);
+#endif
+
 
 /**
  * Wait for a given time for a frame from the tracker
@@ -175,6 +324,19 @@ psmove_tracker_wait_for_frame(PSMoveTracker *tracker, IplImage **frame, int dela
  **/
 void psmove_tracker_get_diff(PSMoveTracker* tracker, PSMove* move, int r, int g, int b, IplImage* on, IplImage* diff, int delay);
 
+/**
+ * Same as "psmove_tracker_get_diff", but blinks the spheres of several controllers at the same time.
+ *
+ * tracker - the tracker that contains the camera control
+ * moves   - the PSMove controllers to use
+ * colors  - the BGR color to lit each sphere with
+ * count   - the number of controllers
+ * on	   - the pre-allocated image to store the captured image when the spheres are lit
+ * diff    - the pre-allocated image to store the calculated diff-image
+ * delay   - the time to wait before taking a picture (in microseconds)
+ **/
+void psmove_tracker_get_diff_multiple(PSMoveTracker* tracker, PSMove** moves, const CvScalar* colors, int count, IplImage* on, IplImage* diff, int delay);
+
 /**
  * This function seths the rectangle of the ROI and assures that the itis always within the bounds
  * of the camera image.
@@ -190,6 +352,27 @@ void psmove_tracker_get_diff(PSMoveTracker* tracker, PSMove* move, int r, int g,
  **/
 void psmove_tracker_set_roi(PSMoveTracker* tracker, TrackedController* tc, int roi_x, int roi_y, int roi_width, int roi_height);
 
+/**
+ * Changes the size of the roi of a controller (limited to ROI_MIN_SIZE and the
+ * biggest roi) and centers it at the given position (within the camera image).
+ *
+ * tracker    - A valid PSMoveTracker * instance
+ * tc         - The TrackableController whose roi should be changed
+ * center_x   - the x-part of the coordinate of the center of the roi
+ * center_y   - the y-part of the coordinate of the center of the roi
+ * roi_width  - the desired width of the roi
+ * roi_height - the desired height of the roi
+ **/
+void psmove_tracker_resize_roi(PSMoveTracker* tracker, TrackedController* tc, int center_x, int center_y, int roi_width, int roi_height);
+
+/**
+ * Returns a view (no copy) of the scratch mask of a controller, with the
+ * size of its current roi.
+ *
+ * tc - The TrackableController whose mask should be returned
+ **/
+IplImage* psmove_tracker_roi_mask(TrackedController* tc);
+
 /**
  * This function prepares the linked list of suitable colors, that can be used for tracking.
  */
@@ -201,11 +384,138 @@ void psmove_tracker_prepare_colors(PSMoveTracker* tracker);
 int psmove_tracker_update_controller(PSMoveTracker* tracker, TrackedController* tc);
 
 /**
- * This draws tracking statistics into the current camera image. This is only used internally.
+ * This picks the copy of the tracking loop used by "psmove_tracker_update_controller"
+ * for the current configuration; must be called whenever one of the options changes.
+ *
+ * A copy is compiled for each of the common combinations of smoothing, color adaption,
+ * automatic exposure and ROI prediction, so that the branches on these options are
+ * resolved at compile time. Any other combination uses the generic copy, which
+ * checks the options of the tracker on every frame.
+ *
+ * tracker - the tracker to use
+ */
+void psmove_tracker_select_variant(PSMoveTracker* tracker);
+
+/**
+ * This predicts where the sphere of a controller will be in the next frame, using
+ * its image velocity, and how far it might deviate from that prediction, using the
+ * rotation rate and linear acceleration measured by the controller.
+ *
+ * tracker - the tracker to use
+ * tc      - the controller whose sphere has just been found
+ * x, y    - (out) the predicted position of the sphere in the next frame
+ * margin  - (out) the expected deviation from the prediction (in pixels)
+ **/
+void psmove_tracker_predict_roi(PSMoveTracker* tracker, TrackedController* tc, float *x, float *y, float *margin);
+
+/**
+ * This searches a lost sphere in the whole frame: The frame is downsampled by
+ * REACQUIRE_SCALE, color filtered and the biggest blob is taken as the candidate
+ * that needs to be confirmed at full resolution.
+ *
+ * tracker - the tracker to use
+ * tc      - the controller whose sphere has been lost
+ * center  - (out) the position of the candidate in the (full resolution) frame
+ *
+ * Returns: nonzero if a candidate was found, zero otherwise
+ **/
+int psmove_tracker_reacquire(PSMoveTracker* tracker, TrackedController* tc, CvPoint *center);
+
+/**
+ * This applies the color filter of a controller to (a ROI of) the current frame.
+ * Depending on "tracker_color_lut", this uses the exact HSV range or the
+ * controller's color lookup table (which is rebuilt when the estimated color changed).
+ *
+ * tracker - the tracker to use
+ * tc      - the controller whose color should be found
+ * roi     - the BGR image to filter
+ * mask    - the pre-allocated binary result image
+ **/
+void psmove_tracker_filter_color(PSMoveTracker* tracker, TrackedController* tc, const CvArr* roi, IplImage* mask);
+
+/**
+ * This applies the color filter of a controller to a ROI of the current frame.
+ * Depending on "tracker_yuyv_filter" and the capture backend, this segments the
+ * raw YUYV data with the controller's YUV lookup table (which is rebuilt when the
+ * estimated color changed), or the BGR frame (see psmove_tracker_filter_color).
+ *
+ * tracker - the tracker to use
+ * tc      - the controller whose color should be found
+ * rect    - the ROI of the current frame
+ * mask    - the pre-allocated binary result image (of the size of rect)
+ **/
+void psmove_tracker_filter_frame(PSMoveTracker* tracker, TrackedController* tc, CvRect rect, IplImage* mask);
+
+/**
+ * Builds (or reuses) the color lookup table of the controller for its current
+ * estimated color (see th_build_color_lut).
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * tc      - The controller whose table should be returned
+ *
+ * Returns: the color lookup table of the controller
+ **/
+const unsigned char* psmove_tracker_color_lut(PSMoveTracker* tracker, TrackedController* tc);
+
+/**
+ * This allocates the scratch buffers (ROI masks, blob labeler and reacquisition images) of a controller,
+ * so that all controllers can be tracked in parallel without sharing any buffers.
+ *
+ * tracker - the tracker that defines the sizes of the ROI levels
+ * tc      - the controller to allocate the buffers for
+ **/
+void psmove_tracker_alloc_scratch(PSMoveTracker* tracker, TrackedController* tc);
+
+/**
+ * This releases the scratch buffers allocated by "psmove_tracker_alloc_scratch".
+ *
+ * tc - the controller to release the buffers of
+ **/
+void psmove_tracker_free_scratch(PSMoveTracker* tracker, TrackedController* tc);
+
+/**
+ * Memory used by the scratch buffers of a controller and by a frame handle (in bytes),
+ * see "psmove_tracker_get_memory_usage".
+ **/
+size_t psmove_tracker_scratch_size(TrackedController* tc);
+size_t psmove_tracker_frame_size(PSMoveTrackerFrame* frame);
+
+/**
+ * Called when the lookup tables of a controller don't match its estimated
+ * color anymore. With "color_background_adaption", this adopts the tables
+ * that have been built in the background (swapping them with the current ones),
+ * or queues the controller for the adaption thread, so that the caller can keep
+ * using the current tables instead of rebuilding them on the tracking path.
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * tc      - The controller whose color has been adapted
+ *
+ * Returns: 1 if the caller should use the (possibly swapped) current tables,
+ *          0 if it has to rebuild them itself
+ **/
+int psmove_tracker_adopt_luts(PSMoveTracker* tracker, TrackedController* tc);
+
+/**
+ * Allocates memory for a controller while it is being tracked; all scratch
+ * buffers are preallocated (see "psmove_tracker_alloc_scratch"), so this is
+ * only a fallback. Counted in PSMoveTrackerMetrics.allocations, and reported
+ * in debug builds, as the tracking loop should not allocate once it is warm.
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * tc      - The controller being tracked
+ * size    - The number of bytes to allocate
+ *
+ * Returns: the allocated memory (see malloc)
+ **/
+void* psmove_tracker_hot_alloc(PSMoveTracker* tracker, TrackedController* tc, size_t size);
+
+/**
+ * This draws tracking statistics into a copy of the current camera image. This is only used internally.
  *
  * tracker - the Tracker to use
+ * frame   - the image to draw into (of the same size as the camera image)
  */
-void psmove_tracker_draw_tracking_stats(PSMoveTracker* tracker);
+void psmove_tracker_draw_tracking_stats(PSMoveTracker* tracker, IplImage* frame);
 
 /*
  *  This finds the biggest contour within the given image.
@@ -213,7 +523,7 @@ void psmove_tracker_draw_tracking_stats(PSMoveTracker* tracker);
  *  img  		- (in) 	the binary image to search for contours
  *  stor 		- (out) a storage that can be used to save the result of this function
  *  resContour 	- (out) points to the biggest contour found within the image
- *  resSize 	- (out)	the size of that contour in px
+ *  resSize 	- (out)	the size of that contour in pxÃÂ²
  */
 void psmove_tracker_biggest_contour(IplImage* img, CvMemStorage* stor, CvSeq** resContour, float* resSize);
 
@@ -240,16 +550,42 @@ float psmove_tracker_hsvcolor_diff(TrackedController* tc);
 
 /*
  * This will estimate the position and the radius of the orb.
- * It will calcualte the radius by findin the two most distant points
- * in the contour. And its by choosing the mid point of those two.
+ * It will calculate the diameter as the larger one of the extent of the
+ * blob's bounding box and the length of its major axis (from the second
+ * order moments). The center is the center of the bounding box.
+ *
+ * blob 	- (in) 	The blob representing the orb.
+ * x            - (out) The X coordinate of the center.
+ * y            - (out) The Y coordinate of the center.
+ * radius	- (out) The radius of the blob that is calculated here.
+ */
+void
+psmove_tracker_estimate_circle_from_blob(const th_blob* blob, float *x, float *y, float* radius);
+
+/*
+ * This returns the position and radius of the orb in the (undistorted) full frame,
+ * as they are returned by psmove_tracker_get_position.
  *
- * cont 	- (in) 	The contour representing the orb.
+ * tracker 	- (in) 	A valid PSMoveTracker instance.
+ * tc 		- (in) 	The controller whose position should be returned.
  * x            - (out) The X coordinate of the center.
  * y            - (out) The Y coordinate of the center.
- * radius	- (out) The radius of the contour that is calculated here.
+ * radius	- (out) The radius of the orb.
+ */
+void
+psmove_tracker_camera_position(PSMoveTracker* tracker, TrackedController* tc, float *x, float *y, float* radius);
+
+/*
+ * This calculates the location of the orb relative to the camera (in mm) from its
+ * position and radius, and stores it in the TrackedController (see psmove_tracker_get_location).
+ * The camera matrix of the lens calibration is used if available, otherwise the
+ * location is based on cam_focal_length and cam_pixel_height.
+ *
+ * tracker 	- (in) 	A valid PSMoveTracker instance.
+ * tc 		- (in) 	The controller whose location should be updated.
  */
 void
-psmove_tracker_estimate_circle_from_contour(CvSeq* cont, float *x, float *y, float* radius);
+psmove_tracker_update_location(PSMoveTracker* tracker, TrackedController* tc);
 
 /*
  * This function return a optimal ROI center point for a given Tracked controller.
@@ -279,6 +615,92 @@ psmove_tracker_center_roi_on_controller(TrackedController* tc, PSMoveTracker* tr
 
 int psmove_tracker_old_color_is_tracked(PSMoveTracker* tracker, PSMove* move, int r, int g, int b);
 
+/*
+ * This starts tracking a controller with its old calibration values, if
+ * "psmove_tracker_old_color_is_tracked" succeeds for the given color.
+ *
+ * tracker       - (in) A valid PSMoveTracker
+ * move          - (in) The PSMove controller to enable
+ * tracked_color - (in) The color the sphere will be lit with
+ *
+ * Returns: nonzero if the controller is tracked now, zero otherwise
+ */
+int
+psmove_tracker_enable_with_old_color(PSMoveTracker *tracker, PSMove *move, PSMoveTrackingColor *tracked_color);
+
+/*
+ * This starts tracking a controller with the calibration record saved for it and the
+ * current camera (see "tracked_controller_load_calibration"). The record is validated
+ * against a single frame: the sphere has to be found with the cached color and its radius
+ * has to be similar to the typical radius of the record.
+ *
+ * tracker       - (in) A valid PSMoveTracker
+ * move          - (in) The PSMove controller to enable
+ * tracked_color - (in) The color the sphere will be lit with
+ *
+ * Returns: nonzero if the controller is tracked now, zero otherwise
+ */
+int
+psmove_tracker_enable_with_cached_calibration(PSMoveTracker *tracker, PSMove *move, PSMoveTrackingColor *tracked_color);
+
+/*
+ * This estimates the sphere color of a controller from the lit images of its blink
+ * sequence and the mask of its sphere, checks that the sphere can be found in
+ * all images using that color and, if so, starts tracking the controller.
+ *
+ * tracker       - (in) A valid PSMoveTracker
+ * move          - (in) The PSMove controller to enable
+ * tracked_color - (in) The (unused) color the sphere has been lit with
+ * images        - (in) The BLINKS images (BGR) taken with the sphere lit
+ * mask          - (in/out) The mask of the sphere (used as scratch image afterwards)
+ *
+ * Returns: Tracker_CALIBRATED on success, Tracker_CALIBRATION_ERROR otherwise
+ */
+enum PSMoveTracker_Status
+psmove_tracker_calibrate_from_mask(PSMoveTracker *tracker, PSMove *move,
+		PSMoveTrackingColor *tracked_color, IplImage **images, IplImage *mask);
+
+#if defined(PSMOVE_USE_PTHREADS)
+/**
+ * This tracks controllers of the current frame until no unclaimed one is left.
+ * It must be called with "work_mutex" held, which is released while tracking.
+ *
+ * tracker - the tracker whose "work_*" fields describe the current frame
+ **/
+void psmove_tracker_work_locked(PSMoveTracker* tracker);
+
+/**
+ * The main function of a worker thread, see "psmove_tracker_update".
+ *
+ * data - the PSMoveTracker the worker belongs to
+ **/
+void *psmove_tracker_worker_proc(void *data);
+
+/**
+ * The main function of the adaption thread, see "psmove_tracker_adopt_luts".
+ *
+ * data - the PSMoveTracker the thread belongs to
+ **/
+void *psmove_tracker_adaption_proc(void *data);
+
+/**
+ * Called before the camera buffer of the current frame is reused: a handle of
+ * the current frame that is still acquired gets its own copy of the image,
+ * released handles go back to the pool (see "psmove_tracker_acquire_frame").
+ *
+ * tracker - A valid PSMoveTracker * instance
+ **/
+void psmove_tracker_detach_frame(PSMoveTracker* tracker);
+
+/**
+ * Stores the current positions of all controllers in a frame handle.
+ *
+ * tracker - A valid PSMoveTracker * instance
+ * frame   - The handle of the current frame (not acquired by anyone else)
+ **/
+void psmove_tracker_annotate_frame(PSMoveTracker* tracker, PSMoveTrackerFrame* frame);
+#endif
+
 // -------- END: internal functions only
 
 PSMoveTracker *psmove_tracker_new() {
@@ -313,8 +735,37 @@ PSMoveTracker *psmove_tracker_new() {
     return psmove_tracker_new_with_camera(camera);
 }
 
+/**
+ * This creates a tracker for an already opened camera control (live or recorded).
+ *
+ * cc     - the camera control to track with
+ * camera - the index of the camera (identifies cached calibrations)
+ * replay - the file name of the recording played back by cc, NULL for a live camera
+ *
+ * Returns: a new tracker, or NULL if no frame could be read
+ **/
+static PSMoveTracker *
+psmove_tracker_new_with_camera_control(CameraControl *cc, int camera, const char *replay);
+
 PSMoveTracker *
 psmove_tracker_new_with_camera(int camera) {
+	return psmove_tracker_new_with_camera_control(camera_control_new(camera), camera, NULL);
+}
+
+PSMoveTracker *
+psmove_tracker_new_from_file(const char *filename) {
+	psmove_return_val_if_fail(filename != NULL, NULL);
+
+	CameraControl *cc = camera_control_new_from_file(filename);
+	if (!cc) {
+		return NULL;
+	}
+
+	return psmove_tracker_new_with_camera_control(cc, RECORDING_CAMERA, filename);
+}
+
+static PSMoveTracker *
+psmove_tracker_new_with_camera_control(CameraControl *cc, int camera, const char *replay) {
 	PSMoveTracker* tracker = (PSMoveTracker*) calloc(1, sizeof(PSMoveTracker));
 	tracker->rHSV = cvScalar(COLOR_FILTER_RANGE_H, COLOR_FILTER_RANGE_S, COLOR_FILTER_RANGE_V, 0);
 	tracker->storage = cvCreateMemStorage(0);
@@ -330,62 +781,135 @@ psmove_tracker_new_with_camera(int camera) {
 	tracker->tracker_t3 = TRACKER_QUALITY_T3;
 	tracker->tracker_adaptive_xy = TRACKER_ADAPTIVE_XY;
 	tracker->tracker_adaptive_z = TRACKER_ADAPTIVE_Z;
+	tracker->tracker_color_lut = TRACKER_COLOR_LUT;
+	tracker->tracker_yuyv_filter = TRACKER_YUYV_FILTER;
+	tracker->tracker_opencl = TRACKER_OPENCL;
+	tracker->tracker_undistort_points = TRACKER_UNDISTORT_POINTS;
+	tracker->tracker_predict_roi = TRACKER_PREDICT_ROI;
+	tracker->tracker_pyramid_reacquire = TRACKER_PYRAMID_REACQUIRE;
 	tracker->adapt_t1 = COLOR_ADAPTION_QUALITY;
 	tracker->color_t1 = COLOR_UPDATE_QUALITY_T1;
 	tracker->color_t2 = COLOR_UPDATE_QUALITY_T2;
 	tracker->color_t3 = COLOR_UPDATE_QUALITY_T3;
 	tracker->color_update_rate = COLOR_UPDATE_RATE;
+	tracker->color_background_adaption = COLOR_BACKGROUND_ADAPTION;
+
+	char *auto_exposure_env = getenv(PSMOVE_TRACKER_AUTO_EXPOSURE_ENV);
+	tracker->auto_exposure = auto_exposure_env && strcmp(auto_exposure_env, "1") == 0;
 	
 	// prepare available colors for tracking
 	psmove_tracker_prepare_colors(tracker);
 
 	// start the video capture device for tracking
-	tracker->cc = camera_control_new(camera);
+	tracker->camera = camera;
+	tracker->cc = cc;
+	if (replay) {
+		tracker->replay_calibration = (char*) malloc(strlen(replay) + strlen(RECORDING_CALIBRATION) + 1);
+		strcpy(tracker->replay_calibration, replay);
+		strcat(tracker->replay_calibration, RECORDING_CALIBRATION);
+	}
 
         char *intrinsics_xml = psmove_util_get_file_path(INTRINSICS_XML);
         char *distortion_xml = psmove_util_get_file_path(DISTORTION_XML);
-	camera_control_read_calibration(tracker->cc, intrinsics_xml, distortion_xml);
+	camera_control_read_calibration(tracker->cc, intrinsics_xml, distortion_xml,
+			!tracker->tracker_undistort_points);
         free(intrinsics_xml);
         free(distortion_xml);
 
-	// backup the systems settings, if not already backuped
+	// backup the systems settings, if not already backuped (there are none for recordings)
 	char *filename = psmove_util_get_file_path(PSEYE_BACKUP_FILE);
-	if (!th_file_exists(filename)) {
+	if (!tracker->replay_calibration && !th_file_exists(filename)) {
             camera_control_backup_system_settings(tracker->cc, filename);
     }
 	free(filename);
 	
 	// use static exposure
 	tracker->exposure = GOOD_EXPOSURE;
-	// use dynamic exposure (This function would enable a lighting condition specific exposure.)
-	//tracker->exposure = psmove_tracker_adapt_to_light(tracker, 25, 2051, 4051);
-	camera_control_set_parameters(tracker->cc, 0, 0, 0, tracker->exposure, 0, 0xffff, 0xffff, 0xffff, -1, -1);
+	if (!tracker->replay_calibration) {
+		if (tracker->auto_exposure) {
+			// start with a lighting condition specific exposure (adjusted while tracking)
+			tracker->exposure = psmove_tracker_adapt_to_light(tracker, 25, 2051, 4051);
+		}
+		camera_control_set_parameters(tracker->cc, 0, 0, 0, tracker->exposure, 0, 0xffff, 0xffff, 0xffff, -1, -1);
+	} else {
+		// the exposure of a recording can't be changed
+		tracker->auto_exposure = 0;
+	}
+	tracker->auto_exposure_value = tracker->exposure;
+	tracker->gain = 0;
+	psmove_tracker_select_variant(tracker);
 
 	// just query a frame so that we know the camera works
 	IplImage* frame = NULL;
 	while (!frame) {
 		frame = camera_control_query_frame(tracker->cc);
+		if (!frame && tracker->replay_calibration) {
+			// the recording is empty (or broken), it won't get better
+			camera_control_delete(tracker->cc);
+			cvReleaseMemStorage(&tracker->storage);
+			tracked_color_release(&tracker->available_colors, 1);
+			free(tracker->replay_calibration);
+			free(tracker);
+			return NULL;
+		}
 	}
 
 	// prepare ROI data structures
 	
-	/* The biggest roi is 1/4 of the whole image (a rectangle) */
-	int w = frame->width/2;
-	int h = frame->height/2;
-	
+	/* The biggest roi is 1/4 of the whole image (a rectangle), smaller ones are views of it */
+	tracker->roi_max = cvSize(frame->width/2, frame->height/2);
+#ifdef DEBUG_WINDOWS
+	tracker->roiI = cvCreateImage(tracker->roi_max, frame->depth, 3);
+#endif
+
 	int i;
-	for (i = 0; i < ROIS; i++) {
-		tracker->roiI[i] = cvCreateImage(cvSize(w,h), frame->depth, 3);
-		tracker->roiM[i] = cvCreateImage(cvSize(w,h), frame->depth, 1);
-		
-		/* Smaller rois are always square, and 70% of the previous level */
-		h = w = MIN(w,h) * 0.7f;
-	}
 
 	// prepare structure used for erode and dilate in calibration process
 	int ks = 5; // Kernel Size
 	int kc = (ks + 1) / 2; // Kernel Center
 	tracker->kCalib = cvCreateStructuringElementEx(ks, ks, kc, kc, CV_SHAPE_RECT, NULL);
+
+	// falls back to the CPU if there is no GPU (or no OpenCL support)
+	if (tracker->tracker_opencl) {
+		tracker->opencl = th_opencl_new();
+	}
+
+#if defined(PSMOVE_USE_PTHREADS) && !defined(DEBUG_WINDOWS)
+	// start one worker per additional core (the caller of "psmove_tracker_update" also tracks)
+	pthread_mutex_init(&tracker->work_mutex, NULL);
+	pthread_cond_init(&tracker->work_cond, NULL);
+	pthread_cond_init(&tracker->done_cond, NULL);
+
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int workers = MIN(MAX(cores - 1, 0), TRACKER_MAX_WORKERS);
+	for (i = 0; i < workers; i++) {
+		if (pthread_create(&tracker->workers[i], NULL, psmove_tracker_worker_proc, tracker) != 0) {
+			break;
+		}
+		tracker->worker_count++;
+	}
+#endif
+
+#if defined(PSMOVE_USE_PTHREADS)
+	pthread_mutex_init(&tracker->frame_mutex, NULL);
+
+	if (tracker->color_background_adaption) {
+		pthread_mutex_init(&tracker->adaption_mutex, NULL);
+		pthread_cond_init(&tracker->adaption_cond, NULL);
+		pthread_cond_init(&tracker->adaption_done, NULL);
+		if (pthread_create(&tracker->adaption_thread, NULL, psmove_tracker_adaption_proc, tracker) == 0) {
+			tracker->adaption_running = 1;
+		}
+	}
+
+	// setting camera parameters can take a while, so it does not happen in the tracking loop
+	pthread_mutex_init(&tracker->exposure_mutex, NULL);
+	pthread_cond_init(&tracker->exposure_cond, NULL);
+	if (!tracker->replay_calibration &&
+			pthread_create(&tracker->exposure_thread, NULL, psmove_tracker_exposure_proc, tracker) == 0) {
+		tracker->exposure_running = 1;
+	}
+#endif
 	return tracker;
 }
 
@@ -416,6 +940,7 @@ int psmove_tracker_old_color_is_tracked(PSMoveTracker* tracker, PSMove* move, in
 
 	TrackedController* tc = tracked_controller_create();
 	tc->dColor = cvScalar(b, g, r, 0);
+	psmove_tracker_alloc_scratch(tracker, tc);
 
 	if (tracked_controller_load_color(tc)) {
 		result = 1;
@@ -441,6 +966,7 @@ int psmove_tracker_old_color_is_tracked(PSMoveTracker* tracker, PSMove* move, in
 			result = result && tc->q1 > 0.83 && tc->q3 > 8;
 		}
 	}
+	psmove_tracker_free_scratch(tracker, tc);
 	tracked_controller_release(&tc, 1);
 	return result;
 }
@@ -458,14 +984,11 @@ psmove_tracker_enable_with_color(PSMoveTracker *tracker, PSMove *move,
 	if (!tracked_color || tracked_color->is_used)
 		return Tracker_CALIBRATION_ERROR;
 
-	// try to track the controller with the old color, if it works we are done
-	if (psmove_tracker_old_color_is_tracked(tracker, move, r, g, b)) {
-		TrackedController* itm = tracked_controller_insert(&tracker->controllers, move);
-		itm->dColor = cvScalar(b, g, r, 0);
-		tracked_controller_load_color(itm);
-		tracked_color->is_used = 1;
+	// try the cached calibration first, then the old color, if it works we are done
+	if (psmove_tracker_enable_with_cached_calibration(tracker, move, tracked_color))
+		return Tracker_CALIBRATED;
+	if (psmove_tracker_enable_with_old_color(tracker, move, tracked_color))
 		return Tracker_CALIBRATED;
-	}
 
 	// clear the calibration html trace
 	psmove_html_trace_clear();
@@ -475,7 +998,6 @@ psmove_tracker_enable_with_color(PSMoveTracker *tracker, PSMove *move,
 	assert(frame!=NULL);
 	IplImage* images[BLINKS]; // array of images saved during calibration for estimation of sphere color
 	IplImage* diffs[BLINKS]; // array of masks saved during calibration for estimation of sphere color
-	double sizes[BLINKS]; // array of blob sizes saved during calibration for estimation of sphere color
 	int i;
 	for (i = 0; i < BLINKS; i++) {
 		images[i] = cvCreateImage(cvGetSize(frame), frame->depth, 3);
@@ -528,85 +1050,337 @@ psmove_tracker_enable_with_color(PSMoveTracker *tracker, PSMove *move,
 
 	cvClearMemStorage(tracker->storage);
 
-	// DEBUG log the final diff-image used for color estimation
-	psmove_html_trace_image_at(mask, 0, "finaldiff");
+	// estimate the color and check that the sphere can be tracked with it
+	enum PSMoveTracker_Status result =
+		psmove_tracker_calibrate_from_mask(tracker, move, tracked_color, images, mask);
 
-	// CHECK if the blob contains a minimum number of pixels
-	if (cvCountNonZero(mask) < CALIB_MIN_SIZE) {
-		psmove_html_trace_put_log_entry("WARNING", "The final mask my not be representative for color estimation.");
+	// clean up all temporary images
+	for (i = 0; i < BLINKS; i++) {
+		cvReleaseImage(&images[i]);
+		cvReleaseImage(&diffs[i]);
 	}
 
-	// calculate the avg color
-	CvScalar color = cvAvg(images[0], mask);
-	CvScalar hsv_assigned = th_brg2hsv(assignedColor);  // HSV color sent to controller
-	CvScalar hsv_color = th_brg2hsv(color);				// HSV color seen by camera
-	
-	psmove_html_trace_put_color_var("estimatedColor", color);
-	psmove_html_trace_put_int_var("estimated_hue", hsv_color.val[0]);
-	psmove_html_trace_put_int_var("assigned_hue", hsv_assigned.val[0]);
-	psmove_html_trace_put_int_var("allowed_hue_difference", tracker->rHSV.val[0]);
+	return result;
+}
 
-	// CHECK if the hue of the estimated and the assigned colors differ more than allowed in the color-filter range.s
-	if (abs(hsv_assigned.val[0] - hsv_color.val[0]) > tracker->rHSV.val[0]) {
-		psmove_html_trace_put_log_entry("WARNING", "The estimated color seems not to be similar to the color it should be.");
-	}
+int
+psmove_tracker_enable_with_old_color(PSMoveTracker *tracker, PSMove *move, PSMoveTrackingColor *tracked_color)
+{
+	unsigned char r = tracked_color->r;
+	unsigned char g = tracked_color->g;
+	unsigned char b = tracked_color->b;
 
-	int valid_countours = 0;
-	// calculate upper & lower bounds for the color filter
-	CvScalar min, max;
-	th_minus(hsv_color.val, tracker->rHSV.val, min.val, 3);
-	th_plus(hsv_color.val, tracker->rHSV.val, max.val, 3);
-	// for each image (where the sphere was lit)
+	if (!psmove_tracker_old_color_is_tracked(tracker, move, r, g, b))
+		return 0;
 
-	CvPoint firstPosition;
-	for (i = 0; i < BLINKS; i++) {
-		// convert to HSV
-		cvCvtColor(images[i], images[i], CV_BGR2HSV);
-		// apply color filter
-		cvInRangeS(images[i], min, max, mask);
+	TrackedController* itm = tracked_controller_insert(&tracker->controllers, move);
+	itm->dColor = cvScalar(b, g, r, 0);
+	tracked_controller_load_color(itm);
+	psmove_tracker_alloc_scratch(tracker, itm);
+	tracked_color->is_used = 1;
+	return 1;
+}
 
-		// use morphological operations to further remove noise
-		cvErode(mask, mask, tracker->kCalib, 1);
-		cvDilate(mask, mask, tracker->kCalib, 1);
+int
+psmove_tracker_enable_with_cached_calibration(PSMoveTracker *tracker, PSMove *move, PSMoveTrackingColor *tracked_color)
+{
+	unsigned char r = tracked_color->r;
+	unsigned char g = tracked_color->g;
+	unsigned char b = tracked_color->b;
+	int exposure;
+	float radius;
 
-		// DEBUG log the color filter and
-		psmove_html_trace_image_at(mask, i, "filtered");
+	TrackedController* tc = tracked_controller_create();
+	tc->move = move;
+	tc->dColor = cvScalar(b, g, r, 0);
 
-		// find the biggest contour in the image and save its location and size
-		psmove_tracker_biggest_contour(mask, tracker->storage, &contourBest, &sizeBest);
-		sizes[i] = 0;
-		float dist = FLT_MAX;
-		CvRect bBox;
-		if (contourBest) {
-			bBox = cvBoundingRect(contourBest, 0);
-			if (i == 0) {
-				firstPosition = cvPoint(bBox.x, bBox.y);
-			}
-			dist = sqrt(pow(firstPosition.x - bBox.x, 2) + pow(firstPosition.y - bBox.y, 2));
-			sizes[i] = sizeBest;
-		}
+	// the color depends on the exposure, so the record is only valid for the same one
+	if (!tracked_controller_load_calibration(tc, tracker->replay_calibration, tracker->camera, &exposure, &radius) ||
+			(exposure != tracker->exposure && !tracker->replay_calibration)) {
+		tracked_controller_release(&tc, 0);
+		return 0;
+	}
 
-		// CHECK for errors (no contour, more than one contour, or contour too small)
-		if (!contourBest) {
-			psmove_html_trace_array_item_at(i, "contours", "no contour");
-		} else if (sizes[i] <= CALIB_MIN_SIZE) {
-			psmove_html_trace_array_item_at(i, "contours", "too small");
-		} else if (dist >= CALIB_MAX_DIST) {
-			psmove_html_trace_array_item_at(i, "contours", "too far apart");
-		} else {
-			psmove_html_trace_array_item_at(i, "contours", "OK");
-			// all checks passed, increase the number of valid contours
-			valid_countours++;
+	// light the sphere and look for it in a single frame
+	psmove_set_leds(move, r * DIMMING_FACTOR, g * DIMMING_FACTOR, b * DIMMING_FACTOR);
+	psmove_update_leds(move);
+	psmove_tracker_wait_for_frame(tracker, &tracker->frame, BLINK_DELAY);
+
+	psmove_tracker_alloc_scratch(tracker, tc);
+	int result = tracker->frame &&
+		psmove_tracker_update_controller(tracker, tc) &&
+		tc->q1 > CALIB_CACHE_QUALITY &&
+		tc->r * CALIB_CACHE_RADIUS_RANGE > radius &&
+		tc->r < radius * CALIB_CACHE_RADIUS_RANGE;
+	psmove_tracker_free_scratch(tracker, tc);
+
+	if (result) {
+		// continue tracking where the validation found the sphere
+		TrackedController* itm = tracked_controller_insert(&tracker->controllers, move);
+		itm->dColor = tc->dColor;
+		itm->eFColor = tc->eFColor;
+		itm->eFColorHSV = tc->eFColorHSV;
+		itm->eColor = tc->eColor;
+		itm->eColorHSV = tc->eColorHSV;
+		itm->roi_x = tc->roi_x;
+		itm->roi_y = tc->roi_y;
+		itm->roi_width = tc->roi_width;
+		itm->roi_height = tc->roi_height;
+		itm->x = tc->x;
+		itm->y = tc->y;
+		itm->r = itm->rs = tc->r;
+		itm->is_tracked = 1;
+		psmove_tracker_alloc_scratch(tracker, itm);
+		tracked_color->is_used = 1;
+	}
+
+	tracked_controller_release(&tc, 0);
+	return result;
+}
+
+int
+psmove_tracker_enable_multiple(PSMoveTracker *tracker, PSMove **moves, int count,
+		enum PSMoveTracker_Status *results)
+{
+	psmove_return_val_if_fail(tracker != NULL, 0);
+	psmove_return_val_if_fail(moves != NULL, 0);
+	psmove_return_val_if_fail(results != NULL, 0);
+
+	int calibrated = 0;
+	int pending = 0;
+	int i, j, k;
+	PSMove** pending_moves = (PSMove**) calloc(count, sizeof(PSMove*));
+	PSMoveTrackingColor** pending_colors = (PSMoveTrackingColor**) calloc(count, sizeof(PSMoveTrackingColor*));
+	CvScalar* blink_colors = (CvScalar*) calloc(count, sizeof(CvScalar));
+	int* blob_of = (int*) calloc(count, sizeof(int)); // the candidate blob of each pending controller
+
+	for (i = 0; i < count; i++) {
+		results[i] = Tracker_CALIBRATION_ERROR;
+
+		// check if the controller is already enabled!
+		if (tracked_controller_find(tracker->controllers, moves[i])) {
+			results[i] = Tracker_CALIBRATED;
+			calibrated++;
+			continue;
+		}
+
+		// pick a free color (it is reserved until the calibration of this batch is done)
+		PSMoveTrackingColor* color = tracker->available_colors;
+		while (color && color->is_used) {
+			color = color->next;
+		}
+		if (!color)
+			continue;
+		color->is_used = 1;
+
+		// try the cached calibration first, then the old color, if it works we are done
+		if (psmove_tracker_enable_with_cached_calibration(tracker, moves[i], color) ||
+				psmove_tracker_enable_with_old_color(tracker, moves[i], color)) {
+			results[i] = Tracker_CALIBRATED;
+			calibrated++;
+			continue;
+		}
+
+		pending_moves[pending] = moves[i];
+		pending_colors[pending] = color;
+		blink_colors[pending] = cvScalar(color->b, color->g, color->r, 0);
+		pending++;
+	}
+
+	if (pending > 0) {
+		// clear the calibration html trace
+		psmove_html_trace_clear();
+
+		IplImage* frame = camera_control_query_frame(tracker->cc);
+		// check if the frame retrieved, is valid
+		assert(frame!=NULL);
+		IplImage* images[BLINKS]; // array of images saved during calibration for estimation of sphere colors
+		IplImage* diffs[BLINKS]; // array of masks saved during calibration for estimation of sphere colors
+		for (i = 0; i < BLINKS; i++) {
+			images[i] = cvCreateImage(cvGetSize(frame), frame->depth, 3);
+			diffs[i] = cvCreateImage(cvGetSize(frame), frame->depth, 1);
+		}
+
+		// blink all remaining spheres at once (each in its own color)
+		for (i = 0; i < BLINKS; i++) {
+			psmove_tracker_get_diff_multiple(tracker, pending_moves, blink_colors, pending, images[i], diffs[i], BLINK_DELAY);
+
+			// threshold it and use morphological operations to reduce image noise
+			cvThreshold(diffs[i], diffs[i], tracker->calibration_t, 0xFF /* white */, CV_THRESH_BINARY);
+			cvErode(diffs[i], diffs[i], tracker->kCalib, 1);
+			cvDilate(diffs[i], diffs[i], tracker->kCalib, 1);
+		}
+
+		// the regions lit in all images are the candidates for the spheres
+		IplImage* mask = diffs[0];
+		for (i = 1; i < BLINKS; i++) {
+			cvAnd(mask, diffs[i], mask, NULL);
+		}
+
+		// collect the candidate blobs and their hue (cvFindContours modifies the mask)
+		IplImage* candidates = cvCloneImage(mask);
+		CvSeq* contour;
+		CvSeq* contours[CALIB_MAX_CANDIDATES];
+		double hues[CALIB_MAX_CANDIDATES];
+		int n = 0;
+		cvFindContours(candidates, tracker->storage, &contour, sizeof(CvContour), CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE, cvPoint(0, 0));
+		for (; contour && n < CALIB_MAX_CANDIDATES; contour = contour->h_next) {
+			if (cvContourArea(contour, CV_WHOLE_SEQ, 0) <= CALIB_MIN_SIZE)
+				continue;
+			cvSet(mask, th_black, NULL);
+			cvDrawContours(mask, contour, th_white, th_white, -1, CV_FILLED, 8, cvPoint(0, 0));
+			contours[n] = contour;
+			hues[n] = th_brg2hsv(cvAvg(images[0], mask)).val[0];
+			n++;
+		}
+
+		// tell the spheres apart by their hue: repeatedly match the controller and blob with the
+		// most similar hues (hue is circular, with a range of 0..180)
+		int assigned[CALIB_MAX_CANDIDATES] = { 0 };
+		for (j = 0; j < pending; j++) {
+			blob_of[j] = -1;
+		}
+		for (k = 0; k < MIN(pending, n); k++) {
+			double best = DBL_MAX;
+			int best_j = -1, best_c = -1;
+			for (j = 0; j < pending; j++) {
+				if (blob_of[j] != -1)
+					continue;
+				double hue = th_brg2hsv(blink_colors[j]).val[0];
+				for (i = 0; i < n; i++) {
+					double d = fabs(hue - hues[i]);
+					d = MIN(d, 180 - d);
+					if (!assigned[i] && d < best) {
+						best = d;
+						best_j = j;
+						best_c = i;
+					}
+				}
+			}
+			blob_of[best_j] = best_c;
+			assigned[best_c] = 1;
+		}
+
+		// estimate the color of each controller from its own blob
+		for (j = 0; j < pending; j++) {
+			cvSet(mask, th_black, NULL);
+			if (blob_of[j] != -1)
+				cvDrawContours(mask, contours[blob_of[j]], th_white, th_white, -1, CV_FILLED, 8, cvPoint(0, 0));
+
+			// release the reservation, the color is marked as used again if calibration succeeds
+			pending_colors[j]->is_used = 0;
+			enum PSMoveTracker_Status result =
+				psmove_tracker_calibrate_from_mask(tracker, pending_moves[j], pending_colors[j], images, mask);
+			// find the original position of the controller
+			for (i = 0; i < count; i++) {
+				if (moves[i] == pending_moves[j]) {
+					results[i] = result;
+				}
+			}
+			if (result == Tracker_CALIBRATED) {
+				calibrated++;
+			}
 		}
 		cvClearMemStorage(tracker->storage);
 
+		// clean up all temporary images
+		cvReleaseImage(&candidates);
+		for (i = 0; i < BLINKS; i++) {
+			cvReleaseImage(&images[i]);
+			cvReleaseImage(&diffs[i]);
+		}
 	}
 
-	// clean up all temporary images
+	free(pending_moves);
+	free(pending_colors);
+	free(blink_colors);
+	free(blob_of);
+	return calibrated;
+}
+
+enum PSMoveTracker_Status
+psmove_tracker_calibrate_from_mask(PSMoveTracker *tracker, PSMove *move,
+		PSMoveTrackingColor *tracked_color, IplImage **images, IplImage *mask)
+{
+	int i;
+	unsigned char r = tracked_color->r;
+	unsigned char g = tracked_color->g;
+	unsigned char b = tracked_color->b;
+	CvScalar assignedColor = cvScalar(b, g, r, 0);
+	double sizes[BLINKS]; // array of blob sizes saved during calibration for estimation of sphere color
+	float sizeBest = 0;
+	CvSeq* contourBest = NULL;
+
+	// DEBUG log the final diff-image used for color estimation
+	psmove_html_trace_image_at(mask, 0, "finaldiff");
+
+	// CHECK if the blob contains a minimum number of pixels
+	if (cvCountNonZero(mask) < CALIB_MIN_SIZE) {
+		psmove_html_trace_put_log_entry("WARNING", "The final mask my not be representative for color estimation.");
+	}
+
+	// calculate the avg color
+	CvScalar color = cvAvg(images[0], mask);
+	CvScalar hsv_assigned = th_brg2hsv(assignedColor);  // HSV color sent to controller
+	CvScalar hsv_color = th_brg2hsv(color);				// HSV color seen by camera
+	
+	psmove_html_trace_put_color_var("estimatedColor", color);
+	psmove_html_trace_put_int_var("estimated_hue", hsv_color.val[0]);
+	psmove_html_trace_put_int_var("assigned_hue", hsv_assigned.val[0]);
+	psmove_html_trace_put_int_var("allowed_hue_difference", tracker->rHSV.val[0]);
+
+	// CHECK if the hue of the estimated and the assigned colors differ more than allowed in the color-filter range.s
+	if (abs(hsv_assigned.val[0] - hsv_color.val[0]) > tracker->rHSV.val[0]) {
+		psmove_html_trace_put_log_entry("WARNING", "The estimated color seems not to be similar to the color it should be.");
+	}
+
+	int valid_countours = 0;
+	// calculate upper & lower bounds for the color filter
+	CvScalar min, max;
+	th_minus(hsv_color.val, tracker->rHSV.val, min.val, 3);
+	th_plus(hsv_color.val, tracker->rHSV.val, max.val, 3);
+	// for each image (where the sphere was lit)
+
+	CvPoint firstPosition;
 	for (i = 0; i < BLINKS; i++) {
-		cvReleaseImage(&images[i]);
-		cvReleaseImage(&diffs[i]);
-		mask = NULL;
+		// apply color filter (directly on the BGR image, the images are shared between controllers)
+		th_bgr_hsv_in_range(images[i], min, max, mask);
+
+		// use morphological operations to further remove noise
+		cvErode(mask, mask, tracker->kCalib, 1);
+		cvDilate(mask, mask, tracker->kCalib, 1);
+
+		// DEBUG log the color filter and
+		psmove_html_trace_image_at(mask, i, "filtered");
+
+		// find the biggest contour in the image and save its location and size
+		psmove_tracker_biggest_contour(mask, tracker->storage, &contourBest, &sizeBest);
+		sizes[i] = 0;
+		float dist = FLT_MAX;
+		CvRect bBox;
+		if (contourBest) {
+			bBox = cvBoundingRect(contourBest, 0);
+			if (i == 0) {
+				firstPosition = cvPoint(bBox.x, bBox.y);
+			}
+			dist = sqrt(pow(firstPosition.x - bBox.x, 2) + pow(firstPosition.y - bBox.y, 2));
+			sizes[i] = sizeBest;
+		}
+
+		// CHECK for errors (no contour, more than one contour, or contour too small)
+		if (!contourBest) {
+			psmove_html_trace_array_item_at(i, "contours", "no contour");
+		} else if (sizes[i] <= CALIB_MIN_SIZE) {
+			psmove_html_trace_array_item_at(i, "contours", "too small");
+		} else if (dist >= CALIB_MAX_DIST) {
+			psmove_html_trace_array_item_at(i, "contours", "too far apart");
+		} else {
+			psmove_html_trace_array_item_at(i, "contours", "OK");
+			// all checks passed, increase the number of valid contours
+			valid_countours++;
+		}
+		cvClearMemStorage(tracker->storage);
+
 	}
 
 	int has_calibration_errors = 0;
@@ -628,6 +1402,7 @@ psmove_tracker_enable_with_color(PSMoveTracker *tracker, PSMove *move,
 
 	// insert to list of tracked controllers
 	TrackedController* itm = tracked_controller_insert(&tracker->controllers, move);
+	psmove_tracker_alloc_scratch(tracker, itm);
 	// set current color
 	itm->dColor = cvScalar(b, g, r, 0);
 	// set first estimated color
@@ -640,7 +1415,12 @@ psmove_tracker_enable_with_color(PSMoveTracker *tracker, PSMove *move,
 	// set, that this color is in use
 	tracked_color->is_used = 1;
 
-	tracked_controller_save_colors(tracker->controllers);
+	// remember the calibration for a fast start next time (but not the one of a recording)
+	if (!tracker->replay_calibration) {
+		tracked_controller_save_colors(tracker->controllers);
+		tracked_controller_save_calibration(itm, NULL, tracker->camera, tracker->exposure,
+				sqrt(th_avg(sizes, BLINKS) / th_PI));
+	}
 	return Tracker_CALIBRATED;
 }
 
@@ -664,8 +1444,9 @@ void psmove_tracker_disable(PSMoveTracker *tracker, PSMove *move) {
 	TrackedController* tc = tracked_controller_find(tracker->controllers, move);
 	PSMoveTrackingColor* color = tracked_color_find(tracker->available_colors, tc->dColor.val[2], tc->dColor.val[1], tc->dColor.val[0]);
 	if (tc) {
+		psmove_tracker_free_scratch(tracker, tc);
+		// this also releases tc
 		tracked_controller_remove(&tracker->controllers, move);
-		tracked_controller_release(&tc, 0);
 	}
 	
 	if (color)
@@ -689,71 +1470,297 @@ psmove_tracker_get_image(PSMoveTracker *tracker) {
 	return tracker->frame;
 }
 
+void*
+psmove_tracker_get_annotated_image(PSMoveTracker *tracker) {
+	if (!tracker->frame)
+		return NULL;
+
+	// (re-)allocate the copy only if the frame format changed
+	if (tracker->annotated && (tracker->annotated->width != tracker->frame->width ||
+				tracker->annotated->height != tracker->frame->height ||
+				tracker->annotated->nChannels != tracker->frame->nChannels)) {
+		cvReleaseImage(&tracker->annotated);
+	}
+	if (!tracker->annotated)
+		tracker->annotated = cvCreateImage(cvGetSize(tracker->frame), tracker->frame->depth, tracker->frame->nChannels);
+
+	cvCopy(tracker->frame, tracker->annotated, NULL);
+	psmove_tracker_draw_tracking_stats(tracker, tracker->annotated);
+	return tracker->annotated;
+}
+
+PSMoveTrackerFrame *
+psmove_tracker_acquire_frame(PSMoveTracker *tracker)
+{
+	psmove_return_val_if_fail(tracker != NULL, NULL);
+
+	if (!tracker->frame)
+		return NULL;
+
+#if defined(PSMOVE_USE_PTHREADS)
+	pthread_mutex_lock(&tracker->frame_mutex);
+#endif
+	PSMoveTrackerFrame* frame = tracker->current_frame;
+	if (!frame) {
+		// a header for the camera buffer (no copy)
+		frame = tracker->free_frames;
+		if (frame) {
+			tracker->free_frames = frame->next;
+		} else {
+			frame = (PSMoveTrackerFrame*) calloc(1, sizeof(PSMoveTrackerFrame));
+		}
+		cvInitImageHeader(&frame->header, cvGetSize(tracker->frame), tracker->frame->depth,
+				tracker->frame->nChannels, IPL_ORIGIN_TL, 4);
+		cvSetData(&frame->header, tracker->frame->imageData, tracker->frame->widthStep);
+		frame->timestamp_us = tracker->frame_timestamp_us;
+		frame->next = NULL;
+		tracker->current_frame = frame;
+	}
+
+	// nobody is looking at the positions, so they can be updated
+	if (frame->refs == 0) {
+		psmove_tracker_annotate_frame(tracker, frame);
+	}
+	frame->refs++;
+#if defined(PSMOVE_USE_PTHREADS)
+	pthread_mutex_unlock(&tracker->frame_mutex);
+#endif
+
+	return frame;
+}
+
+void
+psmove_tracker_release_frame(PSMoveTracker *tracker, PSMoveTrackerFrame *frame)
+{
+	psmove_return_if_fail(tracker != NULL);
+	psmove_return_if_fail(frame != NULL);
+
+#if defined(PSMOVE_USE_PTHREADS)
+	pthread_mutex_lock(&tracker->frame_mutex);
+#endif
+	int unused = 0;
+	if (frame->refs > 0) {
+		unused = (--frame->refs == 0);
+	} else {
+		fprintf(stderr, "[PSMOVE] Frame released more often than acquired\n");
+	}
+
+	// the handle of the current frame is kept (and reused) until the next frame
+	if (unused && frame != tracker->current_frame) {
+		frame->next = tracker->free_frames;
+		tracker->free_frames = frame;
+	}
+#if defined(PSMOVE_USE_PTHREADS)
+	pthread_mutex_unlock(&tracker->frame_mutex);
+#endif
+}
+
+void*
+psmove_tracker_frame_get_image(PSMoveTrackerFrame *frame)
+{
+	psmove_return_val_if_fail(frame != NULL, NULL);
+
+	return &frame->header;
+}
+
+long long
+psmove_tracker_frame_get_timestamp(PSMoveTrackerFrame *frame)
+{
+	psmove_return_val_if_fail(frame != NULL, 0);
+
+	return frame->timestamp_us;
+}
+
+int
+psmove_tracker_frame_get_position(PSMoveTrackerFrame *frame, PSMove *move,
+		float *x, float *y, float *radius)
+{
+	psmove_return_val_if_fail(frame != NULL, 0);
+	psmove_return_val_if_fail(move != NULL, 0);
+
+	int i;
+	for (i = 0; i < frame->position_count; i++) {
+		TrackerFramePosition* position = &frame->positions[i];
+		if (position->move == move) {
+			if (x) {
+				*x = position->x;
+			}
+			if (y) {
+				*y = position->y;
+			}
+			if (radius) {
+				*radius = position->radius;
+			}
+			return position->tracked;
+		}
+	}
+
+	return 0;
+}
+
+void
+psmove_tracker_set_auto_exposure(PSMoveTracker *tracker, enum PSMove_Bool enabled)
+{
+	psmove_return_if_fail(tracker != NULL);
+
+	// the exposure of a recording can't be changed
+	tracker->auto_exposure = enabled && !tracker->replay_calibration;
+	psmove_tracker_select_variant(tracker);
+}
+
+void
+psmove_tracker_set_time_budget(PSMoveTracker *tracker, int budget_us)
+{
+	psmove_return_if_fail(tracker != NULL);
+	psmove_return_if_fail(budget_us >= 0);
+
+	tracker->time_budget_us = budget_us;
+	tracker->budget_load = 0;
+}
+
+void
+psmove_tracker_set_frame_callback(PSMoveTracker *tracker,
+		PSMoveTrackerFrameCallback callback, void *user_data)
+{
+	psmove_return_if_fail(tracker != NULL);
+
+	tracker->frame_callback = callback;
+	tracker->frame_callback_data = user_data;
+}
+
 void psmove_tracker_update_image(PSMoveTracker *tracker) {
+	long long started = psmove_util_get_ticks_us();
+	PSMOVE_TRACE_BEGIN("tracker_update_image");
+	psmove_tracker_detach_frame(tracker);
 	tracker->frame = camera_control_query_frame(tracker->cc);
+	tracker->frame_yuyv = tracker->tracker_yuyv_filter ?
+		camera_control_get_yuyv_frame(tracker->cc) : NULL;
+	tracker->frame_uploaded = 0;
+	tracker->metrics.capture_wait_us = (int)(psmove_util_get_ticks_us() - started);
+	tracker->metrics.undistort_us = camera_control_get_undistort_us(tracker->cc);
+	tracker->frame_timestamp_us = camera_control_get_frame_timestamp(tracker->cc);
+	PSMOVE_TRACE_END("tracker_update_image");
 }
 
-int
-psmove_tracker_update_controller(PSMoveTracker *tracker, TrackedController* tc)
+// should optional work be skipped to stay within the time budget? (counted as a skip if so)
+static inline int
+psmove_tracker_skip_optional(PSMoveTracker *tracker, TrackedController* tc)
+{
+	if (tracker->time_budget_us <= 0) {
+		return 0;
+	}
+
+	// skip if recent updates took longer than the budget, or most of this one is used up
+	long long elapsed_us = psmove_util_get_ticks_us() - tracker->update_started_us;
+	if (tracker->budget_load > 1 || elapsed_us * 100 > (long long)tracker->time_budget_us * TRACKER_BUDGET_OPTIONAL) {
+		tc->budget_skips++;
+		return 1;
+	}
+	return 0;
+}
+
+// options of the tracking loop that can be resolved at compile time (see "psmove_tracker_select_variant")
+#define TRACKER_VARIANT_SMOOTH_XY 0x01 // "tracker_adaptive_xy"
+#define TRACKER_VARIANT_SMOOTH_Z 0x02 // "tracker_adaptive_z"
+#define TRACKER_VARIANT_COLOR_ADAPTION 0x04 // "color_update_rate" > 0
+#define TRACKER_VARIANT_AUTO_EXPOSURE 0x08 // "auto_exposure"
+#define TRACKER_VARIANT_PREDICT_ROI 0x10 // "tracker_predict_roi"
+#define TRACKER_VARIANT_GENERIC 0x80 // check the options of the tracker instead
+
+// with a constant variant, this is a constant as well and the branch disappears
+#define TRACKER_VARIANT_HAS(variant, option, enabled) \
+	(((variant) & TRACKER_VARIANT_GENERIC) ? (enabled) : (((variant) & (option)) != 0))
+
+#if defined(__GNUC__)
+#define TRACKER_VARIANT_INLINE static inline __attribute__((always_inline))
+#else
+#define TRACKER_VARIANT_INLINE static inline
+#endif
+
+TRACKER_VARIANT_INLINE int
+psmove_tracker_update_controller_variant(PSMoveTracker *tracker, TrackedController* tc, const int variant)
 {
         float x, y;
-	int i = 0;
 	int sphere_found = 0;
+	long long started;
+
+	tc->color_filter_us = 0;
+	tc->blob_us = 0;
+	tc->color_adaption_us = 0;
+	tc->allocations = 0;
+	tc->budget_skips = 0;
+
+	// remember the last position and update interval for the velocity estimation
+	float old_x = tc->x;
+	float old_y = tc->y;
+	int was_tracked = tc->is_tracked;
+	int reacquired = 0;
+	long long now_us = psmove_util_get_ticks_us();
+	if (tc->last_update_us) {
+		tc->update_interval_us = now_us - tc->last_update_us;
+	}
+	tc->last_update_us = now_us;
+	tc->contrast_valid = 0;
 
-	// calculate upper & lower bounds for the color filter
-	CvScalar min, max;
-	th_minus(tc->eColorHSV.val, tracker->rHSV.val, min.val, 3);
-	th_plus(tc->eColorHSV.val, tracker->rHSV.val, max.val, 3);
+	// a lost controller is only searched for if there is time left, locked ones are always tracked
+	if (!was_tracked && psmove_tracker_skip_optional(tracker, tc)) {
+		tc->frames_lost++;
+		return 0;
+	}
 
 	// this is the tracking algorithm
 	while (1) {
-		// get pointers to data structures for the given ROI-Level
-		IplImage *roi_i = tracker->roiI[tc->roi_level];
-		IplImage *roi_m = tracker->roiM[tc->roi_level];
+		// get a view of the scratch mask for the current ROI size
+		IplImage *roi_m = psmove_tracker_roi_mask(tc);
 
 		// adjust the ROI, so that the blob is fully visible, but only if we have a reasonable FPS
-		if (tracker->debug_fps > ROI_ADJUST_FPS_T) {
+		if (tracker->debug_fps > ROI_ADJUST_FPS_T && !psmove_tracker_skip_optional(tracker, tc)) {
 			// TODO: check for validity differently
 			CvPoint nRoiCenter;
                         if (psmove_tracker_center_roi_on_controller(tc, tracker, &nRoiCenter)) {
-				psmove_tracker_set_roi(tracker, tc, nRoiCenter.x, nRoiCenter.y, roi_i->width, roi_i->height);
+				psmove_tracker_set_roi(tracker, tc, nRoiCenter.x, nRoiCenter.y, tc->roi_width, tc->roi_height);
 			}
 		}
 
-		// apply the ROI
-		cvSetImageROI(tracker->frame, cvRect(tc->roi_x, tc->roi_y, roi_i->width, roi_i->height));
-		cvCvtColor(tracker->frame, roi_i, CV_BGR2HSV);
+		// apply the ROI (as a separate header, the frame is shared between all controllers)
+		CvMat roi_f;
+		cvGetSubRect(tracker->frame, &roi_f, cvRect(tc->roi_x, tc->roi_y, tc->roi_width, tc->roi_height));
 
-		// apply color filter
-		cvInRangeS(roi_i, min, max, roi_m);
+		// apply color filter (directly on the YUYV or BGR image)
+		started = psmove_util_get_ticks_us();
+		PSMOVE_TRACE_BEGIN("color_filter");
+		psmove_tracker_filter_frame(tracker, tc, cvRect(tc->roi_x, tc->roi_y, tc->roi_width, tc->roi_height), roi_m);
+		PSMOVE_TRACE_END("color_filter");
+		tc->color_filter_us += (int)(psmove_util_get_ticks_us() - started);
 
 		#ifdef DEBUG_WINDOWS
+			// the HSV image is only needed for display (shared, as there are no workers with debug windows)
+			IplImage roi_i;
+			cvInitImageHeader(&roi_i, cvSize(tc->roi_width, tc->roi_height), tracker->roiI->depth, 3, IPL_ORIGIN_TL, 4);
+			cvSetData(&roi_i, tracker->roiI->imageData, tracker->roiI->widthStep);
+			cvCvtColor(&roi_f, &roi_i, CV_BGR2HSV);
 			if (!tc->next){
 				cvShowImage("binary:0", roi_m);
-				cvShowImage("hsv:0", roi_i);
+				cvShowImage("hsv:0", &roi_i);
 			}
 			else{
 				cvShowImage("binary:1", roi_m);
-				cvShowImage("hsv:1", roi_i);
+				cvShowImage("hsv:1", &roi_i);
 			}
 		#endif
 
-		// find the biggest contour in the image
-		float sizeBest = 0;
-		CvSeq* contourBest = NULL;
-		psmove_tracker_biggest_contour(roi_m, tracker->storage, &contourBest, &sizeBest);
-
-		if (contourBest) {
-			CvMoments mu; // ImageMoments are use to calculate the center of mass of the blob
-			CvRect br = cvBoundingRect(contourBest, 0);
-
-			// restore the biggest contour
-			cvSet(roi_m, th_black, NULL);
-			cvDrawContours(roi_m, contourBest, th_white, th_white, -1, CV_FILLED, 8, cvPoint(0, 0));
-			// calucalte image-moments
-			cvMoments(roi_m, &mu, 0);
-			// calucalte the mass center
-			CvPoint p = cvPoint(mu.m10 / mu.m00, mu.m01 / mu.m00);
+		// find the biggest blob in the image (with its size, moments and color in one pass)
+		th_blob blob;
+		started = psmove_util_get_ticks_us();
+		PSMOVE_TRACE_BEGIN("blob");
+		int blob_found = th_biggest_blob(tc->blobs, roi_m, &roi_f, &blob);
+		PSMOVE_TRACE_END("blob");
+		tc->blob_us += (int)(psmove_util_get_ticks_us() - started);
+		if (blob_found) {
+			CvRect br = blob.bbox;
+
+			// the mass center
+			CvPoint p = cvPoint(blob.cx, blob.cy);
 			CvPoint oldMCenter = cvPoint(tc->mx, tc->my);
 			tc->mx = p.x + tc->roi_x;
 			tc->my = p.y + tc->roi_y;
@@ -762,10 +1769,10 @@ psmove_tracker_update_controller(PSMoveTracker *tracker, TrackedController* tc)
 			// remember the old radius and calcutlate the new x/y position and radius of the found contour
 			float oldRadius = tc->r;
 			// estimate x/y position and radius of the sphere
-			psmove_tracker_estimate_circle_from_contour(contourBest, &x, &y, &tc->r);
+			psmove_tracker_estimate_circle_from_blob(&blob, &x, &y, &tc->r);
 
 			// apply radius-smoothing if enabled
-			if (tracker->tracker_adaptive_z) {
+			if (TRACKER_VARIANT_HAS(variant, TRACKER_VARIANT_SMOOTH_Z, tracker->tracker_adaptive_z)) {
 				// calculate the difference between calculated radius and the smoothed radius of the past
 				float rDiff = abs(tc->rs - tc->r);
 				// calcualte a adaptive smoothing factor
@@ -778,7 +1785,7 @@ psmove_tracker_update_controller(PSMoveTracker *tracker, TrackedController* tc)
 			}
 
 			// apply x/y coordinate smoothing if enabled
-			if (tracker->tracker_adaptive_z) {
+			if (TRACKER_VARIANT_HAS(variant, TRACKER_VARIANT_SMOOTH_XY, tracker->tracker_adaptive_xy)) {
 				// a big distance between the old and new center of mass results in no smoothing
 				// a little one to strong smoothing
 				float diff = th_dist(oldMCenter, newMCenter);
@@ -793,7 +1800,8 @@ psmove_tracker_update_controller(PSMoveTracker *tracker, TrackedController* tc)
 			}
 
 			// calculate the quality of the tracking
-			int pixelInBlob = cvCountNonZero(roi_m);
+			// a field contains only every other line of the sphere
+			int pixelInBlob = blob.area * CAMERA_CONTROL_FIELD_SCALE;
 			float pixelInResult = tc->r * tc->r * th_PI;
                         tc->q1 = 0;
                         tc->q2 = FLT_MAX;
@@ -818,7 +1826,7 @@ psmove_tracker_update_controller(PSMoveTracker *tracker, TrackedController* tc)
 				tc->y = tc->my;
 			}
 			// only perform check if we already found the sphere once
-			if (oldRadius > 0 && tc->search_quadrant==0) {
+			if (oldRadius > 0 && tc->search_quadrant==0 && !reacquired) {
 				tc->q2 = abs(oldRadius - tc->r) / (oldRadius + FLT_EPSILON);
 
 				// additionally check for to big changes
@@ -827,18 +1835,40 @@ psmove_tracker_update_controller(PSMoveTracker *tracker, TrackedController* tc)
 
 			// only if the quality is okay update the future ROI
 			if (sphere_found) {
+				// measure the contrast of the sphere vs. the rest of the ROI (see "psmove_tracker_auto_exposure")
+				if (TRACKER_VARIANT_HAS(variant, TRACKER_VARIANT_AUTO_EXPOSURE, tracker->auto_exposure)) {
+					CvScalar sum = cvSum(&roi_f);
+					int background = tc->roi_width * tc->roi_height - blob.area;
+					if (background > 0) {
+						CvScalar bg;
+						int c;
+						for (c = 0; c < 3; c++) {
+							bg.val[c] = (sum.val[c] - blob.color.val[c] * blob.area) / background;
+						}
+						tc->sphere_lum = th_avg(blob.color.val, 3);
+						tc->background_lum = th_avg(bg.val, 3);
+						tc->sphere_clipped = MAX(MAX(blob.color.val[0], blob.color.val[1]),
+								blob.color.val[2]) > AUTO_EXPOSURE_CLIP_T;
+						tc->contrast_valid = 1;
+					}
+				}
+
 				// use adaptive color detection
 				// only if 	1) the sphere has been found
 				// AND		2) the UPDATE_RATE has passed
 				// AND		3) the tracking-quality is high;
 				int do_color_adaption = 0;
 				long now = psmove_util_get_ticks();
-				if (tracker->color_update_rate > 0 && (now - tc->last_color_update) > tracker->color_update_rate*1000)
+				if (TRACKER_VARIANT_HAS(variant, TRACKER_VARIANT_COLOR_ADAPTION, tracker->color_update_rate > 0) &&
+						(now - tc->last_color_update) > tracker->color_update_rate*1000)
 					do_color_adaption = 1;
 
-				if (do_color_adaption && tc->q1 > tracker->color_t1 && tc->q2 < tracker->color_t2 && tc->q3 > tracker->color_t3) {
+				if (do_color_adaption && tc->q1 > tracker->color_t1 && tc->q2 < tracker->color_t2 && tc->q3 > tracker->color_t3 &&
+						!psmove_tracker_skip_optional(tracker, tc)) {
+					started = psmove_util_get_ticks_us();
+					PSMOVE_TRACE_BEGIN("color_adaption");
 					// calculate the new estimated color (adaptive color estimation)
-					CvScalar newColor = cvAvg(tracker->frame, roi_m);
+					CvScalar newColor = blob.color;
 					th_plus(tc->eColor.val, newColor.val, tc->eColor.val, 3);
 					th_mul(tc->eColor.val, 0.5, tc->eColor.val, 3);
 					tc->eColorHSV = th_brg2hsv(tc->eColor);
@@ -849,44 +1879,59 @@ psmove_tracker_update_controller(PSMoveTracker *tracker, TrackedController* tc)
 						tc->eColorHSV = tc->eFColorHSV;
 						sphere_found = 0;
 					}
+					PSMOVE_TRACE_END("color_adaption");
+					tc->color_adaption_us += (int)(psmove_util_get_ticks_us() - started);
+				}
+
+				// estimate the image velocity (in pixels per frame) of the sphere
+				if (was_tracked) {
+					tc->vx = 0.5 * tc->vx + 0.5 * (tc->x - old_x);
+					tc->vy = 0.5 * tc->vy + 0.5 * (tc->y - old_y);
+				} else {
+					tc->vx = tc->vy = 0;
 				}
 
-				// update the future roi box
-				br.width = th_max(br.width, br.height) * 3;
-				br.height = br.width;
-				// find a suitable ROI level
-				for (i = 0; i < ROIS; i++) {
-					if (br.width > tracker->roiI[i]->width && br.height > tracker->roiI[i]->height)
-						break;
-					tc->roi_level = i;
-					// update easy accessors
-					roi_i = tracker->roiI[tc->roi_level];
-					roi_m = tracker->roiM[tc->roi_level];
+				// predict the position of the sphere in the next frame
+				float next_x = tc->x;
+				float next_y = tc->y;
+				float margin = 0;
+				if (TRACKER_VARIANT_HAS(variant, TRACKER_VARIANT_PREDICT_ROI, tracker->tracker_predict_roi)) {
+					psmove_tracker_predict_roi(tracker, tc, &next_x, &next_y, &margin);
 				}
 
+				// size the future roi box to the blob (and big enough for the expected deviation),
+				// so the number of pixels to process scales with the size of the sphere
+				int roi_size = th_max(br.width, br.height) * ROI_BLOB_FACTOR + 2 * margin;
+
 				// assure that the roi is within the target image
-				psmove_tracker_set_roi(tracker, tc, tc->x - roi_i->width / 2, tc->y - roi_i->height / 2,  roi_i->width, roi_i->height);
+				psmove_tracker_resize_roi(tracker, tc, next_x, next_y, roi_size, roi_size);
 			}
 		}
-		cvClearMemStorage(tracker->storage);
-		cvResetImageROI(tracker->frame);
 
 		if (sphere_found) {
 			tc->search_quadrant = 0;
 			// the sphere was found
 			break;
-		}else if(tc->roi_level>0){
+		}else if(tc->roi_width < tracker->roi_max.width || tc->roi_height < tracker->roi_max.height){
 			// the sphere was not found, increase the ROI and search again!
-			tc->roi_x += roi_i->width / 2;
-			tc->roi_y += roi_i->height / 2;
-
-			tc->roi_level = tc->roi_level - 1;
-			// update easy accessors
-			roi_i = tracker->roiI[tc->roi_level];
-			roi_m = tracker->roiM[tc->roi_level];
+			tc->roi_enlargements++;
 
 			// assure that the roi is within the target image
-			psmove_tracker_set_roi(tracker, tc, tc->roi_x -roi_i->width / 2, tc->roi_y - roi_i->height / 2, roi_i->width, roi_i->height);
+			psmove_tracker_resize_roi(tracker, tc, tc->roi_x + tc->roi_width / 2, tc->roi_y + tc->roi_height / 2,
+					tc->roi_width * ROI_GROWTH, tc->roi_height * ROI_GROWTH);
+		}else if (!reacquired && psmove_tracker_skip_optional(tracker, tc)) {
+			// no time to search the whole frame, try again with the next one
+			break;
+		}else if (tracker->tracker_pyramid_reacquire) {
+			// the sphere could not be found til a reasonable roi-level, look for it in the
+			// whole (downsampled) frame and search again at full resolution around the candidate
+			CvPoint candidate;
+			if (!reacquired && psmove_tracker_reacquire(tracker, tc, &candidate)) {
+				reacquired = 1;
+				psmove_tracker_resize_roi(tracker, tc, candidate.x, candidate.y, tracker->roi_max.width, tracker->roi_max.height);
+				continue;
+			}
+			break;
 		}else {
 			int rx;
 			int ry;
@@ -915,29 +1960,134 @@ psmove_tracker_update_controller(PSMoveTracker *tracker, TrackedController* tc)
 			}
 
 			tc->search_quadrant = (tc->search_quadrant + 1) % 4;
-			tc->roi_level=0;
-			psmove_tracker_set_roi(tracker, tc, rx, ry, tracker->roiI[tc->roi_level]->width, tracker->roiI[tc->roi_level]->height);
+			tc->quadrant_searches++;
+			tc->roi_width = tracker->roi_max.width;
+			tc->roi_height = tracker->roi_max.height;
+			psmove_tracker_set_roi(tracker, tc, rx, ry, tc->roi_width, tc->roi_height);
 			break;
 		}
 	}
 
 	// remember if the sphere was found
 	tc->is_tracked = sphere_found;
+	if (sphere_found) {
+		psmove_tracker_update_location(tracker, tc);
+		tc->captured_us = tracker->frame_timestamp_us;
+		tc->tracked_us = psmove_util_get_ticks_us();
+		tc->frames_tracked++;
+	} else {
+		tc->frames_lost++;
+	}
 	return sphere_found;
 }
 
+// the default configuration (see "psmove_tracker_new")
+#define TRACKER_VARIANT_DEFAULT (TRACKER_VARIANT_SMOOTH_XY | TRACKER_VARIANT_SMOOTH_Z | \
+		TRACKER_VARIANT_COLOR_ADAPTION | TRACKER_VARIANT_PREDICT_ROI)
+
+#define TRACKER_VARIANT(name, variant) \
+	static int psmove_tracker_update_controller_##name(PSMoveTracker* tracker, TrackedController* tc) \
+	{ return psmove_tracker_update_controller_variant(tracker, tc, (variant)); }
+
+TRACKER_VARIANT(generic, TRACKER_VARIANT_GENERIC)
+#if TRACKER_VARIANTS
+TRACKER_VARIANT(default, TRACKER_VARIANT_DEFAULT)
+TRACKER_VARIANT(auto_exposure, TRACKER_VARIANT_DEFAULT | TRACKER_VARIANT_AUTO_EXPOSURE)
+TRACKER_VARIANT(no_adaption, TRACKER_VARIANT_DEFAULT & ~TRACKER_VARIANT_COLOR_ADAPTION)
+TRACKER_VARIANT(no_smoothing, TRACKER_VARIANT_DEFAULT & ~(TRACKER_VARIANT_SMOOTH_XY | TRACKER_VARIANT_SMOOTH_Z))
+TRACKER_VARIANT(minimal, TRACKER_VARIANT_PREDICT_ROI)
+
+static const struct {
+	int variant;
+	PSMoveTrackerUpdateFunc update;
+} tracker_variants[] = {
+	{ TRACKER_VARIANT_DEFAULT, psmove_tracker_update_controller_default },
+	{ TRACKER_VARIANT_DEFAULT | TRACKER_VARIANT_AUTO_EXPOSURE, psmove_tracker_update_controller_auto_exposure },
+	{ TRACKER_VARIANT_DEFAULT & ~TRACKER_VARIANT_COLOR_ADAPTION, psmove_tracker_update_controller_no_adaption },
+	{ TRACKER_VARIANT_DEFAULT & ~(TRACKER_VARIANT_SMOOTH_XY | TRACKER_VARIANT_SMOOTH_Z), psmove_tracker_update_controller_no_smoothing },
+	{ TRACKER_VARIANT_PREDICT_ROI, psmove_tracker_update_controller_minimal },
+};
+#endif
+
+void
+psmove_tracker_select_variant(PSMoveTracker* tracker)
+{
+	tracker->update_controller = psmove_tracker_update_controller_generic;
+
+#if TRACKER_VARIANTS
+	int variant = (tracker->tracker_adaptive_xy ? TRACKER_VARIANT_SMOOTH_XY : 0) |
+		(tracker->tracker_adaptive_z ? TRACKER_VARIANT_SMOOTH_Z : 0) |
+		(tracker->color_update_rate > 0 ? TRACKER_VARIANT_COLOR_ADAPTION : 0) |
+		(tracker->auto_exposure ? TRACKER_VARIANT_AUTO_EXPOSURE : 0) |
+		(tracker->tracker_predict_roi ? TRACKER_VARIANT_PREDICT_ROI : 0);
+
+	int i;
+	for (i = 0; i < sizeof(tracker_variants) / sizeof(tracker_variants[0]); i++) {
+		if (tracker_variants[i].variant == variant) {
+			tracker->update_controller = tracker_variants[i].update;
+			break;
+		}
+	}
+#endif
+}
+
+int
+psmove_tracker_update_controller(PSMoveTracker *tracker, TrackedController* tc)
+{
+	return tracker->update_controller(tracker, tc);
+}
+
 int psmove_tracker_update(PSMoveTracker *tracker, PSMove *move) {
 	TrackedController* tc = NULL;
 	int spheres_found = 0;
 	int UPDATE_ALL_CONTROLLERS = (move == NULL);
 
     // FPS calculation
-    long started = psmove_util_get_ticks();
+    long long started = psmove_util_get_ticks_us();
+	tracker->update_started_us = started;
+	PSMOVE_TRACE_BEGIN("tracker_update");
+
+	// the frame is uploaded once and shared by all controllers
+	if (tracker->opencl && tracker->frame && tracker->controllers && !tracker->frame_uploaded) {
+		tracker->frame_uploaded = th_opencl_upload(tracker->opencl, tracker->frame);
+	}
+
 	if (UPDATE_ALL_CONTROLLERS) {
-		// iterate trough all controllers and find their lit spheres
-		tc = tracker->controllers;
-		for (; tc && tracker->frame; tc = tc->next) {
-			spheres_found += psmove_tracker_update_controller(tracker, tc);
+#if defined(PSMOVE_USE_PTHREADS)
+		if (tracker->worker_count > 0 && tracker->frame &&
+				tracker->controllers && tracker->controllers->next) {
+			// hand out the controllers to the workers, and help tracking them
+			pthread_mutex_lock(&tracker->work_mutex);
+			tracker->work_next = tracker->controllers;
+			tracker->work_pending = 0;
+			tracker->work_found = 0;
+			for (tc = tracker->controllers; tc; tc = tc->next) {
+				tracker->work_pending++;
+			}
+			pthread_cond_broadcast(&tracker->work_cond);
+
+			psmove_tracker_work_locked(tracker);
+			while (tracker->work_pending > 0) {
+				pthread_cond_wait(&tracker->done_cond, &tracker->work_mutex);
+			}
+			spheres_found = tracker->work_found;
+			pthread_mutex_unlock(&tracker->work_mutex);
+		} else
+#endif
+		{
+			// iterate trough all controllers and find their lit spheres
+			tc = tracker->controllers;
+			for (; tc && tracker->frame; tc = tc->next) {
+				// with a time budget, the locked controllers go first (lost ones get the rest)
+				if (tracker->time_budget_us <= 0 || tc->is_tracked) {
+					spheres_found += psmove_tracker_update_controller(tracker, tc);
+				}
+			}
+			for (tc = tracker->controllers; tracker->time_budget_us > 0 && tc && tracker->frame; tc = tc->next) {
+				if (tc->last_update_us < started) {
+					spheres_found += psmove_tracker_update_controller(tracker, tc);
+				}
+			}
 		}
 	} else {
 		// find just that specific controller
@@ -946,58 +2096,838 @@ int psmove_tracker_update(PSMoveTracker *tracker, PSMove *move) {
 			spheres_found = psmove_tracker_update_controller(tracker, tc);
 		}
 	}
-    tracker->duration = (psmove_util_get_ticks() - started);
+    tracker->duration = (psmove_util_get_ticks_us() - started);
+	PSMOVE_TRACE_END("tracker_update");
+
+	// sum up the per-stage timings of the updated controllers
+	tracker->metrics.color_filter_us = 0;
+	tracker->metrics.blob_us = 0;
+	tracker->metrics.color_adaption_us = 0;
+	tracker->metrics.allocations = 0;
+	tracker->metrics.budget_skips = 0;
+	for (tc = tracker->controllers; tc && tracker->frame; tc = tc->next) {
+		if (UPDATE_ALL_CONTROLLERS || tc->move == move) {
+			tracker->metrics.color_filter_us += tc->color_filter_us;
+			tracker->metrics.blob_us += tc->blob_us;
+			tracker->metrics.color_adaption_us += tc->color_adaption_us;
+			tracker->metrics.allocations += tc->allocations;
+			tracker->metrics.budget_skips += tc->budget_skips;
+		}
+	}
 
-	// draw all/one controller information to camera image
-#ifdef PRINT_DEBUG_STATS
-	psmove_tracker_draw_tracking_stats(tracker);
-#endif
+	// falling behind the budget makes the next updates skip optional work right away
+	if (tracker->time_budget_us > 0 && tracker->frame) {
+		tracker->budget_load = 0.85 * tracker->budget_load + 0.15 *
+			((float)tracker->duration / (float)tracker->time_budget_us);
+	}
+	tracker->metrics.total_us = (int)tracker->duration;
+	tracker->metrics.latency_us = tracker->frame ?
+		(int)(psmove_util_get_ticks_us() - tracker->frame_timestamp_us) : 0;
+
+	// FPS calculation (also used to decide whether the ROI is adjusted)
+	if (tracker->duration) {
+		tracker->debug_fps = (0.85 * tracker->debug_fps + 0.15 *
+			(1000000. / (double)tracker->duration));
+	}
+
+	if (tracker->auto_exposure && tracker->frame) {
+		psmove_tracker_auto_exposure(tracker);
+	}
+	tracker->metrics.exposure = tracker->auto_exposure_value;
+	tracker->metrics.gain = tracker->gain;
+
+	// hand out the frame with the new positions (without copying it)
+	if (tracker->frame_callback && tracker->frame) {
+		PSMoveTrackerFrame* frame = psmove_tracker_acquire_frame(tracker);
+		tracker->frame_callback(tracker, frame, tracker->frame_callback_data);
+		psmove_tracker_release_frame(tracker, frame);
+	}
 	// return the number of spheres found
 	return spheres_found;
 
 }
 
+void
+psmove_tracker_camera_position(PSMoveTracker* tracker, TrackedController* tc, float *x, float *y, float* radius) {
+	// with deinterlacing, tracking happens on a single field
+	float px = tc->x;
+	float py = tc->y * CAMERA_CONTROL_FIELD_SCALE;
+	float pr = tc->r;
+
+	// tracking happens on the raw frame, apply the lens model to the result
+	if (tracker->tracker_undistort_points) {
+		float ex = px + pr;
+		float ey = py;
+		if (camera_control_undistort_point(tracker->cc, &px, &py)) {
+			camera_control_undistort_point(tracker->cc, &ex, &ey);
+			pr = sqrt(pow(ex - px, 2) + pow(ey - py, 2));
+		}
+	}
+
+	*x = px;
+	*y = py;
+	*radius = pr;
+}
+
+void
+psmove_tracker_update_location(PSMoveTracker* tracker, TrackedController* tc) {
+	float px, py, pr;
+	float fx, fy, cx, cy;
+
+	psmove_tracker_camera_position(tracker, tc, &px, &py, &pr);
+
+	if (!camera_control_get_intrinsics(tracker->cc, &fx, &fy, &cx, &cy)) {
+		// no lens calibration, use the nominal focal length and the image center
+		// (the nominal pixel size is that of the full resolution of the sensor)
+		float scale = (float)tracker->frame->width / PSMOVE_TRACKER_POSITION_X_MAX;
+		fx = fy = scale * tracker->cam_focal_length * tracker->user_factor_dist / (tracker->cam_pixel_height / 100.0);
+		cx = tracker->frame->width / 2;
+		cy = tracker->frame->height * CAMERA_CONTROL_FIELD_SCALE / 2;
+	}
+
+	// the sphere's real diameter and its diameter in pixels give the depth,
+	// pinhole projection of the center gives the other two coordinates
+	tc->lz = fx * tracker->ps_move_diameter / (2 * pr + FLT_EPSILON);
+	tc->lx = (px - cx) * tc->lz / fx;
+	tc->ly = (py - cy) * tc->lz / fy;
+}
+
 int psmove_tracker_get_position(PSMoveTracker *tracker, PSMove *move, float *x, float *y, float *radius) {
 	TrackedController* tc = tracked_controller_find(tracker->controllers, move);
 	psmove_return_val_if_fail(tc != NULL, 0);
 
+	float px, py, pr;
+	psmove_tracker_camera_position(tracker, tc, &px, &py, &pr);
+
 	if (x)
-		*x = tc->x;
+		*x = px;
 
 	if (y)
-		*y = tc->y;
+		*y = py;
 
 	if (radius)
-		*radius = tc->r;
+		*radius = pr;
 	// TODO: return age of tracking values (if possible)
 	
 	return 1;
 }
 
+int
+psmove_tracker_get_location(PSMoveTracker *tracker, PSMove *move, float *x, float *y, float *z)
+{
+	psmove_return_val_if_fail(tracker != NULL, 0);
+	psmove_return_val_if_fail(move != NULL, 0);
+
+	TrackedController* tc = tracked_controller_find(tracker->controllers, move);
+	psmove_return_val_if_fail(tc != NULL, 0);
+
+	// calculated once per update (see psmove_tracker_update_location)
+	if (x)
+		*x = tc->lx;
+
+	if (y)
+		*y = tc->ly;
+
+	if (z)
+		*z = tc->lz;
+
+	return 1;
+}
+
+int
+psmove_tracker_start_recording(PSMoveTracker *tracker, const char *filename)
+{
+	psmove_return_val_if_fail(tracker != NULL, 0);
+	psmove_return_val_if_fail(filename != NULL, 0);
+
+	// store the calibration of the enabled controllers, so that they can be enabled during playback
+	char *calibration = (char*) malloc(strlen(filename) + strlen(RECORDING_CALIBRATION) + 1);
+	strcpy(calibration, filename);
+	strcat(calibration, RECORDING_CALIBRATION);
+	remove(calibration);
+
+	TrackedController* tc;
+	for (tc = tracker->controllers; tc; tc = tc->next) {
+		tracked_controller_save_calibration(tc, calibration, RECORDING_CAMERA, tracker->exposure, tc->rs);
+	}
+	free(calibration);
+
+	return camera_control_start_recording(tracker->cc, filename);
+}
+
+void
+psmove_tracker_stop_recording(PSMoveTracker *tracker)
+{
+	psmove_return_if_fail(tracker != NULL);
+
+	camera_control_stop_recording(tracker->cc);
+}
+
+int
+psmove_tracker_get_position_timestamp(PSMoveTracker *tracker, PSMove *move, long long *captured_us, long long *tracked_us)
+{
+	psmove_return_val_if_fail(tracker != NULL, 0);
+	psmove_return_val_if_fail(move != NULL, 0);
+
+	TrackedController* tc = tracked_controller_find(tracker->controllers, move);
+	psmove_return_val_if_fail(tc != NULL, 0);
+
+	if (captured_us)
+		*captured_us = tc->captured_us;
+
+	if (tracked_us)
+		*tracked_us = tc->tracked_us;
+
+	return tc->tracked_us != 0;
+}
+
+void
+psmove_tracker_get_metrics(PSMoveTracker *tracker, PSMoveTrackerMetrics *metrics)
+{
+	psmove_return_if_fail(tracker != NULL);
+	psmove_return_if_fail(metrics != NULL);
+
+	*metrics = tracker->metrics;
+	metrics->fps = tracker->debug_fps;
+}
+
+int
+psmove_tracker_get_controller_metrics(PSMoveTracker *tracker, PSMove *move,
+		PSMoveTrackerControllerMetrics *metrics)
+{
+	psmove_return_val_if_fail(tracker != NULL, 0);
+	psmove_return_val_if_fail(metrics != NULL, 0);
+
+	TrackedController* tc = tracked_controller_find(tracker->controllers, move);
+	psmove_return_val_if_fail(tc != NULL, 0);
+
+	metrics->q1 = tc->q1;
+	metrics->q2 = tc->q2;
+	metrics->q3 = tc->q3;
+	metrics->roi_width = tc->roi_width;
+	metrics->roi_height = tc->roi_height;
+	metrics->search_quadrant = tc->search_quadrant;
+	metrics->color_filter_us = tc->color_filter_us;
+	metrics->blob_us = tc->blob_us;
+	metrics->color_adaption_us = tc->color_adaption_us;
+	metrics->frames_tracked = tc->frames_tracked;
+	metrics->frames_lost = tc->frames_lost;
+	metrics->roi_enlargements = tc->roi_enlargements;
+	metrics->quadrant_searches = tc->quadrant_searches;
+	metrics->reacquisitions = tc->reacquisitions;
+
+	return 1;
+}
+
+int
+psmove_tracker_get_results(PSMoveTracker *tracker, PSMoveTrackerResult *results, int count)
+{
+	psmove_return_val_if_fail(tracker != NULL, 0);
+	psmove_return_val_if_fail(results != NULL || count == 0, 0);
+
+	// a single walk over the list instead of one lookup per controller
+	int filled = 0;
+	TrackedController* tc;
+	for (tc = tracker->controllers; tc && filled < count; tc = tc->next) {
+		PSMoveTrackerResult* result = &results[filled++];
+		result->move = tc->move;
+		result->status = tc->is_tracked ? Tracker_TRACKING : Tracker_CALIBRATED;
+		psmove_tracker_camera_position(tracker, tc, &result->x, &result->y, &result->radius);
+		result->quality = tc->q1;
+		result->captured_us = tc->captured_us;
+		result->tracked_us = tc->tracked_us;
+	}
+
+	return filled;
+}
+
+size_t
+psmove_tracker_get_memory_usage(PSMoveTracker *tracker)
+{
+	psmove_return_val_if_fail(tracker != NULL, 0);
+
+	size_t usage = sizeof(PSMoveTracker) + camera_control_get_memory_usage(tracker->cc);
+	usage += th_image_size(tracker->annotated);
+#ifdef DEBUG_WINDOWS
+	usage += th_image_size(tracker->roiI);
+#endif
+
+	TrackedController* tc;
+	for (tc = tracker->controllers; tc; tc = tc->next) {
+		usage += sizeof(TrackedController) + psmove_tracker_scratch_size(tc);
+	}
+
+	// frames still acquired by the application (and not current anymore) are not known here
+	usage += psmove_tracker_frame_size(tracker->current_frame);
+	PSMoveTrackerFrame* frame;
+	for (frame = tracker->free_frames; frame; frame = frame->next) {
+		usage += psmove_tracker_frame_size(frame);
+	}
+
+	return usage;
+}
+
+enum PSMove_Bool
+psmove_tracker_set_thread_policy(PSMoveTracker *tracker,
+		enum PSMoveTracker_Thread_Type type, const PSMoveThreadPolicy *policy)
+{
+	psmove_return_val_if_fail(tracker != NULL, PSMove_False);
+
+	PSMoveThreadPolicy defaults = { 0, 0 };
+	if (policy == NULL) {
+		policy = &defaults;
+	}
+
+	switch (type) {
+		case Tracker_THREAD_CAPTURE:
+			return camera_control_set_thread_policy(tracker->cc, policy) ? PSMove_True : PSMove_False;
+		case Tracker_THREAD_WORKERS:
+#if defined(PSMOVE_USE_PTHREADS)
+			if (tracker->worker_count > 0) {
+				int result = 1;
+				int w;
+				for (w = 0; w < tracker->worker_count; w++) {
+					result = _psmove_thread_apply_policy(tracker->workers[w], policy) && result;
+				}
+				return result ? PSMove_True : PSMove_False;
+			}
+#endif
+			return PSMove_False;
+		default:
+			return PSMove_False;
+	}
+}
+
 void psmove_tracker_free(PSMoveTracker *tracker) {
-	tracked_controller_save_colors(tracker->controllers);
+#if defined(PSMOVE_USE_PTHREADS) && !defined(DEBUG_WINDOWS)
+	// stop the worker threads
+	pthread_mutex_lock(&tracker->work_mutex);
+	tracker->workers_quit = 1;
+	pthread_cond_broadcast(&tracker->work_cond);
+	pthread_mutex_unlock(&tracker->work_mutex);
+
+	int w;
+	for (w = 0; w < tracker->worker_count; w++) {
+		pthread_join(tracker->workers[w], NULL);
+	}
+
+	pthread_cond_destroy(&tracker->done_cond);
+	pthread_cond_destroy(&tracker->work_cond);
+	pthread_mutex_destroy(&tracker->work_mutex);
+#endif
+
+#if defined(PSMOVE_USE_PTHREADS)
+	// stop the adaption thread (the controllers' tables are freed below)
+	if (tracker->adaption_running) {
+		pthread_mutex_lock(&tracker->adaption_mutex);
+		tracker->adaption_quit = 1;
+		pthread_cond_broadcast(&tracker->adaption_cond);
+		pthread_mutex_unlock(&tracker->adaption_mutex);
+		pthread_join(tracker->adaption_thread, NULL);
+		tracker->adaption_running = 0;
+	}
+	if (tracker->color_background_adaption) {
+		pthread_cond_destroy(&tracker->adaption_done);
+		pthread_cond_destroy(&tracker->adaption_cond);
+		pthread_mutex_destroy(&tracker->adaption_mutex);
+	}
+
+	// stop the exposure thread (pending parameters are dropped, the settings are restored below)
+	if (tracker->exposure_running) {
+		pthread_mutex_lock(&tracker->exposure_mutex);
+		tracker->exposure_quit = 1;
+		pthread_cond_broadcast(&tracker->exposure_cond);
+		pthread_mutex_unlock(&tracker->exposure_mutex);
+		pthread_join(tracker->exposure_thread, NULL);
+		tracker->exposure_running = 0;
+	}
+	pthread_cond_destroy(&tracker->exposure_cond);
+	pthread_mutex_destroy(&tracker->exposure_mutex);
+#endif
 
 	char *filename = psmove_util_get_file_path(PSEYE_BACKUP_FILE);
-	if (th_file_exists(filename)) {
-            camera_control_restore_system_settings(tracker->cc, filename);
-    }
+	if (!tracker->replay_calibration) {
+		tracked_controller_save_colors(tracker->controllers);
+
+		if (th_file_exists(filename)) {
+			camera_control_restore_system_settings(tracker->cc, filename);
+		}
+	}
 	free(filename);
+	free(tracker->replay_calibration);
 	
 	cvReleaseMemStorage(&tracker->storage);
-	int i = 0;
-	for (; i < ROIS; i++) {
-		cvReleaseImage(&tracker->roiM[i]);
-		cvReleaseImage(&tracker->roiI[i]);
-	}
+#ifdef DEBUG_WINDOWS
+	cvReleaseImage(&tracker->roiI);
+#endif
 	cvReleaseStructuringElement(&tracker->kCalib);
+	if (tracker->annotated)
+		cvReleaseImage(&tracker->annotated);
+
+	TrackedController* tc;
+	for (tc = tracker->controllers; tc; tc = tc->next) {
+		psmove_tracker_free_scratch(tracker, tc);
+	}
 	tracked_controller_release(&tracker->controllers, 1);
 	tracked_color_release(&tracker->available_colors, 1);
+	th_opencl_free(tracker->opencl);
+
+	// the application has released all frames, so all handles are unused
+	PSMoveTrackerFrame* frame = tracker->current_frame;
+	if (frame) {
+		frame->next = tracker->free_frames;
+		tracker->free_frames = frame;
+	}
+	while (tracker->free_frames) {
+		frame = tracker->free_frames;
+		tracker->free_frames = frame->next;
+		if (frame->copy)
+			cvReleaseImage(&frame->copy);
+		free(frame->positions);
+		free(frame);
+	}
+#if defined(PSMOVE_USE_PTHREADS)
+	pthread_mutex_destroy(&tracker->frame_mutex);
+#endif
 
     camera_control_delete(tracker->cc);
     free(tracker);
 }
 
 // -------- Implementation: internal functions only
+void psmove_tracker_filter_color(PSMoveTracker* tracker, TrackedController* tc, const CvArr* roi, IplImage* mask) {
+	// calculate upper & lower bounds for the color filter
+	CvScalar min, max;
+	th_minus(tc->eColorHSV.val, tracker->rHSV.val, min.val, 3);
+	th_plus(tc->eColorHSV.val, tracker->rHSV.val, max.val, 3);
+
+	if (!tracker->tracker_color_lut) {
+		th_bgr_hsv_in_range(roi, min, max, mask);
+		return;
+	}
+
+	th_color_lut_mask(roi, psmove_tracker_color_lut(tracker, tc), mask);
+}
+
+const unsigned char* psmove_tracker_color_lut(PSMoveTracker* tracker, TrackedController* tc) {
+	// the estimated color changes rarely (see "color_update_rate"), so the table is mostly reused
+	if (!tc->color_lut) {
+		tc->color_lut = (unsigned char*) psmove_tracker_hot_alloc(tracker, tc, TH_COLOR_LUT_SIZE);
+		tc->color_lut_valid = 0;
+	}
+	if (!tc->color_lut_valid || memcmp(tc->color_lut_hsv.val, tc->eColorHSV.val, sizeof(tc->eColorHSV.val)) != 0) {
+		// an outdated table is still good enough until the new one has been built in the background
+		if (tc->color_lut_valid && psmove_tracker_adopt_luts(tracker, tc))
+			return tc->color_lut;
+
+		CvScalar min, max;
+		th_minus(tc->eColorHSV.val, tracker->rHSV.val, min.val, 3);
+		th_plus(tc->eColorHSV.val, tracker->rHSV.val, max.val, 3);
+		th_build_color_lut(min, max, tc->color_lut);
+		tc->color_lut_hsv = tc->eColorHSV;
+		tc->color_lut_valid = 1;
+	}
+	return tc->color_lut;
+}
+
+void psmove_tracker_filter_frame(PSMoveTracker* tracker, TrackedController* tc, CvRect rect, IplImage* mask) {
+	// on the GPU, only the matching part of the mask is transferred back (falls back to the CPU on errors)
+	if (tracker->frame_uploaded && tc->opencl_filter &&
+			th_opencl_filter_mask(tc->opencl_filter, rect, psmove_tracker_color_lut(tracker, tc), mask) >= 0) {
+		return;
+	}
+
+	if (!tracker->frame_yuyv) {
+		CvMat roi_f;
+		cvGetSubRect(tracker->frame, &roi_f, rect);
+		psmove_tracker_filter_color(tracker, tc, &roi_f, mask);
+		return;
+	}
+
+	// the thresholds are translated into YUV space once per estimated color
+	if (!tc->yuv_lut) {
+		tc->yuv_lut = (unsigned char*) psmove_tracker_hot_alloc(tracker, tc, TH_COLOR_LUT_SIZE);
+		tc->yuv_lut_valid = 0;
+	}
+	if ((!tc->yuv_lut_valid || memcmp(tc->yuv_lut_hsv.val, tc->eColorHSV.val, sizeof(tc->eColorHSV.val)) != 0) &&
+			!(tc->yuv_lut_valid && psmove_tracker_adopt_luts(tracker, tc))) {
+		CvScalar min, max;
+		th_minus(tc->eColorHSV.val, tracker->rHSV.val, min.val, 3);
+		th_plus(tc->eColorHSV.val, tracker->rHSV.val, max.val, 3);
+		th_build_yuv_lut(min, max, tc->yuv_lut);
+		tc->yuv_lut_hsv = tc->eColorHSV;
+		tc->yuv_lut_valid = 1;
+	}
+
+	th_yuyv_lut_mask(tracker->frame_yuyv, rect, tc->yuv_lut, mask);
+}
+
+void psmove_tracker_alloc_scratch(PSMoveTracker* tracker, TrackedController* tc) {
+	// all roi sizes use views of one mask of the biggest size
+	tc->roiM = cvCreateImage(tracker->roi_max, IPL_DEPTH_8U, 1);
+	tc->blobs = th_blob_labeler_new(tracker->roi_max);
+	if (!tc->roi_width || !tc->roi_height) {
+		tc->roi_width = tracker->roi_max.width;
+		tc->roi_height = tracker->roi_max.height;
+	}
+
+	// the biggest ROI is half the frame size
+	CvSize size = cvSize(tracker->roi_max.width * 2 / REACQUIRE_SCALE, tracker->roi_max.height * 2 / REACQUIRE_SCALE);
+	tc->reacquireI = cvCreateImage(size, IPL_DEPTH_8U, 3);
+	tc->reacquireM = cvCreateImage(size, IPL_DEPTH_8U, 1);
+
+	if (tracker->opencl) {
+		tc->opencl_filter = th_opencl_filter_new(tracker->opencl, tracker->roi_max);
+	}
+
+	// the tables are only rebuilt (not reallocated) when the estimated color changes; tables of
+	// disabled filters are not allocated (the background adaption swaps all of them, see below)
+#if defined(PSMOVE_USE_PTHREADS)
+	int adaption = tracker->adaption_running;
+#else
+	int adaption = 0;
+#endif
+	tc->color_lut = NULL;
+	if (tracker->tracker_color_lut || tc->opencl_filter || adaption)
+		tc->color_lut = (unsigned char*) malloc(TH_COLOR_LUT_SIZE);
+	tc->color_lut_valid = 0;
+	tc->yuv_lut = NULL;
+	if (tracker->tracker_yuyv_filter || adaption)
+		tc->yuv_lut = (unsigned char*) malloc(TH_COLOR_LUT_SIZE);
+	tc->yuv_lut_valid = 0;
+	tc->color_lut_next = NULL;
+	tc->yuv_lut_next = NULL;
+	if (adaption) {
+		tc->color_lut_next = (unsigned char*) malloc(TH_COLOR_LUT_SIZE);
+		tc->yuv_lut_next = (unsigned char*) malloc(TH_COLOR_LUT_SIZE);
+	}
+	tc->lut_next_ready = 0;
+}
+
+size_t psmove_tracker_frame_size(PSMoveTrackerFrame* frame) {
+	if (!frame)
+		return 0;
+	return sizeof(PSMoveTrackerFrame) + th_image_size(frame->copy) +
+			frame->position_capacity * sizeof(TrackerFramePosition);
+}
+
+size_t psmove_tracker_scratch_size(TrackedController* tc) {
+	size_t usage = th_image_size(tc->roiM) + th_image_size(tc->reacquireI) + th_image_size(tc->reacquireM);
+	usage += th_blob_labeler_size(tc->blobs);
+	usage += (tc->color_lut != NULL) * TH_COLOR_LUT_SIZE + (tc->yuv_lut != NULL) * TH_COLOR_LUT_SIZE;
+	usage += (tc->color_lut_next != NULL) * TH_COLOR_LUT_SIZE + (tc->yuv_lut_next != NULL) * TH_COLOR_LUT_SIZE;
+	return usage;
+}
+
+void* psmove_tracker_hot_alloc(PSMoveTracker* tracker, TrackedController* tc, size_t size) {
+	tc->allocations++;
+#ifdef PSMOVE_DEBUG
+	fprintf(stderr, "[PSMOVE] Allocated %lu bytes while tracking (missing scratch buffer)\n",
+			(unsigned long) size);
+#endif
+	return malloc(size);
+}
+
+void psmove_tracker_free_scratch(PSMoveTracker* tracker, TrackedController* tc) {
+#if defined(PSMOVE_USE_PTHREADS)
+	// the adaption thread must not use the tables anymore
+	if (tracker->adaption_running) {
+		int i, n = 0;
+		pthread_mutex_lock(&tracker->adaption_mutex);
+		for (i = 0; i < tracker->adaption_queued; i++) {
+			if (tracker->adaption_queue[i] != tc)
+				tracker->adaption_queue[n++] = tracker->adaption_queue[i];
+		}
+		tracker->adaption_queued = n;
+		while (tracker->adaption_current == tc)
+			pthread_cond_wait(&tracker->adaption_done, &tracker->adaption_mutex);
+		pthread_mutex_unlock(&tracker->adaption_mutex);
+	}
+#endif
+
+	if (tc->roiM)
+		cvReleaseImage(&tc->roiM);
+	th_blob_labeler_free(tc->blobs);
+	tc->blobs = NULL;
+	if (tc->reacquireI)
+		cvReleaseImage(&tc->reacquireI);
+	if (tc->reacquireM)
+		cvReleaseImage(&tc->reacquireM);
+	free(tc->color_lut);
+	tc->color_lut = NULL;
+	free(tc->yuv_lut);
+	tc->yuv_lut = NULL;
+	free(tc->color_lut_next);
+	tc->color_lut_next = NULL;
+	free(tc->yuv_lut_next);
+	tc->yuv_lut_next = NULL;
+	tc->lut_next_ready = 0;
+	th_opencl_filter_free(tc->opencl_filter);
+	tc->opencl_filter = NULL;
+}
+
+#if defined(PSMOVE_USE_PTHREADS)
+void psmove_tracker_work_locked(PSMoveTracker* tracker) {
+	while (tracker->work_next) {
+		// claim the next controller
+		TrackedController* tc = tracker->work_next;
+		tracker->work_next = tc->next;
+
+		pthread_mutex_unlock(&tracker->work_mutex);
+		int found = psmove_tracker_update_controller(tracker, tc);
+		pthread_mutex_lock(&tracker->work_mutex);
+
+		tracker->work_found += found;
+		if (--tracker->work_pending == 0)
+			pthread_cond_signal(&tracker->done_cond);
+	}
+}
+
+void *psmove_tracker_worker_proc(void *data) {
+	PSMoveTracker* tracker = (PSMoveTracker*) data;
+
+	PSMOVE_TRACE_THREAD_NAME("tracker worker");
+
+	pthread_mutex_lock(&tracker->work_mutex);
+	while (!tracker->workers_quit) {
+		if (tracker->work_next)
+			psmove_tracker_work_locked(tracker);
+		else
+			pthread_cond_wait(&tracker->work_cond, &tracker->work_mutex);
+	}
+	pthread_mutex_unlock(&tracker->work_mutex);
+
+	return NULL;
+}
+#endif
+
+void psmove_tracker_detach_frame(PSMoveTracker* tracker) {
+#if defined(PSMOVE_USE_PTHREADS)
+	pthread_mutex_lock(&tracker->frame_mutex);
+#endif
+	PSMoveTrackerFrame* frame = tracker->current_frame;
+	tracker->current_frame = NULL;
+	if (frame && frame->refs > 0) {
+		// still in use: copy the image before the camera overwrites the buffer
+		CvSize size = cvGetSize(&frame->header);
+		if (frame->copy && (frame->copy->width != size.width || frame->copy->height != size.height ||
+					frame->copy->nChannels != frame->header.nChannels)) {
+			cvReleaseImage(&frame->copy);
+		}
+		if (!frame->copy)
+			frame->copy = cvCreateImage(size, frame->header.depth, frame->header.nChannels);
+		cvCopy(&frame->header, frame->copy, NULL);
+		cvSetData(&frame->header, frame->copy->imageData, frame->copy->widthStep);
+	} else if (frame) {
+		frame->next = tracker->free_frames;
+		tracker->free_frames = frame;
+	}
+#if defined(PSMOVE_USE_PTHREADS)
+	pthread_mutex_unlock(&tracker->frame_mutex);
+#endif
+}
+
+void psmove_tracker_annotate_frame(PSMoveTracker* tracker, PSMoveTrackerFrame* frame) {
+	int count = 0;
+	TrackedController* tc;
+	for (tc = tracker->controllers; tc; tc = tc->next) {
+		count++;
+	}
+
+	// the positions are reused with the handle, so this only allocates for new controllers
+	if (count > frame->position_capacity) {
+		frame->positions = (TrackerFramePosition*) realloc(frame->positions, count * sizeof(TrackerFramePosition));
+		frame->position_capacity = count;
+	}
+
+	frame->position_count = 0;
+	for (tc = tracker->controllers; tc; tc = tc->next) {
+		TrackerFramePosition* position = &frame->positions[frame->position_count++];
+		position->move = tc->move;
+		position->tracked = tc->is_tracked;
+		psmove_tracker_camera_position(tracker, tc, &position->x, &position->y, &position->radius);
+	}
+}
+
+int psmove_tracker_adopt_luts(PSMoveTracker* tracker, TrackedController* tc) {
+#if defined(PSMOVE_USE_PTHREADS)
+	if (!tracker->adaption_running || !tc->color_lut_next || !tc->yuv_lut_next)
+		return 0;
+
+	int result = 1;
+	pthread_mutex_lock(&tracker->adaption_mutex);
+	if (tc->lut_next_ready) {
+		// swap in the tables built in the background (both are built for the same color)
+		unsigned char* lut = tc->color_lut;
+		tc->color_lut = tc->color_lut_next;
+		tc->color_lut_next = lut;
+		lut = tc->yuv_lut;
+		tc->yuv_lut = tc->yuv_lut_next;
+		tc->yuv_lut_next = lut;
+		tc->color_lut_hsv = tc->yuv_lut_hsv = tc->lut_next_hsv;
+		tc->color_lut_valid = tc->yuv_lut_valid = 1;
+		tc->lut_next_ready = 0;
+	}
+
+	// the color might have been adapted again in the meantime
+	int queued = (tc == tracker->adaption_current);
+	int i;
+	for (i = 0; i < tracker->adaption_queued; i++) {
+		queued = queued || (tracker->adaption_queue[i] == tc);
+	}
+	if (!queued && memcmp(tc->color_lut_hsv.val, tc->eColorHSV.val, sizeof(tc->eColorHSV.val)) != 0) {
+		if (tracker->adaption_queued < COLOR_ADAPTION_QUEUE) {
+			tc->lut_next_hsv = tc->eColorHSV;
+			tracker->adaption_queue[tracker->adaption_queued++] = tc;
+			pthread_cond_signal(&tracker->adaption_cond);
+		} else {
+			result = 0;
+		}
+	}
+	pthread_mutex_unlock(&tracker->adaption_mutex);
+	return result;
+#else
+	return 0;
+#endif
+}
+
+#if defined(PSMOVE_USE_PTHREADS)
+void *psmove_tracker_adaption_proc(void *data) {
+	PSMoveTracker* tracker = (PSMoveTracker*) data;
+
+	PSMOVE_TRACE_THREAD_NAME("tracker color adaption");
+
+#if defined(SCHED_IDLE)
+	// only use the CPU when nothing else needs it
+	struct sched_param param = { 0 };
+	pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+#endif
+
+	pthread_mutex_lock(&tracker->adaption_mutex);
+	while (!tracker->adaption_quit) {
+		if (!tracker->adaption_queued) {
+			pthread_cond_wait(&tracker->adaption_cond, &tracker->adaption_mutex);
+			continue;
+		}
+
+		TrackedController* tc = tracker->adaption_queue[0];
+		tracker->adaption_queued--;
+		memmove(tracker->adaption_queue, tracker->adaption_queue + 1, tracker->adaption_queued * sizeof(TrackedController*));
+		tracker->adaption_current = tc;
+		CvScalar hsv = tc->lut_next_hsv;
+		pthread_mutex_unlock(&tracker->adaption_mutex);
+
+		// the next tables are only used by the tracking threads once lut_next_ready is set
+		CvScalar min, max;
+		th_minus(hsv.val, tracker->rHSV.val, min.val, 3);
+		th_plus(hsv.val, tracker->rHSV.val, max.val, 3);
+		th_build_color_lut(min, max, tc->color_lut_next);
+		th_build_yuv_lut(min, max, tc->yuv_lut_next);
+
+		pthread_mutex_lock(&tracker->adaption_mutex);
+		tc->lut_next_ready = 1;
+		tracker->adaption_current = NULL;
+		pthread_cond_broadcast(&tracker->adaption_done);
+	}
+	pthread_mutex_unlock(&tracker->adaption_mutex);
+
+	return NULL;
+}
+#endif
+
+void psmove_tracker_auto_exposure(PSMoveTracker* tracker) {
+	long long now = psmove_util_get_ticks_us();
+	if (now - tracker->auto_exposure_us < AUTO_EXPOSURE_INTERVAL)
+		return;
+
+	// the worst contrast of all spheres found in this frame decides
+	int measured = 0;
+	int clipped = 0;
+	float contrast = 255;
+	TrackedController* tc;
+	for (tc = tracker->controllers; tc; tc = tc->next) {
+		if (tc->contrast_valid) {
+			measured = 1;
+			clipped = clipped || tc->sphere_clipped;
+			contrast = MIN(contrast, tc->sphere_lum - tc->background_lum);
+		}
+	}
+
+	// nothing to measure (a lost sphere is handled by reacquisition, not by guessing)
+	if (!measured)
+		return;
+
+	int exposure = tracker->auto_exposure_value;
+	int gain = tracker->gain;
+	if (clipped) {
+		// washed out: reduce the gain first (it adds noise), then the exposure
+		if (gain > 0) {
+			gain = (gain / AUTO_EXPOSURE_STEP > 16) ? (int)(gain / AUTO_EXPOSURE_STEP) : 0;
+		} else {
+			exposure = MAX((int)(exposure / AUTO_EXPOSURE_STEP), AUTO_EXPOSURE_MIN);
+		}
+	} else if (contrast < AUTO_EXPOSURE_CONTRAST_T) {
+		// too dark: increase the exposure first, then the gain
+		if (exposure < AUTO_EXPOSURE_MAX) {
+			exposure = MIN((int)(exposure * AUTO_EXPOSURE_STEP) + 1, AUTO_EXPOSURE_MAX);
+		} else {
+			gain = MIN(MAX((int)(gain * AUTO_EXPOSURE_STEP), 256), AUTO_EXPOSURE_GAIN_MAX);
+		}
+	}
+
+	if (exposure != tracker->auto_exposure_value || gain != tracker->gain) {
+		tracker->auto_exposure_value = exposure;
+		tracker->gain = gain;
+		tracker->auto_exposure_us = now;
+		psmove_tracker_apply_exposure(tracker, exposure, gain);
+	}
+}
+
+void psmove_tracker_apply_exposure(PSMoveTracker* tracker, int exposure, int gain) {
+#if defined(PSMOVE_USE_PTHREADS)
+	if (tracker->exposure_running) {
+		pthread_mutex_lock(&tracker->exposure_mutex);
+		tracker->exposure_next = exposure;
+		tracker->gain_next = gain;
+		tracker->exposure_pending = 1;
+		pthread_cond_signal(&tracker->exposure_cond);
+		pthread_mutex_unlock(&tracker->exposure_mutex);
+		return;
+	}
+#endif
+	// without the thread, this is rare enough (see AUTO_EXPOSURE_INTERVAL) to be done inline
+	camera_control_set_parameters(tracker->cc, 0, 0, 0, exposure, gain, 0xffff, 0xffff, 0xffff, -1, -1);
+}
+
+#if defined(PSMOVE_USE_PTHREADS)
+void *psmove_tracker_exposure_proc(void *data) {
+	PSMoveTracker* tracker = (PSMoveTracker*) data;
+
+	PSMOVE_TRACE_THREAD_NAME("tracker exposure");
+
+	pthread_mutex_lock(&tracker->exposure_mutex);
+	while (!tracker->exposure_quit) {
+		if (!tracker->exposure_pending) {
+			pthread_cond_wait(&tracker->exposure_cond, &tracker->exposure_mutex);
+			continue;
+		}
+
+		int exposure = tracker->exposure_next;
+		int gain = tracker->gain_next;
+		tracker->exposure_pending = 0;
+		pthread_mutex_unlock(&tracker->exposure_mutex);
+
+		// the camera keeps capturing while it is reconfigured
+		camera_control_set_parameters(tracker->cc, 0, 0, 0, exposure, gain, 0xffff, 0xffff, 0xffff, -1, -1);
+
+		pthread_mutex_lock(&tracker->exposure_mutex);
+	}
+	pthread_mutex_unlock(&tracker->exposure_mutex);
+
+	return NULL;
+}
+#endif
+
 int psmove_tracker_adapt_to_light(PSMoveTracker *tracker, int lumMin, int expMin, int expMax) {
 	int exp = expMin;
 	// set the camera parameters to minimal exposure
@@ -1050,6 +2980,16 @@ psmove_tracker_wait_for_frame(PSMoveTracker *tracker, IplImage **frame, int dela
     int elapsed_time = 0;
     int step = 10;
 
+    // frames queried here are not uploaded to the GPU (see "psmove_tracker_update")
+    tracker->frame_uploaded = 0;
+    psmove_tracker_detach_frame(tracker);
+
+    // recorded frames don't take time to arrive, the next one is the one to wait for
+    if (tracker->replay_calibration) {
+        *frame = camera_control_query_frame(tracker->cc);
+        return;
+    }
+
     while (elapsed_time < delay) {
         usleep(1000 * step);
         *frame = camera_control_query_frame(tracker->cc);
@@ -1058,22 +2998,32 @@ psmove_tracker_wait_for_frame(PSMoveTracker *tracker, IplImage **frame, int dela
 }
 
 void psmove_tracker_get_diff(PSMoveTracker* tracker, PSMove* move, int r, int g, int b, IplImage* on, IplImage* diff, int delay) {
+	CvScalar color = cvScalar(b, g, r, 0);
+	psmove_tracker_get_diff_multiple(tracker, &move, &color, 1, on, diff, delay);
+}
+
+void psmove_tracker_get_diff_multiple(PSMoveTracker* tracker, PSMove** moves, const CvScalar* colors, int count, IplImage* on, IplImage* diff, int delay) {
 	// the time to wait for the controller to set the color up
 	IplImage* frame;
-	// switch the LEDs ON and wait for the sphere to be fully lit
-	r *= DIMMING_FACTOR;
-	g *= DIMMING_FACTOR;
-	b *= DIMMING_FACTOR;
-	psmove_set_leds(move, r, g, b);
-	psmove_update_leds(move);
+	int i;
+	// switch the LEDs ON and wait for the spheres to be fully lit
+	for (i = 0; i < count; i++) {
+		psmove_set_leds(moves[i],
+				colors[i].val[2] * DIMMING_FACTOR,
+				colors[i].val[1] * DIMMING_FACTOR,
+				colors[i].val[0] * DIMMING_FACTOR);
+		psmove_update_leds(moves[i]);
+	}
 
 	// take the first frame (sphere lit)
         psmove_tracker_wait_for_frame(tracker, &frame, delay);
 	cvCopy(frame, on, NULL);
 
-	// switch the LEDs OFF and wait for the sphere to be off
-	psmove_set_leds(move, 0, 0, 0);
-	psmove_update_leds(move);
+	// switch the LEDs OFF and wait for the spheres to be off
+	for (i = 0; i < count; i++) {
+		psmove_set_leds(moves[i], 0, 0, 0);
+		psmove_update_leds(moves[i]);
+	}
 
 	// take the second frame (sphere iff)
         psmove_tracker_wait_for_frame(tracker, &frame, delay);
@@ -1092,6 +3042,51 @@ void psmove_tracker_get_diff(PSMoveTracker* tracker, PSMove* move, int r, int g,
 	cvReleaseImage(&grey2);
 }
 
+int psmove_tracker_reacquire(PSMoveTracker* tracker, TrackedController* tc, CvPoint *center) {
+	tc->reacquisitions++;
+
+	// nearest neighbor keeps the colors of single pixels (no blending with the background)
+	cvResize(tracker->frame, tc->reacquireI, CV_INTER_NN);
+	psmove_tracker_filter_color(tracker, tc, tc->reacquireI, tc->reacquireM);
+
+	th_blob blob;
+	if (!th_biggest_blob(tc->blobs, tc->reacquireM, NULL, &blob))
+		return 0;
+
+	center->x = blob.cx * tracker->frame->width / tc->reacquireM->width;
+	center->y = blob.cy * tracker->frame->height / tc->reacquireM->height;
+	return 1;
+}
+
+void psmove_tracker_predict_roi(PSMoveTracker* tracker, TrackedController* tc, float *x, float *y, float *margin) {
+	// assume the sphere keeps moving as fast as in the last frames
+	*x = tc->x + tc->vx;
+	*y = tc->y + tc->vy;
+	*margin = 0;
+
+	if (!tc->move || !psmove_has_calibration(tc->move) || tc->update_interval_us <= 0)
+		return;
+
+	float gx, gy, gz;
+	float ax, ay, az;
+	psmove_get_gyroscope_frame(tc->move, Frame_SecondHalf, &gx, &gy, &gz);
+	psmove_get_accelerometer_frame(tc->move, Frame_SecondHalf, &ax, &ay, &az);
+
+	// time until the next frame (in s), assuming a constant frame rate
+	float dt = MIN(tc->update_interval_us, 100000) / 1000000.;
+
+	// the sphere moves on an arc around the wrist when the controller is rotated
+	float rotation = sqrt(gx * gx + gy * gy + gz * gz) * dt * TRACKER_PREDICT_LEVER;
+
+	// any acceleration apart from gravity changes the velocity (1g = 9810 mm/s^2)
+	float accel = fabs(sqrt(ax * ax + ay * ay + az * az) - 1) * 9810;
+	float translation = 0.5 * accel * dt * dt;
+
+	// project the movement (in mm) onto the image, using the known size of the sphere
+	float pixel_per_mm = tc->r / (tracker->ps_move_diameter / 2);
+	*margin = MIN((rotation + translation) * pixel_per_mm, tracker->frame->width);
+}
+
 void psmove_tracker_set_roi(PSMoveTracker* tracker, TrackedController* tc, int roi_x, int roi_y, int roi_width, int roi_height) {
 	tc->roi_x = roi_x;
 	tc->roi_y = roi_y;
@@ -1107,6 +3102,18 @@ void psmove_tracker_set_roi(PSMoveTracker* tracker, TrackedController* tc, int r
 		tc->roi_y = tracker->frame->height - roi_height;
 }
 
+void psmove_tracker_resize_roi(PSMoveTracker* tracker, TrackedController* tc, int center_x, int center_y, int roi_width, int roi_height) {
+	tc->roi_width = MIN(MAX(roi_width, ROI_MIN_SIZE), tracker->roi_max.width);
+	tc->roi_height = MIN(MAX(roi_height, ROI_MIN_SIZE), tracker->roi_max.height);
+	psmove_tracker_set_roi(tracker, tc, center_x - tc->roi_width / 2, center_y - tc->roi_height / 2, tc->roi_width, tc->roi_height);
+}
+
+IplImage* psmove_tracker_roi_mask(TrackedController* tc) {
+	cvInitImageHeader(&tc->roi_view, cvSize(tc->roi_width, tc->roi_height), tc->roiM->depth, 1, IPL_ORIGIN_TL, 4);
+	cvSetData(&tc->roi_view, tc->roiM->imageData, tc->roiM->widthStep);
+	return &tc->roi_view;
+}
+
 void psmove_tracker_prepare_colors(PSMoveTracker* tracker) {
 	// create MAGENTA (good tracking)
 	tracked_color_insert(&tracker->available_colors, 0xff, 0, 0xff);
@@ -1117,9 +3124,8 @@ void psmove_tracker_prepare_colors(PSMoveTracker* tracker) {
 
 }
 
-void psmove_tracker_draw_tracking_stats(PSMoveTracker* tracker) {
+void psmove_tracker_draw_tracking_stats(PSMoveTracker* tracker, IplImage* frame) {
 	CvPoint p;
-	IplImage* frame = psmove_tracker_get_image(tracker);
 
 	float textSmall = 0.8;
 	float textNormal = 1;
@@ -1136,23 +3142,19 @@ void psmove_tracker_draw_tracking_stats(PSMoveTracker* tracker) {
 	cvRectangle(frame, cvPoint(0, 0), cvPoint(frame->width, 25), th_black, CV_FILLED, 8, 0);
 	sprintf(text, "fps:%.0f", tracker->debug_fps);
 	th_put_text(frame, text, cvPoint(10, 20), th_white, textNormal);
-        if (tracker->duration) {
-            tracker->debug_fps = (0.85 * tracker->debug_fps + 0.15 *
-                (1000. / (double)tracker->duration));
-        }
 	sprintf(text, "avg(lum):%.0f", avgLum);
 	th_put_text(frame, text, cvPoint(255, 20), th_white, textNormal);
 
 	TrackedController* tc;
 	// draw all/one controller information to camera image
 	tc = tracker->controllers;
-	for (; tc != 0x0 && tracker->frame; tc = tc->next) {
+	for (; tc != 0x0; tc = tc->next) {
 		if (tc->is_tracked) {
 			// controller specific statistics
 			p.x = tc->x;
 			p.y = tc->y;
-			roi_w = tracker->roiI[tc->roi_level]->width;
-			roi_h = tracker->roiI[tc->roi_level]->height;
+			roi_w = tc->roi_width;
+			roi_h = tc->roi_height;
 			c = tc->eColor;
 
 			cvRectangle(frame, cvPoint(tc->roi_x, tc->roi_y), cvPoint(tc->roi_x + roi_w, tc->roi_y + roi_h), th_white, 3, 8, 0);
@@ -1225,40 +3227,22 @@ void psmove_tracker_biggest_contour(IplImage* img, CvMemStorage* stor, CvSeq** r
 }
 
 void
-psmove_tracker_estimate_circle_from_contour(CvSeq* cont, float *x, float *y, float* radius)
+psmove_tracker_estimate_circle_from_blob(const th_blob* blob, float *x, float *y, float* radius)
 {
-    psmove_return_if_fail(cont != NULL);
+    psmove_return_if_fail(blob != NULL);
     psmove_return_if_fail(x != NULL && y != NULL && radius != NULL);
 
-	int i, j;
-	float d = 0;
-	float cd = 0;
-	CvPoint m1;
-	CvPoint m2;
-	CvPoint * p1;
-	CvPoint * p2;
-
-	int step = MAX(1,cont->total/20);
-
-	// compare every two points of the contour (but not more than 20)
-	// to find the most distant pair
-	for (i = 0; i < cont->total; i += step) {
-		p1 = (CvPoint*) cvGetSeqElem(cont, i);
-		for (j = i + 1; j < cont->total; j += step) {
-			p2 = (CvPoint*) cvGetSeqElem(cont, j);
-			cd = th_dist_squared(*p1,*p2);
-			if (cd > d) {
-				d = cd;
-				m1 = *p1;
-				m2 = *p2;
-			}
-		}
-	}
-	// calculate center of that pair
-	*x = 0.5 * (m1.x + m2.x);
-	*y = 0.5 * (m1.y + m2.y);
-	// calcualte the radius
-	*radius = sqrt(d) / 2;
+	// the distance between the outermost pixel centers (as for the most distant contour points)
+	float d = MAX(blob->bbox.width, blob->bbox.height) - 1;
+
+	// the major axis of the ellipse with the same moments (covers diagonal blobs)
+	float common = sqrt(pow(blob->mu20 - blob->mu02, 2) + 4 * pow(blob->mu11, 2));
+	float lambda = 0.5 * (blob->mu20 + blob->mu02 + common);
+	d = MAX(d, 4 * sqrt(MAX(lambda, 0)));
+
+	*x = blob->bbox.x + 0.5 * (blob->bbox.width - 1);
+	*y = blob->bbox.y + 0.5 * (blob->bbox.height - 1);
+	*radius = d / 2;
 }
 
 int
@@ -1268,37 +3252,20 @@ psmove_tracker_center_roi_on_controller(TrackedController* tc, PSMoveTracker* tr
     psmove_return_val_if_fail(tracker != NULL, 0);
     psmove_return_val_if_fail(center != NULL, 0);
 
-	CvScalar min, max;
-	th_minus(tc->eColorHSV.val, tracker->rHSV.val, min.val, 3);
-	th_plus(tc->eColorHSV.val, tracker->rHSV.val, max.val, 3);
-
-	IplImage *roi_i = tracker->roiI[tc->roi_level];
-	IplImage *roi_m = tracker->roiM[tc->roi_level];
+	IplImage *roi_m = psmove_tracker_roi_mask(tc);
 
-	// cut out the roi!
-	cvSetImageROI(tracker->frame, cvRect(tc->roi_x, tc->roi_y, roi_i->width, roi_i->height));
-	cvCvtColor(tracker->frame, roi_i, CV_BGR2HSV);
-
-	// apply color filter
-	cvInRangeS(roi_i, min, max, roi_m);
+	// apply color filter to the roi
+	psmove_tracker_filter_frame(tracker, tc, cvRect(tc->roi_x, tc->roi_y, roi_m->width, roi_m->height), roi_m);
 	
-	float sizeBest = 0;
-	CvSeq* contourBest = NULL;
-	psmove_tracker_biggest_contour(roi_m, tracker->storage, &contourBest, &sizeBest);
-	if (contourBest) {
-		cvSet(roi_m, th_black, NULL);
-		cvDrawContours(roi_m, contourBest, th_white, th_white, -1, CV_FILLED, 8, cvPoint(0, 0));
-		// calucalte image-moments to estimate the better ROI center
-		CvMoments mu;
-		cvMoments(roi_m, &mu, 0);
-
-		*center = cvPoint(mu.m10 / mu.m00, mu.m01 / mu.m00);
+	// the center of mass of the biggest blob is the better ROI center
+	th_blob blob;
+	int found = th_biggest_blob(tc->blobs, roi_m, NULL, &blob);
+	if (found) {
+		*center = cvPoint(blob.cx, blob.cy);
 		center->x += tc->roi_x - roi_m->width / 2;
 		center->y += tc->roi_y - roi_m->height / 2;
 	}
-	cvClearMemStorage(tracker->storage);
-	cvResetImageROI(tracker->frame);
 
-        return (contourBest != NULL);
+        return found;
 }
 
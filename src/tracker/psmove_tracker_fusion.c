@@ -0,0 +1,328 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "psmove_tracker.h"
+#include "../psmove_private.h"
+
+/* Time constant of the camera correction (in seconds) */
+#define FUSION_TIME_CONSTANT 0.15f
+
+/* Standard gravity (in mm/s^2), the accelerometer reads 1.0 at rest */
+#define FUSION_GRAVITY 9806.65f
+
+/* Longest interval between two reports that is integrated (in us) */
+#define FUSION_MAX_STEP_US 100000
+
+/* Without a camera location for this long, the location is held (in us) */
+#define FUSION_MAX_COAST_US 250000
+
+/* Number of past locations kept to match late camera frames */
+#define FUSION_HISTORY 32
+
+/* A location at a point in time, see PSMoveTrackerFusionState.history */
+typedef struct {
+    long long time_us;
+    float location[3];
+} PSMoveTrackerFusionPoint;
+
+/* The filter state of a single controller */
+typedef struct {
+    PSMove *move;
+    int valid; /* Nonzero once the camera has seen the controller */
+    float location[3]; /* Fused location (in mm, camera axes) */
+    float velocity[3]; /* Velocity (in mm/s) */
+    float bias[3]; /* Estimated accelerometer bias (in mm/s^2) */
+    long long time_us; /* When the state was last integrated */
+    long long camera_us; /* Tracking time of the last camera location used */
+
+    /* Recent locations, as camera frames arrive after the reports */
+    PSMoveTrackerFusionPoint history[FUSION_HISTORY];
+    int history_next;
+} PSMoveTrackerFusionState;
+
+struct _PSMoveTrackerFusion {
+    PSMoveTracker *tracker;
+
+    PSMoveTrackerFusionState *states;
+    int state_count;
+    int state_capacity;
+};
+
+static PSMoveTrackerFusionState *
+psmove_tracker_fusion_state(PSMoveTrackerFusion *fusion, PSMove *move,
+        int create)
+{
+    int i;
+
+    for (i = 0; i < fusion->state_count; i++) {
+        if (fusion->states[i].move == move) {
+            return fusion->states + i;
+        }
+    }
+
+    if (!create) {
+        return NULL;
+    }
+
+    if (fusion->state_count == fusion->state_capacity) {
+        fusion->state_capacity = fusion->state_capacity ?
+            fusion->state_capacity * 2 : 4;
+        fusion->states = (PSMoveTrackerFusionState *)realloc(fusion->states,
+                fusion->state_capacity * sizeof(PSMoveTrackerFusionState));
+    }
+
+    PSMoveTrackerFusionState *state = fusion->states + fusion->state_count++;
+    memset(state, 0, sizeof(PSMoveTrackerFusionState));
+    state->move = move;
+    return state;
+}
+
+/**
+ * Get the linear acceleration of one half-frame in camera axes (in mm/s^2).
+ *
+ * The accelerometer is first brought into the axes of the orientation
+ * filter (see psmove_orientation_load), then rotated into the world frame
+ * of the quaternion, where gravity is +Z. At the identity orientation the
+ * controller points at the camera with the buttons up, so the world axes
+ * map to the camera axes (X right, Y down, Z away from the camera) as
+ * X = -x, Y = -z and Z = -y.
+ **/
+static void
+psmove_tracker_fusion_acceleration(const PSMoveSample *sample, int frame,
+        const float *q, float *accel)
+{
+    float a[3] = {
+        -sample->accel_x[frame],
+        sample->accel_y[frame],
+        sample->accel_z[frame],
+    };
+    float w = q[0], x = q[1], y = q[2], z = q[3];
+
+    float wx = (1.f - 2.f * (y * y + z * z)) * a[0] +
+        2.f * (x * y - w * z) * a[1] + 2.f * (x * z + w * y) * a[2];
+    float wy = 2.f * (x * y + w * z) * a[0] +
+        (1.f - 2.f * (x * x + z * z)) * a[1] + 2.f * (y * z - w * x) * a[2];
+    float wz = 2.f * (x * z - w * y) * a[0] + 2.f * (y * z + w * x) * a[1] +
+        (1.f - 2.f * (x * x + y * y)) * a[2];
+
+    /* Remove gravity */
+    wz -= 1.f;
+
+    accel[0] = -wx * FUSION_GRAVITY;
+    accel[1] = -wz * FUSION_GRAVITY;
+    accel[2] = -wy * FUSION_GRAVITY;
+}
+
+/* Find the fused location at the time a camera frame was captured */
+static const float *
+psmove_tracker_fusion_history(PSMoveTrackerFusionState *state,
+        long long time_us)
+{
+    const float *best = state->location;
+    long long best_age = -1;
+    int i;
+
+    for (i = 0; i < FUSION_HISTORY; i++) {
+        PSMoveTrackerFusionPoint *point = state->history + i;
+        long long age = time_us - point->time_us;
+        if (point->time_us != 0 && age >= 0 &&
+                (best_age < 0 || age < best_age)) {
+            best = point->location;
+            best_age = age;
+        }
+    }
+
+    return best;
+}
+
+/* Pull the state towards a new camera location */
+static void
+psmove_tracker_fusion_correct(PSMoveTrackerFusionState *state,
+        const float *camera, long long captured_us, long long tracked_us)
+{
+    const float *then = psmove_tracker_fusion_history(state, captured_us);
+    float dt = (float)(tracked_us - state->camera_us) / 1000000.f;
+    float tau = FUSION_TIME_CONSTANT;
+    float error[3];
+    int i, k;
+
+    if (dt <= 0.f || dt > FUSION_MAX_COAST_US / 1000000.f) {
+        /* First frame after a gap: nothing has been integrated reliably */
+        for (k = 0; k < 3; k++) {
+            state->location[k] = camera[k];
+            state->velocity[k] = 0.f;
+        }
+        memset(state->history, 0, sizeof(state->history));
+        return;
+    }
+
+    /* Third-order complementary filter (location, velocity and bias) */
+    for (k = 0; k < 3; k++) {
+        error[k] = camera[k] - then[k];
+    }
+
+    for (k = 0; k < 3; k++) {
+        float step = error[k] * 3.f / tau * dt;
+        state->location[k] += step;
+        state->velocity[k] += error[k] * 3.f / (tau * tau) * dt;
+        state->bias[k] -= error[k] / (tau * tau * tau) * dt;
+
+        /* Keep the history consistent with the corrected location */
+        for (i = 0; i < FUSION_HISTORY; i++) {
+            state->history[i].location[k] += step;
+        }
+    }
+}
+
+PSMoveTrackerFusion *
+psmove_tracker_fusion_new(PSMoveTracker *tracker)
+{
+    psmove_return_val_if_fail(tracker != NULL, NULL);
+
+    PSMoveTrackerFusion *fusion = (PSMoveTrackerFusion *)calloc(1,
+            sizeof(PSMoveTrackerFusion));
+    fusion->tracker = tracker;
+    return fusion;
+}
+
+int
+psmove_tracker_fusion_update(PSMoveTrackerFusion *fusion, PSMove *move)
+{
+    psmove_return_val_if_fail(fusion != NULL, 0);
+    psmove_return_val_if_fail(move != NULL, 0);
+
+    PSMoveTrackerFusionState *state =
+        psmove_tracker_fusion_state(fusion, move, 1);
+    PSMoveTracker *tracker = fusion->tracker;
+    long long now = psmove_util_get_ticks_us();
+    long long captured_us, tracked_us;
+    float camera[3];
+    int k;
+
+    int have_camera = psmove_tracker_get_status(tracker, move) ==
+        Tracker_TRACKING &&
+        psmove_tracker_get_position_timestamp(tracker, move,
+                &captured_us, &tracked_us) &&
+        tracked_us != state->camera_us &&
+        psmove_tracker_get_location(tracker, move,
+                &camera[0], &camera[1], &camera[2]);
+
+    if (!state->valid) {
+        if (!have_camera) {
+            return 0;
+        }
+
+        memcpy(state->location, camera, sizeof(state->location));
+        state->valid = 1;
+        state->time_us = now;
+        state->camera_us = tracked_us;
+        return 1;
+    }
+
+    /* Integrate the two half-frames of the report */
+    PSMoveSample sample;
+    long long step_us = now - state->time_us;
+    int coasting = (now - state->camera_us) > FUSION_MAX_COAST_US;
+
+    if (step_us > 0 && step_us <= FUSION_MAX_STEP_US && !coasting &&
+            psmove_has_orientation(move) &&
+            psmove_get_sample(move, &sample)) {
+        float q[4];
+        float h = (float)step_us / 2000000.f;
+        int frame;
+
+        psmove_get_orientation(move, &q[0], &q[1], &q[2], &q[3]);
+
+        for (frame = Frame_FirstHalf; frame <= Frame_SecondHalf; frame++) {
+            float accel[3];
+            psmove_tracker_fusion_acceleration(&sample, frame, q, accel);
+            for (k = 0; k < 3; k++) {
+                state->velocity[k] += (accel[k] - state->bias[k]) * h;
+                state->location[k] += state->velocity[k] * h;
+            }
+        }
+    } else if (coasting) {
+        /* The camera lost the controller: hold the last location */
+        memset(state->velocity, 0, sizeof(state->velocity));
+    }
+    state->time_us = now;
+
+    PSMoveTrackerFusionPoint *point = state->history + state->history_next;
+    point->time_us = now;
+    memcpy(point->location, state->location, sizeof(point->location));
+    state->history_next = (state->history_next + 1) % FUSION_HISTORY;
+
+    if (have_camera) {
+        psmove_tracker_fusion_correct(state, camera, captured_us, tracked_us);
+        state->camera_us = tracked_us;
+    }
+
+    return 1;
+}
+
+int
+psmove_tracker_fusion_get_location(PSMoveTrackerFusion *fusion, PSMove *move,
+        float *x, float *y, float *z)
+{
+    psmove_return_val_if_fail(fusion != NULL, 0);
+    psmove_return_val_if_fail(move != NULL, 0);
+
+    PSMoveTrackerFusionState *state =
+        psmove_tracker_fusion_state(fusion, move, 0);
+    if (state == NULL || !state->valid) {
+        return 0;
+    }
+
+    if (x) {
+        *x = state->location[0];
+    }
+
+    if (y) {
+        *y = state->location[1];
+    }
+
+    if (z) {
+        *z = state->location[2];
+    }
+
+    return 1;
+}
+
+void
+psmove_tracker_fusion_free(PSMoveTrackerFusion *fusion)
+{
+    psmove_return_if_fail(fusion != NULL);
+
+    free(fusion->states);
+    free(fusion);
+}
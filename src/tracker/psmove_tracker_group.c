@@ -0,0 +1,350 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "psmove_tracker.h"
+#include "../psmove_private.h"
+
+#if defined(PSMOVE_USE_PTHREADS)
+#  include <pthread.h>
+#endif
+
+/* One capture/processing thread per camera */
+typedef struct {
+    struct _PSMoveTrackerGroup *group;
+    int index;
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_t thread;
+#endif
+} PSMoveTrackerGroupWorker;
+
+struct _PSMoveTrackerGroup {
+    int count; /* Number of cameras */
+    PSMoveTracker **trackers; /* One tracker per camera */
+    PSMoveTrackerGroupWorker *workers;
+
+    PSMove **moves; /* Controllers enabled in the group */
+    int move_count;
+    int move_capacity;
+
+#if defined(PSMOVE_USE_PTHREADS)
+    int sync_initialized; /* Nonzero once mutex and conditions exist */
+    int threads_running; /* Number of started worker threads */
+    int quit; /* Set to make the worker threads exit */
+    int generation; /* Incremented for each psmove_tracker_group_update() */
+    int pending; /* Number of cameras not done with the current update */
+    pthread_mutex_t mutex; /* Protects quit, generation and pending */
+    pthread_cond_t work_cond; /* Signalled when a new update starts */
+    pthread_cond_t done_cond; /* Signalled when the last camera is done */
+#endif
+};
+
+static void
+psmove_tracker_group_update_camera(PSMoveTrackerGroup *group, int index)
+{
+    PSMoveTracker *tracker = group->trackers[index];
+    psmove_tracker_update_image(tracker);
+    psmove_tracker_update(tracker, NULL);
+}
+
+#if defined(PSMOVE_USE_PTHREADS)
+static void *
+psmove_tracker_group_worker_proc(void *data)
+{
+    PSMoveTrackerGroupWorker *worker = (PSMoveTrackerGroupWorker *)data;
+    PSMoveTrackerGroup *group = worker->group;
+    int seen = 0;
+
+    pthread_mutex_lock(&group->mutex);
+    while (1) {
+        while (!group->quit && group->generation == seen) {
+            pthread_cond_wait(&group->work_cond, &group->mutex);
+        }
+        if (group->quit) {
+            break;
+        }
+        seen = group->generation;
+        pthread_mutex_unlock(&group->mutex);
+
+        psmove_tracker_group_update_camera(group, worker->index);
+
+        pthread_mutex_lock(&group->mutex);
+        if (--group->pending == 0) {
+            pthread_cond_signal(&group->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&group->mutex);
+
+    return NULL;
+}
+#endif
+
+PSMoveTrackerGroup *
+psmove_tracker_group_new(const int *cameras, int count)
+{
+    int i;
+
+    psmove_return_val_if_fail(cameras != NULL, NULL);
+    psmove_return_val_if_fail(count > 0, NULL);
+
+    PSMoveTrackerGroup *group = (PSMoveTrackerGroup *)calloc(1,
+            sizeof(PSMoveTrackerGroup));
+    group->trackers = (PSMoveTracker **)calloc(count, sizeof(PSMoveTracker *));
+    group->workers = (PSMoveTrackerGroupWorker *)calloc(count,
+            sizeof(PSMoveTrackerGroupWorker));
+
+    for (i = 0; i < count; i++) {
+        group->trackers[i] = psmove_tracker_new_with_camera(cameras[i]);
+        if (group->trackers[i] == NULL) {
+            fprintf(stderr, "[PSMOVE] Cannot open camera %d for tracker "
+                    "group\n", cameras[i]);
+            break;
+        }
+        group->workers[i].group = group;
+        group->workers[i].index = i;
+        group->count++;
+    }
+
+    if (group->count < count) {
+        psmove_tracker_group_free(group);
+        return NULL;
+    }
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_init(&group->mutex, NULL);
+    pthread_cond_init(&group->work_cond, NULL);
+    pthread_cond_init(&group->done_cond, NULL);
+    group->sync_initialized = 1;
+
+    for (i = 0; i < group->count; i++) {
+        if (pthread_create(&group->workers[i].thread, NULL,
+                    psmove_tracker_group_worker_proc,
+                    &group->workers[i]) != 0) {
+            break;
+        }
+        group->threads_running++;
+    }
+#endif
+
+    return group;
+}
+
+int
+psmove_tracker_group_count(PSMoveTrackerGroup *group)
+{
+    psmove_return_val_if_fail(group != NULL, 0);
+    return group->count;
+}
+
+PSMoveTracker *
+psmove_tracker_group_get_tracker(PSMoveTrackerGroup *group, int index)
+{
+    psmove_return_val_if_fail(group != NULL, NULL);
+    psmove_return_val_if_fail(index >= 0 && index < group->count, NULL);
+    return group->trackers[index];
+}
+
+enum PSMoveTracker_Status
+psmove_tracker_group_enable(PSMoveTrackerGroup *group, PSMove *move)
+{
+    int i;
+    unsigned char r, g, b;
+
+    psmove_return_val_if_fail(group != NULL, Tracker_CALIBRATION_ERROR);
+    psmove_return_val_if_fail(move != NULL, Tracker_CALIBRATION_ERROR);
+
+    /* The first camera picks the color, all others have to use the same */
+    enum PSMoveTracker_Status result =
+        psmove_tracker_enable(group->trackers[0], move);
+    if (result != Tracker_CALIBRATED ||
+            !psmove_tracker_get_color(group->trackers[0], move, &r, &g, &b)) {
+        return Tracker_CALIBRATION_ERROR;
+    }
+
+    for (i = 1; i < group->count; i++) {
+        /* A camera that can't see the controller now is not an error */
+        psmove_tracker_enable_with_color(group->trackers[i], move, r, g, b);
+    }
+
+    for (i = 0; i < group->move_count; i++) {
+        if (group->moves[i] == move) {
+            return Tracker_CALIBRATED;
+        }
+    }
+
+    if (group->move_count == group->move_capacity) {
+        group->move_capacity = group->move_capacity ?
+            group->move_capacity * 2 : 4;
+        group->moves = (PSMove **)realloc(group->moves,
+                group->move_capacity * sizeof(PSMove *));
+    }
+    group->moves[group->move_count++] = move;
+
+    return Tracker_CALIBRATED;
+}
+
+void
+psmove_tracker_group_disable(PSMoveTrackerGroup *group, PSMove *move)
+{
+    int i;
+
+    psmove_return_if_fail(group != NULL);
+    psmove_return_if_fail(move != NULL);
+
+    for (i = 0; i < group->count; i++) {
+        if (psmove_tracker_get_status(group->trackers[i], move) !=
+                Tracker_NOT_CALIBRATED) {
+            psmove_tracker_disable(group->trackers[i], move);
+        }
+    }
+
+    for (i = 0; i < group->move_count; i++) {
+        if (group->moves[i] == move) {
+            memmove(group->moves + i, group->moves + i + 1,
+                    (group->move_count - i - 1) * sizeof(PSMove *));
+            group->move_count--;
+            break;
+        }
+    }
+}
+
+/* Find the camera that tracks a controller with the best quality */
+static int
+psmove_tracker_group_best_camera(PSMoveTrackerGroup *group, PSMove *move)
+{
+    int i;
+    int best = -1;
+    float best_quality = -1;
+
+    for (i = 0; i < group->count; i++) {
+        PSMoveTrackerControllerMetrics metrics;
+
+        if (psmove_tracker_get_status(group->trackers[i], move) !=
+                Tracker_TRACKING) {
+            continue;
+        }
+
+        /* q1 compares the blob with a perfect circle (occlusion, blur) */
+        if (psmove_tracker_get_controller_metrics(group->trackers[i], move,
+                    &metrics) && metrics.q1 > best_quality) {
+            best_quality = metrics.q1;
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+int
+psmove_tracker_group_update(PSMoveTrackerGroup *group)
+{
+    int i;
+    int tracked = 0;
+
+    psmove_return_val_if_fail(group != NULL, 0);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    if (group->threads_running == group->count) {
+        /* Let all cameras capture and process their frames in parallel */
+        pthread_mutex_lock(&group->mutex);
+        group->pending = group->count;
+        group->generation++;
+        pthread_cond_broadcast(&group->work_cond);
+        while (group->pending > 0) {
+            pthread_cond_wait(&group->done_cond, &group->mutex);
+        }
+        pthread_mutex_unlock(&group->mutex);
+    } else
+#endif
+    {
+        for (i = 0; i < group->count; i++) {
+            psmove_tracker_group_update_camera(group, i);
+        }
+    }
+
+    for (i = 0; i < group->move_count; i++) {
+        if (psmove_tracker_group_best_camera(group, group->moves[i]) != -1) {
+            tracked++;
+        }
+    }
+
+    return tracked;
+}
+
+int
+psmove_tracker_group_get_position(PSMoveTrackerGroup *group, PSMove *move,
+        float *x, float *y, float *radius)
+{
+    psmove_return_val_if_fail(group != NULL, -1);
+    psmove_return_val_if_fail(move != NULL, -1);
+
+    int best = psmove_tracker_group_best_camera(group, move);
+    if (best != -1) {
+        psmove_tracker_get_position(group->trackers[best], move,
+                x, y, radius);
+    }
+
+    return best;
+}
+
+void
+psmove_tracker_group_free(PSMoveTrackerGroup *group)
+{
+    int i;
+
+    psmove_return_if_fail(group != NULL);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    if (group->sync_initialized) {
+        pthread_mutex_lock(&group->mutex);
+        group->quit = 1;
+        pthread_cond_broadcast(&group->work_cond);
+        pthread_mutex_unlock(&group->mutex);
+
+        for (i = 0; i < group->threads_running; i++) {
+            pthread_join(group->workers[i].thread, NULL);
+        }
+
+        pthread_cond_destroy(&group->done_cond);
+        pthread_cond_destroy(&group->work_cond);
+        pthread_mutex_destroy(&group->mutex);
+    }
+#endif
+
+    for (i = 0; i < group->count; i++) {
+        psmove_tracker_free(group->trackers[i]);
+    }
+
+    free(group->trackers);
+    free(group->workers);
+    free(group->moves);
+    free(group);
+}
@@ -0,0 +1,380 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "psmove_tracker.h"
+#include "../psmove_private.h"
+
+/* Number of input reports kept per controller (about 130 ms) */
+#define SNAPSHOT_INPUT_HISTORY 16
+
+/* Number of camera positions kept per controller (about 130 ms at 60 Hz) */
+#define SNAPSHOT_POSITION_HISTORY 8
+
+/* Positions are extrapolated at most this far beyond the newest frame (in us) */
+#define SNAPSHOT_MAX_EXTRAPOLATION_US 50000
+
+/* The state of a controller at the time of one input report */
+typedef struct {
+    long long time_us;
+    unsigned int buttons;
+    int trigger;
+    float orientation[4];
+} PSMoveTrackerSnapshotInput;
+
+/* The position of a controller in one camera frame */
+typedef struct {
+    long long time_us;
+    int tracked;
+    float x, y, radius;
+} PSMoveTrackerSnapshotPosition;
+
+/**
+ * The recent history of a controller. Each ring has a single writer (the
+ * thread that polls the controller, and the thread that updates the
+ * tracker), which fills the slot after the newest entry and only then
+ * publishes it by incrementing the head. Readers copy the ring without a
+ * lock and discard the entries that might have been overwritten while
+ * copying, so neither side ever waits for the other.
+ **/
+typedef struct {
+    PSMove *move;
+
+    PSMoveTrackerSnapshotInput inputs[SNAPSHOT_INPUT_HISTORY];
+    unsigned int input_head;
+
+    PSMoveTrackerSnapshotPosition positions[SNAPSHOT_POSITION_HISTORY];
+    unsigned int position_head;
+    long long position_captured_us; /* Capture time of the newest position (writer only) */
+} PSMoveTrackerSnapshotHistory;
+
+struct _PSMoveTrackerSnapshot {
+    PSMoveTracker *tracker;
+
+    PSMoveTrackerSnapshotHistory *histories;
+    int history_count;
+};
+
+static PSMoveTrackerSnapshotHistory *
+psmove_tracker_snapshot_history(PSMoveTrackerSnapshot *snapshot, PSMove *move)
+{
+    int i;
+
+    for (i = 0; i < snapshot->history_count; i++) {
+        if (snapshot->histories[i].move == move) {
+            return snapshot->histories + i;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Copy the published entries of a ring, oldest first, into out (which
+ * has room for size entries). Returns the number of consistent entries.
+ **/
+static int
+psmove_tracker_snapshot_copy(const void *slots, size_t entry_size, int size,
+        unsigned int *head, void *out)
+{
+    unsigned int first, last, later, i;
+
+    last = __atomic_load_n(head, __ATOMIC_ACQUIRE);
+    first = (last > (unsigned int)size) ? last - size : 0;
+
+    for (i = first; i < last; i++) {
+        memcpy((char *)out + (i - first) * entry_size,
+                (const char *)slots + (i % size) * entry_size, entry_size);
+    }
+
+    /* The writer may have reused the oldest slots in the meantime */
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    later = __atomic_load_n(head, __ATOMIC_RELAXED);
+    if (later + 1 > first + size) {
+        unsigned int stale = later + 1 - size - first;
+        if (stale >= last - first) {
+            return 0;
+        }
+        memmove(out, (char *)out + stale * entry_size,
+                (last - first - stale) * entry_size);
+        return last - first - stale;
+    }
+
+    return last - first;
+}
+
+/* Normalized linear interpolation of two quaternions (along the shorter arc) */
+static void
+psmove_tracker_snapshot_nlerp(const float *a, const float *b, float t,
+        float *result)
+{
+    float dot = a[0]*b[0] + a[1]*b[1] + a[2]*b[2] + a[3]*b[3];
+    float sign = (dot < 0.f) ? -1.f : 1.f;
+    float length = 0.f;
+    int k;
+
+    for (k = 0; k < 4; k++) {
+        result[k] = a[k] * (1.f - t) + sign * b[k] * t;
+        length += result[k] * result[k];
+    }
+
+    length = sqrtf(length);
+    for (k = 0; k < 4; k++) {
+        result[k] = (length > 0.f) ? result[k] / length : a[k];
+    }
+}
+
+static void
+psmove_tracker_snapshot_get_input(PSMoveTrackerSnapshotHistory *history,
+        long long time_us, PSMoveTrackerSnapshotEntry *entry)
+{
+    PSMoveTrackerSnapshotInput inputs[SNAPSHOT_INPUT_HISTORY];
+    int count = psmove_tracker_snapshot_copy(history->inputs,
+            sizeof(PSMoveTrackerSnapshotInput), SNAPSHOT_INPUT_HISTORY,
+            &(history->input_head), inputs);
+    int i;
+
+    if (count == 0) {
+        entry->orientation[0] = 1.f;
+        return;
+    }
+
+    /* The newest report at or before the time (or the oldest one) */
+    for (i = count - 1; i > 0 && inputs[i].time_us > time_us; i--);
+
+    PSMoveTrackerSnapshotInput *input = inputs + i;
+    entry->valid = 1;
+    entry->input_us = input->time_us;
+    entry->buttons = input->buttons;
+    entry->trigger = input->trigger;
+
+    if (i + 1 < count && input->time_us <= time_us &&
+            inputs[i + 1].time_us > input->time_us) {
+        float t = (float)(time_us - input->time_us) /
+            (float)(inputs[i + 1].time_us - input->time_us);
+        psmove_tracker_snapshot_nlerp(input->orientation,
+                inputs[i + 1].orientation, t, entry->orientation);
+    } else {
+        memcpy(entry->orientation, input->orientation,
+                sizeof(entry->orientation));
+    }
+}
+
+static void
+psmove_tracker_snapshot_get_position(PSMoveTrackerSnapshotHistory *history,
+        long long time_us, PSMoveTrackerSnapshotEntry *entry)
+{
+    PSMoveTrackerSnapshotPosition positions[SNAPSHOT_POSITION_HISTORY];
+    int count = psmove_tracker_snapshot_copy(history->positions,
+            sizeof(PSMoveTrackerSnapshotPosition), SNAPSHOT_POSITION_HISTORY,
+            &(history->position_head), positions);
+    int i;
+
+    if (count == 0) {
+        return;
+    }
+
+    /* The newest frame at or before the time (or the oldest one) */
+    for (i = count - 1; i > 0 && positions[i].time_us > time_us; i--);
+
+    PSMoveTrackerSnapshotPosition *a = positions + i;
+    if (!a->tracked) {
+        return;
+    }
+
+    entry->tracked = 1;
+    entry->captured_us = a->time_us;
+    entry->x = a->x;
+    entry->y = a->y;
+    entry->radius = a->radius;
+
+    /* Interpolate to the next frame, or extrapolate from the previous one */
+    PSMoveTrackerSnapshotPosition *b = NULL;
+    if (i + 1 < count && positions[i + 1].tracked) {
+        b = positions + i + 1;
+    } else if (i + 1 == count && i > 0 && positions[i - 1].tracked &&
+            time_us - a->time_us <= SNAPSHOT_MAX_EXTRAPOLATION_US) {
+        b = a;
+        a = positions + i - 1;
+    }
+
+    if (b != NULL && b->time_us > a->time_us && time_us > a->time_us) {
+        float t = (float)(time_us - a->time_us) / (float)(b->time_us - a->time_us);
+        entry->x = a->x + (b->x - a->x) * t;
+        entry->y = a->y + (b->y - a->y) * t;
+        entry->radius = a->radius + (b->radius - a->radius) * t;
+    }
+}
+
+PSMoveTrackerSnapshot *
+psmove_tracker_snapshot_new(PSMoveTracker *tracker)
+{
+    PSMoveTrackerSnapshot *snapshot = (PSMoveTrackerSnapshot *)calloc(1,
+            sizeof(PSMoveTrackerSnapshot));
+
+    snapshot->tracker = tracker;
+    return snapshot;
+}
+
+int
+psmove_tracker_snapshot_add(PSMoveTrackerSnapshot *snapshot, PSMove *move)
+{
+    psmove_return_val_if_fail(snapshot != NULL, 0);
+    psmove_return_val_if_fail(move != NULL, 0);
+
+    if (psmove_tracker_snapshot_history(snapshot, move) != NULL) {
+        return 1;
+    }
+
+    snapshot->histories = (PSMoveTrackerSnapshotHistory *)realloc(
+            snapshot->histories, (snapshot->history_count + 1) *
+            sizeof(PSMoveTrackerSnapshotHistory));
+
+    PSMoveTrackerSnapshotHistory *history =
+        snapshot->histories + snapshot->history_count++;
+    memset(history, 0, sizeof(PSMoveTrackerSnapshotHistory));
+    history->move = move;
+    return 1;
+}
+
+int
+psmove_tracker_snapshot_update_input(PSMoveTrackerSnapshot *snapshot,
+        PSMove *move)
+{
+    psmove_return_val_if_fail(snapshot != NULL, 0);
+    psmove_return_val_if_fail(move != NULL, 0);
+
+    PSMoveTrackerSnapshotHistory *history =
+        psmove_tracker_snapshot_history(snapshot, move);
+    psmove_return_val_if_fail(history != NULL, 0);
+
+    unsigned int head = history->input_head;
+    PSMoveTrackerSnapshotInput *input =
+        history->inputs + (head % SNAPSHOT_INPUT_HISTORY);
+
+    input->time_us = _psmove_get_input_time_us(move);
+    input->buttons = psmove_get_buttons(move);
+    input->trigger = psmove_get_trigger(move);
+    if (psmove_has_orientation(move)) {
+        psmove_get_orientation(move, &input->orientation[0],
+                &input->orientation[1], &input->orientation[2],
+                &input->orientation[3]);
+    } else {
+        input->orientation[0] = 1.f;
+        input->orientation[1] = input->orientation[2] =
+            input->orientation[3] = 0.f;
+    }
+
+    __atomic_store_n(&(history->input_head), head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+int
+psmove_tracker_snapshot_update_tracker(PSMoveTrackerSnapshot *snapshot)
+{
+    psmove_return_val_if_fail(snapshot != NULL, 0);
+
+    if (snapshot->tracker == NULL || snapshot->history_count == 0) {
+        return 0;
+    }
+
+    PSMoveTrackerResult results[PSMOVE_TRACKER_MAX_CONTROLLERS];
+    int count = psmove_tracker_get_results(snapshot->tracker, results,
+            PSMOVE_TRACKER_MAX_CONTROLLERS);
+    int i;
+
+    for (i = 0; i < count; i++) {
+        PSMoveTrackerSnapshotHistory *history =
+            psmove_tracker_snapshot_history(snapshot, results[i].move);
+        if (history == NULL) {
+            continue;
+        }
+
+        unsigned int head = history->position_head;
+        int tracked = (results[i].status == Tracker_TRACKING);
+        int newest_tracked = (head > 0 &&
+                history->positions[(head - 1) % SNAPSHOT_POSITION_HISTORY].tracked);
+
+        /* One entry per frame the controller was found in, and one when lost */
+        if (tracked ? (results[i].captured_us == history->position_captured_us) :
+                !newest_tracked) {
+            continue;
+        }
+
+        PSMoveTrackerSnapshotPosition *position =
+            history->positions + (head % SNAPSHOT_POSITION_HISTORY);
+        position->tracked = tracked;
+        position->time_us = tracked ? results[i].captured_us :
+            psmove_util_get_ticks_us();
+        position->x = results[i].x;
+        position->y = results[i].y;
+        position->radius = results[i].radius;
+        if (tracked) {
+            history->position_captured_us = results[i].captured_us;
+        }
+
+        __atomic_store_n(&(history->position_head), head + 1, __ATOMIC_RELEASE);
+    }
+
+    return 1;
+}
+
+int
+psmove_tracker_snapshot_get(PSMoveTrackerSnapshot *snapshot, long long time_us,
+        PSMoveTrackerSnapshotEntry *entries, int count)
+{
+    psmove_return_val_if_fail(snapshot != NULL, 0);
+    psmove_return_val_if_fail(entries != NULL || count == 0, 0);
+
+    int filled = 0;
+    int i;
+
+    for (i = 0; i < snapshot->history_count && filled < count; i++) {
+        PSMoveTrackerSnapshotEntry *entry = entries + filled++;
+        memset(entry, 0, sizeof(PSMoveTrackerSnapshotEntry));
+        entry->move = snapshot->histories[i].move;
+
+        psmove_tracker_snapshot_get_input(snapshot->histories + i, time_us, entry);
+        psmove_tracker_snapshot_get_position(snapshot->histories + i, time_us, entry);
+    }
+
+    return filled;
+}
+
+void
+psmove_tracker_snapshot_free(PSMoveTrackerSnapshot *snapshot)
+{
+    psmove_return_if_fail(snapshot != NULL);
+
+    free(snapshot->histories);
+    free(snapshot);
+}
@@ -35,6 +35,31 @@
 #include "../external/iniparser/dictionary.h"
 
 #define COLOR_MAPPING_FILE "ColorMappings.ini"
+#define CALIBRATION_FILE "TrackerCalibration.ini"
+#define CALIBRATION_SECTION "Calibration"
+
+/* Build the key of the calibration record of a controller (serial without colons) */
+static int
+tracked_controller_calibration_key(TrackedController* tc, int camera, char *key, size_t size)
+{
+	char *serial = psmove_get_serial(tc->move);
+	if (!serial) {
+		return 0;
+	}
+
+	char *src, *dst;
+	for (src = dst = serial; *src; src++) {
+		if (*src != ':') {
+			*dst++ = *src;
+		}
+	}
+	*dst = '\0';
+
+	snprintf(key, size, CALIBRATION_SECTION ":%d_%s_%02X%02X%02X", camera, serial,
+			(int) tc->dColor.val[2], (int) tc->dColor.val[1], (int) tc->dColor.val[0]);
+	free(serial);
+	return 1;
+}
 
 TrackedController*
 tracked_controller_create() {
@@ -162,3 +187,54 @@ int tracked_controller_load_color(TrackedController* tc) {
 	return loaded;
 }
 
+void
+tracked_controller_save_calibration(TrackedController* tc, const char* file, int camera, int exposure, float radius)
+{
+	char key[128];
+	char value[128];
+
+	if (!tracked_controller_calibration_key(tc, camera, key, sizeof(key)))
+		return;
+
+	char *filename = file ? strdup(file) : psmove_util_get_file_path(CALIBRATION_FILE);
+	dictionary* ini = iniparser_load(filename);
+	if (!ini)
+		ini = dictionary_new(0);
+	iniparser_set(ini, CALIBRATION_SECTION, 0);
+
+	snprintf(value, sizeof(value), "%02X%02X%02X %d %.1f", (int) tc->eFColor.val[2],
+			(int) tc->eFColor.val[1], (int) tc->eFColor.val[0], exposure, radius);
+	iniparser_set(ini, key, value);
+
+	iniparser_save_ini(ini, filename);
+	dictionary_del(ini);
+	free(filename);
+}
+
+int
+tracked_controller_load_calibration(TrackedController* tc, const char* file, int camera, int* exposure, float* radius)
+{
+	char key[128];
+	int loaded = 0;
+
+	if (!tracked_controller_calibration_key(tc, camera, key, sizeof(key)))
+		return 0;
+
+	char *filename = file ? strdup(file) : psmove_util_get_file_path(CALIBRATION_FILE);
+	dictionary* ini = iniparser_load(filename);
+	free(filename);
+	if (!ini)
+		return 0;
+
+	unsigned int color;
+	if (sscanf(iniparser_getstring(ini, key, ""), "%X %d %f", &color, exposure, radius) == 3) {
+		tc->eFColor = cvScalar(color & 0xFF, color >> 8 & 0xFF, color >> 16 & 0xFF, 0);
+		tc->eColor = tc->eFColor;
+		tc->eFColorHSV = th_brg2hsv(tc->eFColor);
+		tc->eColorHSV = tc->eFColorHSV;
+		loaded = 1;
+	}
+
+	dictionary_del(ini);
+	return loaded;
+}
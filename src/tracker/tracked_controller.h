@@ -31,6 +31,8 @@
 
 #include "opencv2/core/core_c.h"
 #include "psmove.h"
+#include "tracker_helpers.h"
+#include "tracker_opencl.h"
 
 struct _TrackedController;
 typedef struct _TrackedController TrackedController;
@@ -44,16 +46,58 @@ struct _TrackedController {
 	CvScalar eColor;			// estimated color (BGR)
 	CvScalar eColorHSV; 		// estimated color (HSV)
 	int roi_x, roi_y;			// x/y - Coordinates of the ROI
-	int roi_level; 	 			// the current index for the level of ROI
+	int roi_width, roi_height;	// the size of the ROI (0 until the scratch buffers are allocated)
 	float mx, my;				// x/y - Coordinates of center of mass of the blob
 	float x, y, r;				// x/y - Coordinates of the controllers sphere and its radius
 	int search_quadrant; 			// current search quadrant when controller is not found (reset to 0 if found)
 	float rs;					// a smoothed variant of the radius
+	float lx, ly, lz;			// x/y/z - Location of the sphere relative to the camera (in mm)
+	float vx, vy;				// x/y - Image velocity of the sphere (in pixels per frame)
+	long long last_update_us;	// the timestamp of the last update (see psmove_util_get_ticks_us)
+	long long update_interval_us;	// the time between the last two updates
+	long long captured_us;		// the capture time of the frame the sphere has last been found in
+	long long tracked_us;		// the time the sphere has last been found
 
         float q1, q2, q3; // Calculated quality criteria from the tracker
 
+	// metrics (see psmove_tracker_get_controller_metrics)
+	int color_filter_us;		// time spent on color filtering in the last update
+	int blob_us;				// time spent finding the blob in the last update
+	int color_adaption_us;		// time spent on color adaption in the last update
+	int allocations;			// heap allocations in the last update (see "psmove_tracker_hot_alloc")
+	int budget_skips;			// optional steps skipped in the last update (see "psmove_tracker_set_time_budget")
+	unsigned long frames_tracked;	// number of updates that found the sphere
+	unsigned long frames_lost;	// number of updates that did not find the sphere
+	unsigned long roi_enlargements;	// number of times the ROI has been enlarged to search again
+	unsigned long quadrant_searches;	// number of times a whole quadrant had to be searched
+	unsigned long reacquisitions;	// number of times the downsampled frame had to be searched
+
+	// segmentation statistics of the last update (see "psmove_tracker_auto_exposure")
+	int contrast_valid;			// 1 if the sphere has been found with a good quality in the last update
+	float sphere_lum;			// average luminance of the sphere (0-255)
+	float background_lum;		// average luminance of the rest of the ROI (0-255)
+	int sphere_clipped;			// 1 if a color channel of the sphere is (nearly) saturated
+
 	int is_tracked;				// 1 if tracked 0 otherwise
 	long last_color_update;	// the timestamp when the last color adaption has been performed
+
+	// scratch buffers of the tracker (one set per controller, so controllers can be tracked in parallel)
+	IplImage* roiM;				// mask of the biggest roi size (greyscale), smaller rois use roi_view
+	IplImage roi_view;			// header for the part of roiM used by the current roi (see "psmove_tracker_roi_mask")
+	th_blob_labeler* blobs;		// used to find the biggest blob in the ROI
+	IplImage* reacquireI;		// the downsampled frame, used to find a lost sphere (colored)
+	IplImage* reacquireM;		// the downsampled frame, used to find a lost sphere (greyscale)
+	unsigned char* color_lut;	// color lookup table (see th_build_color_lut)
+	CvScalar color_lut_hsv;		// the estimated color (HSV) color_lut was built for
+	int color_lut_valid;		// 1 if color_lut has been built
+	unsigned char* yuv_lut;		// YUV color lookup table (see th_build_yuv_lut)
+	CvScalar yuv_lut_hsv;		// the estimated color (HSV) yuv_lut was built for
+	int yuv_lut_valid;			// 1 if yuv_lut has been built
+	unsigned char* color_lut_next;	// color_lut for lut_next_hsv, built in the background (see "psmove_tracker_adopt_luts")
+	unsigned char* yuv_lut_next;	// yuv_lut for lut_next_hsv, built in the background
+	CvScalar lut_next_hsv;		// the estimated color (HSV) the next tables are built for
+	int lut_next_ready;			// 1 if the next tables have been built
+	th_opencl_filter* opencl_filter;	// the color filter on the GPU, NULL if not available
 	TrackedController* next;
 };
 
@@ -78,4 +122,32 @@ tracked_controller_save_colors(TrackedController* head);
 int
 tracked_controller_load_color(TrackedController* tc);
 
+/**
+ * Saves the calibration record of a controller (estimated color, exposure and
+ * typical radius), keyed by camera, controller serial and assigned color (dColor)
+ *
+ * tc       - the calibrated controller
+ * file     - the file to store the record in, NULL for the calibration cache
+ * camera   - the index of the camera the controller has been calibrated with
+ * exposure - the exposure the camera used during calibration
+ * radius   - the typical radius of the sphere (in pixels)
+ **/
+void
+tracked_controller_save_calibration(TrackedController* tc, const char* file, int camera, int exposure, float radius);
+
+/**
+ * Loads the calibration record saved by tracked_controller_save_calibration()
+ * into the estimated colors of the controller
+ *
+ * tc       - the controller (with its move and dColor set)
+ * file     - the file to load the record from, NULL for the calibration cache
+ * camera   - the index of the camera used for tracking
+ * exposure - (out) the exposure the camera used during calibration
+ * radius   - (out) the typical radius of the sphere (in pixels)
+ *
+ * Returns: nonzero if a record has been found, zero otherwise
+ **/
+int
+tracked_controller_load_calibration(TrackedController* tc, const char* file, int camera, int* exposure, float* radius);
+
 #endif //__TRACKED_CONTROLLER_H
@@ -27,6 +27,8 @@
  **/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #ifdef WIN32
 #    include <windows.h>
 #endif
@@ -36,6 +38,12 @@
 #include "opencv2/core/core_c.h"
 #include "tracker_helpers.h"
 
+#if defined(__SSE2__)
+#    include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#    include <arm_neon.h>
+#endif
+
 double th_var(double* src, int len) {
 	double f = 1.0 / (len - 1);
 	int i;
@@ -189,13 +197,215 @@ CvScalar th_hsv2bgr(CvScalar hsv) {
 
 }
 CvScalar th_brg2hsv(CvScalar bgr) {
-	if (pxHSV == 0x0) {
-		pxHSV = cvCreateImage(cvSize(1, 1), IPL_DEPTH_8U, 3);
-		pxBGR = cvCloneImage(pxHSV);
+	// like cvSet() on a 8-bit pixel, values are rounded and saturated first
+	int c[3];
+	int i;
+	for (i = 0; i < 3; i++) {
+		c[i] = cvRound(bgr.val[i]);
+		c[i] = c[i] < 0 ? 0 : (c[i] > 0xFF ? 0xFF : c[i]);
+	}
+
+	int h, s, v;
+	th_bgr2hsv_pixel(c[0], c[1], c[2], &h, &s, &v);
+	return cvScalar(h, s, v, 0);
+}
+
+void th_bgr2hsv_pixel(int b, int g, int r, int* h, int* s, int* v) {
+	// integer arithmetic of OpenCV's RGB2HSV_b, with the divisions computed instead of tabulated
+	int vmax = MAX(MAX(b, g), r);
+	int vmin = MIN(MIN(b, g), r);
+	int diff = vmax - vmin;
+	int hh;
+
+	*v = vmax;
+	*s = vmax ? (diff * (((255 << 12) + vmax / 2) / vmax) + (1 << 11)) >> 12 : 0;
+
+	if (diff == 0) {
+		*h = 0;
+		return;
+	}
+
+	if (vmax == r)
+		hh = g - b;
+	else if (vmax == g)
+		hh = b - r + 2 * diff;
+	else
+		hh = r - g + 4 * diff;
+
+	hh = (hh * (((180 << 12) + 3 * diff) / (6 * diff)) + (1 << 11)) >> 12;
+	*h = hh < 0 ? hh + 180 : hh;
+}
+
+#define th_color_lut_index(b, g, r) ((((b) >> 3) << 10) | (((g) >> 3) << 5) | ((r) >> 3))
+
+void th_color_lut_mask(const CvArr* src, const unsigned char* lut, IplImage* mask) {
+	CvMat stub;
+	CvMat* mat = cvGetMat(src, &stub, NULL, 0);
+	int x, y;
+
+	for (y = 0; y < mat->rows; y++) {
+		const unsigned char* p = mat->data.ptr + y * mat->step;
+		unsigned char* m = (unsigned char*) mask->imageData + y * mask->widthStep;
+
+		for (x = 0; x < mat->cols; x++, p += 3) {
+			int i = th_color_lut_index(p[0], p[1], p[2]);
+			m[x] = (lut[i >> 3] & (1 << (i & 7))) ? 0xFF : 0;
+		}
+	}
+}
+
+// converts a bound for cvInRangeS on 8-bit images (rounded and saturated, inclusive)
+static int th_range_bound(double value) {
+	int i = cvRound(value);
+	return i < 0 ? 0 : (i > 0xFF ? 0xFF : i);
+}
+
+void th_build_color_lut(CvScalar min, CvScalar max, unsigned char* lut) {
+	int hlo = th_range_bound(min.val[0]), hhi = th_range_bound(max.val[0]);
+	int slo = th_range_bound(min.val[1]), shi = th_range_bound(max.val[1]);
+	int vlo = th_range_bound(min.val[2]), vhi = th_range_bound(max.val[2]);
+	int b, g, r;
+
+	memset(lut, 0, TH_COLOR_LUT_SIZE);
+
+	// classify the center color of each cell
+	for (b = 4; b < 256; b += 8) {
+		for (g = 4; g < 256; g += 8) {
+			for (r = 4; r < 256; r += 8) {
+				int h, s, v;
+				th_bgr2hsv_pixel(b, g, r, &h, &s, &v);
+				if (v >= vlo && v <= vhi && s >= slo && s <= shi && h >= hlo && h <= hhi) {
+					int i = th_color_lut_index(b, g, r);
+					lut[i >> 3] |= 1 << (i & 7);
+				}
+			}
+		}
+	}
+}
+
+// converts a YUV color to BGR (ITU-R BT.601, as cvCvtColor with CV_YUV2BGR_YUYV)
+static void th_yuv2bgr_pixel(int y, int u, int v, int* b, int* g, int* r) {
+	int c = 1192 * (MAX(y, 16) - 16);
+	int d = u - 128;
+	int e = v - 128;
+	*b = th_range_bound((c + 2066 * d) / 1024.);
+	*g = th_range_bound((c - 833 * e - 400 * d) / 1024.);
+	*r = th_range_bound((c + 1634 * e) / 1024.);
+}
+
+void th_build_yuv_lut(CvScalar min, CvScalar max, unsigned char* lut) {
+	int hlo = th_range_bound(min.val[0]), hhi = th_range_bound(max.val[0]);
+	int slo = th_range_bound(min.val[1]), shi = th_range_bound(max.val[1]);
+	int vlo = th_range_bound(min.val[2]), vhi = th_range_bound(max.val[2]);
+	int y, u, v;
+
+	memset(lut, 0, TH_COLOR_LUT_SIZE);
+
+	// classify the center color of each cell, the HSV bounds are translated into YUV space here once
+	for (y = 4; y < 256; y += 8) {
+		for (u = 4; u < 256; u += 8) {
+			for (v = 4; v < 256; v += 8) {
+				int b, g, r, h, s, val;
+				th_yuv2bgr_pixel(y, u, v, &b, &g, &r);
+				th_bgr2hsv_pixel(b, g, r, &h, &s, &val);
+				if (val >= vlo && val <= vhi && s >= slo && s <= shi && h >= hlo && h <= hhi) {
+					int i = th_color_lut_index(y, u, v);
+					lut[i >> 3] |= 1 << (i & 7);
+				}
+			}
+		}
+	}
+}
+
+void th_yuyv_lut_mask(const IplImage* yuyv, CvRect rect, const unsigned char* lut, IplImage* mask) {
+	int x, y;
+
+	for (y = 0; y < rect.height; y++) {
+		// two neighbouring pixels (Y0 U Y1 V) share their U and V samples
+		const unsigned char* line = (const unsigned char*) yuyv->imageData + (rect.y + y) * yuyv->widthStep;
+		unsigned char* m = (unsigned char*) mask->imageData + y * mask->widthStep;
+
+		for (x = 0; x < rect.width; x++) {
+			int px = rect.x + x;
+			const unsigned char* pair = line + (px & ~1) * 2;
+			int i = th_color_lut_index(pair[(px & 1) * 2], pair[1], pair[3]);
+			m[x] = (lut[i >> 3] & (1 << (i & 7))) ? 0xFF : 0;
+		}
+	}
+}
+
+void th_bgr_hsv_in_range(const CvArr* src, CvScalar min, CvScalar max, IplImage* mask) {
+	CvMat stub;
+	CvMat* mat = cvGetMat(src, &stub, NULL, 0);
+	int hlo = th_range_bound(min.val[0]), hhi = th_range_bound(max.val[0]);
+	int slo = th_range_bound(min.val[1]), shi = th_range_bound(max.val[1]);
+	int vlo = th_range_bound(min.val[2]), vhi = th_range_bound(max.val[2]);
+	int x, y;
+
+	for (y = 0; y < mat->rows; y++) {
+		const unsigned char* p = mat->data.ptr + y * mat->step;
+		unsigned char* m = (unsigned char*) mask->imageData + y * mask->widthStep;
+		x = 0;
+
+#if defined(__SSE2__) || (defined(__ARM_NEON) && defined(__aarch64__))
+		/**
+		 * Most of the (low exposure) frame is dark: if all bytes of 16 pixels
+		 * are below vlo, none of them can be in range (V is the maximum of B,G,R)
+		 **/
+		if (vlo > 0) {
+#if defined(__SSE2__)
+			__m128i below = _mm_set1_epi8((char) (vlo - 1));
+			__m128i zero = _mm_setzero_si128();
+#else
+			uint8x16_t below = vdupq_n_u8(vlo - 1);
+#endif
+			for (; x + 16 <= mat->cols; x += 16) {
+				const unsigned char* q = p + x * 3;
+#if defined(__SSE2__)
+				__m128i c = _mm_max_epu8(_mm_loadu_si128((const __m128i*) q),
+						_mm_max_epu8(_mm_loadu_si128((const __m128i*) (q + 16)),
+							_mm_loadu_si128((const __m128i*) (q + 32))));
+				int dark = (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(c, below), zero)) == 0xFFFF);
+#else
+				uint8x16_t c = vmaxq_u8(vld1q_u8(q), vmaxq_u8(vld1q_u8(q + 16), vld1q_u8(q + 32)));
+				int dark = (vmaxvq_u8(vqsubq_u8(c, below)) == 0);
+#endif
+				if (dark) {
+					memset(m + x, 0, 16);
+					continue;
+				}
+
+				// at least one bright pixel: classify these 16 one by one
+				int e;
+				for (e = x; e < x + 16; e++) {
+					const unsigned char* px = p + e * 3;
+					int h, s, v;
+					m[e] = 0;
+					if (MAX(MAX(px[0], px[1]), px[2]) < vlo)
+						continue;
+					th_bgr2hsv_pixel(px[0], px[1], px[2], &h, &s, &v);
+					if (v <= vhi && s >= slo && s <= shi && h >= hlo && h <= hhi)
+						m[e] = 0xFF;
+				}
+			}
+		}
+#endif
+
+		for (; x < mat->cols; x++) {
+			const unsigned char* px = p + x * 3;
+			int h, s, v;
+			m[x] = 0;
+
+			// reject on V first, it needs no division
+			v = MAX(MAX(px[0], px[1]), px[2]);
+			if (v < vlo || v > vhi)
+				continue;
+
+			th_bgr2hsv_pixel(px[0], px[1], px[2], &h, &s, &v);
+			if (s >= slo && s <= shi && h >= hlo && h <= hhi)
+				m[x] = 0xFF;
+		}
 	}
-	cvSet(pxBGR, bgr, 0x0);
-	cvCvtColor(pxBGR, pxHSV, CV_BGR2HSV);
-	return cvAvg(pxHSV, 0x0);
 }
 
 CvScalar th_hsv2bgr_alt(float hue) {
@@ -217,6 +427,185 @@ CvScalar th_hsv2bgr_alt(float hue) {
 	return cvScalar(rgb[2], rgb[1], rgb[0], 0);
 }
 
+// running sums of a (provisional) blob label
+typedef struct {
+	int area;
+	int x0, y0, x1, y1;
+	long long sx, sy, sxx, syy, sxy;
+	long long sb, sg, sr;
+} th_blob_sums;
+
+struct _th_blob_labeler {
+	CvSize max_size;
+	int* rows;				// labels of the previous and current row (2 x width)
+	int* parent;			// union-find forest of the labels (label 0 = background)
+	th_blob_sums* sums;		// sums of each label (valid for the roots only)
+	int capacity;			// number of labels available
+};
+
+th_blob_labeler* th_blob_labeler_new(CvSize max_size) {
+	th_blob_labeler* labeler = (th_blob_labeler*) calloc(1, sizeof(th_blob_labeler));
+	labeler->max_size = max_size;
+	labeler->rows = (int*) calloc(2 * (max_size.width + 2), sizeof(int));
+	// with 8-connectivity, a new label needs a gap of one pixel in both directions
+	labeler->capacity = ((max_size.width + 1) / 2) * ((max_size.height + 1) / 2) + 1;
+	labeler->parent = (int*) malloc(labeler->capacity * sizeof(int));
+	labeler->sums = (th_blob_sums*) malloc(labeler->capacity * sizeof(th_blob_sums));
+	return labeler;
+}
+
+void th_blob_labeler_free(th_blob_labeler* labeler) {
+	if (labeler) {
+		free(labeler->rows);
+		free(labeler->parent);
+		free(labeler->sums);
+		free(labeler);
+	}
+}
+
+size_t th_blob_labeler_size(const th_blob_labeler* labeler) {
+	if (!labeler)
+		return 0;
+	return sizeof(th_blob_labeler) + 2 * (labeler->max_size.width + 2) * sizeof(int) +
+			labeler->capacity * (sizeof(int) + sizeof(th_blob_sums));
+}
+
+size_t th_image_size(const IplImage* image) {
+	return image ? sizeof(IplImage) + image->imageSize : 0;
+}
+
+static int th_blob_find(int* parent, int label) {
+	while (parent[label] != label) {
+		// path halving
+		parent[label] = parent[parent[label]];
+		label = parent[label];
+	}
+	return label;
+}
+
+// merges the sets of labels a and b (both roots), returns the new root
+static int th_blob_union(th_blob_labeler* labeler, int a, int b) {
+	if (a == b)
+		return a;
+	if (b < a) {
+		int t = a;
+		a = b;
+		b = t;
+	}
+
+	th_blob_sums* sa = &labeler->sums[a];
+	th_blob_sums* sb = &labeler->sums[b];
+	sa->area += sb->area;
+	sa->x0 = MIN(sa->x0, sb->x0);
+	sa->y0 = MIN(sa->y0, sb->y0);
+	sa->x1 = MAX(sa->x1, sb->x1);
+	sa->y1 = MAX(sa->y1, sb->y1);
+	sa->sx += sb->sx;
+	sa->sy += sb->sy;
+	sa->sxx += sb->sxx;
+	sa->syy += sb->syy;
+	sa->sxy += sb->sxy;
+	sa->sb += sb->sb;
+	sa->sg += sb->sg;
+	sa->sr += sb->sr;
+
+	labeler->parent[b] = a;
+	return a;
+}
+
+int th_biggest_blob(th_blob_labeler* labeler, const IplImage* mask, const CvArr* image, th_blob* blob) {
+	CvMat stub;
+	CvMat* mat = image ? cvGetMat(image, &stub, NULL, 0) : NULL;
+	int w = mask->width;
+	int h = mask->height;
+	int next = 1;
+	int x, y, i;
+
+	if (w > labeler->max_size.width || h > labeler->max_size.height)
+		return 0;
+
+	// label rows have a border of one background label on both sides
+	int* prev = labeler->rows;
+	int* cur = labeler->rows + w + 2;
+	memset(prev, 0, (w + 2) * sizeof(int));
+	cur[0] = cur[w + 1] = 0;
+
+	for (y = 0; y < h; y++) {
+		const unsigned char* m = (const unsigned char*) mask->imageData + y * mask->widthStep;
+		const unsigned char* p = mat ? mat->data.ptr + y * mat->step : NULL;
+
+		for (x = 0; x < w; x++) {
+			if (!m[x]) {
+				cur[x + 1] = 0;
+				continue;
+			}
+
+			// neighbors: left, upper left, upper, upper right
+			int label = 0;
+			int n[4] = { cur[x], prev[x], prev[x + 1], prev[x + 2] };
+			for (i = 0; i < 4; i++) {
+				if (n[i]) {
+					int root = th_blob_find(labeler->parent, n[i]);
+					label = label ? th_blob_union(labeler, label, root) : root;
+				}
+			}
+
+			if (!label) {
+				if (next == labeler->capacity)
+					return 0;
+				label = next++;
+				labeler->parent[label] = label;
+				th_blob_sums* ns = &labeler->sums[label];
+				memset(ns, 0, sizeof(th_blob_sums));
+				ns->x0 = ns->x1 = x;
+				ns->y0 = ns->y1 = y;
+			}
+
+			th_blob_sums* sum = &labeler->sums[label];
+			sum->area++;
+			sum->x0 = MIN(sum->x0, x);
+			sum->x1 = MAX(sum->x1, x);
+			sum->y1 = y;
+			sum->sx += x;
+			sum->sy += y;
+			sum->sxx += x * x;
+			sum->syy += y * y;
+			sum->sxy += x * y;
+			if (p) {
+				sum->sb += p[x * 3 + 0];
+				sum->sg += p[x * 3 + 1];
+				sum->sr += p[x * 3 + 2];
+			}
+			cur[x + 1] = label;
+		}
+
+		int* t = prev;
+		prev = cur;
+		cur = t;
+	}
+
+	// pick the biggest of the final blobs
+	int best = 0;
+	for (i = 1; i < next; i++) {
+		if (labeler->parent[i] == i && (!best || labeler->sums[i].area > labeler->sums[best].area))
+			best = i;
+	}
+	if (!best)
+		return 0;
+
+	th_blob_sums* b = &labeler->sums[best];
+	double a = b->area;
+	blob->area = b->area;
+	blob->bbox = cvRect(b->x0, b->y0, b->x1 - b->x0 + 1, b->y1 - b->y0 + 1);
+	blob->cx = b->sx / a;
+	blob->cy = b->sy / a;
+	blob->mu20 = b->sxx / a - blob->cx * blob->cx;
+	blob->mu02 = b->syy / a - blob->cy * blob->cy;
+	blob->mu11 = b->sxy / a - blob->cx * blob->cy;
+	blob->color = cvScalar(b->sb / a, b->sg / a, b->sr / a, 0);
+	return 1;
+}
+
 void th_wait_esc() {
 	while (1) {
 		//If ESC key pressed
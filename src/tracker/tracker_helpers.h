@@ -80,6 +80,53 @@ void th_print_array(double* src, int len);
 CvScalar th_hsv2bgr(CvScalar hsv);
 CvScalar th_brg2hsv(CvScalar bgr);
 
+// converts a single 8-bit BGR pixel to HSV (same result as cvCvtColor with CV_BGR2HSV)
+void th_bgr2hsv_pixel(int b, int g, int r, int* h, int* s, int* v);
+
+// same as cvCvtColor(src, hsv, CV_BGR2HSV) followed by cvInRangeS(hsv, min, max, mask), but in
+// a single pass without an HSV image (src: 8-bit, 3 channels BGR, mask: 8-bit, 1 channel, same size)
+void th_bgr_hsv_in_range(const CvArr* src, CvScalar min, CvScalar max, IplImage* mask);
+
+// a quantized BGR color lookup table: one bit for each of 32x32x32 colors (5 bits per channel)
+#define TH_COLOR_LUT_SIZE (32 * 32 * 32 / 8)
+
+// fills lut with the HSV range min..max (same bounds as for th_bgr_hsv_in_range)
+void th_build_color_lut(CvScalar min, CvScalar max, unsigned char* lut);
+
+// sets the pixels of mask whose color is in lut (src: 8-bit, 3 channels BGR, mask: 8-bit, 1 channel, same size)
+void th_color_lut_mask(const CvArr* src, const unsigned char* lut, IplImage* mask);
+
+// same as th_build_color_lut, but for a table indexed by quantized YUV colors (see th_yuyv_lut_mask)
+void th_build_yuv_lut(CvScalar min, CvScalar max, unsigned char* lut);
+
+// sets the pixels of mask whose color is in lut (built by th_build_yuv_lut), for the rectangle rect
+// of a YUYV image (8-bit, 2 channels), mask: 8-bit, 1 channel, the size of rect
+void th_yuyv_lut_mask(const IplImage* yuyv, CvRect rect, const unsigned char* lut, IplImage* mask);
+
+// properties of a blob (8-connected region of non-zero pixels) in a binary image
+typedef struct {
+	int area;				// number of pixels
+	CvRect bbox;			// bounding box
+	float cx, cy;			// center of mass
+	float mu20, mu11, mu02;	// central second order moments, divided by area
+	CvScalar color;			// average color of the blob in the source image (if any)
+} th_blob;
+
+// scratch memory for th_biggest_blob (for images up to a given size)
+typedef struct _th_blob_labeler th_blob_labeler;
+th_blob_labeler* th_blob_labeler_new(CvSize max_size);
+void th_blob_labeler_free(th_blob_labeler* labeler);
+
+// memory used by the labeler (in bytes)
+size_t th_blob_labeler_size(const th_blob_labeler* labeler);
+
+// memory used by the image, including its header (0 for NULL)
+size_t th_image_size(const IplImage* image);
+
+// finds the biggest blob in mask in a single scan (image: optional 8-bit BGR image of the
+// same size for the average color, can be NULL); returns 0 if mask has no blob
+int th_biggest_blob(th_blob_labeler* labeler, const IplImage* mask, const CvArr* image, th_blob* blob);
+
 // waits until the uses presses ESC (only works if a windo is visible)
 void th_wait_esc();
 void th_wait(char c);
@@ -0,0 +1,290 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Benjamin Venditti <benjamin.venditti@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracker_opencl.h"
+#include "tracker_helpers.h"
+
+#ifdef PSMOVE_USE_OPENCL
+
+#ifdef __APPLE__
+#    include <OpenCL/opencl.h>
+#else
+#    include <CL/cl.h>
+#endif
+
+#define TH_OPENCL_SUMMARY 5		// number of ints in the summary: matching pixels, min x, min y, max x, max y
+
+// the same lookup as th_color_lut_mask, one work item per pixel of the ROI
+static const char* th_opencl_source =
+	"__kernel void lut_mask(__global const uchar* frame, int step, int x0, int y0,\n"
+	"		__global const uchar* lut, __global uchar* mask, __global int* summary)\n"
+	"{\n"
+	"	int x = get_global_id(0);\n"
+	"	int y = get_global_id(1);\n"
+	"	__global const uchar* p = frame + (y0 + y) * step + (x0 + x) * 3;\n"
+	"	int i = ((p[0] >> 3) << 10) | ((p[1] >> 3) << 5) | (p[2] >> 3);\n"
+	"	uchar m = (lut[i >> 3] & (1 << (i & 7))) ? 0xFF : 0;\n"
+	"	mask[y * get_global_size(0) + x] = m;\n"
+	"	if (m) {\n"
+	"		atomic_inc(&summary[0]);\n"
+	"		atomic_min(&summary[1], x);\n"
+	"		atomic_min(&summary[2], y);\n"
+	"		atomic_max(&summary[3], x);\n"
+	"		atomic_max(&summary[4], y);\n"
+	"	}\n"
+	"}\n";
+
+struct _th_opencl {
+	cl_context context;
+	cl_device_id device;
+	cl_command_queue queue;		// in-order, so the upload of a frame is done before it is filtered
+	cl_program program;
+	cl_mem frame;				// the current frame (allocated on the first upload)
+	size_t frame_bytes;			// the size of the frame buffer
+	int step;					// the row size of the current frame (in bytes)
+};
+
+struct _th_opencl_filter {
+	th_opencl* cl;
+	cl_kernel kernel;			// one per filter, as the arguments are not shared between threads
+	cl_mem lut;					// the color lookup table on the device
+	unsigned char lut_copy[TH_COLOR_LUT_SIZE];	// the last uploaded color lookup table
+	int lut_valid;				// 1 if lut has been uploaded
+	cl_mem mask;				// the mask of the ROI (dense, grown if a bigger ROI is filtered)
+	size_t mask_bytes;			// the size of the mask buffer
+	cl_mem summary;				// see TH_OPENCL_SUMMARY
+};
+
+th_opencl* th_opencl_new() {
+	cl_platform_id platforms[8];
+	cl_uint platform_count = 0;
+	cl_uint i;
+	cl_int err;
+
+	if (clGetPlatformIDs(8, platforms, &platform_count) != CL_SUCCESS) {
+		return NULL;
+	}
+
+	th_opencl* cl = (th_opencl*) calloc(1, sizeof(th_opencl));
+	for (i = 0; i < platform_count && i < 8; i++) {
+		if (clGetDeviceIDs(platforms[i], CL_DEVICE_TYPE_GPU, 1, &cl->device, NULL) == CL_SUCCESS)
+			break;
+	}
+	if (i == platform_count || i == 8) {
+		free(cl);
+		return NULL;
+	}
+
+	cl->context = clCreateContext(NULL, 1, &cl->device, NULL, NULL, &err);
+	if (err != CL_SUCCESS) {
+		free(cl);
+		return NULL;
+	}
+
+	cl->queue = clCreateCommandQueue(cl->context, cl->device, 0, &err);
+	if (err == CL_SUCCESS) {
+		cl->program = clCreateProgramWithSource(cl->context, 1, &th_opencl_source, NULL, &err);
+	}
+	if (err == CL_SUCCESS) {
+		err = clBuildProgram(cl->program, 1, &cl->device, NULL, NULL, NULL);
+	}
+	if (err != CL_SUCCESS) {
+		fprintf(stderr, "[PSMOVE] Could not prepare the OpenCL color filter (error %d)\n", err);
+		th_opencl_free(cl);
+		return NULL;
+	}
+
+	return cl;
+}
+
+void th_opencl_free(th_opencl* cl) {
+	if (!cl)
+		return;
+
+	if (cl->frame)
+		clReleaseMemObject(cl->frame);
+	if (cl->program)
+		clReleaseProgram(cl->program);
+	if (cl->queue)
+		clReleaseCommandQueue(cl->queue);
+	clReleaseContext(cl->context);
+	free(cl);
+}
+
+int th_opencl_upload(th_opencl* cl, const IplImage* frame) {
+	size_t bytes = frame->widthStep * frame->height;
+	cl_int err;
+
+	if (bytes > cl->frame_bytes) {
+		if (cl->frame)
+			clReleaseMemObject(cl->frame);
+		cl->frame = clCreateBuffer(cl->context, CL_MEM_READ_ONLY, bytes, NULL, &err);
+		if (err != CL_SUCCESS) {
+			cl->frame = NULL;
+			cl->frame_bytes = 0;
+			return 0;
+		}
+		cl->frame_bytes = bytes;
+	}
+
+	// blocking, as the capture backend may reuse the frame afterwards
+	err = clEnqueueWriteBuffer(cl->queue, cl->frame, CL_TRUE, 0, bytes, frame->imageData, 0, NULL, NULL);
+	cl->step = frame->widthStep;
+	return err == CL_SUCCESS;
+}
+
+th_opencl_filter* th_opencl_filter_new(th_opencl* cl, CvSize max_size) {
+	th_opencl_filter* filter = (th_opencl_filter*) calloc(1, sizeof(th_opencl_filter));
+	cl_int err;
+
+	filter->cl = cl;
+	filter->kernel = clCreateKernel(cl->program, "lut_mask", &err);
+	if (err == CL_SUCCESS) {
+		filter->lut = clCreateBuffer(cl->context, CL_MEM_READ_ONLY, TH_COLOR_LUT_SIZE, NULL, &err);
+	}
+	if (err == CL_SUCCESS) {
+		filter->summary = clCreateBuffer(cl->context, CL_MEM_READ_WRITE, TH_OPENCL_SUMMARY * sizeof(cl_int), NULL, &err);
+	}
+	if (err == CL_SUCCESS) {
+		filter->mask_bytes = max_size.width * max_size.height;
+		filter->mask = clCreateBuffer(cl->context, CL_MEM_READ_WRITE, filter->mask_bytes, NULL, &err);
+	}
+	if (err != CL_SUCCESS) {
+		th_opencl_filter_free(filter);
+		return NULL;
+	}
+
+	return filter;
+}
+
+void th_opencl_filter_free(th_opencl_filter* filter) {
+	if (!filter)
+		return;
+
+	if (filter->summary)
+		clReleaseMemObject(filter->summary);
+	if (filter->mask)
+		clReleaseMemObject(filter->mask);
+	if (filter->lut)
+		clReleaseMemObject(filter->lut);
+	if (filter->kernel)
+		clReleaseKernel(filter->kernel);
+	free(filter);
+}
+
+int th_opencl_filter_mask(th_opencl_filter* filter, CvRect rect, const unsigned char* lut, IplImage* mask) {
+	th_opencl* cl = filter->cl;
+	size_t bytes = rect.width * rect.height;
+	cl_int err;
+
+	if (!cl->frame || bytes == 0)
+		return -1;
+
+	// the estimated color changes rarely, so the table is mostly reused
+	if (!filter->lut_valid || memcmp(filter->lut_copy, lut, TH_COLOR_LUT_SIZE) != 0) {
+		err = clEnqueueWriteBuffer(cl->queue, filter->lut, CL_TRUE, 0, TH_COLOR_LUT_SIZE, lut, 0, NULL, NULL);
+		if (err != CL_SUCCESS)
+			return -1;
+		memcpy(filter->lut_copy, lut, TH_COLOR_LUT_SIZE);
+		filter->lut_valid = 1;
+	}
+
+	if (bytes > filter->mask_bytes) {
+		if (filter->mask)
+			clReleaseMemObject(filter->mask);
+		filter->mask = clCreateBuffer(cl->context, CL_MEM_READ_WRITE, bytes, NULL, &err);
+		if (err != CL_SUCCESS) {
+			filter->mask = NULL;
+			filter->mask_bytes = 0;
+			return -1;
+		}
+		filter->mask_bytes = bytes;
+	}
+
+	// the bounding box starts empty (min > max)
+	cl_int summary[TH_OPENCL_SUMMARY] = { 0, rect.width, rect.height, -1, -1 };
+	err = clEnqueueWriteBuffer(cl->queue, filter->summary, CL_FALSE, 0, sizeof(summary), summary, 0, NULL, NULL);
+
+	cl_int step = cl->step, x0 = rect.x, y0 = rect.y;
+	err |= clSetKernelArg(filter->kernel, 0, sizeof(cl_mem), &cl->frame);
+	err |= clSetKernelArg(filter->kernel, 1, sizeof(cl_int), &step);
+	err |= clSetKernelArg(filter->kernel, 2, sizeof(cl_int), &x0);
+	err |= clSetKernelArg(filter->kernel, 3, sizeof(cl_int), &y0);
+	err |= clSetKernelArg(filter->kernel, 4, sizeof(cl_mem), &filter->lut);
+	err |= clSetKernelArg(filter->kernel, 5, sizeof(cl_mem), &filter->mask);
+	err |= clSetKernelArg(filter->kernel, 6, sizeof(cl_mem), &filter->summary);
+
+	size_t global[2] = { rect.width, rect.height };
+	err |= clEnqueueNDRangeKernel(cl->queue, filter->kernel, 2, NULL, global, NULL, 0, NULL, NULL);
+	err |= clEnqueueReadBuffer(cl->queue, filter->summary, CL_TRUE, 0, sizeof(summary), summary, 0, NULL, NULL);
+	if (err != CL_SUCCESS)
+		return -1;
+
+	cvSetZero(mask);
+	if (summary[0] > 0) {
+		// only the bounding box of the matching pixels is transferred
+		size_t origin[3] = { summary[1], summary[2], 0 };
+		size_t region[3] = { summary[3] - summary[1] + 1, summary[4] - summary[2] + 1, 1 };
+		err = clEnqueueReadBufferRect(cl->queue, filter->mask, CL_TRUE, origin, origin, region,
+				rect.width, 0, mask->widthStep, 0, mask->imageData, 0, NULL, NULL);
+		if (err != CL_SUCCESS)
+			return -1;
+	}
+
+	return summary[0];
+}
+
+#else
+
+th_opencl* th_opencl_new() {
+	return NULL;
+}
+
+void th_opencl_free(th_opencl* cl) {
+}
+
+int th_opencl_upload(th_opencl* cl, const IplImage* frame) {
+	return 0;
+}
+
+th_opencl_filter* th_opencl_filter_new(th_opencl* cl, CvSize max_size) {
+	return NULL;
+}
+
+void th_opencl_filter_free(th_opencl_filter* filter) {
+}
+
+int th_opencl_filter_mask(th_opencl_filter* filter, CvRect rect, const unsigned char* lut, IplImage* mask) {
+	return -1;
+}
+
+#endif
@@ -0,0 +1,68 @@
+/**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2012 Benjamin Venditti <benjamin.venditti@gmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+#ifndef TRACKER_OPENCL_H
+#define TRACKER_OPENCL_H
+
+#include "opencv2/core/core_c.h"
+
+#include "psmove_config.h"
+
+/**
+ * Color segmentation on the GPU (only with PSMOVE_USE_OPENCL)
+ *
+ * Each frame is uploaded to the device once (th_opencl_upload), then every
+ * controller thresholds its ROI with its color lookup table on the device
+ * (th_opencl_filter_mask). Only the summary of the matching pixels (count and
+ * bounding box) and the part of the mask inside the bounding box are read
+ * back, so the connected component search on the host only sees a few pixels.
+ *
+ * Without PSMOVE_USE_OPENCL (or without a GPU), th_opencl_new returns NULL
+ * and the tracker keeps segmenting on the CPU.
+ **/
+
+typedef struct _th_opencl th_opencl;
+typedef struct _th_opencl_filter th_opencl_filter;
+
+// selects the first GPU and builds the kernels, NULL if not available
+th_opencl* th_opencl_new();
+void th_opencl_free(th_opencl* cl);
+
+// copies the frame (8-bit, 3 channels BGR) to the device, returns 0 on error
+int th_opencl_upload(th_opencl* cl, const IplImage* frame);
+
+// the device state of one controller (can be used in parallel with other filters),
+// with the mask preallocated for ROIs up to max_size
+th_opencl_filter* th_opencl_filter_new(th_opencl* cl, CvSize max_size);
+void th_opencl_filter_free(th_opencl_filter* filter);
+
+// same as th_color_lut_mask for the rectangle rect of the uploaded frame
+// (lut: built by th_build_color_lut), returns the number of pixels set or -1 on error
+int th_opencl_filter_mask(th_opencl_filter* filter, CvRect rect, const unsigned char* lut, IplImage* mask);
+
+#endif
@@ -27,6 +27,9 @@
  **/
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
 
 #ifdef WIN32
 #	include <direct.h>
@@ -36,12 +39,51 @@
 #endif
 
 #include "psmove.h"
+#include "psmove_tracker.h"
+#include "../psmove_private.h"
 #include "tracker_trace.h"
 #include "../tracker/tracker_helpers.h"
 
+#ifdef PSMOVE_USE_PTHREADS
+#	include <pthread.h>
+#endif
+
+#define TRACE_QUEUE_MAX_BYTES (64 * 1024 * 1024)	// images queued beyond this are dropped
+
+enum TraceEventType {
+    Trace_TEXT = 1, /* a JavaScript statement */
+    Trace_IMAGE = 2, /* an image and its file name */
+    Trace_CLEAR = 3, /* start a new trace */
+};
+
+typedef struct _TraceEvent {
+    enum TraceEventType type;
+    long long timestamp_us;
+    char *text; /* the statement (Trace_TEXT) or file name (Trace_IMAGE) */
+    IplImage *image; /* a copy of the image (Trace_IMAGE) */
+    struct _TraceEvent *next;
+} TraceEvent;
+
 typedef struct {
     FILE *fp;
     int img_count;
+
+    int initialized;
+    int binary; /* write debug.trace instead of debug.js and images */
+    int image_interval; /* write every n-th image, 0 = none */
+    unsigned int image_calls; /* number of images traced so far (atomic) */
+    unsigned long dropped; /* number of images dropped (queue full) */
+
+    TraceEvent *head;
+    TraceEvent *tail;
+    size_t queued_bytes;
+#ifdef PSMOVE_USE_PTHREADS
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond; /* signalled when events are queued */
+    pthread_cond_t idle; /* signalled when the queue is empty */
+    int busy; /* the writer is writing an event */
+#endif
 } TrackerTrace;
 
 TrackerTrace tracker_trace = {
@@ -49,21 +91,256 @@ TrackerTrace tracker_trace = {
     .img_count = 0,
 };
 
-FILE *
+/* Only called from the writer (or with the queue lock held without threads) */
+static FILE *
 tracker_trace_file()
 {
     if (!tracker_trace.fp) {
-        char *filename = psmove_util_get_file_path("debug.js");
-        tracker_trace.fp = fopen(filename, "w");
+        char *filename = psmove_util_get_file_path(tracker_trace.binary ?
+                "debug.trace" : "debug.js");
+        tracker_trace.fp = fopen(filename, tracker_trace.binary ? "wb" : "w");
         free(filename);
     }
 
     return tracker_trace.fp;
 }
 
-#define tracker_trace_printf(...) { \
-    fprintf(tracker_trace_file(), __VA_ARGS__); \
-    fflush(tracker_trace_file()); \
+static void
+tracker_trace_write_record(FILE *fp, TraceEvent *event)
+{
+    unsigned char type = event->type;
+    unsigned int length = event->text ? strlen(event->text) : 0;
+
+    fwrite(&type, sizeof(type), 1, fp);
+    fwrite(&event->timestamp_us, sizeof(event->timestamp_us), 1, fp);
+
+    if (event->type == Trace_TEXT) {
+        unsigned int empty = 0;
+        fwrite(&empty, sizeof(empty), 1, fp);
+        fwrite(&length, sizeof(length), 1, fp);
+        fwrite(event->text, 1, length, fp);
+    } else if (event->type == Trace_IMAGE) {
+        IplImage *image = event->image;
+        int header[3] = { image->width, image->height, image->nChannels };
+        int y;
+
+        fwrite(&length, sizeof(length), 1, fp);
+        fwrite(event->text, 1, length, fp);
+        fwrite(header, sizeof(header), 1, fp);
+        for (y = 0; y < image->height; y++) {
+            fwrite(image->imageData + y * image->widthStep,
+                    image->width * image->nChannels, 1, fp);
+        }
+    } else {
+        unsigned int empty = 0;
+        fwrite(&empty, sizeof(empty), 1, fp);
+    }
+}
+
+static void
+tracker_trace_write(TraceEvent *event)
+{
+    if (event->type == Trace_CLEAR && tracker_trace.fp) {
+        fclose(tracker_trace.fp);
+        tracker_trace.fp = NULL;
+    }
+
+    FILE *fp = tracker_trace_file();
+    if (!fp) {
+        return;
+    }
+
+    if (tracker_trace.binary) {
+        tracker_trace_write_record(fp, event);
+    } else if (event->type == Trace_TEXT) {
+        fputs(event->text, fp);
+    } else if (event->type == Trace_IMAGE) {
+        char *filename = psmove_util_get_file_path(event->text);
+        th_save_jpg(filename, event->image, 100);
+        free(filename);
+    }
+}
+
+static size_t
+tracker_trace_event_size(TraceEvent *event)
+{
+    return sizeof(TraceEvent) + (event->image ? event->image->imageSize : 0);
+}
+
+static void
+tracker_trace_event_free(TraceEvent *event)
+{
+    if (event->image) {
+        cvReleaseImage(&event->image);
+    }
+    free(event->text);
+    free(event);
+}
+
+#ifdef PSMOVE_USE_PTHREADS
+static void *
+tracker_trace_writer(void *data)
+{
+    pthread_mutex_lock(&tracker_trace.mutex);
+    while (1) {
+        while (!tracker_trace.head) {
+            // flush once the queue is drained, so the files are complete when idle
+            if (tracker_trace.fp) {
+                fflush(tracker_trace.fp);
+            }
+            pthread_cond_broadcast(&tracker_trace.idle);
+            pthread_cond_wait(&tracker_trace.cond, &tracker_trace.mutex);
+        }
+
+        TraceEvent *event = tracker_trace.head;
+        tracker_trace.head = event->next;
+        if (!tracker_trace.head) {
+            tracker_trace.tail = NULL;
+        }
+        tracker_trace.busy = 1;
+        pthread_mutex_unlock(&tracker_trace.mutex);
+
+        // encoding and writing happens without the lock, so the tracker can keep queueing
+        tracker_trace_write(event);
+
+        pthread_mutex_lock(&tracker_trace.mutex);
+        tracker_trace.busy = 0;
+        tracker_trace.queued_bytes -= tracker_trace_event_size(event);
+        tracker_trace_event_free(event);
+    }
+
+    return NULL;
+}
+
+/* Wait until all queued events are written (at exit, so no trace is lost) */
+static void
+tracker_trace_flush()
+{
+    pthread_mutex_lock(&tracker_trace.mutex);
+    while (tracker_trace.head || tracker_trace.busy) {
+        pthread_cond_wait(&tracker_trace.idle, &tracker_trace.mutex);
+    }
+    if (tracker_trace.fp) {
+        fflush(tracker_trace.fp);
+    }
+    pthread_mutex_unlock(&tracker_trace.mutex);
+}
+
+static pthread_once_t tracker_trace_once = PTHREAD_ONCE_INIT;
+#endif
+
+static void
+tracker_trace_init_once()
+{
+    char *format = getenv(PSMOVE_TRACKER_TRACE_FORMAT_ENV);
+    tracker_trace.binary = (format && strcmp(format, "binary") == 0);
+
+    char *images = getenv(PSMOVE_TRACKER_TRACE_IMAGES_ENV);
+    tracker_trace.image_interval = images ? atoi(images) : 1;
+
+#ifdef PSMOVE_USE_PTHREADS
+    pthread_mutex_init(&tracker_trace.mutex, NULL);
+    pthread_cond_init(&tracker_trace.cond, NULL);
+    pthread_cond_init(&tracker_trace.idle, NULL);
+    if (pthread_create(&tracker_trace.thread, NULL, tracker_trace_writer, NULL) == 0) {
+        pthread_detach(tracker_trace.thread);
+        atexit(tracker_trace_flush);
+        tracker_trace.initialized = 1;
+    }
+#else
+    tracker_trace.initialized = 1;
+#endif
+}
+
+static void
+tracker_trace_init()
+{
+#ifdef PSMOVE_USE_PTHREADS
+    pthread_once(&tracker_trace_once, tracker_trace_init_once);
+#else
+    if (!tracker_trace.initialized) {
+        tracker_trace_init_once();
+    }
+#endif
+}
+
+/* Queues the event (takes ownership), returns 0 if it has been dropped */
+static int
+tracker_trace_push(TraceEvent *event)
+{
+    tracker_trace_init();
+    event->timestamp_us = psmove_util_get_ticks_us();
+    event->next = NULL;
+
+#ifdef PSMOVE_USE_PTHREADS
+    if (tracker_trace.initialized) {
+        pthread_mutex_lock(&tracker_trace.mutex);
+        size_t size = tracker_trace_event_size(event);
+        if (event->image && tracker_trace.queued_bytes + size > TRACE_QUEUE_MAX_BYTES) {
+            tracker_trace.dropped++;
+            pthread_mutex_unlock(&tracker_trace.mutex);
+            tracker_trace_event_free(event);
+            return 0;
+        }
+
+        if (tracker_trace.tail) {
+            tracker_trace.tail->next = event;
+        } else {
+            tracker_trace.head = event;
+        }
+        tracker_trace.tail = event;
+        tracker_trace.queued_bytes += size;
+        pthread_cond_signal(&tracker_trace.cond);
+        pthread_mutex_unlock(&tracker_trace.mutex);
+        return 1;
+    }
+#endif
+
+    // no writer thread: write it right away
+    tracker_trace_write(event);
+    if (tracker_trace.fp) {
+        fflush(tracker_trace.fp);
+    }
+    tracker_trace_event_free(event);
+    return 1;
+}
+
+static void
+tracker_trace_printf(const char *fmt, ...)
+{
+    TraceEvent *event = (TraceEvent *)calloc(1, sizeof(TraceEvent));
+    va_list args;
+
+    va_start(args, fmt);
+    int length = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    event->type = Trace_TEXT;
+    event->text = (char *)malloc(length + 1);
+    va_start(args, fmt);
+    vsnprintf(event->text, length + 1, fmt, args);
+    va_end(args);
+
+    tracker_trace_push(event);
+}
+
+/* Queues a copy of the image, returns 0 if it is not written (sampling or queue full) */
+static int
+tracker_trace_image(IplImage *image, const char *img_name)
+{
+    tracker_trace_init();
+    /* Called from the tracker's worker threads as well */
+    if (tracker_trace.image_interval <= 0 ||
+            (__atomic_fetch_add(&tracker_trace.image_calls, 1, __ATOMIC_RELAXED) %
+             (unsigned int)tracker_trace.image_interval) != 0) {
+        return 0;
+    }
+
+    TraceEvent *event = (TraceEvent *)calloc(1, sizeof(TraceEvent));
+    event->type = Trace_IMAGE;
+    event->text = strdup(img_name);
+    event->image = cvCloneImage(image);
+    return tracker_trace_push(event);
 }
 
 
@@ -71,10 +348,10 @@ void
 psmove_html_trace_clear()
 {
     tracker_trace.img_count = 0;
-    if (tracker_trace.fp) {
-        fclose(tracker_trace.fp);
-        tracker_trace.fp = NULL;
-    }
+
+    TraceEvent *event = (TraceEvent *)calloc(1, sizeof(TraceEvent));
+    event->type = Trace_CLEAR;
+    tracker_trace_push(event);
 
     time_t rawtime;
     struct tm* timeinfo;
@@ -83,17 +360,14 @@ psmove_html_trace_clear()
     timeinfo=localtime(&rawtime);
     strftime(texttime,256,"%Y-%m-%d / %H:%M:%S",timeinfo);
 
-    FILE *pFile = tracker_trace_file();
-    if (pFile) {
-        fputs("originals = new Array();\n", pFile);
-        fputs("rawdiffs = new Array();\n", pFile);
-        fputs("threshdiffs = new Array();\n", pFile);
-        fputs("erodediffs = new Array();\n", pFile);
-        fputs("finaldiff = new Array();\n", pFile);
-        fputs("filtered = new Array();\n", pFile);
-        fputs("contours = new Array();\n", pFile);
-        fputs("log_table = new Array();\n\n", pFile);
-    }
+    tracker_trace_printf("originals = new Array();\n"
+            "rawdiffs = new Array();\n"
+            "threshdiffs = new Array();\n"
+            "erodediffs = new Array();\n"
+            "finaldiff = new Array();\n"
+            "filtered = new Array();\n"
+            "contours = new Array();\n"
+            "log_table = new Array();\n\n");
 
     psmove_html_trace_put_text_var("time",texttime);
 }
@@ -103,11 +377,11 @@ psmove_html_trace_image_at(IplImage *image, int index, char* target)
 {
     char img_name[256];
 
-    // write image to file sysxtem
+    // queue the image for the file system
     sprintf(img_name, "image_%d.jpg", tracker_trace.img_count);
-    char *filename = psmove_util_get_file_path(img_name);
-    th_save_jpg(filename, image, 100);
-    free(filename);
+    if (!tracker_trace_image(image, img_name)) {
+        return;
+    }
 
     tracker_trace.img_count++;
 
@@ -119,11 +393,11 @@ void
 psmove_html_trace_image(IplImage *image, char* var, int no_js_var)
 {
     char img_name[256];
-    // write image to file sysxtem
+    // queue the image for the file system
     sprintf(img_name, "image_%s.jpg", var);
-    char *filename = psmove_util_get_file_path(img_name);
-    th_save_jpg(filename, image, 100);
-    free(filename);
+    if (!tracker_trace_image(image, img_name)) {
+        return;
+    }
 
     // write image-name to java variable (if desired)
     if (!no_js_var) {
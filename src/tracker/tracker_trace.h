@@ -33,6 +33,22 @@
 
 #define USE_TRACKER_TRACE
 
+/**
+ * Trace events are queued and written by a background thread (synchronously
+ * if there are no threads), so tracing does not stall the tracker. Images are
+ * copied when queued; if too many are pending, new ones are dropped.
+ *
+ * In the binary format (see PSMOVE_TRACKER_TRACE_FORMAT_ENV), debug.trace
+ * is a sequence of little-endian records:
+ *
+ *     uint8 type, int64 timestamp (us, see psmove_util_get_ticks_us),
+ *     uint32 name length, name
+ *
+ * followed by the JavaScript statement (type 1: uint32 length, text) or the
+ * raw pixels of an image (type 2: int32 width, height, channels, then the
+ * rows without padding). A clear (type 3) has no payload.
+ **/
+
 #ifndef USE_TRACKER_TRACE
 #    define psmove_html_trace_image(image, name, no_js_var)
 #    define psmove_html_trace_image_at(image, index, target)
@@ -27,12 +27,45 @@
  * POSSIBILITY OF SUCH DAMAGE.
  **/
 
+
 #include "moved.h"
 
 #include "../psmove_private.h"
 
 #define LOG(format, ...) fprintf(stderr, "moved:" format, __VA_ARGS__)
 
+#if defined(PSMOVE_USE_TRACE)
+#  include <signal.h>
+
+/* Exit normally when stopped, so that PSMOVE_TRACE_FILE gets written */
+static void
+moved_trace_exit(int signum)
+{
+    exit(0);
+}
+#endif
+
+#if defined(PSMOVE_USE_PTHREADS)
+/* How long the reader threads wait for a report before checking for exit */
+#  define MOVED_READER_TIMEOUT_MS 100
+
+#  define psmove_dev_lock(dev) pthread_mutex_lock(&((dev)->mutex))
+#  define psmove_dev_unlock(dev) pthread_mutex_unlock(&((dev)->mutex))
+#  define moved_lock(moved) pthread_mutex_lock(&((moved)->mutex))
+#  define moved_unlock(moved) pthread_mutex_unlock(&((moved)->mutex))
+#else
+#  define psmove_dev_lock(dev)
+#  define psmove_dev_unlock(dev)
+#  define moved_lock(moved)
+#  define moved_unlock(moved)
+#endif
+
+
+#if defined(PSMOVE_USE_PTHREADS)
+static void
+moved_hotplug(enum PSMove_Hotplug_Event event, const char *serial,
+        enum PSMove_Connection_Type type, void *user_data);
+#endif
 
 int
 main(int argc, char *argv[])
@@ -43,23 +76,135 @@ main(int argc, char *argv[])
     /* Never act as a client in "moved" mode */
     _psmove_disable_remote();
 
+#if defined(PSMOVE_USE_TRACE)
+    signal(SIGINT, moved_trace_exit);
+    signal(SIGTERM, moved_trace_exit);
+#endif
+
     int id, count=psmove_count_connected();
     LOG("%d devices connected\n", count);
     for (id=0; id<count; id++) {
         moved_handle_connection(moved, id);
     }
 
+#if defined(PSMOVE_USE_PTHREADS)
+    /**
+     * The devices are read and written by their own threads, so requests
+     * can be answered from the cached reports as soon as they arrive
+     **/
+    moved_server_start(server);
+
+    /* Devices connected later get a free slot (see moved_add_device) */
+    psmove_set_hotplug_callback(moved_hotplug, moved);
+
     while (1) {
         moved_server_handle_request(server);
+    }
+#else
+    while (1) {
+        if (moved_server_wait(server)) {
+            moved_server_handle_request(server);
+        }
+        moved_server_push_reports(server);
         moved_write_reports(moved);
     }
+#endif
 
-    moved_server_destroy(server);
     moved_destroy(moved);
+    moved_server_destroy(server);
 
     return 0;
 }
 
+static void
+moved_server_pack_uint32(unsigned char *out, unsigned int value)
+{
+    out[0] = (value >> 24) & 0xFF;
+    out[1] = (value >> 16) & 0xFF;
+    out[2] = (value >> 8) & 0xFF;
+    out[3] = value & 0xFF;
+}
+
+static void
+moved_server_pack_uint64(unsigned char *out, long long value)
+{
+    moved_server_pack_uint32(out, (unsigned long long)value >> 32);
+    moved_server_pack_uint32(out + 4, value & 0xFFFFFFFF);
+}
+
+/* Count an event for the rate (see MOVED_STATS_RATE_WINDOW_MS) */
+static void
+moved_rate_tick(moved_rate *rate, long now)
+{
+    long elapsed = now - rate->start_ms;
+
+    rate->count++;
+    if (elapsed >= MOVED_STATS_RATE_WINDOW_MS) {
+        rate->rate = (unsigned int)(rate->count * 100000LL / elapsed);
+        rate->start_ms = now;
+        rate->count = 0;
+    }
+}
+
+/* The current rate, 0 if there were no events for two windows */
+static unsigned int
+moved_rate_get(moved_rate *rate, long now)
+{
+    if (now - rate->start_ms > 2 * MOVED_STATS_RATE_WINDOW_MS) {
+        return 0;
+    }
+    return rate->rate;
+}
+
+/* Remember the client that sent a request for the slots in "slots" */
+static void
+moved_note_peer(move_daemon *moved, const struct sockaddr_in *addr,
+        unsigned int slots, long now)
+{
+    moved_peer *peer = &(moved->peers[0]);
+    int i;
+
+    for (i=0; i<MOVED_STATS_MAX_PEERS; i++) {
+        moved_peer *other = &(moved->peers[i]);
+        if (other->seen_ms != 0 &&
+                other->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+                other->addr.sin_port == addr->sin_port) {
+            peer = other;
+            break;
+        }
+
+        /* Otherwise, replace the entry that has been idle the longest */
+        if (other->seen_ms < peer->seen_ms) {
+            peer = other;
+        }
+    }
+
+    if (i == MOVED_STATS_MAX_PEERS) {
+        peer->addr = *addr;
+        peer->slots = 0;
+    }
+
+    peer->seen_ms = now;
+    peer->slots |= slots;
+}
+
+/* The number of recent clients that used one of the slots in "slots" */
+static int
+moved_count_peers(move_daemon *moved, unsigned int slots, long now)
+{
+    int i, count = 0;
+
+    for (i=0; i<MOVED_STATS_MAX_PEERS; i++) {
+        moved_peer *peer = &(moved->peers[i]);
+        if (peer->seen_ms != 0 && (peer->slots & slots) &&
+                now - peer->seen_ms <= MOVED_SUBSCRIPTION_TIMEOUT_MS) {
+            count++;
+        }
+    }
+
+    return count;
+}
+
 moved_server *
 moved_server_create()
 {
@@ -84,70 +229,690 @@ moved_server_handle_request(moved_server *server)
     struct sockaddr_in si_other;
     unsigned int si_len = sizeof(si_other);
 
+    move_daemon *moved = server->moved;
     psmove_dev *dev = NULL;
+    int slot;
     int count = 0;
     int send_response = 0;
 
     int request_id = -1, device_id = -1;
-    unsigned char request[MOVED_SIZE_REQUEST] = {0};
-    unsigned char response[MOVED_SIZE_READ_RESPONSE] = {0};
+    unsigned char request[MOVED_SIZE_WRITE_ACKED] = {0};
+    unsigned char response[MOVED_SIZE_READ_ALL_RESPONSE] = {0};
+    int response_size = MOVED_SIZE_READ_RESPONSE + MOVED_SIZE_RESPONSE_SEQ;
 
     assert(recvfrom(server->socket, request, sizeof(request),
                 0, (struct sockaddr *)&si_other, &si_len) != -1);
+    long long received_us = psmove_util_get_ticks_us();
+    PSMOVE_TRACE_BEGIN("moved_request");
 
     request_id = request[0];
     device_id = request[1];
 
+    /* Echo the sequence number (see MOVED_SIZE_RESPONSE_SEQ) */
+    response[MOVED_SIZE_READ_RESPONSE] = request[MOVED_SIZE_REQUEST-2];
+    response[MOVED_SIZE_READ_RESPONSE+1] = request[MOVED_SIZE_REQUEST-1];
+
+    /* Devices are only removed while the slots are locked */
+    moved_lock(moved);
+
+    long now = psmove_util_get_ticks();
+    moved->requests++;
+    moved_rate_tick(&(moved->request_rate), now);
+    if (request_id == MOVED_REQ_WRITE || request_id == MOVED_REQ_WRITE_ACKED ||
+            request_id == MOVED_REQ_SUBSCRIBE || request_id == MOVED_REQ_READ) {
+        moved_note_peer(moved, &si_other,
+                1 << MOVED_DEVICE_SLOT(device_id), now);
+    } else if (request_id == MOVED_REQ_READ_ALL) {
+        moved_note_peer(moved, &si_other, ~0u, now);
+    } else {
+        moved_note_peer(moved, &si_other, 0, now);
+    }
+
     switch (request_id) {
         case MOVED_REQ_COUNT_CONNECTED:
-            for each (dev, server->moved->devs) {
-                count++;
+            response[0] = moved->slots;
+            for (slot=0; slot<moved->slots; slot++) {
+                if (moved->devs[slot] != NULL) {
+                    response[1+slot] = MOVED_DEVICE_ID(slot,
+                            moved->generations[slot]);
+                }
             }
-            response[0] = count;
 
             send_response = 1;
             break;
         case MOVED_REQ_WRITE:
-            for each (dev, server->moved->devs) {
-                if (count == device_id) {
-                    break;
-                }
-                count++;
+            dev = moved_find_device(moved, device_id);
+
+            if (dev != NULL) {
+                moved_set_output(moved, dev, request+2);
+            } else {
+                LOG("Cannot write to device %d.\n", device_id);
             }
+            break;
+        case MOVED_REQ_WRITE_ACKED:
+            dev = moved_find_device(moved, device_id);
 
             if (dev != NULL) {
-                psmove_dev_set_output(dev, request+2);
+                moved_set_output(moved, dev, request+2);
             } else {
                 LOG("Cannot write to device %d.\n", device_id);
             }
+
+            response[0] = MOVED_WRITE_ACK;
+            response[1] = device_id;
+            response[2] = request[MOVED_SIZE_WRITE_ACKED-2];
+            response[3] = request[MOVED_SIZE_WRITE_ACKED-1];
+            response[4] = (dev != NULL);
+            response_size = MOVED_SIZE_WRITE_ACK;
+
+            send_response = 1;
             break;
-        case MOVED_REQ_READ:
-            for each (dev, server->moved->devs) {
-                if (count == device_id) {
-                    break;
+        case MOVED_REQ_SUBSCRIBE:
+            dev = moved_find_device(moved, device_id);
+
+            if (dev != NULL) {
+                /* The reports are the response (see moved_server_push_reports) */
+                psmove_dev_lock(dev);
+                if (request[2] && !dev->subscribed) {
+                    LOG("Pushing reports of device %d.\n", device_id);
+                }
+
+                int format = MOVED_PUSH_INPUT;
+                if (request[4] == 1) {
+                    format = MOVED_PUSH_STATE;
+                    if (!moved->orientation) {
+                        LOG("Orientation of device %d is not computed.\n",
+                                device_id);
+                    }
+                } else if (request[3] == 1) {
+                    format = MOVED_PUSH_COMPACT;
+                }
+
+                /* A new subscriber has to start with a key frame */
+                if (!dev->subscribed || dev->subscriber_format != format ||
+                        memcmp(&(dev->subscriber), &si_other,
+                            sizeof(si_other)) != 0) {
+                    memset(&(dev->subscriber_state), 0,
+                            sizeof(dev->subscriber_state));
                 }
-                count++;
+
+                dev->subscribed = (request[2] != 0);
+                dev->subscriber_format = format;
+                dev->subscriber_timestamps = (request[5] == 1);
+                dev->subscriber = si_other;
+                dev->subscribed_ms = psmove_util_get_ticks();
+                psmove_dev_unlock(dev);
+            } else {
+                LOG("Cannot subscribe to device %d.\n", device_id);
             }
+            break;
+        case MOVED_REQ_READ:
+            dev = moved_find_device(moved, device_id);
 
             if (dev != NULL) {
-                _psmove_read_data(dev->move, dev->input, sizeof(dev->input));
+                psmove_dev_lock(dev);
+                psmove_dev_poll(dev);
                 memcpy(response, dev->input, sizeof(dev->input));
+                psmove_dev_unlock(dev);
             } else {
                 LOG("Cannot read from device %d.\n", device_id);
             }
 
+            send_response = 1;
+            break;
+        case MOVED_REQ_READ_ALL:
+            response[0] = MOVED_READ_ALL_RESPONSE;
+            response[2] = request[MOVED_SIZE_REQUEST-2];
+            response[3] = request[MOVED_SIZE_REQUEST-1];
+            response_size = MOVED_SIZE_READ_ALL_HEADER;
+
+            for (slot=0; slot<moved->slots; slot++) {
+                dev = moved->devs[slot];
+                if (dev == NULL || count == MOVED_READ_ALL_MAX) {
+                    continue;
+                }
+
+                psmove_dev_lock(dev);
+                if (psmove_dev_poll(dev)) {
+                    moved_server_pack_report(dev, slot,
+                            response + response_size);
+                    response_size += MOVED_SIZE_REPORT_ENTRY;
+                    response[1]++;
+                    count++;
+                }
+                psmove_dev_unlock(dev);
+            }
+
+            send_response = 1;
+            break;
+        case MOVED_REQ_TIME:
+            response[0] = MOVED_TIME_RESPONSE;
+            response[2] = request[MOVED_SIZE_REQUEST-2];
+            response[3] = request[MOVED_SIZE_REQUEST-1];
+            moved_server_pack_uint64(response + 4, received_us);
+            response_size = MOVED_SIZE_TIME_RESPONSE;
+
+            send_response = 1;
+            break;
+        case MOVED_REQ_STATS:
+            dev = moved_find_device(moved, device_id);
+            response_size = moved_server_pack_stats(moved, dev, device_id,
+                    response);
+            response[2] = request[MOVED_SIZE_REQUEST-2];
+            response[3] = request[MOVED_SIZE_REQUEST-1];
+
             send_response = 1;
             break;
         default:
+            moved_unlock(moved);
             LOG("Unsupported call: %x - ignoring.\n", request_id);
+            PSMOVE_TRACE_END("moved_request");
             return;
     }
 
+    moved_unlock(moved);
+
     /* Some requests need a response - send it here */
     if (send_response) {
-        assert(sendto(server->socket, response, sizeof(response),
+        if (request_id == MOVED_REQ_TIME) {
+            /* As late as possible, so the client can subtract our delay */
+            moved_server_pack_uint64(response + 12, psmove_util_get_ticks_us());
+        }
+
+        assert(sendto(server->socket, response, response_size,
                 0, (struct sockaddr *)&si_other, si_len) != -1);
     }
+    PSMOVE_TRACE_END("moved_request");
+}
+
+void
+moved_server_pack_report(psmove_dev *dev, int device_id, unsigned char *entry)
+{
+    entry[0] = device_id;
+    entry[1] = (dev->push_seq >> 24) & 0xFF;
+    entry[2] = (dev->push_seq >> 16) & 0xFF;
+    entry[3] = (dev->push_seq >> 8) & 0xFF;
+    entry[4] = dev->push_seq & 0xFF;
+    memcpy(entry + 5, dev->input + 1, MOVED_SIZE_INPUT);
+}
+
+int
+moved_server_pack_push(psmove_dev *dev, int device_id, int format,
+        moved_compact_state *compact, unsigned char *push)
+{
+    switch (format) {
+        case MOVED_PUSH_COMPACT:
+            return moved_compact_encode(compact, device_id, dev->push_seq,
+                    dev->input + 1, push);
+        case MOVED_PUSH_STATE:
+            return moved_server_pack_state(dev, device_id, push);
+        default:
+            push[0] = MOVED_PUSH_INPUT;
+            moved_server_pack_report(dev, device_id, push + 1);
+            return MOVED_SIZE_PUSH;
+    }
+}
+
+int
+moved_server_pack_timestamp(psmove_dev *dev, unsigned char *push, int len)
+{
+    /* The buffer has MOVED_SIZE_TIMESTAMP bytes after the datagram */
+    if (push[0] == MOVED_PUSH_COMPACT) {
+        push[4] |= MOVED_COMPACT_TIMESTAMP;
+    }
+
+    moved_server_pack_uint64(push + len, dev->input_time_us);
+    return len + MOVED_SIZE_TIMESTAMP;
+}
+
+static void
+moved_server_pack_floats(unsigned char *out, const float *values, int count)
+{
+    unsigned int bits;
+    int i;
+
+    for (i=0; i<count; i++) {
+        memcpy(&bits, &(values[i]), sizeof(bits));
+        moved_server_pack_uint32(out + 4 * i, bits);
+    }
+}
+
+/**
+ * Must be called by the thread that reads the device (the values are
+ * those of the report that was read last)
+ **/
+int
+moved_server_pack_state(psmove_dev *dev, int device_id, unsigned char *push)
+{
+    /* Accelerometer, gyroscope, orientation quaternion */
+    float values[10] = { 0, 0, 0, 0, 0, 0, 1, 0, 0, 0 };
+
+    push[0] = MOVED_PUSH_STATE;
+    push[1] = device_id;
+    moved_server_pack_uint32(push + 2, dev->push_seq);
+    moved_server_pack_uint32(push + 6, psmove_get_buttons(dev->move));
+    push[10] = psmove_get_trigger(dev->move);
+    push[11] = psmove_get_battery(dev->move);
+    push[12] = 0;
+
+    if (psmove_has_calibration(dev->move)) {
+        push[12] |= MOVED_STATE_CALIBRATED;
+        psmove_get_accelerometer_frame(dev->move, Frame_SecondHalf,
+                &values[0], &values[1], &values[2]);
+        psmove_get_gyroscope_frame(dev->move, Frame_SecondHalf,
+                &values[3], &values[4], &values[5]);
+    }
+
+    if (psmove_has_orientation(dev->move)) {
+        push[12] |= MOVED_STATE_ORIENTATION;
+        psmove_get_orientation(dev->move,
+                &values[6], &values[7], &values[8], &values[9]);
+    }
+
+    moved_server_pack_floats(push + 13, values, 10);
+
+    return MOVED_SIZE_PUSH_STATE;
+}
+
+static int
+moved_compare_uint(const void *a, const void *b)
+{
+    unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+    return (x > y) - (x < y);
+}
+
+int
+moved_server_pack_stats(move_daemon *moved, psmove_dev *dev, int device_id,
+        unsigned char *response)
+{
+    /* The slots are locked by the caller (see moved_server_handle_request) */
+    unsigned int values[MOVED_STATS_COUNT] = {0};
+    unsigned int latencies[MOVED_STATS_LATENCY_SAMPLES];
+    long now = psmove_util_get_ticks();
+    int slot, i, count = 0;
+
+    values[MOVED_STATS_UPTIME_S] = (now - moved->started_ms) / 1000;
+    values[MOVED_STATS_REQUESTS] = moved->requests;
+    values[MOVED_STATS_REQUEST_RATE] = moved_rate_get(&(moved->request_rate),
+            now);
+    values[MOVED_STATS_CLIENTS] = moved_count_peers(moved, ~0u, now);
+    for (slot=0; slot<moved->slots; slot++) {
+        if (moved->devs[slot] != NULL) {
+            values[MOVED_STATS_DEVICES]++;
+            values[MOVED_STATS_PENDING_OUTPUTS] +=
+                moved->devs[slot]->dirty_output;
+        }
+    }
+
+    if (dev != NULL) {
+        psmove_dev_lock(dev);
+        values[MOVED_STATS_REPORTS] = dev->stats.psmove.reports;
+        values[MOVED_STATS_REPORT_RATE] = moved_rate_get(
+                &(dev->stats.report_rate), now);
+        values[MOVED_STATS_DROPPED_REPORTS] =
+            dev->stats.psmove.dropped_reports;
+        values[MOVED_STATS_SUBSCRIBED] = dev->subscribed;
+
+        count = dev->stats.latencies;
+        if (count > MOVED_STATS_LATENCY_SAMPLES) {
+            count = MOVED_STATS_LATENCY_SAMPLES;
+        }
+        memcpy(latencies, dev->stats.latency_us, count * sizeof(latencies[0]));
+        psmove_dev_unlock(dev);
+
+        values[MOVED_STATS_WRITES] = dev->stats.writes;
+        values[MOVED_STATS_COALESCED_WRITES] = dev->stats.coalesced_writes;
+        values[MOVED_STATS_QUEUED_REPORTS] = _psmove_get_queued_reports(
+                dev->move);
+        values[MOVED_STATS_DEVICE_CLIENTS] = moved_count_peers(moved,
+                1 << dev->slot, now);
+
+        if (count > 0) {
+            qsort(latencies, count, sizeof(latencies[0]), moved_compare_uint);
+            values[MOVED_STATS_LATENCY_P50] = latencies[(count - 1) * 50 / 100];
+            values[MOVED_STATS_LATENCY_P95] = latencies[(count - 1) * 95 / 100];
+            values[MOVED_STATS_LATENCY_P99] = latencies[(count - 1) * 99 / 100];
+        }
+    }
+
+    response[0] = MOVED_STATS_RESPONSE;
+    response[1] = device_id;
+    response[4] = (dev != NULL);
+    for (i=0; i<MOVED_STATS_COUNT; i++) {
+        moved_server_pack_uint32(response + MOVED_SIZE_STATS_HEADER + 4 * i,
+                values[i]);
+    }
+
+    return MOVED_SIZE_STATS_RESPONSE;
+}
+
+int
+moved_server_wait(moved_server *server)
+{
+    move_daemon *moved = server->moved;
+    psmove_dev *dev;
+    fd_set fds;
+    int max_fd = server->socket;
+    int subscribed = 0;
+    int slot;
+
+    FD_ZERO(&fds);
+    FD_SET(server->socket, &fds);
+
+    for (slot=0; slot<moved->slots; slot++) {
+        dev = moved->devs[slot];
+        if (dev != NULL && (dev->subscribed || moved->multicast)) {
+            int fd = psmove_get_fd(dev->move);
+            if (fd != -1) {
+                FD_SET(fd, &fds);
+                if (fd > max_fd) {
+                    max_fd = fd;
+                }
+            }
+            subscribed = 1;
+        }
+    }
+
+    /* Without subscribers, there is nothing to do until a request comes */
+    if (!subscribed) {
+        return 1;
+    }
+
+    /**
+     * Wake up for requests and for new reports (devices without a file
+     * descriptor are polled every millisecond)
+     **/
+    struct timeval timeout = { 0, 1000 };
+    if (select(max_fd + 1, &fds, NULL, NULL, &timeout) <= 0) {
+        return 0;
+    }
+
+    return FD_ISSET(server->socket, &fds);
+}
+
+void
+moved_server_push_reports(moved_server *server)
+{
+    move_daemon *moved = server->moved;
+    psmove_dev *dev;
+    unsigned char push[MOVED_SIZE_PUSH + MOVED_SIZE_TIMESTAMP];
+    unsigned char group[MOVED_SIZE_COMPACT_MAX + MOVED_SIZE_TIMESTAMP];
+    unsigned char state[MOVED_SIZE_PUSH_STATE + MOVED_SIZE_TIMESTAMP];
+    long now = psmove_util_get_ticks();
+    int slot;
+
+    for (slot=0; slot<moved->slots; slot++) {
+        dev = moved->devs[slot];
+        if (dev == NULL) {
+            continue;
+        }
+
+        if (dev->subscribed &&
+                now - dev->subscribed_ms > MOVED_SUBSCRIPTION_TIMEOUT_MS) {
+            LOG("Subscription of device %d expired.\n", slot);
+            dev->subscribed = 0;
+        }
+
+        /* Push all reports that have arrived since the last call */
+        while (dev->subscribed || moved->multicast) {
+            _psmove_read_data(dev->move, dev->input, sizeof(dev->input));
+            if (dev->input[0] == 0) {
+                break;
+            }
+
+            dev->push_seq++;
+            psmove_dev_account_report(dev);
+
+            if (dev->subscribed) {
+                int len = moved_server_pack_push(dev, slot,
+                        dev->subscriber_format, &(dev->subscriber_state),
+                        push);
+                if (dev->subscriber_timestamps) {
+                    len = moved_server_pack_timestamp(dev, push, len);
+                }
+                if (sendto(server->socket, push, len, 0,
+                            (struct sockaddr *)&(dev->subscriber),
+                            sizeof(dev->subscriber)) == -1) {
+                    LOG("Cannot push to device %d's subscriber.\n", slot);
+                    dev->subscribed = 0;
+                }
+            }
+
+            if (moved->multicast) {
+                int len = moved_server_pack_push(dev, slot,
+                        MOVED_PUSH_COMPACT, &(dev->multicast_state), group);
+                len = moved_server_pack_timestamp(dev, group, len);
+                sendto(server->socket, group, len, 0,
+                        (struct sockaddr *)&(moved->multicast_addr),
+                        sizeof(moved->multicast_addr));
+            }
+
+            if (moved->multicast && moved->orientation) {
+                int len = moved_server_pack_state(dev, slot, state);
+                len = moved_server_pack_timestamp(dev, state, len);
+                sendto(server->socket, state, len, 0,
+                        (struct sockaddr *)&(moved->multicast_addr),
+                        sizeof(moved->multicast_addr));
+            }
+        }
+    }
+}
+
+#if defined(PSMOVE_USE_PTHREADS)
+static void *
+psmove_dev_reader_proc(void *user_data)
+{
+    psmove_dev *dev = (psmove_dev *)user_data;
+    unsigned char input[MOVED_SIZE_READ_RESPONSE];
+    unsigned char push[MOVED_SIZE_PUSH + MOVED_SIZE_TIMESTAMP];
+    unsigned char group[MOVED_SIZE_COMPACT_MAX + MOVED_SIZE_TIMESTAMP];
+    unsigned char state[MOVED_SIZE_PUSH_STATE + MOVED_SIZE_TIMESTAMP];
+    struct sockaddr_in subscriber;
+    int running = 1;
+
+    PSMOVE_TRACE_THREAD_NAME("moved reader");
+
+    while (running) {
+        int push_len = 0, group_len = 0, state_len = 0;
+
+        _psmove_read_data_timeout(dev->move, input, sizeof(input),
+                MOVED_READER_TIMEOUT_MS);
+        PSMOVE_TRACE_BEGIN("moved_push");
+
+        psmove_dev_lock(dev);
+        if (input[0] != 0) {
+            memcpy(dev->input, input, sizeof(dev->input));
+            dev->input_fresh = 1;
+            dev->push_seq++;
+            psmove_dev_account_report(dev);
+
+            if (dev->shm != NULL) {
+                moved_shm_write(dev->shm, dev->slot, dev->push_seq,
+                        dev->input_time_us, dev->input + 1);
+            }
+
+            if (dev->subscribed && psmove_util_get_ticks() -
+                    dev->subscribed_ms > MOVED_SUBSCRIPTION_TIMEOUT_MS) {
+                LOG("Subscription of device %d expired.\n", dev->slot);
+                dev->subscribed = 0;
+            }
+
+            if (dev->subscribed) {
+                push_len = moved_server_pack_push(dev, dev->slot,
+                        dev->subscriber_format, &(dev->subscriber_state),
+                        push);
+                if (dev->subscriber_timestamps) {
+                    push_len = moved_server_pack_timestamp(dev, push,
+                            push_len);
+                }
+                subscriber = dev->subscriber;
+            }
+
+            if (dev->multicast != NULL) {
+                group_len = moved_server_pack_push(dev, dev->slot,
+                        MOVED_PUSH_COMPACT, &(dev->multicast_state), group);
+                group_len = moved_server_pack_timestamp(dev, group,
+                        group_len);
+
+                if (psmove_has_orientation(dev->move)) {
+                    state_len = moved_server_pack_state(dev, dev->slot, state);
+                    state_len = moved_server_pack_timestamp(dev, state,
+                            state_len);
+                }
+            }
+        }
+        running = dev->reader_running;
+        psmove_dev_unlock(dev);
+
+        /* The same datagram goes to all clients that joined the group */
+        if (group_len > 0) {
+            sendto(dev->socket, group, group_len, 0,
+                    (struct sockaddr *)dev->multicast,
+                    sizeof(*(dev->multicast)));
+        }
+
+        if (state_len > 0) {
+            sendto(dev->socket, state, state_len, 0,
+                    (struct sockaddr *)dev->multicast,
+                    sizeof(*(dev->multicast)));
+        }
+
+        /* Push outside of the lock, so that requests are not held up */
+        if (push_len > 0 && sendto(dev->socket, push, push_len, 0,
+                    (struct sockaddr *)&subscriber,
+                    sizeof(subscriber)) == -1) {
+            LOG("Cannot push to device %d's subscriber.\n", dev->slot);
+            psmove_dev_lock(dev);
+            dev->subscribed = 0;
+            psmove_dev_unlock(dev);
+        }
+        PSMOVE_TRACE_END("moved_push");
+    }
+
+    return NULL;
+}
+
+static void
+psmove_dev_start(psmove_dev *dev, move_daemon *moved)
+{
+    dev->socket = moved->socket;
+    dev->multicast = moved->multicast ? &(moved->multicast_addr) : NULL;
+    dev->shm = moved->shm;
+    dev->reader_running = 1;
+    assert(pthread_create(&(dev->reader), NULL,
+                psmove_dev_reader_proc, dev) == 0);
+}
+
+static void *
+moved_writer_proc(void *user_data)
+{
+    move_daemon *moved = (move_daemon *)user_data;
+    psmove_dev *dev;
+    int slot;
+
+    /**
+     * The lock is kept while writing, so devices can't be removed in the
+     * meantime (_psmove_write_data only hands the LEDs to psmove's writer)
+     **/
+    PSMOVE_TRACE_THREAD_NAME("moved writer");
+
+    moved_lock(moved);
+    while (moved->writer_running) {
+        for (slot=0; slot<moved->slots; slot++) {
+            dev = moved->devs[slot];
+            if (dev != NULL && dev->dirty_output) {
+                PSMOVE_TRACE_INSTANT("moved_write");
+                _psmove_write_data(dev->move, dev->output,
+                        sizeof(dev->output));
+                dev->dirty_output = 0;
+                dev->stats.writes++;
+            }
+        }
+
+        pthread_cond_wait(&(moved->cond), &(moved->mutex));
+    }
+    moved_unlock(moved);
+
+    return NULL;
+}
+
+static void
+moved_hotplug(enum PSMove_Hotplug_Event event, const char *serial,
+        enum PSMove_Connection_Type type, void *user_data)
+{
+    move_daemon *moved = (move_daemon *)user_data;
+    int slot, found = -1;
+    int id, count;
+
+    /* USB-connected controllers have no serial and send no input reports */
+    if (type != Conn_Bluetooth) {
+        return;
+    }
+
+    moved_lock(moved);
+    for (slot=0; slot<moved->slots; slot++) {
+        if (moved->devs[slot] != NULL &&
+                strcmp(moved->devs[slot]->serial, serial) == 0) {
+            found = slot;
+            break;
+        }
+    }
+    moved_unlock(moved);
+
+    if (event == Hotplug_Removed) {
+        if (found != -1) {
+            moved_remove_device(moved, found);
+        }
+        return;
+    }
+
+    if (found != -1) {
+        /* Already known (e.g. connected before the callback was set) */
+        return;
+    }
+
+    count = psmove_count_connected();
+    for (id=0; id<count; id++) {
+        PSMove *move = psmove_connect_by_id(id);
+        if (move == NULL) {
+            continue;
+        }
+
+        char *move_serial = psmove_get_serial(move);
+        if (move_serial != NULL && strcmp(move_serial, serial) == 0) {
+            moved_add_device(moved, move);
+            free(move_serial);
+            return;
+        }
+
+        free(move_serial);
+        psmove_disconnect(move);
+    }
+
+    LOG("Cannot connect to new device %s.\n", serial);
+}
+#endif
+
+void
+moved_server_start(moved_server *server)
+{
+#if defined(PSMOVE_USE_PTHREADS)
+    move_daemon *moved = server->moved;
+    int slot;
+
+    moved_lock(moved);
+    moved->socket = server->socket;
+    moved->writer_running = 1;
+    assert(pthread_create(&(moved->writer), NULL,
+                moved_writer_proc, moved) == 0);
+
+    for (slot=0; slot<moved->slots; slot++) {
+        if (moved->devs[slot] != NULL) {
+            psmove_dev_start(moved->devs[slot], moved);
+        }
+    }
+    moved_unlock(moved);
+#endif
 }
 
 void
@@ -159,27 +924,84 @@ moved_server_destroy(moved_server *server)
 
 
 psmove_dev *
-psmove_dev_create(int id)
+psmove_dev_create(PSMove *move)
 {
     psmove_dev *dev = calloc(1, sizeof(psmove_dev));
     assert(dev != NULL);
 
-    dev->move = psmove_connect_by_id(id);
+    dev->move = move;
+    dev->serial = psmove_get_serial(move);
+    if (dev->serial == NULL) {
+        dev->serial = strdup("");
+    }
     psmove_set_rate_limiting(dev->move, 0);
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_init(&(dev->mutex), NULL);
+#endif
     return dev;
 }
 
 void
 psmove_dev_set_output(psmove_dev *dev, const unsigned char *output)
 {
+    if (dev->dirty_output) {
+        /* The previous output has not been written yet */
+        dev->stats.coalesced_writes++;
+    }
     memcpy(dev->output, output, sizeof(dev->output));
     dev->dirty_output = 1;
 }
 
+int
+psmove_dev_poll(psmove_dev *dev)
+{
+#if defined(PSMOVE_USE_PTHREADS)
+    /* The reader thread caches the report, hand it out only once */
+    if (!dev->input_fresh) {
+        dev->input[0] = 0;
+    }
+    dev->input_fresh = 0;
+#else
+    _psmove_read_data(dev->move, dev->input, sizeof(dev->input));
+    if (dev->input[0] != 0) {
+        dev->push_seq++;
+        psmove_dev_account_report(dev);
+    }
+#endif
+    return dev->input[0];
+}
+
+void
+psmove_dev_account_report(psmove_dev *dev)
+{
+    /* Called with the device locked, right after reading a report */
+    dev->input_time_us = _psmove_get_input_time_us(dev->move);
+    long long latency = psmove_util_get_ticks_us() - dev->input_time_us;
+
+    dev->stats.latency_us[dev->stats.latencies %
+        MOVED_STATS_LATENCY_SAMPLES] = (latency > 0) ? latency : 0;
+    dev->stats.latencies++;
+
+    moved_rate_tick(&(dev->stats.report_rate), psmove_util_get_ticks());
+    psmove_get_stats(dev->move, &(dev->stats.psmove));
+}
+
 void
 psmove_dev_destroy(psmove_dev *dev)
 {
+#if defined(PSMOVE_USE_PTHREADS)
+    if (dev->reader_running) {
+        psmove_dev_lock(dev);
+        dev->reader_running = 0;
+        psmove_dev_unlock(dev);
+        pthread_join(dev->reader, NULL);
+    }
+    pthread_mutex_destroy(&(dev->mutex));
+#endif
+
     psmove_disconnect(dev->move);
+    free(dev->serial);
     free(dev);
 }
 
@@ -189,30 +1011,166 @@ moved_init(moved_server *server)
 {
     move_daemon *moved = (move_daemon *)calloc(1, sizeof(move_daemon));
     server->moved = moved;
+    moved->started_ms = psmove_util_get_ticks();
+
+    char *multicast_env = getenv(MOVED_MULTICAST_ENV);
+    if (multicast_env != NULL) {
+        const char *group = MOVED_MULTICAST_GROUP;
+        if (strcmp(multicast_env, "1") != 0 && strcmp(multicast_env, "") != 0) {
+            group = multicast_env;
+        }
+
+        moved->multicast_addr.sin_family = AF_INET;
+        moved->multicast_addr.sin_port = htons(MOVED_MULTICAST_PORT);
+        if (inet_pton(AF_INET, group, &(moved->multicast_addr.sin_addr)) == 1) {
+            LOG("Publishing reports to %s:%d\n", group, MOVED_MULTICAST_PORT);
+            moved->multicast = 1;
+        } else {
+            LOG("Invalid multicast group: '%s'\n", group);
+        }
+    }
+
+    char *orientation_env = getenv(MOVED_ORIENTATION_ENV);
+    if (orientation_env != NULL && strcmp(orientation_env, "1") == 0) {
+        LOG("Computing orientations (%s)\n", MOVED_ORIENTATION_ENV);
+        moved->orientation = 1;
+    }
+
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_mutex_init(&(moved->mutex), NULL);
+    pthread_cond_init(&(moved->cond), NULL);
+    moved->socket = -1;
+
+    /* Written by the reader threads, so only used with them */
+    moved->shm = moved_shm_create();
+    if (moved->shm != NULL) {
+        LOG("Sharing reports with local clients (%s)\n", MOVED_SHM_NAME);
+    }
+#endif
     return moved;
 }
 
 void
 moved_handle_connection(move_daemon *moved, int id)
 {
-    psmove_dev *dev = psmove_dev_create(id);
-    dev->next = moved->devs;
-    moved->devs = dev;
+    PSMove *move = psmove_connect_by_id(id);
+
+    if (move == NULL) {
+        LOG("Cannot connect to device %d\n", id);
+        return;
+    }
+
+    moved_add_device(moved, move);
+}
+
+int
+moved_add_device(move_daemon *moved, PSMove *move)
+{
+    psmove_dev *dev = psmove_dev_create(move);
+    int slot;
 
-    LOG("New device %d\n", id);
+    if (moved->orientation) {
+        psmove_enable_orientation(move, PSMove_True);
+        if (!psmove_has_orientation(move)) {
+            LOG("No orientation for device %s (not calibrated?)\n",
+                    dev->serial);
+        }
+    }
+
+    moved_lock(moved);
+    for (slot=0; slot<MOVED_MAX_DEVICES; slot++) {
+        if (moved->devs[slot] == NULL) {
+            break;
+        }
+    }
+
+    if (slot == MOVED_MAX_DEVICES) {
+        moved_unlock(moved);
+        LOG("No free slot for device %s\n", dev->serial);
+        psmove_dev_destroy(dev);
+        return -1;
+    }
+
+    /* Generation 0 addresses any device (see MOVED_DEVICE_ID) */
+    moved->generations[slot] = (moved->generations[slot] % 15) + 1;
+    dev->slot = slot;
+    moved->devs[slot] = dev;
+    if (slot >= moved->slots) {
+        moved->slots = slot + 1;
+    }
+
+#if defined(PSMOVE_USE_PTHREADS)
+    if (moved->socket != -1) {
+        psmove_dev_start(dev, moved);
+    }
+#endif
+    moved_unlock(moved);
+
+    LOG("New device %d (%s)\n", slot, dev->serial);
+    return slot;
 }
 
+void
+moved_remove_device(move_daemon *moved, int slot)
+{
+    psmove_dev *dev;
+
+    moved_lock(moved);
+    dev = moved->devs[slot];
+    moved->devs[slot] = NULL;
+    while (moved->slots > 0 && moved->devs[moved->slots-1] == NULL) {
+        moved->slots--;
+    }
+    moved_unlock(moved);
+
+    if (dev != NULL) {
+        LOG("Removed device %d (%s)\n", slot, dev->serial);
+        psmove_dev_destroy(dev);
+    }
+}
+
+psmove_dev *
+moved_find_device(move_daemon *moved, int device_id)
+{
+    int slot = MOVED_DEVICE_SLOT(device_id);
+    int generation = MOVED_DEVICE_GENERATION(device_id);
+
+    if (slot >= moved->slots) {
+        return NULL;
+    }
+
+    /* Requests for a replaced device must not reach its successor */
+    if (generation != 0 && generation != moved->generations[slot]) {
+        return NULL;
+    }
+
+    return moved->devs[slot];
+}
+
+void
+moved_set_output(move_daemon *moved, psmove_dev *dev,
+        const unsigned char *output)
+{
+    /* The slots are locked by the caller (see moved_writer_proc) */
+    psmove_dev_set_output(dev, output);
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_cond_signal(&(moved->cond));
+#endif
+}
 
 void
 moved_write_reports(move_daemon *moved)
 {
     psmove_dev *dev;
+    int slot;
 
-    for each(dev, moved->devs) {
+    for (slot=0; slot<moved->slots; slot++) {
         /* Send new outputs for devices with "dirty" output */
-        if (dev->dirty_output) {
+        dev = moved->devs[slot];
+        if (dev != NULL && dev->dirty_output) {
             _psmove_write_data(dev->move, dev->output, sizeof(dev->output));
             dev->dirty_output = 0;
+            dev->stats.writes++;
         }
     }
 }
@@ -220,11 +1178,30 @@ moved_write_reports(move_daemon *moved)
 void
 moved_destroy(move_daemon *moved)
 {
-    while (moved->devs != NULL) {
-        psmove_dev *next_dev = moved->devs->next;
-        psmove_dev_destroy(moved->devs);
-        moved->devs = next_dev;
+    int slot;
+
+#if defined(PSMOVE_USE_PTHREADS)
+    psmove_set_hotplug_callback(NULL, NULL);
+
+    if (moved->writer_running) {
+        moved_lock(moved);
+        moved->writer_running = 0;
+        pthread_cond_signal(&(moved->cond));
+        moved_unlock(moved);
+        pthread_join(moved->writer, NULL);
     }
+#endif
+
+    for (slot=0; slot<MOVED_MAX_DEVICES; slot++) {
+        if (moved->devs[slot] != NULL) {
+            psmove_dev_destroy(moved->devs[slot]);
+        }
+    }
+
+#if defined(PSMOVE_USE_PTHREADS)
+    moved_shm_destroy(moved->shm);
+    pthread_cond_destroy(&(moved->cond));
+    pthread_mutex_destroy(&(moved->mutex));
+#endif
     free(moved);
 }
-
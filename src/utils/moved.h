@@ -45,30 +45,122 @@
 #  include <netinet/in.h>
 #  include <sys/types.h>
 #  include <sys/socket.h>
+#  include <sys/select.h>
 #  include <fcntl.h>
 #endif
 
 #include "../daemon/psmove_moved_protocol.h"
+#include "../daemon/moved_compact.h"
+#include "../daemon/moved_shm.h"
 
 #include "psmove.h"
+#include "../psmove_private.h"
 
+#if defined(PSMOVE_USE_PTHREADS)
+#  include <pthread.h>
+#endif
+
+
+/* Number of clients remembered for MOVED_STATS_CLIENTS */
+#define MOVED_STATS_MAX_PEERS 32
+
+/* Rates are updated this often */
+#define MOVED_STATS_RATE_WINDOW_MS 1000
 
-#define each(name,set) (name=set; name; name=name->next)
+/* Events per second, measured over MOVED_STATS_RATE_WINDOW_MS */
+typedef struct {
+  long start_ms;
+  unsigned int count;
+  unsigned int rate; /* In 1/100 per second (see MOVED_STATS_REQUEST_RATE) */
+} moved_rate;
+
+/* Statistics of a device (see MOVED_REQ_STATS) */
+typedef struct {
+  moved_rate report_rate;
+  unsigned int latency_us[MOVED_STATS_LATENCY_SAMPLES]; /* Ring of samples */
+  unsigned int latencies; /* Number of samples taken */
+  PSMoveStats psmove; /* Updated whenever a report is read */
+  unsigned int writes;
+  unsigned int coalesced_writes;
+} psmove_dev_stats;
+
+/* A client (address and port) that sent requests (see MOVED_STATS_CLIENTS) */
+typedef struct {
+  struct sockaddr_in addr;
+  long seen_ms; /* 0 for unused entries */
+  unsigned int slots; /* Bit mask of the slots used by the client */
+} moved_peer;
 
 typedef struct _psmove_dev {
   PSMove *move;
+  char *serial;
+  int slot; /* Index in move_daemon's devs (see MOVED_DEVICE_SLOT) */
 
   unsigned char input[MOVED_SIZE_READ_RESPONSE];
   unsigned char output[7];
 
   int dirty_output;
 
-  struct _psmove_dev *next;
+  /* Subscriber of the input reports (see MOVED_REQ_SUBSCRIBE) */
+  int subscribed;
+  struct sockaddr_in subscriber;
+  long subscribed_ms;
+  int subscriber_format; /* MOVED_PUSH_INPUT, _COMPACT or _STATE */
+  moved_compact_state subscriber_state;
+  int subscriber_timestamps; /* Append capture times (see MOVED_SIZE_TIMESTAMP) */
+  unsigned int push_seq; /* Sequence number of the last report read */
+  long long input_time_us; /* Capture time of the last report read */
+
+  moved_compact_state multicast_state; /* See MOVED_MULTICAST_ENV */
+
+  /* Report counters are protected by mutex, write counters by moved's */
+  psmove_dev_stats stats;
+
+#if defined(PSMOVE_USE_PTHREADS)
+  /* Reader thread caching the latest input report in "input" */
+  pthread_t reader;
+  pthread_mutex_t mutex; /* Protects input, push_seq and the subscription */
+  int reader_running;
+  int input_fresh; /* "input" has not yet been returned by a READ request */
+  int socket; /* Server socket used for pushing reports */
+  const struct sockaddr_in *multicast; /* Group to publish to, or NULL */
+  moved_shm_segment *shm; /* Shared memory to write reports to, or NULL */
+#endif
 } psmove_dev;
 
 
 typedef struct _move_daemon {
-    psmove_dev *devs;
+    /* Connected devices by slot, NULL for free slots */
+    psmove_dev *devs[MOVED_MAX_DEVICES];
+    /* Generation of each slot, bumped when a new device takes it */
+    unsigned char generations[MOVED_MAX_DEVICES];
+    /* Number of slots up to the last one in use */
+    int slots;
+
+    /* Group that all reports are published to (see MOVED_MULTICAST_ENV) */
+    int multicast;
+    struct sockaddr_in multicast_addr;
+
+    /* Compute the orientation of all devices (see MOVED_ORIENTATION_ENV) */
+    int orientation;
+
+    /* Reports for clients on this host (see moved_shm.h), or NULL */
+    moved_shm_segment *shm;
+
+    /* Server-wide statistics (see MOVED_REQ_STATS) */
+    long started_ms;
+    unsigned int requests;
+    moved_rate request_rate;
+    moved_peer peers[MOVED_STATS_MAX_PEERS];
+
+#if defined(PSMOVE_USE_PTHREADS)
+    /* Writer thread flushing dirty outputs as soon as they arrive */
+    pthread_t writer;
+    pthread_mutex_t mutex; /* Protects the slots and the outputs */
+    pthread_cond_t cond;
+    int writer_running;
+    int socket; /* Server socket once started, -1 before */
+#endif
 } move_daemon;
 
 
@@ -87,6 +179,32 @@ moved_server_create();
 void
 moved_server_handle_request(moved_server *server);
 
+int
+moved_server_wait(moved_server *server);
+
+void
+moved_server_push_reports(moved_server *server);
+
+void
+moved_server_pack_report(psmove_dev *dev, int device_id, unsigned char *entry);
+
+int
+moved_server_pack_push(psmove_dev *dev, int device_id, int format,
+        moved_compact_state *compact, unsigned char *push);
+
+int
+moved_server_pack_state(psmove_dev *dev, int device_id, unsigned char *push);
+
+int
+moved_server_pack_timestamp(psmove_dev *dev, unsigned char *push, int len);
+
+int
+moved_server_pack_stats(move_daemon *moved, psmove_dev *dev, int device_id,
+        unsigned char *response);
+
+void
+moved_server_start(moved_server *server);
+
 void
 moved_server_destroy(moved_server *server);
 
@@ -94,11 +212,17 @@ moved_server_destroy(moved_server *server);
 /* psmove_dev */
 
 psmove_dev *
-psmove_dev_create(int id);
+psmove_dev_create(PSMove *move);
 
 void
 psmove_dev_set_output(psmove_dev *dev, const unsigned char *output);
 
+int
+psmove_dev_poll(psmove_dev *dev);
+
+void
+psmove_dev_account_report(psmove_dev *dev);
+
 void
 psmove_dev_destroy(psmove_dev *dev);
 
@@ -111,6 +235,19 @@ moved_init();
 void
 moved_handle_connection(move_daemon *moved, int id);
 
+int
+moved_add_device(move_daemon *moved, PSMove *move);
+
+void
+moved_remove_device(move_daemon *moved, int slot);
+
+psmove_dev *
+moved_find_device(move_daemon *moved, int device_id);
+
+void
+moved_set_output(move_daemon *moved, psmove_dev *dev,
+        const unsigned char *output);
+
 void
 moved_write_reports(move_daemon *moved);
 
@@ -0,0 +1,114 @@
+
+ /**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2011, 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+
+/**
+ * Print the statistics of moved hosts (see MOVED_REQ_STATS), one line for
+ * each host and one for each of its devices. The exit status is nonzero if
+ * a host did not answer, so this can be used for health checks.
+ **/
+
+#include <stdio.h>
+
+#include "../daemon/moved_client.h"
+
+
+static void
+print_rate(const char *name, unsigned int rate)
+{
+    printf(" %s=%u.%02u", name, rate / 100, rate % 100);
+}
+
+static int
+print_stats(const char *hostname)
+{
+    unsigned int stats[MOVED_STATS_COUNT];
+    moved_client *client = moved_client_create(hostname);
+    int i, count;
+
+    if (client == NULL) {
+        return 0;
+    }
+
+    if (moved_client_get_stats(client, 0, stats) == -1) {
+        printf("%s: no answer\n", hostname);
+        moved_client_destroy(client);
+        return 0;
+    }
+
+    printf("%s: uptime=%us requests=%u", hostname,
+            stats[MOVED_STATS_UPTIME_S], stats[MOVED_STATS_REQUESTS]);
+    print_rate("requests/s", stats[MOVED_STATS_REQUEST_RATE]);
+    printf(" clients=%u devices=%u pending_outputs=%u\n",
+            stats[MOVED_STATS_CLIENTS], stats[MOVED_STATS_DEVICES],
+            stats[MOVED_STATS_PENDING_OUTPUTS]);
+
+    /* The response to the count lists the ids of the devices */
+    count = moved_client_send(client, MOVED_REQ_COUNT_CONNECTED, 0, NULL);
+
+    for (i=0; i<count; i++) {
+        int id = moved_client_device_id(client, i);
+        if (moved_client_get_stats(client, id, stats) != 1) {
+            continue;
+        }
+
+        printf("%s: device %d: reports=%u", hostname, MOVED_DEVICE_SLOT(id),
+                stats[MOVED_STATS_REPORTS]);
+        print_rate("reports/s", stats[MOVED_STATS_REPORT_RATE]);
+        printf(" latency_us=%u/%u/%u writes=%u coalesced=%u dropped=%u"
+                " queued=%u clients=%u subscribed=%u\n",
+                stats[MOVED_STATS_LATENCY_P50], stats[MOVED_STATS_LATENCY_P95],
+                stats[MOVED_STATS_LATENCY_P99], stats[MOVED_STATS_WRITES],
+                stats[MOVED_STATS_COALESCED_WRITES],
+                stats[MOVED_STATS_DROPPED_REPORTS],
+                stats[MOVED_STATS_QUEUED_REPORTS],
+                stats[MOVED_STATS_DEVICE_CLIENTS],
+                stats[MOVED_STATS_SUBSCRIBED]);
+    }
+
+    moved_client_destroy(client);
+    return 1;
+}
+
+int main(int argc, char *argv[])
+{
+    int i, result = 0;
+
+    if (argc < 2) {
+        return print_stats("127.0.0.1") ? 0 : 1;
+    }
+
+    for (i=1; i<argc; i++) {
+        if (!print_stats(argv[i])) {
+            result = 1;
+        }
+    }
+
+    return result;
+}
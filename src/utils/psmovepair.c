@@ -33,10 +33,231 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "psmove.h"
 #include "../psmove_private.h"
 
+#if defined(PSMOVE_USE_PTHREADS)
+#  include <pthread.h>
+#endif
+
+#if defined(__linux)
+#  include <errno.h>
+#  include <sys/stat.h>
+#endif
+
+/* Maximum number of host adapters used by the mass-pair mode */
+#define PSMOVEPAIR_MAX_HOSTS 16
+
+/* Active connections per adapter (Bluetooth piconet limit) */
+#define PSMOVEPAIR_CONNECTIONS_PER_HOST 7
+
+/* One USB-connected controller in the mass-pair mode */
+typedef struct {
+    PSMove *move;
+    int host; /* index of the assigned host address */
+    PSMove_Data_BTAddr controller;
+    int paired;
+    int calibrated;
+#if defined(PSMOVE_USE_PTHREADS)
+    pthread_t thread;
+    int thread_started;
+#endif
+} PSMovePair_Job;
+
+static PSMove_Data_BTAddr hosts[PSMOVEPAIR_MAX_HOSTS];
+
+/* Formats an address in the order of _psmove_btaddr_from_string() */
+static void
+format_host_addr(const PSMove_Data_BTAddr addr, char *dest)
+{
+    sprintf(dest, "%02X:%02X:%02X:%02X:%02X:%02X",
+            addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+}
+
+/* Formats an address as read by _psmove_read_btaddrs() */
+static void
+format_controller_addr(const PSMove_Data_BTAddr addr, char *dest)
+{
+    sprintf(dest, "%02X:%02X:%02X:%02X:%02X:%02X",
+            addr[5], addr[4], addr[3], addr[2], addr[1], addr[0]);
+}
+
+/**
+ * Pair one controller: Everything here only talks to this controller's
+ * USB device, so the jobs of all controllers can run at the same time.
+ * Reading the calibration data is the slow part.
+ **/
+static void *
+pair_job(void *data)
+{
+    PSMovePair_Job *job = (PSMovePair_Job *)data;
+
+    if (_psmove_read_btaddrs(job->move, NULL, &(job->controller))) {
+        job->paired = psmove_set_btaddr(job->move, &(hosts[job->host]));
+    }
+    job->calibrated = psmove_has_calibration(job->move);
+
+    return NULL;
+}
+
+#if defined(__linux)
+/**
+ * Make BlueZ (5.x) accept incoming connections from the controller,
+ * by adding it as a trusted HID device of the host adapter. Returns
+ * nonzero on success (needs root, bluetoothd reads it when restarted).
+ **/
+static int
+register_with_bluez(const char *host, const char *controller)
+{
+    char path[256];
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "/var/lib/bluetooth/%s/%s", host, controller);
+    if (mkdir(path, 0700) != 0 && errno != EEXIST) {
+        return 0;
+    }
+
+    strncat(path, "/info", sizeof(path) - strlen(path) - 1);
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        return 0;
+    }
+
+    fprintf(fp, "[General]\n"
+            "Name=Motion Controller\n"
+            "Class=0x002508\n"
+            "SupportedTechnologies=BR/EDR;\n"
+            "Trusted=true\n"
+            "Blocked=false\n"
+            "Services=00001124-0000-1000-8000-00805f9b34fb;\n"
+            "\n"
+            "[DeviceID]\n"
+            "Source=1\n"
+            "Vendor=1356\n"
+            "Product=981\n"
+            "Version=1\n");
+
+    return fclose(fp) == 0;
+}
+#endif
+
+/**
+ * Pair all USB-connected controllers at once, distributed over all
+ * host adapters (or the given addresses), and register them in one go.
+ **/
+static int
+mass_pair(int host_count)
+{
+    int count = psmove_count_connected();
+    PSMovePair_Job *jobs = calloc(count > 0 ? count : 1, sizeof(PSMovePair_Job));
+    int jobs_count = 0;
+    int result = 0;
+    int i;
+
+    if (host_count == 0) {
+        host_count = _psmove_get_host_btaddrs(hosts, PSMOVEPAIR_MAX_HOSTS);
+    }
+
+    if (host_count == 0) {
+        printf("No Bluetooth adapter found.\n");
+        free(jobs);
+        return 1;
+    }
+
+    printf("Connected controllers: %d, host adapters: %d\n", count, host_count);
+
+    for (i=0; i<count; i++) {
+        PSMove *move = psmove_connect_by_id(i);
+
+        if (move == NULL) {
+            printf("Error connecting to PSMove #%d\n", i+1);
+            result = 1;
+            continue;
+        }
+
+        if (psmove_connection_type(move) == Conn_Bluetooth) {
+            psmove_disconnect(move);
+            continue;
+        }
+
+        /* Round-robin, so the connections are spread over the adapters */
+        jobs[jobs_count].move = move;
+        jobs[jobs_count].host = jobs_count % host_count;
+        jobs_count++;
+    }
+
+    if (jobs_count > host_count * PSMOVEPAIR_CONNECTIONS_PER_HOST) {
+        printf("Warning: Only %d controllers can be connected at the same "
+                "time with %d adapter(s).\n",
+                host_count * PSMOVEPAIR_CONNECTIONS_PER_HOST, host_count);
+    }
+
+#if defined(PSMOVE_USE_PTHREADS)
+    for (i=0; i<jobs_count; i++) {
+        jobs[i].thread_started = (pthread_create(&(jobs[i].thread), NULL,
+                    pair_job, &(jobs[i])) == 0);
+        if (!jobs[i].thread_started) {
+            pair_job(&(jobs[i]));
+        }
+    }
+
+    for (i=0; i<jobs_count; i++) {
+        if (jobs[i].thread_started) {
+            pthread_join(jobs[i].thread, NULL);
+        }
+    }
+#else
+    for (i=0; i<jobs_count; i++) {
+        pair_job(&(jobs[i]));
+    }
+#endif
+
+    int paired = 0;
+    int registered = 0;
+    for (i=0; i<jobs_count; i++) {
+        char host[18], controller[18];
+
+        format_host_addr(hosts[jobs[i].host], host);
+        format_controller_addr(jobs[i].controller, controller);
+
+        if (jobs[i].paired) {
+            paired++;
+            printf("PSMove %s paired with %s%s\n", controller, host,
+                    jobs[i].calibrated ? "" : " (no calibration data)");
+#if defined(__linux)
+            if (register_with_bluez(host, controller)) {
+                registered++;
+            }
+#endif
+        } else {
+            printf("PSMove #%d: Pairing failed.\n", i+1);
+            result = 1;
+        }
+
+        psmove_disconnect(jobs[i].move);
+    }
+
+#if defined(__linux)
+    if (registered > 0) {
+        /* bluetoothd only reads the devices on startup, so restart it once */
+        printf("Registered %d controller(s) with BlueZ, restarting bluetoothd.\n",
+                registered);
+        if (system("systemctl restart bluetooth.service") != 0) {
+            printf("Could not restart bluetoothd, please restart it manually.\n");
+        }
+    } else if (jobs_count > 0) {
+        printf("Controllers not registered with BlueZ (needs root).\n");
+    }
+#endif
+
+    printf("Paired %d of %d controller(s).\n", paired, jobs_count);
+
+    free(jobs);
+    return result;
+}
+
 int main(int argc, char* argv[])
 {
     PSMove *move;
@@ -45,6 +266,19 @@ int main(int argc, char* argv[])
     int result = 0;
     int custom_addr = 0;
 
+    if (argc > 1 && strcmp(argv[1], "--all") == 0) {
+        int host_count = 0;
+
+        for (i=2; i<argc && host_count<PSMOVEPAIR_MAX_HOSTS; i++) {
+            if (!_psmove_btaddr_from_string(argv[i], &(hosts[host_count++]))) {
+                printf("Cannot convert host address: %s\n", argv[i]);
+                return 1;
+            }
+        }
+
+        return mass_pair(host_count);
+    }
+
     if (argc > 1) {
         if (_psmove_btaddr_from_string(argv[1], NULL)) {
             printf("Using user-supplied host address: %s\n", argv[1]);
@@ -0,0 +1,371 @@
+
+ /**
+ * PS Move API - An interface for the PS Move Motion Controller
+ * Copyright (c) 2011, 2012 Thomas Perl <m@thp.io>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in the
+ *       documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ **/
+
+
+/**
+ * Expose each controller as a virtual input device via Linux uinput, so
+ * it can be used as a mouse or gamepad by any application (X11, Wayland
+ * or the console). The reports are read in the background (see
+ * psmove_enable_input_thread()) and the events are written as soon as a
+ * report arrives, one write() per report.
+ **/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/input.h>
+#include <linux/uinput.h>
+
+#include "psmove.h"
+
+/* psmove_poll_all() handles at most 32 controllers */
+#define PSMOVEUINPUT_MAX_CONTROLLERS 32
+
+/* Time between two half-frames of a report (in seconds) */
+#define PSMOVEUINPUT_HALF_FRAME_S (1.f / 120.f)
+
+/* Default pointer speed of the mouse mode (pixels per radian) */
+#define PSMOVEUINPUT_DEFAULT_SPEED 800.f
+
+/* Rotation (in radians) for a full deflection of the gamepad axes */
+#define PSMOVEUINPUT_GAMEPAD_RANGE 0.6f
+
+/* Maximum value of the gamepad axes */
+#define PSMOVEUINPUT_AXIS_MAX 32767
+
+enum PSMoveUinput_Mode {
+    Mode_Mouse,
+    Mode_Gamepad,
+};
+
+/* The event codes of a button in both modes (0 = not mapped) */
+static const struct {
+    unsigned int button;
+    int mouse;
+    int gamepad;
+} button_map[] = {
+    { Btn_CROSS, BTN_LEFT, BTN_A },
+    { Btn_MOVE, BTN_MIDDLE, BTN_THUMBL },
+    { Btn_CIRCLE, BTN_RIGHT, BTN_B },
+    { Btn_SQUARE, KEY_LEFT, BTN_Y },
+    { Btn_TRIANGLE, KEY_RIGHT, BTN_X },
+    { Btn_SELECT, KEY_ESC, BTN_SELECT },
+    { Btn_START, KEY_ENTER, BTN_START },
+    { Btn_T, KEY_LEFTALT, BTN_TR2 },
+    { Btn_PS, 0, BTN_MODE },
+};
+
+#define BUTTON_MAP_SIZE (sizeof(button_map) / sizeof(button_map[0]))
+
+typedef struct {
+    PSMove *move;
+    int fd; /* the uinput device */
+    int has_motion; /* nonzero if calibrated gyroscope data is available */
+
+    /* Mouse mode: sub-pixel motion not sent yet */
+    float rest_x, rest_y;
+    int locked; /* pointer locked with the PS button */
+
+    /* Gamepad mode: rotation since the last recentering (radians) */
+    float yaw, pitch;
+} PSMoveUinput_Device;
+
+static volatile sig_atomic_t quit = 0;
+
+static void
+on_signal(int sig)
+{
+    quit = 1;
+}
+
+static float
+clamp(float v, float min, float max)
+{
+    return (v < min) ? min : ((v > max) ? max : v);
+}
+
+static int
+uinput_open(enum PSMoveUinput_Mode mode, int index)
+{
+    struct uinput_user_dev dev;
+    unsigned int i;
+    int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    ioctl(fd, UI_SET_EVBIT, EV_KEY);
+    for (i=0; i<BUTTON_MAP_SIZE; i++) {
+        int code = (mode == Mode_Mouse) ? button_map[i].mouse :
+            button_map[i].gamepad;
+        if (code) {
+            ioctl(fd, UI_SET_KEYBIT, code);
+        }
+    }
+
+    memset(&dev, 0, sizeof(dev));
+
+    if (mode == Mode_Mouse) {
+        ioctl(fd, UI_SET_EVBIT, EV_REL);
+        ioctl(fd, UI_SET_RELBIT, REL_X);
+        ioctl(fd, UI_SET_RELBIT, REL_Y);
+        snprintf(dev.name, UINPUT_MAX_NAME_SIZE, "PS Move Mouse %d", index + 1);
+    } else {
+        ioctl(fd, UI_SET_EVBIT, EV_ABS);
+        ioctl(fd, UI_SET_ABSBIT, ABS_X);
+        ioctl(fd, UI_SET_ABSBIT, ABS_Y);
+        ioctl(fd, UI_SET_ABSBIT, ABS_Z);
+        dev.absmin[ABS_X] = dev.absmin[ABS_Y] = -PSMOVEUINPUT_AXIS_MAX;
+        dev.absmax[ABS_X] = dev.absmax[ABS_Y] = PSMOVEUINPUT_AXIS_MAX;
+        dev.absmin[ABS_Z] = 0;
+        dev.absmax[ABS_Z] = 255;
+        snprintf(dev.name, UINPUT_MAX_NAME_SIZE, "PS Move Gamepad %d", index + 1);
+    }
+
+    /* Sony Corp. / Motion Controller */
+    dev.id.bustype = BUS_VIRTUAL;
+    dev.id.vendor = 0x054c;
+    dev.id.product = 0x03d5;
+    dev.id.version = 1;
+
+    if (write(fd, &dev, sizeof(dev)) != sizeof(dev) ||
+            ioctl(fd, UI_DEV_CREATE) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void
+uinput_close(int fd)
+{
+    ioctl(fd, UI_DEV_DESTROY);
+    close(fd);
+}
+
+static void
+add_event(struct input_event *events, int *count, int type, int code, int value)
+{
+    memset(&events[*count], 0, sizeof(struct input_event));
+    events[*count].type = type;
+    events[*count].code = code;
+    events[*count].value = value;
+    (*count)++;
+}
+
+/* Convert the current report of a controller to input events */
+static void
+process_report(PSMoveUinput_Device *dev, enum PSMoveUinput_Mode mode,
+        float speed)
+{
+    struct input_event events[BUTTON_MAP_SIZE + 4];
+    int count = 0;
+    unsigned int pressed, released;
+    unsigned int i;
+
+    psmove_get_button_events(dev->move, &pressed, &released);
+
+    for (i=0; i<BUTTON_MAP_SIZE; i++) {
+        int code = (mode == Mode_Mouse) ? button_map[i].mouse :
+            button_map[i].gamepad;
+        if (code && (pressed & button_map[i].button)) {
+            add_event(events, &count, EV_KEY, code, 1);
+        } else if (code && (released & button_map[i].button)) {
+            add_event(events, &count, EV_KEY, code, 0);
+        }
+    }
+
+    /* Rotation around the vertical (z) and horizontal (x) axis */
+    float yaw = 0.f, pitch = 0.f;
+    if (dev->has_motion) {
+        enum PSMove_Frame frame;
+        for (frame=Frame_FirstHalf; frame<=Frame_SecondHalf; frame++) {
+            float gx, gy, gz;
+            psmove_get_gyroscope_frame(dev->move, frame, &gx, &gy, &gz);
+            yaw -= gz * PSMOVEUINPUT_HALF_FRAME_S;
+            pitch -= gx * PSMOVEUINPUT_HALF_FRAME_S;
+        }
+    }
+
+    if (mode == Mode_Mouse) {
+        /**
+         * Special functions (useful for presentations):
+         *  - PS button ..... toggle mouse position locking
+         **/
+        if (pressed & Btn_PS) {
+            dev->locked = !dev->locked;
+            dev->rest_x = dev->rest_y = 0.f;
+        }
+
+        if (!dev->locked) {
+            /* Keep the fractions, so slow movements are not lost */
+            float x = dev->rest_x + yaw * speed;
+            float y = dev->rest_y + pitch * speed;
+            int dx = (int)x, dy = (int)y;
+            dev->rest_x = x - dx;
+            dev->rest_y = y - dy;
+
+            if (dx) {
+                add_event(events, &count, EV_REL, REL_X, dx);
+            }
+            if (dy) {
+                add_event(events, &count, EV_REL, REL_Y, dy);
+            }
+        }
+    } else {
+        /* The PS button recenters the axes at the current orientation */
+        if (pressed & Btn_PS) {
+            dev->yaw = dev->pitch = 0.f;
+        }
+
+        dev->yaw = clamp(dev->yaw + yaw, -PSMOVEUINPUT_GAMEPAD_RANGE,
+                PSMOVEUINPUT_GAMEPAD_RANGE);
+        dev->pitch = clamp(dev->pitch + pitch, -PSMOVEUINPUT_GAMEPAD_RANGE,
+                PSMOVEUINPUT_GAMEPAD_RANGE);
+
+        /* uinput drops values that didn't change */
+        add_event(events, &count, EV_ABS, ABS_X,
+                (int)(dev->yaw / PSMOVEUINPUT_GAMEPAD_RANGE * PSMOVEUINPUT_AXIS_MAX));
+        add_event(events, &count, EV_ABS, ABS_Y,
+                (int)(dev->pitch / PSMOVEUINPUT_GAMEPAD_RANGE * PSMOVEUINPUT_AXIS_MAX));
+        add_event(events, &count, EV_ABS, ABS_Z, psmove_get_trigger(dev->move));
+    }
+
+    if (count == 0) {
+        return;
+    }
+
+    add_event(events, &count, EV_SYN, SYN_REPORT, 0);
+    if (write(dev->fd, events, count * sizeof(struct input_event)) < 0) {
+        fprintf(stderr, "Cannot write events to uinput device.\n");
+    }
+}
+
+static void
+usage(const char *progname)
+{
+    fprintf(stderr, "Usage: %s [--mouse | --gamepad] [--speed <pixels per radian>]\n",
+            progname);
+}
+
+int
+main(int argc, char *argv[])
+{
+    PSMoveUinput_Device devices[PSMOVEUINPUT_MAX_CONTROLLERS];
+    PSMove *moves[PSMOVEUINPUT_MAX_CONTROLLERS];
+    enum PSMoveUinput_Mode mode = Mode_Mouse;
+    float speed = PSMOVEUINPUT_DEFAULT_SPEED;
+    int count = 0;
+    int i;
+
+    for (i=1; i<argc; i++) {
+        if (strcmp(argv[i], "--mouse") == 0) {
+            mode = Mode_Mouse;
+        } else if (strcmp(argv[i], "--gamepad") == 0) {
+            mode = Mode_Gamepad;
+        } else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            speed = atof(argv[++i]);
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int connected = psmove_count_connected();
+    if (connected > PSMOVEUINPUT_MAX_CONTROLLERS) {
+        connected = PSMOVEUINPUT_MAX_CONTROLLERS;
+    }
+
+    for (i=0; i<connected; i++) {
+        PSMoveUinput_Device *dev = &devices[count];
+        memset(dev, 0, sizeof(*dev));
+
+        dev->move = psmove_connect_by_id(i);
+        if (dev->move == NULL) {
+            fprintf(stderr, "Cannot connect to PSMove #%d.\n", i + 1);
+            continue;
+        }
+
+        dev->fd = uinput_open(mode, count);
+        if (dev->fd < 0) {
+            fprintf(stderr, "Cannot create uinput device (is the uinput "
+                    "module loaded, and is /dev/uinput writable?)\n");
+            psmove_disconnect(dev->move);
+            break;
+        }
+
+        dev->has_motion = psmove_has_calibration(dev->move);
+        if (!dev->has_motion) {
+            fprintf(stderr, "PSMove #%d: Calibration data not found, only "
+                    "buttons are available. Pair using USB first.\n", i + 1);
+        }
+
+        /* Events are sent as soon as the reader thread receives a report */
+        psmove_enable_input_thread(dev->move, PSMove_True);
+        moves[count++] = dev->move;
+    }
+
+    if (count == 0) {
+        fprintf(stderr, "No controllers available.\n");
+        return 1;
+    }
+
+    printf("Exposing %d controller(s) as %s.\n", count,
+            (mode == Mode_Mouse) ? "mouse" : "gamepad");
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    while (!quit) {
+        /* The timeout is only used to check for the signals */
+        unsigned int ready = psmove_poll_all(moves, count, 500);
+
+        for (i=0; i<count; i++) {
+            if (ready & (1 << i)) {
+                /* Handle all reports queued since the last wakeup */
+                do {
+                    process_report(&devices[i], mode, speed);
+                } while (psmove_poll(devices[i].move));
+            }
+        }
+    }
+
+    for (i=0; i<count; i++) {
+        uinput_close(devices[i].fd);
+        psmove_disconnect(devices[i].move);
+    }
+
+    return 0;
+}